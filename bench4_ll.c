@@ -0,0 +1,1783 @@
+/*  Copyright (C) 2013  P.D. Buchan (pdbuchan@yahoo.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Benchmark the ways these examples build IPv4 frames, compute checksums, and send
+// frames via raw socket at the link layer (ethernet frame).
+// Three parts, each of which may be left out:
+//  1. Microbenchmarks, in memory only: the checksum functions and frame builders
+//     copied from the other examples, over payloads from 64 bytes to 64 kB, including
+//     odd lengths. Each is timed in several repeats; the fastest and the median are reported.
+//  2. Send path: frames sent as fast as possible to an interface which discards them
+//     (a null sink), with sendto(), with sendmmsg(), and with sendmmsg() bypassing the
+//     queueing discipline.
+//  3. End to end: frames sent to one end of a veth pair and received, by a packet socket
+//     opened in the network namespace of the other end. Throughput (packets per second
+//     received, and losses), then latency (one frame at a time, sender to receiver).
+// Results are written to stdout, one JSON object per line, for tracking from run to run;
+// progress messages go to stderr. Link with -lpthread.
+// The copies of checksum(), tcp4_checksum() etc. below are those of tr4_ll.c, and
+// sum_bytes() and fold_sum() those of udp4_stream_ll.c; keep them in step when changing those.
+
+#define _GNU_SOURCE           // sendmmsg(), recvmmsg() and struct mmsghdr
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>           // close()
+#include <string.h>           // strcpy, memset(), and memcpy()
+
+#include <sys/types.h>        // needed for socket(), uint8_t, uint16_t, uint32_t
+#include <sys/socket.h>       // needed for socket(), sendmmsg(), recvmmsg()
+#include <netinet/in.h>       // IPPROTO_TCP, IPPROTO_UDP, IPPROTO_ICMP, INET_ADDRSTRLEN
+#include <netinet/ip.h>       // struct ip and IP_MAXPACKET (which is 65535)
+#include <netinet/ip_icmp.h>  // struct icmp, ICMP_ECHO
+#define __FAVOR_BSD           // Use BSD format of tcp header
+#include <netinet/tcp.h>      // struct tcphdr
+#include <netinet/udp.h>      // struct udphdr
+#include <arpa/inet.h>        // inet_pton() and inet_ntop()
+#include <sys/ioctl.h>        // macro ioctl is defined
+#include <bits/ioctls.h>      // defines values for argument "request" of ioctl.
+#include <net/if.h>           // struct ifreq
+#include <linux/if_ether.h>   // ETH_P_IP = 0x0800, ETH_P_IPV6 = 0x86DD
+#include <linux/if_packet.h>  // struct sockaddr_ll (see man 7 packet), PACKET_QDISC_BYPASS
+#include <net/ethernet.h>
+#include <time.h>             // clock_gettime(), time()
+#include <signal.h>           // signal(), SIGINT
+#include <sched.h>            // setns()
+#include <fcntl.h>            // open()
+#include <poll.h>             // poll()
+#include <pthread.h>          // pthread_create(), pthread_join() (link with -lpthread)
+
+#include <errno.h>            // errno, perror()
+
+// Define some constants.
+#define ETH_HDRLEN 14         // Ethernet header length
+#define IP4_HDRLEN 20         // IPv4 header length
+#define TCP_HDRLEN 20         // TCP header length, excludes options data
+#define UDP_HDRLEN  8         // UDP header length, excludes data
+#define ICMP_HDRLEN 8         // ICMP header length for echo request, excludes data
+#define HDRS_LEN (ETH_HDRLEN + IP4_HDRLEN + UDP_HDRLEN)  // Length of all headers in front of a UDP payload
+#define MAX_L4_PAYLOAD (IP_MAXPACKET - IP4_HDRLEN - TCP_HDRLEN)  // Largest payload the frame builders take
+#define MAX_FRAMELEN (ETH_HDRLEN + IP_MAXPACKET)  // Largest frame built or received
+#define MIN_FRAMELEN 60       // Shortest ethernet frame, without frame check sequence
+#define BATCH 64              // Frames handed to sendmmsg() or taken from recvmmsg() at once
+#define REPEATS 5             // Timed repeats of each microbenchmark
+#define CALIBRATE_NS 10000000L  // Iterations are doubled until a run takes this long (ns),
+#define REPEAT_NS 50000000L   // then scaled so that each repeat takes about this long (ns)
+#define SEND_NS 1000000000L   // Duration of each send-path and end-to-end throughput run (ns)
+#define DRAIN_MS 100          // Time allowed for the last frames to arrive after sending stops (ms)
+#define LAT_SAMPLES 10000     // Frames sent one at a time for each end-to-end latency run
+#define LAT_TIMEOUT_MS 100    // A frame not received within this time (ms) is counted as lost
+#define STAMP_LEN 16          // Sequence number and send time (ns) at the start of end-to-end payloads
+#define BENCH_PORT 9          // UDP destination port of frames sent (discard)
+
+// Microbenchmarks
+#define OP_CHECKSUM 0         // checksum() over the payload, as used for every header in these examples
+#define OP_SUM_BYTES 1        // sum_bytes() and fold_sum() over the payload
+#define OP_SUM_BYTES_UNALIGNED 2  // The same, starting at an odd address
+#define OP_CSUM_UPDATE 3      // Incremental update of a checksum for a changed IPv4 address (RFC 1624)
+#define OP_TCP4_CHECKSUM 4    // tcp4_checksum(): pseudo-header, header and payload copied, then summed
+#define OP_UDP4_CHECKSUM 5    // udp4_checksum()
+#define OP_ICMP4_CHECKSUM 6   // icmp4_checksum()
+#define OP_CREATE_TCP 7       // create_tcp_frame(): whole frame built field by field
+#define OP_CREATE_UDP 8       // create_udp_frame()
+#define OP_CREATE_ICMP 9      // create_icmp_frame()
+#define OP_TEMPLATE_UDP 10    // template_frame(): headers copied from a template, checksums from partial sums
+#define NUM_OPS 11
+
+// Send-path methods
+#define SEND_SENDTO 0         // One frame per call to sendto()
+#define SEND_SENDMMSG 1       // BATCH frames per call to sendmmsg()
+#define SEND_QDISC_BYPASS 2   // BATCH frames per call to sendmmsg(), with PACKET_QDISC_BYPASS
+#define NUM_METHODS 3
+
+// Define a struct for the results of timing one microbenchmark.
+typedef struct _timing timing;
+struct _timing {
+  long int iterations;  // Operations in each repeat
+  double min;           // Fastest repeat (ns per operation)
+  double median;        // Median repeat (ns per operation)
+};
+
+// Define a struct for a template of ethernet, IPv4 and UDP headers, with partial checksums
+// over the fields which never change, as in udp4_stream_ll.c.
+typedef struct _udp_template udp_template;
+struct _udp_template {
+  uint8_t hdrs[HDRS_LEN];  // Headers, with lengths, IP ID and checksums zero
+  uint32_t ip_sum0;     // Sum over the IPv4 header
+  uint32_t udp_sum0;    // Sum over pseudo-header addresses and protocol, and ports
+};
+
+// Define a struct for what the microbenchmarks work on.
+typedef struct _bench_ctx bench_ctx;
+struct _bench_ctx {
+  uint8_t *data;        // Payload (one spare byte at the end for OP_SUM_BYTES_UNALIGNED)
+  uint8_t *frame;       // Frame being built
+  char *src_ip;         // Addresses given to the frame builders
+  char *dst_ip;
+  uint8_t *src_mac;
+  uint8_t *dst_mac;
+  struct ip iphdr;      // Headers given to the pseudo-header checksum functions
+  struct tcphdr tcphdr;
+  struct udphdr udphdr;
+  struct icmp icmphdr;
+  udp_template tmpl;    // Template for OP_TEMPLATE_UDP
+};
+
+// Define a struct for the receiving thread of an end-to-end throughput run.
+typedef struct _e2e_rx e2e_rx;
+struct _e2e_rx {
+  int rd;               // Packet socket on the veth peer
+  udp_template *tmpl;   // Frames counted are those with the addresses and ports of this template
+  uint8_t *frames;      // Room for BATCH frames of MAX_FRAMELEN bytes
+  volatile int done;    // Set by the sending thread when the last frames should have arrived
+  long int received;    // Frames of ours received
+  uint64_t bytes;       // Their total length
+};
+
+// Function prototypes
+uint32_t run_op (bench_ctx *, int, int, long int);
+void time_op (bench_ctx *, int, int, timing *);
+void template_init (udp_template *, uint8_t *, uint8_t *, char *, char *);
+int template_frame (udp_template *, uint8_t *, uint8_t *, int, uint16_t);
+int interface_mac (int, char *, uint8_t *);
+int rx_open (char *, char *, uint8_t *);
+int rx_match (udp_template *, uint8_t *, int, uint64_t *, uint64_t *);
+void *rx_thread (void *);
+void bench_send (int, int, char *, int, udp_template *, uint8_t *, int);
+void bench_throughput (int, char *, int, int, udp_template *, uint8_t *, int);
+void bench_latency (int, char *, int, int, udp_template *, uint8_t *, int);
+uint64_t now_ns (void);
+int cmp_double (const void *, const void *);
+int cmp_u64 (const void *, const void *);
+int create_tcp_frame (uint8_t *, char *, char *, uint8_t *, uint8_t *, int, uint8_t *, int);
+int create_icmp_frame (uint8_t *, char *, char *, uint8_t *, uint8_t *, int, uint8_t *, int);
+int create_udp_frame (uint8_t *, char *, char *, uint8_t *, uint8_t *, int, uint8_t *, int);
+uint16_t checksum (uint16_t *, int);
+uint16_t tcp4_checksum (struct ip, struct tcphdr, uint8_t *, int);
+uint16_t icmp4_checksum (struct icmp, uint8_t *, int);
+uint16_t udp4_checksum (struct ip, struct udphdr, uint8_t *, int);
+uint32_t sum_bytes (uint32_t, uint8_t *, int);
+uint16_t fold_sum (uint32_t);
+uint16_t csum_update32 (uint16_t, uint32_t, uint32_t);
+void sig_handler (int);
+char *allocate_strmem (int);
+uint8_t *allocate_ustrmem (int);
+int *allocate_intmem (int);
+
+// Set by SIGINT handler to stop after the current benchmark.
+volatile sig_atomic_t stop = 0;
+
+// Results of microbenchmarks are added here, so the compiler cannot leave out the work.
+volatile uint32_t sink_sum = 0;
+
+int
+main (int argc, char **argv)
+{
+  int i, op, size, sd, index, micro, send_path, end_to_end, method, rd;
+  char *interface, *sink, *peer, *peer_netns, *src_ip, *dst_ip;
+  uint8_t *src_mac, *dst_mac, *peer_mac, *frames;
+  bench_ctx ctx;
+  udp_template tmpl;
+  timing t;
+  static const char *op_names[NUM_OPS] = {"checksum", "sum_bytes", "sum_bytes_unaligned", "csum_update32",
+    "tcp4_checksum", "udp4_checksum", "icmp4_checksum", "create_tcp_frame", "create_udp_frame",
+    "create_icmp_frame", "template_frame"};
+
+  // Payload lengths for microbenchmarks (bytes): powers of two and their odd neighbours,
+  // and the payloads of full 1500 and 9000 byte MTU datagrams.
+  static const int sizes[] = {64, 65, 127, 128, 511, 512, 1023, 1024, 1472, 1473, 4095, 4096,
+    8972, 16383, 16384, 32767, 65495, 65535};
+  int nsizes = sizeof (sizes) / sizeof (sizes[0]);
+
+  // Ethernet frame lengths for send-path and end-to-end benchmarks (bytes).
+  static const int frame_lens[] = {MIN_FRAMELEN, 512, 1514};
+  int nframe_lens = sizeof (frame_lens) / sizeof (frame_lens[0]);
+
+  // Allocate memory for various arrays.
+  src_mac = allocate_ustrmem (6);
+  dst_mac = allocate_ustrmem (6);
+  peer_mac = allocate_ustrmem (6);
+  interface = allocate_strmem (40);
+  sink = allocate_strmem (40);
+  peer = allocate_strmem (40);
+  peer_netns = allocate_strmem (256);
+  src_ip = allocate_strmem (INET_ADDRSTRLEN);
+  dst_ip = allocate_strmem (INET_ADDRSTRLEN);
+  frames = allocate_ustrmem (BATCH * MAX_FRAMELEN);
+
+  // Microbenchmarks: 1 = run, 0 = leave out.
+  micro = 1;
+
+  // Send path: 1 = run, 0 = leave out.
+  // Frames are sent to an interface which discards them, such as a dummy interface
+  // (ip link add bench0 type dummy; ip link set bench0 up), or one end of a veth pair whose
+  // other end is down. This times system calls, packet socket and queueing discipline,
+  // but no driver or wire. A veth whose other end is down refuses frames which bypass the
+  // queueing discipline (ENOBUFS), so use a dummy interface to time that method.
+  send_path = 1;
+  strcpy (sink, "bench0");
+
+  // End to end: 1 = run, 0 = leave out.
+  // Frames are sent to interface, one end of a veth pair, and received on peer, the other end,
+  // in network namespace peer_netns (empty if ours). For example:
+  //   ip netns add bench
+  //   ip link add veth0 type veth peer name veth1 netns bench
+  //   ip link set veth0 up; ip netns exec bench ip link set veth1 up
+  end_to_end = 1;
+  strcpy (interface, "veth0");
+  strcpy (peer, "veth1");
+  strcpy (peer_netns, "/var/run/netns/bench");
+
+  // Source and destination IPv4 addresses of frames built.
+  // They need not be reachable: frames only go to the sink or the veth peer.
+  strcpy (src_ip, "192.168.1.132");
+  strcpy (dst_ip, "192.168.1.133");
+
+  // Source and destination MAC addresses of frames built for microbenchmarks and the send path.
+  // End-to-end frames go from the MAC address of interface to that of peer.
+  memset (src_mac, 0, 6 * sizeof (uint8_t));
+  src_mac[0] = 0x02;
+  memset (dst_mac, 0xff, 6 * sizeof (uint8_t));
+
+  // Stop after the current benchmark on Ctrl-C.
+  signal (SIGINT, sig_handler);
+
+  // First line of results says when and how this run was made.
+  printf ("{\"bench\": \"run\", \"time\": %ld, \"repeats\": %i, \"repeat_ns\": %ld, \"send_ns\": %ld, "
+          "\"lat_samples\": %i}\n", (long int) time (NULL), REPEATS, REPEAT_NS, SEND_NS, LAT_SAMPLES);
+  fflush (stdout);
+
+  // Microbenchmarks
+  if (micro) {
+    memset (&ctx, 0, sizeof (ctx));
+    ctx.data = allocate_ustrmem (IP_MAXPACKET + 1);
+    ctx.frame = allocate_ustrmem (MAX_FRAMELEN);
+    ctx.src_ip = src_ip;
+    ctx.dst_ip = dst_ip;
+    ctx.src_mac = src_mac;
+    ctx.dst_mac = dst_mac;
+
+    // Payload: ASCII list of numbers, like the file "data".
+    for (i=0, size=0; size<(IP_MAXPACKET + 1); i++) {
+      size += snprintf ((char *) ctx.data + size, IP_MAXPACKET + 1 - size, "%i ", i);
+    }
+
+    // Headers for the pseudo-header checksum functions, as the frame builders make them.
+    create_tcp_frame (ctx.frame, src_ip, dst_ip, src_mac, dst_mac, 255, ctx.data, 0);
+    memcpy (&ctx.iphdr, ctx.frame + ETH_HDRLEN, IP4_HDRLEN * sizeof (uint8_t));
+    memcpy (&ctx.tcphdr, ctx.frame + ETH_HDRLEN + IP4_HDRLEN, TCP_HDRLEN * sizeof (uint8_t));
+    create_udp_frame (ctx.frame, src_ip, dst_ip, src_mac, dst_mac, 255, ctx.data, 0);
+    memcpy (&ctx.udphdr, ctx.frame + ETH_HDRLEN + IP4_HDRLEN, UDP_HDRLEN * sizeof (uint8_t));
+    create_icmp_frame (ctx.frame, src_ip, dst_ip, src_mac, dst_mac, 255, ctx.data, 0);
+    memcpy (&ctx.icmphdr, ctx.frame + ETH_HDRLEN + IP4_HDRLEN, ICMP_HDRLEN * sizeof (uint8_t));
+    template_init (&ctx.tmpl, src_mac, dst_mac, src_ip, dst_ip);
+
+    for (op=0; (op<NUM_OPS) && (stop == 0); op++) {
+      for (i=0; (i<nsizes) && (stop == 0); i++) {
+
+        // An incremental update takes the same time whatever the size of the data.
+        size = (op == OP_CSUM_UPDATE) ? 4 : sizes[i];
+        if ((op >= OP_TCP4_CHECKSUM) && (size > MAX_L4_PAYLOAD)) {
+          continue;
+        }
+        fprintf (stderr, "%s, %i bytes\n", op_names[op], size);
+        time_op (&ctx, op, size, &t);
+        printf ("{\"bench\": \"micro\", \"op\": \"%s\", \"size\": %i, \"iterations\": %ld, "
+                "\"ns_min\": %.2f, \"ns_median\": %.2f, \"mbyte_per_s\": %.1f}\n",
+                op_names[op], size, t.iterations, t.min, t.median, size * 1000.0 / t.min);
+        fflush (stdout);
+        if (op == OP_CSUM_UPDATE) {
+          break;
+        }
+      }
+    }
+    free (ctx.data);
+    free (ctx.frame);
+  }
+
+  // Send path
+  if (send_path && (stop == 0)) {
+    if ((sd = socket (PF_PACKET, SOCK_RAW, htons (ETH_P_ALL))) < 0) {
+      perror ("socket() failed to get socket descriptor for using ioctl() ");
+      exit (EXIT_FAILURE);
+    }
+    index = interface_mac (sd, sink, src_mac);
+    close (sd);
+    template_init (&tmpl, src_mac, dst_mac, src_ip, dst_ip);
+
+    for (method=0; (method<NUM_METHODS) && (stop == 0); method++) {
+      for (i=0; (i<nframe_lens) && (stop == 0); i++) {
+        if ((sd = socket (PF_PACKET, SOCK_RAW, htons (ETH_P_ALL))) < 0) {
+          perror ("socket() failed ");
+          exit (EXIT_FAILURE);
+        }
+
+        // Frames go straight to the driver, without a queueing discipline.
+        if (method == SEND_QDISC_BYPASS) {
+          op = 1;
+          if (setsockopt (sd, SOL_PACKET, PACKET_QDISC_BYPASS, &op, sizeof (op)) < 0) {
+            perror ("setsockopt() failed to set PACKET_QDISC_BYPASS ");
+            exit (EXIT_FAILURE);
+          }
+        }
+        fprintf (stderr, "Send path, method %i, %i byte frames\n", method, frame_lens[i]);
+        bench_send (sd, method, sink, index, &tmpl, frames, frame_lens[i]);
+        close (sd);
+      }
+    }
+  }
+
+  // End to end
+  if (end_to_end && (stop == 0)) {
+    if ((sd = socket (PF_PACKET, SOCK_RAW, htons (ETH_P_ALL))) < 0) {
+      perror ("socket() failed ");
+      exit (EXIT_FAILURE);
+    }
+    index = interface_mac (sd, interface, src_mac);
+    rd = rx_open (peer, peer_netns, peer_mac);
+    template_init (&tmpl, src_mac, peer_mac, src_ip, dst_ip);
+
+    for (i=0; (i<nframe_lens) && (stop == 0); i++) {
+      fprintf (stderr, "End to end throughput, %i byte frames\n", frame_lens[i]);
+      bench_throughput (sd, interface, index, rd, &tmpl, frames, frame_lens[i]);
+    }
+    for (i=0; (i<nframe_lens) && (stop == 0); i++) {
+      fprintf (stderr, "End to end latency, %i byte frames\n", frame_lens[i]);
+      bench_latency (sd, interface, index, rd, &tmpl, frames, frame_lens[i]);
+    }
+    close (sd);
+    close (rd);
+  }
+
+  // Free allocated memory.
+  free (src_mac);
+  free (dst_mac);
+  free (peer_mac);
+  free (interface);
+  free (sink);
+  free (peer);
+  free (peer_netns);
+  free (src_ip);
+  free (dst_ip);
+  free (frames);
+
+  return (EXIT_SUCCESS);
+}
+
+// Run microbenchmark op n times over size bytes of payload, and return the sum of the results.
+// The first byte of the payload changes each time, so no call can be moved out of the loop.
+uint32_t
+run_op (bench_ctx *ctx, int op, int size, long int n)
+{
+  long int i;
+  uint32_t acc;
+
+  acc = 0;
+  switch (op) {
+    case OP_CHECKSUM:
+      for (i=0; i<n; i++) {
+        ctx->data[0] = (uint8_t) i;
+        acc += checksum ((uint16_t *) ctx->data, size);
+      }
+      break;
+
+    case OP_SUM_BYTES:
+      for (i=0; i<n; i++) {
+        ctx->data[0] = (uint8_t) i;
+        acc += fold_sum (sum_bytes (0, ctx->data, size));
+      }
+      break;
+
+    case OP_SUM_BYTES_UNALIGNED:
+      for (i=0; i<n; i++) {
+        ctx->data[1] = (uint8_t) i;
+        acc += fold_sum (sum_bytes (0, ctx->data + 1, size));
+      }
+      break;
+
+    case OP_CSUM_UPDATE:
+      for (i=0; i<n; i++) {
+        acc += csum_update32 (ctx->iphdr.ip_sum, ctx->iphdr.ip_dst.s_addr, (uint32_t) i);
+      }
+      break;
+
+    case OP_TCP4_CHECKSUM:
+      for (i=0; i<n; i++) {
+        ctx->data[0] = (uint8_t) i;
+        acc += tcp4_checksum (ctx->iphdr, ctx->tcphdr, ctx->data, size);
+      }
+      break;
+
+    case OP_UDP4_CHECKSUM:
+      ctx->udphdr.uh_ulen = htons (UDP_HDRLEN + size);
+      for (i=0; i<n; i++) {
+        ctx->data[0] = (uint8_t) i;
+        acc += udp4_checksum (ctx->iphdr, ctx->udphdr, ctx->data, size);
+      }
+      break;
+
+    case OP_ICMP4_CHECKSUM:
+      for (i=0; i<n; i++) {
+        ctx->data[0] = (uint8_t) i;
+        acc += icmp4_checksum (ctx->icmphdr, ctx->data, size);
+      }
+      break;
+
+    case OP_CREATE_TCP:
+      for (i=0; i<n; i++) {
+        ctx->data[0] = (uint8_t) i;
+        create_tcp_frame (ctx->frame, ctx->src_ip, ctx->dst_ip, ctx->src_mac, ctx->dst_mac, 255, ctx->data, size);
+        acc += ctx->frame[ETH_HDRLEN + IP4_HDRLEN + 16];
+      }
+      break;
+
+    case OP_CREATE_UDP:
+      for (i=0; i<n; i++) {
+        ctx->data[0] = (uint8_t) i;
+        create_udp_frame (ctx->frame, ctx->src_ip, ctx->dst_ip, ctx->src_mac, ctx->dst_mac, 255, ctx->data, size);
+        acc += ctx->frame[ETH_HDRLEN + IP4_HDRLEN + 6];
+      }
+      break;
+
+    case OP_CREATE_ICMP:
+      for (i=0; i<n; i++) {
+        ctx->data[0] = (uint8_t) i;
+        create_icmp_frame (ctx->frame, ctx->src_ip, ctx->dst_ip, ctx->src_mac, ctx->dst_mac, 255, ctx->data, size);
+        acc += ctx->frame[ETH_HDRLEN + IP4_HDRLEN + 2];
+      }
+      break;
+
+    case OP_TEMPLATE_UDP:
+      for (i=0; i<n; i++) {
+        ctx->data[0] = (uint8_t) i;
+        template_frame (&ctx->tmpl, ctx->frame, ctx->data, size, (uint16_t) i);
+        acc += ctx->frame[ETH_HDRLEN + IP4_HDRLEN + 6];
+      }
+      break;
+  }
+
+  sink_sum += acc;
+
+  return (acc);
+}
+
+// Time microbenchmark op over size bytes: double the number of iterations until a run takes
+// CALIBRATE_NS, scale it so a run takes about REPEAT_NS, then time REPEATS runs.
+void
+time_op (bench_ctx *ctx, int op, int size, timing *t)
+{
+  int i;
+  long int n;
+  uint64_t t0, dt;
+  double ns[REPEATS];
+
+  n = 1;
+  while (1) {
+    t0 = now_ns ();
+    run_op (ctx, op, size, n);
+    dt = now_ns () - t0;
+    if (dt >= CALIBRATE_NS) {
+      break;
+    }
+    n *= 2;
+  }
+  n = (long int) ((double) n * REPEAT_NS / dt);
+  if (n < 1) {
+    n = 1;
+  }
+
+  for (i=0; i<REPEATS; i++) {
+    t0 = now_ns ();
+    run_op (ctx, op, size, n);
+    ns[i] = (double) (now_ns () - t0) / n;
+  }
+  qsort (ns, REPEATS, sizeof (double), cmp_double);
+
+  t->iterations = n;
+  t->min = ns[0];
+  t->median = ns[REPEATS / 2];
+}
+
+// Build a template of ethernet, IPv4 and UDP headers, and sums over the fields which never change.
+void
+template_init (udp_template *tmpl, uint8_t *src_mac, uint8_t *dst_mac, char *src_ip, char *dst_ip)
+{
+  int status;
+  struct ip iphdr;
+  struct udphdr udphdr;
+
+  // IPv4 header
+
+  // IPv4 header length (4 bits): Number of 32-bit words in header = 5
+  iphdr.ip_hl = IP4_HDRLEN / sizeof (uint32_t);
+
+  // Internet Protocol version (4 bits): IPv4
+  iphdr.ip_v = 4;
+
+  // Type of service (8 bits)
+  iphdr.ip_tos = 0;
+
+  // Total length of datagram (16 bits): set for each frame by template_frame().
+  iphdr.ip_len = 0;
+
+  // ID sequence number (16 bits): set for each frame by template_frame().
+  iphdr.ip_id = 0;
+
+  // Flags, and Fragmentation offset (3, 13 bits): 0 since single datagram
+  iphdr.ip_off = htons (0);
+
+  // Time-to-Live (8 bits): default to maximum value
+  iphdr.ip_ttl = 255;
+
+  // Transport layer protocol (8 bits): 17 for UDP
+  iphdr.ip_p = IPPROTO_UDP;
+
+  // Source IPv4 address (32 bits)
+  if ((status = inet_pton (AF_INET, src_ip, &(iphdr.ip_src))) != 1) {
+    fprintf (stderr, "inet_pton() failed.\nError message: %s", strerror (status));
+    exit (EXIT_FAILURE);
+  }
+
+  // Destination IPv4 address (32 bits)
+  if ((status = inet_pton (AF_INET, dst_ip, &(iphdr.ip_dst))) != 1) {
+    fprintf (stderr, "inet_pton() failed.\nError message: %s", strerror (status));
+    exit (EXIT_FAILURE);
+  }
+
+  // IPv4 header checksum (16 bits): set for each frame by template_frame().
+  iphdr.ip_sum = 0;
+
+  // UDP header
+
+  // Source port number (16 bits): pick a number
+  udphdr.uh_sport = htons (4950);
+
+  // Destination port number (16 bits)
+  udphdr.uh_dport = htons (BENCH_PORT);
+
+  // Length of UDP datagram (16 bits): set for each frame by template_frame().
+  udphdr.uh_ulen = 0;
+
+  // UDP checksum (16 bits): set for each frame by template_frame().
+  udphdr.uh_sum = 0;
+
+  memcpy (tmpl->hdrs, dst_mac, 6 * sizeof (uint8_t));
+  memcpy (tmpl->hdrs + 6, src_mac, 6 * sizeof (uint8_t));
+  tmpl->hdrs[12] = ETH_P_IP / 256;
+  tmpl->hdrs[13] = ETH_P_IP % 256;
+  memcpy (tmpl->hdrs + ETH_HDRLEN, &iphdr, IP4_HDRLEN * sizeof (uint8_t));
+  memcpy (tmpl->hdrs + ETH_HDRLEN + IP4_HDRLEN, &udphdr, UDP_HDRLEN * sizeof (uint8_t));
+
+  // Partial sums: only lengths, IP ID, and payload need to be added for each frame.
+  tmpl->ip_sum0 = sum_bytes (0, tmpl->hdrs + ETH_HDRLEN, IP4_HDRLEN);
+  tmpl->udp_sum0 = sum_bytes (0, (uint8_t *) &iphdr.ip_src, 8) + IPPROTO_UDP;
+  tmpl->udp_sum0 = sum_bytes (tmpl->udp_sum0, tmpl->hdrs + ETH_HDRLEN + IP4_HDRLEN, 4);
+}
+
+// Build a frame from the template and len bytes of payload, as udp4_stream_ll.c does.
+// The payload is copied behind the headers, unless it is already there.
+// Returns the length of the frame, padded to the shortest ethernet frame.
+int
+template_frame (udp_template *tmpl, uint8_t *frame, uint8_t *payload, int len, uint16_t ip_id)
+{
+  int ip_len, frame_len;
+  uint32_t sum;
+  uint16_t csum;
+
+  ip_len = IP4_HDRLEN + UDP_HDRLEN + len;
+  memcpy (frame, tmpl->hdrs, HDRS_LEN * sizeof (uint8_t));
+  if (payload != (frame + HDRS_LEN)) {
+    memcpy (frame + HDRS_LEN, payload, len * sizeof (uint8_t));
+  }
+
+  // IPv4 total length, ID and header checksum
+  frame[ETH_HDRLEN + 2] = ip_len >> 8;
+  frame[ETH_HDRLEN + 3] = ip_len & 0xff;
+  frame[ETH_HDRLEN + 4] = ip_id >> 8;
+  frame[ETH_HDRLEN + 5] = ip_id & 0xff;
+  csum = ~fold_sum (tmpl->ip_sum0 + ip_len + ip_id);
+  frame[ETH_HDRLEN + 10] = csum >> 8;
+  frame[ETH_HDRLEN + 11] = csum & 0xff;
+
+  // UDP length and checksum
+  frame[ETH_HDRLEN + IP4_HDRLEN + 4] = (UDP_HDRLEN + len) >> 8;
+  frame[ETH_HDRLEN + IP4_HDRLEN + 5] = (UDP_HDRLEN + len) & 0xff;
+  sum = tmpl->udp_sum0 + (2 * (UDP_HDRLEN + len));  // Pseudo-header length + UDP header length
+  csum = ~fold_sum (sum_bytes (sum, frame + HDRS_LEN, len));
+  if (csum == 0) {
+    csum = 0xffff;  // Zero means "no checksum" in UDP (RFC 768)
+  }
+  frame[ETH_HDRLEN + IP4_HDRLEN + 6] = csum >> 8;
+  frame[ETH_HDRLEN + IP4_HDRLEN + 7] = csum & 0xff;
+
+  frame_len = HDRS_LEN + len;
+  if (frame_len < MIN_FRAMELEN) {
+    memset (frame + frame_len, 0, (MIN_FRAMELEN - frame_len) * sizeof (uint8_t));
+    frame_len = MIN_FRAMELEN;
+  }
+
+  return (frame_len);
+}
+
+// Use ioctl() on socket sd to get the MAC address of an interface.
+// Returns the interface index.
+int
+interface_mac (int sd, char *interface, uint8_t *mac)
+{
+  int index;
+  struct ifreq ifr;
+
+  memset (&ifr, 0, sizeof (ifr));
+  snprintf (ifr.ifr_name, sizeof (ifr.ifr_name), "%s", interface);
+  if (ioctl (sd, SIOCGIFHWADDR, &ifr) < 0) {
+    fprintf (stderr, "ioctl() failed to get MAC address of interface %s: %s\n", interface, strerror (errno));
+    exit (EXIT_FAILURE);
+  }
+  memcpy (mac, ifr.ifr_hwaddr.sa_data, 6 * sizeof (uint8_t));
+
+  if ((index = if_nametoindex (interface)) == 0) {
+    fprintf (stderr, "if_nametoindex() failed to obtain index of interface %s: %s\n", interface, strerror (errno));
+    exit (EXIT_FAILURE);
+  }
+
+  return (index);
+}
+
+// Open a socket receiving IPv4 frames on the given interface, which may be in another
+// network namespace (named by a path such as /var/run/netns/name, or empty for ours),
+// and get its MAC address.
+int
+rx_open (char *interface, char *netns, uint8_t *mac)
+{
+  int rd, nsfd, ourfd, size;
+  struct sockaddr_ll sll;
+
+  nsfd = -1;
+  ourfd = -1;
+  if (netns[0] != 0) {
+    if (((ourfd = open ("/proc/self/ns/net", O_RDONLY)) < 0) || ((nsfd = open (netns, O_RDONLY)) < 0)) {
+      perror ("open() failed to open network namespace ");
+      exit (EXIT_FAILURE);
+    }
+    if (setns (nsfd, CLONE_NEWNET) < 0) {
+      perror ("setns() failed to enter network namespace ");
+      exit (EXIT_FAILURE);
+    }
+  }
+
+  // Socket and interface index belong to the namespace we are in when asking for them.
+  if ((rd = socket (PF_PACKET, SOCK_RAW, htons (ETH_P_IP))) < 0) {
+    perror ("socket() failed ");
+    exit (EXIT_FAILURE);
+  }
+  memset (&sll, 0, sizeof (sll));
+  sll.sll_family = AF_PACKET;
+  sll.sll_protocol = htons (ETH_P_IP);
+  sll.sll_ifindex = interface_mac (rd, interface, mac);
+  if (bind (rd, (struct sockaddr *) &sll, sizeof (sll)) < 0) {
+    perror ("bind() failed ");
+    exit (EXIT_FAILURE);
+  }
+
+  // Room for bursts while the receiving thread waits for the CPU.
+  size = 32 * 1024 * 1024;
+  if (setsockopt (rd, SOL_SOCKET, SO_RCVBUF, &size, sizeof (size)) < 0) {
+    perror ("setsockopt() failed to set SO_RCVBUF ");
+    exit (EXIT_FAILURE);
+  }
+
+  if (nsfd >= 0) {
+    if (setns (ourfd, CLONE_NEWNET) < 0) {
+      perror ("setns() failed to return to our network namespace ");
+      exit (EXIT_FAILURE);
+    }
+    close (nsfd);
+    close (ourfd);
+  }
+
+  return (rd);
+}
+
+// Is a received frame one of ours (same addresses and ports as the template)?
+// If so, give the sequence number and send time at the start of its payload.
+int
+rx_match (udp_template *tmpl, uint8_t *frame, int len, uint64_t *seq, uint64_t *stamp)
+{
+  if ((len < (HDRS_LEN + STAMP_LEN)) || (frame[12] != ETH_P_IP / 256) || (frame[13] != ETH_P_IP % 256) ||
+      (frame[ETH_HDRLEN + 9] != IPPROTO_UDP) ||
+      (memcmp (frame + ETH_HDRLEN + 12, tmpl->hdrs + ETH_HDRLEN + 12, 8) != 0) ||
+      (memcmp (frame + ETH_HDRLEN + IP4_HDRLEN, tmpl->hdrs + ETH_HDRLEN + IP4_HDRLEN, 4) != 0)) {
+    return (0);
+  }
+  memcpy (seq, frame + HDRS_LEN, sizeof (uint64_t));
+  memcpy (stamp, frame + HDRS_LEN + sizeof (uint64_t), sizeof (uint64_t));
+
+  return (1);
+}
+
+// Receiving thread of an end-to-end throughput run: count our frames until told to stop.
+void *
+rx_thread (void *arg)
+{
+  int i, n;
+  uint64_t seq, stamp;
+  e2e_rx *rx = (e2e_rx *) arg;
+  struct mmsghdr msgs[BATCH];
+  struct iovec iovs[BATCH];
+  struct pollfd pfd;
+
+  memset (msgs, 0, sizeof (msgs));
+  for (i=0; i<BATCH; i++) {
+    iovs[i].iov_base = rx->frames + (i * MAX_FRAMELEN);
+    iovs[i].iov_len = MAX_FRAMELEN;
+    msgs[i].msg_hdr.msg_iov = &iovs[i];
+    msgs[i].msg_hdr.msg_iovlen = 1;
+  }
+  pfd.fd = rx->rd;
+  pfd.events = POLLIN;
+
+  while (rx->done == 0) {
+    if (poll (&pfd, 1, 10) <= 0) {
+      continue;
+    }
+    if ((n = recvmmsg (rx->rd, msgs, BATCH, MSG_DONTWAIT, NULL)) <= 0) {
+      continue;
+    }
+    for (i=0; i<n; i++) {
+      if (rx_match (rx->tmpl, rx->frames + (i * MAX_FRAMELEN), msgs[i].msg_len, &seq, &stamp)) {
+        rx->received++;
+        rx->bytes += msgs[i].msg_len;
+      }
+    }
+  }
+
+  return (NULL);
+}
+
+// Send frames of frame_len bytes as fast as possible for SEND_NS to a sink interface, one per call
+// to sendto() (method SEND_SENDTO), or BATCH per call to sendmmsg(), and report the rate achieved.
+// Calls which fail (e.g., ENOBUFS while the queue is full) are counted, and their frames not.
+void
+bench_send (int sd, int method, char *interface, int index, udp_template *tmpl, uint8_t *frames, int frame_len)
+{
+  int i, n, len, error;
+  long int calls, errors;
+  uint64_t sent, t0, t1, end;
+  struct sockaddr_ll device;
+  struct mmsghdr msgs[BATCH];
+  struct iovec iovs[BATCH];
+  double dt;
+  static const char *method_names[NUM_METHODS] = {"sendto", "sendmmsg", "sendmmsg_qdisc_bypass"};
+
+  memset (&device, 0, sizeof (device));
+  device.sll_family = AF_PACKET;
+  device.sll_ifindex = index;
+  device.sll_halen = 6;
+  memcpy (device.sll_addr, tmpl->hdrs, 6 * sizeof (uint8_t));
+
+  // The same BATCH frames, with different IP IDs, are sent again and again.
+  memset (msgs, 0, sizeof (msgs));
+  memset (frames, 0, BATCH * MAX_FRAMELEN * sizeof (uint8_t));
+  for (i=0; i<BATCH; i++) {
+    len = template_frame (tmpl, frames + (i * MAX_FRAMELEN), frames + (i * MAX_FRAMELEN) + HDRS_LEN,
+                          frame_len - HDRS_LEN, i);
+    iovs[i].iov_base = frames + (i * MAX_FRAMELEN);
+    iovs[i].iov_len = len;
+    msgs[i].msg_hdr.msg_iov = &iovs[i];
+    msgs[i].msg_hdr.msg_iovlen = 1;
+    msgs[i].msg_hdr.msg_name = &device;
+    msgs[i].msg_hdr.msg_namelen = sizeof (device);
+  }
+
+  sent = 0;
+  calls = 0;
+  errors = 0;
+  error = 0;
+  i = 0;
+  t0 = now_ns ();
+  end = t0 + SEND_NS;
+  while (((t1 = now_ns ()) < end) && (stop == 0)) {
+    calls++;
+    if (method == SEND_SENDTO) {
+      if (sendto (sd, iovs[i].iov_base, iovs[i].iov_len, 0, (struct sockaddr *) &device, sizeof (device)) <= 0) {
+        error = errno;
+        errors++;
+      } else {
+        sent++;
+      }
+      i = (i + 1) % BATCH;
+    } else if ((n = sendmmsg (sd, msgs, BATCH, 0)) < 0) {
+      error = errno;
+      errors++;
+    } else {
+      sent += n;
+    }
+  }
+  dt = (double) (t1 - t0) / 1e9;
+
+  // Reason for the last failed call, if any, is reported too.
+  printf ("{\"bench\": \"send\", \"method\": \"%s\", \"interface\": \"%s\", \"frame_len\": %i, "
+          "\"frames\": %llu, \"calls\": %ld, \"errors\": %ld, \"last_error\": \"%s\", \"seconds\": %.3f, "
+          "\"pps\": %.0f, \"mbit_per_s\": %.1f}\n", method_names[method], interface, frame_len,
+          (unsigned long long int) sent, calls, errors, (error != 0) ? strerror (error) : "", dt,
+          sent / dt, sent * frame_len * 8.0 / dt / 1e6);
+  fflush (stdout);
+}
+
+// End-to-end throughput: send frames of frame_len bytes as fast as possible for SEND_NS to one end
+// of a veth pair, BATCH per call to sendmmsg(), while a second thread counts those received on
+// the other end. Each frame carries a sequence number, so each batch is built again before sending.
+void
+bench_throughput (int sd, char *interface, int index, int rd, udp_template *tmpl, uint8_t *frames, int frame_len)
+{
+  int i, n, status;
+  long int errors;
+  uint64_t seq, sent, t0, t1, end;
+  uint8_t *payload, *rxframes;
+  struct sockaddr_ll device;
+  struct mmsghdr msgs[BATCH];
+  struct iovec iovs[BATCH];
+  pthread_t thread;
+  e2e_rx rx;
+  double dt;
+
+  memset (&device, 0, sizeof (device));
+  device.sll_family = AF_PACKET;
+  device.sll_ifindex = index;
+  device.sll_halen = 6;
+  memcpy (device.sll_addr, tmpl->hdrs, 6 * sizeof (uint8_t));
+
+  memset (msgs, 0, sizeof (msgs));
+  memset (frames, 0, BATCH * MAX_FRAMELEN * sizeof (uint8_t));
+  for (i=0; i<BATCH; i++) {
+    iovs[i].iov_base = frames + (i * MAX_FRAMELEN);
+    msgs[i].msg_hdr.msg_iov = &iovs[i];
+    msgs[i].msg_hdr.msg_iovlen = 1;
+    msgs[i].msg_hdr.msg_name = &device;
+    msgs[i].msg_hdr.msg_namelen = sizeof (device);
+  }
+
+  // Leave nothing from an earlier run waiting at the receiving socket.
+  rxframes = allocate_ustrmem (BATCH * MAX_FRAMELEN);
+  while (recv (rd, rxframes, MAX_FRAMELEN, MSG_DONTWAIT) >= 0);
+
+  memset (&rx, 0, sizeof (rx));
+  rx.rd = rd;
+  rx.tmpl = tmpl;
+  rx.frames = rxframes;
+  if ((status = pthread_create (&thread, NULL, rx_thread, &rx)) != 0) {
+    fprintf (stderr, "pthread_create() failed.\nError message: %s\n", strerror (status));
+    exit (EXIT_FAILURE);
+  }
+
+  seq = 0;
+  sent = 0;
+  errors = 0;
+  t0 = now_ns ();
+  end = t0 + SEND_NS;
+  while (((t1 = now_ns ()) < end) && (stop == 0)) {
+    for (i=0; i<BATCH; i++) {
+      payload = frames + (i * MAX_FRAMELEN) + HDRS_LEN;
+      memcpy (payload, &seq, sizeof (uint64_t));
+      memcpy (payload + sizeof (uint64_t), &t1, sizeof (uint64_t));
+      iovs[i].iov_len = template_frame (tmpl, frames + (i * MAX_FRAMELEN), payload, frame_len - HDRS_LEN, seq);
+      seq++;
+    }
+    if ((n = sendmmsg (sd, msgs, BATCH, 0)) < 0) {
+      errors++;
+    } else {
+      sent += n;
+    }
+  }
+  dt = (double) (t1 - t0) / 1e9;
+
+  // Give the last frames time to arrive, then stop the receiving thread.
+  poll (NULL, 0, DRAIN_MS);
+  rx.done = 1;
+  pthread_join (thread, NULL);
+  free (rxframes);
+
+  printf ("{\"bench\": \"veth_throughput\", \"interface\": \"%s\", \"frame_len\": %i, \"sent\": %llu, "
+          "\"received\": %ld, \"lost\": %lld, \"errors\": %ld, \"seconds\": %.3f, \"pps_sent\": %.0f, "
+          "\"pps_received\": %.0f, \"mbit_per_s_received\": %.1f}\n", interface, frame_len,
+          (unsigned long long int) sent, rx.received, (long long int) sent - rx.received, errors, dt,
+          sent / dt, rx.received / dt, rx.bytes * 8.0 / dt / 1e6);
+  fflush (stdout);
+}
+
+// End-to-end latency: send LAT_SAMPLES frames of frame_len bytes one at a time, each stamped with
+// its send time, and wait for each to be received on the other end of the veth pair.
+// Latency is from just before sendto() to just after recv() gives the frame to us.
+void
+bench_latency (int sd, char *interface, int index, int rd, udp_template *tmpl, uint8_t *frames, int frame_len)
+{
+  int n, len;
+  long int lost;
+  uint64_t seq, stamp, rseq, rstamp, t0, t1, *lat;
+  uint8_t *payload, *rxframe;
+  struct sockaddr_ll device;
+  struct pollfd pfd;
+  double sum;
+
+  memset (&device, 0, sizeof (device));
+  device.sll_family = AF_PACKET;
+  device.sll_ifindex = index;
+  device.sll_halen = 6;
+  memcpy (device.sll_addr, tmpl->hdrs, 6 * sizeof (uint8_t));
+
+  lat = (uint64_t *) allocate_ustrmem (LAT_SAMPLES * sizeof (uint64_t));
+  rxframe = allocate_ustrmem (MAX_FRAMELEN);
+  memset (frames, 0, MAX_FRAMELEN * sizeof (uint8_t));
+  payload = frames + HDRS_LEN;
+  pfd.fd = rd;
+  pfd.events = POLLIN;
+
+  // Leave nothing from an earlier run waiting at the receiving socket.
+  while (recv (rd, rxframe, MAX_FRAMELEN, MSG_DONTWAIT) >= 0);
+
+  n = 0;
+  lost = 0;
+  sum = 0.0;
+  for (seq=0; (seq<LAT_SAMPLES) && (stop == 0); seq++) {
+    stamp = now_ns ();
+    memcpy (payload, &seq, sizeof (uint64_t));
+    memcpy (payload + sizeof (uint64_t), &stamp, sizeof (uint64_t));
+    len = template_frame (tmpl, frames, payload, frame_len - HDRS_LEN, seq);
+    if (sendto (sd, frames, len, 0, (struct sockaddr *) &device, sizeof (device)) <= 0) {
+      perror ("sendto() failed ");
+      exit (EXIT_FAILURE);
+    }
+
+    // Wait for this frame, skipping any others.
+    t0 = now_ns ();
+    while (1) {
+      t1 = now_ns ();
+      if ((t1 - t0) >= (LAT_TIMEOUT_MS * 1000000ull)) {
+        lost++;
+        break;
+      }
+      if (poll (&pfd, 1, LAT_TIMEOUT_MS - (int) ((t1 - t0) / 1000000)) <= 0) {
+        continue;
+      }
+      if ((len = recv (rd, rxframe, MAX_FRAMELEN, MSG_DONTWAIT)) < 0) {
+        continue;
+      }
+      if (rx_match (tmpl, rxframe, len, &rseq, &rstamp) && (rseq == seq) && (rstamp == stamp)) {
+        lat[n] = now_ns () - stamp;
+        sum += lat[n];
+        n++;
+        break;
+      }
+    }
+  }
+  qsort (lat, n, sizeof (uint64_t), cmp_u64);
+
+  if (n > 0) {
+    printf ("{\"bench\": \"veth_latency\", \"interface\": \"%s\", \"frame_len\": %i, \"samples\": %i, "
+            "\"lost\": %ld, \"ns_min\": %llu, \"ns_mean\": %.0f, \"ns_p50\": %llu, \"ns_p90\": %llu, "
+            "\"ns_p99\": %llu, \"ns_p999\": %llu, \"ns_max\": %llu}\n", interface, frame_len, n, lost,
+            (unsigned long long int) lat[0], sum / n,
+            (unsigned long long int) lat[(n - 1) * 50 / 100],
+            (unsigned long long int) lat[(n - 1) * 90 / 100],
+            (unsigned long long int) lat[(n - 1) * 99 / 100],
+            (unsigned long long int) lat[(n - 1) * 999 / 1000],
+            (unsigned long long int) lat[n - 1]);
+  } else {
+    printf ("{\"bench\": \"veth_latency\", \"interface\": \"%s\", \"frame_len\": %i, \"samples\": 0, "
+            "\"lost\": %ld}\n", interface, frame_len, lost);
+  }
+  fflush (stdout);
+
+  free (lat);
+  free (rxframe);
+}
+
+// Current time from the monotonic clock (ns).
+uint64_t
+now_ns (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+
+  return ((uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec);
+}
+
+// Compare two doubles, for qsort().
+int
+cmp_double (const void *a, const void *b)
+{
+  double x = *(const double *) a, y = *(const double *) b;
+
+  return ((x > y) - (x < y));
+}
+
+// Compare two 64-bit unsigned integers, for qsort().
+int
+cmp_u64 (const void *a, const void *b)
+{
+  uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+
+  return ((x > y) - (x < y));
+}
+
+// Create a TCP ethernet frame.
+int
+create_tcp_frame (uint8_t *snd_ether_frame, char *src_ip, char *dst_ip, uint8_t *src_mac, uint8_t *dst_mac,
+                  int ttl, uint8_t *data, int datalen)
+{
+  int i, status, *ip_flags, *tcp_flags;
+  struct ip iphdr;
+  struct tcphdr tcphdr;
+
+  // Allocate memory for various arrays.
+  ip_flags = allocate_intmem (4);
+  tcp_flags = allocate_intmem (8);
+
+  // IPv4 header
+
+  // IPv4 header length (4 bits): Number of 32-bit words in header = 5
+  iphdr.ip_hl = IP4_HDRLEN / sizeof (uint32_t);
+
+  // Internet Protocol version (4 bits): IPv4
+  iphdr.ip_v = 4;
+
+  // Type of service (8 bits)
+  iphdr.ip_tos = 0;
+
+  // Total length of datagram (16 bits): IP header + TCP header + data
+  iphdr.ip_len = htons (IP4_HDRLEN + TCP_HDRLEN + datalen);
+
+  // ID sequence number (16 bits): unused, since single datagram
+  iphdr.ip_id = htons (0);
+
+  // Flags, and Fragmentation offset (3, 13 bits): 0 since single datagram
+
+  // Zero (1 bit)
+  ip_flags[0] = 0;
+
+  // Do not fragment flag (1 bit)
+  ip_flags[1] = 0;
+
+  // More fragments following flag (1 bit)
+  ip_flags[2] = 0;
+
+  // Fragmentation offset (13 bits)
+  ip_flags[3] = 0;
+
+  iphdr.ip_off = htons ((ip_flags[0] << 15)
+                      + (ip_flags[1] << 14)
+                      + (ip_flags[2] << 13)
+                      +  ip_flags[3]);
+
+  // Time-to-Live (8 bits): default to maximum value
+  iphdr.ip_ttl = ttl;
+
+  // Transport layer protocol (8 bits): 6 for TCP
+  iphdr.ip_p = IPPROTO_TCP;
+
+  // Source IPv4 address (32 bits)
+  if ((status = inet_pton (AF_INET, src_ip, &(iphdr.ip_src))) != 1) {
+    fprintf (stderr, "inet_pton() failed.\nError message: %s", strerror (status));
+    exit (EXIT_FAILURE);
+  }
+
+  // Destination IPv4 address (32 bits)
+  if ((status = inet_pton (AF_INET, dst_ip, &(iphdr.ip_dst))) != 1) {
+    fprintf (stderr, "inet_pton() failed.\nError message: %s", strerror (status));
+    exit (EXIT_FAILURE);
+  }
+
+  // IPv4 header checksum (16 bits): set to 0 when calculating checksum
+  iphdr.ip_sum = 0;
+  iphdr.ip_sum = checksum ((uint16_t *) &iphdr, IP4_HDRLEN);
+
+  // TCP header
+
+  // Source port number (16 bits)
+  tcphdr.th_sport = htons (80);
+
+  // Destination port number (16 bits)
+  tcphdr.th_dport = htons (80);
+
+  // Sequence number (32 bits)
+  tcphdr.th_seq = htonl (0);
+
+  // Acknowledgement number (32 bits): 0 in first packet of SYN/ACK process
+  tcphdr.th_ack = htonl (0);
+
+  // Reserved (4 bits): should be 0
+  tcphdr.th_x2 = 0;
+
+  // Data offset (4 bits): size of TCP header in 32-bit words
+  tcphdr.th_off = TCP_HDRLEN / 4;
+
+  // Flags (8 bits)
+
+  // FIN flag (1 bit)
+  tcp_flags[0] = 0;
+
+  // SYN flag (1 bit): set to 1
+  tcp_flags[1] = 1;
+
+  // RST flag (1 bit)
+  tcp_flags[2] = 0;
+
+  // PSH flag (1 bit)
+  tcp_flags[3] = 0;
+
+  // ACK flag (1 bit)
+  tcp_flags[4] = 0;
+
+  // URG flag (1 bit)
+  tcp_flags[5] = 0;
+
+  // ECE flag (1 bit)
+  tcp_flags[6] = 0;
+
+  // CWR flag (1 bit)
+  tcp_flags[7] = 0;
+
+  tcphdr.th_flags = 0;
+  for (i=0; i<8; i++) {
+    tcphdr.th_flags += (tcp_flags[i] << i);
+  }
+
+  // Window size (16 bits)
+  tcphdr.th_win = htons (65535);
+
+  // Urgent pointer (16 bits): 0 (only valid if URG flag is set)
+  tcphdr.th_urp = htons (0);
+
+  // TCP checksum (16 bits)
+  tcphdr.th_sum = tcp4_checksum (iphdr, tcphdr, data, datalen);
+
+  // Fill out ethernet frame header.
+
+  // Destination and Source MAC addresses
+  memcpy (snd_ether_frame, dst_mac, 6 * sizeof (uint8_t));
+  memcpy (snd_ether_frame + 6, src_mac, 6 * sizeof (uint8_t));
+
+  // Next is ethernet type code (ETH_P_IP for IPv4).
+  // http://www.iana.org/assignments/ethernet-numbers
+  snd_ether_frame[12] = ETH_P_IP / 256;
+  snd_ether_frame[13] = ETH_P_IP % 256;
+
+  // Next is ethernet frame data (IPv4 header + TCP header).
+
+  // IPv4 header
+  memcpy (snd_ether_frame + ETH_HDRLEN, &iphdr, IP4_HDRLEN * sizeof (uint8_t));
+
+  // TCP header
+  memcpy (snd_ether_frame + ETH_HDRLEN + IP4_HDRLEN, &tcphdr, TCP_HDRLEN * sizeof (uint8_t));
+
+  // TCP data
+  memcpy (snd_ether_frame + ETH_HDRLEN + IP4_HDRLEN + TCP_HDRLEN, data, datalen * sizeof (uint8_t));
+
+  // Free allocated memory.
+  free (ip_flags);
+  free (tcp_flags);
+
+  return (EXIT_SUCCESS);
+}
+
+// Create a ICMP ethernet frame.
+int
+create_icmp_frame (uint8_t *snd_ether_frame, char *src_ip, char *dst_ip, uint8_t *src_mac, uint8_t *dst_mac,
+                   int ttl, uint8_t *data, int datalen)
+{
+  int status, *ip_flags;
+  struct ip iphdr;
+  struct icmp icmphdr;
+
+  // Allocate memory for various arrays.
+  ip_flags = allocate_intmem (4);
+
+  // IPv4 header
+
+  // IPv4 header length (4 bits): Number of 32-bit words in header = 5
+  iphdr.ip_hl = IP4_HDRLEN / sizeof (uint32_t);
+
+  // Internet Protocol version (4 bits): IPv4
+  iphdr.ip_v = 4;
+
+  // Type of service (8 bits)
+  iphdr.ip_tos = 0;
+
+  // Total length of datagram (16 bits): IP header + ICMP header + ICMP data
+  iphdr.ip_len = htons (IP4_HDRLEN + ICMP_HDRLEN + datalen);
+
+  // ID sequence number (16 bits): unused, since single datagram
+  iphdr.ip_id = htons (0);
+
+  // Flags, and Fragmentation offset (3, 13 bits): 0 since single datagram
+
+  // Zero (1 bit)
+  ip_flags[0] = 0;
+
+  // Do not fragment flag (1 bit)
+  ip_flags[1] = 0;
+
+  // More fragments following flag (1 bit)
+  ip_flags[2] = 0;
+
+  // Fragmentation offset (13 bits)
+  ip_flags[3] = 0;
+
+  iphdr.ip_off = htons ((ip_flags[0] << 15)
+                      + (ip_flags[1] << 14)
+                      + (ip_flags[2] << 13)
+                      +  ip_flags[3]);
+
+  // Time-to-Live (8 bits): default to maximum value
+  iphdr.ip_ttl = ttl;
+
+  // Transport layer protocol (8 bits): 1 for ICMP
+  iphdr.ip_p = IPPROTO_ICMP;
+
+  // Source IPv4 address (32 bits)
+  if ((status = inet_pton (AF_INET, src_ip, &(iphdr.ip_src))) != 1) {
+    fprintf (stderr, "inet_pton() failed.\nError message: %s", strerror (status));
+    exit (EXIT_FAILURE);
+  }
+
+  // Destination IPv4 address (32 bits)
+  if ((status = inet_pton (AF_INET, dst_ip, &(iphdr.ip_dst))) != 1) {
+    fprintf (stderr, "inet_pton() failed.\nError message: %s", strerror (status));
+    exit (EXIT_FAILURE);
+  }
+
+  // IPv4 header checksum (16 bits): set to 0 when calculating checksum
+  iphdr.ip_sum = 0;
+  iphdr.ip_sum = checksum ((uint16_t *) &iphdr, IP4_HDRLEN);
+
+  // ICMP header
+
+  // Message Type (8 bits): echo request
+  icmphdr.icmp_type = ICMP_ECHO;
+
+  // Message Code (8 bits): echo request
+  icmphdr.icmp_code = 0;
+
+  // Identifier (16 bits): usually pid of sending process - pick a number
+  icmphdr.icmp_id = htons (1000);
+
+  // Sequence Number (16 bits): starts at 0
+  icmphdr.icmp_seq = htons (0);
+
+  // ICMP header checksum (16 bits): set to 0 when calculating checksum
+  icmphdr.icmp_cksum = 0;
+
+  // Fill out ethernet frame header.
+
+  // Destination and Source MAC addresses
+  memcpy (snd_ether_frame, dst_mac, 6 * sizeof (uint8_t));
+  memcpy (snd_ether_frame + 6, src_mac, 6 * sizeof (uint8_t));
+
+  // Next is ethernet type code (ETH_P_IP for IPv4).
+  // http://www.iana.org/assignments/ethernet-numbers
+  snd_ether_frame[12] = ETH_P_IP / 256;
+  snd_ether_frame[13] = ETH_P_IP % 256;
+
+  // Next is ethernet frame data (IPv4 header + ICMP header + ICMP data).
+
+  // IPv4 header
+  memcpy (snd_ether_frame + ETH_HDRLEN, &iphdr, IP4_HDRLEN * sizeof (uint8_t));
+
+  // ICMP header
+  memcpy (snd_ether_frame + ETH_HDRLEN + IP4_HDRLEN, &icmphdr, ICMP_HDRLEN * sizeof (uint8_t));
+
+  // ICMP data
+  memcpy (snd_ether_frame + ETH_HDRLEN + IP4_HDRLEN + ICMP_HDRLEN, data, datalen * sizeof (uint8_t));
+
+  // Calcuate ICMP checksum
+  icmphdr.icmp_cksum = checksum ((uint16_t *) (snd_ether_frame + ETH_HDRLEN + IP4_HDRLEN), ICMP_HDRLEN + datalen);
+  memcpy (snd_ether_frame + ETH_HDRLEN + IP4_HDRLEN, &icmphdr, ICMP_HDRLEN * sizeof (uint8_t));
+
+  // Free allocated memory.
+  free (ip_flags);
+
+  return (EXIT_SUCCESS);
+}
+
+// Create a UDP ethernet frame.
+int
+create_udp_frame (uint8_t *snd_ether_frame, char *src_ip, char *dst_ip, uint8_t *src_mac, uint8_t *dst_mac,
+                  int ttl, uint8_t *data, int datalen)
+{
+  int status, *ip_flags;
+  struct ip iphdr;
+  struct udphdr udphdr;
+
+  // Allocate memory for various arrays.
+  ip_flags = allocate_intmem (4);
+
+  // IPv4 header
+
+  // IPv4 header length (4 bits): Number of 32-bit words in header = 5
+  iphdr.ip_hl = IP4_HDRLEN / sizeof (uint32_t);
+
+  // Internet Protocol version (4 bits): IPv4
+  iphdr.ip_v = 4;
+
+  // Type of service (8 bits)
+  iphdr.ip_tos = 0;
+
+  // Total length of datagram (16 bits): IP header + UDP header + datalen
+  iphdr.ip_len = htons (IP4_HDRLEN + UDP_HDRLEN + datalen);
+
+  // ID sequence number (16 bits): unused, since single datagram
+  iphdr.ip_id = htons (0);
+
+  // Flags, and Fragmentation offset (3, 13 bits): 0 since single datagram
+
+  // Zero (1 bit)
+  ip_flags[0] = 0;
+
+  // Do not fragment flag (1 bit)
+  ip_flags[1] = 0;
+
+  // More fragments following flag (1 bit)
+  ip_flags[2] = 0;
+
+  // Fragmentation offset (13 bits)
+  ip_flags[3] = 0;
+
+  iphdr.ip_off = htons ((ip_flags[0] << 15)
+                      + (ip_flags[1] << 14)
+                      + (ip_flags[2] << 13)
+                      +  ip_flags[3]);
+
+  // Time-to-Live (8 bits): default to maximum value
+  iphdr.ip_ttl = ttl;
+
+  // Transport layer protocol (8 bits): 17 for UDP
+  iphdr.ip_p = IPPROTO_UDP;
+
+  // Source IPv4 address (32 bits)
+  if ((status = inet_pton (AF_INET, src_ip, &(iphdr.ip_src))) != 1) {
+    fprintf (stderr, "inet_pton() failed.\nError message: %s", strerror (status));
+    exit (EXIT_FAILURE);
+  }
+
+  // Destination IPv4 address (32 bits)
+  if ((status = inet_pton (AF_INET, dst_ip, &(iphdr.ip_dst))) != 1) {
+    fprintf (stderr, "inet_pton() failed.\nError message: %s", strerror (status));
+    exit (EXIT_FAILURE);
+  }
+
+  // IPv4 header checksum (16 bits): set to 0 when calculating checksum
+  iphdr.ip_sum = 0;
+  iphdr.ip_sum = checksum ((uint16_t *) &iphdr, IP4_HDRLEN);
+
+  // UDP header
+
+  // Source port number (16 bits): pick a number
+  udphdr.uh_sport = htons (4950);
+
+  // Destination port number (16 bits): pick a number
+  udphdr.uh_dport = htons (33435);
+
+  // Length of UDP datagram (16 bits): UDP header + UDP data
+  udphdr.uh_ulen = htons (UDP_HDRLEN + datalen);
+
+  // UDP checksum (16 bits)
+  udphdr.uh_sum = udp4_checksum (iphdr, udphdr, data, datalen);
+
+  // Fill out ethernet frame header.
+
+  // Destination and Source MAC addresses
+  memcpy (snd_ether_frame, dst_mac, 6 * sizeof (uint8_t));
+  memcpy (snd_ether_frame + 6, src_mac, 6 * sizeof (uint8_t));
+
+  // Next is ethernet type code (ETH_P_IP for IPv4).
+  // http://www.iana.org/assignments/ethernet-numbers
+  snd_ether_frame[12] = ETH_P_IP / 256;
+  snd_ether_frame[13] = ETH_P_IP % 256;
+
+  // Next is ethernet frame data (IPv4 header + UDP header + UDP data).
+  // IPv4 header
+  memcpy (snd_ether_frame + ETH_HDRLEN, &iphdr, IP4_HDRLEN * sizeof (uint8_t));
+
+  // UDP header
+  memcpy (snd_ether_frame + ETH_HDRLEN + IP4_HDRLEN, &udphdr, UDP_HDRLEN * sizeof (uint8_t));
+
+  // UDP data
+  memcpy (snd_ether_frame + ETH_HDRLEN + IP4_HDRLEN + UDP_HDRLEN, data, datalen * sizeof (uint8_t));
+
+  // Free allocated memory.
+  free (ip_flags);
+
+  return (EXIT_SUCCESS);
+}
+
+// Checksum function
+uint16_t
+checksum (uint16_t *addr, int len)
+{
+  int nleft = len;
+  int sum = 0;
+  uint16_t *w = addr;
+  uint16_t answer = 0;
+
+  while (nleft > 1) {
+    sum += *w++;
+    nleft -= sizeof (uint16_t);
+  }
+
+  if (nleft == 1) {
+    *(uint8_t *) (&answer) = *(uint8_t *) w;
+    sum += answer;
+  }
+
+  sum = (sum >> 16) + (sum & 0xFFFF);
+  sum += (sum >> 16);
+  answer = ~sum;
+  return (answer);
+}
+
+// Build IPv4 TCP pseudo-header and call checksum function.
+uint16_t
+tcp4_checksum (struct ip iphdr, struct tcphdr tcphdr, uint8_t *payload, int payloadlen)
+{
+  uint16_t svalue;
+  char buf[IP_MAXPACKET], cvalue;
+  char *ptr;
+  int chksumlen = 0;
+  int i;
+
+  ptr = &buf[0];  // ptr points to beginning of buffer buf
+
+  // Copy source IP address into buf (32 bits)
+  memcpy (ptr, &iphdr.ip_src.s_addr, sizeof (iphdr.ip_src.s_addr));
+  ptr += sizeof (iphdr.ip_src.s_addr);
+  chksumlen += sizeof (iphdr.ip_src.s_addr);
+
+  // Copy destination IP address into buf (32 bits)
+  memcpy (ptr, &iphdr.ip_dst.s_addr, sizeof (iphdr.ip_dst.s_addr));
+  ptr += sizeof (iphdr.ip_dst.s_addr);
+  chksumlen += sizeof (iphdr.ip_dst.s_addr);
+
+  // Copy zero field to buf (8 bits)
+  *ptr = 0; ptr++;
+  chksumlen += 1;
+
+  // Copy transport layer protocol to buf (8 bits)
+  memcpy (ptr, &iphdr.ip_p, sizeof (iphdr.ip_p));
+  ptr += sizeof (iphdr.ip_p);
+  chksumlen += sizeof (iphdr.ip_p);
+
+  // Copy TCP length to buf (16 bits)
+  svalue = htons (sizeof (tcphdr) + payloadlen);
+  memcpy (ptr, &svalue, sizeof (svalue));
+  ptr += sizeof (svalue);
+  chksumlen += sizeof (svalue);
+
+  // Copy TCP source port to buf (16 bits)
+  memcpy (ptr, &tcphdr.th_sport, sizeof (tcphdr.th_sport));
+  ptr += sizeof (tcphdr.th_sport);
+  chksumlen += sizeof (tcphdr.th_sport);
+
+  // Copy TCP destination port to buf (16 bits)
+  memcpy (ptr, &tcphdr.th_dport, sizeof (tcphdr.th_dport));
+  ptr += sizeof (tcphdr.th_dport);
+  chksumlen += sizeof (tcphdr.th_dport);
+
+  // Copy sequence number to buf (32 bits)
+  memcpy (ptr, &tcphdr.th_seq, sizeof (tcphdr.th_seq));
+  ptr += sizeof (tcphdr.th_seq);
+  chksumlen += sizeof (tcphdr.th_seq);
+
+  // Copy acknowledgement number to buf (32 bits)
+  memcpy (ptr, &tcphdr.th_ack, sizeof (tcphdr.th_ack));
+  ptr += sizeof (tcphdr.th_ack);
+  chksumlen += sizeof (tcphdr.th_ack);
+
+  // Copy data offset to buf (4 bits) and
+  // copy reserved bits to buf (4 bits)
+  cvalue = (tcphdr.th_off << 4) + tcphdr.th_x2;
+  memcpy (ptr, &cvalue, sizeof (cvalue));
+  ptr += sizeof (cvalue);
+  chksumlen += sizeof (cvalue);
+
+  // Copy TCP flags to buf (8 bits)
+  memcpy (ptr, &tcphdr.th_flags, sizeof (tcphdr.th_flags));
+  ptr += sizeof (tcphdr.th_flags);
+  chksumlen += sizeof (tcphdr.th_flags);
+
+  // Copy TCP window size to buf (16 bits)
+  memcpy (ptr, &tcphdr.th_win, sizeof (tcphdr.th_win));
+  ptr += sizeof (tcphdr.th_win);
+  chksumlen += sizeof (tcphdr.th_win);
+
+  // Copy TCP checksum to buf (16 bits)
+  // Zero, since we don't know it yet
+  *ptr = 0; ptr++;
+  *ptr = 0; ptr++;
+  chksumlen += 2;
+
+  // Copy urgent pointer to buf (16 bits)
+  memcpy (ptr, &tcphdr.th_urp, sizeof (tcphdr.th_urp));
+  ptr += sizeof (tcphdr.th_urp);
+  chksumlen += sizeof (tcphdr.th_urp);
+
+  // Copy payload to buf
+  memcpy (ptr, payload, payloadlen);
+  ptr += payloadlen;
+  chksumlen += payloadlen;
+
+  // Pad to the next 16-bit boundary
+  for (i=0; i<payloadlen%2; i++, ptr++) {
+    *ptr = 0;
+    ptr++;
+    chksumlen++;
+  }
+
+  return checksum ((uint16_t *) buf, chksumlen);
+}
+
+// Build IPv4 ICMP pseudo-header and call checksum function.
+uint16_t
+icmp4_checksum (struct icmp icmphdr, uint8_t *payload, int payloadlen)
+{
+  char buf[IP_MAXPACKET];
+  char *ptr;
+  int chksumlen = 0;
+  int i;
+
+  ptr = &buf[0];  // ptr points to beginning of buffer buf
+
+  // Copy Message Type to buf (8 bits)
+  memcpy (ptr, &icmphdr.icmp_type, sizeof (icmphdr.icmp_type));
+  ptr += sizeof (icmphdr.icmp_type);
+  chksumlen += sizeof (icmphdr.icmp_type);
+
+  // Copy Message Code to buf (8 bits)
+  memcpy (ptr, &icmphdr.icmp_code, sizeof (icmphdr.icmp_code));
+  ptr += sizeof (icmphdr.icmp_code);
+  chksumlen += sizeof (icmphdr.icmp_code);
+
+  // Copy ICMP checksum to buf (16 bits)
+  // Zero, since we don't know it yet
+  *ptr = 0; ptr++;
+  *ptr = 0; ptr++;
+  chksumlen += 2;
+
+  // Copy Identifier to buf (16 bits)
+  memcpy (ptr, &icmphdr.icmp_id, sizeof (icmphdr.icmp_id));
+  ptr += sizeof (icmphdr.icmp_id);
+  chksumlen += sizeof (icmphdr.icmp_id);
+
+  // Copy Sequence Number to buf (16 bits)
+  memcpy (ptr, &icmphdr.icmp_seq, sizeof (icmphdr.icmp_seq));
+  ptr += sizeof (icmphdr.icmp_seq);
+  chksumlen += sizeof (icmphdr.icmp_seq);
+
+  // Copy payload to buf
+  memcpy (ptr, payload, payloadlen);
+  ptr += payloadlen;
+  chksumlen += payloadlen;
+
+  // Pad to the next 16-bit boundary
+  for (i=0; i<payloadlen%2; i++, ptr++) {
+    *ptr = 0;
+    ptr++;
+    chksumlen++;
+  }
+
+  return checksum ((uint16_t *) buf, chksumlen);
+}
+
+// Build IPv4 UDP pseudo-header and call checksum function.
+uint16_t
+udp4_checksum (struct ip iphdr, struct udphdr udphdr, uint8_t *payload, int payloadlen)
+{
+  char buf[IP_MAXPACKET];
+  char *ptr;
+  int chksumlen = 0;
+  int i;
+
+  ptr = &buf[0];  // ptr points to beginning of buffer buf
+
+  // Copy source IP address into buf (32 bits)
+  memcpy (ptr, &iphdr.ip_src.s_addr, sizeof (iphdr.ip_src.s_addr));
+  ptr += sizeof (iphdr.ip_src.s_addr);
+  chksumlen += sizeof (iphdr.ip_src.s_addr);
+
+  // Copy destination IP address into buf (32 bits)
+  memcpy (ptr, &iphdr.ip_dst.s_addr, sizeof (iphdr.ip_dst.s_addr));
+  ptr += sizeof (iphdr.ip_dst.s_addr);
+  chksumlen += sizeof (iphdr.ip_dst.s_addr);
+
+  // Copy zero field to buf (8 bits)
+  *ptr = 0; ptr++;
+  chksumlen += 1;
+
+  // Copy transport layer protocol to buf (8 bits)
+  memcpy (ptr, &iphdr.ip_p, sizeof (iphdr.ip_p));
+  ptr += sizeof (iphdr.ip_p);
+  chksumlen += sizeof (iphdr.ip_p);
+
+  // Copy UDP length to buf (16 bits)
+  memcpy (ptr, &udphdr.uh_ulen, sizeof (udphdr.uh_ulen));
+  ptr += sizeof (udphdr.uh_ulen);
+  chksumlen += sizeof (udphdr.uh_ulen);
+
+  // Copy UDP source port to buf (16 bits)
+  memcpy (ptr, &udphdr.uh_sport, sizeof (udphdr.uh_sport));
+  ptr += sizeof (udphdr.uh_sport);
+  chksumlen += sizeof (udphdr.uh_sport);
+
+  // Copy UDP destination port to buf (16 bits)
+  memcpy (ptr, &udphdr.uh_dport, sizeof (udphdr.uh_dport));
+  ptr += sizeof (udphdr.uh_dport);
+  chksumlen += sizeof (udphdr.uh_dport);
+
+  // Copy UDP length again to buf (16 bits)
+  memcpy (ptr, &udphdr.uh_ulen, sizeof (udphdr.uh_ulen));
+  ptr += sizeof (udphdr.uh_ulen);
+  chksumlen += sizeof (udphdr.uh_ulen);
+
+  // Copy UDP checksum to buf (16 bits)
+  // Zero, since we don't know it yet
+  *ptr = 0; ptr++;
+  *ptr = 0; ptr++;
+  chksumlen += 2;
+
+  // Copy payload to buf
+  memcpy (ptr, payload, payloadlen);
+  ptr += payloadlen;
+  chksumlen += payloadlen;
+
+  // Pad to the next 16-bit boundary
+  for (i=0; i<payloadlen%2; i++, ptr++) {
+    *ptr = 0;
+    ptr++;
+    chksumlen++;
+  }
+
+  return checksum ((uint16_t *) buf, chksumlen);
+}
+// Add bytes to a running ones' complement sum of 16-bit words in host byte order.
+// Data need not be aligned, so this can run directly over a memory-mapped file.
+uint32_t
+sum_bytes (uint32_t sum, uint8_t *data, int len)
+{
+  while (len > 1) {
+    sum += (data[0] << 8) + data[1];
+    data += 2;
+    len -= 2;
+  }
+
+  // Odd byte is padded with zero.
+  if (len == 1) {
+    sum += data[0] << 8;
+  }
+
+  return (sum);
+}
+
+// Fold a 32-bit running sum into 16 bits, with end-around carry.
+uint16_t
+fold_sum (uint32_t sum)
+{
+  while (sum >> 16) {
+    sum = (sum & 0xffff) + (sum >> 16);
+  }
+
+  return ((uint16_t) sum);
+}
+
+// Update a checksum for a 32-bit field (e.g., an IPv4 address) changing from old to new.
+uint16_t
+csum_update32 (uint16_t check, uint32_t old, uint32_t new)
+{
+  uint32_t sum;
+
+  sum = (~check & 0xffff) + (~old >> 16) + (~old & 0xffff) + (new >> 16) + (new & 0xffff);
+
+  return (~fold_sum (sum) & 0xffff);
+}
+
+// SIGINT handler: stop after the current benchmark.
+void
+sig_handler (int signum)
+{
+  (void) signum;
+  stop = 1;
+}
+
+// Allocate memory for an array of chars.
+char *
+allocate_strmem (int len)
+{
+  void *tmp;
+
+  if (len <= 0) {
+    fprintf (stderr, "ERROR: Cannot allocate memory because len = %i in allocate_strmem().\n", len);
+    exit (EXIT_FAILURE);
+  }
+
+  tmp = (char *) malloc (len * sizeof (char));
+  if (tmp != NULL) {
+    memset (tmp, 0, len * sizeof (char));
+    return (tmp);
+  } else {
+    fprintf (stderr, "ERROR: Cannot allocate memory for array allocate_strmem().\n");
+    exit (EXIT_FAILURE);
+  }
+}
+
+// Allocate memory for an array of unsigned chars.
+uint8_t *
+allocate_ustrmem (int len)
+{
+  void *tmp;
+
+  if (len <= 0) {
+    fprintf (stderr, "ERROR: Cannot allocate memory because len = %i in allocate_ustrmem().\n", len);
+    exit (EXIT_FAILURE);
+  }
+
+  tmp = (uint8_t *) malloc (len * sizeof (uint8_t));
+  if (tmp != NULL) {
+    memset (tmp, 0, len * sizeof (uint8_t));
+    return (tmp);
+  } else {
+    fprintf (stderr, "ERROR: Cannot allocate memory for array allocate_ustrmem().\n");
+    exit (EXIT_FAILURE);
+  }
+}
+
+// Allocate memory for an array of ints.
+int *
+allocate_intmem (int len)
+{
+  void *tmp;
+
+  if (len <= 0) {
+    fprintf (stderr, "ERROR: Cannot allocate memory because len = %i in allocate_intmem().\n", len);
+    exit (EXIT_FAILURE);
+  }
+
+  tmp = (int *) malloc (len * sizeof (int));
+  if (tmp != NULL) {
+    memset (tmp, 0, len * sizeof (int));
+    return (tmp);
+  } else {
+    fprintf (stderr, "ERROR: Cannot allocate memory for array allocate_intmem().\n");
+    exit (EXIT_FAILURE);
+  }
+}
@@ -0,0 +1,1220 @@
+/*  Copyright (C) 2013  P.D. Buchan (pdbuchan@yahoo.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// HTTP load generator: open many IPv4 TCP connections to a web server via raw socket at
+// the link layer (ethernet frame), send an HTTP GET on each, and receive the response.
+// Need to have destination MAC address.
+// Unlike get4_ll.c, a real conversation takes place: a small TCP state machine in this
+// program does the three-way handshake, sends the request (retransmitting as needed),
+// acknowledges the response in order, and answers the server's FIN with its own.
+// Connections are kept in a flat array and found by a hash table of (address, port),
+// so one process can hold 100,000 or more at once without any kernel sockets.
+// Our source addresses must NOT be assigned to this host, or its own TCP stack would reset
+// each connection on seeing the server's SYN-ACK. Instead, we answer ARP requests for
+// them ourselves. The server (or gateway) must see them as on-link, via this interface.
+// The request is rendered once, as a template: each connection's own fields (object
+// number in the path, session cookie, request ID) have fixed widths and offsets, and are
+// written straight into the frame, with the checksum of the rest already summed.
+
+#define _GNU_SOURCE           // sendmmsg(), recvmmsg() and struct mmsghdr
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>           // close()
+#include <string.h>           // strcpy, memset(), and memcpy()
+
+#include <netdb.h>            // struct addrinfo
+#include <sys/types.h>        // needed for socket(), uint8_t, uint16_t, uint32_t
+#include <sys/socket.h>       // needed for socket(), sendmmsg(), recvmmsg()
+#include <netinet/in.h>       // IPPROTO_TCP, INET_ADDRSTRLEN
+#include <netinet/ip.h>       // struct ip and IP_MAXPACKET (which is 65535)
+#define __FAVOR_BSD           // Use BSD format of tcp header
+#include <netinet/tcp.h>      // struct tcphdr
+#include <arpa/inet.h>        // inet_pton() and inet_ntop()
+#include <sys/ioctl.h>        // macro ioctl is defined
+#include <bits/ioctls.h>      // defines values for argument "request" of ioctl.
+#include <net/if.h>           // struct ifreq
+#include <linux/if_ether.h>   // ETH_P_IP = 0x0800, ETH_P_ARP = 0x0806
+#include <linux/if_packet.h>  // struct sockaddr_ll (see man 7 packet)
+#include <net/ethernet.h>
+#include <poll.h>             // poll()
+#include <signal.h>           // signal(), SIGINT
+#include <sys/random.h>       // getrandom()
+#include <time.h>             // clock_gettime()
+
+#include <errno.h>            // errno, perror()
+
+// Define some constants.
+#define ETH_HDRLEN 14         // Ethernet header length
+#define IP4_HDRLEN 20         // IPv4 header length
+#define TCP_HDRLEN 20         // TCP header length, excludes options data
+#define ARP_HDRLEN 28         // ARP header length
+#define BATCH 64              // Frames per sendmmsg() or recvmmsg()
+#define MAX_FRAMELEN 2048     // Room for each frame in a transmit batch
+#define MAX_RXLEN (ETH_HDRLEN + IP_MAXPACKET)  // Room for each received frame (GRO may exceed MTU)
+#define MSS 1460              // Maximum segment size we advertise
+#define PORT_LO 1024          // Range of source ports used on each source address
+#define PORT_HI 65535
+#define RTO_INIT 1000         // Initial retransmission timeout, in ms (RFC 6298)
+#define MAX_RETRIES 5         // Retransmissions before a connection is abandoned
+#define IDLE_TIMEOUT 30000    // Time to wait for (more of) a response, in ms
+#define TIMER_TICK 10         // Interval between checks of retransmission timers, in ms
+#define WHEEL_SLOTS 4096      // Slots of timer wheel, one per tick (power of 2): 40.96 s, beyond any timeout
+#define MAX_REQLEN 1024       // Maximum length of HTTP request (must fit in one segment)
+
+// Per-connection fields of HTTP request, written as fixed-width hexadecimal numbers
+#define FIELD_PATH 0          // Object number, appended to filename
+#define FIELD_COOKIE 1        // Session cookie
+#define FIELD_ID 2            // Request ID
+#define NFIELDS 3
+
+// Connection states
+#define CONN_FREE 0           // Slot not in use
+#define CONN_SYN_SENT 1       // SYN sent, waiting for SYN-ACK
+#define CONN_ESTABLISHED 2    // Request sent, receiving response
+#define CONN_LAST_ACK 3       // Server has closed, our FIN sent, waiting for its ACK
+
+// Define a struct for a connection.
+typedef struct _conn conn;
+struct _conn {
+  uint32_t saddr;       // Our IPv4 address for this connection (host byte order)
+  uint16_t sport;       // Our port
+  uint8_t state;        // One of CONN_*
+  uint8_t retries;      // Retransmissions of segment now outstanding
+  uint32_t iss;         // Initial send sequence number
+  uint32_t snd_una;     // Oldest unacknowledged sequence number
+  uint32_t snd_nxt;     // Next sequence number to send
+  uint32_t rcv_nxt;     // Next sequence number expected from server
+  uint32_t rto;         // Current retransmission timeout, in ms
+  uint64_t deadline;    // When retransmission (or idle) timer expires, in ms
+  int wheel_slot;       // Slot of timer wheel it is in, or -1
+  int wheel_prev;       // Previous and next connection in that slot, or -1
+  int wheel_next;
+  uint32_t rcvd;        // Response bytes received
+  int status;           // HTTP status code of response, or 0 until seen
+  uint32_t serial;      // Number of connection, counting from 0 (for fields of request)
+};
+
+// Define a struct for an HTTP request template.
+typedef struct _request_template request_template;
+struct _request_template {
+  uint8_t bytes[MAX_REQLEN];  // Request, with per-connection fields zeroed
+  int len;
+  int off[NFIELDS];     // Offset of each field in request
+  int width[NFIELDS];   // Width of each field, in hexadecimal digits
+  uint32_t sum;         // One's complement sum of request with fields zeroed (host byte order)
+};
+
+// Define a struct for the TCP engine: connections, their hash table, and transmit batch.
+typedef struct _engine engine;
+struct _engine {
+  conn *conns;          // Connection slots
+  int nconns;
+  uint32_t *table;      // Hash table of connections: index into conns + 1, or 0 if empty
+  uint32_t mask;        // Size of hash table - 1
+  int *wheel;           // Timer wheel: first connection whose deadline falls in each tick, or -1
+  uint64_t wheel_tick;  // Next tick of timer wheel to check (ms / TIMER_TICK)
+  int *free_slots;      // Stack of unused connection slots
+  int nfree;
+  uint32_t src_base;    // First of our source addresses (host byte order)
+  int nsrc;             // Number of source addresses
+  uint64_t next_port;   // Counter over (address, port) pairs, for choosing next one
+  uint32_t dst;         // Server address (host byte order)
+  uint16_t dport;       // Server port
+  request_template tmpl;  // HTTP request sent on every connection
+  uint32_t nobjects;    // Number of objects requested in turn (see FIELD_PATH)
+  uint32_t ip_base;     // Partial IPv4 header checksum over fields common to all packets
+  uint32_t tcp_base;    // Partial TCP checksum over pseudo-header fields common to all packets
+  uint8_t ether[ETH_HDRLEN];  // Ethernet header of every IPv4 frame
+  uint8_t src_mac[6];
+  int sd;               // Socket descriptor for sending
+  struct sockaddr_ll device;
+  uint8_t *frames;      // Transmit batch
+  struct mmsghdr msgs[BATCH];
+  struct iovec iovs[BATCH];
+  int ntx;              // Frames waiting in transmit batch
+  uint64_t secret;      // Key for hash in initial sequence numbers
+  uint64_t opened, completed, failed, resets, timeouts, retransmits, ok, bytes;
+};
+
+// Function prototypes
+int conn_open (engine *, int, uint64_t);
+void conn_close (engine *, conn *, int);
+void conn_reset (engine *, conn *);
+conn *conn_lookup (engine *, uint32_t, uint16_t);
+void conn_insert (engine *, int);
+void conn_remove (engine *, conn *);
+uint32_t conn_hash (engine *, uint32_t, uint16_t);
+void tcp_input (engine *, uint8_t *, int, uint64_t);
+void tcp_output (engine *, conn *, uint8_t, uint32_t, int, int);
+void tcp_timers (engine *, uint64_t);
+void timer_set (engine *, conn *, uint64_t);
+void timer_cancel (engine *, conn *);
+void arp_input (engine *, uint8_t *, int);
+void tx_flush (engine *);
+int tmpl_init (request_template *, char *, char *, char *);
+uint32_t tmpl_fill (request_template *, uint8_t *, uint64_t *);
+uint64_t mix64 (uint64_t);
+uint64_t now_ms (void);
+void put16 (uint8_t *, uint16_t);
+void put32 (uint8_t *, uint32_t);
+uint16_t get16 (const uint8_t *);
+uint32_t get32 (const uint8_t *);
+uint32_t sum_bytes (uint32_t, const uint8_t *, int);
+uint16_t fold_sum (uint32_t);
+void sig_handler (int);
+char *allocate_strmem (int);
+uint8_t *allocate_ustrmem (int);
+
+// Set by SIGINT handler to stop: connections still open are then reset.
+volatile sig_atomic_t stop = 0;
+
+int
+main (int argc, char **argv)
+{
+  int i, n, status, sd, rd, nconns, rate, count, size;
+  char *interface, *target, *src_ip, *dst_ip, *url, *directory, *filename;
+  uint8_t *dst_mac, *rxframes, hdr[IP4_HDRLEN];
+  uint64_t now, start, next_tick, next_report, last_bytes;
+  struct addrinfo hints, *res;
+  struct sockaddr_in *ipv4;
+  struct sockaddr_ll from[BATCH];
+  struct ifreq ifr;
+  struct mmsghdr rxmsgs[BATCH];
+  struct iovec rxiovs[BATCH];
+  struct in_addr addr;
+  struct pollfd pfd;
+  engine *e;
+  void *tmp;
+
+  // Allocate memory for various arrays.
+  e = (engine *) allocate_ustrmem (sizeof (engine));
+  dst_mac = allocate_ustrmem (6);
+  interface = allocate_strmem (40);
+  target = allocate_strmem (40);
+  src_ip = allocate_strmem (INET_ADDRSTRLEN);
+  dst_ip = allocate_strmem (INET_ADDRSTRLEN);
+  url = allocate_strmem (40);
+  directory = allocate_strmem (80);
+  filename = allocate_strmem (80);
+  rxframes = allocate_ustrmem (BATCH * MAX_RXLEN);
+  e->frames = allocate_ustrmem (BATCH * MAX_FRAMELEN);
+
+  // Set TCP data: server closes the connection once it has sent the response.
+  // Connections request objects filename0000, filename0001, ... in turn.
+  strcpy (url, "www.google.com");  // Could be URL or IPv4 address
+  strcpy (directory, "/");
+  strcpy (filename, "filename");
+  e->nobjects = 1000;
+  tmpl_init (&e->tmpl, directory, filename, url);
+
+  // Interface to send packets through.
+  strcpy (interface, "eth0");
+
+  // First of our source IPv4 addresses, and how many consecutive ones to use.
+  // Each gives (PORT_HI - PORT_LO + 1) connections at once. You need to fill this out
+  strcpy (src_ip, "192.168.1.200");
+  e->nsrc = 4;
+
+  // Destination URL or IPv4 address, and port: you need to fill this out
+  strcpy (target, "www.google.com");
+  e->dport = 80;
+
+  // Connections to keep open at once, new connections per second,
+  // and total connections to make (0 to keep going until interrupted).
+  nconns = 100000;
+  rate = 20000;
+  count = 0;
+
+  // Submit request for a socket descriptor to look up interface.
+  if ((sd = socket (PF_PACKET, SOCK_RAW, htons (ETH_P_ALL))) < 0) {
+    perror ("socket() failed to get socket descriptor for using ioctl() ");
+    exit (EXIT_FAILURE);
+  }
+
+  // Use ioctl() to look up interface name and get its MAC address.
+  memset (&ifr, 0, sizeof (ifr));
+  snprintf (ifr.ifr_name, sizeof (ifr.ifr_name), "%s", interface);
+  if (ioctl (sd, SIOCGIFHWADDR, &ifr) < 0) {
+    perror ("ioctl() failed to get source MAC address ");
+    return (EXIT_FAILURE);
+  }
+  close (sd);
+
+  // Copy source MAC address.
+  memcpy (e->src_mac, ifr.ifr_hwaddr.sa_data, 6 * sizeof (uint8_t));
+
+  // Report source MAC address to stdout.
+  printf ("MAC address for interface %s is ", interface);
+  for (i=0; i<5; i++) {
+    printf ("%02x:", e->src_mac[i]);
+  }
+  printf ("%02x\n", e->src_mac[5]);
+
+  // Find interface index from interface name and store index in
+  // struct sockaddr_ll device, which will be used as an argument of sendmmsg().
+  if ((e->device.sll_ifindex = if_nametoindex (interface)) == 0) {
+    perror ("if_nametoindex() failed to obtain interface index ");
+    exit (EXIT_FAILURE);
+  }
+  printf ("Index for interface %s is %i\n", interface, e->device.sll_ifindex);
+
+  // Set destination MAC address: you need to fill these out
+  dst_mac[0] = 0xff;
+  dst_mac[1] = 0xff;
+  dst_mac[2] = 0xff;
+  dst_mac[3] = 0xff;
+  dst_mac[4] = 0xff;
+  dst_mac[5] = 0xff;
+
+  // Fill out hints for getaddrinfo().
+  memset (&hints, 0, sizeof (struct addrinfo));
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = hints.ai_flags | AI_CANONNAME;
+
+  // Resolve target using getaddrinfo().
+  if ((status = getaddrinfo (target, NULL, &hints, &res)) != 0) {
+    fprintf (stderr, "getaddrinfo() failed: %s\n", gai_strerror (status));
+    exit (EXIT_FAILURE);
+  }
+  ipv4 = (struct sockaddr_in *) res->ai_addr;
+  tmp = &(ipv4->sin_addr);
+  if (inet_ntop (AF_INET, tmp, dst_ip, INET_ADDRSTRLEN) == NULL) {
+    status = errno;
+    fprintf (stderr, "inet_ntop() failed.\nError message: %s", strerror (status));
+    exit (EXIT_FAILURE);
+  }
+  e->dst = ntohl (ipv4->sin_addr.s_addr);
+  freeaddrinfo (res);
+
+  if ((status = inet_pton (AF_INET, src_ip, &addr)) != 1) {
+    fprintf (stderr, "inet_pton() failed.\nError message: %s", strerror (status));
+    exit (EXIT_FAILURE);
+  }
+  e->src_base = ntohl (addr.s_addr);
+
+  if (nconns > (e->nsrc * (PORT_HI - PORT_LO + 1))) {
+    fprintf (stderr, "ERROR: %i connections need more than %i source addresses.\n", nconns, e->nsrc);
+    exit (EXIT_FAILURE);
+  }
+
+  // Fill out sockaddr_ll.
+  e->device.sll_family = AF_PACKET;
+  memcpy (e->device.sll_addr, e->src_mac, 6 * sizeof (uint8_t));
+  e->device.sll_halen = 6;
+
+  // Ethernet header, the same for every IPv4 frame.
+  memcpy (e->ether, dst_mac, 6 * sizeof (uint8_t));
+  memcpy (e->ether + 6, e->src_mac, 6 * sizeof (uint8_t));
+  e->ether[12] = ETH_P_IP / 256;
+  e->ether[13] = ETH_P_IP % 256;
+
+  // Partial checksums. IPv4 header: all fields but total length and source address, which
+  // differ between packets. TCP pseudo-header: destination address and protocol.
+  memset (hdr, 0, IP4_HDRLEN * sizeof (uint8_t));
+  hdr[0] = (4 << 4) + (IP4_HDRLEN / 4);  // Version 4, header length
+  hdr[6] = IP_DF >> 8;                   // Don't Fragment
+  hdr[8] = 64;                           // Time-to-Live
+  hdr[9] = IPPROTO_TCP;
+  put32 (hdr + 16, e->dst);
+  e->ip_base = sum_bytes (0, hdr, IP4_HDRLEN);
+  e->tcp_base = sum_bytes (IPPROTO_TCP, hdr + 16, 4);
+
+  // Connection slots, all free, and hash table at most half full.
+  e->nconns = nconns;
+  e->conns = (conn *) allocate_ustrmem (nconns * sizeof (conn));
+  e->free_slots = (int *) allocate_ustrmem (nconns * sizeof (int));
+  for (i=0; i<nconns; i++) {
+    e->free_slots[i] = nconns - 1 - i;
+  }
+  e->nfree = nconns;
+  size = 1;
+  while (size < (2 * nconns)) {
+    size *= 2;
+  }
+  e->table = (uint32_t *) allocate_ustrmem (size * sizeof (uint32_t));
+  e->mask = size - 1;
+
+  // Timer wheel, empty.
+  e->wheel = (int *) allocate_ustrmem (WHEEL_SLOTS * sizeof (int));
+  for (i=0; i<WHEEL_SLOTS; i++) {
+    e->wheel[i] = -1;
+  }
+
+  // Key for initial sequence numbers.
+  if (getrandom (&e->secret, sizeof (e->secret), 0) != sizeof (e->secret)) {
+    perror ("getrandom() failed ");
+    exit (EXIT_FAILURE);
+  }
+
+  // Transmit batch.
+  memset (e->msgs, 0, sizeof (e->msgs));
+  for (i=0; i<BATCH; i++) {
+    e->iovs[i].iov_base = e->frames + (i * MAX_FRAMELEN);
+    e->msgs[i].msg_hdr.msg_iov = &e->iovs[i];
+    e->msgs[i].msg_hdr.msg_iovlen = 1;
+    e->msgs[i].msg_hdr.msg_name = &e->device;
+    e->msgs[i].msg_hdr.msg_namelen = sizeof (struct sockaddr_ll);
+  }
+
+  // Submit request for raw socket descriptors: one to send, and one to receive everything
+  // arriving on the interface (IPv4 for us, and ARP requests for our addresses).
+  if ((e->sd = socket (PF_PACKET, SOCK_RAW, htons (ETH_P_ALL))) < 0) {
+    perror ("socket() failed ");
+    exit (EXIT_FAILURE);
+  }
+  if ((rd = socket (PF_PACKET, SOCK_RAW, htons (ETH_P_ALL))) < 0) {
+    perror ("socket() failed ");
+    exit (EXIT_FAILURE);
+  }
+  memset (&from[0], 0, sizeof (struct sockaddr_ll));
+  from[0].sll_family = AF_PACKET;
+  from[0].sll_protocol = htons (ETH_P_ALL);
+  from[0].sll_ifindex = e->device.sll_ifindex;
+  if (bind (rd, (struct sockaddr *) &from[0], sizeof (struct sockaddr_ll)) < 0) {
+    perror ("bind() failed ");
+    exit (EXIT_FAILURE);
+  }
+
+  // Room for bursts of responses while we are busy sending.
+  size = 32 * 1024 * 1024;
+  if (setsockopt (rd, SOL_SOCKET, SO_RCVBUF, &size, sizeof (size)) < 0) {
+    perror ("setsockopt() failed to set SO_RCVBUF ");
+    exit (EXIT_FAILURE);
+  }
+
+  memset (rxmsgs, 0, sizeof (rxmsgs));
+  for (i=0; i<BATCH; i++) {
+    rxiovs[i].iov_base = rxframes + (i * MAX_RXLEN);
+    rxiovs[i].iov_len = MAX_RXLEN;
+    rxmsgs[i].msg_hdr.msg_iov = &rxiovs[i];
+    rxmsgs[i].msg_hdr.msg_iovlen = 1;
+    rxmsgs[i].msg_hdr.msg_name = &from[i];
+    rxmsgs[i].msg_hdr.msg_namelen = sizeof (struct sockaddr_ll);
+  }
+  pfd.fd = rd;
+  pfd.events = POLLIN;
+
+  signal (SIGINT, sig_handler);
+
+  printf ("Up to %i connections to %s port %u, %i new per second\n", nconns, dst_ip, e->dport, rate);
+
+  start = now_ms ();
+  next_tick = start + TIMER_TICK;
+  e->wheel_tick = start / TIMER_TICK;
+  next_report = start + 1000;
+  last_bytes = 0;
+  for (;;) {
+    now = now_ms ();
+
+    // Open new connections, no faster than rate allows.
+    while ((stop == 0) && (e->nfree > 0) && ((count == 0) || (e->opened < (uint64_t) count)) &&
+           (e->opened < ((now - start) * rate / 1000))) {
+      conn_open (e, e->free_slots[--e->nfree], now);
+    }
+
+    // Finished: either interrupted, or every connection made has been closed.
+    if ((stop == 1) || ((count > 0) && (e->opened >= (uint64_t) count) && (e->nfree == e->nconns))) {
+      break;
+    }
+
+    // Process whatever has arrived.
+    n = 0;
+    while ((status = recvmmsg (rd, rxmsgs, BATCH, MSG_DONTWAIT, NULL)) > 0) {
+      for (i=0; i<status; i++) {
+        if (from[i].sll_pkttype == PACKET_OUTGOING) {
+          continue;
+        }
+        if (from[i].sll_protocol == htons (ETH_P_IP)) {
+          tcp_input (e, rxframes + (i * MAX_RXLEN), rxmsgs[i].msg_len, now);
+        } else if (from[i].sll_protocol == htons (ETH_P_ARP)) {
+          arp_input (e, rxframes + (i * MAX_RXLEN), rxmsgs[i].msg_len);
+        }
+      }
+      n += status;
+    }
+
+    // Retransmission and idle timers.
+    if (now >= next_tick) {
+      tcp_timers (e, now);
+      next_tick = now + TIMER_TICK;
+    }
+    tx_flush (e);
+
+    // Report progress once a second.
+    if (now >= next_report) {
+      printf ("active %i  opened %llu  completed %llu (%llu OK)  failed %llu  retransmits %llu  %.1f Mbit/s\n",
+              e->nconns - e->nfree, (unsigned long long) e->opened, (unsigned long long) e->completed,
+              (unsigned long long) e->ok, (unsigned long long) e->failed, (unsigned long long) e->retransmits,
+              (double) (e->bytes - last_bytes) * 8.0 / 1000000.0);
+      last_bytes = e->bytes;
+      next_report += 1000;
+    }
+
+    // Nothing arrived: wait a little for something to.
+    if (n == 0) {
+      poll (&pfd, 1, 1);
+    }
+  }
+
+  // Reset any connections still open, so the server can let them go.
+  n = 0;
+  for (i=0; i<e->nconns; i++) {
+    if (e->conns[i].state != CONN_FREE) {
+      conn_reset (e, &e->conns[i]);
+      conn_close (e, &e->conns[i], 0);
+      n++;
+    }
+  }
+  e->failed -= n;
+  tx_flush (e);
+
+  // Report results.
+  printf ("Opened %llu connections in %g seconds: %llu completed (%llu with 2xx status), %llu failed (%llu reset, %llu timed out)\n",
+          (unsigned long long) e->opened, (double) (now_ms () - start) / 1000.0, (unsigned long long) e->completed,
+          (unsigned long long) e->ok, (unsigned long long) e->failed, (unsigned long long) e->resets,
+          (unsigned long long) e->timeouts);
+  printf ("Reset %i connections still open at finish\n", n);
+  printf ("Received %llu bytes of responses\n", (unsigned long long) e->bytes);
+
+  // Close socket descriptors.
+  close (e->sd);
+  close (rd);
+
+  // Free allocated memory.
+  free (dst_mac);
+  free (interface);
+  free (target);
+  free (src_ip);
+  free (dst_ip);
+  free (url);
+  free (directory);
+  free (filename);
+  free (rxframes);
+  free (e->frames);
+  free (e->conns);
+  free (e->free_slots);
+  free (e->table);
+  free (e->wheel);
+  free (e);
+
+  return (EXIT_SUCCESS);
+}
+
+// Open a connection in slot idx: pick the next free (address, port) pair and send a SYN.
+int
+conn_open (engine *e, int idx, uint64_t now)
+{
+  uint32_t k, saddr;
+  uint16_t sport;
+  uint64_t tries, h;
+  struct timespec ts;
+  conn *c;
+
+  // Pairs are taken in turn, addresses varying fastest, skipping any still in use.
+  tries = (uint64_t) e->nsrc * (PORT_HI - PORT_LO + 1);
+  do {
+    k = e->next_port++ % ((uint64_t) e->nsrc * (PORT_HI - PORT_LO + 1));
+    saddr = e->src_base + (k % e->nsrc);
+    sport = PORT_LO + (k / e->nsrc);
+  } while ((conn_lookup (e, saddr, sport) != NULL) && (--tries > 0));
+
+  // Initial sequence number as in RFC 6528: a 4-microsecond clock plus a keyed hash of
+  // address and port. A reused port so starts beyond where its last connection got to,
+  // and a server still holding that one in TIME-WAIT will accept the new SYN.
+  h = mix64 ((((uint64_t) saddr << 16) | sport) ^ e->secret);
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+
+  c = &e->conns[idx];
+  memset (c, 0, sizeof (conn));
+  c->saddr = saddr;
+  c->sport = sport;
+  c->state = CONN_SYN_SENT;
+  c->iss = (uint32_t) ((((uint64_t) ts.tv_sec * 1000000) + (ts.tv_nsec / 1000)) / 4) + (uint32_t) h;
+  c->snd_una = c->iss;
+  c->snd_nxt = c->iss + 1;
+  c->rto = RTO_INIT;
+  c->wheel_slot = -1;
+  timer_set (e, c, now + c->rto);
+  c->serial = e->opened;
+  conn_insert (e, idx);
+
+  tcp_output (e, c, TH_SYN, c->iss, 0, 0);
+  e->opened++;
+
+  return (EXIT_SUCCESS);
+}
+
+// Close a connection, and return its slot for reuse. Counted as completed if ok is 1.
+void
+conn_close (engine *e, conn *c, int ok)
+{
+  conn_remove (e, c);
+  timer_cancel (e, c);
+  c->state = CONN_FREE;
+  e->free_slots[e->nfree++] = c - e->conns;
+  if (ok) {
+    e->completed++;
+    if ((c->status >= 200) && (c->status < 300)) {
+      e->ok++;
+    }
+  } else {
+    e->failed++;
+  }
+}
+
+// Send RST to abort a connection. Until we have the server's SYN-ACK, there is no sequence
+// number of its for us to acknowledge. After, if some of what we sent is unacknowledged, we
+// cannot know how much of it the server has, so a RST is sent at each end of that range.
+void
+conn_reset (engine *e, conn *c)
+{
+  if (c->state == CONN_SYN_SENT) {
+    tcp_output (e, c, TH_RST, c->snd_nxt, 0, 0);
+    return;
+  }
+  if (c->snd_una != c->snd_nxt) {
+    tcp_output (e, c, TH_RST | TH_ACK, c->snd_una, 0, 0);
+  }
+  tcp_output (e, c, TH_RST | TH_ACK, c->snd_nxt, 0, 0);
+}
+
+// Hash of our address and port: Fibonacci hashing.
+uint32_t
+conn_hash (engine *e, uint32_t saddr, uint16_t sport)
+{
+  return ((uint32_t) (((((uint64_t) saddr << 16) | sport) * 0x9e3779b97f4a7c15ull) >> 32) & e->mask);
+}
+
+// Find the connection using our address and port, or NULL if there is none.
+conn *
+conn_lookup (engine *e, uint32_t saddr, uint16_t sport)
+{
+  uint32_t i;
+  conn *c;
+
+  for (i=conn_hash (e, saddr, sport); e->table[i] != 0; i=(i + 1) & e->mask) {
+    c = &e->conns[e->table[i] - 1];
+    if ((c->sport == sport) && (c->saddr == saddr)) {
+      return (c);
+    }
+  }
+
+  return (NULL);
+}
+
+// Add connection in slot idx to hash table (linear probing).
+void
+conn_insert (engine *e, int idx)
+{
+  uint32_t i;
+
+  for (i=conn_hash (e, e->conns[idx].saddr, e->conns[idx].sport); e->table[i] != 0; i=(i + 1) & e->mask);
+  e->table[i] = idx + 1;
+}
+
+// Remove a connection from hash table. Later entries of the same probe run are shifted
+// back into the hole, so that no tombstones are needed and lookups stay short.
+void
+conn_remove (engine *e, conn *c)
+{
+  uint32_t i, j, k;
+  conn *d;
+
+  for (i=conn_hash (e, c->saddr, c->sport); e->table[i] != (uint32_t) (c - e->conns + 1); i=(i + 1) & e->mask);
+  e->table[i] = 0;
+
+  for (j=(i + 1) & e->mask; e->table[j] != 0; j=(j + 1) & e->mask) {
+    d = &e->conns[e->table[j] - 1];
+    k = conn_hash (e, d->saddr, d->sport);
+
+    // Entry stays if its home slot lies cyclically in (i, j].
+    if ((i <= j) ? ((i < k) && (k <= j)) : ((i < k) || (k <= j))) {
+      continue;
+    }
+    e->table[i] = e->table[j];
+    e->table[j] = 0;
+    i = j;
+  }
+}
+
+// Handle a received IPv4 frame: if it is for one of our connections, advance its state.
+void
+tcp_input (engine *e, uint8_t *frame, int len, uint64_t now)
+{
+  int ihl, off, dlen, tot;
+  uint8_t *ip, *tcp, *data, flags;
+  uint32_t to, seq, ack;
+  conn *c;
+
+  if (len < (ETH_HDRLEN + IP4_HDRLEN)) {
+    return;
+  }
+  ip = frame + ETH_HDRLEN;
+  ihl = (ip[0] & 0x0f) * 4;
+  tot = get16 (ip + 2);
+  if (((ip[0] >> 4) != 4) || (ip[9] != IPPROTO_TCP) || (ihl < IP4_HDRLEN) ||
+      (tot > (len - ETH_HDRLEN)) || (tot < (ihl + TCP_HDRLEN)) || ((get16 (ip + 6) & 0x3fff) != 0)) {
+    return;  // Not TCP, truncated, or a fragment
+  }
+  to = get32 (ip + 16);
+  if ((get32 (ip + 12) != e->dst) || ((to - e->src_base) >= (uint32_t) e->nsrc)) {
+    return;
+  }
+
+  tcp = ip + ihl;
+  off = (tcp[12] >> 4) * 4;
+  if ((off < TCP_HDRLEN) || ((ihl + off) > tot) || (get16 (tcp) != e->dport)) {
+    return;
+  }
+
+  // Checksums are not verified here: the interface has already done so, if it can.
+  if ((c = conn_lookup (e, to, get16 (tcp + 2))) == NULL) {
+    return;
+  }
+  seq = get32 (tcp + 4);
+  ack = get32 (tcp + 8);
+  flags = tcp[13];
+  data = tcp + off;
+  dlen = tot - ihl - off;
+
+  // Reset: accepted if it acknowledges our SYN, or is in sequence.
+  if (flags & TH_RST) {
+    if ((c->state == CONN_SYN_SENT) ? ((flags & TH_ACK) && (ack == c->snd_nxt)) : (seq == c->rcv_nxt)) {
+      e->resets++;
+      conn_close (e, c, 0);
+    }
+    return;
+  }
+
+  // SYN-ACK: complete handshake, acknowledging it with our request.
+  if (c->state == CONN_SYN_SENT) {
+
+    // An ACK of something else is left over from an old connection on this port
+    // (RFC 793, page 66): reset that one, and our SYN will get through when resent.
+    if ((flags & TH_ACK) && (ack != c->snd_nxt)) {
+      tcp_output (e, c, TH_RST, ack, 0, 0);
+      return;
+    }
+    if ((flags & (TH_SYN | TH_ACK)) != (TH_SYN | TH_ACK)) {
+      return;
+    }
+    c->rcv_nxt = seq + 1;
+    c->snd_una = ack;
+    c->state = CONN_ESTABLISHED;
+    c->retries = 0;
+    c->rto = RTO_INIT;
+    tcp_output (e, c, TH_ACK | TH_PUSH, c->snd_nxt, 0, e->tmpl.len);
+    c->snd_nxt += e->tmpl.len;
+    timer_set (e, c, now + c->rto);
+    return;
+  }
+
+  // Repeated SYN-ACK: our ACK of it was lost (along with the request, resent on timeout).
+  if (flags & TH_SYN) {
+    tcp_output (e, c, TH_ACK, c->snd_una, 0, 0);
+    return;
+  }
+  if ((flags & TH_ACK) == 0) {
+    return;
+  }
+
+  // New acknowledgement of what we have sent.
+  if (((int32_t) (ack - c->snd_una) > 0) && ((int32_t) (ack - c->snd_nxt) <= 0)) {
+    c->snd_una = ack;
+    c->retries = 0;
+    c->rto = RTO_INIT;
+    if (c->snd_una == c->snd_nxt) {
+      if (c->state == CONN_LAST_ACK) {
+        conn_close (e, c, 1);
+        return;
+      }
+      timer_set (e, c, now + IDLE_TIMEOUT);
+    } else {
+      timer_set (e, c, now + c->rto);
+    }
+  }
+
+  if ((dlen == 0) && ((flags & TH_FIN) == 0)) {
+    return;
+  }
+
+  // Out of order or repeated: acknowledge what we have, so server resends the rest.
+  if (seq != c->rcv_nxt) {
+    tcp_output (e, c, TH_ACK, c->snd_nxt, 0, 0);
+    return;
+  }
+
+  // In order: take data, noting status code from the response's first line.
+  if (dlen > 0) {
+    if ((c->rcvd == 0) && (dlen >= 12) && (memcmp (data, "HTTP/1.", 7) == 0)) {
+      c->status = ((data[9] - '0') * 100) + ((data[10] - '0') * 10) + (data[11] - '0');
+    }
+    c->rcvd += dlen;
+    c->rcv_nxt += dlen;
+    e->bytes += dlen;
+    if (c->state == CONN_ESTABLISHED) {
+      timer_set (e, c, now + ((c->snd_una == c->snd_nxt) ? IDLE_TIMEOUT : c->rto));
+    }
+  }
+
+  // Server has finished: answer its FIN with ours.
+  if ((flags & TH_FIN) && (c->state == CONN_ESTABLISHED)) {
+    c->rcv_nxt++;
+    tcp_output (e, c, TH_FIN | TH_ACK, c->snd_nxt, 0, 0);
+    c->snd_nxt++;
+    c->state = CONN_LAST_ACK;
+    c->retries = 0;
+    c->rto = RTO_INIT;
+    timer_set (e, c, now + c->rto);
+    return;
+  }
+
+  tcp_output (e, c, TH_ACK, c->snd_nxt, 0, 0);
+}
+
+// Queue a segment for a connection, with sequence number seq, carrying dlen bytes of the
+// HTTP request from offset off (the whole of it, or what is left unacknowledged of it).
+// SYNs carry a maximum segment size option. Batch is sent when full.
+void
+tcp_output (engine *e, conn *c, uint8_t flags, uint32_t seq, int off, int dlen)
+{
+  int optlen, len, tcplen;
+  uint8_t *frame, *ip, *tcp, req[MAX_REQLEN];
+  uint32_t sum, dsum;
+  uint64_t values[NFIELDS];
+
+  if (e->ntx == BATCH) {
+    tx_flush (e);
+  }
+  frame = e->frames + (e->ntx * MAX_FRAMELEN);
+  optlen = (flags & TH_SYN) ? 4 : 0;
+  len = dlen;
+  tcplen = TCP_HDRLEN + optlen + len;
+
+  // Ethernet header
+  memcpy (frame, e->ether, ETH_HDRLEN * sizeof (uint8_t));
+
+  // IPv4 header: fields not common to all packets are total length and source address.
+  ip = frame + ETH_HDRLEN;
+  memset (ip, 0, IP4_HDRLEN * sizeof (uint8_t));
+  ip[0] = (4 << 4) + (IP4_HDRLEN / 4);
+  put16 (ip + 2, IP4_HDRLEN + tcplen);
+  ip[6] = IP_DF >> 8;
+  ip[8] = 64;
+  ip[9] = IPPROTO_TCP;
+  put32 (ip + 12, c->saddr);
+  put32 (ip + 16, e->dst);
+  sum = e->ip_base + IP4_HDRLEN + tcplen + (c->saddr >> 16) + (c->saddr & 0xffff);
+  put16 (ip + 10, ~fold_sum (sum));
+
+  // TCP header
+  tcp = ip + IP4_HDRLEN;
+  put16 (tcp, c->sport);
+  put16 (tcp + 2, e->dport);
+  put32 (tcp + 4, seq);
+  put32 (tcp + 8, (flags & TH_ACK) ? c->rcv_nxt : 0);
+  tcp[12] = ((TCP_HDRLEN + optlen) / 4) << 4;
+  tcp[13] = flags;
+  put16 (tcp + 14, 65535);
+  put32 (tcp + 16, 0);  // Checksum and urgent pointer
+
+  // TCP options: maximum segment size
+  if (optlen > 0) {
+    tcp[20] = 2;
+    tcp[21] = 4;
+    put16 (tcp + 22, MSS);
+  }
+
+  // TCP data: request from template, with this connection's fields filled in.
+  // The whole request's sum comes with it, so only the header is summed here; the tail
+  // of a request partly acknowledged is filled in aside, and summed as it is copied.
+  dsum = 0;
+  if (len > 0) {
+    values[FIELD_PATH] = c->serial % e->nobjects;
+    values[FIELD_COOKIE] = mix64 (c->serial ^ ~e->secret);
+    values[FIELD_ID] = c->serial;
+    if (len == e->tmpl.len) {
+      dsum = tmpl_fill (&e->tmpl, tcp + TCP_HDRLEN + optlen, values);
+    } else {
+      tmpl_fill (&e->tmpl, req, values);
+      memcpy (tcp + TCP_HDRLEN + optlen, req + off, len * sizeof (uint8_t));
+      dsum = sum_bytes (0, tcp + TCP_HDRLEN + optlen, len);
+    }
+  }
+
+  // TCP checksum: pseudo-header, header, then data (which starts on an even offset).
+  sum = e->tcp_base + tcplen + (c->saddr >> 16) + (c->saddr & 0xffff);
+  sum = sum_bytes (sum, tcp, TCP_HDRLEN + optlen);
+  put16 (tcp + 16, ~fold_sum (sum + dsum));
+
+  e->iovs[e->ntx].iov_len = ETH_HDRLEN + IP4_HDRLEN + tcplen;
+  e->ntx++;
+}
+
+// Check the timers of the connections in each slot of the timer wheel up to now. On expiry,
+// resend what is outstanding with the timeout doubled, or give up: after MAX_RETRIES, or if
+// the server has gone quiet mid-response. Only connections whose deadlines fall in those
+// slots are looked at, however many are open.
+void
+tcp_timers (engine *e, uint64_t now)
+{
+  int i, next;
+  uint64_t tick, last;
+  conn *c;
+
+  // If we have fallen more than a turn of the wheel behind, one turn checks every slot.
+  last = now / TIMER_TICK;
+  if (last >= (e->wheel_tick + WHEEL_SLOTS)) {
+    e->wheel_tick = last - WHEEL_SLOTS + 1;
+  }
+  for (tick=e->wheel_tick; tick<=last; tick++) {
+    e->wheel_tick = tick + 1;  // Timers re-armed from here go in later slots
+
+    for (i=e->wheel[tick & (WHEEL_SLOTS - 1)]; i >= 0; i=next) {
+      c = &e->conns[i];
+      next = c->wheel_next;
+
+      // Due in a later turn of the wheel.
+      if (now < c->deadline) {
+        continue;
+      }
+      if (((c->state == CONN_ESTABLISHED) && (c->snd_una == c->snd_nxt)) || (c->retries >= MAX_RETRIES)) {
+        conn_reset (e, c);
+        e->timeouts++;
+        conn_close (e, c, 0);
+        continue;
+      }
+
+      c->retries++;
+      c->rto *= 2;
+      timer_set (e, c, now + c->rto);
+      e->retransmits++;
+      switch (c->state) {
+        case CONN_SYN_SENT:
+          tcp_output (e, c, TH_SYN, c->iss, 0, 0);
+          break;
+        case CONN_ESTABLISHED:
+          tcp_output (e, c, TH_ACK | TH_PUSH, c->snd_una, e->tmpl.len - (c->snd_nxt - c->snd_una), c->snd_nxt - c->snd_una);
+          break;
+        case CONN_LAST_ACK:
+          tcp_output (e, c, TH_FIN | TH_ACK, c->snd_nxt - 1, 0, 0);
+          break;
+      }
+    }
+  }
+}
+
+// Set a connection's timer: move it to the slot of the timer wheel for the first tick
+// at or after its new deadline (or the next slot to be checked, if that has gone by).
+void
+timer_set (engine *e, conn *c, uint64_t deadline)
+{
+  int idx;
+  uint64_t tick;
+
+  timer_cancel (e, c);
+  c->deadline = deadline;
+  tick = (deadline + TIMER_TICK - 1) / TIMER_TICK;  // Rounded up: a slot is checked once its tick begins
+  if (tick < e->wheel_tick) {
+    tick = e->wheel_tick;
+  }
+  idx = c - e->conns;
+  c->wheel_slot = tick & (WHEEL_SLOTS - 1);
+  c->wheel_prev = -1;
+  c->wheel_next = e->wheel[c->wheel_slot];
+  if (c->wheel_next >= 0) {
+    e->conns[c->wheel_next].wheel_prev = idx;
+  }
+  e->wheel[c->wheel_slot] = idx;
+}
+
+// Take a connection's timer off the timer wheel.
+void
+timer_cancel (engine *e, conn *c)
+{
+  if (c->wheel_slot < 0) {
+    return;
+  }
+  if (c->wheel_prev >= 0) {
+    e->conns[c->wheel_prev].wheel_next = c->wheel_next;
+  } else {
+    e->wheel[c->wheel_slot] = c->wheel_next;
+  }
+  if (c->wheel_next >= 0) {
+    e->conns[c->wheel_next].wheel_prev = c->wheel_prev;
+  }
+  c->wheel_slot = -1;
+}
+
+// Answer an ARP request for one of our source addresses.
+void
+arp_input (engine *e, uint8_t *frame, int len)
+{
+  uint8_t *arp, *reply;
+
+  if (len < (ETH_HDRLEN + ARP_HDRLEN)) {
+    return;
+  }
+  arp = frame + ETH_HDRLEN;
+
+  // Ethernet/IPv4 request (operation 1) for an address in our range.
+  if ((get16 (arp) != 1) || (get16 (arp + 2) != ETH_P_IP) || (arp[4] != 6) || (arp[5] != 4) ||
+      (get16 (arp + 6) != 1) || ((get32 (arp + 24) - e->src_base) >= (uint32_t) e->nsrc)) {
+    return;
+  }
+
+  if (e->ntx == BATCH) {
+    tx_flush (e);
+  }
+  reply = e->frames + (e->ntx * MAX_FRAMELEN);
+
+  // Ethernet header: back to the asker.
+  memcpy (reply, arp + 8, 6 * sizeof (uint8_t));
+  memcpy (reply + 6, e->src_mac, 6 * sizeof (uint8_t));
+  reply[12] = ETH_P_ARP / 256;
+  reply[13] = ETH_P_ARP % 256;
+
+  // ARP header: reply (operation 2), with sender and target swapped and our MAC filled in.
+  memcpy (reply + ETH_HDRLEN, arp, 6 * sizeof (uint8_t));
+  put16 (reply + ETH_HDRLEN + 6, 2);
+  memcpy (reply + ETH_HDRLEN + 8, e->src_mac, 6 * sizeof (uint8_t));
+  memcpy (reply + ETH_HDRLEN + 14, arp + 24, 4 * sizeof (uint8_t));
+  memcpy (reply + ETH_HDRLEN + 18, arp + 8, 10 * sizeof (uint8_t));
+
+  e->iovs[e->ntx].iov_len = ETH_HDRLEN + ARP_HDRLEN;
+  e->ntx++;
+}
+
+// Send all frames waiting in transmit batch.
+void
+tx_flush (engine *e)
+{
+  int i, n;
+
+  i = 0;
+  while (i < e->ntx) {
+    if ((n = sendmmsg (e->sd, e->msgs + i, e->ntx - i, 0)) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == ENOBUFS) {  // Transmit queue full: let it drain.
+        usleep (100);
+        continue;
+      }
+      perror ("sendmmsg() failed ");
+      exit (EXIT_FAILURE);
+    }
+    i += n;
+  }
+  e->ntx = 0;
+}
+
+// Render HTTP request template, recording where each per-connection field lies.
+int
+tmpl_init (request_template *t, char *directory, char *filename, char *url)
+{
+  int i, n;
+  char *p;
+
+  if ((strlen (directory) + strlen (filename) + strlen (url) + 128) > MAX_REQLEN) {
+    fprintf (stderr, "ERROR: HTTP request would be longer than %i bytes.\n", MAX_REQLEN);
+    exit (EXIT_FAILURE);
+  }
+  memset (t, 0, sizeof (request_template));
+  p = (char *) t->bytes;
+
+  n = sprintf (p, "GET %s%s", directory, filename);
+  t->off[FIELD_PATH] = n;
+  t->width[FIELD_PATH] = 4;
+  n += t->width[FIELD_PATH];
+  n += sprintf (p + n, " HTTP/1.1\r\nHost: %s\r\nCookie: session=", url);
+  t->off[FIELD_COOKIE] = n;
+  t->width[FIELD_COOKIE] = 16;
+  n += t->width[FIELD_COOKIE];
+  n += sprintf (p + n, "\r\nX-Request-ID: ");
+  t->off[FIELD_ID] = n;
+  t->width[FIELD_ID] = 8;
+  n += t->width[FIELD_ID];
+  n += sprintf (p + n, "\r\nConnection: close\r\n\r\n");
+  t->len = n;
+
+  // Fields are zero bytes in the template, so they add nothing to the sum of the rest.
+  for (i=0; i<NFIELDS; i++) {
+    memset (t->bytes + t->off[i], 0, t->width[i] * sizeof (uint8_t));
+  }
+  t->sum = sum_bytes (0, t->bytes, t->len);
+
+  return (EXIT_SUCCESS);
+}
+
+// Copy request template to dst, writing each field's value in hexadecimal.
+// Returns one's complement sum of the whole request (not folded).
+uint32_t
+tmpl_fill (request_template *t, uint8_t *dst, uint64_t *values)
+{
+  int i, j, k;
+  uint8_t d;
+  uint32_t sum;
+  static const char hex[] = "0123456789abcdef";
+
+  memcpy (dst, t->bytes, t->len * sizeof (uint8_t));
+  sum = t->sum;
+  for (i=0; i<NFIELDS; i++) {
+    for (j=0; j<t->width[i]; j++) {
+      k = t->off[i] + j;
+      d = hex[(values[i] >> (4 * (t->width[i] - 1 - j))) & 0xf];
+      dst[k] = d;
+
+      // Bytes at even offsets are high halves of 16-bit words.
+      sum += (k & 1) ? d : (d << 8);
+    }
+  }
+
+  return (sum);
+}
+
+// 64-bit mix (finalizer of MurmurHash3).
+uint64_t
+mix64 (uint64_t h)
+{
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdull;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ull;
+  h ^= h >> 33;
+
+  return (h);
+}
+
+// Monotonic clock, in milliseconds.
+uint64_t
+now_ms (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+
+  return (((uint64_t) ts.tv_sec * 1000) + (ts.tv_nsec / 1000000));
+}
+
+// Store 16 or 32 bits in network byte order, and load them back.
+void
+put16 (uint8_t *p, uint16_t v)
+{
+  p[0] = v >> 8;
+  p[1] = v & 0xff;
+}
+
+void
+put32 (uint8_t *p, uint32_t v)
+{
+  p[0] = v >> 24;
+  p[1] = (v >> 16) & 0xff;
+  p[2] = (v >> 8) & 0xff;
+  p[3] = v & 0xff;
+}
+
+uint16_t
+get16 (const uint8_t *p)
+{
+  return ((p[0] << 8) | p[1]);
+}
+
+uint32_t
+get32 (const uint8_t *p)
+{
+  return (((uint32_t) p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3]);
+}
+
+// Add bytes to a running (host byte order) one's complement sum.
+uint32_t
+sum_bytes (uint32_t sum, const uint8_t *data, int len)
+{
+  while (len > 1) {
+    sum += (data[0] << 8) + data[1];
+    data += 2;
+    len -= 2;
+  }
+
+  // Odd byte is padded with zero.
+  if (len == 1) {
+    sum += data[0] << 8;
+  }
+
+  return (sum);
+}
+
+// Fold a 32-bit running sum into 16 bits, with end-around carry.
+uint16_t
+fold_sum (uint32_t sum)
+{
+  while (sum >> 16) {
+    sum = (sum & 0xffff) + (sum >> 16);
+  }
+
+  return ((uint16_t) sum);
+}
+
+// SIGINT handler: stop opening connections, reset those still open, and report results.
+void
+sig_handler (int signum)
+{
+  (void) signum;
+  stop = 1;
+}
+
+// Allocate memory for an array of chars.
+char *
+allocate_strmem (int len)
+{
+  void *tmp;
+
+  if (len <= 0) {
+    fprintf (stderr, "ERROR: Cannot allocate memory because len = %i in allocate_strmem().\n", len);
+    exit (EXIT_FAILURE);
+  }
+
+  tmp = (char *) malloc (len * sizeof (char));
+  if (tmp != NULL) {
+    memset (tmp, 0, len * sizeof (char));
+    return (tmp);
+  } else {
+    fprintf (stderr, "ERROR: Cannot allocate memory for array allocate_strmem().\n");
+    exit (EXIT_FAILURE);
+  }
+}
+
+// Allocate memory for an array of unsigned chars.
+uint8_t *
+allocate_ustrmem (int len)
+{
+  void *tmp;
+
+  if (len <= 0) {
+    fprintf (stderr, "ERROR: Cannot allocate memory because len = %i in allocate_ustrmem().\n", len);
+    exit (EXIT_FAILURE);
+  }
+
+  tmp = (uint8_t *) malloc (len * sizeof (uint8_t));
+  if (tmp != NULL) {
+    memset (tmp, 0, len * sizeof (uint8_t));
+    return (tmp);
+  } else {
+    fprintf (stderr, "ERROR: Cannot allocate memory for array allocate_ustrmem().\n");
+    exit (EXIT_FAILURE);
+  }
+}
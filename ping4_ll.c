@@ -44,10 +44,43 @@
 #define ETH_HDRLEN 14  // Ethernet header length
 #define IP4_HDRLEN 20  // IPv4 header length
 #define ICMP_HDRLEN 8  // ICMP header length for echo request, excludes data
+#define DISSECT_ETH 0  // dissect() starts at an ethernet header
+#define DISSECT_ICMP6 1  // dissect() starts at an ICMPv6 header, as read from an ICMPv6 raw socket
+#define ND_OPT_TYPES 32  // Neighbor discovery option types whose first offset dissect() records
+#define MAX_EXTHDRS 16  // Most IPv6 extension headers dissect() will follow
+
+// Define a struct for the layout of a received frame, as found by dissect().
+// Offsets are from the start of the frame; -1 means the header is absent, or not
+// wholly within the frame. Nothing in it points into the frame.
+typedef struct _pkt_info pkt_info;
+struct _pkt_info {
+  int len;              // Length of frame
+  int end;              // End of IP packet: frames may carry padding after it
+  int nvlans;           // Number of VLAN tags (802.1Q, and 802.1ad outer tag for QinQ)
+  uint16_t vlan[2];     // VLAN IDs, outer tag first
+  uint16_t ethertype;   // Ethernet type after any VLAN tags
+  int l3;               // Offset of ARP, IPv4 or IPv6 header
+  int l3_len;           // Length of ARP header, IPv4 header with options, or IPv6 header with extension headers
+  int ip_opts;          // Offset of IPv4 options, or of first IPv6 extension header
+  int ip_opts_len;      // Length of IPv4 options, or of all IPv6 extension headers
+  int frag;             // 1 for a fragment other than the first, which has no transport header
+  uint8_t proto;        // Transport protocol (for IPv6, the next header after any extension headers)
+  int l4;               // Offset of TCP, UDP, ICMP or ICMPv6 header
+  int l4_len;           // Length of TCP header with options, or 8 for UDP, ICMP and ICMPv6
+  int payload;          // Offset of data after transport header (for ND, after the fixed part of the message)
+  int inner_l3;         // ICMP or ICMPv6 error: offset of IP header of the packet quoted
+  uint8_t inner_proto;  // ICMP or ICMPv6 error: transport protocol of the packet quoted
+  int inner_l4;         // ICMP or ICMPv6 error: offset of first 8 bytes of its transport header
+  int nd_opts;          // Neighbor discovery: offset of first option (-1 if any option is malformed)
+  int nd_opt[ND_OPT_TYPES];  // Neighbor discovery: offset of first option of each type (if nd_opts >= 0)
+};
 
 // Function prototypes
 uint16_t checksum (uint16_t *, int);
 uint16_t icmp4_checksum (struct icmp, uint8_t *, int);
+int dissect (pkt_info *, uint8_t *, int, int);
+int dissect_ip (uint8_t *, int, int, int *, int *, uint8_t *, int *);
+int dissect_l4 (pkt_info *, uint8_t *, int);
 char *allocate_strmem (int);
 uint8_t *allocate_ustrmem (int);
 int *allocate_intmem (int);
@@ -68,6 +101,7 @@ main (int argc, char **argv)
   socklen_t fromlen;
   struct timeval wait, t1, t2;
   struct timezone tz;
+  pkt_info pi;
   double dt;
   void *tmp;
 
@@ -276,12 +310,6 @@ main (int argc, char **argv)
   trylim = 3;
   trycount = 0;
 
-  // Cast recv_iphdr as pointer to IPv4 header within received ethernet frame.
-  recv_iphdr = (struct ip *) (recv_ether_frame + ETH_HDRLEN);
-
-  // Case recv_icmphdr as pointer to ICMP header within received ethernet frame.
-  recv_icmphdr = (struct icmp *) (recv_ether_frame + ETH_HDRLEN + IP4_HDRLEN);
-
   done = 0;
   for (;;) {
 
@@ -331,9 +359,16 @@ main (int argc, char **argv)
         }
       }  // End of error handling conditionals.
 
+      // Find the IPv4 and ICMP headers, wherever VLAN tags and IPv4 options put them.
+      dissect (&pi, recv_ether_frame, bytes, DISSECT_ETH);
+      if ((pi.ethertype != ETH_P_IP) || (pi.proto != IPPROTO_ICMP) || (pi.l4 < 0)) {
+        continue;
+      }
+      recv_iphdr = (struct ip *) (recv_ether_frame + pi.l3);
+      recv_icmphdr = (struct icmp *) (recv_ether_frame + pi.l4);
+
       // Check for an IP ethernet frame, carrying ICMP echo reply. If not, ignore and keep listening.
-      if ((((recv_ether_frame[12] << 8) + recv_ether_frame[13]) == ETH_P_IP) &&
-         (recv_iphdr->ip_p == IPPROTO_ICMP) && (recv_icmphdr->icmp_type == ICMP_ECHOREPLY) && (recv_icmphdr->icmp_code == 0)) {
+      if ((recv_icmphdr->icmp_type == ICMP_ECHOREPLY) && (recv_icmphdr->icmp_code == 0)) {
 
         // Stop timer and calculate how long it took to get a reply.
         (void) gettimeofday (&t2, &tz);
@@ -463,6 +498,238 @@ checksum (uint16_t *addr, int len)
   return (answer);
 }
 
+// Find the headers of a frame (start = DISSECT_ETH), or of an ICMPv6 message as read
+// from an ICMPv6 raw socket (start = DISSECT_ICMP6), in one pass, without copying.
+// Each header is checked to lie within the frame before it is read.
+// Returns 0 if all headers found were whole, or -1 if one was cut short or malformed,
+// in which case pi describes the headers in front of it.
+int
+dissect (pkt_info *pi, uint8_t *pkt, int len, int start)
+{
+  int off, type, ip_len;
+
+  pi->len = len;
+  pi->end = len;
+  pi->nvlans = 0;
+  pi->ethertype = 0;
+  pi->l3 = -1;
+  pi->l3_len = 0;
+  pi->ip_opts = -1;
+  pi->ip_opts_len = 0;
+  pi->frag = 0;
+  pi->proto = 0;
+  pi->l4 = -1;
+  pi->l4_len = 0;
+  pi->payload = -1;
+  pi->inner_l3 = -1;
+  pi->inner_proto = 0;
+  pi->inner_l4 = -1;
+  pi->nd_opts = -1;
+
+  if (start == DISSECT_ICMP6) {
+    pi->proto = IPPROTO_ICMPV6;
+    return (dissect_l4 (pi, pkt, 0));
+  }
+
+  // Ethernet header, and any VLAN tags in front of the ethernet type.
+  if (len < 14) {
+    return (-1);
+  }
+  off = 12;
+  type = (pkt[off] << 8) + pkt[off + 1];
+  while ((type == 0x8100) || (type == 0x88a8)) {
+    if ((off + 6) > len) {
+      return (-1);
+    }
+    if (pi->nvlans < 2) {
+      pi->vlan[pi->nvlans] = ((pkt[off + 2] << 8) + pkt[off + 3]) & 0x0fff;
+    }
+    pi->nvlans++;
+    off += 4;
+    type = (pkt[off] << 8) + pkt[off + 1];
+  }
+  off += 2;
+  pi->ethertype = type;
+
+  // ARP: fixed part, then sender and target hardware and protocol addresses.
+  if (type == 0x0806) {
+    if (((off + 8) > len) || ((off + 8 + (2 * (pkt[off + 4] + pkt[off + 5]))) > len)) {
+      return (-1);
+    }
+    pi->l3 = off;
+    pi->l3_len = 8 + (2 * (pkt[off + 4] + pkt[off + 5]));
+    return (0);
+  }
+
+  if ((type != 0x0800) && (type != 0x86dd)) {
+    return (0);
+  }
+  if (dissect_ip (pkt, off, len, &pi->l3_len, &ip_len, &pi->proto, &pi->frag) < 0) {
+    return (-1);
+  }
+  pi->l3 = off;
+  pi->ip_opts_len = pi->l3_len - (((pkt[off] >> 4) == 4) ? 20 : 40);
+  if (pi->ip_opts_len > 0) {
+    pi->ip_opts = off + pi->l3_len - pi->ip_opts_len;
+  }
+  if ((off + ip_len) < len) {
+    pi->end = off + ip_len;
+  }
+  if (pi->frag) {
+    return (0);
+  }
+
+  return (dissect_l4 (pi, pkt, off + pi->l3_len));
+}
+
+// Check the IPv4 or IPv6 header at offset off, and follow any IPv6 extension headers.
+// Gives the length of the header with options or extension headers, the length of the
+// packet according to the header, the transport protocol, and whether this is a fragment
+// other than the first. Returns -1 if the header is not wholly within len bytes.
+int
+dissect_ip (uint8_t *pkt, int off, int len, int *hlen, int *ip_len, uint8_t *proto, int *frag)
+{
+  int i, ext;
+  uint8_t nh;
+
+  *frag = 0;
+  if ((off + 1) > len) {
+    return (-1);
+  }
+
+  // IPv4: header length in 32-bit words, total length, fragment offset, protocol.
+  if ((pkt[off] >> 4) == 4) {
+    if ((off + 20) > len) {
+      return (-1);
+    }
+    *hlen = (pkt[off] & 0x0f) * 4;
+    *ip_len = (pkt[off + 2] << 8) + pkt[off + 3];
+    if ((*hlen < 20) || ((off + *hlen) > len) || (*ip_len < *hlen)) {
+      return (-1);
+    }
+    *proto = pkt[off + 9];
+    *frag = ((((pkt[off + 6] & 0x1f) << 8) + pkt[off + 7]) != 0);
+    return (0);
+  }
+
+  if ((pkt[off] >> 4) != 6) {
+    return (-1);
+  }
+
+  // IPv6: fixed header, then a chain of extension headers, each naming the next.
+  // Payload length 0 means a jumbogram, whose length is in a hop-by-hop option.
+  if ((off + 40) > len) {
+    return (-1);
+  }
+  *ip_len = 40 + (pkt[off + 4] << 8) + pkt[off + 5];
+  if (*ip_len == 40) {
+    *ip_len = len - off;
+  }
+  nh = pkt[off + 6];
+  *hlen = 40;
+  for (i=0; i<MAX_EXTHDRS; i++) {
+    if ((nh != 0) && (nh != 43) && (nh != 44) && (nh != 51) && (nh != 60) && (nh != 135) && (nh != 139) && (nh != 140)) {
+      break;  // Transport header, ESP, or no next header (59).
+    }
+    if ((off + *hlen + 8) > len) {
+      return (-1);
+    }
+    if (nh == 44) {  // Fragment header: fixed length.
+      ext = 8;
+    } else if (nh == 51) {  // Authentication header: length in 32-bit words, less 2.
+      ext = (pkt[off + *hlen + 1] + 2) * 4;
+    } else {  // Others: length in 8-byte units, not counting the first.
+      ext = (pkt[off + *hlen + 1] + 1) * 8;
+    }
+    if ((off + *hlen + ext) > len) {
+      return (-1);
+    }
+    if ((nh == 44) && ((((pkt[off + *hlen + 2] << 8) + pkt[off + *hlen + 3]) >> 3) != 0)) {
+      *frag = 1;
+    }
+    nh = pkt[off + *hlen];
+    *hlen += ext;
+    if (*frag) {
+      break;
+    }
+  }
+  if ((i == MAX_EXTHDRS) || (*ip_len < *hlen)) {
+    return (-1);
+  }
+  *proto = nh;
+
+  return (0);
+}
+
+// Check the transport header at offset off, then for an ICMP or ICMPv6 error, the
+// IP header and first 8 bytes of the packet quoted, and for a neighbor discovery
+// message, its options.
+int
+dissect_l4 (pkt_info *pi, uint8_t *pkt, int off)
+{
+  int i, n, type, hlen, ip_len, frag;
+
+  if (pi->proto == IPPROTO_TCP) {
+    if ((off + 20) > pi->end) {
+      return (-1);
+    }
+    pi->l4_len = (pkt[off + 12] >> 4) * 4;
+    if ((pi->l4_len < 20) || ((off + pi->l4_len) > pi->end)) {
+      pi->l4_len = 0;
+      return (-1);
+    }
+  } else if ((pi->proto == IPPROTO_UDP) || (pi->proto == IPPROTO_ICMP) || (pi->proto == IPPROTO_ICMPV6)) {
+    if ((off + 8) > pi->end) {
+      return (-1);
+    }
+    pi->l4_len = 8;
+  } else {
+    return (0);
+  }
+  pi->l4 = off;
+  pi->payload = off + pi->l4_len;
+
+  // ICMP errors (destination unreachable, source quench, redirect, time exceeded,
+  // parameter problem) and ICMPv6 errors (types 1 to 4) quote the packet which caused them.
+  type = pkt[off];
+  if (((pi->proto == IPPROTO_ICMP) && ((type == 3) || (type == 4) || (type == 5) || (type == 11) || (type == 12))) ||
+      ((pi->proto == IPPROTO_ICMPV6) && (type >= 1) && (type <= 4))) {
+    if (dissect_ip (pkt, off + 8, pi->end, &hlen, &ip_len, &pi->inner_proto, &frag) == 0) {
+      pi->inner_l3 = off + 8;
+      if ((frag == 0) && ((off + 8 + hlen + 8) <= pi->end)) {
+        pi->inner_l4 = off + 8 + hlen;
+      }
+    }
+    return (0);
+  }
+
+  // Neighbor discovery (router solicitation and advertisement, neighbor solicitation and
+  // advertisement, redirect): options follow the fixed part of the message. Each gives its
+  // length in units of 8 bytes, and must not be zero length nor run past the end.
+  if ((pi->proto != IPPROTO_ICMPV6) || (type < 133) || (type > 137)) {
+    return (0);
+  }
+  n = off + ((type == 133) ? 8 : (type == 134) ? 16 : (type == 137) ? 40 : 24);
+  if (n > pi->end) {
+    return (-1);
+  }
+  pi->payload = n;
+  for (i=0; i<ND_OPT_TYPES; i++) {
+    pi->nd_opt[i] = -1;
+  }
+  for (i=n; i<pi->end; i+=pkt[i + 1] * 8) {
+    if (((i + 2) > pi->end) || (pkt[i + 1] == 0) || ((i + (pkt[i + 1] * 8)) > pi->end)) {
+      return (-1);
+    }
+    if ((pkt[i] < ND_OPT_TYPES) && (pi->nd_opt[pkt[i]] < 0)) {
+      pi->nd_opt[pkt[i]] = i;
+    }
+  }
+  pi->nd_opts = n;
+
+  return (0);
+}
+
 // Allocate memory for an array of chars.
 char *
 allocate_strmem (int len)
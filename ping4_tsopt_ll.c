@@ -0,0 +1,844 @@
+/*  Copyright (C) 2013  P.D. Buchan (pdbuchan@yahoo.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Per-hop latency profiling with the IPv4 timestamp option (RFC 791).
+// Send a stream of IPv4 probes (ICMP echo requests, or UDP datagrams to an unused port)
+// via raw socket at the link layer (ethernet frame), each carrying a timestamp option.
+// Need to have destination MAC address.
+// Routers (and the target) along the way write their time, in milliseconds since midnight
+// UT, into the option. It comes back to us in the echo reply, or inside the copy of the
+// probe's IP header quoted in an ICMP error (port unreachable or time exceeded).
+// Differences between successive timestamps give a one-way delay for each hop. These
+// include any offset between the two clocks involved, so they are most meaningful as
+// spreads, and as changes over time. Results are gathered per path (sequence of stamping
+// addresses) in fixed tables, so any number of probes needs no further memory.
+
+#define _GNU_SOURCE           // sendmmsg(), recvmmsg() and struct mmsghdr
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>           // close(), usleep()
+#include <string.h>           // strcpy, memset(), and memcpy()
+#include <math.h>             // sqrt() (link with -lm)
+
+#include <netdb.h>            // struct addrinfo
+#include <sys/types.h>        // needed for socket(), uint8_t, uint16_t, uint32_t
+#include <sys/socket.h>       // needed for socket(), sendmmsg(), recvmmsg()
+#include <netinet/in.h>       // IPPROTO_ICMP, IPPROTO_UDP, INET_ADDRSTRLEN
+#include <netinet/ip.h>       // struct ip and IP_MAXPACKET (which is 65535)
+#include <netinet/ip_icmp.h>  // struct icmp, ICMP_ECHO
+#include <arpa/inet.h>        // inet_pton() and inet_ntop()
+#include <sys/ioctl.h>        // macro ioctl is defined
+#include <bits/ioctls.h>      // defines values for argument "request" of ioctl.
+#include <net/if.h>           // struct ifreq
+#include <linux/if_ether.h>   // ETH_P_IP = 0x0800, ETH_P_IPV6 = 0x86DD
+#include <linux/if_packet.h>  // struct sockaddr_ll (see man 7 packet)
+#include <net/ethernet.h>
+#include <signal.h>           // signal(), SIGINT
+#include <time.h>             // clock_gettime(), clock_nanosleep()
+
+#include <errno.h>            // errno, perror()
+
+// Define some constants.
+#define ETH_HDRLEN 14         // Ethernet header length
+#define IP4_HDRLEN 20         // IPv4 header length
+#define ICMP_HDRLEN 8         // ICMP header length for echo request, excludes data
+#define UDP_HDRLEN 8          // UDP header length, excludes data
+#define DATALEN 16            // Probe data: probe number and send time
+#define BATCH 64              // Probes handed to sendmmsg() at once
+#define MAX_FRAMELEN 256      // Room for each probe frame in batch
+#define MAX_RXLEN 2048        // Room for each received frame
+#define PROBE_ICMP 0          // Probe types: ICMP echo request,
+#define PROBE_UDP 1           // or UDP datagram to port UDP_PORT
+#define UDP_PORT 33434        // Destination port for UDP probes (traceroute's)
+#define TS_ONLY 0             // Timestamp option flags: timestamps only,
+#define TS_ADDR 1             // each preceded by stamping node's address,
+#define TS_PRESPEC 3          // or only by nodes whose addresses we name in advance
+#define MAX_STAMPS 9          // Most timestamps that fit in the option (flag TS_ONLY)
+#define MAX_PATHS 64          // Most distinct paths tracked
+
+// Define a struct for the timestamps read from one reply.
+typedef struct _ts_result ts_result;
+struct _ts_result {
+  int n;                        // Number of timestamps
+  uint32_t addr[MAX_STAMPS];    // Address of each stamping node (0 for flag TS_ONLY)
+  uint32_t ts[MAX_STAMPS];      // Timestamps (host byte order)
+  int overflow;                 // Number of nodes which found no room to stamp
+};
+
+// Define a struct for running statistics of one hop's delay, in milliseconds.
+typedef struct _hop_stats hop_stats;
+struct _hop_stats {
+  uint64_t n;           // Samples
+  double mean;          // Running mean and sum of squared deviations (Welford's method)
+  double m2;
+  int32_t min;
+  int32_t max;
+  uint64_t nonstd;      // Timestamps not in milliseconds since midnight UT (high bit set)
+};
+
+// Define a struct for statistics of one path. Hop i is delay up to node i from the
+// previous node (hop 0 being us, at send time); hop n is back to us, at receive time.
+typedef struct _path_stats path_stats;
+struct _path_stats {
+  int n;                        // Number of timestamps along path
+  uint32_t addr[MAX_STAMPS];    // Addresses of stamping nodes
+  uint64_t probes;              // Replies which took this path
+  uint64_t overflow;            // Nodes which found no room to stamp
+  hop_stats hops[MAX_STAMPS + 1];
+};
+
+// Function prototypes
+int build_ts_option (uint8_t *, int, uint32_t, uint32_t *, int, uint32_t);
+int parse_ts_option (uint8_t *, int, ts_result *);
+int parse_reply (uint8_t *, int, uint32_t, uint32_t, uint16_t, int, ts_result *);
+path_stats *path_lookup (path_stats *, int *, ts_result *);
+void path_add (path_stats *, ts_result *, uint32_t);
+void hop_add (hop_stats *, uint32_t, uint32_t);
+void path_report (path_stats *);
+uint32_t ms_since_midnight (void);
+uint32_t sum_bytes (uint32_t, uint8_t *, int);
+uint16_t fold_sum (uint32_t);
+void pace (struct timespec *, long int);
+void sig_handler (int);
+char *allocate_strmem (int);
+uint8_t *allocate_ustrmem (int);
+
+// Set by SIGINT handler to stop sending.
+volatile sig_atomic_t stop = 0;
+
+int
+main (int argc, char **argv)
+{
+  int i, n, c, status, sd, rd, optlen, hdrlen, probe_type, ts_flag, count, rate, wait, nprespec, npaths, sent, received;
+  char *interface, *target, *src_ip, *dst_ip;
+  uint8_t *src_mac, *dst_mac, *frames, *rxframes, *ip, *l4;
+  uint16_t ident;
+  uint32_t src, dst, prespec[4], sum, now;
+  struct addrinfo hints, *res;
+  struct sockaddr_in *ipv4;
+  struct sockaddr_ll device, from[BATCH];
+  struct ifreq ifr;
+  struct mmsghdr msgs[BATCH], rxmsgs[BATCH];
+  struct iovec iovs[BATCH], rxiovs[BATCH];
+  struct timespec next, ts, end;
+  struct in_addr addr, daddr;
+  ts_result r;
+  path_stats *paths, *p;
+  void *tmp;
+
+  // Allocate memory for various arrays.
+  src_mac = allocate_ustrmem (6);
+  dst_mac = allocate_ustrmem (6);
+  interface = allocate_strmem (40);
+  target = allocate_strmem (40);
+  src_ip = allocate_strmem (INET_ADDRSTRLEN);
+  dst_ip = allocate_strmem (INET_ADDRSTRLEN);
+  frames = allocate_ustrmem (BATCH * MAX_FRAMELEN);
+  rxframes = allocate_ustrmem (BATCH * MAX_RXLEN);
+  paths = (path_stats *) allocate_ustrmem (MAX_PATHS * sizeof (path_stats));
+
+  // Interface to send packets through.
+  strcpy (interface, "eth0");
+
+  // Probe type (PROBE_ICMP or PROBE_UDP), and timestamp option flag (TS_ONLY, TS_ADDR or TS_PRESPEC).
+  // UDP probes are answered by ICMP errors, which most nodes rate-limit.
+  probe_type = PROBE_ICMP;
+  ts_flag = TS_ADDR;
+
+  // Number of probes, probes per second, and seconds to wait for late replies.
+  count = 1000;
+  rate = 100;
+  wait = 2;
+  if (rate <= 0) {
+    fprintf (stderr, "ERROR: Probe rate must be at least 1 per second.\n");
+    exit (EXIT_FAILURE);
+  }
+
+  // Submit request for a socket descriptor to look up interface.
+  if ((sd = socket (PF_PACKET, SOCK_RAW, htons (ETH_P_ALL))) < 0) {
+    perror ("socket() failed to get socket descriptor for using ioctl() ");
+    exit (EXIT_FAILURE);
+  }
+
+  // Use ioctl() to look up interface name and get its MAC address.
+  memset (&ifr, 0, sizeof (ifr));
+  snprintf (ifr.ifr_name, sizeof (ifr.ifr_name), "%s", interface);
+  if (ioctl (sd, SIOCGIFHWADDR, &ifr) < 0) {
+    perror ("ioctl() failed to get source MAC address ");
+    return (EXIT_FAILURE);
+  }
+  close (sd);
+
+  // Copy source MAC address.
+  memcpy (src_mac, ifr.ifr_hwaddr.sa_data, 6 * sizeof (uint8_t));
+
+  // Report source MAC address to stdout.
+  printf ("MAC address for interface %s is ", interface);
+  for (i=0; i<5; i++) {
+    printf ("%02x:", src_mac[i]);
+  }
+  printf ("%02x\n", src_mac[5]);
+
+  // Find interface index from interface name and store index in
+  // struct sockaddr_ll device, which will be used as an argument of sendmmsg().
+  memset (&device, 0, sizeof (device));
+  if ((device.sll_ifindex = if_nametoindex (interface)) == 0) {
+    perror ("if_nametoindex() failed to obtain interface index ");
+    exit (EXIT_FAILURE);
+  }
+  printf ("Index for interface %s is %i\n", interface, device.sll_ifindex);
+
+  // Set destination MAC address: you need to fill these out
+  dst_mac[0] = 0xff;
+  dst_mac[1] = 0xff;
+  dst_mac[2] = 0xff;
+  dst_mac[3] = 0xff;
+  dst_mac[4] = 0xff;
+  dst_mac[5] = 0xff;
+
+  // Source IPv4 address: you need to fill this out
+  strcpy (src_ip, "192.168.1.132");
+
+  // Destination URL or IPv4 address: you need to fill this out
+  strcpy (target, "www.google.com");
+
+  // Fill out hints for getaddrinfo().
+  memset (&hints, 0, sizeof (struct addrinfo));
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = hints.ai_flags | AI_CANONNAME;
+
+  // Resolve target using getaddrinfo().
+  if ((status = getaddrinfo (target, NULL, &hints, &res)) != 0) {
+    fprintf (stderr, "getaddrinfo() failed: %s\n", gai_strerror (status));
+    exit (EXIT_FAILURE);
+  }
+  ipv4 = (struct sockaddr_in *) res->ai_addr;
+  tmp = &(ipv4->sin_addr);
+  if (inet_ntop (AF_INET, tmp, dst_ip, INET_ADDRSTRLEN) == NULL) {
+    status = errno;
+    fprintf (stderr, "inet_ntop() failed.\nError message: %s", strerror (status));
+    exit (EXIT_FAILURE);
+  }
+  daddr = ipv4->sin_addr;
+  dst = ntohl (daddr.s_addr);
+  freeaddrinfo (res);
+
+  if ((status = inet_pton (AF_INET, src_ip, &addr)) != 1) {
+    fprintf (stderr, "inet_pton() failed.\nError message: %s", strerror (status));
+    exit (EXIT_FAILURE);
+  }
+  src = ntohl (addr.s_addr);
+
+  // For flag TS_PRESPEC: addresses of up to 3 nodes whose timestamps we want, in order
+  // (we take the first slot ourselves). You need to fill this out
+  nprespec = 0;
+  prespec[nprespec++] = src;
+  prespec[nprespec++] = dst;
+
+  // Fill out sockaddr_ll.
+  device.sll_family = AF_PACKET;
+  memcpy (device.sll_addr, src_mac, 6 * sizeof (uint8_t));
+  device.sll_halen = 6;
+
+  // Identifier of our probes: ICMP identifier, or UDP source port.
+  ident = (getpid () & 0x3fff) | 0x8000;
+
+  // Set up batch. Each frame is written in full when its probe is sent.
+  memset (msgs, 0, sizeof (msgs));
+  for (i=0; i<BATCH; i++) {
+    iovs[i].iov_base = frames + (i * MAX_FRAMELEN);
+    msgs[i].msg_hdr.msg_iov = &iovs[i];
+    msgs[i].msg_hdr.msg_iovlen = 1;
+    msgs[i].msg_hdr.msg_name = &device;
+    msgs[i].msg_hdr.msg_namelen = sizeof (device);
+  }
+
+  // Submit request for raw socket descriptors: one to send, and one to receive IPv4 frames.
+  if ((sd = socket (PF_PACKET, SOCK_RAW, htons (ETH_P_ALL))) < 0) {
+    perror ("socket() failed ");
+    exit (EXIT_FAILURE);
+  }
+  if ((rd = socket (PF_PACKET, SOCK_RAW, htons (ETH_P_IP))) < 0) {
+    perror ("socket() failed ");
+    exit (EXIT_FAILURE);
+  }
+  memset (&from[0], 0, sizeof (struct sockaddr_ll));
+  from[0].sll_family = AF_PACKET;
+  from[0].sll_protocol = htons (ETH_P_IP);
+  from[0].sll_ifindex = device.sll_ifindex;
+  if (bind (rd, (struct sockaddr *) &from[0], sizeof (struct sockaddr_ll)) < 0) {
+    perror ("bind() failed ");
+    exit (EXIT_FAILURE);
+  }
+
+  memset (rxmsgs, 0, sizeof (rxmsgs));
+  for (i=0; i<BATCH; i++) {
+    rxiovs[i].iov_base = rxframes + (i * MAX_RXLEN);
+    rxiovs[i].iov_len = MAX_RXLEN;
+    rxmsgs[i].msg_hdr.msg_iov = &rxiovs[i];
+    rxmsgs[i].msg_hdr.msg_iovlen = 1;
+    rxmsgs[i].msg_hdr.msg_name = &from[i];
+    rxmsgs[i].msg_hdr.msg_namelen = sizeof (struct sockaddr_ll);
+  }
+
+  signal (SIGINT, sig_handler);
+
+  printf ("Sending %i %s probes with timestamp option (flag %i) to %s\n", count,
+          (probe_type == PROBE_ICMP) ? "ICMP echo" : "UDP", ts_flag, dst_ip);
+
+  npaths = 0;
+  sent = 0;
+  received = 0;
+  end.tv_sec = 0;
+  clock_gettime (CLOCK_MONOTONIC, &next);
+  while (stop == 0) {
+
+    // Wait for batch's send time before stamping it, keeping to rate.
+    if (sent < count) {
+      pace (&next, (long int) (1000000000.0 * ((count - sent < BATCH) ? count - sent : BATCH) / rate));
+    }
+
+    // Fill a batch of probes.
+    n = 0;
+    while ((n < BATCH) && (sent + n < count)) {
+      now = ms_since_midnight ();
+      c = 0;
+      ip = frames + (n * MAX_FRAMELEN);
+
+      // Ethernet header
+      memcpy (ip, dst_mac, 6 * sizeof (uint8_t));
+      memcpy (ip + 6, src_mac, 6 * sizeof (uint8_t));
+      ip[12] = ETH_P_IP / 256;
+      ip[13] = ETH_P_IP % 256;
+      ip += ETH_HDRLEN;
+
+      // IPv4 header, then timestamp option (with our own timestamp first).
+      optlen = build_ts_option (ip + IP4_HDRLEN, ts_flag, src, prespec, nprespec, now);
+      hdrlen = IP4_HDRLEN + optlen;
+      l4 = ip + hdrlen;
+      c = ((probe_type == PROBE_ICMP) ? ICMP_HDRLEN : UDP_HDRLEN) + DATALEN;
+      ip[0] = (4 << 4) + (hdrlen / 4);
+      ip[1] = 0;
+      ip[2] = (hdrlen + c) >> 8;
+      ip[3] = (hdrlen + c) & 0xff;
+      ip[4] = (sent + n) >> 8;  // ID
+      ip[5] = (sent + n) & 0xff;
+      ip[6] = 0;
+      ip[7] = 0;
+      ip[8] = 255;
+      ip[9] = (probe_type == PROBE_ICMP) ? IPPROTO_ICMP : IPPROTO_UDP;
+      ip[10] = 0;
+      ip[11] = 0;
+      memcpy (ip + 12, &addr.s_addr, 4 * sizeof (uint8_t));
+      memcpy (ip + 16, &daddr.s_addr, 4 * sizeof (uint8_t));
+      sum = ~fold_sum (sum_bytes (0, ip, hdrlen)) & 0xffff;
+      ip[10] = sum >> 8;
+      ip[11] = sum & 0xff;
+
+      // Probe data: probe number, and send time.
+      clock_gettime (CLOCK_MONOTONIC, &ts);
+      memset (l4, 0, c * sizeof (uint8_t));
+      i = c - DATALEN;
+      l4[i] = (sent + n) >> 24;
+      l4[i + 1] = ((sent + n) >> 16) & 0xff;
+      l4[i + 2] = ((sent + n) >> 8) & 0xff;
+      l4[i + 3] = (sent + n) & 0xff;
+      memcpy (l4 + i + 4, &ts, (DATALEN - 4) * sizeof (uint8_t));
+
+      if (probe_type == PROBE_ICMP) {
+
+        // ICMP echo request: identifier, and probe number as sequence number.
+        l4[0] = ICMP_ECHO;
+        l4[4] = ident >> 8;
+        l4[5] = ident & 0xff;
+        l4[6] = ((sent + n) >> 8) & 0xff;
+        l4[7] = (sent + n) & 0xff;
+        sum = ~fold_sum (sum_bytes (0, l4, c)) & 0xffff;
+        l4[2] = sum >> 8;
+        l4[3] = sum & 0xff;
+      } else {
+
+        // UDP header: identifier as source port. Checksum over pseudo-header too.
+        l4[0] = ident >> 8;
+        l4[1] = ident & 0xff;
+        l4[2] = UDP_PORT >> 8;
+        l4[3] = UDP_PORT & 0xff;
+        l4[4] = c >> 8;
+        l4[5] = c & 0xff;
+        sum = sum_bytes (0, ip + 12, 8) + IPPROTO_UDP + c;
+        sum = ~fold_sum (sum_bytes (sum, l4, c)) & 0xffff;
+        if (sum == 0) {
+          sum = 0xffff;
+        }
+        l4[6] = sum >> 8;
+        l4[7] = sum & 0xff;
+      }
+
+      iovs[n].iov_len = ETH_HDRLEN + hdrlen + c;
+      n++;
+    }
+
+    // Send batch.
+    if (n > 0) {
+      i = 0;
+      while (i < n) {
+        if ((status = sendmmsg (sd, msgs + i, n - i, 0)) < 0) {
+          if (errno == EINTR) {
+            continue;
+          }
+          if (errno == ENOBUFS) {  // Transmit queue full: let it drain.
+            usleep (100);
+            continue;
+          }
+          perror ("sendmmsg() failed ");
+          exit (EXIT_FAILURE);
+        }
+        i += status;
+      }
+      sent += n;
+    } else {
+
+      // All probes sent: keep listening for a while.
+      clock_gettime (CLOCK_MONOTONIC, &ts);
+      if (end.tv_sec == 0) {
+        end = ts;
+        end.tv_sec += wait;
+      }
+      if ((ts.tv_sec > end.tv_sec) || ((ts.tv_sec == end.tv_sec) && (ts.tv_nsec >= end.tv_nsec))) {
+        break;
+      }
+      usleep (1000);
+    }
+
+    // Take whatever replies have arrived, without waiting.
+    while ((status = recvmmsg (rd, rxmsgs, BATCH, MSG_DONTWAIT, NULL)) > 0) {
+      now = ms_since_midnight ();
+      for (i=0; i<status; i++) {
+        if (from[i].sll_pkttype == PACKET_OUTGOING) {
+          continue;
+        }
+        if (parse_reply (rxframes + (i * MAX_RXLEN), rxmsgs[i].msg_len, src, dst, ident, probe_type, &r) != 0) {
+          continue;
+        }
+        received++;
+        if ((p = path_lookup (paths, &npaths, &r)) != NULL) {
+          path_add (p, &r, now);
+        }
+      }
+    }
+  }
+
+  // Report results: each path seen, most frequent first.
+  printf ("Sent %i probes, received %i replies carrying timestamps, over %i paths\n", sent, received, npaths);
+  for (c=0; c<npaths; c++) {
+    p = &paths[0];
+    for (i=1; i<npaths; i++) {
+      if (paths[i].probes > p->probes) {
+        p = &paths[i];
+      }
+    }
+    if (p->probes == 0) {
+      break;
+    }
+    printf ("\nPath %i:\n", c + 1);
+    path_report (p);
+    p->probes = 0;
+  }
+
+  // Close socket descriptors.
+  close (sd);
+  close (rd);
+
+  // Free allocated memory.
+  free (src_mac);
+  free (dst_mac);
+  free (interface);
+  free (target);
+  free (src_ip);
+  free (dst_ip);
+  free (frames);
+  free (rxframes);
+  free (paths);
+
+  return (EXIT_SUCCESS);
+}
+
+// Build IPv4 timestamp option (type 68) with given flag, taking the first slot ourselves.
+// With flag TS_PRESPEC, the first of the nprespec addresses must be our own.
+// Returns length of option, padded to a multiple of 4 bytes.
+int
+build_ts_option (uint8_t *opt, int flag, uint32_t src, uint32_t *prespec, int nprespec, uint32_t now)
+{
+  int i, len, slot;
+
+  slot = (flag == TS_ONLY) ? 4 : 8;
+  if (flag == TS_ONLY) {
+    len = 4 + (MAX_STAMPS * 4);
+  } else if (flag == TS_ADDR) {
+    len = 4 + (4 * 8);
+  } else {
+    len = 4 + (nprespec * 8);
+  }
+  memset (opt, 0, ((len + 3) & ~3) * sizeof (uint8_t));
+
+  opt[0] = IPOPT_TS;        // Option type 68
+  opt[1] = len;             // Option length
+  opt[2] = 5 + slot;        // Pointer (from 1): next free slot, after ours
+  opt[3] = flag;            // Overflow (4 bits) and flag (4 bits)
+
+  // Our slot: address (unless TS_ONLY) and time.
+  i = 4;
+  if (flag != TS_ONLY) {
+    opt[i++] = src >> 24;
+    opt[i++] = (src >> 16) & 0xff;
+    opt[i++] = (src >> 8) & 0xff;
+    opt[i++] = src & 0xff;
+  }
+  opt[i++] = now >> 24;
+  opt[i++] = (now >> 16) & 0xff;
+  opt[i++] = (now >> 8) & 0xff;
+  opt[i++] = now & 0xff;
+
+  // Prespecified addresses of the other nodes to stamp.
+  if (flag == TS_PRESPEC) {
+    for (i=1; i<nprespec; i++) {
+      opt[4 + (8 * i)] = prespec[i] >> 24;
+      opt[4 + (8 * i) + 1] = (prespec[i] >> 16) & 0xff;
+      opt[4 + (8 * i) + 2] = (prespec[i] >> 8) & 0xff;
+      opt[4 + (8 * i) + 3] = prespec[i] & 0xff;
+    }
+  }
+
+  // Pad with end-of-options (zero) to a 4-byte boundary.
+  return ((len + 3) & ~3);
+}
+
+// Find timestamp option among options of an IPv4 header, and read the timestamps filled in.
+// Returns 0 if one was found, or -1 if not.
+int
+parse_ts_option (uint8_t *ip, int hdrlen, ts_result *r)
+{
+  int i, j, len, ptr, flag, slot;
+  uint8_t *opt;
+
+  i = IP4_HDRLEN;
+  while (i < hdrlen) {
+    if (ip[i] == IPOPT_EOL) {
+      break;
+    }
+    if (ip[i] == IPOPT_NOP) {
+      i++;
+      continue;
+    }
+    if ((i + 1 >= hdrlen) || (ip[i + 1] < 2) || ((i + ip[i + 1]) > hdrlen)) {
+      return (-1);  // Malformed
+    }
+    if (ip[i] != IPOPT_TS) {
+      i += ip[i + 1];
+      continue;
+    }
+
+    opt = ip + i;
+    len = opt[1];
+    ptr = opt[2];
+    flag = opt[3] & 0x0f;
+    slot = (flag == TS_ONLY) ? 4 : 8;
+
+    // Slots up to pointer are filled (pointer counts from 1).
+    memset (r, 0, sizeof (ts_result));
+    r->overflow = opt[3] >> 4;
+    for (j=4; ((j + slot) <= (ptr - 1)) && ((j + slot) <= len) && (r->n < MAX_STAMPS); j+=slot) {
+      if (slot == 8) {
+        r->addr[r->n] = ((uint32_t) opt[j] << 24) | (opt[j + 1] << 16) | (opt[j + 2] << 8) | opt[j + 3];
+      }
+      r->ts[r->n] = ((uint32_t) opt[j + slot - 4] << 24) | (opt[j + slot - 3] << 16) | (opt[j + slot - 2] << 8) | opt[j + slot - 1];
+      r->n++;
+    }
+    return (0);
+  }
+
+  return (-1);
+}
+
+// Check whether a received frame answers one of our probes, and if so read its timestamps:
+// from the reply's own header (echo reply), or the quoted header of our probe (ICMP error).
+// Returns 0 if so, or -1 if the frame is not for us or carries no timestamps.
+int
+parse_reply (uint8_t *frame, int len, uint32_t src, uint32_t dst, uint16_t ident, int probe_type, ts_result *r)
+{
+  int hdrlen, qlen;
+  uint8_t *ip, *icmp, *q;
+
+  if (len < (ETH_HDRLEN + IP4_HDRLEN + ICMP_HDRLEN)) {
+    return (-1);
+  }
+  ip = frame + ETH_HDRLEN;
+  hdrlen = (ip[0] & 0x0f) * 4;
+  if (((ip[0] >> 4) != 4) || (ip[9] != IPPROTO_ICMP) || (hdrlen < IP4_HDRLEN) ||
+      (len < (ETH_HDRLEN + hdrlen + ICMP_HDRLEN)) ||
+      ((((uint32_t) ip[16] << 24) | (ip[17] << 16) | (ip[18] << 8) | ip[19]) != src)) {
+    return (-1);
+  }
+  icmp = ip + hdrlen;
+
+  // Echo reply to one of our echo requests: option has been echoed back.
+  if ((icmp[0] == ICMP_ECHOREPLY) && (probe_type == PROBE_ICMP)) {
+    if ((((icmp[4] << 8) | icmp[5]) != ident) ||
+        ((((uint32_t) ip[12] << 24) | (ip[13] << 16) | (ip[14] << 8) | ip[15]) != dst)) {
+      return (-1);
+    }
+    return (parse_ts_option (ip, hdrlen, r));
+  }
+
+  // Destination unreachable or time exceeded: quotes our probe's IP header with its option.
+  if ((icmp[0] != ICMP_UNREACH) && (icmp[0] != ICMP_TIMXCEED)) {
+    return (-1);
+  }
+  q = icmp + ICMP_HDRLEN;
+  qlen = len - ETH_HDRLEN - hdrlen - ICMP_HDRLEN;
+  if ((qlen < IP4_HDRLEN) || ((q[0] >> 4) != 4) || (qlen < (((q[0] & 0x0f) * 4) + 8))) {
+    return (-1);
+  }
+  if (((((uint32_t) q[12] << 24) | (q[13] << 16) | (q[14] << 8) | q[15]) != src) ||
+      ((((uint32_t) q[16] << 24) | (q[17] << 16) | (q[18] << 8) | q[19]) != dst)) {
+    return (-1);
+  }
+  hdrlen = (q[0] & 0x0f) * 4;
+  if ((probe_type == PROBE_ICMP) && ((q[9] != IPPROTO_ICMP) || (((q[hdrlen + 4] << 8) | q[hdrlen + 5]) != ident))) {
+    return (-1);
+  }
+  if ((probe_type == PROBE_UDP) && ((q[9] != IPPROTO_UDP) || (((q[hdrlen] << 8) | q[hdrlen + 1]) != ident))) {
+    return (-1);
+  }
+
+  return (parse_ts_option (q, hdrlen, r));
+}
+
+// Find statistics for the path a reply took, adding a new path if there is room.
+// Returns NULL if the table is full.
+path_stats *
+path_lookup (path_stats *paths, int *npaths, ts_result *r)
+{
+  int i;
+
+  for (i=0; i<*npaths; i++) {
+    if ((paths[i].n == r->n) && (memcmp (paths[i].addr, r->addr, r->n * sizeof (uint32_t)) == 0)) {
+      return (&paths[i]);
+    }
+  }
+  if (*npaths == MAX_PATHS) {
+    return (NULL);
+  }
+
+  i = (*npaths)++;
+  memset (&paths[i], 0, sizeof (path_stats));
+  paths[i].n = r->n;
+  memcpy (paths[i].addr, r->addr, r->n * sizeof (uint32_t));
+
+  return (&paths[i]);
+}
+
+// Add delays between successive timestamps of a reply (and then to us, at now) to its path.
+void
+path_add (path_stats *p, ts_result *r, uint32_t now)
+{
+  int i;
+
+  p->probes++;
+  p->overflow += r->overflow;
+  for (i=1; i<r->n; i++) {
+    hop_add (&p->hops[i], r->ts[i - 1], r->ts[i]);
+  }
+  if (r->n > 0) {
+    hop_add (&p->hops[r->n], r->ts[r->n - 1], now);
+  }
+}
+
+// Add one delay to a hop's statistics. Timestamps with the high bit set are in units of the
+// node's choosing, so cannot be compared; a zero timestamp was never filled in.
+void
+hop_add (hop_stats *h, uint32_t t0, uint32_t t1)
+{
+  int32_t d;
+  double delta;
+
+  if ((t0 & 0x80000000u) || (t1 & 0x80000000u) || (t0 == 0) || (t1 == 0)) {
+    h->nonstd++;
+    return;
+  }
+
+  // Delay in ms, allowing for midnight passing in between.
+  d = (int32_t) t1 - (int32_t) t0;
+  if (d < -43200000) {
+    d += 86400000;
+  }
+
+  if ((h->n == 0) || (d < h->min)) {
+    h->min = d;
+  }
+  if ((h->n == 0) || (d > h->max)) {
+    h->max = d;
+  }
+  h->n++;
+  delta = d - h->mean;
+  h->mean += delta / h->n;
+  h->m2 += delta * (d - h->mean);
+}
+
+// Print per-hop delay statistics of a path.
+void
+path_report (path_stats *p)
+{
+  int i;
+  uint32_t a;
+  char addr[20];
+  struct in_addr in;
+  hop_stats *h;
+
+  printf ("%llu replies, %llu nodes unable to stamp (option full)\n",
+          (unsigned long long) p->probes, (unsigned long long) p->overflow);
+  printf ("%-4s %-16s %8s %8s %8s %8s %8s %8s\n", "hop", "to node", "samples", "min", "avg", "max", "stddev", "nonstd");
+  for (i=1; i<=p->n; i++) {
+    h = &p->hops[i];
+    if (i < p->n) {
+      a = p->addr[i];
+    } else {
+      a = 0;
+    }
+    if (i == p->n) {
+      strcpy (addr, "(back to us)");
+    } else if (a == 0) {
+      snprintf (addr, sizeof (addr), "(node %i)", i);
+    } else {
+      in.s_addr = htonl (a);
+      inet_ntop (AF_INET, &in, addr, INET_ADDRSTRLEN);
+    }
+    if (h->n == 0) {
+      printf ("%-4i %-16s %8s %8s %8s %8s %8s %8llu\n", i, addr, "0", "-", "-", "-", "-", (unsigned long long) h->nonstd);
+      continue;
+    }
+    printf ("%-4i %-16s %8llu %8i %8.2f %8i %8.2f %8llu\n", i, addr, (unsigned long long) h->n, h->min, h->mean, h->max,
+            (h->n > 1) ? sqrt (h->m2 / (h->n - 1)) : 0.0, (unsigned long long) h->nonstd);
+  }
+}
+
+// Time of day in milliseconds since midnight UT: the standard IPv4 timestamp.
+uint32_t
+ms_since_midnight (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_REALTIME, &ts);
+
+  return ((uint32_t) (((ts.tv_sec % 86400) * 1000) + (ts.tv_nsec / 1000000)));
+}
+
+// Add bytes to a running (host byte order) one's complement sum.
+uint32_t
+sum_bytes (uint32_t sum, uint8_t *data, int len)
+{
+  while (len > 1) {
+    sum += (data[0] << 8) + data[1];
+    data += 2;
+    len -= 2;
+  }
+
+  // Odd byte is padded with zero.
+  if (len == 1) {
+    sum += data[0] << 8;
+  }
+
+  return (sum);
+}
+
+// Fold a 32-bit running sum into 16 bits, with end-around carry.
+uint16_t
+fold_sum (uint32_t sum)
+{
+  while (sum >> 16) {
+    sum = (sum & 0xffff) + (sum >> 16);
+  }
+
+  return ((uint16_t) sum);
+}
+
+// Sleep until next scheduled send time, then schedule the one after.
+// Absolute deadlines keep the average rate exact even if one sleep runs long.
+void
+pace (struct timespec *next, long int interval)
+{
+  next->tv_nsec += interval;
+  while (next->tv_nsec >= 1000000000L) {
+    next->tv_nsec -= 1000000000L;
+    next->tv_sec++;
+  }
+  while (clock_nanosleep (CLOCK_MONOTONIC, TIMER_ABSTIME, next, NULL) == EINTR) {
+    if (stop == 1) {
+      break;
+    }
+  }
+}
+
+// SIGINT handler: stop sending and report results.
+void
+sig_handler (int signum)
+{
+  (void) signum;
+  stop = 1;
+}
+
+// Allocate memory for an array of chars.
+char *
+allocate_strmem (int len)
+{
+  void *tmp;
+
+  if (len <= 0) {
+    fprintf (stderr, "ERROR: Cannot allocate memory because len = %i in allocate_strmem().\n", len);
+    exit (EXIT_FAILURE);
+  }
+
+  tmp = (char *) malloc (len * sizeof (char));
+  if (tmp != NULL) {
+    memset (tmp, 0, len * sizeof (char));
+    return (tmp);
+  } else {
+    fprintf (stderr, "ERROR: Cannot allocate memory for array allocate_strmem().\n");
+    exit (EXIT_FAILURE);
+  }
+}
+
+// Allocate memory for an array of unsigned chars.
+uint8_t *
+allocate_ustrmem (int len)
+{
+  void *tmp;
+
+  if (len <= 0) {
+    fprintf (stderr, "ERROR: Cannot allocate memory because len = %i in allocate_ustrmem().\n", len);
+    exit (EXIT_FAILURE);
+  }
+
+  tmp = (uint8_t *) malloc (len * sizeof (uint8_t));
+  if (tmp != NULL) {
+    memset (tmp, 0, len * sizeof (uint8_t));
+    return (tmp);
+  } else {
+    fprintf (stderr, "ERROR: Cannot allocate memory for array allocate_ustrmem().\n");
+    exit (EXIT_FAILURE);
+  }
+}
@@ -0,0 +1,861 @@
+/*  Copyright (C) 2013  P.D. Buchan (pdbuchan@yahoo.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Send IPv6 ICMP router advertisements at a high rate via raw socket at the link layer
+// (ethernet frame), to load-test RA-guard and the neighbor discovery of hosts.
+// Each RA carries a source link-layer address option, any number of prefix information
+// options, route information options (RFC 4191), and an RDNSS option (RFC 8106).
+// From one RA to the next, the source (MAC address, and the link-local address made from it),
+// the prefixes, routes and DNS servers advertised, and the set of lifetimes are each taken
+// in turn from pools of chosen sizes.
+// Every RA is the same template with only those fields changed, so each is made by writing
+// them into a frame already in place, and its checksum is the template's sum plus that of
+// the fields written, rather than a sum over the whole message.
+// Frames go BATCH at a time to sendmmsg(), optionally bypassing the queueing discipline,
+// from one or more threads, each with its own socket. Achieved rates are reported each second.
+// Link with -lpthread.
+
+#define _GNU_SOURCE           // sendmmsg() and struct mmsghdr
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>           // close(), usleep()
+#include <string.h>           // strcpy, memset(), and memcpy()
+
+#include <sys/types.h>        // needed for socket(), uint8_t, uint16_t, uint32_t
+#include <sys/socket.h>       // needed for socket(), sendmmsg()
+#include <netinet/in.h>       // IPPROTO_ICMPV6, INET6_ADDRSTRLEN
+#include <netinet/ip6.h>      // struct ip6_hdr
+#include <netinet/icmp6.h>    // struct nd_router_advert, ND_ROUTER_ADVERT, ND_OPT_*
+#include <arpa/inet.h>        // inet_pton() and inet_ntop()
+#include <sys/ioctl.h>        // macro ioctl is defined
+#include <bits/ioctls.h>      // defines values for argument "request" of ioctl.
+#include <net/if.h>           // struct ifreq
+#include <linux/if_ether.h>   // ETH_P_IP = 0x0800, ETH_P_IPV6 = 0x86DD
+#include <linux/if_packet.h>  // struct sockaddr_ll (see man 7 packet), PACKET_QDISC_BYPASS
+#include <net/ethernet.h>
+#include <signal.h>           // signal(), SIGINT
+#include <time.h>             // clock_gettime(), clock_nanosleep()
+#include <pthread.h>          // pthread_create(), pthread_join() (link with -lpthread)
+
+#include <errno.h>            // errno, perror()
+
+// Define some constants.
+#define ETH_HDRLEN 14         // Ethernet header length
+#define IP6_HDRLEN 40         // IPv6 header length
+#define RA_HDRLEN 16          // Router advertisement header length, excludes options
+#define SLLA_OPTLEN 8         // Source link-layer address option length
+#define PIO_OPTLEN 32         // Prefix information option length
+#define RIO_OPTLEN 16         // Route information option length, for routes of prefix length 64 or less
+#define RDNSS_HDRLEN 8        // RDNSS option length, excludes addresses
+#define ND_OPT_ROUTE_INFO 24  // Route information option type (RFC 4191)
+#define ND_OPT_RDNSS 25       // Recursive DNS server option type (RFC 8106)
+#define MAX_FRAMELEN 1518     // Largest frame we build
+#define MAX_PREFIXES 32       // Most prefix information options in one RA
+#define MAX_ROUTES 32         // Most route information options in one RA
+#define MAX_DNS 16            // Most DNS server addresses in one RA
+#define MAX_LIFETIMES 16      // Most sets of lifetimes taken in turn
+#define MAX_THREADS 64        // Most sending threads
+#define BATCH 64              // Number of frames handed to sendmmsg() at once
+
+// Define a struct for the lifetimes advertised together in one RA (seconds).
+typedef struct _ra_lifetimes ra_lifetimes;
+struct _ra_lifetimes {
+  uint16_t router;      // Router lifetime: 0 means not a default router
+  uint32_t valid;       // Valid lifetime of prefixes: 0xffffffff means infinity
+  uint32_t preferred;   // Preferred lifetime of prefixes
+  uint32_t route;       // Lifetime of routes
+  uint32_t dns;         // Lifetime of DNS servers
+};
+
+// Define a struct for the RAs to generate: a template frame, where its changing fields are,
+// and the pools they are taken from.
+typedef struct _ra_gen ra_gen;
+struct _ra_gen {
+  uint8_t frame[MAX_FRAMELEN];  // Template: changing fields are zero, but for the constant
+                                // upper halves of link-local and DNS server addresses
+  int len;              // Length of frame
+  uint32_t sum0;        // Sum of ICMPv6 pseudo-header and message of template, not folded
+  int slla;             // Offset of source link-layer address option
+  int pio;              // Offset of first prefix information option
+  int rio;              // Offset of first route information option
+  int rdnss;            // Offset of RDNSS option
+  uint8_t src_mac[6];   // First source MAC address: each next source adds one to its last three bytes
+  uint32_t nsources;    // Number of sources
+  int nprefixes;        // Prefix information options in each RA
+  uint64_t prefix_base; // First prefix advertised (upper 64 bits of address, host byte order): /64s follow it
+  uint64_t prefix_pool; // Number of prefixes
+  int nroutes;          // Route information options in each RA
+  uint64_t route_base;  // First route (upper 64 bits)
+  int route_len;        // Prefix length of routes (64 or less)
+  uint64_t route_pool;  // Number of routes
+  int ndns;             // DNS server addresses in each RA
+  uint64_t dns_prefix;  // Upper 64 bits of DNS server addresses (host byte order)
+  uint64_t dns_base;    // Lower 64 bits of first DNS server address: those of the others count up from it
+  uint64_t dns_pool;    // Number of DNS servers
+  ra_lifetimes life[MAX_LIFETIMES];  // Sets of lifetimes
+  int nlife;            // Number of sets of lifetimes
+  int nthreads;         // Number of sending threads: thread t sends RAs t, t + nthreads, ...
+};
+
+// Define a struct for a sending thread, and its counters.
+// Aligned to a cache line, so no two threads' counters share one.
+typedef struct _gen_thread_ctx gen_thread_ctx;
+struct _gen_thread_ctx {
+  pthread_t thread;
+  ra_gen *gen;
+  int index;            // Thread number
+  int ifindex;          // Interface index
+  int qdisc_bypass;     // Send with PACKET_QDISC_BYPASS
+  long int rate;        // RAs per second for this thread (0 = as fast as possible)
+  uint64_t max;         // RAs for this thread to send (0 = no limit)
+  uint64_t sent;        // RAs sent (written by thread, read by main)
+  uint64_t retries;     // sendmmsg() calls retried: EINTR, or ENOBUFS while queue was full
+  int done;             // Set when thread has finished
+} __attribute__ ((aligned (64)));
+
+// Function prototypes
+void gen_init (ra_gen *);
+void ra_fill (ra_gen *, uint8_t *, uint64_t);
+void *gen_thread (void *);
+uint32_t put16 (uint8_t *, uint16_t);
+uint32_t put32 (uint8_t *, uint32_t);
+uint32_t put64 (uint8_t *, uint64_t);
+uint64_t get64 (uint8_t *);
+uint32_t sum_bytes (uint32_t, uint8_t *, int);
+uint16_t fold_sum (uint32_t);
+uint16_t checksum (uint16_t *, int);
+void pace (struct timespec *, long int);
+double now_sec (void);
+void sig_handler (int);
+char *allocate_strmem (int);
+uint8_t *allocate_ustrmem (int);
+
+// Set by SIGINT handler to stop.
+volatile sig_atomic_t stop = 0;
+
+int
+main (int argc, char **argv)
+{
+  int i, sd, status, len, ifindex, mtu, nthreads, qdisc_bypass, duration, finished;
+  long int rate;
+  char *interface, *prefix, *route, *dns, *check;
+  uint8_t addr[16], *frame, *psdhdr;
+  uint64_t max_ras, sent, retries, last_sent;
+  double start, now, last, dt;
+  struct ifreq ifr;
+  ra_gen *g;
+  gen_thread_ctx *ctx;
+
+  // Allocate memory for various arrays.
+  interface = allocate_strmem (40);
+  prefix = allocate_strmem (INET6_ADDRSTRLEN);
+  route = allocate_strmem (INET6_ADDRSTRLEN);
+  dns = allocate_strmem (INET6_ADDRSTRLEN);
+  g = (ra_gen *) calloc (1, sizeof (ra_gen));
+  if (g == NULL) {
+    fprintf (stderr, "ERROR: Cannot allocate memory for struct ra_gen.\n");
+    exit (EXIT_FAILURE);
+  }
+
+  // Interface to send RAs through: you need to fill this out
+  strcpy (interface, "eth0");
+
+  // Number of sending threads, and whether their frames skip the queueing discipline.
+  nthreads = 1;
+  qdisc_bypass = 1;
+
+  // RAs per second, over all threads (0 = as fast as possible).
+  rate = 0;
+
+  // Stop after this many RAs (0 = no limit), or this many seconds (0 = no limit), or Ctrl-C.
+  max_ras = 0;
+  duration = 10;
+
+  // Sources: MAC addresses count up from this one, in their last three bytes. Each RA comes
+  // from the link-local address made from its MAC address (modified EUI-64, RFC 4291).
+  g->src_mac[0] = 0x02;  // Locally administered
+  g->src_mac[1] = 0x00;
+  g->src_mac[2] = 0x5e;
+  g->src_mac[3] = 0x00;
+  g->src_mac[4] = 0x00;
+  g->src_mac[5] = 0x00;
+  g->nsources = 1000;
+
+  // Prefix information options in each RA: /64 prefixes, counting up from this one.
+  g->nprefixes = 4;
+  strcpy (prefix, "2001:db8::");
+  g->prefix_pool = 65536;
+
+  // Route information options in each RA: routes of route_len bits, counting up from this one.
+  g->nroutes = 2;
+  strcpy (route, "2001:db8:8000::");
+  g->route_len = 48;
+  g->route_pool = 4096;
+
+  // DNS server addresses in the RDNSS option of each RA (0 for no RDNSS option), counting up from this one.
+  g->ndns = 2;
+  strcpy (dns, "2001:db8:53::1");
+  g->dns_pool = 256;
+
+  // Sets of lifetimes (s), taken in turn: router, valid, preferred, route, DNS server.
+  g->nlife = 3;
+  g->life[0] = (ra_lifetimes) {1800, 86400, 14400, 1800, 1800};
+  g->life[1] = (ra_lifetimes) {0, 7200, 0, 0, 0};  // Not a default router; prefixes deprecated; withdraw routes and servers
+  g->life[2] = (ra_lifetimes) {9000, 0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff};  // Longest allowed, and infinity
+
+  if ((nthreads < 1) || (nthreads > MAX_THREADS)) {
+    fprintf (stderr, "ERROR: Number of threads must be from 1 to %i.\n", MAX_THREADS);
+    exit (EXIT_FAILURE);
+  }
+  if ((g->nsources < 1) || (g->nsources > 0x1000000)) {
+    fprintf (stderr, "ERROR: Number of sources must be from 1 to 2^24.\n");
+    exit (EXIT_FAILURE);
+  }
+  if ((g->nprefixes < 0) || (g->nprefixes > MAX_PREFIXES) || (g->nroutes < 0) || (g->nroutes > MAX_ROUTES)
+      || (g->ndns < 0) || (g->ndns > MAX_DNS)) {
+    fprintf (stderr, "ERROR: At most %i prefixes, %i routes and %i DNS servers in each RA.\n", MAX_PREFIXES, MAX_ROUTES, MAX_DNS);
+    exit (EXIT_FAILURE);
+  }
+  if (((g->nprefixes > 0) && (g->prefix_pool < 1)) || ((g->nroutes > 0) && (g->route_pool < 1))
+      || ((g->ndns > 0) && (g->dns_pool < 1)) || (g->nlife < 1) || (g->nlife > MAX_LIFETIMES)) {
+    fprintf (stderr, "ERROR: Each pool needs at least one entry, and there may be 1 to %i sets of lifetimes.\n", MAX_LIFETIMES);
+    exit (EXIT_FAILURE);
+  }
+  if ((g->route_len < 0) || (g->route_len > 64)) {
+    fprintf (stderr, "ERROR: Prefix length of routes must be from 0 to 64.\n");
+    exit (EXIT_FAILURE);
+  }
+
+  // Length of frame, from the numbers of options, before anything is written to it.
+  len = ETH_HDRLEN + IP6_HDRLEN + RA_HDRLEN + SLLA_OPTLEN + (g->nprefixes * PIO_OPTLEN) + (g->nroutes * RIO_OPTLEN);
+  if (g->ndns > 0) {
+    len += RDNSS_HDRLEN + (g->ndns * 16);
+  }
+  if (len > MAX_FRAMELEN) {
+    fprintf (stderr, "ERROR: RAs of %i bytes would not fit a frame of %i bytes: use fewer options.\n", len - ETH_HDRLEN, MAX_FRAMELEN);
+    exit (EXIT_FAILURE);
+  }
+
+  // Upper (or for DNS servers, lower) 64 bits of each base address.
+  check = prefix;
+  if (inet_pton (AF_INET6, prefix, addr) == 1) {
+    g->prefix_base = get64 (addr);
+    check = route;
+    if (inet_pton (AF_INET6, route, addr) == 1) {
+      g->route_base = get64 (addr);
+      check = dns;
+      if (inet_pton (AF_INET6, dns, addr) == 1) {
+        g->dns_prefix = get64 (addr);
+        g->dns_base = get64 (addr + 8);
+        check = NULL;
+      }
+    }
+  }
+  if (check != NULL) {
+    fprintf (stderr, "ERROR: %s is not an IPv6 address.\n", check);
+    exit (EXIT_FAILURE);
+  }
+
+  // Look up interface index and MTU.
+  if ((sd = socket (PF_PACKET, SOCK_RAW, htons (ETH_P_ALL))) < 0) {
+    perror ("socket() failed to get socket descriptor for using ioctl() ");
+    exit (EXIT_FAILURE);
+  }
+  memset (&ifr, 0, sizeof (ifr));
+  snprintf (ifr.ifr_name, sizeof (ifr.ifr_name), "%s", interface);
+  if (ioctl (sd, SIOCGIFMTU, &ifr) < 0) {
+    perror ("ioctl() failed to get MTU ");
+    exit (EXIT_FAILURE);
+  }
+  mtu = ifr.ifr_mtu;
+  close (sd);
+  if ((ifindex = if_nametoindex (interface)) == 0) {
+    perror ("if_nametoindex() failed to obtain interface index ");
+    exit (EXIT_FAILURE);
+  }
+
+  if (len - ETH_HDRLEN > mtu) {
+    fprintf (stderr, "ERROR: RAs of %i bytes would not fit the MTU of %s (%i bytes).\n", len - ETH_HDRLEN, interface, mtu);
+    exit (EXIT_FAILURE);
+  }
+
+  // Build template.
+  gen_init (g);
+
+  // Check the checksum of the first RA, as made by ra_fill(), against one summed over the
+  // whole message the slow way, with checksum() as in ra6.c: the sum of a pseudo-header
+  // and message with a correct checksum in it comes to 0xffff, whose complement is 0.
+  frame = allocate_ustrmem (MAX_FRAMELEN);
+  psdhdr = allocate_ustrmem (40 + MAX_FRAMELEN);
+  memcpy (frame, g->frame, g->len);
+  ra_fill (g, frame, 0);
+  memcpy (psdhdr, frame + ETH_HDRLEN + 8, 32);  // Source and destination addresses
+  psdhdr[34] = (g->len - ETH_HDRLEN - IP6_HDRLEN) / 256;  // Upper layer packet length
+  psdhdr[35] = (g->len - ETH_HDRLEN - IP6_HDRLEN) % 256;
+  psdhdr[39] = IPPROTO_ICMPV6;
+  memcpy (psdhdr + 40, frame + ETH_HDRLEN + IP6_HDRLEN, g->len - ETH_HDRLEN - IP6_HDRLEN);
+  if (checksum ((uint16_t *) psdhdr, 40 + g->len - ETH_HDRLEN - IP6_HDRLEN) != 0) {
+    fprintf (stderr, "ERROR: Checksum of first RA does not verify.\n");
+    exit (EXIT_FAILURE);
+  }
+  free (frame);
+  free (psdhdr);
+
+  printf ("RAs of %i bytes (%i prefixes, %i routes, %i DNS servers) from %u sources through %s (index %i)\n",
+          g->len - ETH_HDRLEN - IP6_HDRLEN, g->nprefixes, g->nroutes, g->ndns, g->nsources, interface, ifindex);
+
+  // Start sending threads, each with a share of the rate and of the RAs to send.
+  if ((max_ras > 0) && (max_ras < (uint64_t) nthreads)) {
+    nthreads = max_ras;
+  }
+  if ((rate > 0) && (rate < nthreads)) {
+    nthreads = rate;  // Else some threads would have a rate of 0, which is as fast as possible
+  }
+  g->nthreads = nthreads;
+  ctx = (gen_thread_ctx *) aligned_alloc (64, nthreads * sizeof (gen_thread_ctx));
+  if (ctx == NULL) {
+    fprintf (stderr, "ERROR: Cannot allocate memory for threads.\n");
+    exit (EXIT_FAILURE);
+  }
+  memset (ctx, 0, nthreads * sizeof (gen_thread_ctx));
+
+  signal (SIGINT, sig_handler);
+
+  for (i=0; i<nthreads; i++) {
+    ctx[i].gen = g;
+    ctx[i].index = i;
+    ctx[i].ifindex = ifindex;
+    ctx[i].qdisc_bypass = qdisc_bypass;
+    ctx[i].rate = rate / nthreads + ((i < (rate % nthreads)) ? 1 : 0);
+    ctx[i].max = 0;
+    if (max_ras > 0) {
+      ctx[i].max = max_ras / nthreads + ((i < (int) (max_ras % nthreads)) ? 1 : 0);
+    }
+    if ((status = pthread_create (&ctx[i].thread, NULL, gen_thread, &ctx[i])) != 0) {
+      fprintf (stderr, "pthread_create() failed.\nError message: %s\n", strerror (status));
+      exit (EXIT_FAILURE);
+    }
+  }
+
+  // Report achieved rates each second, until all threads are done, or time is up.
+  start = now_sec ();
+  last = start;
+  last_sent = 0;
+  finished = 0;
+  while (finished == 0) {
+    usleep (100000);
+    now = now_sec ();
+    finished = 1;
+    sent = 0;
+    retries = 0;
+    for (i=0; i<nthreads; i++) {
+      sent += __atomic_load_n (&ctx[i].sent, __ATOMIC_RELAXED);
+      retries += __atomic_load_n (&ctx[i].retries, __ATOMIC_RELAXED);
+      if (__atomic_load_n (&ctx[i].done, __ATOMIC_ACQUIRE) == 0) {
+        finished = 0;
+      }
+    }
+    if ((duration > 0) && (now - start >= duration)) {
+      stop = 1;
+    }
+    if ((now - last >= 1.0) && (finished == 0)) {
+      dt = now - last;
+      printf ("%7.1f s  %12llu RAs  %10.0f RAs/s  %9.1f Mbit/s  %llu retries\n", now - start, (unsigned long long) sent,
+              (sent - last_sent) / dt, (sent - last_sent) * (g->len + 4.0) * 8.0 / dt / 1e6, (unsigned long long) retries);
+      fflush (stdout);
+      last = now;
+      last_sent = sent;
+    }
+  }
+  for (i=0; i<nthreads; i++) {
+    pthread_join (ctx[i].thread, NULL);
+  }
+  dt = now_sec () - start;
+  printf ("Sent %llu RAs in %.3f s: %.0f RAs/s, %.1f Mbit/s (ethernet frames, with FCS)\n", (unsigned long long) sent, dt,
+          sent / dt, sent * (g->len + 4.0) * 8.0 / dt / 1e6);
+
+  // Free allocated memory.
+  free (interface);
+  free (prefix);
+  free (route);
+  free (dns);
+  free (ctx);
+  free (g);
+
+  return (EXIT_SUCCESS);
+}
+
+// Build the template frame: ethernet and IPv6 headers, RA header, and options,
+// with fields which change from one RA to the next left zero. Then sum it.
+void
+gen_init (ra_gen *g)
+{
+  int i, off, icmp;
+  uint8_t *f;
+  struct ip6_hdr *ip6;
+  struct nd_router_advert *ra;
+
+  f = g->frame;
+  memset (f, 0, MAX_FRAMELEN);
+
+  // Ethernet header: to the IPv6 "all nodes" multicast MAC address, 33:33:00:00:00:01.
+  // Source MAC address changes.
+  f[0] = 0x33;
+  f[1] = 0x33;
+  f[5] = 0x01;
+  f[12] = ETH_P_IPV6 / 256;
+  f[13] = ETH_P_IPV6 % 256;
+
+  // IPv6 header: hop limit must be 255 for neighbor discovery (RFC 4861).
+  // Source is link-local: fe80::/64, and an interface ID which changes.
+  ip6 = (struct ip6_hdr *) (f + ETH_HDRLEN);
+  ip6->ip6_flow = htonl ((6 << 28) | (0 << 20) | 0);
+  ip6->ip6_nxt = IPPROTO_ICMPV6;
+  ip6->ip6_hops = 255;
+  ip6->ip6_src.s6_addr[0] = 0xfe;
+  ip6->ip6_src.s6_addr[1] = 0x80;
+  if (inet_pton (AF_INET6, "ff02::1", &ip6->ip6_dst) != 1) {
+    fprintf (stderr, "inet_pton() failed for destination address.\n");
+    exit (EXIT_FAILURE);
+  }
+
+  // Router advertisement header. Router lifetime changes.
+  icmp = ETH_HDRLEN + IP6_HDRLEN;
+  ra = (struct nd_router_advert *) (f + icmp);
+  ra->nd_ra_hdr.icmp6_type = ND_ROUTER_ADVERT;  // 133 (RFC 4861)
+  ra->nd_ra_hdr.icmp6_code = 0;
+  ra->nd_ra_curhoplimit = 64;                // Hop limit recommended by this router
+  ra->nd_ra_flags_reserved = 0;              // M and O flags: addresses from SLAAC, no DHCPv6
+  ra->nd_ra_reachable = htonl (0);           // Reachable Time (ms): 0 is unspecified
+  ra->nd_ra_retransmit = htonl (0);          // Retransmission Time (ms): 0 is unspecified
+  off = icmp + RA_HDRLEN;
+
+  // Source link-layer address option. Address changes.
+  g->slla = off;
+  f[off] = ND_OPT_SOURCE_LINKADDR;
+  f[off + 1] = SLLA_OPTLEN / 8;  // Option length in units of 8 bytes
+  off += SLLA_OPTLEN;
+
+  // Prefix information options: on-link, and for autonomous address configuration.
+  // Lifetimes and prefix change.
+  g->pio = off;
+  for (i=0; i<g->nprefixes; i++) {
+    f[off] = ND_OPT_PREFIX_INFORMATION;
+    f[off + 1] = PIO_OPTLEN / 8;
+    f[off + 2] = 64;  // Prefix length
+    f[off + 3] = ND_OPT_PI_FLAG_ONLINK | ND_OPT_PI_FLAG_AUTO;
+    off += PIO_OPTLEN;
+  }
+
+  // Route information options: medium preference. Lifetime and prefix change.
+  g->rio = off;
+  for (i=0; i<g->nroutes; i++) {
+    f[off] = ND_OPT_ROUTE_INFO;
+    f[off + 1] = RIO_OPTLEN / 8;
+    f[off + 2] = g->route_len;
+    f[off + 3] = 0;  // Preference (bits 3-4): 00 is medium
+    off += RIO_OPTLEN;
+  }
+
+  // RDNSS option. Lifetime and lower halves of the addresses change.
+  g->rdnss = off;
+  if (g->ndns > 0) {
+    f[off] = ND_OPT_RDNSS;
+    f[off + 1] = (RDNSS_HDRLEN + (16 * g->ndns)) / 8;
+    off += RDNSS_HDRLEN + (16 * g->ndns);
+  }
+  g->len = off;
+
+  // IPv6 payload length.
+  ip6->ip6_plen = htons (g->len - icmp);
+
+  // Upper halves of DNS server addresses are the same in every RA.
+  for (i=0; i<g->ndns; i++) {
+    put64 (f + g->rdnss + RDNSS_HDRLEN + (16 * i), g->dns_prefix);
+  }
+
+  // Sum of template: pseudo-header (source and destination addresses, upper layer
+  // packet length, next header) and ICMPv6 message, with checksum and changing fields zero.
+  g->sum0 = sum_bytes (0, f + ETH_HDRLEN + 8, 32);
+  g->sum0 += g->len - icmp;
+  g->sum0 += IPPROTO_ICMPV6;
+  g->sum0 = sum_bytes (g->sum0, f + icmp, g->len - icmp);
+}
+
+// Write RA number m of the sequence into a frame holding the template (or made from it
+// before), and set its checksum. Each changing field is summed as it is written; all of
+// them start on even offsets from the start of the ICMPv6 message, as the sum requires.
+void
+ra_fill (ra_gen *g, uint8_t *f, uint64_t m)
+{
+  int i, off;
+  uint32_t sum, s;
+  uint64_t k;
+  uint8_t *mac, *ifid;
+  ra_lifetimes *life;
+
+  sum = g->sum0;
+
+  // Source MAC address, in ethernet header and source link-layer address option.
+  s = ((g->src_mac[3] << 16) + (g->src_mac[4] << 8) + g->src_mac[5] + (uint32_t) (m % g->nsources)) & 0xffffff;
+  mac = f + 6;
+  mac[0] = g->src_mac[0];
+  mac[1] = g->src_mac[1];
+  mac[2] = g->src_mac[2];
+  mac[3] = s >> 16;
+  mac[4] = (s >> 8) & 0xff;
+  mac[5] = s & 0xff;
+  memcpy (f + g->slla + 2, mac, 6);
+  sum = sum_bytes (sum, f + g->slla + 2, 6);
+
+  // Link-local source address: interface ID is modified EUI-64 of MAC address (RFC 4291).
+  ifid = f + ETH_HDRLEN + 8 + 8;
+  ifid[0] = mac[0] ^ 0x02;
+  ifid[1] = mac[1];
+  ifid[2] = mac[2];
+  ifid[3] = 0xff;
+  ifid[4] = 0xfe;
+  ifid[5] = mac[3];
+  ifid[6] = mac[4];
+  ifid[7] = mac[5];
+  sum = sum_bytes (sum, ifid, 8);
+
+  // Lifetimes.
+  life = &g->life[m % g->nlife];
+  sum += put16 (f + ETH_HDRLEN + IP6_HDRLEN + 6, life->router);
+
+  // Prefixes.
+  off = g->pio;
+  k = m * g->nprefixes;
+  for (i=0; i<g->nprefixes; i++) {
+    sum += put32 (f + off + 4, life->valid);
+    sum += put32 (f + off + 8, life->preferred);
+    sum += put64 (f + off + 16, g->prefix_base + ((k + i) % g->prefix_pool));
+    off += PIO_OPTLEN;
+  }
+
+  // Routes.
+  k = m * g->nroutes;
+  for (i=0; i<g->nroutes; i++) {
+    sum += put32 (f + off + 4, life->route);
+    sum += put64 (f + off + 8, (g->route_len == 0) ? 0 : g->route_base + (((k + i) % g->route_pool) << (64 - g->route_len)));
+    off += RIO_OPTLEN;
+  }
+
+  // DNS servers.
+  if (g->ndns > 0) {
+    sum += put32 (f + off + 4, life->dns);
+    k = m * g->ndns;
+    for (i=0; i<g->ndns; i++) {
+      sum += put64 (f + off + RDNSS_HDRLEN + (16 * i) + 8, g->dns_base + ((k + i) % g->dns_pool));
+    }
+  }
+
+  sum = ~fold_sum (sum) & 0xffff;
+  f[ETH_HDRLEN + IP6_HDRLEN + 2] = sum >> 8;
+  f[ETH_HDRLEN + IP6_HDRLEN + 3] = sum & 0xff;
+}
+
+// Sending thread: fill BATCH frames at a time with the thread's next RAs, and send them.
+void *
+gen_thread (void *arg)
+{
+  int i, n, sd, op, burst, done;
+  long int interval;
+  uint64_t m, sent, retries;
+  uint8_t *frames;
+  gen_thread_ctx *ctx;
+  ra_gen *g;
+  struct sockaddr_ll device;
+  struct mmsghdr msgs[BATCH];
+  struct iovec iovs[BATCH];
+  struct timespec next;
+
+  ctx = (gen_thread_ctx *) arg;
+  g = ctx->gen;
+
+  if ((sd = socket (PF_PACKET, SOCK_RAW, htons (ETH_P_ALL))) < 0) {
+    perror ("socket() failed ");
+    exit (EXIT_FAILURE);
+  }
+
+  // Frames go straight to the driver, without a queueing discipline.
+  if (ctx->qdisc_bypass) {
+    op = 1;
+    if (setsockopt (sd, SOL_PACKET, PACKET_QDISC_BYPASS, &op, sizeof (op)) < 0) {
+      perror ("setsockopt() failed to set PACKET_QDISC_BYPASS ");
+      exit (EXIT_FAILURE);
+    }
+  }
+
+  memset (&device, 0, sizeof (device));
+  device.sll_family = AF_PACKET;
+  device.sll_ifindex = ctx->ifindex;
+  device.sll_halen = 6;
+  memcpy (device.sll_addr, g->frame, 6 * sizeof (uint8_t));
+
+  // Each frame of the batch starts as the template; only the changing fields are written after.
+  frames = allocate_ustrmem (BATCH * MAX_FRAMELEN);
+  memset (msgs, 0, sizeof (msgs));
+  for (i=0; i<BATCH; i++) {
+    memcpy (frames + (i * MAX_FRAMELEN), g->frame, g->len);
+    iovs[i].iov_base = frames + (i * MAX_FRAMELEN);
+    iovs[i].iov_len = g->len;
+    msgs[i].msg_hdr.msg_iov = &iovs[i];
+    msgs[i].msg_hdr.msg_iovlen = 1;
+    msgs[i].msg_hdr.msg_name = &device;
+    msgs[i].msg_hdr.msg_namelen = sizeof (device);
+  }
+
+  // Send several frames per system call, unless the rate is so low that batching would cause bursts.
+  burst = BATCH;
+  interval = 0;
+  if (ctx->rate > 0) {
+    if (ctx->rate < 10000) {
+      burst = 1;
+    }
+    interval = (1000000000L / ctx->rate) * burst;  // Nanoseconds between batches
+  }
+
+  m = ctx->index;
+  sent = 0;
+  retries = 0;
+  done = 0;
+  clock_gettime (CLOCK_MONOTONIC, &next);
+  while ((done == 0) && (stop == 0)) {
+
+    // Fill out up to 'burst' frames.
+    for (n=0; n<burst; n++) {
+      if ((ctx->max > 0) && ((sent + n) >= ctx->max)) {
+        done = 1;
+        break;
+      }
+      ra_fill (g, frames + (n * MAX_FRAMELEN), m);
+      m += g->nthreads;
+    }
+    if (n == 0) {
+      break;
+    }
+
+    // Wait until it's time to send this batch.
+    if (interval > 0) {
+      pace (&next, interval);
+    }
+
+    i = 0;
+    while ((i < n) && (stop == 0)) {
+      if ((op = sendmmsg (sd, msgs + i, n - i, 0)) < 0) {
+        if (errno == EINTR) {
+          retries++;
+          continue;
+        }
+        if (errno == ENOBUFS) {  // Transmit queue full: let it drain.
+          retries++;
+          usleep (100);
+          continue;
+        }
+        perror ("sendmmsg() failed ");
+        exit (EXIT_FAILURE);
+      }
+      i += op;
+    }
+    sent += i;
+    __atomic_store_n (&ctx->sent, sent, __ATOMIC_RELAXED);
+    __atomic_store_n (&ctx->retries, retries, __ATOMIC_RELAXED);
+  }
+
+  close (sd);
+  free (frames);
+  __atomic_store_n (&ctx->done, 1, __ATOMIC_RELEASE);
+
+  return (NULL);
+}
+
+// Write a 16-bit value in network byte order, and return its sum as one word.
+uint32_t
+put16 (uint8_t *p, uint16_t v)
+{
+  p[0] = v >> 8;
+  p[1] = v & 0xff;
+
+  return (v);
+}
+
+// Write a 32-bit value in network byte order, and return the sum of its two words.
+uint32_t
+put32 (uint8_t *p, uint32_t v)
+{
+  p[0] = v >> 24;
+  p[1] = (v >> 16) & 0xff;
+  p[2] = (v >> 8) & 0xff;
+  p[3] = v & 0xff;
+
+  return ((v >> 16) + (v & 0xffff));
+}
+
+// Write a 64-bit value in network byte order, and return the sum of its four words.
+uint32_t
+put64 (uint8_t *p, uint64_t v)
+{
+  return (put32 (p, v >> 32) + put32 (p + 4, v & 0xffffffff));
+}
+
+// Read a 64-bit value in network byte order.
+uint64_t
+get64 (uint8_t *p)
+{
+  int i;
+  uint64_t v;
+
+  v = 0;
+  for (i=0; i<8; i++) {
+    v = (v << 8) | p[i];
+  }
+
+  return (v);
+}
+
+// Add bytes to a running ones' complement sum, as 16-bit big-endian words.
+uint32_t
+sum_bytes (uint32_t sum, uint8_t *data, int len)
+{
+  while (len > 1) {
+    sum += (data[0] << 8) + data[1];
+    data += 2;
+    len -= 2;
+  }
+
+  // Odd byte is padded with zero.
+  if (len == 1) {
+    sum += data[0] << 8;
+  }
+
+  return (sum);
+}
+
+// Fold a 32-bit running sum into 16 bits, with end-around carry.
+uint16_t
+fold_sum (uint32_t sum)
+{
+  while (sum >> 16) {
+    sum = (sum & 0xffff) + (sum >> 16);
+  }
+
+  return (sum);
+}
+
+// Checksum function
+uint16_t
+checksum (uint16_t *addr, int len)
+{
+  int nleft = len;
+  int sum = 0;
+  uint16_t *w = addr;
+  uint16_t answer = 0;
+
+  while (nleft > 1) {
+    sum += *w++;
+    nleft -= sizeof (uint16_t);
+  }
+
+  if (nleft == 1) {
+    *(uint8_t *) (&answer) = *(uint8_t *) w;
+    sum += answer;
+  }
+
+  sum = (sum >> 16) + (sum & 0xFFFF);
+  sum += (sum >> 16);
+  answer = ~sum;
+
+  return (answer);
+}
+
+// Sleep until interval nanoseconds after the last wakeup (absolute time, so pacing never drifts).
+void
+pace (struct timespec *next, long int interval)
+{
+  next->tv_nsec += interval;
+  while (next->tv_nsec >= 1000000000L) {
+    next->tv_nsec -= 1000000000L;
+    next->tv_sec++;
+  }
+  while (clock_nanosleep (CLOCK_MONOTONIC, TIMER_ABSTIME, next, NULL) == EINTR) {
+    if (stop == 1) {
+      break;
+    }
+  }
+}
+
+// Time now (s, CLOCK_MONOTONIC).
+double
+now_sec (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+
+  return ((double) ts.tv_sec + (double) ts.tv_nsec / 1.0e9);
+}
+
+// SIGINT handler: finish current batch and report statistics.
+void
+sig_handler (int signum)
+{
+  (void) signum;
+  stop = 1;
+}
+
+// Allocate memory for an array of chars.
+char *
+allocate_strmem (int len)
+{
+  void *tmp;
+
+  if (len <= 0) {
+    fprintf (stderr, "ERROR: Cannot allocate memory because len = %i in allocate_strmem().\n", len);
+    exit (EXIT_FAILURE);
+  }
+
+  tmp = (char *) malloc (len * sizeof (char));
+  if (tmp != NULL) {
+    memset (tmp, 0, len * sizeof (char));
+    return (tmp);
+  } else {
+    fprintf (stderr, "ERROR: Cannot allocate memory for array allocate_strmem().\n");
+    exit (EXIT_FAILURE);
+  }
+}
+
+// Allocate memory for an array of unsigned chars.
+uint8_t *
+allocate_ustrmem (int len)
+{
+  void *tmp;
+
+  if (len <= 0) {
+    fprintf (stderr, "ERROR: Cannot allocate memory because len = %i in allocate_ustrmem().\n", len);
+    exit (EXIT_FAILURE);
+  }
+
+  tmp = (uint8_t *) malloc (len * sizeof (uint8_t));
+  if (tmp != NULL) {
+    memset (tmp, 0, len * sizeof (uint8_t));
+    return (tmp);
+  } else {
+    fprintf (stderr, "ERROR: Cannot allocate memory for array allocate_ustrmem().\n");
+    exit (EXIT_FAILURE);
+  }
+}
@@ -0,0 +1,1361 @@
+/*  Copyright (C) 2013  P.D. Buchan (pdbuchan@yahoo.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Receive IPv6 packets carrying an authentication header (AH) and/or an
+// encapsulating security payload (ESP) header, as sent by tcp6_hop_auth_ll.c
+// and tcp6_hop_esp_ll.c, and validate them.
+// Security associations (SAs) are looked up by SPI in a hash table.
+// AH integrity check values (HMAC-SHA1-96 or HMAC-SHA-256-128) are verified,
+// ESP payloads are authenticated and decrypted (AES-GCM, RFC 4106), and
+// replayed packets are rejected with a sliding window bitmap which also
+// infers the high half of extended (64-bit) sequence numbers (Appendix A of RFC 4303).
+// Statistics are printed every second; stop with Ctrl-C.
+
+#define _GNU_SOURCE           // recvmmsg() and struct mmsghdr
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>           // close()
+#include <string.h>           // strcpy, memset(), and memcpy()
+
+#include <sys/types.h>        // needed for socket(), uint8_t, uint16_t, uint32_t
+#include <sys/socket.h>       // needed for socket(), recvmmsg()
+#include <netinet/in.h>       // IPPROTO_IPV6, IPPROTO_HOPOPTS, IPPROTO_AH, IPPROTO_ESP, IPPROTO_TCP
+#include <netinet/ip.h>       // IP_MAXPACKET (which is 65535)
+#include <arpa/inet.h>        // htons()
+#include <net/if.h>           // if_nametoindex()
+#include <linux/if_ether.h>   // ETH_P_IP = 0x0800, ETH_P_IPV6 = 0x86DD
+#include <linux/if_packet.h>  // struct sockaddr_ll (see man 7 packet)
+#include <sys/time.h>         // struct timeval
+#include <time.h>             // clock_gettime()
+#include <signal.h>           // signal(), SIGINT
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>        // AES-NI and PCLMULQDQ intrinsics (x86 only)
+#endif
+
+#include <errno.h>            // errno, perror()
+
+// Define some constants.
+#define ETH_HDRLEN 14         // Ethernet header length
+#define IP6_HDRLEN 40         // IPv6 header length
+#define ATH_HDRLEN 12         // Authentication header length, excludes authentication data
+#define ESP_HDRLEN 8          // ESP header (SPI and sequence number)
+#define ESP_IVLEN 8           // AES-GCM explicit IV length (Section 3.1 of RFC 4106)
+#define ESP_TAILLEN 2         // ESP trailer: pad length and next header
+#define ESP_ICVLEN 16         // AES-GCM ICV length (16-octet ICV variant of RFC 4106)
+#define BATCH 64              // Maximum number of frames returned by one recvmmsg()
+#define MAX_FRAMELEN 9216     // Largest (jumbo) ethernet frame we expect
+#define MAX_KEYLEN 64         // Maximum key length (bytes)
+#define MAX_SAS 16            // Maximum number of configured SAs
+#define SA_TABLE_SIZE 64      // Hash table slots: a power of two, comfortably more than MAX_SAS
+#define REPLAY_WINDOW 1024    // Anti-replay window size in packets: a multiple of 64 (Section 3.4.3 of RFC 4303)
+
+// IPsec protocols (IANA protocol numbers)
+#define SA_AH IPPROTO_AH      // 51
+#define SA_ESP IPPROTO_ESP    // 50
+
+// Integrity algorithms for AH
+#define AUTH_HMAC_SHA1_96 1        // RFC 2404: 20-byte digest truncated to 12-byte ICV
+#define AUTH_HMAC_SHA256_128 2     // RFC 4868: 32-byte digest truncated to 16-byte ICV
+
+// Results of processing a packet
+#define RX_OK 0               // ICV verified (and payload decrypted)
+#define RX_NOSA -1            // No SA for this SPI
+#define RX_REPLAY -2          // Duplicate, or too old for the window
+#define RX_AUTH -3            // ICV verification failed
+#define RX_BAD -4             // Malformed packet, or not IPsec
+
+// Rotate 32-bit value left or right.
+#define ROL(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+#define ROR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+// Multiply by x in GF(2^8), as used by AES MixColumns.
+#define XTIME(x) ((uint8_t) (((x) << 1) ^ (((x) & 0x80) ? 0x1b : 0x00)))
+
+// Define a struct for SHA-1 or SHA-256 hash state.
+typedef struct _hash_ctx hash_ctx;
+struct _hash_ctx {
+  int alg;              // AUTH_HMAC_SHA1_96 or AUTH_HMAC_SHA256_128
+  uint32_t h[8];        // Chaining state (5 words for SHA-1, 8 for SHA-256)
+  uint64_t len;         // Total number of bytes hashed
+  uint8_t buf[64];      // Partial block
+  int nbuf;             // Number of bytes in partial block
+};
+
+// Define a struct for expanded AES key.
+typedef struct _aes_ctx aes_ctx;
+struct _aes_ctx {
+  uint8_t rk[240];      // Round keys, 16 bytes for each round plus initial key
+  int nr;               // Number of rounds: 10 for AES-128, 14 for AES-256
+};
+
+// Define a struct for an inbound security association (SA), either AH or ESP.
+typedef struct _sa_entry sa_entry;
+struct _sa_entry {
+  int proto;            // SA_AH or SA_ESP
+  uint32_t spi;         // Security parameters index
+  int esn;              // Extended (64-bit) sequence numbers: 0 = no, 1 = yes
+
+  // Anti-replay state: bit (seq % REPLAY_WINDOW) of bitmap is set once seq has been accepted.
+  uint64_t top;         // Highest sequence number accepted so far
+  uint64_t bitmap[REPLAY_WINDOW / 64];
+
+  // AH: HMAC
+  int alg;              // Integrity algorithm
+  int digest_len;       // Full HMAC digest length (bytes)
+  int icv_len;          // Truncated ICV length (bytes)
+  int ah_len;           // Total authentication header length, including ICV and padding (bytes)
+  hash_ctx inner;       // Hash state after absorbing key XOR ipad
+  hash_ctx outer;       // Hash state after absorbing key XOR opad
+
+  // ESP: AES-GCM
+  uint8_t salt[4];      // Implicit part of nonce (Section 4 of RFC 4106)
+  aes_ctx aes;          // Expanded AES key
+  uint8_t hpow[4][16];  // GHASH key H = E(K, 0^128), and H^2, H^3, H^4
+  int aesni;            // Use AES-NI and PCLMULQDQ instructions: 0 = no, 1 = yes
+
+  // Counters
+  uint64_t ok;
+  uint64_t replay;
+  uint64_t auth;
+  uint64_t bytes;       // Upper layer bytes accepted
+};
+
+// Define a struct for SA table: SPIs hash to slots, with linear probing.
+typedef struct _sa_table sa_table;
+struct _sa_table {
+  sa_entry sas[MAX_SAS];
+  int nsas;
+  int slot[SA_TABLE_SIZE];  // Index into sas[], or -1 if empty
+};
+
+// AES S-box (Section 5.1.1 of FIPS 197)
+static const uint8_t aes_sbox[256] = {
+  0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5, 0x30, 0x01, 0x67, 0x2b, 0xfe, 0xd7, 0xab, 0x76,
+  0xca, 0x82, 0xc9, 0x7d, 0xfa, 0x59, 0x47, 0xf0, 0xad, 0xd4, 0xa2, 0xaf, 0x9c, 0xa4, 0x72, 0xc0,
+  0xb7, 0xfd, 0x93, 0x26, 0x36, 0x3f, 0xf7, 0xcc, 0x34, 0xa5, 0xe5, 0xf1, 0x71, 0xd8, 0x31, 0x15,
+  0x04, 0xc7, 0x23, 0xc3, 0x18, 0x96, 0x05, 0x9a, 0x07, 0x12, 0x80, 0xe2, 0xeb, 0x27, 0xb2, 0x75,
+  0x09, 0x83, 0x2c, 0x1a, 0x1b, 0x6e, 0x5a, 0xa0, 0x52, 0x3b, 0xd6, 0xb3, 0x29, 0xe3, 0x2f, 0x84,
+  0x53, 0xd1, 0x00, 0xed, 0x20, 0xfc, 0xb1, 0x5b, 0x6a, 0xcb, 0xbe, 0x39, 0x4a, 0x4c, 0x58, 0xcf,
+  0xd0, 0xef, 0xaa, 0xfb, 0x43, 0x4d, 0x33, 0x85, 0x45, 0xf9, 0x02, 0x7f, 0x50, 0x3c, 0x9f, 0xa8,
+  0x51, 0xa3, 0x40, 0x8f, 0x92, 0x9d, 0x38, 0xf5, 0xbc, 0xb6, 0xda, 0x21, 0x10, 0xff, 0xf3, 0xd2,
+  0xcd, 0x0c, 0x13, 0xec, 0x5f, 0x97, 0x44, 0x17, 0xc4, 0xa7, 0x7e, 0x3d, 0x64, 0x5d, 0x19, 0x73,
+  0x60, 0x81, 0x4f, 0xdc, 0x22, 0x2a, 0x90, 0x88, 0x46, 0xee, 0xb8, 0x14, 0xde, 0x5e, 0x0b, 0xdb,
+  0xe0, 0x32, 0x3a, 0x0a, 0x49, 0x06, 0x24, 0x5c, 0xc2, 0xd3, 0xac, 0x62, 0x91, 0x95, 0xe4, 0x79,
+  0xe7, 0xc8, 0x37, 0x6d, 0x8d, 0xd5, 0x4e, 0xa9, 0x6c, 0x56, 0xf4, 0xea, 0x65, 0x7a, 0xae, 0x08,
+  0xba, 0x78, 0x25, 0x2e, 0x1c, 0xa6, 0xb4, 0xc6, 0xe8, 0xdd, 0x74, 0x1f, 0x4b, 0xbd, 0x8b, 0x8a,
+  0x70, 0x3e, 0xb5, 0x66, 0x48, 0x03, 0xf6, 0x0e, 0x61, 0x35, 0x57, 0xb9, 0x86, 0xc1, 0x1d, 0x9e,
+  0xe1, 0xf8, 0x98, 0x11, 0x69, 0xd9, 0x8e, 0x94, 0x9b, 0x1e, 0x87, 0xe9, 0xce, 0x55, 0x28, 0xdf,
+  0x8c, 0xa1, 0x89, 0x0d, 0xbf, 0xe6, 0x42, 0x68, 0x41, 0x99, 0x2d, 0x0f, 0xb0, 0x54, 0xbb, 0x16
+};
+
+// Function prototypes
+void sig_handler (int);
+void sa_table_init (sa_table *);
+sa_entry *sa_table_add (sa_table *, int, uint32_t, int, int, char *);
+sa_entry *sa_table_lookup (sa_table *, int, uint32_t);
+int replay_check (sa_entry *, uint32_t, uint64_t *);
+void replay_update (sa_entry *, uint64_t);
+int process_packet (sa_table *, uint8_t *, int);
+int ah_verify (sa_entry *, uint8_t *, int, int, uint64_t);
+int esp_open (sa_entry *, uint8_t *, int, uint64_t, int *, int *);
+int ct_memcmp (const uint8_t *, const uint8_t *, int);
+int hex_to_bytes (char *, uint8_t *, int);
+void hash_init (hash_ctx *, int);
+void sha1_block (uint32_t *, const uint8_t *);
+void sha256_block (uint32_t *, const uint8_t *);
+void hash_update (hash_ctx *, const uint8_t *, int);
+void hash_final (hash_ctx *, uint8_t *);
+void aes_key_expand (aes_ctx *, const uint8_t *, int);
+void aes_encrypt_block (aes_ctx *, const uint8_t *, uint8_t *);
+void ghash_mult (uint8_t *, const uint8_t *);
+void ghash_update (uint8_t *, const uint8_t *, const uint8_t *, int);
+int gcm_open (sa_entry *, const uint8_t *, const uint8_t *, int, const uint8_t *, uint8_t *, int, const uint8_t *);
+#if defined(__x86_64__) || defined(__i386__)
+int gcm_open_ni (sa_entry *, const uint8_t *, const uint8_t *, int, const uint8_t *, uint8_t *, int, const uint8_t *);
+#endif
+char *allocate_strmem (int);
+uint8_t *allocate_ustrmem (int);
+
+// Set by SIGINT handler to stop receiving.
+volatile sig_atomic_t stop = 0;
+
+int
+main (int argc, char **argv)
+{
+  int i, n, sd, ifindex, bufsize, status;
+  uint64_t total, nosa, bad, last;
+  char *interface;
+  uint8_t *frames;
+  sa_table table;
+  sa_entry *sa;
+  struct sockaddr_ll device;
+  struct mmsghdr msgs[BATCH];
+  struct iovec iovs[BATCH];
+  struct timeval tv;
+  struct timespec t0, t1;
+  double dt;
+
+  // Allocate memory for various arrays.
+  interface = allocate_strmem (40);
+  frames = allocate_ustrmem (BATCH * MAX_FRAMELEN);
+
+  // Interface to receive packets on.
+  strcpy (interface, "eth0");
+
+  // Inbound security associations: these must match the sender's SAs.
+  // Arguments: protocol, SPI, extended sequence numbers (0 or 1), algorithm (AH only),
+  // and key in hexadecimal (for ESP, AES key followed by 4-byte salt): you need to fill these out
+  sa_table_init (&table);
+  sa_table_add (&table, SA_AH, 51413ul, 0, AUTH_HMAC_SHA1_96, "0102030405060708090a0b0c0d0e0f1011121314");
+  sa_table_add (&table, SA_ESP, 31415ul, 0, 0, "000102030405060708090a0b0c0d0e0fdeadbeef");
+
+  // Find interface index from interface name.
+  if ((ifindex = if_nametoindex (interface)) == 0) {
+    perror ("if_nametoindex() failed to obtain interface index ");
+    exit (EXIT_FAILURE);
+  }
+  printf ("Index for interface %s is %i\n", interface, ifindex);
+
+  // Submit request for a raw socket descriptor, receiving IPv6 frames only.
+  if ((sd = socket (PF_PACKET, SOCK_RAW, htons (ETH_P_IPV6))) < 0) {
+    perror ("socket() failed ");
+    exit (EXIT_FAILURE);
+  }
+
+  // Bind socket to interface.
+  memset (&device, 0, sizeof (device));
+  device.sll_family = AF_PACKET;
+  device.sll_protocol = htons (ETH_P_IPV6);
+  device.sll_ifindex = ifindex;
+  if (bind (sd, (struct sockaddr *) &device, sizeof (device)) < 0) {
+    perror ("bind() failed ");
+    exit (EXIT_FAILURE);
+  }
+
+  // A large receive buffer absorbs bursts at high packet rates.
+  bufsize = 64 * 1024 * 1024;
+  if (setsockopt (sd, SOL_SOCKET, SO_RCVBUF, &bufsize, sizeof (bufsize)) < 0) {
+    perror ("setsockopt() failed to set SO_RCVBUF ");
+    exit (EXIT_FAILURE);
+  }
+
+  // Time out so statistics are printed even when no packets arrive.
+  tv.tv_sec = 1;
+  tv.tv_usec = 0;
+  if (setsockopt (sd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof (tv)) < 0) {
+    perror ("setsockopt() failed to set SO_RCVTIMEO ");
+    exit (EXIT_FAILURE);
+  }
+
+  // Prepare messages for recvmmsg().
+  memset (msgs, 0, sizeof (msgs));
+  for (i=0; i<BATCH; i++) {
+    iovs[i].iov_base = frames + (i * MAX_FRAMELEN);
+    iovs[i].iov_len = MAX_FRAMELEN;
+    msgs[i].msg_hdr.msg_iov = &iovs[i];
+    msgs[i].msg_hdr.msg_iovlen = 1;
+  }
+
+  signal (SIGINT, sig_handler);
+
+  total = 0;
+  nosa = 0;
+  bad = 0;
+  last = 0;
+  clock_gettime (CLOCK_MONOTONIC, &t0);
+  while (stop == 0) {
+
+    // Receive a batch of frames: block for the first, then take whatever else is queued.
+    if ((n = recvmmsg (sd, msgs, BATCH, MSG_WAITFORONE, NULL)) < 0) {
+      if ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR)) {
+        perror ("recvmmsg() failed ");
+        exit (EXIT_FAILURE);
+      }
+      n = 0;
+    }
+
+    for (i=0; i<n; i++) {
+      if (msgs[i].msg_len <= ETH_HDRLEN) {
+        continue;
+      }
+      status = process_packet (&table, frames + (i * MAX_FRAMELEN) + ETH_HDRLEN, msgs[i].msg_len - ETH_HDRLEN);
+      if (status == RX_NOSA) {
+        nosa++;
+      } else if (status == RX_BAD) {
+        bad++;
+      }
+      total++;
+    }
+
+    // Report rate once a second.
+    clock_gettime (CLOCK_MONOTONIC, &t1);
+    dt = (double) (t1.tv_sec - t0.tv_sec) + (double) (t1.tv_nsec - t0.tv_nsec) / 1000000000.0;
+    if (dt >= 1.0) {
+      printf ("%.0f packets per second, %llu packets total\n", (double) (total - last) / dt, (unsigned long long) total);
+      last = total;
+      t0 = t1;
+    }
+  }
+
+  // Report results.
+  printf ("\nFrames received: %llu (unknown SPI: %llu, not IPsec or malformed: %llu)\n",
+    (unsigned long long) total, (unsigned long long) nosa, (unsigned long long) bad);
+  for (i=0; i<table.nsas; i++) {
+    sa = &table.sas[i];
+    printf ("%s SPI %u: %llu accepted (%llu bytes), %llu failed ICV, %llu replayed; highest sequence number %llu\n",
+      (sa->proto == SA_AH) ? "AH" : "ESP", sa->spi, (unsigned long long) sa->ok, (unsigned long long) sa->bytes,
+      (unsigned long long) sa->auth, (unsigned long long) sa->replay, (unsigned long long) sa->top);
+  }
+
+  // Close socket descriptor.
+  close (sd);
+
+  // Free allocated memory.
+  free (interface);
+  free (frames);
+
+  return (EXIT_SUCCESS);
+}
+
+// Signal handler: stop receiving.
+void
+sig_handler (int signum)
+{
+  (void) signum;
+  stop = 1;
+}
+
+// Initialize an empty SA table.
+void
+sa_table_init (sa_table *table)
+{
+  int i;
+
+  memset (table, 0, sizeof (sa_table));
+  for (i=0; i<SA_TABLE_SIZE; i++) {
+    table->slot[i] = -1;
+  }
+}
+
+// Hash protocol and SPI to a table slot (Fibonacci hashing).
+static inline int
+sa_hash (int proto, uint32_t spi)
+{
+  return ((int) (((spi ^ ((uint32_t) proto << 24)) * 2654435769u) >> 26) & (SA_TABLE_SIZE - 1));
+}
+
+// Add an inbound SA and derive its per-packet state: HMAC pad states for AH,
+// or expanded AES key and GHASH key powers for ESP.
+sa_entry *
+sa_table_add (sa_table *table, int proto, uint32_t spi, int esn, int alg, char *key_hex)
+{
+  int i, keylen, s;
+  uint8_t key[MAX_KEYLEN], k[64], block[64], zero[16];
+  hash_ctx ctx;
+  sa_entry *sa;
+
+  if (table->nsas >= MAX_SAS) {
+    fprintf (stderr, "ERROR: Too many SAs; increase MAX_SAS.\n");
+    exit (EXIT_FAILURE);
+  }
+  if (sa_table_lookup (table, proto, spi) != NULL) {
+    fprintf (stderr, "ERROR: Duplicate SPI %u.\n", spi);
+    exit (EXIT_FAILURE);
+  }
+
+  sa = &table->sas[table->nsas];
+  memset (sa, 0, sizeof (sa_entry));
+  sa->proto = proto;
+  sa->spi = spi;
+  sa->esn = esn;
+  keylen = hex_to_bytes (key_hex, key, MAX_KEYLEN);
+
+  if (proto == SA_AH) {
+    sa->alg = alg;
+    if (alg == AUTH_HMAC_SHA1_96) {
+      sa->digest_len = 20;
+      sa->icv_len = 12;
+    } else if (alg == AUTH_HMAC_SHA256_128) {
+      sa->digest_len = 32;
+      sa->icv_len = 16;
+    } else {
+      fprintf (stderr, "ERROR: Unknown integrity algorithm %i for SPI %u.\n", alg, spi);
+      exit (EXIT_FAILURE);
+    }
+    sa->ah_len = ATH_HDRLEN + sa->icv_len;
+    while ((sa->ah_len % 8) != 0) {
+      sa->ah_len++;
+    }
+
+    // HMAC inner and outer pad states (Section 2 of RFC 2104).
+    memset (k, 0, sizeof (k));
+    if (keylen > 64) {
+      hash_init (&ctx, alg);
+      hash_update (&ctx, key, keylen);
+      hash_final (&ctx, k);
+    } else {
+      memcpy (k, key, keylen * sizeof (uint8_t));
+    }
+    for (i=0; i<64; i++) {
+      block[i] = k[i] ^ 0x36;
+    }
+    hash_init (&sa->inner, alg);
+    hash_update (&sa->inner, block, 64);
+    for (i=0; i<64; i++) {
+      block[i] = k[i] ^ 0x5c;
+    }
+    hash_init (&sa->outer, alg);
+    hash_update (&sa->outer, block, 64);
+
+  } else if (proto == SA_ESP) {
+    if ((keylen != 20) && (keylen != 36)) {
+      fprintf (stderr, "ERROR: ESP keying material must be 20 bytes (AES-GCM-128) or 36 bytes (AES-GCM-256) for SPI %u.\n", spi);
+      exit (EXIT_FAILURE);
+    }
+    memcpy (sa->salt, key + keylen - 4, 4 * sizeof (uint8_t));
+    aes_key_expand (&sa->aes, key, keylen - 4);
+    memset (zero, 0, 16 * sizeof (uint8_t));
+    aes_encrypt_block (&sa->aes, zero, sa->hpow[0]);
+    for (i=1; i<4; i++) {
+      memcpy (sa->hpow[i], sa->hpow[i-1], 16 * sizeof (uint8_t));
+      ghash_mult (sa->hpow[i], sa->hpow[0]);
+    }
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init ();
+    sa->aesni = (__builtin_cpu_supports ("aes") && __builtin_cpu_supports ("pclmul") && __builtin_cpu_supports ("sse4.1")) ? 1 : 0;
+#else
+    sa->aesni = 0;
+#endif
+
+  } else {
+    fprintf (stderr, "ERROR: Unknown protocol %i for SPI %u.\n", proto, spi);
+    exit (EXIT_FAILURE);
+  }
+
+  // Insert into first free slot at or after the hashed one.
+  s = sa_hash (proto, spi);
+  while (table->slot[s] != -1) {
+    s = (s + 1) & (SA_TABLE_SIZE - 1);
+  }
+  table->slot[s] = table->nsas;
+  table->nsas++;
+
+  return (sa);
+}
+
+// Look up an SA by protocol and SPI. Returns NULL if there is none.
+sa_entry *
+sa_table_lookup (sa_table *table, int proto, uint32_t spi)
+{
+  int s, idx;
+
+  s = sa_hash (proto, spi);
+  while ((idx = table->slot[s]) != -1) {
+    if ((table->sas[idx].spi == spi) && (table->sas[idx].proto == proto)) {
+      return (&table->sas[idx]);
+    }
+    s = (s + 1) & (SA_TABLE_SIZE - 1);
+  }
+
+  return (NULL);
+}
+
+// Check a received sequence number against the anti-replay window, before the ICV is verified.
+// With extended sequence numbers, only the low 32 bits are sent; the high 32 bits are inferred
+// from where the low bits fall relative to the window (Section A2.2 of RFC 4303).
+// On success, the full sequence number is written to *seq.
+int
+replay_check (sa_entry *sa, uint32_t seql, uint64_t *seq)
+{
+  uint32_t tl, th, bottom;
+  uint64_t s;
+
+  if (sa->esn == 1) {
+    tl = sa->top & 0xfffffffful;
+    th = sa->top >> 32;
+    bottom = tl - REPLAY_WINDOW + 1;  // May wrap, which is intended.
+    if (tl >= (REPLAY_WINDOW - 1)) {
+
+      // Case A: window lies within one sequence number subspace.
+      if (seql >= bottom) {
+        s = ((uint64_t) th << 32) | seql;
+      } else {
+        s = ((uint64_t) (th + 1) << 32) | seql;
+      }
+    } else {
+
+      // Case B: window spans two sequence number subspaces.
+      if (seql >= bottom) {
+        if (th == 0) {
+          return (RX_REPLAY);  // Would be before the first packet.
+        }
+        s = ((uint64_t) (th - 1) << 32) | seql;
+      } else {
+        s = ((uint64_t) th << 32) | seql;
+      }
+    }
+  } else {
+    s = seql;
+  }
+
+  // Sequence number zero is never sent (Section 3.3.3 of RFC 4303).
+  if (s == 0) {
+    return (RX_REPLAY);
+  }
+
+  // Newer than anything seen: fine.
+  if (s > sa->top) {
+    *seq = s;
+    return (RX_OK);
+  }
+
+  // Too old, or already seen.
+  if ((sa->top - s) >= REPLAY_WINDOW) {
+    return (RX_REPLAY);
+  }
+  if ((sa->bitmap[(s % REPLAY_WINDOW) / 64] >> (s % 64)) & 1) {
+    return (RX_REPLAY);
+  }
+
+  *seq = s;
+  return (RX_OK);
+}
+
+// Record an authenticated sequence number, sliding the window forward if it is the newest.
+// Only called after the ICV has been verified (Section 3.4.3 of RFC 4303).
+void
+replay_update (sa_entry *sa, uint64_t seq)
+{
+  uint64_t diff, s;
+
+  if (seq > sa->top) {
+    diff = seq - sa->top;
+    if (diff >= REPLAY_WINDOW) {
+      memset (sa->bitmap, 0, sizeof (sa->bitmap));
+    } else {
+
+      // Clear bits for sequence numbers skipped over, which are now inside the window.
+      for (s=sa->top+1; s<seq; s++) {
+        sa->bitmap[(s % REPLAY_WINDOW) / 64] &= ~(1ull << (s % 64));
+      }
+    }
+    sa->top = seq;
+  }
+  sa->bitmap[(seq % REPLAY_WINDOW) / 64] |= 1ull << (seq % 64);
+}
+
+// Process one IPv6 packet: find AH and/or ESP, look up SA, check replay window,
+// verify ICV (decrypting ESP), and update the window.
+int
+process_packet (sa_table *table, uint8_t *pkt, int len)
+{
+  int c, status, nxt, offset, plen, found;
+  uint64_t seq;
+  sa_entry *sa;
+
+  if ((len < IP6_HDRLEN) || ((pkt[0] >> 4) != 6)) {
+    return (RX_BAD);
+  }
+
+  // Trust IPv6 payload length rather than frame length, which may include ethernet padding.
+  plen = (pkt[4] << 8) + pkt[5];
+  if ((IP6_HDRLEN + plen) > len) {
+    return (RX_BAD);
+  }
+  len = IP6_HDRLEN + plen;
+
+  // Skip extension headers ahead of AH or ESP.
+  nxt = pkt[6];
+  c = IP6_HDRLEN;
+  while ((nxt == IPPROTO_HOPOPTS) || (nxt == IPPROTO_DSTOPTS) || (nxt == IPPROTO_ROUTING)) {
+    if ((c + 8) > len) {
+      return (RX_BAD);
+    }
+    nxt = pkt[c];
+    c += (pkt[c + 1] + 1) * 8;
+  }
+
+  found = 0;
+  if (nxt == IPPROTO_AH) {
+    if ((c + ATH_HDRLEN) > len) {
+      return (RX_BAD);
+    }
+    if ((sa = sa_table_lookup (table, SA_AH, ntohl (*(uint32_t *) (pkt + c + 4)))) == NULL) {
+      return (RX_NOSA);
+    }
+    if (replay_check (sa, ntohl (*(uint32_t *) (pkt + c + 8)), &seq) != RX_OK) {
+      sa->replay++;
+      return (RX_REPLAY);
+    }
+    if ((status = ah_verify (sa, pkt, len, c, seq)) != RX_OK) {
+      if (status == RX_AUTH) {
+        sa->auth++;
+      }
+      return (status);
+    }
+    replay_update (sa, seq);
+    sa->ok++;
+    nxt = pkt[c];
+    c += (pkt[c + 1] + 2) * 4;
+    sa->bytes += len - c;
+    found = 1;
+  }
+
+  if (nxt == IPPROTO_ESP) {
+    if ((c + ESP_HDRLEN + ESP_IVLEN + ESP_TAILLEN + ESP_ICVLEN) > len) {
+      return (RX_BAD);
+    }
+    if ((sa = sa_table_lookup (table, SA_ESP, ntohl (*(uint32_t *) (pkt + c)))) == NULL) {
+      return (RX_NOSA);
+    }
+    if (replay_check (sa, ntohl (*(uint32_t *) (pkt + c + 4)), &seq) != RX_OK) {
+      sa->replay++;
+      return (RX_REPLAY);
+    }
+    if ((status = esp_open (sa, pkt + c, len - c, seq, &offset, &plen)) != RX_OK) {
+      if (status == RX_AUTH) {
+        sa->auth++;
+      }
+      return (status);
+    }
+    replay_update (sa, seq);
+    sa->ok++;
+    sa->bytes += plen;
+    found = 1;
+  }
+
+  return ((found == 1) ? RX_OK : RX_BAD);
+}
+
+// Verify the ICV of an IPv6 packet with an authentication header at offset ah.
+// Mutable fields are hashed as zero, as the sender did (Section 3.3.3.1 of RFC 4302).
+int
+ah_verify (sa_entry *sa, uint8_t *pkt, int len, int ah, uint64_t seq)
+{
+  int c, hdrlen, indx, optlen;
+  uint8_t nxt, scratch[2048], digest[32], seqhi[4];
+  hash_ctx ctx;
+
+  hdrlen = (pkt[ah + 1] + 2) * 4;
+  if ((hdrlen != sa->ah_len) || ((ah + hdrlen) > len)) {
+    return (RX_BAD);
+  }
+
+  ctx = sa->inner;
+
+  // IPv6 header: traffic class, flow label and hop limit are mutable.
+  memcpy (scratch, pkt, IP6_HDRLEN * sizeof (uint8_t));
+  scratch[0] = 0x60;
+  scratch[1] = 0;
+  scratch[2] = 0;
+  scratch[3] = 0;
+  scratch[7] = 0;
+  hash_update (&ctx, scratch, IP6_HDRLEN);
+
+  // Hop-by-hop and destination options ahead of AH: zero data of options marked mutable.
+  nxt = pkt[6];
+  c = IP6_HDRLEN;
+  while (c < ah) {
+    if ((nxt != IPPROTO_HOPOPTS) && (nxt != IPPROTO_DSTOPTS)) {
+      return (RX_BAD);  // Routing header would need its final destination substituted; not handled.
+    }
+    hdrlen = (pkt[c + 1] + 1) * 8;
+    memcpy (scratch, pkt + c, hdrlen * sizeof (uint8_t));
+    indx = 2;
+    while (indx < hdrlen) {
+      if (scratch[indx] == 0) {  // Pad1
+        indx++;
+        continue;
+      }
+      if ((indx + 1) >= hdrlen) {
+        return (RX_BAD);
+      }
+      optlen = scratch[indx + 1];
+      if ((indx + 2 + optlen) > hdrlen) {
+        return (RX_BAD);
+      }
+      if (scratch[indx] & 0x20) {
+        memset (scratch + indx + 2, 0, optlen * sizeof (uint8_t));
+      }
+      indx += 2 + optlen;
+    }
+    hash_update (&ctx, scratch, hdrlen);
+    nxt = pkt[c];
+    c += hdrlen;
+  }
+
+  // Authentication header with ICV zeroed, then the rest of the packet.
+  memset (scratch, 0, sa->ah_len * sizeof (uint8_t));
+  memcpy (scratch, pkt + ah, ATH_HDRLEN * sizeof (uint8_t));
+  hash_update (&ctx, scratch, sa->ah_len);
+  hash_update (&ctx, pkt + ah + sa->ah_len, len - ah - sa->ah_len);
+
+  // Implicit high-order 32 bits of extended sequence number.
+  if (sa->esn == 1) {
+    seqhi[0] = (seq >> 56) & 0xff;
+    seqhi[1] = (seq >> 48) & 0xff;
+    seqhi[2] = (seq >> 40) & 0xff;
+    seqhi[3] = (seq >> 32) & 0xff;
+    hash_update (&ctx, seqhi, 4);
+  }
+  hash_final (&ctx, digest);
+
+  ctx = sa->outer;
+  hash_update (&ctx, digest, sa->digest_len);
+  hash_final (&ctx, digest);
+
+  if (ct_memcmp (digest, pkt + ah + ATH_HDRLEN, sa->icv_len) != 0) {
+    return (RX_AUTH);
+  }
+
+  return (RX_OK);
+}
+
+// Authenticate and decrypt (in place) an ESP packet starting at esp, of len bytes through the ICV.
+// On success, *offset and *plen give the position (from esp) and length of the upper layer data,
+// with padding and ESP trailer removed.
+int
+esp_open (sa_entry *sa, uint8_t *esp, int len, uint64_t seq, int *offset, int *plen)
+{
+  int i, ctlen, aadlen, padlen, status;
+  uint8_t nonce[12], aad[12], *ct;
+
+  ctlen = len - ESP_HDRLEN - ESP_IVLEN - ESP_ICVLEN;
+  ct = esp + ESP_HDRLEN + ESP_IVLEN;
+
+  // Nonce is salt followed by explicit IV (Section 4 of RFC 4106).
+  memcpy (nonce, sa->salt, 4 * sizeof (uint8_t));
+  memcpy (nonce + 4, esp + ESP_HDRLEN, ESP_IVLEN * sizeof (uint8_t));
+
+  // Additional authenticated data: SPI and 32 or 64-bit sequence number (Section 5 of RFC 4106).
+  memcpy (aad, esp, 4 * sizeof (uint8_t));
+  if (sa->esn == 1) {
+    for (i=0; i<8; i++) {
+      aad[4 + i] = (seq >> (56 - (8 * i))) & 0xff;
+    }
+    aadlen = 12;
+  } else {
+    memcpy (aad + 4, esp + 4, 4 * sizeof (uint8_t));
+    aadlen = 8;
+  }
+
+#if defined(__x86_64__) || defined(__i386__)
+  if (sa->aesni == 1) {
+    status = gcm_open_ni (sa, nonce, aad, aadlen, ct, ct, ctlen, ct + ctlen);
+  } else {
+    status = gcm_open (sa, nonce, aad, aadlen, ct, ct, ctlen, ct + ctlen);
+  }
+#else
+  status = gcm_open (sa, nonce, aad, aadlen, ct, ct, ctlen, ct + ctlen);
+#endif
+  if (status != 0) {
+    return (RX_AUTH);
+  }
+
+  // ESP trailer and padding (Section 2.4 of RFC 4303).
+  padlen = ct[ctlen - 2];
+  if ((padlen + ESP_TAILLEN) > ctlen) {
+    return (RX_BAD);
+  }
+  for (i=0; i<padlen; i++) {
+    if (ct[ctlen - ESP_TAILLEN - padlen + i] != (uint8_t) (i + 1u)) {
+      return (RX_BAD);
+    }
+  }
+
+  *offset = ESP_HDRLEN + ESP_IVLEN;
+  *plen = ctlen - ESP_TAILLEN - padlen;
+
+  return (RX_OK);
+}
+
+// Compare two byte strings in time independent of their contents. Returns 0 if equal.
+int
+ct_memcmp (const uint8_t *a, const uint8_t *b, int len)
+{
+  int i;
+  uint8_t d;
+
+  d = 0;
+  for (i=0; i<len; i++) {
+    d |= a[i] ^ b[i];
+  }
+
+  return (d != 0);
+}
+
+// Convert a string of hexadecimal digits to bytes. Returns number of bytes.
+int
+hex_to_bytes (char *hex, uint8_t *out, int max)
+{
+  int n;
+  unsigned int byte;
+
+  n = 0;
+  while ((hex[2 * n] != 0) && (hex[(2 * n) + 1] != 0)) {
+    if (n >= max) {
+      fprintf (stderr, "ERROR: Hexadecimal key longer than %i bytes in hex_to_bytes().\n", max);
+      exit (EXIT_FAILURE);
+    }
+    if (sscanf (hex + (2 * n), "%2x", &byte) != 1) {
+      fprintf (stderr, "ERROR: Invalid hexadecimal digits in hex_to_bytes().\n");
+      exit (EXIT_FAILURE);
+    }
+    out[n] = byte;
+    n++;
+  }
+
+  return (n);
+}
+
+// Initialize hash state for SHA-1 (FIPS 180-4) or SHA-256.
+void
+hash_init (hash_ctx *ctx, int alg)
+{
+  static const uint32_t sha1_iv[5] = {
+    0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0
+  };
+  static const uint32_t sha256_iv[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+  };
+
+  memset (ctx, 0, sizeof (hash_ctx));
+  ctx->alg = alg;
+  if (alg == AUTH_HMAC_SHA1_96) {
+    memcpy (ctx->h, sha1_iv, sizeof (sha1_iv));
+  } else {
+    memcpy (ctx->h, sha256_iv, sizeof (sha256_iv));
+  }
+}
+
+// SHA-1 compression function: process one 64-byte block.
+// Rounds are split into four loops of 20, so no round has to test which function to use.
+void
+sha1_block (uint32_t *h, const uint8_t *p)
+{
+  int i;
+  uint32_t w[80], a, b, c, d, e, t;
+
+  for (i=0; i<16; i++) {
+    w[i] = ((uint32_t) p[4*i] << 24) | ((uint32_t) p[4*i+1] << 16) | ((uint32_t) p[4*i+2] << 8) | p[4*i+3];
+  }
+  for (i=16; i<80; i++) {
+    w[i] = ROL (w[i-3] ^ w[i-8] ^ w[i-14] ^ w[i-16], 1);
+  }
+
+  a = h[0]; b = h[1]; c = h[2]; d = h[3]; e = h[4];
+  for (i=0; i<20; i++) {
+    t = ROL (a, 5) + (d ^ (b & (c ^ d))) + e + 0x5a827999 + w[i];
+    e = d; d = c; c = ROL (b, 30); b = a; a = t;
+  }
+  for (; i<40; i++) {
+    t = ROL (a, 5) + (b ^ c ^ d) + e + 0x6ed9eba1 + w[i];
+    e = d; d = c; c = ROL (b, 30); b = a; a = t;
+  }
+  for (; i<60; i++) {
+    t = ROL (a, 5) + ((b & c) | (d & (b | c))) + e + 0x8f1bbcdc + w[i];
+    e = d; d = c; c = ROL (b, 30); b = a; a = t;
+  }
+  for (; i<80; i++) {
+    t = ROL (a, 5) + (b ^ c ^ d) + e + 0xca62c1d6 + w[i];
+    e = d; d = c; c = ROL (b, 30); b = a; a = t;
+  }
+  h[0] += a; h[1] += b; h[2] += c; h[3] += d; h[4] += e;
+}
+
+// SHA-256 compression function: process one 64-byte block.
+void
+sha256_block (uint32_t *h, const uint8_t *p)
+{
+  static const uint32_t k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+  };
+  int i;
+  uint32_t w[64], a, b, c, d, e, f, g, hh, s0, s1, t1, t2;
+
+  for (i=0; i<16; i++) {
+    w[i] = ((uint32_t) p[4*i] << 24) | ((uint32_t) p[4*i+1] << 16) | ((uint32_t) p[4*i+2] << 8) | p[4*i+3];
+  }
+  for (i=16; i<64; i++) {
+    s0 = ROR (w[i-15], 7) ^ ROR (w[i-15], 18) ^ (w[i-15] >> 3);
+    s1 = ROR (w[i-2], 17) ^ ROR (w[i-2], 19) ^ (w[i-2] >> 10);
+    w[i] = w[i-16] + s0 + w[i-7] + s1;
+  }
+
+  a = h[0]; b = h[1]; c = h[2]; d = h[3]; e = h[4]; f = h[5]; g = h[6]; hh = h[7];
+  for (i=0; i<64; i++) {
+    s1 = ROR (e, 6) ^ ROR (e, 11) ^ ROR (e, 25);
+    t1 = hh + s1 + ((e & f) ^ (~e & g)) + k[i] + w[i];
+    s0 = ROR (a, 2) ^ ROR (a, 13) ^ ROR (a, 22);
+    t2 = s0 + ((a & b) ^ (a & c) ^ (b & c));
+    hh = g; g = f; f = e; e = d + t1; d = c; c = b; b = a; a = t1 + t2;
+  }
+  h[0] += a; h[1] += b; h[2] += c; h[3] += d; h[4] += e; h[5] += f; h[6] += g; h[7] += hh;
+}
+
+// Add data to hash.
+void
+hash_update (hash_ctx *ctx, const uint8_t *data, int len)
+{
+  int n;
+
+  ctx->len += len;
+
+  // Top up a partial block first.
+  if (ctx->nbuf > 0) {
+    n = 64 - ctx->nbuf;
+    if (n > len) {
+      n = len;
+    }
+    memcpy (ctx->buf + ctx->nbuf, data, n * sizeof (uint8_t));
+    ctx->nbuf += n;
+    data += n;
+    len -= n;
+    if (ctx->nbuf < 64) {
+      return;
+    }
+    if (ctx->alg == AUTH_HMAC_SHA1_96) {
+      sha1_block (ctx->h, ctx->buf);
+    } else {
+      sha256_block (ctx->h, ctx->buf);
+    }
+    ctx->nbuf = 0;
+  }
+
+  // Whole blocks are processed straight from the caller's buffer.
+  while (len >= 64) {
+    if (ctx->alg == AUTH_HMAC_SHA1_96) {
+      sha1_block (ctx->h, data);
+    } else {
+      sha256_block (ctx->h, data);
+    }
+    data += 64;
+    len -= 64;
+  }
+
+  memcpy (ctx->buf, data, len * sizeof (uint8_t));
+  ctx->nbuf = len;
+}
+
+// Finish hash: append padding and bit length, and write out the digest.
+void
+hash_final (hash_ctx *ctx, uint8_t *digest)
+{
+  int i, n;
+  uint64_t bits;
+  uint8_t pad[72];
+
+  bits = ctx->len * 8;
+  n = (ctx->nbuf < 56) ? (56 - ctx->nbuf) : (120 - ctx->nbuf);
+  memset (pad, 0, sizeof (pad));
+  pad[0] = 0x80;
+  for (i=0; i<8; i++) {
+    pad[n + i] = (bits >> (56 - (8 * i))) & 0xff;
+  }
+  hash_update (ctx, pad, n + 8);
+
+  n = (ctx->alg == AUTH_HMAC_SHA1_96) ? 5 : 8;
+  for (i=0; i<n; i++) {
+    digest[4*i] = ctx->h[i] >> 24;
+    digest[4*i+1] = (ctx->h[i] >> 16) & 0xff;
+    digest[4*i+2] = (ctx->h[i] >> 8) & 0xff;
+    digest[4*i+3] = ctx->h[i] & 0xff;
+  }
+}
+
+// Expand AES-128 or AES-256 key into round keys (Section 5.2 of FIPS 197).
+void
+aes_key_expand (aes_ctx *ctx, const uint8_t *key, int keylen)
+{
+  static const uint8_t rcon[10] = {0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0x1b, 0x36};
+  int i, j, nk;
+  uint8_t t[4], u;
+
+  nk = keylen / 4;
+  ctx->nr = nk + 6;
+  memcpy (ctx->rk, key, keylen * sizeof (uint8_t));
+
+  for (i=nk; i<4*(ctx->nr + 1); i++) {
+    memcpy (t, ctx->rk + (4 * (i - 1)), 4 * sizeof (uint8_t));
+    if ((i % nk) == 0) {
+      u = t[0];  // RotWord, SubWord, and Rcon
+      t[0] = aes_sbox[t[1]] ^ rcon[(i / nk) - 1];
+      t[1] = aes_sbox[t[2]];
+      t[2] = aes_sbox[t[3]];
+      t[3] = aes_sbox[u];
+    } else if ((nk > 6) && ((i % nk) == 4)) {
+      for (j=0; j<4; j++) {
+        t[j] = aes_sbox[t[j]];
+      }
+    }
+    for (j=0; j<4; j++) {
+      ctx->rk[(4 * i) + j] = ctx->rk[(4 * (i - nk)) + j] ^ t[j];
+    }
+  }
+}
+
+// Encrypt one 16-byte block with AES, without special instructions.
+void
+aes_encrypt_block (aes_ctx *ctx, const uint8_t *in, uint8_t *out)
+{
+  int i, r;
+  uint8_t s[16], t[16], a0, a1, a2, a3, x;
+
+  for (i=0; i<16; i++) {
+    s[i] = in[i] ^ ctx->rk[i];
+  }
+
+  for (r=1; r<=ctx->nr; r++) {
+
+    // SubBytes and ShiftRows: state is column-major, so row i%4 moves left by i%4 columns.
+    for (i=0; i<16; i++) {
+      t[i] = aes_sbox[s[(i + (4 * (i % 4))) % 16]];
+    }
+
+    // MixColumns, except in final round.
+    if (r < ctx->nr) {
+      for (i=0; i<16; i+=4) {
+        a0 = t[i];
+        a1 = t[i+1];
+        a2 = t[i+2];
+        a3 = t[i+3];
+        x = a0 ^ a1 ^ a2 ^ a3;
+        s[i] = a0 ^ x ^ XTIME (a0 ^ a1);
+        s[i+1] = a1 ^ x ^ XTIME (a1 ^ a2);
+        s[i+2] = a2 ^ x ^ XTIME (a2 ^ a3);
+        s[i+3] = a3 ^ x ^ XTIME (a3 ^ a0);
+      }
+    } else {
+      memcpy (s, t, 16 * sizeof (uint8_t));
+    }
+
+    // AddRoundKey
+    for (i=0; i<16; i++) {
+      s[i] ^= ctx->rk[(16 * r) + i];
+    }
+  }
+
+  memcpy (out, s, 16 * sizeof (uint8_t));
+}
+
+// Multiply x by h in GF(2^128), bit by bit, leaving the result in x (Algorithm 1 of NIST SP 800-38D).
+void
+ghash_mult (uint8_t *x, const uint8_t *h)
+{
+  int i, j, lsb;
+  uint8_t z[16], v[16];
+
+  memset (z, 0, 16 * sizeof (uint8_t));
+  memcpy (v, h, 16 * sizeof (uint8_t));
+
+  for (i=0; i<128; i++) {
+    if ((x[i / 8] >> (7 - (i % 8))) & 1) {
+      for (j=0; j<16; j++) {
+        z[j] ^= v[j];
+      }
+    }
+    lsb = v[15] & 1;
+    for (j=15; j>0; j--) {
+      v[j] = (v[j] >> 1) | (v[j-1] << 7);
+    }
+    v[0] >>= 1;
+    if (lsb) {
+      v[0] ^= 0xe1;
+    }
+  }
+
+  memcpy (x, z, 16 * sizeof (uint8_t));
+}
+
+// Absorb data into GHASH accumulator x, zero-padding the final partial block.
+void
+ghash_update (uint8_t *x, const uint8_t *h, const uint8_t *data, int len)
+{
+  int i, n;
+
+  while (len > 0) {
+    n = (len < 16) ? len : 16;
+    for (i=0; i<n; i++) {
+      x[i] ^= data[i];
+    }
+    ghash_mult (x, h);
+    data += n;
+    len -= n;
+  }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+// Multiply a by b in GF(2^128) with carry-less multiplication. Operands and result are
+// byte-reflected GCM field elements (Algorithm 5 of Intel's "Carry-Less Multiplication
+// Instruction and its Usage for Computing the GCM Mode").
+__attribute__ ((target ("pclmul,sse2")))
+static inline __m128i
+gfmul_ni (__m128i a, __m128i b)
+{
+  __m128i t2, t3, t4, t5, t6, t7, t8, t9;
+
+  t3 = _mm_clmulepi64_si128 (a, b, 0x00);
+  t4 = _mm_clmulepi64_si128 (a, b, 0x10);
+  t5 = _mm_clmulepi64_si128 (a, b, 0x01);
+  t6 = _mm_clmulepi64_si128 (a, b, 0x11);
+
+  t4 = _mm_xor_si128 (t4, t5);
+  t5 = _mm_slli_si128 (t4, 8);
+  t4 = _mm_srli_si128 (t4, 8);
+  t3 = _mm_xor_si128 (t3, t5);
+  t6 = _mm_xor_si128 (t6, t4);
+
+  // Shift 256-bit product left by one bit, since operands are reflected.
+  t7 = _mm_srli_epi32 (t3, 31);
+  t8 = _mm_srli_epi32 (t6, 31);
+  t3 = _mm_slli_epi32 (t3, 1);
+  t6 = _mm_slli_epi32 (t6, 1);
+  t9 = _mm_srli_si128 (t7, 12);
+  t8 = _mm_slli_si128 (t8, 4);
+  t7 = _mm_slli_si128 (t7, 4);
+  t3 = _mm_or_si128 (t3, t7);
+  t6 = _mm_or_si128 (t6, t8);
+  t6 = _mm_or_si128 (t6, t9);
+
+  // Reduce modulo x^128 + x^7 + x^2 + x + 1.
+  t7 = _mm_slli_epi32 (t3, 31);
+  t8 = _mm_slli_epi32 (t3, 30);
+  t9 = _mm_slli_epi32 (t3, 25);
+  t7 = _mm_xor_si128 (t7, t8);
+  t7 = _mm_xor_si128 (t7, t9);
+  t8 = _mm_srli_si128 (t7, 4);
+  t7 = _mm_slli_si128 (t7, 12);
+  t3 = _mm_xor_si128 (t3, t7);
+
+  t2 = _mm_srli_epi32 (t3, 1);
+  t4 = _mm_srli_epi32 (t3, 2);
+  t5 = _mm_srli_epi32 (t3, 7);
+  t2 = _mm_xor_si128 (t2, t4);
+  t2 = _mm_xor_si128 (t2, t5);
+  t2 = _mm_xor_si128 (t2, t8);
+  t3 = _mm_xor_si128 (t3, t2);
+
+  return (_mm_xor_si128 (t6, t3));
+}
+
+// AES-GCM authenticated decryption, without special instructions (Section 7.2 of NIST SP 800-38D).
+// The tag is checked before anything is decrypted. Returns 0 if the tag is valid.
+int
+gcm_open (sa_entry *sa, const uint8_t *nonce, const uint8_t *aad, int aadlen, const uint8_t *in, uint8_t *out, int len, const uint8_t *tag)
+{
+  int i, j, n;
+  uint32_t ctr;
+  uint8_t cb[16], ks[16], x[16], lens[16];
+
+  // GHASH over AAD, ciphertext, and their bit lengths.
+  memset (x, 0, 16 * sizeof (uint8_t));
+  ghash_update (x, sa->hpow[0], aad, aadlen);
+  ghash_update (x, sa->hpow[0], in, len);
+  memset (lens, 0, 16 * sizeof (uint8_t));
+  for (i=0; i<8; i++) {
+    lens[7 - i] = ((uint64_t) aadlen * 8) >> (8 * i);
+    lens[15 - i] = ((uint64_t) len * 8) >> (8 * i);
+  }
+  ghash_update (x, sa->hpow[0], lens, 16);
+
+  // Expected tag = E(K, J0) XOR GHASH
+  memcpy (cb, nonce, 12 * sizeof (uint8_t));
+  cb[12] = 0;
+  cb[13] = 0;
+  cb[14] = 0;
+  cb[15] = 1;
+  aes_encrypt_block (&sa->aes, cb, ks);
+  for (i=0; i<16; i++) {
+    x[i] ^= ks[i];
+  }
+  if (ct_memcmp (x, tag, 16) != 0) {
+    return (-1);
+  }
+
+  // Decrypt: CTR mode, starting from counter 2.
+  ctr = 2;
+  for (i=0; i<len; i+=16) {
+    cb[12] = ctr >> 24;
+    cb[13] = (ctr >> 16) & 0xff;
+    cb[14] = (ctr >> 8) & 0xff;
+    cb[15] = ctr & 0xff;
+    aes_encrypt_block (&sa->aes, cb, ks);
+    n = ((len - i) < 16) ? (len - i) : 16;
+    for (j=0; j<n; j++) {
+      out[i + j] = in[i + j] ^ ks[j];
+    }
+    ctr++;
+  }
+
+  return (0);
+}
+
+// AES-GCM authenticated decryption with AES-NI and PCLMULQDQ, in one pass: GHASH of each
+// group of four ciphertext blocks is aggregated over H^4..H while they are decrypted.
+// Output may overlap input. If the tag is invalid (-1 returned), output must be discarded.
+__attribute__ ((target ("aes,pclmul,sse4.1")))
+int
+gcm_open_ni (sa_entry *sa, const uint8_t *nonce, const uint8_t *aad, int aadlen, const uint8_t *in, uint8_t *out, int len, const uint8_t *tag)
+{
+  int i, r, n;
+  uint32_t ctr;
+  uint8_t last[16];
+  __m128i rk[15], bswap, h, h2, h3, h4, x, j0, b0, b1, b2, b3, c0, c1, c2, c3;
+
+  bswap = _mm_set_epi8 (0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+  for (r=0; r<=sa->aes.nr; r++) {
+    rk[r] = _mm_loadu_si128 ((const __m128i *) (sa->aes.rk + (16 * r)));
+  }
+  h = _mm_shuffle_epi8 (_mm_loadu_si128 ((const __m128i *) sa->hpow[0]), bswap);
+  h2 = _mm_shuffle_epi8 (_mm_loadu_si128 ((const __m128i *) sa->hpow[1]), bswap);
+  h3 = _mm_shuffle_epi8 (_mm_loadu_si128 ((const __m128i *) sa->hpow[2]), bswap);
+  h4 = _mm_shuffle_epi8 (_mm_loadu_si128 ((const __m128i *) sa->hpow[3]), bswap);
+
+  // J0 = nonce || 0x00000001
+  memcpy (last, nonce, 12 * sizeof (uint8_t));
+  last[12] = 0;
+  last[13] = 0;
+  last[14] = 0;
+  last[15] = 1;
+  j0 = _mm_loadu_si128 ((const __m128i *) last);
+
+  // GHASH over AAD.
+  x = _mm_setzero_si128 ();
+  for (i=0; i<aadlen; i+=16) {
+    n = ((aadlen - i) < 16) ? (aadlen - i) : 16;
+    memset (last, 0, 16 * sizeof (uint8_t));
+    memcpy (last, aad + i, n * sizeof (uint8_t));
+    x = gfmul_ni (_mm_xor_si128 (x, _mm_shuffle_epi8 (_mm_loadu_si128 ((const __m128i *) last), bswap)), h);
+  }
+
+  // Four blocks at a time. Ciphertext is loaded before plaintext is stored, so in-place works.
+  ctr = 2;
+  for (i=0; (i + 64)<=len; i+=64) {
+    c0 = _mm_loadu_si128 ((const __m128i *) (in + i));
+    c1 = _mm_loadu_si128 ((const __m128i *) (in + i + 16));
+    c2 = _mm_loadu_si128 ((const __m128i *) (in + i + 32));
+    c3 = _mm_loadu_si128 ((const __m128i *) (in + i + 48));
+
+    b0 = _mm_xor_si128 (_mm_insert_epi32 (j0, __builtin_bswap32 (ctr), 3), rk[0]);
+    b1 = _mm_xor_si128 (_mm_insert_epi32 (j0, __builtin_bswap32 (ctr + 1), 3), rk[0]);
+    b2 = _mm_xor_si128 (_mm_insert_epi32 (j0, __builtin_bswap32 (ctr + 2), 3), rk[0]);
+    b3 = _mm_xor_si128 (_mm_insert_epi32 (j0, __builtin_bswap32 (ctr + 3), 3), rk[0]);
+    ctr += 4;
+    for (r=1; r<sa->aes.nr; r++) {
+      b0 = _mm_aesenc_si128 (b0, rk[r]);
+      b1 = _mm_aesenc_si128 (b1, rk[r]);
+      b2 = _mm_aesenc_si128 (b2, rk[r]);
+      b3 = _mm_aesenc_si128 (b3, rk[r]);
+    }
+    b0 = _mm_aesenclast_si128 (b0, rk[r]);
+    b1 = _mm_aesenclast_si128 (b1, rk[r]);
+    b2 = _mm_aesenclast_si128 (b2, rk[r]);
+    b3 = _mm_aesenclast_si128 (b3, rk[r]);
+
+    _mm_storeu_si128 ((__m128i *) (out + i), _mm_xor_si128 (b0, c0));
+    _mm_storeu_si128 ((__m128i *) (out + i + 16), _mm_xor_si128 (b1, c1));
+    _mm_storeu_si128 ((__m128i *) (out + i + 32), _mm_xor_si128 (b2, c2));
+    _mm_storeu_si128 ((__m128i *) (out + i + 48), _mm_xor_si128 (b3, c3));
+
+    x = _mm_xor_si128 (_mm_xor_si128 (gfmul_ni (_mm_xor_si128 (x, _mm_shuffle_epi8 (c0, bswap)), h4),
+                                      gfmul_ni (_mm_shuffle_epi8 (c1, bswap), h3)),
+                       _mm_xor_si128 (gfmul_ni (_mm_shuffle_epi8 (c2, bswap), h2),
+                                      gfmul_ni (_mm_shuffle_epi8 (c3, bswap), h)));
+  }
+
+  // Remaining blocks, the last of which may be partial.
+  for (; i<len; i+=16) {
+    n = ((len - i) < 16) ? (len - i) : 16;
+    memset (last, 0, 16 * sizeof (uint8_t));
+    memcpy (last, in + i, n * sizeof (uint8_t));
+    c0 = _mm_loadu_si128 ((const __m128i *) last);
+    x = gfmul_ni (_mm_xor_si128 (x, _mm_shuffle_epi8 (c0, bswap)), h);
+
+    b0 = _mm_xor_si128 (_mm_insert_epi32 (j0, __builtin_bswap32 (ctr), 3), rk[0]);
+    ctr++;
+    for (r=1; r<sa->aes.nr; r++) {
+      b0 = _mm_aesenc_si128 (b0, rk[r]);
+    }
+    b0 = _mm_aesenclast_si128 (b0, rk[r]);
+    _mm_storeu_si128 ((__m128i *) last, _mm_xor_si128 (b0, c0));
+    memcpy (out + i, last, n * sizeof (uint8_t));
+  }
+
+  // Bit lengths of AAD and ciphertext (already byte-reflected).
+  x = gfmul_ni (_mm_xor_si128 (x, _mm_set_epi64x ((uint64_t) aadlen * 8, (uint64_t) len * 8)), h);
+
+  // Expected tag = E(K, J0) XOR GHASH
+  b0 = _mm_xor_si128 (j0, rk[0]);
+  for (r=1; r<sa->aes.nr; r++) {
+    b0 = _mm_aesenc_si128 (b0, rk[r]);
+  }
+  b0 = _mm_aesenclast_si128 (b0, rk[r]);
+  _mm_storeu_si128 ((__m128i *) last, _mm_xor_si128 (b0, _mm_shuffle_epi8 (x, bswap)));
+
+  return ((ct_memcmp (last, tag, 16) != 0) ? -1 : 0);
+}
+
+#endif
+
+// Allocate memory for an array of chars.
+char *
+allocate_strmem (int len)
+{
+  void *tmp;
+
+  if (len <= 0) {
+    fprintf (stderr, "ERROR: Cannot allocate memory because len = %i in allocate_strmem().\n", len);
+    exit (EXIT_FAILURE);
+  }
+
+  tmp = (char *) malloc (len * sizeof (char));
+  if (tmp != NULL) {
+    memset (tmp, 0, len * sizeof (char));
+    return (tmp);
+  } else {
+    fprintf (stderr, "ERROR: Cannot allocate memory for array allocate_strmem().\n");
+    exit (EXIT_FAILURE);
+  }
+}
+
+// Allocate memory for an array of unsigned chars.
+uint8_t *
+allocate_ustrmem (int len)
+{
+  void *tmp;
+
+  if (len <= 0) {
+    fprintf (stderr, "ERROR: Cannot allocate memory because len = %i in allocate_ustrmem().\n", len);
+    exit (EXIT_FAILURE);
+  }
+
+  tmp = (uint8_t *) malloc (len * sizeof (uint8_t));
+  if (tmp != NULL) {
+    memset (tmp, 0, len * sizeof (uint8_t));
+    return (tmp);
+  } else {
+    fprintf (stderr, "ERROR: Cannot allocate memory for array allocate_ustrmem().\n");
+    exit (EXIT_FAILURE);
+  }
+}
@@ -48,8 +48,41 @@ struct _ra_hdr {
 // Define some constants.
 #define IP4_HDRLEN 20         // IPv4 header length
 #define ICMP_HDRLEN 8         // IPv4 ICMP header length excluding data
+#define DISSECT_ETH 0         // dissect() starts at an ethernet header
+#define DISSECT_ICMP6 1       // dissect() starts at an ICMPv6 header, as read from an ICMPv6 raw socket
+#define ND_OPT_TYPES 32       // Neighbor discovery option types whose first offset dissect() records
+#define MAX_EXTHDRS 16        // Most IPv6 extension headers dissect() will follow
+
+// Define a struct for the layout of a received frame, as found by dissect().
+// Offsets are from the start of the frame; -1 means the header is absent, or not
+// wholly within the frame. Nothing in it points into the frame.
+typedef struct _pkt_info pkt_info;
+struct _pkt_info {
+  int len;              // Length of frame
+  int end;              // End of IP packet: frames may carry padding after it
+  int nvlans;           // Number of VLAN tags (802.1Q, and 802.1ad outer tag for QinQ)
+  uint16_t vlan[2];     // VLAN IDs, outer tag first
+  uint16_t ethertype;   // Ethernet type after any VLAN tags
+  int l3;               // Offset of ARP, IPv4 or IPv6 header
+  int l3_len;           // Length of ARP header, IPv4 header with options, or IPv6 header with extension headers
+  int ip_opts;          // Offset of IPv4 options, or of first IPv6 extension header
+  int ip_opts_len;      // Length of IPv4 options, or of all IPv6 extension headers
+  int frag;             // 1 for a fragment other than the first, which has no transport header
+  uint8_t proto;        // Transport protocol (for IPv6, the next header after any extension headers)
+  int l4;               // Offset of TCP, UDP, ICMP or ICMPv6 header
+  int l4_len;           // Length of TCP header with options, or 8 for UDP, ICMP and ICMPv6
+  int payload;          // Offset of data after transport header (for ND, after the fixed part of the message)
+  int inner_l3;         // ICMP or ICMPv6 error: offset of IP header of the packet quoted
+  uint8_t inner_proto;  // ICMP or ICMPv6 error: transport protocol of the packet quoted
+  int inner_l4;         // ICMP or ICMPv6 error: offset of first 8 bytes of its transport header
+  int nd_opts;          // Neighbor discovery: offset of first option (-1 if any option is malformed)
+  int nd_opt[ND_OPT_TYPES];  // Neighbor discovery: offset of first option of each type (if nd_opts >= 0)
+};
 
 // Function prototypes
+int dissect (pkt_info *, uint8_t *, int, int);
+int dissect_ip (uint8_t *, int, int, int *, int *, uint8_t *, int *);
+int dissect_l4 (pkt_info *, uint8_t *, int);
 char *allocate_strmem (int);
 uint8_t *allocate_ustrmem (int);
 
@@ -61,6 +94,7 @@ main (int argc, char **argv)
   struct ip *iphdr;
   ra_hdr *rahdr;
   char *src_ip, *dst_ip;
+  pkt_info pi;
 
   // Allocate memory for various arrays.
   ether_frame = allocate_ustrmem (IP_MAXPACKET);
@@ -77,11 +111,10 @@ main (int argc, char **argv)
   // We expect a router advertisment ethernet frame of the form:
   //     MAC (6 bytes) + MAC (6 bytes) + ethernet type (2 bytes)
   //     + ethernet data (IPv4 header + RA header)
+  // There may be VLAN tags before the ethernet type, and options in the IPv4 header,
+  // so let dissect() find where each header is.
   // Keep at it until we get a router advertisement.
-  iphdr = (struct ip *) (ether_frame + 6 + 6 +2);
-  rahdr = (ra_hdr *) (ether_frame + 6 + 6 + 2 + IP4_HDRLEN);
-  while (((((ether_frame[12]) << 8) + ether_frame[13]) != ETH_P_IP) || (iphdr->ip_p != IPPROTO_ICMP) ||
-         (rahdr->icmp_type != ICMP_ROUTERADVERT)) {
+  for (;;) {
     if ((status = recv (sd, ether_frame, IP_MAXPACKET, 0)) < 0) {
       if (errno == EINTR) {
         memset (ether_frame, 0, IP_MAXPACKET * sizeof (uint8_t));
@@ -91,8 +124,15 @@ main (int argc, char **argv)
         exit (EXIT_FAILURE);
       }
     }
+    dissect (&pi, ether_frame, status, DISSECT_ETH);
+    if ((pi.ethertype == ETH_P_IP) && (pi.proto == IPPROTO_ICMP) && (pi.l4 >= 0) &&
+        (ether_frame[pi.l4] == ICMP_ROUTERADVERT)) {
+      break;
+    }
   }
   close (sd);
+  iphdr = (struct ip *) (ether_frame + pi.l3);
+  rahdr = (ra_hdr *) (ether_frame + pi.l4);
 
   // Print out contents of received ethernet frame.
   printf ("\nEthernet frame header:\n");
@@ -106,10 +146,14 @@ main (int argc, char **argv)
     printf ("%02x:", ether_frame[i+6]);
   }
   printf ("%02x\n", ether_frame[11]);
+  for (i=0; i<pi.nvlans && i<2; i++) {
+    printf ("VLAN ID: %u\n", pi.vlan[i]);
+  }
   // Next is ethernet type code (ETH_P_IP for IPv4 packets).
   // http://www.iana.org/assignments/ethernet-numbers
-  printf ("Ethernet type code (2048 = IPv4): %u\n", ((ether_frame[12]) << 8) + ether_frame[13]);
+  printf ("Ethernet type code (2048 = IPv4): %u\n", pi.ethertype);
   printf ("\nEthernet data (IPv4 header + Router Advertisement header)\n");
+  printf ("IPv4 header length (bytes, including %i bytes of options): %i\n", pi.ip_opts_len, pi.l3_len);
   printf ("IPv4 transport layer protocol (1 = ICMP): %u\n", iphdr->ip_p);
   if (inet_ntop (AF_INET, &(iphdr->ip_src), src_ip, INET_ADDRSTRLEN) == NULL) {
     status = errno;
@@ -128,17 +172,17 @@ main (int argc, char **argv)
   printf ("Number of IPv4 addresses associated with router: %u\n", rahdr->num_addrs);
   printf ("Router address entry size (in units of 32 bit words): %u\n", rahdr->entry_size);
   printf ("Lifetime of validity of router advertisement (seconds): %u\n", ntohs (rahdr->lifetime));
-  offset = 6 + 6 + 2 + IP4_HDRLEN + ICMP_HDRLEN;  // Start of list of addresses and preference levels within ethernet frame
-  for (i=0; i<rahdr->num_addrs; i++) {
+  offset = pi.payload;  // Start of list of addresses and preference levels within ethernet frame
+  for (i=0; (i<rahdr->num_addrs) && (rahdr->entry_size >= 2) && ((offset + 8) <= pi.end); i++) {
     printf ("Router %i IPv4 address: %u:%u:%u:%u\n", 
-     i, ether_frame[offset + (i * rahdr->entry_size * 4) + 0],
-        ether_frame[offset + (i * rahdr->entry_size * 4) + 1],
-        ether_frame[offset + (i * rahdr->entry_size * 4) + 2],
-        ether_frame[offset + (i * rahdr->entry_size * 4) + 3]);
-    printf ("Router %i preference level: %u\n", i,  ((ether_frame[offset + (i * rahdr->entry_size * 4) + 4]) << 24) +
-     ((ether_frame[offset + (i * rahdr->entry_size * 4) + 5]) << 16) +
-     ((ether_frame[offset + (i * rahdr->entry_size * 4) + 6]) << 8) +
-     ether_frame[offset + (i * rahdr->entry_size * 4) + 7]);
+     i, ether_frame[offset + 0],
+        ether_frame[offset + 1],
+        ether_frame[offset + 2],
+        ether_frame[offset + 3]);
+    printf ("Router %i preference level: %u\n", i,  ((ether_frame[offset + 4]) << 24) +
+     ((ether_frame[offset + 5]) << 16) +
+     ((ether_frame[offset + 6]) << 8) +
+     ether_frame[offset + 7]);
     offset += rahdr->entry_size * 4;
   }
 
@@ -149,6 +193,238 @@ main (int argc, char **argv)
   return (EXIT_SUCCESS);
 }
 
+// Find the headers of a frame (start = DISSECT_ETH), or of an ICMPv6 message as read
+// from an ICMPv6 raw socket (start = DISSECT_ICMP6), in one pass, without copying.
+// Each header is checked to lie within the frame before it is read.
+// Returns 0 if all headers found were whole, or -1 if one was cut short or malformed,
+// in which case pi describes the headers in front of it.
+int
+dissect (pkt_info *pi, uint8_t *pkt, int len, int start)
+{
+  int off, type, ip_len;
+
+  pi->len = len;
+  pi->end = len;
+  pi->nvlans = 0;
+  pi->ethertype = 0;
+  pi->l3 = -1;
+  pi->l3_len = 0;
+  pi->ip_opts = -1;
+  pi->ip_opts_len = 0;
+  pi->frag = 0;
+  pi->proto = 0;
+  pi->l4 = -1;
+  pi->l4_len = 0;
+  pi->payload = -1;
+  pi->inner_l3 = -1;
+  pi->inner_proto = 0;
+  pi->inner_l4 = -1;
+  pi->nd_opts = -1;
+
+  if (start == DISSECT_ICMP6) {
+    pi->proto = IPPROTO_ICMPV6;
+    return (dissect_l4 (pi, pkt, 0));
+  }
+
+  // Ethernet header, and any VLAN tags in front of the ethernet type.
+  if (len < 14) {
+    return (-1);
+  }
+  off = 12;
+  type = (pkt[off] << 8) + pkt[off + 1];
+  while ((type == 0x8100) || (type == 0x88a8)) {
+    if ((off + 6) > len) {
+      return (-1);
+    }
+    if (pi->nvlans < 2) {
+      pi->vlan[pi->nvlans] = ((pkt[off + 2] << 8) + pkt[off + 3]) & 0x0fff;
+    }
+    pi->nvlans++;
+    off += 4;
+    type = (pkt[off] << 8) + pkt[off + 1];
+  }
+  off += 2;
+  pi->ethertype = type;
+
+  // ARP: fixed part, then sender and target hardware and protocol addresses.
+  if (type == 0x0806) {
+    if (((off + 8) > len) || ((off + 8 + (2 * (pkt[off + 4] + pkt[off + 5]))) > len)) {
+      return (-1);
+    }
+    pi->l3 = off;
+    pi->l3_len = 8 + (2 * (pkt[off + 4] + pkt[off + 5]));
+    return (0);
+  }
+
+  if ((type != 0x0800) && (type != 0x86dd)) {
+    return (0);
+  }
+  if (dissect_ip (pkt, off, len, &pi->l3_len, &ip_len, &pi->proto, &pi->frag) < 0) {
+    return (-1);
+  }
+  pi->l3 = off;
+  pi->ip_opts_len = pi->l3_len - (((pkt[off] >> 4) == 4) ? 20 : 40);
+  if (pi->ip_opts_len > 0) {
+    pi->ip_opts = off + pi->l3_len - pi->ip_opts_len;
+  }
+  if ((off + ip_len) < len) {
+    pi->end = off + ip_len;
+  }
+  if (pi->frag) {
+    return (0);
+  }
+
+  return (dissect_l4 (pi, pkt, off + pi->l3_len));
+}
+
+// Check the IPv4 or IPv6 header at offset off, and follow any IPv6 extension headers.
+// Gives the length of the header with options or extension headers, the length of the
+// packet according to the header, the transport protocol, and whether this is a fragment
+// other than the first. Returns -1 if the header is not wholly within len bytes.
+int
+dissect_ip (uint8_t *pkt, int off, int len, int *hlen, int *ip_len, uint8_t *proto, int *frag)
+{
+  int i, ext;
+  uint8_t nh;
+
+  *frag = 0;
+  if ((off + 1) > len) {
+    return (-1);
+  }
+
+  // IPv4: header length in 32-bit words, total length, fragment offset, protocol.
+  if ((pkt[off] >> 4) == 4) {
+    if ((off + 20) > len) {
+      return (-1);
+    }
+    *hlen = (pkt[off] & 0x0f) * 4;
+    *ip_len = (pkt[off + 2] << 8) + pkt[off + 3];
+    if ((*hlen < 20) || ((off + *hlen) > len) || (*ip_len < *hlen)) {
+      return (-1);
+    }
+    *proto = pkt[off + 9];
+    *frag = ((((pkt[off + 6] & 0x1f) << 8) + pkt[off + 7]) != 0);
+    return (0);
+  }
+
+  if ((pkt[off] >> 4) != 6) {
+    return (-1);
+  }
+
+  // IPv6: fixed header, then a chain of extension headers, each naming the next.
+  // Payload length 0 means a jumbogram, whose length is in a hop-by-hop option.
+  if ((off + 40) > len) {
+    return (-1);
+  }
+  *ip_len = 40 + (pkt[off + 4] << 8) + pkt[off + 5];
+  if (*ip_len == 40) {
+    *ip_len = len - off;
+  }
+  nh = pkt[off + 6];
+  *hlen = 40;
+  for (i=0; i<MAX_EXTHDRS; i++) {
+    if ((nh != 0) && (nh != 43) && (nh != 44) && (nh != 51) && (nh != 60) && (nh != 135) && (nh != 139) && (nh != 140)) {
+      break;  // Transport header, ESP, or no next header (59).
+    }
+    if ((off + *hlen + 8) > len) {
+      return (-1);
+    }
+    if (nh == 44) {  // Fragment header: fixed length.
+      ext = 8;
+    } else if (nh == 51) {  // Authentication header: length in 32-bit words, less 2.
+      ext = (pkt[off + *hlen + 1] + 2) * 4;
+    } else {  // Others: length in 8-byte units, not counting the first.
+      ext = (pkt[off + *hlen + 1] + 1) * 8;
+    }
+    if ((off + *hlen + ext) > len) {
+      return (-1);
+    }
+    if ((nh == 44) && ((((pkt[off + *hlen + 2] << 8) + pkt[off + *hlen + 3]) >> 3) != 0)) {
+      *frag = 1;
+    }
+    nh = pkt[off + *hlen];
+    *hlen += ext;
+    if (*frag) {
+      break;
+    }
+  }
+  if ((i == MAX_EXTHDRS) || (*ip_len < *hlen)) {
+    return (-1);
+  }
+  *proto = nh;
+
+  return (0);
+}
+
+// Check the transport header at offset off, then for an ICMP or ICMPv6 error, the
+// IP header and first 8 bytes of the packet quoted, and for a neighbor discovery
+// message, its options.
+int
+dissect_l4 (pkt_info *pi, uint8_t *pkt, int off)
+{
+  int i, n, type, hlen, ip_len, frag;
+
+  if (pi->proto == IPPROTO_TCP) {
+    if ((off + 20) > pi->end) {
+      return (-1);
+    }
+    pi->l4_len = (pkt[off + 12] >> 4) * 4;
+    if ((pi->l4_len < 20) || ((off + pi->l4_len) > pi->end)) {
+      pi->l4_len = 0;
+      return (-1);
+    }
+  } else if ((pi->proto == IPPROTO_UDP) || (pi->proto == IPPROTO_ICMP) || (pi->proto == IPPROTO_ICMPV6)) {
+    if ((off + 8) > pi->end) {
+      return (-1);
+    }
+    pi->l4_len = 8;
+  } else {
+    return (0);
+  }
+  pi->l4 = off;
+  pi->payload = off + pi->l4_len;
+
+  // ICMP errors (destination unreachable, source quench, redirect, time exceeded,
+  // parameter problem) and ICMPv6 errors (types 1 to 4) quote the packet which caused them.
+  type = pkt[off];
+  if (((pi->proto == IPPROTO_ICMP) && ((type == 3) || (type == 4) || (type == 5) || (type == 11) || (type == 12))) ||
+      ((pi->proto == IPPROTO_ICMPV6) && (type >= 1) && (type <= 4))) {
+    if (dissect_ip (pkt, off + 8, pi->end, &hlen, &ip_len, &pi->inner_proto, &frag) == 0) {
+      pi->inner_l3 = off + 8;
+      if ((frag == 0) && ((off + 8 + hlen + 8) <= pi->end)) {
+        pi->inner_l4 = off + 8 + hlen;
+      }
+    }
+    return (0);
+  }
+
+  // Neighbor discovery (router solicitation and advertisement, neighbor solicitation and
+  // advertisement, redirect): options follow the fixed part of the message. Each gives its
+  // length in units of 8 bytes, and must not be zero length nor run past the end.
+  if ((pi->proto != IPPROTO_ICMPV6) || (type < 133) || (type > 137)) {
+    return (0);
+  }
+  n = off + ((type == 133) ? 8 : (type == 134) ? 16 : (type == 137) ? 40 : 24);
+  if (n > pi->end) {
+    return (-1);
+  }
+  pi->payload = n;
+  for (i=0; i<ND_OPT_TYPES; i++) {
+    pi->nd_opt[i] = -1;
+  }
+  for (i=n; i<pi->end; i+=pkt[i + 1] * 8) {
+    if (((i + 2) > pi->end) || (pkt[i + 1] == 0) || ((i + (pkt[i + 1] * 8)) > pi->end)) {
+      return (-1);
+    }
+    if ((pkt[i] < ND_OPT_TYPES) && (pi->nd_opt[pkt[i]] < 0)) {
+      pi->nd_opt[pkt[i]] = i;
+    }
+  }
+  pi->nd_opts = n;
+
+  return (0);
+}
+
 // Allocate memory for an array of chars.
 char *
 allocate_strmem (int len)
@@ -0,0 +1,977 @@
+/*  Copyright (C) 2013  P.D. Buchan (pdbuchan@yahoo.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Replay the ethernet frames of a pcap or pcapng capture file via raw socket
+// at the link layer, at their original timing, at a multiple of it, at a
+// constant packet rate, or as fast as possible.
+// The file is memory-mapped and read front to back, so captures of many gigabytes
+// are replayed without being loaded into memory.
+// On the way out, MAC addresses, IPv4 addresses and TCP/UDP ports can be rewritten.
+// Checksums are then fixed up incrementally (RFC 1624) from the old and new values
+// of each changed field, without summing the rest of the packet again.
+// The capture can be looped, with rewritten addresses moved along on each pass.
+
+#define _GNU_SOURCE           // sendmmsg() and struct mmsghdr
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>           // close()
+#include <string.h>           // strcpy, memset(), and memcpy()
+
+#include <sys/types.h>        // needed for socket(), uint8_t, uint16_t, uint32_t
+#include <sys/socket.h>       // needed for socket(), sendmmsg()
+#include <netinet/in.h>       // IPPROTO_TCP, IPPROTO_UDP, INET_ADDRSTRLEN
+#include <arpa/inet.h>        // inet_pton() and inet_ntop()
+#include <sys/ioctl.h>        // macro ioctl is defined
+#include <bits/ioctls.h>      // defines values for argument "request" of ioctl.
+#include <net/if.h>           // struct ifreq
+#include <linux/if_ether.h>   // ETH_P_IP = 0x0800, ETH_P_8021Q = 0x8100
+#include <linux/if_packet.h>  // struct sockaddr_ll (see man 7 packet)
+#include <net/ethernet.h>
+#include <sys/mman.h>         // mmap(), madvise(), munmap()
+#include <sys/stat.h>         // fstat()
+#include <fcntl.h>            // open()
+#include <byteswap.h>         // bswap_16(), bswap_32()
+#include <time.h>             // clock_gettime(), clock_nanosleep()
+#include <signal.h>           // signal(), SIGINT
+
+#include <errno.h>            // errno, perror()
+
+// Define some constants.
+#define ETH_HDRLEN 14         // Ethernet header length
+#define IP4_HDRLEN 20         // IPv4 header length, without options
+#define BATCH 64              // Maximum number of frames handed to sendmmsg() at once
+#define MAX_FRAMELEN 9216     // Largest frame we replay (jumbo frames included)
+#define MAX_IFS 16            // Most interfaces per pcapng section we keep track of
+#define MAX_MAPS 16           // Most address maps and port maps
+#define READAHEAD (8 * 1024 * 1024)  // Capture file is read ahead in windows of this size
+#define EARLY_NS 20000L       // With original timing, frames due within this long (ns) go with the batch before
+
+// Timing modes
+#define TIMING_ORIGINAL 0     // Gaps between frames as captured, divided by a speed factor
+#define TIMING_RATE 1         // Constant packet rate
+#define TIMING_FLAT 2         // As fast as possible
+
+// pcapng block types
+#define PCAPNG_SHB 0x0a0d0d0a // Section Header Block
+#define PCAPNG_IDB 1          // Interface Description Block
+#define PCAPNG_OPB 2          // Packet Block (obsolete, but still found in old files)
+#define PCAPNG_SPB 3          // Simple Packet Block
+#define PCAPNG_EPB 6          // Enhanced Packet Block
+
+// Define a struct for a memory-mapped capture file, pcap or pcapng, and our place in it.
+typedef struct _capture capture;
+struct _capture {
+  uint8_t *base;        // Start of mapped file
+  size_t size;          // Size of file
+  size_t pos;           // Offset of next record (pcap) or block (pcapng)
+  size_t first;         // Offset of first record or block
+  size_t advised;       // Offset up to which the kernel has been asked to read ahead
+  size_t released;      // Offset up to which pages have been given back
+  int pcapng;           // 0 = pcap, 1 = pcapng
+  int swapped;          // 1 if file (or pcapng section) was written in the other byte order
+  int linktype;         // pcap: link type of all frames
+  uint64_t tsres;       // pcap: timestamp units per second
+  int nifs;             // pcapng: interfaces described so far in this section
+  int if_linktype[MAX_IFS];  // pcapng: link type of each interface
+  uint64_t if_tsres[MAX_IFS];  // pcapng: timestamp units per second of each interface
+  uint64_t last_ts;     // Timestamp of last frame (ns); Simple Packet Blocks have none of their own
+  long int skipped;     // Frames which are not ethernet, or from undescribed interfaces
+};
+
+// Define a struct for rewriting rules.
+typedef struct _rewrite rewrite;
+struct _rewrite {
+  int set_src_mac;      // Replace source MAC address: 0 = no, 1 = yes
+  uint8_t src_mac[6];
+  int set_dst_mac;      // Replace destination MAC address: 0 = no, 1 = yes
+  uint8_t dst_mac[6];
+  int nmaps;            // Number of IPv4 address maps
+  uint32_t old_net[MAX_MAPS];  // Source or destination addresses in old_net/mask ...
+  uint32_t mask[MAX_MAPS];
+  uint32_t new_net[MAX_MAPS];  // ... are moved into new_net/mask, keeping their host bits, ...
+  uint32_t rotate[MAX_MAPS];   // ... plus rotate times the number of the loop (host byte order)
+  int nports;           // Number of port maps
+  uint16_t old_port[MAX_MAPS];  // Source or destination port old_port becomes new_port
+  uint16_t new_port[MAX_MAPS];
+};
+
+// Function prototypes
+void capture_open (capture *, char *);
+int capture_next (capture *, uint8_t **, int *, int *, uint64_t *);
+void capture_rewind (capture *);
+void capture_advise (capture *);
+void capture_close (capture *);
+uint16_t cap_u16 (capture *, size_t);
+uint32_t cap_u32 (capture *, size_t);
+uint64_t ts_to_ns (uint64_t, uint64_t);
+void add_ip_map (rewrite *, char *, char *, uint32_t);
+void add_port_map (rewrite *, uint16_t, uint16_t);
+void rewrite_frame (rewrite *, uint8_t *, int, uint32_t);
+uint32_t map_ip (rewrite *, uint32_t, uint32_t);
+uint16_t map_port (rewrite *, uint16_t);
+uint16_t csum_update (uint16_t, uint16_t, uint16_t);
+uint16_t csum_update32 (uint16_t, uint32_t, uint32_t);
+uint16_t fold_sum (uint32_t);
+void pace (struct timespec *, long int);
+void sig_handler (int);
+char *allocate_strmem (int);
+uint8_t *allocate_ustrmem (int);
+
+// Set by SIGINT handler to stop the replay.
+volatile sig_atomic_t stop = 0;
+
+int
+main (int argc, char **argv)
+{
+  int i, k, n, sd, status, timing, loops, rewriting, have, newpass, caplen, len, mtu, done;
+  long int rate, sent, skipped, truncated, pass_frames;
+  uint32_t iteration;
+  uint64_t ts, base_ts, base_ns, deadline, now, bytes;
+  double speed, dt;
+  char *interface, *filename;
+  uint8_t *dst_mac, *frames, *data;
+  struct sockaddr_ll device;
+  struct ifreq ifr;
+  struct mmsghdr msgs[BATCH];
+  struct iovec iovs[BATCH];
+  struct timespec t1, t2, next;
+  capture cap;
+  rewrite rw;
+
+  // Allocate memory for various arrays.
+  dst_mac = allocate_ustrmem (6);
+  interface = allocate_strmem (40);
+  filename = allocate_strmem (256);
+  frames = allocate_ustrmem (BATCH * MAX_FRAMELEN);
+  memset (&rw, 0, sizeof (rw));
+
+  // Interface to send packets through.
+  strcpy (interface, "eth0");
+
+  // Capture file to replay (pcap or pcapng): you need to fill this out
+  strcpy (filename, "capture.pcap");
+
+  // Timing: TIMING_ORIGINAL, TIMING_RATE or TIMING_FLAT (see constants above).
+  timing = TIMING_ORIGINAL;
+
+  // For TIMING_ORIGINAL: speed factor (1.0 = as captured, 2.0 = twice as fast, ...).
+  speed = 1.0;
+
+  // For TIMING_RATE: packets per second.
+  rate = 100000;
+
+  // Number of passes through the capture file (0 = loop until Ctrl-C).
+  loops = 1;
+
+  // Submit request for a socket descriptor to look up interface.
+  if ((sd = socket (PF_PACKET, SOCK_RAW, htons (ETH_P_ALL))) < 0) {
+    perror ("socket() failed to get socket descriptor for using ioctl() ");
+    exit (EXIT_FAILURE);
+  }
+
+  // Use ioctl() to get interface maximum transmission unit (MTU).
+  memset (&ifr, 0, sizeof (ifr));
+  snprintf (ifr.ifr_name, sizeof (ifr.ifr_name), "%s", interface);
+  if (ioctl (sd, SIOCGIFMTU, &ifr) < 0) {
+    perror ("ioctl() failed to get MTU ");
+    return (EXIT_FAILURE);
+  }
+  mtu = ifr.ifr_mtu;
+  printf ("Current MTU of interface %s is: %i\n", interface, mtu);
+
+  // Use ioctl() to look up interface name and get its MAC address.
+  memset (&ifr, 0, sizeof (ifr));
+  snprintf (ifr.ifr_name, sizeof (ifr.ifr_name), "%s", interface);
+  if (ioctl (sd, SIOCGIFHWADDR, &ifr) < 0) {
+    perror ("ioctl() failed to get source MAC address ");
+    return (EXIT_FAILURE);
+  }
+  close (sd);
+
+  // Copy source MAC address.
+  memcpy (rw.src_mac, ifr.ifr_hwaddr.sa_data, 6 * sizeof (uint8_t));
+
+  // Report source MAC address to stdout.
+  printf ("MAC address for interface %s is ", interface);
+  for (i=0; i<5; i++) {
+    printf ("%02x:", rw.src_mac[i]);
+  }
+  printf ("%02x\n", rw.src_mac[5]);
+
+  // Find interface index from interface name and store index in
+  // struct sockaddr_ll device, which will be used as an argument of sendmmsg().
+  memset (&device, 0, sizeof (device));
+  if ((device.sll_ifindex = if_nametoindex (interface)) == 0) {
+    perror ("if_nametoindex() failed to obtain interface index ");
+    exit (EXIT_FAILURE);
+  }
+  printf ("Index for interface %s is %i\n", interface, device.sll_ifindex);
+
+  // Set destination MAC address: you need to fill these out
+  dst_mac[0] = 0xff;
+  dst_mac[1] = 0xff;
+  dst_mac[2] = 0xff;
+  dst_mac[3] = 0xff;
+  dst_mac[4] = 0xff;
+  dst_mac[5] = 0xff;
+
+  // Rewrite MAC addresses of every frame: source to that of our interface, and
+  // destination to the one above (0 = leave as captured, 1 = rewrite).
+  rw.set_src_mac = 1;
+  rw.set_dst_mac = 1;
+  memcpy (rw.dst_mac, dst_mac, 6 * sizeof (uint8_t));
+
+  // IPv4 address maps: source and destination addresses in the first network are moved
+  // into the second, keeping their host bits. On each loop through the capture, host
+  // parts are advanced by the last argument (0 for none), so each pass appears to come
+  // from (or go to) different hosts. Maps are tried in order: you need to fill these out
+  add_ip_map (&rw, "192.168.1.0/24", "10.0.1.0", 0);
+
+  // Port maps: TCP or UDP source and destination ports equal to the first are replaced by
+  // the second: you need to fill these out
+  add_port_map (&rw, 8080, 80);
+
+  rewriting = rw.set_src_mac || rw.set_dst_mac || (rw.nmaps > 0) || (rw.nports > 0);
+
+  // Fill out sockaddr_ll.
+  device.sll_family = AF_PACKET;
+  memcpy (device.sll_addr, rw.src_mac, 6 * sizeof (uint8_t));
+  device.sll_halen = 6;
+
+  // Map capture file.
+  capture_open (&cap, filename);
+  printf ("Replaying %s file %s (%llu bytes)\n", cap.pcapng ? "pcapng" : "pcap", filename, (unsigned long long) cap.size);
+
+  // Submit request for a raw socket descriptor.
+  if ((sd = socket (PF_PACKET, SOCK_RAW, htons (ETH_P_ALL))) < 0) {
+    perror ("socket() failed ");
+    exit (EXIT_FAILURE);
+  }
+
+  // Frames are copied into these slots to be rewritten, or sent straight from
+  // the mapped file if there is nothing to rewrite.
+  memset (msgs, 0, sizeof (msgs));
+  for (i=0; i<BATCH; i++) {
+    iovs[i].iov_base = frames + (i * MAX_FRAMELEN);
+    msgs[i].msg_hdr.msg_iov = &iovs[i];
+    msgs[i].msg_hdr.msg_iovlen = 1;
+    msgs[i].msg_hdr.msg_name = &device;
+    msgs[i].msg_hdr.msg_namelen = sizeof (device);
+  }
+
+  signal (SIGINT, sig_handler);
+
+  sent = 0;
+  skipped = 0;
+  truncated = 0;
+  bytes = 0;
+  iteration = 0;
+  pass_frames = 0;
+  have = 0;
+  newpass = 1;
+  done = 0;
+  data = NULL;
+  caplen = 0;
+  len = 0;
+  ts = 0;
+  base_ts = 0;
+  base_ns = 0;
+  clock_gettime (CLOCK_MONOTONIC, &t1);
+  next = t1;
+  deadline = (uint64_t) t1.tv_sec * 1000000000ull + t1.tv_nsec;
+  while ((stop == 0) && (done == 0)) {
+
+    // Gather a batch of frames which are due.
+    clock_gettime (CLOCK_MONOTONIC, &t2);
+    now = (uint64_t) t2.tv_sec * 1000000000ull + t2.tv_nsec;
+    n = 0;
+    while ((n < BATCH) && (stop == 0)) {
+
+      // Next frame from the file, going back to the start at the end of each pass.
+      if (have == 0) {
+        if (capture_next (&cap, &data, &caplen, &len, &ts) == 0) {
+          iteration++;
+          if (((loops > 0) && (iteration >= (uint32_t) loops)) || (pass_frames == 0)) {
+            done = 1;
+            break;
+          }
+          capture_rewind (&cap);
+          pass_frames = 0;
+          newpass = 1;
+          continue;
+        }
+        have = 1;
+        pass_frames++;
+        if ((caplen < ETH_HDRLEN) || (caplen > MAX_FRAMELEN)) {
+          skipped++;
+          have = 0;
+          continue;
+        }
+        if (caplen < len) {
+          truncated++;
+        }
+      }
+
+      // Original timing: send what we have before a frame that isn't due yet,
+      // or sleep until it is due if it's the first of the batch.
+      // The first frame of each pass is due straight after the last one of the pass before,
+      // and frames stamped earlier than it (out of order) are due at once.
+      if (timing == TIMING_ORIGINAL) {
+        if (newpass) {
+          base_ts = ts;
+          base_ns = deadline;
+          newpass = 0;
+        }
+        deadline = base_ns;
+        if (ts > base_ts) {
+          deadline += (uint64_t) ((double) (ts - base_ts) / speed);
+        }
+        if (deadline > (now + EARLY_NS)) {
+          if (n > 0) {
+            break;
+          }
+          next.tv_sec = deadline / 1000000000ull;
+          next.tv_nsec = deadline % 1000000000ull;
+          while (clock_nanosleep (CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL) == EINTR) {
+            if (stop == 1) {
+              break;
+            }
+          }
+          now = deadline;
+        }
+      }
+
+      if (rewriting) {
+        iovs[n].iov_base = frames + (n * MAX_FRAMELEN);
+        memcpy (iovs[n].iov_base, data, caplen * sizeof (uint8_t));
+        rewrite_frame (&rw, iovs[n].iov_base, caplen, iteration);
+      } else {
+        iovs[n].iov_base = data;
+      }
+      iovs[n].iov_len = caplen;
+      have = 0;
+      n++;
+    }
+
+    // Send batch.
+    if (n > 0) {
+      if (timing == TIMING_RATE) {
+        pace (&next, (long int) (1000000000.0 * n / rate));
+      }
+      i = 0;
+      while (i < n) {
+        if ((status = sendmmsg (sd, msgs + i, n - i, 0)) < 0) {
+          if (errno == EINTR) {
+            continue;
+          }
+          if (errno == ENOBUFS) {  // Transmit queue full: let it drain.
+            usleep (100);
+            continue;
+          }
+          if ((errno == EMSGSIZE) || (errno == EINVAL)) {  // Frame too big for interface, or too short.
+            skipped++;
+            i++;
+            continue;
+          }
+          perror ("sendmmsg() failed ");
+          exit (EXIT_FAILURE);
+        }
+        for (k=0; k<status; k++) {
+          bytes += iovs[i + k].iov_len;
+        }
+        sent += status;
+        i += status;
+      }
+    }
+  }
+  clock_gettime (CLOCK_MONOTONIC, &t2);
+  dt = (double) (t2.tv_sec - t1.tv_sec) + (double) (t2.tv_nsec - t1.tv_nsec) / 1000000000.0;
+
+  // Report statistics.
+  printf ("Sent %li frames (%llu bytes) in %g seconds: %.0f packets/s, %.1f Mbit/s\n", sent,
+          (unsigned long long) bytes, dt, sent / dt, 8.0 * bytes / dt / 1000000.0);
+  printf ("Passes through capture: %u; frames skipped: %li; frames truncated in capture: %li\n",
+          iteration, skipped + cap.skipped, truncated);
+
+  // Close socket descriptor.
+  close (sd);
+
+  // Free allocated memory.
+  capture_close (&cap);
+  free (dst_mac);
+  free (interface);
+  free (filename);
+  free (frames);
+
+  return (EXIT_SUCCESS);
+}
+
+// Memory-map a pcap or pcapng file, and work out which it is from its first four bytes.
+void
+capture_open (capture *c, char *filename)
+{
+  int fd;
+  uint32_t magic;
+  struct stat st;
+  void *map;
+
+  memset (c, 0, sizeof (capture));
+
+  if ((fd = open (filename, O_RDONLY)) < 0) {
+    fprintf (stderr, "Can't open file '%s'.\n", filename);
+    exit (EXIT_FAILURE);
+  }
+  if (fstat (fd, &st) < 0) {
+    perror ("fstat() failed ");
+    exit (EXIT_FAILURE);
+  }
+  if (st.st_size < 24) {
+    fprintf (stderr, "ERROR: File '%s' is too short to be a capture file.\n", filename);
+    exit (EXIT_FAILURE);
+  }
+  if ((map = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+    perror ("mmap() failed ");
+    exit (EXIT_FAILURE);
+  }
+
+  // Mapping stays valid after descriptor is closed.
+  close (fd);
+
+  // Tell kernel we'll read the file front to back.
+  if (madvise (map, st.st_size, MADV_SEQUENTIAL) < 0) {
+    perror ("madvise() failed ");
+  }
+
+  c->base = (uint8_t *) map;
+  c->size = st.st_size;
+
+  memcpy (&magic, c->base, 4);
+  switch (magic) {
+    case 0xa1b2c3d4:  // pcap, microsecond timestamps
+    case 0xa1b23c4d:  // pcap, nanosecond timestamps
+      c->swapped = 0;
+      break;
+    case 0xd4c3b2a1:
+    case 0x4d3cb2a1:
+      c->swapped = 1;
+      magic = bswap_32 (magic);
+      break;
+    case PCAPNG_SHB:  // Same in either byte order; each section header gives its own.
+      c->pcapng = 1;
+      break;
+    default:
+      fprintf (stderr, "ERROR: File '%s' is neither pcap nor pcapng.\n", filename);
+      exit (EXIT_FAILURE);
+  }
+
+  // pcap file header: magic, version, time zone, accuracy, snap length, link type.
+  if (c->pcapng == 0) {
+    c->tsres = (magic == 0xa1b23c4d) ? 1000000000ull : 1000000ull;
+    c->linktype = cap_u32 (c, 20) & 0xffff;
+    if (c->linktype != 1) {
+      fprintf (stderr, "ERROR: File '%s' holds link type %i frames; only ethernet (1) can be replayed.\n", filename, c->linktype);
+      exit (EXIT_FAILURE);
+    }
+    c->first = 24;
+  }
+  c->pos = c->first;
+}
+
+// Find the next ethernet frame in the capture: point *data to it, and give its captured
+// and original lengths and its timestamp (ns). Returns 0 at the end of the file.
+int
+capture_next (capture *c, uint8_t **data, int *caplen, int *len, uint64_t *ts)
+{
+  int i, code, olen;
+  uint32_t type, blen, magic, ifid;
+  size_t opt, end;
+
+  while (1) {
+    capture_advise (c);
+
+    // pcap record: seconds, fraction, captured length, original length, frame.
+    if (c->pcapng == 0) {
+      if ((c->pos + 16) > c->size) {
+        return (0);
+      }
+      *caplen = cap_u32 (c, c->pos + 8);
+      *len = cap_u32 (c, c->pos + 12);
+      if ((*caplen < 0) || ((c->pos + 16 + *caplen) > c->size)) {
+        fprintf (stderr, "Warning: capture file ends in a partial record.\n");
+        return (0);
+      }
+      *ts = (uint64_t) cap_u32 (c, c->pos) * 1000000000ull + ts_to_ns (cap_u32 (c, c->pos + 4), c->tsres);
+      *data = c->base + c->pos + 16;
+      c->pos += 16 + *caplen;
+      c->last_ts = *ts;
+      return (1);
+    }
+
+    // pcapng block: type, total length, body, total length again.
+    if ((c->pos + 12) > c->size) {
+      return (0);
+    }
+    memcpy (&type, c->base + c->pos, 4);
+
+    // A section header block gives the byte order of the blocks which follow it.
+    if (type == PCAPNG_SHB) {
+      memcpy (&magic, c->base + c->pos + 8, 4);
+      if (magic == 0x1a2b3c4d) {
+        c->swapped = 0;
+      } else if (magic == 0x4d3c2b1a) {
+        c->swapped = 1;
+      } else {
+        fprintf (stderr, "Warning: bad byte-order magic in pcapng section header.\n");
+        return (0);
+      }
+      c->nifs = 0;
+    }
+    type = cap_u32 (c, c->pos);
+    blen = cap_u32 (c, c->pos + 4);
+    if ((blen < 12) || ((blen % 4) != 0) || ((c->pos + blen) > c->size)) {
+      fprintf (stderr, "Warning: capture file ends in a partial or damaged block.\n");
+      return (0);
+    }
+
+    *caplen = -1;
+    switch (type) {
+
+      // Interface: link type, snap length, then options, of which we want if_tsresol (9).
+      // Its value is a negative power of 10, or of 2 if the top bit is set. Default is 10^-6.
+      case PCAPNG_IDB:
+        if (c->nifs < MAX_IFS) {
+          c->if_linktype[c->nifs] = cap_u16 (c, c->pos + 8);
+          c->if_tsres[c->nifs] = 1000000ull;
+          opt = c->pos + 16;
+          end = c->pos + blen - 4;
+          while ((opt + 4) <= end) {
+            code = cap_u16 (c, opt);
+            olen = cap_u16 (c, opt + 2);
+            if ((code == 0) || ((opt + 4 + olen) > end)) {
+              break;
+            }
+            if ((code == 9) && (olen >= 1)) {
+              if (c->base[opt + 4] & 0x80) {
+                c->if_tsres[c->nifs] = 1ull << (c->base[opt + 4] & 0x3f);
+              } else {
+                c->if_tsres[c->nifs] = 1;
+                for (i=0; i<(c->base[opt + 4] & 0x7f) && (i<19); i++) {
+                  c->if_tsres[c->nifs] *= 10;
+                }
+              }
+            }
+            opt += 4 + ((olen + 3) & ~3);
+          }
+        }
+        c->nifs++;
+        break;
+
+      // Enhanced (and old) packet block: interface, timestamp, captured length, original length, frame.
+      case PCAPNG_EPB:
+      case PCAPNG_OPB:
+        ifid = (type == PCAPNG_EPB) ? cap_u32 (c, c->pos + 8) : cap_u16 (c, c->pos + 8);
+        *caplen = cap_u32 (c, c->pos + 20);
+        *len = cap_u32 (c, c->pos + 24);
+        *data = c->base + c->pos + 28;
+        if ((*caplen < 0) || ((28 + (uint32_t) *caplen + 4) > blen) || (ifid >= (uint32_t) c->nifs) ||
+            (ifid >= MAX_IFS) || (c->if_linktype[ifid] != 1)) {
+          c->skipped++;
+          *caplen = -1;
+          break;
+        }
+        *ts = ts_to_ns (((uint64_t) cap_u32 (c, c->pos + 12) << 32) | cap_u32 (c, c->pos + 16), c->if_tsres[ifid]);
+        break;
+
+      // Simple packet block: original length and frame only, from the first interface.
+      case PCAPNG_SPB:
+        *len = cap_u32 (c, c->pos + 8);
+        *caplen = ((uint32_t) *len < (blen - 16)) ? *len : (int) (blen - 16);
+        *data = c->base + c->pos + 12;
+        if ((c->nifs < 1) || (c->if_linktype[0] != 1)) {
+          c->skipped++;
+          *caplen = -1;
+          break;
+        }
+        *ts = c->last_ts;
+        break;
+    }
+    c->pos += blen;
+    if (*caplen >= 0) {
+      c->last_ts = *ts;
+      return (1);
+    }
+  }
+}
+
+// Go back to the first record of the capture, for another pass.
+void
+capture_rewind (capture *c)
+{
+  c->pos = c->first;
+  c->advised = 0;
+  c->released = 0;
+  c->nifs = 0;
+}
+
+// Ask the kernel to read the next window ahead of us, before we fault on it,
+// and give back the pages of a window well behind us, so however large the
+// capture, only a few windows of it are mapped in at a time.
+void
+capture_advise (capture *c)
+{
+  size_t start, len;
+
+  if ((c->advised >= c->size) || ((c->pos + (READAHEAD / 2)) < c->advised)) {
+    return;
+  }
+  start = c->advised & ~((size_t) sysconf (_SC_PAGESIZE) - 1);
+  len = READAHEAD;
+  if ((start + len) > c->size) {
+    len = c->size - start;
+  }
+  madvise (c->base + start, len, MADV_WILLNEED);
+  c->advised = start + len;
+
+  // Frames of the batch being gathered are never more than a window behind.
+  if (start >= (c->released + (2 * READAHEAD))) {
+    madvise (c->base + c->released, start - READAHEAD - c->released, MADV_DONTNEED);
+    c->released = start - READAHEAD;
+  }
+}
+
+// Unmap capture file.
+void
+capture_close (capture *c)
+{
+  munmap (c->base, c->size);
+  c->base = NULL;
+}
+
+// Read a 16-bit field of the capture file, in the byte order it was written in.
+uint16_t
+cap_u16 (capture *c, size_t off)
+{
+  uint16_t x;
+
+  memcpy (&x, c->base + off, 2);
+
+  return (c->swapped ? bswap_16 (x) : x);
+}
+
+// Read a 32-bit field of the capture file, in the byte order it was written in.
+uint32_t
+cap_u32 (capture *c, size_t off)
+{
+  uint32_t x;
+
+  memcpy (&x, c->base + off, 4);
+
+  return (c->swapped ? bswap_32 (x) : x);
+}
+
+// Convert a timestamp in units of 1/res seconds to nanoseconds.
+uint64_t
+ts_to_ns (uint64_t ts, uint64_t res)
+{
+  if (res == 1000000000ull) {
+    return (ts);
+  }
+  if ((res < 1000000000ull) && ((1000000000ull % res) == 0)) {
+    return (ts * (1000000000ull / res));
+  }
+
+  return ((uint64_t) ((long double) ts * 1000000000.0L / res));
+}
+
+// Add an IPv4 address map: addresses in network old_cidr ("a.b.c.d/prefix") are moved
+// into network new_net of the same prefix length, and advanced by rotate on each pass.
+void
+add_ip_map (rewrite *rw, char *old_cidr, char *new_net, uint32_t rotate)
+{
+  int prefix;
+  char *slash, net[INET_ADDRSTRLEN];
+  struct in_addr addr;
+
+  if (rw->nmaps >= MAX_MAPS) {
+    fprintf (stderr, "ERROR: Too many address maps; at most %i.\n", MAX_MAPS);
+    exit (EXIT_FAILURE);
+  }
+
+  snprintf (net, sizeof (net), "%s", old_cidr);
+  prefix = 32;
+  if ((slash = strchr (net, '/')) != NULL) {
+    *slash = 0;
+    prefix = atoi (slash + 1);
+  }
+  if ((prefix < 0) || (prefix > 32) || (inet_pton (AF_INET, net, &addr) != 1)) {
+    fprintf (stderr, "ERROR: Bad network %s in address map.\n", old_cidr);
+    exit (EXIT_FAILURE);
+  }
+  rw->mask[rw->nmaps] = (prefix == 0) ? 0 : (0xffffffffu << (32 - prefix));
+  rw->old_net[rw->nmaps] = ntohl (addr.s_addr) & rw->mask[rw->nmaps];
+  if (inet_pton (AF_INET, new_net, &addr) != 1) {
+    fprintf (stderr, "ERROR: Bad network %s in address map.\n", new_net);
+    exit (EXIT_FAILURE);
+  }
+  rw->new_net[rw->nmaps] = ntohl (addr.s_addr) & rw->mask[rw->nmaps];
+  rw->rotate[rw->nmaps] = rotate;
+  rw->nmaps++;
+}
+
+// Add a TCP/UDP port map.
+void
+add_port_map (rewrite *rw, uint16_t old_port, uint16_t new_port)
+{
+  if (rw->nports >= MAX_MAPS) {
+    fprintf (stderr, "ERROR: Too many port maps; at most %i.\n", MAX_MAPS);
+    exit (EXIT_FAILURE);
+  }
+  rw->old_port[rw->nports] = old_port;
+  rw->new_port[rw->nports] = new_port;
+  rw->nports++;
+}
+
+// Rewrite MAC addresses, and for IPv4 (perhaps behind 802.1Q tags), addresses and TCP/UDP
+// ports, fixing up the IPv4 header checksum and TCP/UDP checksum for each changed field.
+// The TCP/UDP checksum covers the addresses through the pseudo-header, so it changes with them,
+// and is only found in the first fragment. Fields past the captured length are left alone.
+void
+rewrite_frame (rewrite *rw, uint8_t *frame, int len, uint32_t iteration)
+{
+  int off, ihl, csum_off, i;
+  uint8_t *ip, *l4;
+  uint16_t type, ip_sum, l4_sum, port, new_port;
+  uint32_t addr[2], new_addr[2];
+
+  if (rw->set_dst_mac) {
+    memcpy (frame, rw->dst_mac, 6 * sizeof (uint8_t));
+  }
+  if (rw->set_src_mac) {
+    memcpy (frame + 6, rw->src_mac, 6 * sizeof (uint8_t));
+  }
+  if ((rw->nmaps == 0) && (rw->nports == 0)) {
+    return;
+  }
+
+  // Skip VLAN tags to find the ethertype.
+  off = 12;
+  type = (frame[off] << 8) + frame[off + 1];
+  while (((type == ETH_P_8021Q) || (type == ETH_P_8021AD)) && ((off + 6) <= len)) {
+    off += 4;
+    type = (frame[off] << 8) + frame[off + 1];
+  }
+  off += 2;
+  if ((type != ETH_P_IP) || ((off + IP4_HDRLEN) > len)) {
+    return;
+  }
+  ip = frame + off;
+  ihl = (ip[0] & 0x0f) * 4;
+  if (((ip[0] >> 4) != 4) || (ihl < IP4_HDRLEN) || ((off + ihl) > len)) {
+    return;
+  }
+
+  // Transport checksum, if this is the first fragment of TCP or UDP and we have it.
+  l4 = ip + ihl;
+  csum_off = -1;
+  if ((((ip[6] & 0x1f) << 8) + ip[7]) == 0) {
+    if (ip[9] == IPPROTO_TCP) {
+      csum_off = 16;
+    } else if (ip[9] == IPPROTO_UDP) {
+      csum_off = 6;
+    }
+    if ((off + ihl + csum_off + 2) > len) {
+      csum_off = -1;
+    }
+  }
+  l4_sum = (csum_off < 0) ? 0 : ((l4[csum_off] << 8) + l4[csum_off + 1]);
+  ip_sum = (ip[10] << 8) + ip[11];
+
+  // Source and destination addresses.
+  for (i=0; i<2; i++) {
+    addr[i] = ((uint32_t) ip[12 + 4*i] << 24) + (ip[13 + 4*i] << 16) + (ip[14 + 4*i] << 8) + ip[15 + 4*i];
+    new_addr[i] = map_ip (rw, addr[i], iteration);
+    if (new_addr[i] != addr[i]) {
+      ip[12 + 4*i] = new_addr[i] >> 24;
+      ip[13 + 4*i] = (new_addr[i] >> 16) & 0xff;
+      ip[14 + 4*i] = (new_addr[i] >> 8) & 0xff;
+      ip[15 + 4*i] = new_addr[i] & 0xff;
+      ip_sum = csum_update32 (ip_sum, addr[i], new_addr[i]);
+      l4_sum = csum_update32 (l4_sum, addr[i], new_addr[i]);
+    }
+  }
+  ip[10] = ip_sum >> 8;
+  ip[11] = ip_sum & 0xff;
+
+  if (csum_off < 0) {
+    return;
+  }
+
+  // Source and destination ports.
+  for (i=0; i<2; i++) {
+    port = (l4[2*i] << 8) + l4[2*i + 1];
+    new_port = map_port (rw, port);
+    if (new_port != port) {
+      l4[2*i] = new_port >> 8;
+      l4[2*i + 1] = new_port & 0xff;
+      l4_sum = csum_update (l4_sum, port, new_port);
+    }
+  }
+
+  // A UDP checksum of zero means none was computed: leave it so. A computed checksum of
+  // zero is sent as 0xffff instead (RFC 768).
+  if ((ip[9] == IPPROTO_UDP) && (l4[csum_off] == 0) && (l4[csum_off + 1] == 0)) {
+    return;
+  }
+  if ((ip[9] == IPPROTO_UDP) && (l4_sum == 0)) {
+    l4_sum = 0xffff;
+  }
+  l4[csum_off] = l4_sum >> 8;
+  l4[csum_off + 1] = l4_sum & 0xff;
+}
+
+// Map an IPv4 address (host byte order) by the first address map it falls in,
+// advancing its host part by rotate for each pass. Unmapped addresses are returned as they are.
+uint32_t
+map_ip (rewrite *rw, uint32_t addr, uint32_t iteration)
+{
+  int i;
+
+  for (i=0; i<rw->nmaps; i++) {
+    if ((addr & rw->mask[i]) == rw->old_net[i]) {
+      return (rw->new_net[i] | ((addr + (iteration * rw->rotate[i])) & ~rw->mask[i]));
+    }
+  }
+
+  return (addr);
+}
+
+// Map a TCP/UDP port by the first port map which matches it.
+uint16_t
+map_port (rewrite *rw, uint16_t port)
+{
+  int i;
+
+  for (i=0; i<rw->nports; i++) {
+    if (port == rw->old_port[i]) {
+      return (rw->new_port[i]);
+    }
+  }
+
+  return (port);
+}
+
+// Update a checksum for a 16-bit word of the data it covers changing from old to new,
+// without summing the data again: HC' = ~(~HC + ~m + m') (RFC 1624, eqn. 3).
+// Unlike eqn. 2, this never gives 0x0000 when 0xffff is meant.
+uint16_t
+csum_update (uint16_t check, uint16_t old, uint16_t new)
+{
+  uint32_t sum;
+
+  sum = (~check & 0xffff) + (~old & 0xffff) + new;
+
+  return (~fold_sum (sum) & 0xffff);
+}
+
+// Update a checksum for a 32-bit field (e.g., an IPv4 address) changing from old to new.
+uint16_t
+csum_update32 (uint16_t check, uint32_t old, uint32_t new)
+{
+  uint32_t sum;
+
+  sum = (~check & 0xffff) + (~old >> 16) + (~old & 0xffff) + (new >> 16) + (new & 0xffff);
+
+  return (~fold_sum (sum) & 0xffff);
+}
+
+// Fold a 32-bit running sum into 16 bits, with end-around carry.
+uint16_t
+fold_sum (uint32_t sum)
+{
+  while (sum >> 16) {
+    sum = (sum & 0xffff) + (sum >> 16);
+  }
+
+  return ((uint16_t) sum);
+}
+
+// Sleep until next scheduled send time, then schedule the one after.
+// Absolute deadlines keep the average rate exact even if one sleep runs long.
+void
+pace (struct timespec *next, long int interval)
+{
+  next->tv_nsec += interval;
+  while (next->tv_nsec >= 1000000000L) {
+    next->tv_nsec -= 1000000000L;
+    next->tv_sec++;
+  }
+  while (clock_nanosleep (CLOCK_MONOTONIC, TIMER_ABSTIME, next, NULL) == EINTR) {
+    if (stop == 1) {
+      break;
+    }
+  }
+}
+
+// SIGINT handler: finish current batch and report statistics.
+void
+sig_handler (int signum)
+{
+  (void) signum;
+
+  stop = 1;
+}
+
+// Allocate memory for an array of chars.
+char *
+allocate_strmem (int len)
+{
+  void *tmp;
+
+  if (len <= 0) {
+    fprintf (stderr, "ERROR: Cannot allocate memory because len = %i in allocate_strmem().\n", len);
+    exit (EXIT_FAILURE);
+  }
+
+  tmp = (char *) malloc (len * sizeof (char));
+  if (tmp != NULL) {
+    memset (tmp, 0, len * sizeof (char));
+    return (tmp);
+  } else {
+    fprintf (stderr, "ERROR: Cannot allocate memory for array allocate_strmem().\n");
+    exit (EXIT_FAILURE);
+  }
+}
+
+// Allocate memory for an array of unsigned chars.
+uint8_t *
+allocate_ustrmem (int len)
+{
+  void *tmp;
+
+  if (len <= 0) {
+    fprintf (stderr, "ERROR: Cannot allocate memory because len = %i in allocate_ustrmem().\n", len);
+    exit (EXIT_FAILURE);
+  }
+
+  tmp = (uint8_t *) malloc (len * sizeof (uint8_t));
+  if (tmp != NULL) {
+    memset (tmp, 0, len * sizeof (uint8_t));
+    return (tmp);
+  } else {
+    fprintf (stderr, "ERROR: Cannot allocate memory for array allocate_ustrmem().\n");
+    exit (EXIT_FAILURE);
+  }
+}
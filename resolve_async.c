@@ -0,0 +1,1182 @@
+/*  Copyright (C) 2013  P.D. Buchan (pdbuchan@yahoo.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Resolve a list of host names to IPv4 and IPv6 addresses with thousands of DNS
+// queries outstanding at once, instead of one blocking getaddrinfo() call at a time.
+// Queries (A, AAAA, or both, for each name) are sent over UDP to the nameservers in
+// /etc/resolv.conf, or to a given address and port, such as a stand-in server for
+// testing. Each answer is written out as soon as it arrives, one line per address
+// (name, record type, address, TTL), for a prober to read from a pipe.
+// Answers are cached for their TTL, and names which do not exist, or have no such
+// record, for the time the server's SOA record allows (RFC 2308). A name looked up
+// again while its query is outstanding waits for the same answer, so names repeated
+// in the list cost no more queries.
+
+#define _GNU_SOURCE           // sendmmsg(), recvmmsg() and struct mmsghdr
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>           // close()
+#include <string.h>           // strcpy, memset(), and memcpy()
+
+#include <stdint.h>           // int64_t
+#include <ctype.h>            // tolower(), isspace()
+#include <sys/types.h>        // needed for socket(), uint8_t, uint16_t, uint32_t
+#include <sys/socket.h>       // needed for socket(), sendmmsg(), recvmmsg()
+#include <netinet/in.h>       // IPPROTO_UDP, INET6_ADDRSTRLEN
+#include <arpa/inet.h>        // inet_pton() and inet_ntop()
+#include <sys/random.h>       // getrandom()
+#include <poll.h>             // poll()
+#include <time.h>             // clock_gettime()
+#include <signal.h>           // signal(), SIGINT
+
+#include <errno.h>            // errno, perror()
+
+// Define some constants.
+#define DNS_HDRLEN 12         // DNS header length
+#define DNS_QUERYLEN 320      // Room for a query: header, name, type, class, and EDNS0 OPT record
+#define DNS_MSGLEN 4096       // Room for an answer
+#define DNS_NAMELEN 256       // Room for a name in text form (253 characters at most)
+#define EDNS_PAYLOAD 1232     // Largest UDP answer we ask for (avoids fragmentation)
+#define MAX_SERVERS 3         // Nameservers used, as with resolv.conf
+#define MAX_INFLIGHT 16384    // Room for outstanding queries
+#define MAX_TRIES 3           // Times a query is sent before giving up
+#define QUERY_MS 1000         // Time to wait for the first answer (ms), doubled on each retry
+#define SCAN_MS 20            // Interval between checks for queries timed out (ms)
+#define MAX_RRS 64            // Room for records of an answer section
+#define MAX_CNAMES 8          // Longest chain of aliases followed
+#define MAX_TTL 86400         // Longest time any answer is cached (s)
+#define FAIL_TTL 30           // Time a failure (SERVFAIL, REFUSED, timeout) is cached (s)
+#define CACHE_BUCKETS 131072  // Buckets of cache hash table (a power of two)
+#define BATCH 64              // Queries sent, or answers received, per system call
+
+// DNS record types and classes.
+#define DNS_A 1
+#define DNS_CNAME 5
+#define DNS_SOA 6
+#define DNS_AAAA 28
+#define DNS_OPT 41
+#define DNS_IN 1
+
+// DNS response codes, then our own codes for other reasons a name was not resolved.
+#define DNS_NOERROR 0
+#define DNS_SERVFAIL 2
+#define DNS_NXDOMAIN 3
+#define DNS_REFUSED 5
+#define DNS_NODATA 16         // Name exists, without records of the type asked for
+#define DNS_TIMEOUT 17        // No answer after MAX_TRIES
+#define DNS_TRUNCATED 18      // Answer too long for UDP, and no records in what came
+
+// States of a cache entry.
+#define ENTRY_PENDING 0       // Query outstanding
+#define ENTRY_POSITIVE 1      // Addresses known
+#define ENTRY_NEGATIVE 2      // Not resolved: see rcode
+
+// Define a struct for an answer in the cache.
+typedef struct _dns_entry dns_entry;
+struct _dns_entry {
+  char *name;           // Lowercase, without trailing dot
+  uint16_t qtype;       // DNS_A or DNS_AAAA
+  int state;            // ENTRY_PENDING, ENTRY_POSITIVE or ENTRY_NEGATIVE
+  int rcode;            // Why a negative entry was not resolved
+  int64_t expires;      // Time entry goes stale (ms, CLOCK_MONOTONIC)
+  int naddr;            // Addresses, 4 or 16 bytes each
+  uint8_t *addr;
+  int waiters;          // Lookups waiting for the answer to an outstanding query
+  dns_entry *next;      // Next entry in hash bucket
+};
+
+// Define a struct for an outstanding query.
+typedef struct _dns_query dns_query;
+struct _dns_query {
+  dns_entry *entry;     // Name and type asked for, or NULL if slot is free
+  uint16_t id;          // DNS message ID, chosen at random
+  int tries;            // Times sent
+  int64_t deadline;     // Time to send again, or give up (ms, CLOCK_MONOTONIC)
+};
+
+// Define a struct for a record of a message.
+typedef struct _dns_rr dns_rr;
+struct _dns_rr {
+  char owner[DNS_NAMELEN];
+  uint16_t type;
+  uint32_t ttl;
+  int rdoff;            // Offset of data in message
+  int rdlen;            // Length of data
+};
+
+// Define a struct for queries waiting to be sent to one address family of servers.
+typedef struct _send_batch send_batch;
+struct _send_batch {
+  int n;
+  struct mmsghdr msg[BATCH];
+  struct iovec iov[BATCH];
+  uint8_t buf[BATCH][DNS_QUERYLEN];
+};
+
+// Define a struct for the resolver.
+typedef struct _resolver resolver;
+struct _resolver {
+  int sd[2];            // UDP sockets for IPv4 and IPv6 servers, or -1 if none
+  int nservers;
+  struct sockaddr_storage server[MAX_SERVERS];
+  socklen_t server_len[MAX_SERVERS];
+  int failures;         // Report names not resolved, as well as addresses
+  dns_entry **table;    // Cache: hash table of entries
+  int nslots;           // Most queries outstanding
+  dns_query *slot;
+  int *free;            // Stack of free slots
+  int nfree;
+  int *by_id;           // Slot of each DNS message ID outstanding, or -1
+  uint16_t ids[256];    // Random IDs, taken from the end
+  int nids;
+  send_batch batch[2];  // Queries to send to IPv4 and IPv6 servers
+  struct mmsghdr rmsg[BATCH];
+  struct iovec riov[BATCH];
+  struct sockaddr_storage rfrom[BATCH];
+  uint8_t (*rbuf)[DNS_MSGLEN];
+  long int lookups, hits, joined, sent, retries, answers, addrs, nxdomain, nodata, failed, unmatched;
+};
+
+// Function prototypes
+resolver *res_open (char *, int, int);
+void res_close (resolver *);
+int read_resolv_conf (resolver *, int);
+int add_server (resolver *, char *, int);
+void res_lookup (resolver *, char *, uint16_t, int64_t);
+void res_send (resolver *, int, int64_t);
+void res_flush (resolver *);
+void res_recv (resolver *, int, int64_t);
+void res_answer (resolver *, uint8_t *, int, struct sockaddr_storage *, int64_t);
+void res_finish (resolver *, int, int, int, uint32_t, int64_t);
+int64_t res_expire (resolver *, int64_t);
+void deliver (resolver *, dns_entry *, int, int64_t);
+dns_entry *cache_find (resolver *, char *, uint16_t);
+dns_entry *cache_add (resolver *, char *, uint16_t);
+uint32_t name_hash (char *, uint16_t);
+uint16_t new_id (resolver *);
+int from_server (resolver *, struct sockaddr_storage *);
+int encode_query (uint8_t *, uint16_t, char *, uint16_t);
+int read_name (uint8_t *, int, int, char *);
+int read_rr (uint8_t *, int, int, dns_rr *);
+int clean_name (char *);
+char *rcode_name (int);
+int64_t now_ms (void);
+void sig_handler (int);
+char *allocate_strmem (int);
+
+// Set by SIGINT handler to stop.
+volatile sig_atomic_t stop = 0;
+
+int
+main (int argc, char **argv)
+{
+  int i, port, inflight, rate, failures, want_a, want_aaaa, ntypes, eof, timeout, nfds;
+  long int names, bad;
+  char *server, *filename, *line;
+  int64_t now, start, next_scan, deadline;
+  double dt;
+  FILE *fi;
+  resolver *res;
+  struct pollfd pfd[2];
+  int fam[2];
+
+  // Allocate memory for various arrays.
+  server = allocate_strmem (INET6_ADDRSTRLEN);
+  filename = allocate_strmem (256);
+  line = allocate_strmem (1024);
+
+  // Nameserver: empty for those in /etc/resolv.conf. To test against a stand-in
+  // server, give its address and port (e.g., "127.0.0.1" and 5353).
+  strcpy (server, "");
+  port = 53;
+
+  // File of host names, one per line, or "-" for standard input: you need to fill this out
+  strcpy (filename, "targets.txt");
+
+  // Address records to ask for: A (IPv4), AAAA (IPv6), or both.
+  want_a = 1;
+  want_aaaa = 1;
+
+  // Most queries outstanding at once, and most queries sent per second (0 for no limit).
+  inflight = 4096;
+  rate = 0;
+
+  // Report names not resolved (NXDOMAIN, NODATA, SERVFAIL, ...), as well as addresses.
+  failures = 1;
+
+  if ((inflight < 2) || (inflight > MAX_INFLIGHT)) {
+    fprintf (stderr, "ERROR: Outstanding queries must be from 2 to %i.\n", MAX_INFLIGHT);
+    exit (EXIT_FAILURE);
+  }
+  ntypes = want_a + want_aaaa;
+  if (ntypes == 0) {
+    fprintf (stderr, "ERROR: Ask for A records, AAAA records, or both.\n");
+    exit (EXIT_FAILURE);
+  }
+
+  if (strcmp (filename, "-") == 0) {
+    fi = stdin;
+  } else if ((fi = fopen (filename, "r")) == NULL) {
+    fprintf (stderr, "ERROR: Cannot open file %s: %s\n", filename, strerror (errno));
+    exit (EXIT_FAILURE);
+  }
+
+  res = res_open (server, port, inflight);
+  res->failures = failures;
+
+  signal (SIGINT, sig_handler);
+
+  nfds = 0;
+  for (i=0; i<2; i++) {
+    if (res->sd[i] >= 0) {
+      pfd[nfds].fd = res->sd[i];
+      pfd[nfds].events = POLLIN;
+      fam[nfds] = i;
+      nfds++;
+    }
+  }
+
+  names = 0;
+  bad = 0;
+  eof = 0;
+  start = now_ms ();
+  next_scan = start + SCAN_MS;
+  while (stop == 0) {
+    now = now_ms ();
+
+    // Look up more names while there is room for their queries, and the rate allows.
+    while ((eof == 0) && (res->nfree >= ntypes)
+           && ((rate == 0) || (res->sent < 1 + (now - start) * rate / 1000))) {
+      if (fgets (line, 1024, fi) == NULL) {
+        eof = 1;
+        break;
+      }
+      if ((i = clean_name (line)) <= 0) {
+        if (i < 0) {
+          fprintf (stderr, "Skipping bad name: %s\n", line);
+          bad++;
+        }
+        continue;
+      }
+      names++;
+      if (want_a != 0) {
+        res_lookup (res, line, DNS_A, now);
+      }
+      if (want_aaaa != 0) {
+        res_lookup (res, line, DNS_AAAA, now);
+      }
+    }
+    res_flush (res);
+    fflush (stdout);
+
+    if ((eof != 0) && (res->nfree == res->nslots)) {
+      break;
+    }
+
+    // Wait for answers, until the next check for timeouts, or sooner if the rate
+    // held back queries.
+    timeout = (int) (next_scan - now);
+    if ((eof == 0) && (rate > 0) && (res->nfree >= ntypes)) {
+      timeout = 1;
+    }
+    if (timeout < 0) {
+      timeout = 0;
+    }
+    if ((poll (pfd, nfds, timeout) < 0) && (errno != EINTR)) {
+      perror ("poll() failed ");
+      exit (EXIT_FAILURE);
+    }
+    now = now_ms ();
+    for (i=0; i<nfds; i++) {
+      if (pfd[i].revents & POLLIN) {
+        res_recv (res, fam[i], now);
+      }
+    }
+
+    // Send again, or give up on, queries not answered in time.
+    if (now >= next_scan) {
+      deadline = res_expire (res, now);
+      next_scan = now + SCAN_MS;
+      if (deadline < next_scan) {
+        next_scan = deadline;
+      }
+      res_flush (res);
+    }
+  }
+  fflush (stdout);
+
+  dt = (double) (now_ms () - start) / 1000.0;
+  fprintf (stderr, "%li names (%li bad) in %.3f s, %.0f names/s\n", names, bad, dt, (dt > 0.0) ? names / dt : 0.0);
+  fprintf (stderr, "%li lookups: %li from cache, %li joined an outstanding query\n", res->lookups, res->hits, res->joined);
+  fprintf (stderr, "%li queries sent (%li retries), %li answered: %li addresses, %li NXDOMAIN, %li NODATA, %li failed; %li stray replies\n",
+           res->sent, res->retries, res->answers, res->addrs, res->nxdomain, res->nodata, res->failed, res->unmatched);
+
+  if (fi != stdin) {
+    fclose (fi);
+  }
+  res_close (res);
+
+  // Free allocated memory.
+  free (server);
+  free (filename);
+  free (line);
+
+  return (EXIT_SUCCESS);
+}
+
+// Open UDP sockets to the nameserver given (or, if server is empty, to those in
+// /etc/resolv.conf), and make room for the cache and nslots outstanding queries.
+resolver *
+res_open (char *server, int port, int nslots)
+{
+  int i, size;
+  resolver *res;
+
+  res = (resolver *) calloc (1, sizeof (resolver));
+  if (res == NULL) {
+    fprintf (stderr, "ERROR: Cannot allocate memory for struct resolver.\n");
+    exit (EXIT_FAILURE);
+  }
+  res->table = (dns_entry **) calloc (CACHE_BUCKETS, sizeof (dns_entry *));
+  res->slot = (dns_query *) calloc (nslots, sizeof (dns_query));
+  res->free = (int *) calloc (nslots, sizeof (int));
+  res->by_id = (int *) calloc (65536, sizeof (int));
+  res->rbuf = calloc (BATCH, DNS_MSGLEN);
+  if ((res->table == NULL) || (res->slot == NULL) || (res->free == NULL) || (res->by_id == NULL) || (res->rbuf == NULL)) {
+    fprintf (stderr, "ERROR: Cannot allocate memory for resolver.\n");
+    exit (EXIT_FAILURE);
+  }
+  res->nslots = nslots;
+  for (i=0; i<nslots; i++) {
+    res->free[i] = nslots - 1 - i;
+  }
+  res->nfree = nslots;
+  for (i=0; i<65536; i++) {
+    res->by_id[i] = -1;
+  }
+
+  // Nameservers.
+  if (server[0] == 0) {
+    read_resolv_conf (res, port);
+  } else if (add_server (res, server, port) < 0) {
+    fprintf (stderr, "ERROR: Nameserver %s is not an IPv4 or IPv6 address.\n", server);
+    exit (EXIT_FAILURE);
+  }
+
+  // One socket for each address family of server. The kernel chooses a random source
+  // port for each, which, with random IDs, makes forged answers hard to get accepted.
+  res->sd[0] = -1;
+  res->sd[1] = -1;
+  for (i=0; i<res->nservers; i++) {
+    if (res->sd[res->server[i].ss_family == AF_INET6] >= 0) {
+      continue;
+    }
+    if ((res->sd[res->server[i].ss_family == AF_INET6] = socket (res->server[i].ss_family, SOCK_DGRAM, IPPROTO_UDP)) < 0) {
+      perror ("socket() failed ");
+      exit (EXIT_FAILURE);
+    }
+
+    // Answers to thousands of queries may arrive together.
+    size = 4 * 1024 * 1024;
+    if (setsockopt (res->sd[res->server[i].ss_family == AF_INET6], SOL_SOCKET, SO_RCVBUF, &size, sizeof (size)) < 0) {
+      perror ("setsockopt() failed to set SO_RCVBUF ");
+      exit (EXIT_FAILURE);
+    }
+  }
+
+  // Receive buffers.
+  for (i=0; i<BATCH; i++) {
+    res->riov[i].iov_base = res->rbuf[i];
+    res->riov[i].iov_len = DNS_MSGLEN;
+  }
+
+  return (res);
+}
+
+// Close the sockets, and free the cache and all else.
+void
+res_close (resolver *res)
+{
+  int i;
+  dns_entry *e, *next;
+
+  for (i=0; i<2; i++) {
+    if (res->sd[i] >= 0) {
+      close (res->sd[i]);
+    }
+  }
+  for (i=0; i<CACHE_BUCKETS; i++) {
+    for (e = res->table[i]; e != NULL; e = next) {
+      next = e->next;
+      free (e->name);
+      free (e->addr);
+      free (e);
+    }
+  }
+  free (res->table);
+  free (res->slot);
+  free (res->free);
+  free (res->by_id);
+  free (res->rbuf);
+  free (res);
+}
+
+// Read the nameservers in /etc/resolv.conf. If there are none, as with the C library,
+// use the local host. Returns the number of nameservers.
+int
+read_resolv_conf (resolver *res, int port)
+{
+  char line[256], addr[256], *p;
+  FILE *fi;
+
+  if ((fi = fopen ("/etc/resolv.conf", "r")) != NULL) {
+    while ((res->nservers < MAX_SERVERS) && (fgets (line, sizeof (line), fi) != NULL)) {
+      if (sscanf (line, "nameserver %255s", addr) != 1) {
+        continue;
+      }
+
+      // Drop any scope of an IPv6 link-local address (fe80::1%eth0).
+      if ((p = strchr (addr, '%')) != NULL) {
+        *p = 0;
+      }
+      add_server (res, addr, port);
+    }
+    fclose (fi);
+  }
+  if (res->nservers == 0) {
+    add_server (res, "127.0.0.1", port);
+  }
+
+  return (res->nservers);
+}
+
+// Add a nameserver by IPv4 or IPv6 address. Returns 0, or -1 if addr is neither.
+int
+add_server (resolver *res, char *addr, int port)
+{
+  struct sockaddr_in *sin;
+  struct sockaddr_in6 *sin6;
+
+  memset (&res->server[res->nservers], 0, sizeof (struct sockaddr_storage));
+  sin = (struct sockaddr_in *) &res->server[res->nservers];
+  sin6 = (struct sockaddr_in6 *) &res->server[res->nservers];
+  if (inet_pton (AF_INET, addr, &sin->sin_addr) == 1) {
+    sin->sin_family = AF_INET;
+    sin->sin_port = htons (port);
+    res->server_len[res->nservers] = sizeof (struct sockaddr_in);
+  } else if (inet_pton (AF_INET6, addr, &sin6->sin6_addr) == 1) {
+    sin6->sin6_family = AF_INET6;
+    sin6->sin6_port = htons (port);
+    res->server_len[res->nservers] = sizeof (struct sockaddr_in6);
+  } else {
+    return (-1);
+  }
+  res->nservers++;
+
+  return (0);
+}
+
+// Look up a name: from the cache if its answer there is fresh, by waiting for a query
+// already outstanding for it, or else by sending a query. The caller makes sure a slot
+// is free. Answers are handed to deliver(), now or when they arrive.
+void
+res_lookup (resolver *res, char *name, uint16_t qtype, int64_t now)
+{
+  int slot;
+  dns_entry *e;
+  dns_query *q;
+
+  res->lookups++;
+  e = cache_find (res, name, qtype);
+  if ((e != NULL) && (e->state == ENTRY_PENDING)) {
+    e->waiters++;
+    res->joined++;
+    return;
+  }
+  if ((e != NULL) && (e->expires > now)) {
+    res->hits++;
+    deliver (res, e, 1, now);
+    return;
+  }
+  if (e == NULL) {
+    e = cache_add (res, name, qtype);
+  }
+  e->state = ENTRY_PENDING;
+  e->waiters = 1;
+
+  slot = res->free[--res->nfree];
+  q = &res->slot[slot];
+  q->entry = e;
+  q->tries = 0;
+  q->id = new_id (res);
+  res->by_id[q->id] = slot;
+
+  res_send (res, slot, now);
+}
+
+// Queue a query to be sent, to the next server in turn for each try, and set the time
+// to wait for its answer, which doubles with each try.
+void
+res_send (resolver *res, int slot, int64_t now)
+{
+  int s, f;
+  dns_query *q;
+  send_batch *b;
+
+  q = &res->slot[slot];
+  s = q->tries % res->nservers;
+  f = (res->server[s].ss_family == AF_INET6);
+  b = &res->batch[f];
+  if (b->n == BATCH) {
+    res_flush (res);
+  }
+
+  b->iov[b->n].iov_base = b->buf[b->n];
+  b->iov[b->n].iov_len = encode_query (b->buf[b->n], q->id, q->entry->name, q->entry->qtype);
+  memset (&b->msg[b->n], 0, sizeof (struct mmsghdr));
+  b->msg[b->n].msg_hdr.msg_name = &res->server[s];
+  b->msg[b->n].msg_hdr.msg_namelen = res->server_len[s];
+  b->msg[b->n].msg_hdr.msg_iov = &b->iov[b->n];
+  b->msg[b->n].msg_hdr.msg_iovlen = 1;
+  b->n++;
+
+  q->deadline = now + ((int64_t) QUERY_MS << q->tries);
+  q->tries++;
+  res->sent++;
+  if (q->tries > 1) {
+    res->retries++;
+  }
+}
+
+// Send the queries queued, with as few system calls as possible.
+void
+res_flush (resolver *res)
+{
+  int i, n, off;
+  send_batch *b;
+
+  for (i=0; i<2; i++) {
+    b = &res->batch[i];
+    off = 0;
+    while (off < b->n) {
+      if ((n = sendmmsg (res->sd[i], b->msg + off, b->n - off, 0)) < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        perror ("sendmmsg() failed ");
+        exit (EXIT_FAILURE);
+      }
+      off += n;
+    }
+    b->n = 0;
+  }
+}
+
+// Receive all answers waiting on the socket for servers of one address family.
+void
+res_recv (resolver *res, int fam, int64_t now)
+{
+  int i, n;
+
+  for (;;) {
+    for (i=0; i<BATCH; i++) {
+      memset (&res->rmsg[i], 0, sizeof (struct mmsghdr));
+      res->rmsg[i].msg_hdr.msg_name = &res->rfrom[i];
+      res->rmsg[i].msg_hdr.msg_namelen = sizeof (struct sockaddr_storage);
+      res->rmsg[i].msg_hdr.msg_iov = &res->riov[i];
+      res->rmsg[i].msg_hdr.msg_iovlen = 1;
+    }
+    if ((n = recvmmsg (res->sd[fam], res->rmsg, BATCH, MSG_DONTWAIT, NULL)) < 0) {
+      if ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR)) {
+        return;
+      }
+
+      // An earlier query drew an ICMP error (port unreachable, ...): it will time out.
+      if ((errno == ECONNREFUSED) || (errno == EHOSTUNREACH) || (errno == ENETUNREACH)) {
+        continue;
+      }
+      perror ("recvmmsg() failed ");
+      exit (EXIT_FAILURE);
+    }
+    for (i=0; i<n; i++) {
+      res_answer (res, res->rbuf[i], res->rmsg[i].msg_len, &res->rfrom[i], now);
+    }
+    if (n < BATCH) {
+      return;
+    }
+  }
+}
+
+// Match an answer to its query, and read its addresses, aliases, and for a negative
+// answer, the time it may be cached. Anything which is not a well-formed answer, from
+// one of our servers, to the question of an outstanding query, is ignored.
+void
+res_answer (resolver *res, uint8_t *msg, int len, struct sockaddr_storage *from, int64_t now)
+{
+  int i, n, off, hops, slot, flags, rcode, qdcount, ancount, nscount, alen;
+  uint32_t ttl, negttl, minimum;
+  char name[DNS_NAMELEN], cur[DNS_NAMELEN];
+  dns_rr rr[MAX_RRS], ns;
+  dns_query *q;
+  dns_entry *e;
+
+  if ((len < DNS_HDRLEN) || (from_server (res, from) < 0)) {
+    res->unmatched++;
+    return;
+  }
+  slot = res->by_id[(msg[0] << 8) + msg[1]];
+  flags = (msg[2] << 8) + msg[3];
+  qdcount = (msg[4] << 8) + msg[5];
+  ancount = (msg[6] << 8) + msg[7];
+  nscount = (msg[8] << 8) + msg[9];
+  if ((slot < 0) || ((flags & 0x8000) == 0) || (qdcount != 1)) {
+    res->unmatched++;
+    return;
+  }
+  q = &res->slot[slot];
+  e = q->entry;
+
+  // Question must be the one we asked.
+  if (((off = read_name (msg, len, DNS_HDRLEN, name)) < 0) || (off + 4 > len)
+      || (strcmp (name, e->name) != 0) || (((msg[off] << 8) + msg[off + 1]) != e->qtype)
+      || (((msg[off + 2] << 8) + msg[off + 3]) != DNS_IN)) {
+    res->unmatched++;
+    return;
+  }
+  off += 4;
+  res->answers++;
+
+  // Server could not answer: ask the next one, if tries remain.
+  rcode = flags & 0x000f;
+  if ((rcode != DNS_NOERROR) && (rcode != DNS_NXDOMAIN)) {
+    if (q->tries < MAX_TRIES) {
+      res_send (res, slot, now);
+      return;
+    }
+    res_finish (res, slot, ENTRY_NEGATIVE, rcode, FAIL_TTL, now);
+    return;
+  }
+
+  // Answer section.
+  n = 0;
+  for (i=0; i<ancount; i++) {
+    if ((off = read_rr (msg, len, off, (n < MAX_RRS) ? &rr[n] : &ns)) < 0) {
+      break;
+    }
+    if (n < MAX_RRS) {
+      n++;
+    }
+  }
+
+  // Follow aliases from the name asked for to its canonical name. The answer may be
+  // cached no longer than any record on the way.
+  strcpy (cur, e->name);
+  ttl = MAX_TTL;
+  for (hops=0; hops<MAX_CNAMES; hops++) {
+    for (i=0; i<n; i++) {
+      if ((rr[i].type == DNS_CNAME) && (strcmp (rr[i].owner, cur) == 0)) {
+        break;
+      }
+    }
+    if ((i == n) || (read_name (msg, len, rr[i].rdoff, cur) < 0)) {
+      break;
+    }
+    if (rr[i].ttl < ttl) {
+      ttl = rr[i].ttl;
+    }
+  }
+
+  // Addresses of the canonical name.
+  alen = (e->qtype == DNS_A) ? 4 : 16;
+  free (e->addr);
+  e->addr = NULL;
+  e->naddr = 0;
+  for (i=0; i<n; i++) {
+    if ((rr[i].type != e->qtype) || (rr[i].rdlen != alen) || (strcmp (rr[i].owner, cur) != 0)) {
+      continue;
+    }
+    if ((e->addr = (uint8_t *) realloc (e->addr, (e->naddr + 1) * alen)) == NULL) {
+      fprintf (stderr, "ERROR: Cannot allocate memory for addresses.\n");
+      exit (EXIT_FAILURE);
+    }
+    memcpy (e->addr + e->naddr * alen, msg + rr[i].rdoff, alen);
+    e->naddr++;
+    if (rr[i].ttl < ttl) {
+      ttl = rr[i].ttl;
+    }
+  }
+  if (e->naddr > 0) {
+    res_finish (res, slot, ENTRY_POSITIVE, DNS_NOERROR, ttl, now);
+    return;
+  }
+
+  // An answer cut short (TC bit) which holds no addresses tells us nothing.
+  if ((flags & 0x0200) && (rcode == DNS_NOERROR) && (n == 0)) {
+    res_finish (res, slot, ENTRY_NEGATIVE, DNS_TRUNCATED, FAIL_TTL, now);
+    return;
+  }
+
+  // Negative answer: cached for the lesser of the TTL of the SOA record in the
+  // authority section, and its MINIMUM field (RFC 2308), or not at all without one.
+  negttl = 0;
+  for (i=0; (i<nscount) && (off >= 0); i++) {
+    if ((off = read_rr (msg, len, off, &ns)) < 0) {
+      break;
+    }
+    if (ns.type != DNS_SOA) {
+      continue;
+    }
+
+    // MINIMUM is the last of the five 32-bit fields after the two names of SOA data.
+    if (ns.rdlen < 22) {
+      break;
+    }
+    minimum = ((uint32_t) msg[ns.rdoff + ns.rdlen - 4] << 24) + (msg[ns.rdoff + ns.rdlen - 3] << 16)
+            + (msg[ns.rdoff + ns.rdlen - 2] << 8) + msg[ns.rdoff + ns.rdlen - 1];
+    negttl = (ns.ttl < minimum) ? ns.ttl : minimum;
+    break;
+  }
+  if (negttl > ttl) {
+    negttl = ttl;
+  }
+  res_finish (res, slot, ENTRY_NEGATIVE, (rcode == DNS_NXDOMAIN) ? DNS_NXDOMAIN : DNS_NODATA, negttl, now);
+}
+
+// Finish a query: cache its answer for ttl seconds, hand it to all lookups waiting
+// for it, and free its slot.
+void
+res_finish (resolver *res, int slot, int state, int rcode, uint32_t ttl, int64_t now)
+{
+  dns_query *q;
+  dns_entry *e;
+
+  q = &res->slot[slot];
+  e = q->entry;
+  if (ttl > MAX_TTL) {
+    ttl = MAX_TTL;
+  }
+  e->state = state;
+  e->rcode = rcode;
+  e->expires = now + (int64_t) ttl * 1000;
+  if (state == ENTRY_POSITIVE) {
+    res->addrs += e->naddr;
+  } else if (rcode == DNS_NXDOMAIN) {
+    res->nxdomain++;
+  } else if (rcode == DNS_NODATA) {
+    res->nodata++;
+  } else {
+    res->failed++;
+  }
+
+  deliver (res, e, e->waiters, now);
+  e->waiters = 0;
+
+  res->by_id[q->id] = -1;
+  q->entry = NULL;
+  res->free[res->nfree++] = slot;
+}
+
+// Send again each query whose time is up, or give up on it after MAX_TRIES.
+// Returns the earliest time still awaited.
+int64_t
+res_expire (resolver *res, int64_t now)
+{
+  int i;
+  int64_t earliest;
+  dns_query *q;
+
+  earliest = now + QUERY_MS;
+  for (i=0; i<res->nslots; i++) {
+    q = &res->slot[i];
+    if (q->entry == NULL) {
+      continue;
+    }
+    if (q->deadline <= now) {
+      if (q->tries < MAX_TRIES) {
+        res_send (res, i, now);
+      } else {
+        res_finish (res, i, ENTRY_NEGATIVE, DNS_TIMEOUT, FAIL_TTL, now);
+        continue;
+      }
+    }
+    if (q->deadline < earliest) {
+      earliest = q->deadline;
+    }
+  }
+
+  return (earliest);
+}
+
+// Hand an answer to the lookups waiting for it: here, written to stdout, one line per
+// address, with the time left for which it may be used, for a prober reading a pipe.
+void
+deliver (resolver *res, dns_entry *e, int count, int64_t now)
+{
+  int i, j, left;
+  char ip[INET6_ADDRSTRLEN];
+  char *type;
+
+  type = (e->qtype == DNS_A) ? "A" : "AAAA";
+  left = (e->expires > now) ? (int) ((e->expires - now) / 1000) : 0;
+  for (i=0; i<count; i++) {
+    if (e->state == ENTRY_POSITIVE) {
+      for (j=0; j<e->naddr; j++) {
+        if (e->qtype == DNS_A) {
+          inet_ntop (AF_INET, e->addr + j * 4, ip, INET6_ADDRSTRLEN);
+        } else {
+          inet_ntop (AF_INET6, e->addr + j * 16, ip, INET6_ADDRSTRLEN);
+        }
+        printf ("%s\t%s\t%s\t%i\n", e->name, type, ip, left);
+      }
+    } else if (res->failures != 0) {
+      printf ("%s\t%s\t-\t%s\n", e->name, type, rcode_name (e->rcode));
+    }
+  }
+}
+
+// Find a name and record type in the cache. Returns NULL if not there.
+dns_entry *
+cache_find (resolver *res, char *name, uint16_t qtype)
+{
+  dns_entry *e;
+
+  for (e = res->table[name_hash (name, qtype) & (CACHE_BUCKETS - 1)]; e != NULL; e = e->next) {
+    if ((e->qtype == qtype) && (strcmp (e->name, name) == 0)) {
+      return (e);
+    }
+  }
+
+  return (NULL);
+}
+
+// Add a name and record type to the cache.
+dns_entry *
+cache_add (resolver *res, char *name, uint16_t qtype)
+{
+  uint32_t b;
+  dns_entry *e;
+
+  if (((e = (dns_entry *) calloc (1, sizeof (dns_entry))) == NULL) || ((e->name = strdup (name)) == NULL)) {
+    fprintf (stderr, "ERROR: Cannot allocate memory for cache entry.\n");
+    exit (EXIT_FAILURE);
+  }
+  e->qtype = qtype;
+  b = name_hash (name, qtype) & (CACHE_BUCKETS - 1);
+  e->next = res->table[b];
+  res->table[b] = e;
+
+  return (e);
+}
+
+// Hash of a name and record type (FNV-1a).
+uint32_t
+name_hash (char *name, uint16_t qtype)
+{
+  uint32_t h;
+
+  h = 2166136261U ^ qtype;
+  while (*name != 0) {
+    h = (h ^ (uint8_t) *name++) * 16777619U;
+  }
+
+  return (h);
+}
+
+// Choose a random DNS message ID not in use.
+uint16_t
+new_id (resolver *res)
+{
+  uint16_t id;
+
+  do {
+    if (res->nids == 0) {
+      if (getrandom (res->ids, sizeof (res->ids), 0) != sizeof (res->ids)) {
+        perror ("getrandom() failed ");
+        exit (EXIT_FAILURE);
+      }
+      res->nids = sizeof (res->ids) / sizeof (uint16_t);
+    }
+    id = res->ids[--res->nids];
+  } while (res->by_id[id] >= 0);
+
+  return (id);
+}
+
+// Find which of our servers a message came from. Returns its index, or -1 if none.
+int
+from_server (resolver *res, struct sockaddr_storage *from)
+{
+  int i;
+  struct sockaddr_in *a, *b;
+  struct sockaddr_in6 *a6, *b6;
+
+  for (i=0; i<res->nservers; i++) {
+    if (res->server[i].ss_family != from->ss_family) {
+      continue;
+    }
+    if (from->ss_family == AF_INET) {
+      a = (struct sockaddr_in *) from;
+      b = (struct sockaddr_in *) &res->server[i];
+      if ((a->sin_addr.s_addr == b->sin_addr.s_addr) && (a->sin_port == b->sin_port)) {
+        return (i);
+      }
+    } else {
+      a6 = (struct sockaddr_in6 *) from;
+      b6 = (struct sockaddr_in6 *) &res->server[i];
+      if ((memcmp (&a6->sin6_addr, &b6->sin6_addr, sizeof (struct in6_addr)) == 0) && (a6->sin6_port == b6->sin6_port)) {
+        return (i);
+      }
+    }
+  }
+
+  return (-1);
+}
+
+// Build a query for a name and record type, with recursion desired, and an EDNS0
+// OPT record offering to take answers of up to EDNS_PAYLOAD bytes over UDP.
+// The name has been checked by clean_name(). Returns the length of the query.
+int
+encode_query (uint8_t *buf, uint16_t id, char *name, uint16_t qtype)
+{
+  int off, len;
+  char *p, *dot;
+
+  // Header: ID, flags (RD), one question, no answers or authority, one additional record.
+  memset (buf, 0, DNS_HDRLEN);
+  buf[0] = id >> 8;
+  buf[1] = id & 0xff;
+  buf[2] = 0x01;
+  buf[5] = 1;
+  buf[11] = 1;
+  off = DNS_HDRLEN;
+
+  // Name, as labels each preceded by its length, ending with the root (length 0).
+  p = name;
+  while (*p != 0) {
+    dot = strchr (p, '.');
+    len = (dot != NULL) ? (int) (dot - p) : (int) strlen (p);
+    buf[off++] = len;
+    memcpy (buf + off, p, len);
+    off += len;
+    p += len;
+    if (*p == '.') {
+      p++;
+    }
+  }
+  buf[off++] = 0;
+
+  // Type and class.
+  buf[off++] = qtype >> 8;
+  buf[off++] = qtype & 0xff;
+  buf[off++] = 0;
+  buf[off++] = DNS_IN;
+
+  // OPT record: root name, type, UDP payload size (in place of class), TTL and data length 0.
+  buf[off++] = 0;
+  buf[off++] = 0;
+  buf[off++] = DNS_OPT;
+  buf[off++] = EDNS_PAYLOAD >> 8;
+  buf[off++] = EDNS_PAYLOAD & 0xff;
+  memset (buf + off, 0, 6);
+  off += 6;
+
+  return (off);
+}
+
+// Read the name at offset off of a message into text form, lowercase and without a
+// trailing dot, following compression pointers. Returns the offset just after the
+// name where it starts (not where pointers lead), or -1 if it is malformed.
+int
+read_name (uint8_t *msg, int len, int off, char *out)
+{
+  int i, n, end, jumps;
+
+  end = -1;
+  jumps = 0;
+  n = 0;
+  for (;;) {
+    if (off >= len) {
+      return (-1);
+    }
+
+    // Pointer (two top bits set): rest of name is elsewhere, earlier in message.
+    if ((msg[off] & 0xc0) == 0xc0) {
+      if ((off + 1 >= len) || (++jumps > 64)) {
+        return (-1);
+      }
+      if (end < 0) {
+        end = off + 2;
+      }
+      off = ((msg[off] & 0x3f) << 8) + msg[off + 1];
+      continue;
+    }
+    if (msg[off] & 0xc0) {
+      return (-1);
+    }
+
+    // End of name.
+    if (msg[off] == 0) {
+      if (end < 0) {
+        end = off + 1;
+      }
+      break;
+    }
+
+    // Label.
+    if ((off + 1 + msg[off] > len) || (n + msg[off] + 1 >= DNS_NAMELEN)) {
+      return (-1);
+    }
+    if (n > 0) {
+      out[n++] = '.';
+    }
+    for (i=0; i<msg[off]; i++) {
+      out[n++] = tolower (msg[off + 1 + i]);
+    }
+    off += 1 + msg[off];
+  }
+  out[n] = 0;
+
+  return (end);
+}
+
+// Read a resource record at offset off of a message. Returns the offset of the next,
+// or -1 if it is malformed.
+int
+read_rr (uint8_t *msg, int len, int off, dns_rr *rr)
+{
+  if (((off = read_name (msg, len, off, rr->owner)) < 0) || (off + 10 > len)) {
+    return (-1);
+  }
+  rr->type = (msg[off] << 8) + msg[off + 1];
+  rr->ttl = ((uint32_t) msg[off + 4] << 24) + (msg[off + 5] << 16) + (msg[off + 6] << 8) + msg[off + 7];
+  rr->rdlen = (msg[off + 8] << 8) + msg[off + 9];
+  rr->rdoff = off + 10;
+
+  // TTLs with the top bit set are taken as 0 (RFC 2181).
+  if (rr->ttl & 0x80000000U) {
+    rr->ttl = 0;
+  }
+  if (rr->rdoff + rr->rdlen > len) {
+    return (-1);
+  }
+
+  return (rr->rdoff + rr->rdlen);
+}
+
+// Make a line of input into a name to look up: strip white space and any trailing
+// dot, and lowercase it. Returns its length, 0 if the line is empty or a comment,
+// or -1 if it is not a valid name.
+int
+clean_name (char *line)
+{
+  int i, n, label;
+  char *p;
+
+  n = strlen (line);
+  while ((n > 0) && isspace ((unsigned char) line[n - 1])) {
+    line[--n] = 0;
+  }
+  p = line;
+  while (isspace ((unsigned char) *p)) {
+    p++;
+  }
+  n -= p - line;
+  memmove (line, p, strlen (p) + 1);
+  if ((n == 0) || (line[0] == '#')) {
+    return (0);
+  }
+  if (line[n - 1] == '.') {
+    line[--n] = 0;
+  }
+  if ((n == 0) || (n > 253)) {
+    return (-1);
+  }
+
+  // Each label from 1 to 63 characters.
+  label = 0;
+  for (i=0; i<n; i++) {
+    line[i] = tolower ((unsigned char) line[i]);
+    if (line[i] == '.') {
+      if (label == 0) {
+        return (-1);
+      }
+      label = 0;
+    } else if ((++label > 63) || isspace ((unsigned char) line[i])) {
+      return (-1);
+    }
+  }
+  if (label == 0) {
+    return (-1);
+  }
+
+  return (n);
+}
+
+// Name of a reason a name was not resolved.
+char *
+rcode_name (int rcode)
+{
+  switch (rcode) {
+    case DNS_NXDOMAIN: return ("NXDOMAIN");
+    case DNS_NODATA: return ("NODATA");
+    case DNS_SERVFAIL: return ("SERVFAIL");
+    case DNS_REFUSED: return ("REFUSED");
+    case DNS_TIMEOUT: return ("TIMEOUT");
+    case DNS_TRUNCATED: return ("TRUNCATED");
+  }
+
+  return ("ERROR");
+}
+
+// Time now (ms, CLOCK_MONOTONIC).
+int64_t
+now_ms (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+
+  return ((int64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
+// SIGINT handler: stop reading names, and report.
+void
+sig_handler (int signum)
+{
+  (void) signum;
+  stop = 1;
+}
+
+// Allocate memory for an array of chars.
+char *
+allocate_strmem (int len)
+{
+  void *tmp;
+
+  if (len <= 0) {
+    fprintf (stderr, "ERROR: Cannot allocate memory because len = %i in allocate_strmem().\n", len);
+    exit (EXIT_FAILURE);
+  }
+
+  tmp = (char *) malloc (len * sizeof (char));
+  if (tmp != NULL) {
+    memset (tmp, 0, len * sizeof (char));
+    return (tmp);
+  } else {
+    fprintf (stderr, "ERROR: Cannot allocate memory for array allocate_strmem().\n");
+    exit (EXIT_FAILURE);
+  }
+}
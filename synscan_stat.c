@@ -0,0 +1,370 @@
+/*  Copyright (C) 2013  P.D. Buchan (pdbuchan@yahoo.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Read the statistics which tcp4_synscan_ll.c publishes in shared memory, while
+// the scan runs, and report them at a fixed interval: for each thread and stage,
+// runs and frames per second, share of the thread's time spent in the stage, mean
+// time per frame and per run, percentiles of time per run, and the counters.
+// The segment is mapped read-only, and each counter is read once per interval, so the
+// scan is never made to wait. Reading starts when the scan has created the segment,
+// and stops after the scan exits. Link with -lrt on systems with glibc older than 2.34.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>           // close(), usleep()
+#include <string.h>           // strcpy, memset(), and memcpy()
+
+#include <stdint.h>           // uint32_t, uint64_t
+#include <sys/mman.h>         // shm_open(), mmap()
+#include <sys/stat.h>         // fstat()
+#include <fcntl.h>            // O_RDONLY
+#include <time.h>             // clock_gettime(), clock_nanosleep()
+#include <signal.h>           // signal(), SIGINT, kill()
+
+#include <errno.h>            // errno, perror()
+
+// Define some constants: these, and the structs below, are those of tcp4_synscan_ll.c.
+#define STATS_MAGIC 0x53434e53  // "SNCS": written last, once the segment is ready
+#define STATS_VERSION 1
+#define STATS_THREADS 2       // Threads with counters: scan loop, and capture writer
+#define STAT_NAMELEN 16       // Room for each name of a thread, stage or counter
+#define HIST_BUCKETS 32       // Bucket b counts runs of 2^b to 2^(b+1) - 1 ticks (bucket 0 from 0)
+#define NUM_STAGES 7
+#define NUM_COUNTERS 9
+
+// Define a struct for the statistics of one stage in one thread.
+typedef struct _stage_stats stage_stats;
+struct _stage_stats {
+  uint64_t runs;        // Times stage was run
+  uint64_t items;       // Frames handled (a batch is many)
+  uint64_t ticks;       // Total time taken (timer ticks)
+  uint64_t max;         // Longest run (timer ticks)
+  uint64_t hist[HIST_BUCKETS];  // Runs by time taken, in log2 buckets
+} __attribute__ ((aligned (64)));
+
+// Define a struct for the statistics of one thread.
+typedef struct _thread_stats thread_stats;
+struct _thread_stats {
+  char name[STAT_NAMELEN];  // Empty if unused
+  stage_stats stage[NUM_STAGES];
+  uint64_t counter[NUM_COUNTERS] __attribute__ ((aligned (64)));
+} __attribute__ ((aligned (64)));
+
+// Define a struct for the shared memory segment.
+typedef struct _stats_shm stats_shm;
+struct _stats_shm {
+  uint32_t magic;       // STATS_MAGIC once the rest is filled in
+  uint32_t version;     // STATS_VERSION
+  uint32_t nthreads;    // STATS_THREADS, NUM_STAGES, NUM_COUNTERS and HIST_BUCKETS
+  uint32_t nstages;
+  uint32_t ncounters;
+  uint32_t nbuckets;
+  int32_t pid;          // Process writing the statistics
+  uint32_t unused;
+  uint64_t tick_hz;     // Timer ticks per second
+  uint64_t start_ns;    // Time statistics began (ns since the epoch)
+  char stage_names[NUM_STAGES][STAT_NAMELEN];
+  char counter_names[NUM_COUNTERS][STAT_NAMELEN];
+  thread_stats thread[STATS_THREADS];
+};
+
+// Function prototypes
+stats_shm *stats_attach (char *);
+void snapshot (stats_shm *, thread_stats *);
+void report (stats_shm *, thread_stats *, thread_stats *, double);
+double percentile (stats_shm *, uint64_t *, uint64_t *, double);
+double ticks_ns (stats_shm *, double);
+void pace (struct timespec *, long int);
+void sig_handler (int);
+char *allocate_strmem (int);
+
+// Set by SIGINT handler to stop reading.
+volatile sig_atomic_t stop = 0;
+
+int
+main (int argc, char **argv)
+{
+  int interval, exited;
+  char *name;
+  stats_shm *shm;
+  thread_stats *prev, *cur, *tmp;
+  struct timespec next, t1, t2;
+  double dt;
+
+  // Allocate memory for various arrays.
+  name = allocate_strmem (64);
+  prev = (thread_stats *) calloc (STATS_THREADS, sizeof (thread_stats));
+  cur = (thread_stats *) calloc (STATS_THREADS, sizeof (thread_stats));
+  if ((prev == NULL) || (cur == NULL)) {
+    fprintf (stderr, "ERROR: Cannot allocate memory for snapshots of statistics.\n");
+    exit (EXIT_FAILURE);
+  }
+
+  // Shared memory segment named in tcp4_synscan_ll.c (stats_name).
+  strcpy (name, "/synscan");
+
+  // Seconds between reports.
+  interval = 1;
+
+  signal (SIGINT, sig_handler);
+
+  shm = stats_attach (name);
+  printf ("Reading statistics of process %i, timer at %.3f MHz\n", shm->pid, shm->tick_hz / 1e6);
+
+  snapshot (shm, prev);
+  clock_gettime (CLOCK_MONOTONIC, &t1);
+  next = t1;
+  exited = 0;
+  while ((stop == 0) && (exited == 0)) {
+    pace (&next, interval * 1000000000L);
+
+    // Once the scan has gone, report what it left, and finish.
+    if ((kill (shm->pid, 0) < 0) && (errno == ESRCH)) {
+      exited = 1;
+    }
+    snapshot (shm, cur);
+    clock_gettime (CLOCK_MONOTONIC, &t2);
+    dt = (double) (t2.tv_sec - t1.tv_sec) + (double) (t2.tv_nsec - t1.tv_nsec) / 1000000000.0;
+    t1 = t2;
+
+    report (shm, prev, cur, dt);
+    tmp = prev;
+    prev = cur;
+    cur = tmp;
+  }
+  if (exited) {
+    printf ("Process %i has exited\n", shm->pid);
+  }
+
+  // Free allocated memory.
+  munmap (shm, sizeof (stats_shm));
+  free (name);
+  free (prev);
+  free (cur);
+
+  return (EXIT_SUCCESS);
+}
+
+// Map the statistics segment read-only, waiting for the scan to create it and fill in
+// its header, and check that it has the layout we expect.
+stats_shm *
+stats_attach (char *name)
+{
+  int fd, waiting;
+  struct stat sb;
+  stats_shm *shm;
+
+  waiting = 0;
+  while (1) {
+    if ((fd = shm_open (name, O_RDONLY, 0)) >= 0) {
+      if (fstat (fd, &sb) < 0) {
+        perror ("fstat() failed ");
+        exit (EXIT_FAILURE);
+      }
+      if (sb.st_size >= (off_t) sizeof (stats_shm)) {
+        break;
+      }
+      close (fd);
+    } else if (errno != ENOENT) {
+      perror ("shm_open() failed to open statistics segment ");
+      exit (EXIT_FAILURE);
+    }
+    if (waiting == 0) {
+      printf ("Waiting for statistics segment %s\n", name);
+      waiting = 1;
+    }
+    usleep (100000);
+    if (stop == 1) {
+      exit (EXIT_SUCCESS);
+    }
+  }
+
+  if ((shm = mmap (NULL, sizeof (stats_shm), PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+    perror ("mmap() failed to map statistics segment ");
+    exit (EXIT_FAILURE);
+  }
+  close (fd);
+
+  while (__atomic_load_n (&shm->magic, __ATOMIC_ACQUIRE) != STATS_MAGIC) {
+    usleep (10000);
+    if (stop == 1) {
+      exit (EXIT_SUCCESS);
+    }
+  }
+  if ((shm->version != STATS_VERSION) || (shm->nthreads != STATS_THREADS) || (shm->nstages != NUM_STAGES) ||
+      (shm->ncounters != NUM_COUNTERS) || (shm->nbuckets != HIST_BUCKETS)) {
+    fprintf (stderr, "Statistics segment %s has version %u with %u threads, %u stages, %u counters, %u buckets;\n"
+             "expected version %i with %i, %i, %i, %i.\n", name, shm->version, shm->nthreads, shm->nstages,
+             shm->ncounters, shm->nbuckets, STATS_VERSION, STATS_THREADS, NUM_STAGES, NUM_COUNTERS, HIST_BUCKETS);
+    exit (EXIT_FAILURE);
+  }
+
+  return (shm);
+}
+
+// Copy the statistics of all threads. Each word is read whole, as it is written,
+// but the copy is not one instant: a run being recorded may be counted in some fields only.
+void
+snapshot (stats_shm *shm, thread_stats *snap)
+{
+  int i, j, k;
+  stage_stats *from, *to;
+
+  for (i=0; i<STATS_THREADS; i++) {
+    memcpy (snap[i].name, shm->thread[i].name, STAT_NAMELEN);
+    snap[i].name[STAT_NAMELEN - 1] = 0;
+    for (j=0; j<NUM_STAGES; j++) {
+      from = &shm->thread[i].stage[j];
+      to = &snap[i].stage[j];
+      to->runs = __atomic_load_n (&from->runs, __ATOMIC_RELAXED);
+      to->items = __atomic_load_n (&from->items, __ATOMIC_RELAXED);
+      to->ticks = __atomic_load_n (&from->ticks, __ATOMIC_RELAXED);
+      to->max = __atomic_load_n (&from->max, __ATOMIC_RELAXED);
+      for (k=0; k<HIST_BUCKETS; k++) {
+        to->hist[k] = __atomic_load_n (&from->hist[k], __ATOMIC_RELAXED);
+      }
+    }
+    for (j=0; j<NUM_COUNTERS; j++) {
+      snap[i].counter[j] = __atomic_load_n (&shm->thread[i].counter[j], __ATOMIC_RELAXED);
+    }
+  }
+}
+
+// Report what happened between two snapshots, dt seconds apart.
+void
+report (stats_shm *shm, thread_stats *prev, thread_stats *cur, double dt)
+{
+  int i, j, header;
+  uint64_t runs, items, ticks;
+  stage_stats *a, *b;
+  struct timespec ts;
+
+  clock_gettime (CLOCK_REALTIME, &ts);
+  printf ("\n%.1f seconds since start\n", (double) ts.tv_sec + ts.tv_nsec / 1e9 - shm->start_ns / 1e9);
+  for (i=0; i<STATS_THREADS; i++) {
+    if (cur[i].name[0] == 0) {
+      continue;
+    }
+    printf ("Thread %s\n", cur[i].name);
+    header = 0;
+    for (j=0; j<NUM_STAGES; j++) {
+      a = &prev[i].stage[j];
+      b = &cur[i].stage[j];
+      runs = b->runs - a->runs;
+      items = b->items - a->items;
+      ticks = b->ticks - a->ticks;
+      if (runs == 0) {
+        continue;
+      }
+      if (header == 0) {
+        printf ("  %-9s %10s %10s %6s %9s %9s %9s %9s %10s\n", "stage", "runs/s", "frames/s", "busy%",
+                "ns/frame", "ns/run", "p50 ns<=", "p99 ns<=", "max ns");
+        header = 1;
+      }
+      printf ("  %-9s %10.0f %10.0f %6.1f %9.1f %9.1f %9.0f %9.0f %10.0f\n", shm->stage_names[j],
+              runs / dt, items / dt, 100.0 * ticks_ns (shm, ticks) / (dt * 1e9),
+              (items > 0) ? ticks_ns (shm, ticks) / items : 0.0, ticks_ns (shm, ticks) / runs,
+              percentile (shm, a->hist, b->hist, 0.5), percentile (shm, a->hist, b->hist, 0.99),
+              ticks_ns (shm, b->max));
+    }
+    for (j=0; j<NUM_COUNTERS; j++) {
+      if (cur[i].counter[j] > 0) {
+        printf ("  %-12s %14llu  %12.0f/s\n", shm->counter_names[j], (unsigned long long) cur[i].counter[j],
+                (cur[i].counter[j] - prev[i].counter[j]) / dt);
+      }
+    }
+  }
+  fflush (stdout);
+}
+
+// Time (ns) within which fraction q of the runs between two snapshots of a histogram
+// took place: the upper end of the bucket holding the q-th run.
+double
+percentile (stats_shm *shm, uint64_t *a, uint64_t *b, double q)
+{
+  int k;
+  uint64_t total, sum;
+
+  total = 0;
+  for (k=0; k<HIST_BUCKETS; k++) {
+    total += b[k] - a[k];
+  }
+  sum = 0;
+  for (k=0; k<HIST_BUCKETS; k++) {
+    sum += b[k] - a[k];
+    if (sum >= (q * total)) {
+      break;
+    }
+  }
+  if (k == HIST_BUCKETS) {
+    k--;
+  }
+
+  return (ticks_ns (shm, (double) (2ull << k)));
+}
+
+// Convert timer ticks to ns.
+double
+ticks_ns (stats_shm *shm, double ticks)
+{
+  return (ticks * 1e9 / shm->tick_hz);
+}
+
+// Sleep until next scheduled report, then schedule the one after.
+// Absolute deadlines keep reports in step even if one runs late.
+void
+pace (struct timespec *next, long int interval)
+{
+  next->tv_nsec += interval;
+  while (next->tv_nsec >= 1000000000L) {
+    next->tv_nsec -= 1000000000L;
+    next->tv_sec++;
+  }
+  while (clock_nanosleep (CLOCK_MONOTONIC, TIMER_ABSTIME, next, NULL) == EINTR) {
+    if (stop == 1) {
+      break;
+    }
+  }
+}
+
+// SIGINT handler: stop reading.
+void
+sig_handler (int signum)
+{
+  (void) signum;
+  stop = 1;
+}
+
+// Allocate memory for an array of chars.
+char *
+allocate_strmem (int len)
+{
+  void *tmp;
+
+  if (len <= 0) {
+    fprintf (stderr, "ERROR: Cannot allocate memory because len = %i in allocate_strmem().\n", len);
+    exit (EXIT_FAILURE);
+  }
+
+  tmp = (char *) malloc (len * sizeof (char));
+  if (tmp != NULL) {
+    memset (tmp, 0, len * sizeof (char));
+    return (tmp);
+  } else {
+    fprintf (stderr, "ERROR: Cannot allocate memory for array allocate_strmem().\n");
+    exit (EXIT_FAILURE);
+  }
+}
@@ -0,0 +1,920 @@
+/*  Copyright (C) 2013  P.D. Buchan (pdbuchan@yahoo.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Load a set of IPv4 and IPv6 targets (addresses and CIDR networks) from a file,
+// cut out those in a file of exclusions, and visit each target left exactly once,
+// in a random order, split into disjoint shards for worker threads.
+// Files are memory-mapped and read in place, one address or network per line;
+// anything after a # is a comment. The targets of each address family are kept as a
+// sorted list of disjoint ranges, each stored as its first address and the number of
+// targets before it. A /8 costs no more than a single address, and a sparse IPv6
+// hitlist costs 24 bytes for each run of adjacent addresses.
+// Targets are numbered 0 to n - 1, IPv4 first. The order is a keyed Feistel
+// permutation of those numbers, as in tcp4_synscan_ll.c, so the state of an iterator
+// is a single number: shard s of k takes positions s, s + k, s + 2k, ... of the
+// permutation, and a position is turned into an address by binary search of the ranges.
+// Given the same seed, separate processes (or hosts) visit the same order, so each may
+// take a shard of its own. Link with -lpthread.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>           // close()
+#include <string.h>           // strcpy, memset(), and memcpy()
+
+#include <stdint.h>           // uint64_t
+#include <sys/types.h>        // needed for uint8_t, uint32_t
+#include <sys/socket.h>       // AF_INET, AF_INET6
+#include <netinet/in.h>       // INET6_ADDRSTRLEN
+#include <arpa/inet.h>        // inet_pton() and inet_ntop()
+#include <sys/random.h>       // getrandom()
+#include <signal.h>           // signal(), SIGINT
+#include <time.h>             // clock_gettime()
+#include <fcntl.h>            // open()
+#include <pthread.h>          // pthread_create(), pthread_join() (link with -lpthread)
+#include <sys/mman.h>         // mmap(), madvise(), munmap()
+#include <sys/stat.h>         // fstat()
+
+#include <errno.h>            // errno, perror()
+
+// Define some constants.
+#define FEISTEL_ROUNDS 4      // Rounds of Feistel network used to permute targets
+#define MAX_SHARDS 1024       // Most shards (worker threads)
+#define MAX_TOKEN 64          // Longest address or network on a line, with prefix length
+#define MAX_BAD 10            // Lines not understood which are reported, of each file
+#define MAX_TARGETS (1ull << 62)  // Most targets: positions, plus the shard count, must not overflow 64 bits
+#define PRINT_BUFSIZE 1048576 // Buffer for standard output, when printing a shard
+
+// A 128-bit unsigned integer (gcc and clang), to hold an IPv6 address in host byte order.
+typedef unsigned __int128 u128;
+
+// Define a struct for an IPv4 range of addresses as read from a file: lo to hi, inclusive.
+typedef struct _range4 range4;
+struct _range4 {
+  uint32_t lo;          // First address (host byte order)
+  uint32_t hi;          // Last address
+};
+
+// Define a struct for an IPv6 range of addresses as read from a file: lo to hi, inclusive.
+typedef struct _range6 range6;
+struct _range6 {
+  u128 lo;              // First address (host byte order)
+  u128 hi;              // Last address
+};
+
+// Define a struct for the ranges read from a file, before they are sorted.
+typedef struct _range_list range_list;
+struct _range_list {
+  range4 *r4;           // IPv4 ranges
+  long int n4;          // Number of IPv4 ranges, and room for them
+  long int max4;
+  range6 *r6;           // IPv6 ranges
+  long int n6;          // Number of IPv6 ranges, and room for them
+  long int max6;
+  long int lines;       // Lines with an address or network
+  long int bad;         // Lines not understood
+};
+
+// Define a struct for a set of targets, and its permutation.
+// Range i of a family runs from first[i] for before[i + 1] - before[i] addresses.
+typedef struct _target_set target_set;
+struct _target_set {
+  uint32_t *first4;     // First address of each IPv4 range (host byte order)
+  uint64_t *before4;    // Targets before each IPv4 range; before4[n4] is the number of IPv4 targets
+  long int n4;          // Number of IPv4 ranges
+  u128 *first6;         // First address of each IPv6 range (host byte order)
+  uint64_t *before6;    // Targets before each IPv6 range (counting IPv4 targets); before6[n6] is the total
+  long int n6;          // Number of IPv6 ranges
+  uint64_t total;       // Number of targets
+  int half_bits;        // Feistel half width: permutation domain is 2^(2 * half_bits), at least total
+  uint64_t half_mask;   // (1 << half_bits) - 1
+  uint64_t round_key[FEISTEL_ROUNDS];
+};
+
+// Define a struct for an iterator over one shard of a set of targets.
+typedef struct _target_iter target_iter;
+struct _target_iter {
+  uint64_t next;        // Next position of permutation to visit
+  uint64_t step;        // Number of shards
+};
+
+// Define a struct for a worker thread, which visits one shard.
+typedef struct _worker worker;
+struct _worker {
+  pthread_t thread;
+  target_set *set;
+  int shard;            // Shard visited
+  int nshards;          // Number of shards
+  uint64_t count;       // Targets visited
+  uint64_t v4;          // IPv4 targets among them
+  uint64_t sum;         // Sum of the numbers of the targets visited (each shard is disjoint
+                        // from the others, and together they cover the set, if these add up)
+  double seconds;       // Time taken
+};
+
+// Function prototypes
+void load_ranges (char *, range_list *);
+int parse_range (char *, range_list *);
+void add_range4 (range_list *, uint32_t, uint32_t);
+void add_range6 (range_list *, u128, u128);
+int cmp_range4 (const void *, const void *);
+int cmp_range6 (const void *, const void *);
+long int merge_range4 (range4 *, long int);
+long int merge_range6 (range6 *, long int);
+long int subtract_range4 (range4 *, long int, range4 *, long int, range4 *);
+long int subtract_range6 (range6 *, long int, range6 *, long int, range6 *);
+void set_build (target_set *, range_list *, range_list *);
+void set_key (target_set *, uint64_t);
+void set_free (target_set *);
+uint64_t permute (target_set *, uint64_t);
+int set_lookup (target_set *, uint64_t, uint8_t *);
+void iter_init (target_iter *, int, int);
+int iter_next (target_set *, target_iter *, uint64_t *, uint8_t *);
+void *worker_thread (void *);
+u128 load_u128 (uint8_t *);
+void store_u128 (u128, uint8_t *);
+uint64_t splitmix64 (uint64_t *);
+double now_sec (void);
+void sig_handler (int);
+char *allocate_strmem (int);
+
+// Set by SIGINT handler to stop.
+volatile sig_atomic_t stop = 0;
+
+int
+main (int argc, char **argv)
+{
+  int i, status, nshards, shard, family;
+  char *include, *exclude, *outbuf;
+  char addr_str[INET6_ADDRSTRLEN];
+  uint8_t addr[16];
+  uint64_t seed, n, count, v4, sum, expect;
+  double start, dt;
+  range_list inc, exc;
+  target_set set;
+  target_iter it;
+  worker *w;
+
+  // Allocate memory for various arrays.
+  include = allocate_strmem (256);
+  exclude = allocate_strmem (256);
+
+  // File of targets, one IPv4 or IPv6 address or CIDR network per line: you need to fill this out
+  strcpy (include, "targets.txt");
+
+  // File of addresses and networks never to visit (e.g., reserved or opted-out networks),
+  // or empty for none.
+  strcpy (exclude, "exclude.txt");
+
+  // Number of shards. Each is visited by a worker thread of its own.
+  nshards = 4;
+
+  // Shard whose targets are printed, one per line, in the order visited; or -1 to visit
+  // every shard, in threads, and report counts and rates only.
+  shard = -1;
+
+  // Seed of the permutation: processes given the same seed visit targets in the same
+  // order, so each may take a shard. 0 draws a random seed.
+  seed = 0;
+
+  if ((nshards < 1) || (nshards > MAX_SHARDS) || (shard >= nshards)) {
+    fprintf (stderr, "ERROR: Number of shards must be from 1 to %i, and shard printed less than it.\n", MAX_SHARDS);
+    exit (EXIT_FAILURE);
+  }
+
+  // Load targets and exclusions, and cut the one from the other.
+  start = now_sec ();
+  memset (&inc, 0, sizeof (inc));
+  memset (&exc, 0, sizeof (exc));
+  load_ranges (include, &inc);
+  if (exclude[0] != 0) {
+    load_ranges (exclude, &exc);
+  }
+  fprintf (stderr, "Read %li targets (%li not understood) from %s", inc.lines, inc.bad, include);
+  if (exclude[0] != 0) {
+    fprintf (stderr, ", and %li exclusions (%li not understood) from %s", exc.lines, exc.bad, exclude);
+  }
+  fprintf (stderr, ".\n");
+  set_build (&set, &inc, &exc);
+  if (set.total == 0) {
+    fprintf (stderr, "ERROR: No targets left after exclusions.\n");
+    exit (EXIT_FAILURE);
+  }
+
+  if (seed == 0) {
+    if (getrandom (&seed, sizeof (seed), 0) != sizeof (seed)) {
+      perror ("getrandom() failed ");
+      exit (EXIT_FAILURE);
+    }
+  }
+  set_key (&set, seed);
+
+  fprintf (stderr, "%llu targets (%llu IPv4, %llu IPv6) in %li IPv4 and %li IPv6 ranges, held in %lu bytes; built in %.3f s.\n",
+           (unsigned long long) set.total, (unsigned long long) set.before4[set.n4], (unsigned long long) (set.total - set.before4[set.n4]),
+           set.n4, set.n6, (unsigned long) ((set.n4 + 1) * (sizeof (uint32_t) + sizeof (uint64_t)) + (set.n6 + 1) * (sizeof (u128) + sizeof (uint64_t))),
+           now_sec () - start);
+  fprintf (stderr, "Seed %llu, %i shards.\n", (unsigned long long) seed, nshards);
+
+  signal (SIGINT, sig_handler);
+
+  // Print the targets of one shard.
+  if (shard >= 0) {
+    outbuf = allocate_strmem (PRINT_BUFSIZE);
+    setvbuf (stdout, outbuf, _IOFBF, PRINT_BUFSIZE);
+    iter_init (&it, shard, nshards);
+    count = 0;
+    while ((stop == 0) && (iter_next (&set, &it, &n, addr) == 1)) {
+      family = (n < set.before4[set.n4]) ? AF_INET : AF_INET6;
+      if (inet_ntop (family, addr, addr_str, INET6_ADDRSTRLEN) == NULL) {
+        status = errno;
+        fprintf (stderr, "inet_ntop() failed.\nError message: %s", strerror (status));
+        exit (EXIT_FAILURE);
+      }
+      printf ("%s\n", addr_str);
+      count++;
+    }
+    fflush (stdout);
+    fprintf (stderr, "Shard %i: %llu targets.\n", shard, (unsigned long long) count);
+    set_free (&set);
+    free (include);
+    free (exclude);
+    free (outbuf);
+    return (EXIT_SUCCESS);
+  }
+
+  // Visit every shard, each in a thread of its own.
+  w = (worker *) calloc (nshards, sizeof (worker));
+  if (w == NULL) {
+    fprintf (stderr, "ERROR: Cannot allocate memory for workers.\n");
+    exit (EXIT_FAILURE);
+  }
+  start = now_sec ();
+  for (i=0; i<nshards; i++) {
+    w[i].set = &set;
+    w[i].shard = i;
+    w[i].nshards = nshards;
+    if ((status = pthread_create (&w[i].thread, NULL, worker_thread, &w[i])) != 0) {
+      fprintf (stderr, "pthread_create() failed.\nError message: %s\n", strerror (status));
+      exit (EXIT_FAILURE);
+    }
+  }
+  count = 0;
+  v4 = 0;
+  sum = 0;
+  for (i=0; i<nshards; i++) {
+    pthread_join (w[i].thread, NULL);
+    printf ("Shard %i: %llu targets (%llu IPv4) in %.3f s, %.2f million targets/s\n", i,
+            (unsigned long long) w[i].count, (unsigned long long) w[i].v4, w[i].seconds,
+            (w[i].seconds > 0.0) ? (double) w[i].count / w[i].seconds / 1.0e6 : 0.0);
+    count += w[i].count;
+    v4 += w[i].v4;
+    sum += w[i].sum;
+  }
+  dt = now_sec () - start;
+
+  // Numbers 0 to total - 1 add up to total * (total - 1) / 2 (mod 2^64).
+  expect = (set.total & 1) ? set.total * ((set.total - 1) / 2) : (set.total / 2) * (set.total - 1);
+  printf ("All shards: %llu targets (%llu IPv4) in %.3f s, %.2f million targets/s\n",
+          (unsigned long long) count, (unsigned long long) v4, dt, (dt > 0.0) ? (double) count / dt / 1.0e6 : 0.0);
+  if (stop == 0) {
+    if ((count == set.total) && (sum == expect)) {
+      printf ("Shards are disjoint and cover the set.\n");
+    } else {
+      printf ("ERROR: Shards do not cover the set exactly.\n");
+    }
+  }
+
+  set_free (&set);
+  free (w);
+  free (include);
+  free (exclude);
+
+  return (EXIT_SUCCESS);
+}
+
+// Read the addresses and networks in a file, memory-mapped, into a list of ranges.
+void
+load_ranges (char *filename, range_list *list)
+{
+  int fd, len, lineno_bad;
+  long int lineno;
+  char *map, *p, *end, *eol, token[MAX_TOKEN];
+  struct stat st;
+
+  if ((fd = open (filename, O_RDONLY)) < 0) {
+    fprintf (stderr, "ERROR: Cannot open file %s: %s\n", filename, strerror (errno));
+    exit (EXIT_FAILURE);
+  }
+  if (fstat (fd, &st) < 0) {
+    perror ("fstat() failed ");
+    exit (EXIT_FAILURE);
+  }
+  if (st.st_size == 0) {
+    close (fd);
+    return;
+  }
+  if ((map = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+    perror ("mmap() failed ");
+    exit (EXIT_FAILURE);
+  }
+
+  // Mapping stays valid after descriptor is closed.
+  close (fd);
+
+  // Tell kernel we'll read the file front to back.
+  if (madvise (map, st.st_size, MADV_SEQUENTIAL) < 0) {
+    perror ("madvise() failed ");
+  }
+
+  lineno = 0;
+  lineno_bad = 0;
+  end = map + st.st_size;
+  for (p = map; p < end; p = eol + 1) {
+    lineno++;
+    if ((eol = memchr (p, '\n', end - p)) == NULL) {
+      eol = end;
+    }
+
+    // Skip leading white space; stop at white space or a comment.
+    while ((p < eol) && ((*p == ' ') || (*p == '\t'))) {
+      p++;
+    }
+    len = 0;
+    while ((p + len < eol) && (p[len] != '#') && (p[len] != ' ') && (p[len] != '\t') && (p[len] != '\r')) {
+      len++;
+    }
+    if (len == 0) {
+      continue;
+    }
+
+    // The mapping is read-only, so copy the token out to terminate it.
+    if (len < MAX_TOKEN) {
+      memcpy (token, p, len);
+      token[len] = 0;
+      if (parse_range (token, list) == 0) {
+        list->lines++;
+        continue;
+      }
+    }
+    list->bad++;
+    if (lineno_bad++ < MAX_BAD) {
+      fprintf (stderr, "Line %li of %s is not an address or network: %.*s\n", lineno, filename, (len < MAX_TOKEN) ? len : MAX_TOKEN, p);
+    }
+  }
+
+  munmap (map, st.st_size);
+}
+
+// Add an IPv4 or IPv6 address, or CIDR network, to a list of ranges.
+// Host bits of a network are ignored. Returns 0, or -1 if it is neither.
+int
+parse_range (char *token, range_list *list)
+{
+  int prefixlen;
+  char *slash, *endp;
+  uint8_t addr[16];
+  uint32_t a4, mask4;
+  u128 a6, mask6;
+
+  prefixlen = -1;
+  if ((slash = strchr (token, '/')) != NULL) {
+    *slash = 0;
+    prefixlen = (int) strtol (slash + 1, &endp, 10);
+    if ((slash[1] == 0) || (*endp != 0) || (prefixlen < 0)) {
+      return (-1);
+    }
+  }
+
+  if (inet_pton (AF_INET, token, addr) == 1) {
+    if (prefixlen > 32) {
+      return (-1);
+    }
+    if (prefixlen < 0) {
+      prefixlen = 32;
+    }
+    memcpy (&a4, addr, 4);
+    a4 = ntohl (a4);
+    mask4 = (prefixlen == 0) ? 0 : 0xffffffffU << (32 - prefixlen);
+    add_range4 (list, a4 & mask4, (a4 & mask4) | ~mask4);
+    return (0);
+  }
+
+  if (inet_pton (AF_INET6, token, addr) == 1) {
+    if (prefixlen > 128) {
+      return (-1);
+    }
+    if (prefixlen < 0) {
+      prefixlen = 128;
+    }
+    a6 = load_u128 (addr);
+    mask6 = (prefixlen == 0) ? 0 : ~(u128) 0 << (128 - prefixlen);
+    add_range6 (list, a6 & mask6, (a6 & mask6) | ~mask6);
+    return (0);
+  }
+
+  return (-1);
+}
+
+// Add an IPv4 range to a list, making more room as needed.
+void
+add_range4 (range_list *list, uint32_t lo, uint32_t hi)
+{
+  if (list->n4 == list->max4) {
+    list->max4 = (list->max4 == 0) ? 1024 : list->max4 * 2;
+    if ((list->r4 = (range4 *) realloc (list->r4, list->max4 * sizeof (range4))) == NULL) {
+      fprintf (stderr, "ERROR: Cannot allocate memory for IPv4 ranges.\n");
+      exit (EXIT_FAILURE);
+    }
+  }
+  list->r4[list->n4].lo = lo;
+  list->r4[list->n4].hi = hi;
+  list->n4++;
+}
+
+// Add an IPv6 range to a list, making more room as needed.
+void
+add_range6 (range_list *list, u128 lo, u128 hi)
+{
+  if (list->n6 == list->max6) {
+    list->max6 = (list->max6 == 0) ? 1024 : list->max6 * 2;
+    if ((list->r6 = (range6 *) realloc (list->r6, list->max6 * sizeof (range6))) == NULL) {
+      fprintf (stderr, "ERROR: Cannot allocate memory for IPv6 ranges.\n");
+      exit (EXIT_FAILURE);
+    }
+  }
+  list->r6[list->n6].lo = lo;
+  list->r6[list->n6].hi = hi;
+  list->n6++;
+}
+
+// Order IPv4 ranges by first address, for qsort().
+int
+cmp_range4 (const void *a, const void *b)
+{
+  uint32_t x, y;
+
+  x = ((range4 *) a)->lo;
+  y = ((range4 *) b)->lo;
+
+  return ((x > y) - (x < y));
+}
+
+// Order IPv6 ranges by first address, for qsort().
+int
+cmp_range6 (const void *a, const void *b)
+{
+  u128 x, y;
+
+  x = ((range6 *) a)->lo;
+  y = ((range6 *) b)->lo;
+
+  return ((x > y) - (x < y));
+}
+
+// Join sorted IPv4 ranges which overlap or abut, in place. Returns the number left.
+long int
+merge_range4 (range4 *r, long int n)
+{
+  long int i, m;
+
+  if (n == 0) {
+    return (0);
+  }
+  m = 0;
+  for (i=1; i<n; i++) {
+    if ((r[m].hi == 0xffffffffU) || (r[i].lo <= r[m].hi + 1)) {
+      if (r[i].hi > r[m].hi) {
+        r[m].hi = r[i].hi;
+      }
+    } else {
+      r[++m] = r[i];
+    }
+  }
+
+  return (m + 1);
+}
+
+// Join sorted IPv6 ranges which overlap or abut, in place. Returns the number left.
+long int
+merge_range6 (range6 *r, long int n)
+{
+  long int i, m;
+
+  if (n == 0) {
+    return (0);
+  }
+  m = 0;
+  for (i=1; i<n; i++) {
+    if ((r[m].hi == ~(u128) 0) || (r[i].lo <= r[m].hi + 1)) {
+      if (r[i].hi > r[m].hi) {
+        r[m].hi = r[i].hi;
+      }
+    } else {
+      r[++m] = r[i];
+    }
+  }
+
+  return (m + 1);
+}
+
+// Cut merged IPv4 exclusions x out of merged ranges r, into out (room for nr + nx ranges).
+// Returns the number of ranges left.
+long int
+subtract_range4 (range4 *r, long int nr, range4 *x, long int nx, range4 *out)
+{
+  long int i, j, k, n;
+  uint32_t cur;
+  int done;
+
+  n = 0;
+  j = 0;
+  for (i=0; i<nr; i++) {
+
+    // Exclusions wholly before this range are before all later ones too.
+    while ((j < nx) && (x[j].hi < r[i].lo)) {
+      j++;
+    }
+    cur = r[i].lo;
+    done = 0;
+    for (k=j; (k<nx) && (x[k].lo <= r[i].hi); k++) {
+      if (x[k].lo > cur) {
+        out[n].lo = cur;
+        out[n++].hi = x[k].lo - 1;
+      }
+      if (x[k].hi >= r[i].hi) {
+        done = 1;
+        break;
+      }
+      cur = x[k].hi + 1;
+    }
+    if (done == 0) {
+      out[n].lo = cur;
+      out[n++].hi = r[i].hi;
+    }
+  }
+
+  return (n);
+}
+
+// Cut merged IPv6 exclusions x out of merged ranges r, into out (room for nr + nx ranges).
+// Returns the number of ranges left.
+long int
+subtract_range6 (range6 *r, long int nr, range6 *x, long int nx, range6 *out)
+{
+  long int i, j, k, n;
+  u128 cur;
+  int done;
+
+  n = 0;
+  j = 0;
+  for (i=0; i<nr; i++) {
+
+    // Exclusions wholly before this range are before all later ones too.
+    while ((j < nx) && (x[j].hi < r[i].lo)) {
+      j++;
+    }
+    cur = r[i].lo;
+    done = 0;
+    for (k=j; (k<nx) && (x[k].lo <= r[i].hi); k++) {
+      if (x[k].lo > cur) {
+        out[n].lo = cur;
+        out[n++].hi = x[k].lo - 1;
+      }
+      if (x[k].hi >= r[i].hi) {
+        done = 1;
+        break;
+      }
+      cur = x[k].hi + 1;
+    }
+    if (done == 0) {
+      out[n].lo = cur;
+      out[n++].hi = r[i].hi;
+    }
+  }
+
+  return (n);
+}
+
+// Build a set of targets from lists of ranges to include and exclude, which are freed.
+void
+set_build (target_set *set, range_list *inc, range_list *exc)
+{
+  long int i;
+  uint64_t total;
+  u128 size;
+  range4 *out4;
+  range6 *out6;
+
+  memset (set, 0, sizeof (target_set));
+
+  // Sort and merge each list, then cut the exclusions out.
+  qsort (inc->r4, inc->n4, sizeof (range4), cmp_range4);
+  qsort (exc->r4, exc->n4, sizeof (range4), cmp_range4);
+  qsort (inc->r6, inc->n6, sizeof (range6), cmp_range6);
+  qsort (exc->r6, exc->n6, sizeof (range6), cmp_range6);
+  inc->n4 = merge_range4 (inc->r4, inc->n4);
+  exc->n4 = merge_range4 (exc->r4, exc->n4);
+  inc->n6 = merge_range6 (inc->r6, inc->n6);
+  exc->n6 = merge_range6 (exc->r6, exc->n6);
+
+  // Each exclusion can split at most one range in two.
+  out4 = (range4 *) malloc ((inc->n4 + exc->n4 + 1) * sizeof (range4));
+  out6 = (range6 *) malloc ((inc->n6 + exc->n6 + 1) * sizeof (range6));
+  if ((out4 == NULL) || (out6 == NULL)) {
+    fprintf (stderr, "ERROR: Cannot allocate memory for ranges.\n");
+    exit (EXIT_FAILURE);
+  }
+  set->n4 = subtract_range4 (inc->r4, inc->n4, exc->r4, exc->n4, out4);
+  set->n6 = subtract_range6 (inc->r6, inc->n6, exc->r6, exc->n6, out6);
+  free (inc->r4);
+  free (exc->r4);
+  free (inc->r6);
+  free (exc->r6);
+
+  // Keep only the first address of each range, and the number of targets before it.
+  set->first4 = (uint32_t *) malloc ((set->n4 + 1) * sizeof (uint32_t));
+  set->before4 = (uint64_t *) malloc ((set->n4 + 1) * sizeof (uint64_t));
+  set->first6 = (u128 *) malloc ((set->n6 + 1) * sizeof (u128));
+  set->before6 = (uint64_t *) malloc ((set->n6 + 1) * sizeof (uint64_t));
+  if ((set->first4 == NULL) || (set->before4 == NULL) || (set->first6 == NULL) || (set->before6 == NULL)) {
+    fprintf (stderr, "ERROR: Cannot allocate memory for target set.\n");
+    exit (EXIT_FAILURE);
+  }
+  total = 0;
+  for (i=0; i<set->n4; i++) {
+    set->first4[i] = out4[i].lo;
+    set->before4[i] = total;
+    total += (uint64_t) (out4[i].hi - out4[i].lo) + 1;
+  }
+  set->before4[set->n4] = total;
+  for (i=0; i<set->n6; i++) {
+    set->first6[i] = out6[i].lo;
+    set->before6[i] = total;
+    size = out6[i].hi - out6[i].lo + 1;
+    if ((size == 0) || (size > MAX_TARGETS - total)) {
+      fprintf (stderr, "ERROR: More than 2^62 targets: each must be visited, so an IPv6 network can be no larger than a /66.\n");
+      exit (EXIT_FAILURE);
+    }
+    total += (uint64_t) size;
+  }
+  set->before6[set->n6] = total;
+  set->total = total;
+  free (out4);
+  free (out6);
+}
+
+// Set the permutation of a set: its domain, and its round keys, drawn from a seed.
+void
+set_key (target_set *set, uint64_t seed)
+{
+  int r, bits;
+
+  // Smallest even number of bits covering the set, so the Feistel halves are equal.
+  // Then the domain is less than four times the set, and cycle-walking is short.
+  bits = 2;
+  while ((bits < 64) && ((1ull << bits) < set->total)) {
+    bits += 2;
+  }
+  set->half_bits = bits / 2;
+  set->half_mask = (1ull << set->half_bits) - 1;
+
+  for (r=0; r<FEISTEL_ROUNDS; r++) {
+    set->round_key[r] = splitmix64 (&seed);
+  }
+}
+
+// Free the ranges of a set.
+void
+set_free (target_set *set)
+{
+  free (set->first4);
+  free (set->before4);
+  free (set->first6);
+  free (set->before6);
+}
+
+// Map index i of [0, total) to a unique position in [0, total).
+// A balanced Feistel network is a permutation of [0, 2^(2 * half_bits)); results
+// outside the set are fed back in until one lands inside it (cycle-walking).
+uint64_t
+permute (target_set *set, uint64_t i)
+{
+  int r;
+  uint64_t left, right, f;
+
+  do {
+    left = i >> set->half_bits;
+    right = i & set->half_mask;
+    for (r=0; r<FEISTEL_ROUNDS; r++) {
+
+      // Round function: keyed 64-bit mix (finalizer of MurmurHash3).
+      f = right ^ set->round_key[r];
+      f ^= f >> 33;
+      f *= 0xff51afd7ed558ccdull;
+      f ^= f >> 33;
+      f *= 0xc4ceb9fe1a85ec53ull;
+      f ^= f >> 33;
+
+      f = (left ^ f) & set->half_mask;
+      left = right;
+      right = f;
+    }
+    i = (left << set->half_bits) | right;
+  } while (i >= set->total);
+
+  return (i);
+}
+
+// Find target number n of a set, and write its address (network byte order) to addr.
+// Returns AF_INET or AF_INET6.
+int
+set_lookup (target_set *set, uint64_t n, uint8_t *addr)
+{
+  long int lo, hi, mid;
+  uint32_t a4;
+
+  // Last range starting at or before n.
+  if (n < set->before4[set->n4]) {
+    lo = 0;
+    hi = set->n4 - 1;
+    while (lo < hi) {
+      mid = lo + (hi - lo + 1) / 2;
+      if (set->before4[mid] <= n) {
+        lo = mid;
+      } else {
+        hi = mid - 1;
+      }
+    }
+    a4 = htonl (set->first4[lo] + (uint32_t) (n - set->before4[lo]));
+    memcpy (addr, &a4, 4);
+    return (AF_INET);
+  }
+
+  lo = 0;
+  hi = set->n6 - 1;
+  while (lo < hi) {
+    mid = lo + (hi - lo + 1) / 2;
+    if (set->before6[mid] <= n) {
+      lo = mid;
+    } else {
+      hi = mid - 1;
+    }
+  }
+  store_u128 (set->first6[lo] + (n - set->before6[lo]), addr);
+
+  return (AF_INET6);
+}
+
+// Start an iterator at the first target of a shard.
+void
+iter_init (target_iter *it, int shard, int nshards)
+{
+  it->next = shard;
+  it->step = nshards;
+}
+
+// Give the next target of an iterator's shard: its number (to n) and its address (to addr).
+// Returns 1, or 0 once the shard is done.
+int
+iter_next (target_set *set, target_iter *it, uint64_t *n, uint8_t *addr)
+{
+  if (it->next >= set->total) {
+    return (0);
+  }
+  *n = permute (set, it->next);
+  it->next += it->step;
+  set_lookup (set, *n, addr);
+
+  return (1);
+}
+
+// Worker thread: visit every target of one shard.
+void *
+worker_thread (void *arg)
+{
+  uint64_t n, count, v4, sum, nv4;
+  uint8_t addr[16];
+  double start;
+  worker *w;
+  target_iter it;
+
+  w = (worker *) arg;
+  nv4 = w->set->before4[w->set->n4];
+
+  // Count in locals: workers' structs sit side by side, and would share cache lines.
+  count = 0;
+  v4 = 0;
+  sum = 0;
+  start = now_sec ();
+  iter_init (&it, w->shard, w->nshards);
+  while (iter_next (w->set, &it, &n, addr) == 1) {
+    count++;
+    sum += n;
+
+    // The address itself is what a prober would send to; here it's just counted.
+    if (n < nv4) {
+      v4++;
+    }
+    if (((count & 0xffff) == 0) && (stop != 0)) {
+      break;
+    }
+  }
+  w->seconds = now_sec () - start;
+  w->count = count;
+  w->v4 = v4;
+  w->sum = sum;
+
+  return (NULL);
+}
+
+// Read 16 bytes (network byte order) as a 128-bit number.
+u128
+load_u128 (uint8_t *b)
+{
+  int i;
+  u128 x;
+
+  x = 0;
+  for (i=0; i<16; i++) {
+    x = (x << 8) | b[i];
+  }
+
+  return (x);
+}
+
+// Write a 128-bit number as 16 bytes (network byte order).
+void
+store_u128 (u128 x, uint8_t *b)
+{
+  int i;
+
+  for (i=15; i>=0; i--) {
+    b[i] = (uint8_t) x;
+    x >>= 8;
+  }
+}
+
+// Next number of a SplitMix64 sequence, used to draw round keys from a seed.
+uint64_t
+splitmix64 (uint64_t *state)
+{
+  uint64_t z;
+
+  z = (*state += 0x9e3779b97f4a7c15ull);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+
+  return (z ^ (z >> 31));
+}
+
+// Time now (s, CLOCK_MONOTONIC).
+double
+now_sec (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+
+  return ((double) ts.tv_sec + (double) ts.tv_nsec / 1.0e9);
+}
+
+// Signal handler for SIGINT: stop visiting targets.
+void
+sig_handler (int signum)
+{
+  (void) signum;
+  stop = 1;
+}
+
+// Allocate memory for an array of chars.
+char *
+allocate_strmem (int len)
+{
+  void *tmp;
+
+  if (len <= 0) {
+    fprintf (stderr, "ERROR: Cannot allocate memory because len = %i in allocate_strmem().\n", len);
+    exit (EXIT_FAILURE);
+  }
+
+  tmp = (char *) malloc (len * sizeof (char));
+  if (tmp != NULL) {
+    memset (tmp, 0, len * sizeof (char));
+    return (tmp);
+  } else {
+    fprintf (stderr, "ERROR: Cannot allocate memory for array allocate_strmem().\n");
+    exit (EXIT_FAILURE);
+  }
+}
@@ -0,0 +1,1496 @@
+/*  Copyright (C) 2013  P.D. Buchan (pdbuchan@yahoo.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Send an IPv4 TCP SYN packet via raw socket at the link layer (ethernet frame)
+// to each of a list of targets, without being told which interface, source address,
+// or destination MAC address to use. These are found in a copy of the kernel's tables
+// of interfaces, IPv4 addresses, routes and neighbors (the ARP cache), which is read
+// over rtnetlink at startup and then kept up to date from the kernel's notifications
+// of changes, so that each target needs only a lookup in memory: the route with the
+// longest matching prefix gives the interface and next hop, and the neighbor table the
+// next hop's MAC address. A next hop not in the neighbor table is resolved by the
+// kernel at our request, and we wait for its notification of the result.
+// Only the local and main routing tables are used: policy routing rules are not followed.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>           // close()
+#include <string.h>           // strcpy, memset(), and memcpy()
+
+#include <netdb.h>            // struct addrinfo
+#include <sys/types.h>        // needed for socket(), uint8_t, uint16_t, uint32_t
+#include <sys/socket.h>       // needed for socket()
+#include <netinet/in.h>       // IPPROTO_TCP, INET_ADDRSTRLEN
+#include <netinet/ip.h>       // struct ip and IP_MAXPACKET (which is 65535)
+#define __FAVOR_BSD           // Use BSD format of tcp header
+#include <netinet/tcp.h>      // struct tcphdr
+#include <arpa/inet.h>        // inet_pton() and inet_ntop()
+#include <net/if.h>           // IFNAMSIZ, IFF_UP
+#include <net/if_arp.h>       // ARPHRD_ETHER
+#include <linux/if_ether.h>   // ETH_P_IP = 0x0800, ETH_P_IPV6 = 0x86DD
+#include <linux/if_packet.h>  // struct sockaddr_ll (see man 7 packet)
+#include <net/ethernet.h>
+#include <linux/netlink.h>    // struct sockaddr_nl, struct nlmsghdr
+#include <linux/rtnetlink.h>  // RTM_GETLINK, struct rtmsg, struct rtattr, RTMGRP_LINK
+#include <linux/neighbour.h>  // struct ndmsg, NDA_DST, NTF_USE
+#include <poll.h>             // poll()
+#include <time.h>             // clock_gettime()
+#include <signal.h>           // signal(), SIGINT
+
+#include <errno.h>            // errno, perror()
+
+// Define some constants.
+#define ETH_HDRLEN 14  // Ethernet header length
+#define IP4_HDRLEN 20  // IPv4 header length
+#define TCP_HDRLEN 20  // TCP header length, excludes options data
+#define MAX_TARGETS 16        // Room for targets
+#define MAX_IFACES 256        // Room in each table: further entries are dropped, and counted
+#define MAX_ADDRS 1024
+#define MAX_ROUTES 65536
+#define MAX_NEIGHS 16384
+#define NL_BUFLEN 65536       // Receive buffer for netlink messages (bytes)
+#define NL_RCVBUF 4194304     // Socket receive buffer, for bursts of notifications (bytes)
+#define RESOLVE_MS 3000       // Time to wait for the kernel to resolve a next hop (ms)
+
+// Neighbor states in which the MAC address may be used.
+#define NUD_VALID (NUD_PERMANENT | NUD_NOARP | NUD_REACHABLE | NUD_STALE | NUD_DELAY | NUD_PROBE)
+
+// Attributes of a neighbor message, which follow its struct ndmsg.
+#define NDA_RTA(r) ((struct rtattr *) (((char *) (r)) + NLMSG_ALIGN (sizeof (struct ndmsg))))
+
+// Define a struct for an interface.
+typedef struct _link_entry link_entry;
+struct _link_entry {
+  int index;            // Interface index
+  unsigned int type;    // ARPHRD_ETHER for ethernet
+  unsigned int flags;   // IFF_UP, IFF_LOOPBACK, ...
+  unsigned int mtu;
+  int halen;            // Length of MAC address: 6, or 0 if it has none
+  uint8_t mac[6];
+  char name[IFNAMSIZ];
+};
+
+// Define a struct for an IPv4 address of an interface.
+typedef struct _addr_entry addr_entry;
+struct _addr_entry {
+  int index;            // Interface index
+  int prefixlen;        // Length of subnet prefix (bits)
+  struct in_addr addr;
+};
+
+// Define a struct for a route of the local or main table.
+typedef struct _route_entry route_entry;
+struct _route_entry {
+  uint32_t table;       // RT_TABLE_LOCAL (addresses of this host) or RT_TABLE_MAIN
+  struct in_addr dst;   // Destination prefix
+  int dst_len;          // Length of prefix (bits)
+  int tos;              // Type of service to match (0 for any)
+  uint32_t priority;    // Metric: of routes to the same prefix, the lowest is used
+  int type;             // RTN_UNICAST, or RTN_BLACKHOLE, RTN_UNREACHABLE, ...
+  struct in_addr gateway;  // Next hop, or 0 if destination is on-link
+  struct in_addr prefsrc;  // Preferred source address, or 0 if none
+  int oif;              // Interface index
+};
+
+// Define a struct for a neighbor (ARP cache entry).
+typedef struct _neigh_entry neigh_entry;
+struct _neigh_entry {
+  int index;            // Interface index
+  struct in_addr addr;
+  uint16_t state;       // NUD_REACHABLE, NUD_STALE, ...
+  int halen;            // Length of MAC address: 6, or 0 if not yet resolved
+  uint8_t mac[6];
+};
+
+// Define a struct for our copy of the kernel's tables.
+typedef struct _topology topology;
+struct _topology {
+  int sd;               // Netlink socket, subscribed to changes
+  uint32_t seq;         // Sequence number of last request
+  int watch;            // Report each change as it is applied
+  int intr;             // Set if a table changed while being dumped
+  int lost;             // Set if notifications were lost
+  int dropped;          // Entries dropped because a table was full
+  int nlinks;
+  int naddrs;
+  int nroutes;
+  int nneighs;
+  link_entry *links;
+  addr_entry *addrs;
+  route_entry *routes;
+  neigh_entry *neighs;
+  uint8_t *buf;         // Receive buffer
+};
+
+// Define a struct for the way to a destination.
+typedef struct _next_hop next_hop;
+struct _next_hop {
+  int index;            // Interface to send through
+  unsigned int type;    // Type of interface (ARPHRD_ETHER for ethernet)
+  char name[IFNAMSIZ];
+  uint8_t src_mac[6];   // MAC address of interface
+  struct in_addr src;   // Source address
+  struct in_addr via;   // Gateway, or destination itself if on-link
+  uint8_t dst_mac[6];   // MAC address of via
+};
+
+// Function prototypes
+topology *topo_open (void);
+void topo_dump (topology *);
+int topo_poll (topology *);
+int topo_recv (topology *, int, uint32_t);
+uint32_t nl_send (topology *, uint16_t, uint16_t, void *, int);
+void parse_rtattr (struct rtattr **, int, struct rtattr *, int);
+void topo_msg (topology *, struct nlmsghdr *);
+void link_msg (topology *, struct nlmsghdr *);
+void addr_msg (topology *, struct nlmsghdr *);
+void route_msg (topology *, struct nlmsghdr *);
+void neigh_msg (topology *, struct nlmsghdr *);
+void drop_link (topology *, int);
+link_entry *find_link (topology *, int);
+int topo_route (topology *, struct in_addr, next_hop *);
+int topo_neigh (topology *, next_hop *);
+void topo_resolve (topology *, next_hop *);
+int topo_wait (topology *, next_hop *, int);
+void topo_print (topology *);
+void print_link (char *, link_entry *);
+void print_addr (char *, topology *, addr_entry *);
+void print_route (char *, topology *, route_entry *);
+void print_neigh (char *, topology *, neigh_entry *);
+char *link_name (topology *, int);
+char *neigh_state (uint16_t);
+int create_tcp_frame (uint8_t *, char *, char *, uint8_t *, uint8_t *, int, uint8_t *, int);
+uint16_t checksum (uint16_t *, int);
+uint16_t tcp4_checksum (struct ip, struct tcphdr, uint8_t *, int);
+void sig_handler (int);
+char *allocate_strmem (int);
+uint8_t *allocate_ustrmem (int);
+int *allocate_intmem (int);
+
+// Set by SIGINT handler to stop.
+volatile sig_atomic_t stop = 0;
+
+int
+main (int argc, char **argv)
+{
+  int i, status, ntargets, watch, frame_length, sd, bytes, remaining;
+  char **targets, *src_ip, *dst_ip, *via_ip;
+  uint8_t *ether_frame, *data;
+  struct addrinfo hints, *res;
+  struct sockaddr_in *ipv4;
+  struct sockaddr_ll device;
+  struct in_addr dst;
+  struct pollfd pfd;
+  struct timespec t1, t2;
+  topology *topo;
+  next_hop hop;
+
+  // Allocate memory for various arrays.
+  ether_frame = allocate_ustrmem (IP_MAXPACKET);
+  data = allocate_ustrmem (4);
+  src_ip = allocate_strmem (INET_ADDRSTRLEN);
+  dst_ip = allocate_strmem (INET_ADDRSTRLEN);
+  via_ip = allocate_strmem (INET_ADDRSTRLEN);
+  targets = (char **) malloc (MAX_TARGETS * sizeof (char *));
+  if (targets == NULL) {
+    fprintf (stderr, "ERROR: Cannot allocate memory for array 'targets'.\n");
+    exit (EXIT_FAILURE);
+  }
+  for (i=0; i<MAX_TARGETS; i++) {
+    targets[i] = allocate_strmem (40);
+  }
+
+  // Destination URLs or IPv4 addresses: you need to fill these out
+  ntargets = 0;
+  strcpy (targets[ntargets++], "www.google.com");
+  strcpy (targets[ntargets++], "192.168.1.1");
+
+  // Seconds to go on reporting changes to the tables after sending (0 for none).
+  watch = 0;
+
+  signal (SIGINT, sig_handler);
+
+  // Read the kernel's tables, and subscribe to changes.
+  clock_gettime (CLOCK_MONOTONIC, &t1);
+  topo = topo_open ();
+  clock_gettime (CLOCK_MONOTONIC, &t2);
+  printf ("Read %i interfaces, %i addresses, %i routes and %i neighbors in %.3f ms\n",
+          topo->nlinks, topo->naddrs, topo->nroutes, topo->nneighs,
+          (double) (t2.tv_sec - t1.tv_sec) * 1000.0 + (double) (t2.tv_nsec - t1.tv_nsec) / 1000000.0);
+  topo_print (topo);
+
+  // Submit request for a raw socket descriptor.
+  if ((sd = socket (PF_PACKET, SOCK_RAW, htons (ETH_P_ALL))) < 0) {
+    perror ("socket() failed ");
+    exit (EXIT_FAILURE);
+  }
+
+  // Fill out sockaddr_ll: interface index and source MAC address are set for each target.
+  memset (&device, 0, sizeof (device));
+  device.sll_family = AF_PACKET;
+  device.sll_halen = 6;
+
+  // Fill out hints for getaddrinfo().
+  memset (&hints, 0, sizeof (struct addrinfo));
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = hints.ai_flags | AI_CANONNAME;
+
+  for (i=0; (i<ntargets) && (stop == 0); i++) {
+
+    // Resolve target using getaddrinfo().
+    if ((status = getaddrinfo (targets[i], NULL, &hints, &res)) != 0) {
+      fprintf (stderr, "getaddrinfo() failed for %s: %s\n", targets[i], gai_strerror (status));
+      continue;
+    }
+    ipv4 = (struct sockaddr_in *) res->ai_addr;
+    dst = ipv4->sin_addr;
+    freeaddrinfo (res);
+    inet_ntop (AF_INET, &dst, dst_ip, INET_ADDRSTRLEN);
+
+    // Apply any changes the kernel has told us of, then look up the way to target.
+    topo_poll (topo);
+    if (topo_route (topo, dst, &hop) < 0) {
+      fprintf (stderr, "No route off this host to %s (%s).\n", targets[i], dst_ip);
+      continue;
+    }
+    if (hop.type != ARPHRD_ETHER) {
+      fprintf (stderr, "Route to %s (%s) is through %s, which is not an ethernet interface.\n",
+               targets[i], dst_ip, hop.name);
+      continue;
+    }
+    inet_ntop (AF_INET, &hop.src, src_ip, INET_ADDRSTRLEN);
+    inet_ntop (AF_INET, &hop.via, via_ip, INET_ADDRSTRLEN);
+
+    // MAC address of next hop: if the kernel does not know it, ask it to find out.
+    if (topo_neigh (topo, &hop) < 0) {
+      printf ("Resolving %s on %s\n", via_ip, hop.name);
+      topo_resolve (topo, &hop);
+      if (topo_wait (topo, &hop, RESOLVE_MS) < 0) {
+        fprintf (stderr, "No MAC address for %s on %s: cannot send to %s (%s).\n",
+                 via_ip, hop.name, targets[i], dst_ip);
+        continue;
+      }
+    }
+
+    printf ("%s (%s) via %s dev %s src %s lladdr %02x:%02x:%02x:%02x:%02x:%02x\n",
+            targets[i], dst_ip, via_ip, hop.name, src_ip,
+            hop.dst_mac[0], hop.dst_mac[1], hop.dst_mac[2], hop.dst_mac[3], hop.dst_mac[4], hop.dst_mac[5]);
+
+    // Create SYN frame, with no TCP data.
+    create_tcp_frame (ether_frame, src_ip, dst_ip, hop.src_mac, hop.dst_mac, 255, data, 0);
+    frame_length = ETH_HDRLEN + IP4_HDRLEN + TCP_HDRLEN;
+
+    // Send ethernet frame to socket.
+    device.sll_ifindex = hop.index;
+    memcpy (device.sll_addr, hop.src_mac, 6 * sizeof (uint8_t));
+    if ((bytes = sendto (sd, ether_frame, frame_length, 0, (struct sockaddr *) &device, sizeof (device))) <= 0) {
+      perror ("sendto() failed");
+      exit (EXIT_FAILURE);
+    }
+  }
+
+  // Report changes to the tables as the kernel notifies us of them.
+  if ((watch > 0) && (stop == 0)) {
+    printf ("Reporting changes for %i seconds\n", watch);
+    topo->watch = 1;
+    clock_gettime (CLOCK_MONOTONIC, &t1);
+    remaining = watch * 1000;
+    while ((stop == 0) && (remaining > 0)) {
+      pfd.fd = topo->sd;
+      pfd.events = POLLIN;
+      if ((poll (&pfd, 1, remaining) < 0) && (errno != EINTR)) {
+        perror ("poll() failed ");
+        exit (EXIT_FAILURE);
+      }
+      topo_poll (topo);
+      clock_gettime (CLOCK_MONOTONIC, &t2);
+      remaining = watch * 1000 - ((t2.tv_sec - t1.tv_sec) * 1000 + (t2.tv_nsec - t1.tv_nsec) / 1000000);
+    }
+  }
+
+  // Close socket descriptors.
+  close (sd);
+  close (topo->sd);
+
+  // Free allocated memory.
+  free (ether_frame);
+  free (data);
+  free (src_ip);
+  free (dst_ip);
+  free (via_ip);
+  for (i=0; i<MAX_TARGETS; i++) {
+    free (targets[i]);
+  }
+  free (targets);
+  free (topo->links);
+  free (topo->addrs);
+  free (topo->routes);
+  free (topo->neighs);
+  free (topo->buf);
+  free (topo);
+
+  return (EXIT_SUCCESS);
+}
+
+// Open a netlink socket subscribed to changes of interfaces, IPv4 addresses, IPv4 routes
+// and neighbors, and read the kernel's tables of them.
+topology *
+topo_open (void)
+{
+  int size;
+  topology *topo;
+  struct sockaddr_nl sa;
+
+  topo = (topology *) calloc (1, sizeof (topology));
+  if (topo == NULL) {
+    fprintf (stderr, "ERROR: Cannot allocate memory for struct topology.\n");
+    exit (EXIT_FAILURE);
+  }
+  topo->links = (link_entry *) calloc (MAX_IFACES, sizeof (link_entry));
+  topo->addrs = (addr_entry *) calloc (MAX_ADDRS, sizeof (addr_entry));
+  topo->routes = (route_entry *) calloc (MAX_ROUTES, sizeof (route_entry));
+  topo->neighs = (neigh_entry *) calloc (MAX_NEIGHS, sizeof (neigh_entry));
+  if ((topo->links == NULL) || (topo->addrs == NULL) || (topo->routes == NULL) || (topo->neighs == NULL)) {
+    fprintf (stderr, "ERROR: Cannot allocate memory for tables.\n");
+    exit (EXIT_FAILURE);
+  }
+  topo->buf = allocate_ustrmem (NL_BUFLEN);
+
+  // Submit request for a netlink socket descriptor.
+  if ((topo->sd = socket (AF_NETLINK, SOCK_RAW, NETLINK_ROUTE)) < 0) {
+    perror ("socket() failed to get netlink socket descriptor ");
+    exit (EXIT_FAILURE);
+  }
+
+  // Make room for bursts of notifications, such as when an interface goes down.
+  // SO_RCVBUFFORCE may exceed net.core.rmem_max, but needs CAP_NET_ADMIN.
+  size = NL_RCVBUF;
+  if (setsockopt (topo->sd, SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof (size)) < 0) {
+    if (setsockopt (topo->sd, SOL_SOCKET, SO_RCVBUF, &size, sizeof (size)) < 0) {
+      perror ("setsockopt() failed to set SO_RCVBUF ");
+      exit (EXIT_FAILURE);
+    }
+  }
+
+  // Subscribe to changes before reading the tables, so that none are missed in between.
+  memset (&sa, 0, sizeof (sa));
+  sa.nl_family = AF_NETLINK;
+  sa.nl_groups = RTMGRP_LINK | RTMGRP_IPV4_IFADDR | RTMGRP_IPV4_ROUTE | RTMGRP_NEIGH;
+  if (bind (topo->sd, (struct sockaddr *) &sa, sizeof (sa)) < 0) {
+    perror ("bind() failed to subscribe to rtnetlink groups ");
+    exit (EXIT_FAILURE);
+  }
+
+  topo_dump (topo);
+
+  return (topo);
+}
+
+// Read the kernel's tables of interfaces, IPv4 addresses, routes and neighbors.
+// The kernel dumps one table at a time on a socket, so the four are asked for in turn,
+// each as the last is done. As dumps share the socket with notifications, we get
+// both in the order the kernel made them. If a table changed while it was dumped,
+// or notifications were lost, we start over.
+void
+topo_dump (topology *topo)
+{
+  int i;
+  uint32_t seq;
+  uint16_t type[4] = {RTM_GETLINK, RTM_GETADDR, RTM_GETROUTE, RTM_GETNEIGH};
+  int len[4] = {sizeof (struct ifinfomsg), sizeof (struct ifaddrmsg), sizeof (struct rtmsg), sizeof (struct ndmsg)};
+  union {
+    struct ifinfomsg ifi;
+    struct ifaddrmsg ifa;
+    struct rtmsg rtm;
+    struct ndmsg ndm;
+  } req;
+
+  do {
+    topo->nlinks = 0;
+    topo->naddrs = 0;
+    topo->nroutes = 0;
+    topo->nneighs = 0;
+    topo->dropped = 0;
+    topo->intr = 0;
+    topo->lost = 0;
+
+    for (i=0; i<4; i++) {
+
+      // Address family is the first member of each request: all interfaces, but IPv4 otherwise.
+      memset (&req, 0, sizeof (req));
+      req.rtm.rtm_family = (type[i] == RTM_GETLINK) ? AF_UNSPEC : AF_INET;
+      seq = nl_send (topo, type[i], NLM_F_DUMP, &req, len[i]);
+      while (topo_recv (topo, 1, seq) != 1);
+    }
+  } while ((topo->intr != 0) || (topo->lost != 0));
+}
+
+// Apply all notifications waiting, without blocking. If any were lost, read the tables
+// again. Returns the number of datagrams read.
+int
+topo_poll (topology *topo)
+{
+  int n;
+
+  n = 0;
+  while (topo_recv (topo, 0, 0) >= 0) {
+    n++;
+  }
+
+  if (topo->lost != 0) {
+    fprintf (stderr, "Notifications of changes were lost: reading tables again.\n");
+    topo_dump (topo);
+  }
+
+  return (n);
+}
+
+// Receive one datagram of netlink messages, and apply them to the tables.
+// If block is 0 and none is waiting, returns -1 at once. Returns 1 if the datagram
+// ended the reply to request seq (or reported its error), and 0 otherwise.
+int
+topo_recv (topology *topo, int block, uint32_t seq)
+{
+  int len, done;
+  struct nlmsghdr *nh;
+  struct nlmsgerr *err;
+
+  if ((len = recv (topo->sd, topo->buf, NL_BUFLEN, (block == 0) ? MSG_DONTWAIT : 0)) < 0) {
+    if ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR)) {
+      return (-1);
+    }
+
+    // Socket receive buffer overran: notifications are lost, and the tables must be read again.
+    if (errno == ENOBUFS) {
+      topo->lost = 1;
+      return (0);
+    }
+    perror ("recv() failed on netlink socket ");
+    exit (EXIT_FAILURE);
+  }
+
+  done = 0;
+  for (nh = (struct nlmsghdr *) topo->buf; NLMSG_OK (nh, len); nh = NLMSG_NEXT (nh, len)) {
+    if (nh->nlmsg_flags & NLM_F_DUMP_INTR) {
+      topo->intr = 1;
+    }
+    if (nh->nlmsg_type == NLMSG_DONE) {
+      if (nh->nlmsg_seq == seq) {
+        done = 1;
+      }
+    } else if (nh->nlmsg_type == NLMSG_ERROR) {
+      err = (struct nlmsgerr *) NLMSG_DATA (nh);
+      if (err->error != 0) {
+        fprintf (stderr, "Netlink request %u failed: %s\n", nh->nlmsg_seq, strerror (-err->error));
+      }
+      if (nh->nlmsg_seq == seq) {
+        done = 1;
+      }
+    } else {
+      topo_msg (topo, nh);
+    }
+  }
+
+  return (done);
+}
+
+// Send a netlink request to the kernel, with msg (len bytes) after the header.
+// Returns its sequence number.
+uint32_t
+nl_send (topology *topo, uint16_t type, uint16_t flags, void *msg, int len)
+{
+  uint8_t req[NLMSG_SPACE (128)];
+  struct nlmsghdr *nh;
+  struct sockaddr_nl sa;
+
+  memset (req, 0, sizeof (req));
+  nh = (struct nlmsghdr *) req;
+  nh->nlmsg_len = NLMSG_LENGTH (len);
+  nh->nlmsg_type = type;
+  nh->nlmsg_flags = NLM_F_REQUEST | flags;
+  nh->nlmsg_seq = ++topo->seq;
+  memcpy (NLMSG_DATA (nh), msg, len);
+
+  // Kernel's netlink address: all zeros.
+  memset (&sa, 0, sizeof (sa));
+  sa.nl_family = AF_NETLINK;
+
+  if (sendto (topo->sd, req, nh->nlmsg_len, 0, (struct sockaddr *) &sa, sizeof (sa)) < 0) {
+    perror ("sendto() failed to send netlink request ");
+    exit (EXIT_FAILURE);
+  }
+
+  return (nh->nlmsg_seq);
+}
+
+// Index the attributes of a message by type, up to type max.
+void
+parse_rtattr (struct rtattr **tb, int max, struct rtattr *rta, int len)
+{
+  memset (tb, 0, (max + 1) * sizeof (struct rtattr *));
+  for (; RTA_OK (rta, len); rta = RTA_NEXT (rta, len)) {
+    if (rta->rta_type <= max) {
+      tb[rta->rta_type] = rta;
+    }
+  }
+}
+
+// Apply a message from a dump, or a notification, to the tables.
+void
+topo_msg (topology *topo, struct nlmsghdr *nh)
+{
+  switch (nh->nlmsg_type) {
+    case RTM_NEWLINK:
+    case RTM_DELLINK:
+      link_msg (topo, nh);
+      break;
+    case RTM_NEWADDR:
+    case RTM_DELADDR:
+      addr_msg (topo, nh);
+      break;
+    case RTM_NEWROUTE:
+    case RTM_DELROUTE:
+      route_msg (topo, nh);
+      break;
+    case RTM_NEWNEIGH:
+    case RTM_DELNEIGH:
+      neigh_msg (topo, nh);
+      break;
+  }
+}
+
+// Apply a new, changed or deleted interface.
+void
+link_msg (topology *topo, struct nlmsghdr *nh)
+{
+  int len;
+  struct ifinfomsg *ifi;
+  struct rtattr *tb[IFLA_MAX + 1];
+  link_entry e, *link;
+
+  ifi = (struct ifinfomsg *) NLMSG_DATA (nh);
+  len = nh->nlmsg_len - NLMSG_LENGTH (sizeof (*ifi));
+
+  // Bridge ports are also reported, with address family AF_BRIDGE: skip them.
+  if ((len < 0) || (ifi->ifi_family != AF_UNSPEC)) {
+    return;
+  }
+  parse_rtattr (tb, IFLA_MAX, IFLA_RTA (ifi), len);
+
+  memset (&e, 0, sizeof (e));
+  e.index = ifi->ifi_index;
+  e.type = ifi->ifi_type;
+  e.flags = ifi->ifi_flags;
+  if (tb[IFLA_IFNAME] != NULL) {
+    snprintf (e.name, IFNAMSIZ, "%s", (char *) RTA_DATA (tb[IFLA_IFNAME]));
+  }
+  if (tb[IFLA_MTU] != NULL) {
+    e.mtu = *(uint32_t *) RTA_DATA (tb[IFLA_MTU]);
+  }
+  if ((tb[IFLA_ADDRESS] != NULL) && (RTA_PAYLOAD (tb[IFLA_ADDRESS]) == 6)) {
+    e.halen = 6;
+    memcpy (e.mac, RTA_DATA (tb[IFLA_ADDRESS]), 6 * sizeof (uint8_t));
+  }
+  if (topo->watch != 0) {
+    print_link ((nh->nlmsg_type == RTM_DELLINK) ? "- " : "+ ", &e);
+  }
+
+  link = find_link (topo, e.index);
+  if (nh->nlmsg_type == RTM_DELLINK) {
+    if (link != NULL) {
+      *link = topo->links[--topo->nlinks];
+    }
+    drop_link (topo, e.index);
+    return;
+  }
+  if (link == NULL) {
+    if (topo->nlinks == MAX_IFACES) {
+      topo->dropped++;
+      return;
+    }
+    link = &topo->links[topo->nlinks++];
+  }
+  *link = e;
+
+  // An interface's routes go when it goes down, without notifications.
+  if ((e.flags & IFF_UP) == 0) {
+    drop_link (topo, e.index);
+  }
+}
+
+// Apply a new or deleted IPv4 address.
+void
+addr_msg (topology *topo, struct nlmsghdr *nh)
+{
+  int i, len;
+  struct ifaddrmsg *ifa;
+  struct rtattr *tb[IFA_MAX + 1], *rta;
+  addr_entry e, *a;
+
+  ifa = (struct ifaddrmsg *) NLMSG_DATA (nh);
+  len = nh->nlmsg_len - NLMSG_LENGTH (sizeof (*ifa));
+  if ((len < 0) || (ifa->ifa_family != AF_INET)) {
+    return;
+  }
+  parse_rtattr (tb, IFA_MAX, IFA_RTA (ifa), len);
+
+  // IFA_LOCAL is the interface's own address; IFA_ADDRESS is the peer's on a point-to-point link.
+  rta = (tb[IFA_LOCAL] != NULL) ? tb[IFA_LOCAL] : tb[IFA_ADDRESS];
+  if (rta == NULL) {
+    return;
+  }
+  memset (&e, 0, sizeof (e));
+  e.index = ifa->ifa_index;
+  e.prefixlen = ifa->ifa_prefixlen;
+  memcpy (&e.addr, RTA_DATA (rta), sizeof (e.addr));
+  if (topo->watch != 0) {
+    print_addr ((nh->nlmsg_type == RTM_DELADDR) ? "- " : "+ ", topo, &e);
+  }
+
+  a = NULL;
+  for (i=0; i<topo->naddrs; i++) {
+    if ((topo->addrs[i].index == e.index) && (topo->addrs[i].prefixlen == e.prefixlen)
+        && (topo->addrs[i].addr.s_addr == e.addr.s_addr)) {
+      a = &topo->addrs[i];
+      break;
+    }
+  }
+  if (nh->nlmsg_type == RTM_DELADDR) {
+    if (a != NULL) {
+      *a = topo->addrs[--topo->naddrs];
+    }
+    return;
+  }
+  if (a == NULL) {
+    if (topo->naddrs == MAX_ADDRS) {
+      topo->dropped++;
+      return;
+    }
+    a = &topo->addrs[topo->naddrs++];
+  }
+  *a = e;
+}
+
+// Apply a new or deleted IPv4 route.
+void
+route_msg (topology *topo, struct nlmsghdr *nh)
+{
+  int i, len;
+  uint32_t table;
+  struct rtmsg *rtm;
+  struct rtattr *tb[RTA_MAX + 1], *nt[RTA_MAX + 1];
+  struct rtnexthop *rtnh;
+  route_entry e, *r;
+
+  rtm = (struct rtmsg *) NLMSG_DATA (nh);
+  len = nh->nlmsg_len - NLMSG_LENGTH (sizeof (*rtm));
+  if ((len < 0) || (rtm->rtm_family != AF_INET)) {
+    return;
+  }
+  parse_rtattr (tb, RTA_MAX, RTM_RTA (rtm), len);
+
+  // Keep only the local and main tables. Table IDs above 255 are only in RTA_TABLE.
+  table = rtm->rtm_table;
+  if (tb[RTA_TABLE] != NULL) {
+    table = *(uint32_t *) RTA_DATA (tb[RTA_TABLE]);
+  }
+  if (((table != RT_TABLE_MAIN) && (table != RT_TABLE_LOCAL)) || (rtm->rtm_flags & RTM_F_CLONED)) {
+    return;
+  }
+
+  memset (&e, 0, sizeof (e));
+  e.table = table;
+  e.dst_len = rtm->rtm_dst_len;
+  e.tos = rtm->rtm_tos;
+  e.type = rtm->rtm_type;
+  if (tb[RTA_DST] != NULL) {
+    memcpy (&e.dst, RTA_DATA (tb[RTA_DST]), sizeof (e.dst));
+  }
+  if (tb[RTA_PRIORITY] != NULL) {
+    e.priority = *(uint32_t *) RTA_DATA (tb[RTA_PRIORITY]);
+  }
+  if (tb[RTA_GATEWAY] != NULL) {
+    memcpy (&e.gateway, RTA_DATA (tb[RTA_GATEWAY]), sizeof (e.gateway));
+  }
+  if (tb[RTA_PREFSRC] != NULL) {
+    memcpy (&e.prefsrc, RTA_DATA (tb[RTA_PREFSRC]), sizeof (e.prefsrc));
+  }
+  if (tb[RTA_OIF] != NULL) {
+    e.oif = *(int *) RTA_DATA (tb[RTA_OIF]);
+  }
+
+  // Of a route with several next hops (multipath), we use the first.
+  if (tb[RTA_MULTIPATH] != NULL) {
+    rtnh = (struct rtnexthop *) RTA_DATA (tb[RTA_MULTIPATH]);
+    len = RTA_PAYLOAD (tb[RTA_MULTIPATH]);
+    if ((len >= (int) sizeof (*rtnh)) && RTNH_OK (rtnh, len)) {
+      e.oif = rtnh->rtnh_ifindex;
+      parse_rtattr (nt, RTA_MAX, RTNH_DATA (rtnh), rtnh->rtnh_len - RTNH_LENGTH (0));
+      if (nt[RTA_GATEWAY] != NULL) {
+        memcpy (&e.gateway, RTA_DATA (nt[RTA_GATEWAY]), sizeof (e.gateway));
+      }
+    }
+  }
+  if (topo->watch != 0) {
+    print_route ((nh->nlmsg_type == RTM_DELROUTE) ? "- " : "+ ", topo, &e);
+  }
+
+  // A route is known by its table, prefix, type of service and metric, and by its
+  // interface and gateway: the same prefix may be routed at the same metric through
+  // several interfaces (or, appended, through several gateways).
+  r = NULL;
+  for (i=0; i<topo->nroutes; i++) {
+    if ((topo->routes[i].table == e.table) && (topo->routes[i].dst.s_addr == e.dst.s_addr) && (topo->routes[i].dst_len == e.dst_len)
+        && (topo->routes[i].tos == e.tos) && (topo->routes[i].priority == e.priority)
+        && (topo->routes[i].oif == e.oif) && (topo->routes[i].gateway.s_addr == e.gateway.s_addr)) {
+      r = &topo->routes[i];
+      break;
+    }
+  }
+
+  // Routes are kept in the kernel's order, as of equal routes topo_route() takes the first.
+  if (nh->nlmsg_type == RTM_DELROUTE) {
+    if (r != NULL) {
+      topo->nroutes--;
+      memmove (r, r + 1, (topo->nroutes - (r - topo->routes)) * sizeof (route_entry));
+    }
+    return;
+  }
+  if (r == NULL) {
+    if (topo->nroutes == MAX_ROUTES) {
+      topo->dropped++;
+      return;
+    }
+    r = &topo->routes[topo->nroutes++];
+  }
+  *r = e;
+}
+
+// Apply a new, changed or deleted IPv4 neighbor.
+void
+neigh_msg (topology *topo, struct nlmsghdr *nh)
+{
+  int i, len;
+  struct ndmsg *ndm;
+  struct rtattr *tb[NDA_MAX + 1];
+  neigh_entry e, *n;
+
+  ndm = (struct ndmsg *) NLMSG_DATA (nh);
+  len = nh->nlmsg_len - NLMSG_LENGTH (sizeof (*ndm));
+
+  // Proxy entries are addresses we answer ARP for, not neighbors.
+  if ((len < 0) || (ndm->ndm_family != AF_INET) || (ndm->ndm_flags & NTF_PROXY)) {
+    return;
+  }
+  parse_rtattr (tb, NDA_MAX, NDA_RTA (ndm), len);
+  if (tb[NDA_DST] == NULL) {
+    return;
+  }
+
+  memset (&e, 0, sizeof (e));
+  e.index = ndm->ndm_ifindex;
+  e.state = ndm->ndm_state;
+  memcpy (&e.addr, RTA_DATA (tb[NDA_DST]), sizeof (e.addr));
+  if ((tb[NDA_LLADDR] != NULL) && (RTA_PAYLOAD (tb[NDA_LLADDR]) == 6)) {
+    e.halen = 6;
+    memcpy (e.mac, RTA_DATA (tb[NDA_LLADDR]), 6 * sizeof (uint8_t));
+  }
+  if (topo->watch != 0) {
+    print_neigh ((nh->nlmsg_type == RTM_DELNEIGH) ? "- " : "+ ", topo, &e);
+  }
+
+  n = NULL;
+  for (i=0; i<topo->nneighs; i++) {
+    if ((topo->neighs[i].index == e.index) && (topo->neighs[i].addr.s_addr == e.addr.s_addr)) {
+      n = &topo->neighs[i];
+      break;
+    }
+  }
+  if (nh->nlmsg_type == RTM_DELNEIGH) {
+    if (n != NULL) {
+      *n = topo->neighs[--topo->nneighs];
+    }
+    return;
+  }
+  if (n == NULL) {
+    if (topo->nneighs == MAX_NEIGHS) {
+      topo->dropped++;
+      return;
+    }
+    n = &topo->neighs[topo->nneighs++];
+  }
+  *n = e;
+}
+
+// Drop the routes and neighbors of an interface which went down or away.
+void
+drop_link (topology *topo, int index)
+{
+  int i;
+
+  for (i=0; i<topo->nroutes; i++) {
+    if (topo->routes[i].oif == index) {
+      topo->routes[i--] = topo->routes[--topo->nroutes];
+    }
+  }
+  for (i=0; i<topo->nneighs; i++) {
+    if (topo->neighs[i].index == index) {
+      topo->neighs[i--] = topo->neighs[--topo->nneighs];
+    }
+  }
+}
+
+// Find an interface by index. Returns NULL if there is none.
+link_entry *
+find_link (topology *topo, int index)
+{
+  int i;
+
+  for (i=0; i<topo->nlinks; i++) {
+    if (topo->links[i].index == index) {
+      return (&topo->links[i]);
+    }
+  }
+
+  return (NULL);
+}
+
+// Find the way to dst: of the routes whose prefix matches, the longest, and of those,
+// the one of lowest metric. As in the kernel, the local table is searched first, and
+// a match there means dst is this host. Fills out hop with the route's interface,
+// source address, and next hop (gateway, or dst itself if on-link). Returns 0, or -1 if
+// there is no route, the route is not unicast (local, blackhole, unreachable, ...), or
+// there is no source address.
+int
+topo_route (topology *topo, struct in_addr dst, next_hop *hop)
+{
+  int i, best, found;
+  uint32_t mask;
+  route_entry *r, *b;
+  addr_entry *a;
+  link_entry *link;
+
+  best = -1;
+  for (i=0; i<topo->nroutes; i++) {
+    r = &topo->routes[i];
+    mask = (r->dst_len == 0) ? 0 : htonl (0xffffffffU << (32 - r->dst_len));
+    if (((dst.s_addr & mask) != r->dst.s_addr) || (r->tos != 0)) {
+      continue;
+    }
+    if (best >= 0) {
+      b = &topo->routes[best];
+
+      // A match in the local table beats any in the main table.
+      if ((b->table == RT_TABLE_LOCAL) && (r->table != RT_TABLE_LOCAL)) {
+        continue;
+      }
+      if ((b->table == r->table) && ((r->dst_len < b->dst_len)
+          || ((r->dst_len == b->dst_len) && (r->priority >= b->priority)))) {
+        continue;
+      }
+    }
+    best = i;
+  }
+  if ((best < 0) || (topo->routes[best].type != RTN_UNICAST)) {
+    return (-1);
+  }
+  r = &topo->routes[best];
+  if ((link = find_link (topo, r->oif)) == NULL) {
+    return (-1);
+  }
+
+  memset (hop, 0, sizeof (*hop));
+  hop->index = link->index;
+  hop->type = link->type;
+  memcpy (hop->name, link->name, IFNAMSIZ);
+  memcpy (hop->src_mac, link->mac, 6 * sizeof (uint8_t));
+  hop->via = (r->gateway.s_addr != 0) ? r->gateway : dst;
+
+  // Source address: the route's preferred source address if it has one, otherwise an
+  // address of the interface on the next hop's subnet, otherwise its first address.
+  if (r->prefsrc.s_addr != 0) {
+    hop->src = r->prefsrc;
+    return (0);
+  }
+  found = 0;
+  for (i=0; i<topo->naddrs; i++) {
+    a = &topo->addrs[i];
+    if (a->index != hop->index) {
+      continue;
+    }
+    mask = (a->prefixlen == 0) ? 0 : htonl (0xffffffffU << (32 - a->prefixlen));
+    if ((a->addr.s_addr & mask) == (hop->via.s_addr & mask)) {
+      hop->src = a->addr;
+      return (0);
+    }
+    if (found == 0) {
+      hop->src = a->addr;
+      found = 1;
+    }
+  }
+
+  return ((found != 0) ? 0 : -1);
+}
+
+// Find the MAC address of the next hop in the neighbor table.
+// Returns 0, or -1 if it is not there (or not yet, or no longer, usable).
+int
+topo_neigh (topology *topo, next_hop *hop)
+{
+  int i;
+  neigh_entry *n;
+
+  for (i=0; i<topo->nneighs; i++) {
+    n = &topo->neighs[i];
+    if ((n->index == hop->index) && (n->addr.s_addr == hop->via.s_addr)) {
+      if ((n->state & NUD_VALID) && (n->halen == 6)) {
+        memcpy (hop->dst_mac, n->mac, 6 * sizeof (uint8_t));
+        return (0);
+      }
+      return (-1);
+    }
+  }
+
+  return (-1);
+}
+
+// Ask the kernel to resolve the next hop's MAC address, as it would if it had a packet
+// to send there (NTF_USE), without waiting: we are notified of the result.
+void
+topo_resolve (topology *topo, next_hop *hop)
+{
+  struct {
+    struct ndmsg ndm;
+    struct rtattr rta;
+    struct in_addr dst;
+  } req;
+
+  memset (&req, 0, sizeof (req));
+  req.ndm.ndm_family = AF_INET;
+  req.ndm.ndm_ifindex = hop->index;
+  req.ndm.ndm_flags = NTF_USE;
+  req.rta.rta_type = NDA_DST;
+  req.rta.rta_len = RTA_LENGTH (sizeof (req.dst));
+  req.dst = hop->via;
+
+  nl_send (topo, RTM_NEWNEIGH, NLM_F_CREATE | NLM_F_REPLACE, &req, sizeof (req));
+}
+
+// Apply notifications until the next hop's MAC address is known, for up to ms milliseconds.
+// Returns 0, or -1 if it is not known in time.
+int
+topo_wait (topology *topo, next_hop *hop, int ms)
+{
+  int remaining;
+  struct pollfd pfd;
+  struct timespec t1, t2;
+
+  clock_gettime (CLOCK_MONOTONIC, &t1);
+  while (topo_neigh (topo, hop) < 0) {
+    clock_gettime (CLOCK_MONOTONIC, &t2);
+    remaining = ms - ((t2.tv_sec - t1.tv_sec) * 1000 + (t2.tv_nsec - t1.tv_nsec) / 1000000);
+    if ((remaining <= 0) || (stop != 0)) {
+      return (-1);
+    }
+    pfd.fd = topo->sd;
+    pfd.events = POLLIN;
+    if ((poll (&pfd, 1, remaining) < 0) && (errno != EINTR)) {
+      perror ("poll() failed ");
+      exit (EXIT_FAILURE);
+    }
+    topo_poll (topo);
+  }
+
+  return (0);
+}
+
+// Report the tables.
+void
+topo_print (topology *topo)
+{
+  int i;
+
+  for (i=0; i<topo->nlinks; i++) {
+    print_link ("  ", &topo->links[i]);
+  }
+  for (i=0; i<topo->naddrs; i++) {
+    print_addr ("  ", topo, &topo->addrs[i]);
+  }
+  for (i=0; i<topo->nroutes; i++) {
+    print_route ("  ", topo, &topo->routes[i]);
+  }
+  for (i=0; i<topo->nneighs; i++) {
+    print_neigh ("  ", topo, &topo->neighs[i]);
+  }
+  if (topo->dropped > 0) {
+    printf ("  %i entries dropped: tables full\n", topo->dropped);
+  }
+}
+
+// Report an interface.
+void
+print_link (char *prefix, link_entry *link)
+{
+  printf ("%slink %i %s mtu %u %s", prefix, link->index, link->name, link->mtu,
+          (link->flags & IFF_UP) ? "up" : "down");
+  if (link->halen == 6) {
+    printf (" lladdr %02x:%02x:%02x:%02x:%02x:%02x",
+            link->mac[0], link->mac[1], link->mac[2], link->mac[3], link->mac[4], link->mac[5]);
+  }
+  printf ("\n");
+}
+
+// Report an IPv4 address.
+void
+print_addr (char *prefix, topology *topo, addr_entry *a)
+{
+  char ip[INET_ADDRSTRLEN];
+
+  inet_ntop (AF_INET, &a->addr, ip, INET_ADDRSTRLEN);
+  printf ("%saddr %s/%i dev %s\n", prefix, ip, a->prefixlen, link_name (topo, a->index));
+}
+
+// Report a route.
+void
+print_route (char *prefix, topology *topo, route_entry *r)
+{
+  char ip[INET_ADDRSTRLEN];
+
+  inet_ntop (AF_INET, &r->dst, ip, INET_ADDRSTRLEN);
+  printf ("%sroute %s/%i", prefix, ip, r->dst_len);
+  if (r->table == RT_TABLE_LOCAL) {
+    printf (" table local");
+  }
+  if (r->type != RTN_UNICAST) {
+    printf (" type %i", r->type);
+  }
+  if (r->gateway.s_addr != 0) {
+    inet_ntop (AF_INET, &r->gateway, ip, INET_ADDRSTRLEN);
+    printf (" via %s", ip);
+  }
+  if (r->oif != 0) {
+    printf (" dev %s", link_name (topo, r->oif));
+  }
+  if (r->prefsrc.s_addr != 0) {
+    inet_ntop (AF_INET, &r->prefsrc, ip, INET_ADDRSTRLEN);
+    printf (" src %s", ip);
+  }
+  if (r->priority != 0) {
+    printf (" metric %u", r->priority);
+  }
+  printf ("\n");
+}
+
+// Report a neighbor.
+void
+print_neigh (char *prefix, topology *topo, neigh_entry *n)
+{
+  char ip[INET_ADDRSTRLEN];
+
+  inet_ntop (AF_INET, &n->addr, ip, INET_ADDRSTRLEN);
+  printf ("%sneigh %s dev %s", prefix, ip, link_name (topo, n->index));
+  if (n->halen == 6) {
+    printf (" lladdr %02x:%02x:%02x:%02x:%02x:%02x",
+            n->mac[0], n->mac[1], n->mac[2], n->mac[3], n->mac[4], n->mac[5]);
+  }
+  printf (" %s\n", neigh_state (n->state));
+}
+
+// Name of an interface, or "?" if we do not know it.
+char *
+link_name (topology *topo, int index)
+{
+  link_entry *link;
+
+  if ((link = find_link (topo, index)) == NULL) {
+    return ("?");
+  }
+
+  return (link->name);
+}
+
+// Name of a neighbor state.
+char *
+neigh_state (uint16_t state)
+{
+  if (state & NUD_PERMANENT) return ("PERMANENT");
+  if (state & NUD_NOARP) return ("NOARP");
+  if (state & NUD_REACHABLE) return ("REACHABLE");
+  if (state & NUD_STALE) return ("STALE");
+  if (state & NUD_DELAY) return ("DELAY");
+  if (state & NUD_PROBE) return ("PROBE");
+  if (state & NUD_INCOMPLETE) return ("INCOMPLETE");
+  if (state & NUD_FAILED) return ("FAILED");
+
+  return ("NONE");
+}
+
+// Create a TCP ethernet frame.
+int
+create_tcp_frame (uint8_t *snd_ether_frame, char *src_ip, char *dst_ip, uint8_t *src_mac, uint8_t *dst_mac,
+                  int ttl, uint8_t *data, int datalen)
+{
+  int i, status, *ip_flags, *tcp_flags;
+  struct ip iphdr;
+  struct tcphdr tcphdr;
+
+  // Allocate memory for various arrays.
+  ip_flags = allocate_intmem (4);
+  tcp_flags = allocate_intmem (8);
+
+  // IPv4 header
+
+  // IPv4 header length (4 bits): Number of 32-bit words in header = 5
+  iphdr.ip_hl = IP4_HDRLEN / sizeof (uint32_t);
+
+  // Internet Protocol version (4 bits): IPv4
+  iphdr.ip_v = 4;
+
+  // Type of service (8 bits)
+  iphdr.ip_tos = 0;
+
+  // Total length of datagram (16 bits): IP header + TCP header + data
+  iphdr.ip_len = htons (IP4_HDRLEN + TCP_HDRLEN + datalen);
+
+  // ID sequence number (16 bits): unused, since single datagram
+  iphdr.ip_id = htons (0);
+
+  // Flags, and Fragmentation offset (3, 13 bits): 0 since single datagram
+
+  // Zero (1 bit)
+  ip_flags[0] = 0;
+
+  // Do not fragment flag (1 bit)
+  ip_flags[1] = 0;
+
+  // More fragments following flag (1 bit)
+  ip_flags[2] = 0;
+
+  // Fragmentation offset (13 bits)
+  ip_flags[3] = 0;
+
+  iphdr.ip_off = htons ((ip_flags[0] << 15)
+                      + (ip_flags[1] << 14)
+                      + (ip_flags[2] << 13)
+                      +  ip_flags[3]);
+
+  // Time-to-Live (8 bits): default to maximum value
+  iphdr.ip_ttl = ttl;
+
+  // Transport layer protocol (8 bits): 6 for TCP
+  iphdr.ip_p = IPPROTO_TCP;
+
+  // Source IPv4 address (32 bits)
+  if ((status = inet_pton (AF_INET, src_ip, &(iphdr.ip_src))) != 1) {
+    fprintf (stderr, "inet_pton() failed.\nError message: %s", strerror (status));
+    exit (EXIT_FAILURE);
+  }
+
+  // Destination IPv4 address (32 bits)
+  if ((status = inet_pton (AF_INET, dst_ip, &(iphdr.ip_dst))) != 1) {
+    fprintf (stderr, "inet_pton() failed.\nError message: %s", strerror (status));
+    exit (EXIT_FAILURE);
+  }
+
+  // IPv4 header checksum (16 bits): set to 0 when calculating checksum
+  iphdr.ip_sum = 0;
+  iphdr.ip_sum = checksum ((uint16_t *) &iphdr, IP4_HDRLEN);
+
+  // TCP header
+
+  // Source port number (16 bits)
+  tcphdr.th_sport = htons (80);
+
+  // Destination port number (16 bits)
+  tcphdr.th_dport = htons (80);
+
+  // Sequence number (32 bits)
+  tcphdr.th_seq = htonl (0);
+
+  // Acknowledgement number (32 bits): 0 in first packet of SYN/ACK process
+  tcphdr.th_ack = htonl (0);
+
+  // Reserved (4 bits): should be 0
+  tcphdr.th_x2 = 0;
+
+  // Data offset (4 bits): size of TCP header in 32-bit words
+  tcphdr.th_off = TCP_HDRLEN / 4;
+
+  // Flags (8 bits)
+
+  // FIN flag (1 bit)
+  tcp_flags[0] = 0;
+
+  // SYN flag (1 bit): set to 1
+  tcp_flags[1] = 1;
+
+  // RST flag (1 bit)
+  tcp_flags[2] = 0;
+
+  // PSH flag (1 bit)
+  tcp_flags[3] = 0;
+
+  // ACK flag (1 bit)
+  tcp_flags[4] = 0;
+
+  // URG flag (1 bit)
+  tcp_flags[5] = 0;
+
+  // ECE flag (1 bit)
+  tcp_flags[6] = 0;
+
+  // CWR flag (1 bit)
+  tcp_flags[7] = 0;
+
+  tcphdr.th_flags = 0;
+  for (i=0; i<8; i++) {
+    tcphdr.th_flags += (tcp_flags[i] << i);
+  }
+
+  // Window size (16 bits)
+  tcphdr.th_win = htons (65535);
+
+  // Urgent pointer (16 bits): 0 (only valid if URG flag is set)
+  tcphdr.th_urp = htons (0);
+
+  // TCP checksum (16 bits)
+  tcphdr.th_sum = tcp4_checksum (iphdr, tcphdr, data, datalen);
+
+  // Fill out ethernet frame header.
+
+  // Destination and Source MAC addresses
+  memcpy (snd_ether_frame, dst_mac, 6 * sizeof (uint8_t));
+  memcpy (snd_ether_frame + 6, src_mac, 6 * sizeof (uint8_t));
+
+  // Next is ethernet type code (ETH_P_IP for IPv4).
+  // http://www.iana.org/assignments/ethernet-numbers
+  snd_ether_frame[12] = ETH_P_IP / 256;
+  snd_ether_frame[13] = ETH_P_IP % 256;
+
+  // Next is ethernet frame data (IPv4 header + TCP header).
+
+  // IPv4 header
+  memcpy (snd_ether_frame + ETH_HDRLEN, &iphdr, IP4_HDRLEN * sizeof (uint8_t));
+
+  // TCP header
+  memcpy (snd_ether_frame + ETH_HDRLEN + IP4_HDRLEN, &tcphdr, TCP_HDRLEN * sizeof (uint8_t));
+
+  // TCP data
+  memcpy (snd_ether_frame + ETH_HDRLEN + IP4_HDRLEN + TCP_HDRLEN, data, datalen * sizeof (uint8_t));
+
+  // Free allocated memory.
+  free (ip_flags);
+  free (tcp_flags);
+
+  return (EXIT_SUCCESS);
+}
+
+// Checksum function
+uint16_t
+checksum (uint16_t *addr, int len)
+{
+  int nleft = len;
+  int sum = 0;
+  uint16_t *w = addr;
+  uint16_t answer = 0;
+
+  while (nleft > 1) {
+    sum += *w++;
+    nleft -= sizeof (uint16_t);
+  }
+
+  if (nleft == 1) {
+    *(uint8_t *) (&answer) = *(uint8_t *) w;
+    sum += answer;
+  }
+
+  sum = (sum >> 16) + (sum & 0xFFFF);
+  sum += (sum >> 16);
+  answer = ~sum;
+  return (answer);
+}
+
+// Build IPv4 TCP pseudo-header and call checksum function.
+uint16_t
+tcp4_checksum (struct ip iphdr, struct tcphdr tcphdr, uint8_t *payload, int payloadlen)
+{
+  uint16_t svalue;
+  char buf[IP_MAXPACKET], cvalue;
+  char *ptr;
+  int chksumlen = 0;
+  int i;
+
+  ptr = &buf[0];  // ptr points to beginning of buffer buf
+
+  // Copy source IP address into buf (32 bits)
+  memcpy (ptr, &iphdr.ip_src.s_addr, sizeof (iphdr.ip_src.s_addr));
+  ptr += sizeof (iphdr.ip_src.s_addr);
+  chksumlen += sizeof (iphdr.ip_src.s_addr);
+
+  // Copy destination IP address into buf (32 bits)
+  memcpy (ptr, &iphdr.ip_dst.s_addr, sizeof (iphdr.ip_dst.s_addr));
+  ptr += sizeof (iphdr.ip_dst.s_addr);
+  chksumlen += sizeof (iphdr.ip_dst.s_addr);
+
+  // Copy zero field to buf (8 bits)
+  *ptr = 0; ptr++;
+  chksumlen += 1;
+
+  // Copy transport layer protocol to buf (8 bits)
+  memcpy (ptr, &iphdr.ip_p, sizeof (iphdr.ip_p));
+  ptr += sizeof (iphdr.ip_p);
+  chksumlen += sizeof (iphdr.ip_p);
+
+  // Copy TCP length to buf (16 bits)
+  svalue = htons (sizeof (tcphdr) + payloadlen);
+  memcpy (ptr, &svalue, sizeof (svalue));
+  ptr += sizeof (svalue);
+  chksumlen += sizeof (svalue);
+
+  // Copy TCP source port to buf (16 bits)
+  memcpy (ptr, &tcphdr.th_sport, sizeof (tcphdr.th_sport));
+  ptr += sizeof (tcphdr.th_sport);
+  chksumlen += sizeof (tcphdr.th_sport);
+
+  // Copy TCP destination port to buf (16 bits)
+  memcpy (ptr, &tcphdr.th_dport, sizeof (tcphdr.th_dport));
+  ptr += sizeof (tcphdr.th_dport);
+  chksumlen += sizeof (tcphdr.th_dport);
+
+  // Copy sequence number to buf (32 bits)
+  memcpy (ptr, &tcphdr.th_seq, sizeof (tcphdr.th_seq));
+  ptr += sizeof (tcphdr.th_seq);
+  chksumlen += sizeof (tcphdr.th_seq);
+
+  // Copy acknowledgement number to buf (32 bits)
+  memcpy (ptr, &tcphdr.th_ack, sizeof (tcphdr.th_ack));
+  ptr += sizeof (tcphdr.th_ack);
+  chksumlen += sizeof (tcphdr.th_ack);
+
+  // Copy data offset to buf (4 bits) and
+  // copy reserved bits to buf (4 bits)
+  cvalue = (tcphdr.th_off << 4) + tcphdr.th_x2;
+  memcpy (ptr, &cvalue, sizeof (cvalue));
+  ptr += sizeof (cvalue);
+  chksumlen += sizeof (cvalue);
+
+  // Copy TCP flags to buf (8 bits)
+  memcpy (ptr, &tcphdr.th_flags, sizeof (tcphdr.th_flags));
+  ptr += sizeof (tcphdr.th_flags);
+  chksumlen += sizeof (tcphdr.th_flags);
+
+  // Copy TCP window size to buf (16 bits)
+  memcpy (ptr, &tcphdr.th_win, sizeof (tcphdr.th_win));
+  ptr += sizeof (tcphdr.th_win);
+  chksumlen += sizeof (tcphdr.th_win);
+
+  // Copy TCP checksum to buf (16 bits)
+  // Zero, since we don't know it yet
+  *ptr = 0; ptr++;
+  *ptr = 0; ptr++;
+  chksumlen += 2;
+
+  // Copy urgent pointer to buf (16 bits)
+  memcpy (ptr, &tcphdr.th_urp, sizeof (tcphdr.th_urp));
+  ptr += sizeof (tcphdr.th_urp);
+  chksumlen += sizeof (tcphdr.th_urp);
+
+  // Copy payload to buf
+  memcpy (ptr, payload, payloadlen);
+  ptr += payloadlen;
+  chksumlen += payloadlen;
+
+  // Pad to the next 16-bit boundary
+  for (i=0; i<payloadlen%2; i++, ptr++) {
+    *ptr = 0;
+    ptr++;
+    chksumlen++;
+  }
+
+  return checksum ((uint16_t *) buf, chksumlen);
+}
+
+// SIGINT handler: stop sending, or reporting changes.
+void
+sig_handler (int signum)
+{
+  (void) signum;
+  stop = 1;
+}
+
+// Allocate memory for an array of chars.
+char *
+allocate_strmem (int len)
+{
+  void *tmp;
+
+  if (len <= 0) {
+    fprintf (stderr, "ERROR: Cannot allocate memory because len = %i in allocate_strmem().\n", len);
+    exit (EXIT_FAILURE);
+  }
+
+  tmp = (char *) malloc (len * sizeof (char));
+  if (tmp != NULL) {
+    memset (tmp, 0, len * sizeof (char));
+    return (tmp);
+  } else {
+    fprintf (stderr, "ERROR: Cannot allocate memory for array allocate_strmem().\n");
+    exit (EXIT_FAILURE);
+  }
+}
+
+// Allocate memory for an array of unsigned chars.
+uint8_t *
+allocate_ustrmem (int len)
+{
+  void *tmp;
+
+  if (len <= 0) {
+    fprintf (stderr, "ERROR: Cannot allocate memory because len = %i in allocate_ustrmem().\n", len);
+    exit (EXIT_FAILURE);
+  }
+
+  tmp = (uint8_t *) malloc (len * sizeof (uint8_t));
+  if (tmp != NULL) {
+    memset (tmp, 0, len * sizeof (uint8_t));
+    return (tmp);
+  } else {
+    fprintf (stderr, "ERROR: Cannot allocate memory for array allocate_ustrmem().\n");
+    exit (EXIT_FAILURE);
+  }
+}
+
+// Allocate memory for an array of ints.
+int *
+allocate_intmem (int len)
+{
+  void *tmp;
+
+  if (len <= 0) {
+    fprintf (stderr, "ERROR: Cannot allocate memory because len = %i in allocate_intmem().\n", len);
+    exit (EXIT_FAILURE);
+  }
+
+  tmp = (int *) malloc (len * sizeof (int));
+  if (tmp != NULL) {
+    memset (tmp, 0, len * sizeof (int));
+    return (tmp);
+  } else {
+    fprintf (stderr, "ERROR: Cannot allocate memory for array allocate_intmem().\n");
+    exit (EXIT_FAILURE);
+  }
+}
@@ -0,0 +1,533 @@
+/*  Copyright (C) 2013  P.D. Buchan (pdbuchan@yahoo.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Send a stream of IPv4 TCP SYN packets via raw socket at the link layer (ethernet frame).
+// Need to have destination MAC address.
+// Each SYN carries the usual TCP options: maximum segment size, SACK permitted,
+// timestamp, and window scale. Which options are included, and their layout, are
+// fixed at compile time by the OPT_* macros below, so the whole option block (padding
+// included) is a constant. Only the timestamp value is patched per packet, and the TCP
+// checksum is finished from a precomputed partial sum, so a SYN with options costs
+// no more to build than a bare one.
+
+#define _GNU_SOURCE           // sendmmsg() and struct mmsghdr
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>           // close()
+#include <string.h>           // strcpy, memset(), and memcpy()
+
+#include <netdb.h>            // struct addrinfo
+#include <sys/types.h>        // needed for socket(), uint8_t, uint16_t, uint32_t
+#include <sys/socket.h>       // needed for socket(), sendmmsg()
+#include <netinet/in.h>       // IPPROTO_TCP, INET_ADDRSTRLEN
+#include <netinet/ip.h>       // struct ip and IP_MAXPACKET (which is 65535)
+#define __FAVOR_BSD           // Use BSD format of tcp header
+#include <netinet/tcp.h>      // struct tcphdr
+#include <arpa/inet.h>        // inet_pton() and inet_ntop()
+#include <sys/ioctl.h>        // macro ioctl is defined
+#include <bits/ioctls.h>      // defines values for argument "request" of ioctl.
+#include <net/if.h>           // struct ifreq
+#include <linux/if_ether.h>   // ETH_P_IP = 0x0800, ETH_P_IPV6 = 0x86DD
+#include <linux/if_packet.h>  // struct sockaddr_ll (see man 7 packet)
+#include <net/ethernet.h>
+#include <signal.h>           // signal(), SIGINT
+#include <time.h>             // clock_gettime(), clock_nanosleep()
+
+#include <errno.h>            // errno, perror()
+
+// Define some constants.
+#define ETH_HDRLEN 14         // Ethernet header length
+#define IP4_HDRLEN 20         // IPv4 header length
+#define TCP_HDRLEN 20         // TCP header length, excludes options data
+#define BATCH 64              // Number of frames handed to sendmmsg() at once
+#define MAX_FRAMELEN 128      // Room for each frame in batch
+
+// TCP options to include: set to 0 to leave one out.
+#define OPT_MSS 1             // Maximum segment size (RFC 793)
+#define OPT_SACK_PERM 1       // SACK permitted (RFC 2018)
+#define OPT_TIMESTAMP 1       // Timestamp (RFC 7323)
+#define OPT_WSCALE 1          // Window scale (RFC 7323)
+#define MSS_VALUE 1460        // Maximum segment size to advertise
+#define WSCALE_VALUE 7        // Window scale shift count to advertise
+
+// Option block, laid out as Linux does so every option falls on its natural boundary:
+// MSS, then SACK permitted sharing a word with the timestamp's kind and length,
+// then NOP + window scale. An option whose partner is left out is padded with NOPs.
+#if OPT_MSS
+#define OPT_MSS_BYTES 2, 4, (MSS_VALUE >> 8), (MSS_VALUE & 0xff),
+#define OPT_MSS_LEN 4
+#else
+#define OPT_MSS_BYTES
+#define OPT_MSS_LEN 0
+#endif
+
+#if OPT_SACK_PERM && OPT_TIMESTAMP
+#define OPT_SACKTS_BYTES 4, 2, 8, 10, 0, 0, 0, 0, 0, 0, 0, 0,
+#define OPT_SACKTS_LEN 12
+#elif OPT_TIMESTAMP
+#define OPT_SACKTS_BYTES 1, 1, 8, 10, 0, 0, 0, 0, 0, 0, 0, 0,
+#define OPT_SACKTS_LEN 12
+#elif OPT_SACK_PERM
+#define OPT_SACKTS_BYTES 1, 1, 4, 2,
+#define OPT_SACKTS_LEN 4
+#else
+#define OPT_SACKTS_BYTES
+#define OPT_SACKTS_LEN 0
+#endif
+
+#if OPT_WSCALE
+#define OPT_WSCALE_BYTES 1, 3, 3, WSCALE_VALUE,
+#define OPT_WSCALE_LEN 4
+#else
+#define OPT_WSCALE_BYTES
+#define OPT_WSCALE_LEN 0
+#endif
+
+#define OPT_LEN (OPT_MSS_LEN + OPT_SACKTS_LEN + OPT_WSCALE_LEN)  // Length of option block
+#define OPT_TSVAL (OPT_MSS_LEN + 4)  // Offset of TSval within option block (if OPT_TIMESTAMP)
+
+_Static_assert (((OPT_LEN % 4) == 0) && (OPT_LEN <= 40), "TCP option block must be whole words, at most 40 bytes");
+
+// The option block itself; the extra final byte only keeps the initializer non-empty.
+static const uint8_t tcp_options[OPT_LEN + 1] = { OPT_MSS_BYTES OPT_SACKTS_BYTES OPT_WSCALE_BYTES 0 };
+
+// Function prototypes
+uint32_t sum_bytes (uint32_t, const uint8_t *, int);
+uint16_t fold_sum (uint32_t);
+void pace (struct timespec *, long int);
+void sig_handler (int);
+char *allocate_strmem (int);
+uint8_t *allocate_ustrmem (int);
+
+// Set by SIGINT handler to stop sending.
+volatile sig_atomic_t stop = 0;
+
+int
+main (int argc, char **argv)
+{
+  int i, n, c, status, sd, frame_length, rate, count, sent;
+  char *interface, *target, *src_ip, *dst_ip;
+  uint8_t *src_mac, *dst_mac, *frames, *slot;
+  uint16_t sport;
+  uint32_t seq, tcp_base, sum;
+#if OPT_TIMESTAMP
+  uint32_t tsval;
+#endif
+  struct ip iphdr;
+  struct tcphdr tcphdr;
+  struct addrinfo hints, *res;
+  struct sockaddr_in *ipv4;
+  struct sockaddr_ll device;
+  struct ifreq ifr;
+  struct mmsghdr msgs[BATCH];
+  struct iovec iovs[BATCH];
+  struct timespec next, now, t1, t2;
+  double dt, build;
+  void *tmp;
+
+  // Allocate memory for various arrays.
+  src_mac = allocate_ustrmem (6);
+  dst_mac = allocate_ustrmem (6);
+  frames = allocate_ustrmem (BATCH * MAX_FRAMELEN);
+  interface = allocate_strmem (40);
+  target = allocate_strmem (40);
+  src_ip = allocate_strmem (INET_ADDRSTRLEN);
+  dst_ip = allocate_strmem (INET_ADDRSTRLEN);
+
+  // Interface to send packets through.
+  strcpy (interface, "eth0");
+
+  // Number of SYNs to send, and SYNs per second (0 for as fast as possible).
+  count = 1000000;
+  rate = 0;
+
+  // Submit request for a socket descriptor to look up interface.
+  if ((sd = socket (PF_PACKET, SOCK_RAW, htons (ETH_P_ALL))) < 0) {
+    perror ("socket() failed to get socket descriptor for using ioctl() ");
+    exit (EXIT_FAILURE);
+  }
+
+  // Use ioctl() to look up interface name and get its MAC address.
+  memset (&ifr, 0, sizeof (ifr));
+  snprintf (ifr.ifr_name, sizeof (ifr.ifr_name), "%s", interface);
+  if (ioctl (sd, SIOCGIFHWADDR, &ifr) < 0) {
+    perror ("ioctl() failed to get source MAC address ");
+    return (EXIT_FAILURE);
+  }
+  close (sd);
+
+  // Copy source MAC address.
+  memcpy (src_mac, ifr.ifr_hwaddr.sa_data, 6 * sizeof (uint8_t));
+
+  // Report source MAC address to stdout.
+  printf ("MAC address for interface %s is ", interface);
+  for (i=0; i<5; i++) {
+    printf ("%02x:", src_mac[i]);
+  }
+  printf ("%02x\n", src_mac[5]);
+
+  // Find interface index from interface name and store index in
+  // struct sockaddr_ll device, which will be used as an argument of sendmmsg().
+  memset (&device, 0, sizeof (device));
+  if ((device.sll_ifindex = if_nametoindex (interface)) == 0) {
+    perror ("if_nametoindex() failed to obtain interface index ");
+    exit (EXIT_FAILURE);
+  }
+  printf ("Index for interface %s is %i\n", interface, device.sll_ifindex);
+
+  // Set destination MAC address: you need to fill these out
+  dst_mac[0] = 0xff;
+  dst_mac[1] = 0xff;
+  dst_mac[2] = 0xff;
+  dst_mac[3] = 0xff;
+  dst_mac[4] = 0xff;
+  dst_mac[5] = 0xff;
+
+  // Source IPv4 address: you need to fill this out
+  strcpy (src_ip, "192.168.1.132");
+
+  // Destination URL or IPv4 address: you need to fill this out
+  strcpy (target, "www.google.com");
+
+  // Fill out hints for getaddrinfo().
+  memset (&hints, 0, sizeof (struct addrinfo));
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = hints.ai_flags | AI_CANONNAME;
+
+  // Resolve target using getaddrinfo().
+  if ((status = getaddrinfo (target, NULL, &hints, &res)) != 0) {
+    fprintf (stderr, "getaddrinfo() failed: %s\n", gai_strerror (status));
+    exit (EXIT_FAILURE);
+  }
+  ipv4 = (struct sockaddr_in *) res->ai_addr;
+  tmp = &(ipv4->sin_addr);
+  if (inet_ntop (AF_INET, tmp, dst_ip, INET_ADDRSTRLEN) == NULL) {
+    status = errno;
+    fprintf (stderr, "inet_ntop() failed.\nError message: %s", strerror (status));
+    exit (EXIT_FAILURE);
+  }
+  freeaddrinfo (res);
+
+  // Fill out sockaddr_ll.
+  device.sll_family = AF_PACKET;
+  memcpy (device.sll_addr, src_mac, 6 * sizeof (uint8_t));
+  device.sll_halen = 6;
+
+  // IPv4 header
+
+  // IPv4 header length (4 bits): Number of 32-bit words in header = 5
+  iphdr.ip_hl = IP4_HDRLEN / sizeof (uint32_t);
+
+  // Internet Protocol version (4 bits): IPv4
+  iphdr.ip_v = 4;
+
+  // Type of service (8 bits)
+  iphdr.ip_tos = 0;
+
+  // Total length of datagram (16 bits): IP header + TCP header + TCP options
+  iphdr.ip_len = htons (IP4_HDRLEN + TCP_HDRLEN + OPT_LEN);
+
+  // ID sequence number (16 bits): unused, since single datagram
+  iphdr.ip_id = htons (0);
+
+  // Flags, and Fragmentation offset (3, 13 bits): Don't Fragment
+  iphdr.ip_off = htons (IP_DF);
+
+  // Time-to-Live (8 bits): default to maximum value
+  iphdr.ip_ttl = 255;
+
+  // Transport layer protocol (8 bits): 6 for TCP
+  iphdr.ip_p = IPPROTO_TCP;
+
+  // Source IPv4 address (32 bits)
+  if ((status = inet_pton (AF_INET, src_ip, &(iphdr.ip_src))) != 1) {
+    fprintf (stderr, "inet_pton() failed.\nError message: %s", strerror (status));
+    exit (EXIT_FAILURE);
+  }
+
+  // Destination IPv4 address (32 bits)
+  if ((status = inet_pton (AF_INET, dst_ip, &(iphdr.ip_dst))) != 1) {
+    fprintf (stderr, "inet_pton() failed.\nError message: %s", strerror (status));
+    exit (EXIT_FAILURE);
+  }
+
+  // IPv4 header checksum (16 bits): the same for every packet, so computed once.
+  iphdr.ip_sum = 0;
+  iphdr.ip_sum = htons (~fold_sum (sum_bytes (0, (uint8_t *) &iphdr, IP4_HDRLEN)) & 0xffff);
+
+  // TCP header
+
+  // Source port number (16 bits): filled in for each packet
+  tcphdr.th_sport = 0;
+
+  // Destination port number (16 bits)
+  tcphdr.th_dport = htons (80);
+
+  // Sequence number (32 bits): filled in for each packet
+  tcphdr.th_seq = 0;
+
+  // Acknowledgement number (32 bits): 0 in first packet of SYN/ACK process
+  tcphdr.th_ack = htonl (0);
+
+  // Reserved (4 bits): should be 0
+  tcphdr.th_x2 = 0;
+
+  // Data offset (4 bits): size of TCP header + length of options, in 32-bit words
+  tcphdr.th_off = (TCP_HDRLEN + OPT_LEN) / 4;
+
+  // Flags (8 bits): SYN
+  tcphdr.th_flags = TH_SYN;
+
+  // Window size (16 bits)
+  tcphdr.th_win = htons (65535);
+
+  // Urgent pointer (16 bits): 0 (only valid if URG flag is set)
+  tcphdr.th_urp = htons (0);
+
+  // TCP checksum (16 bits): filled in for each packet
+  tcphdr.th_sum = 0;
+
+  // Partial TCP checksum over everything which is the same in every packet: pseudo-header,
+  // TCP header with source port and sequence number zeroed, and option block with TSval
+  // zeroed (TSecr is always zero in a SYN). Each packet adds just those three fields.
+  tcp_base = sum_bytes (0, (uint8_t *) &iphdr.ip_src, 8);  // Pseudo-header: addresses,
+  tcp_base += IPPROTO_TCP + TCP_HDRLEN + OPT_LEN;           // protocol and TCP length,
+  tcp_base = sum_bytes (tcp_base, (uint8_t *) &tcphdr, TCP_HDRLEN);  // TCP header,
+  tcp_base = sum_bytes (tcp_base, tcp_options, OPT_LEN);             // and options.
+
+  // Build template frame in every slot.
+  c = 0;
+  memcpy (frames, dst_mac, 6 * sizeof (uint8_t));
+  memcpy (frames + 6, src_mac, 6 * sizeof (uint8_t));
+  frames[12] = ETH_P_IP / 256;
+  frames[13] = ETH_P_IP % 256;
+  c += ETH_HDRLEN;
+  memcpy (frames + c, &iphdr, IP4_HDRLEN * sizeof (uint8_t));
+  c += IP4_HDRLEN;
+  memcpy (frames + c, &tcphdr, TCP_HDRLEN * sizeof (uint8_t));
+  c += TCP_HDRLEN;
+  memcpy (frames + c, tcp_options, OPT_LEN * sizeof (uint8_t));
+  c += OPT_LEN;
+  frame_length = c;
+
+  memset (msgs, 0, sizeof (msgs));
+  for (i=0; i<BATCH; i++) {
+    if (i > 0) {
+      memcpy (frames + (i * MAX_FRAMELEN), frames, frame_length * sizeof (uint8_t));
+    }
+    iovs[i].iov_base = frames + (i * MAX_FRAMELEN);
+    iovs[i].iov_len = frame_length;
+    msgs[i].msg_hdr.msg_iov = &iovs[i];
+    msgs[i].msg_hdr.msg_iovlen = 1;
+    msgs[i].msg_hdr.msg_name = &device;
+    msgs[i].msg_hdr.msg_namelen = sizeof (device);
+  }
+
+  // Submit request for a raw socket descriptor.
+  if ((sd = socket (PF_PACKET, SOCK_RAW, htons (ETH_P_ALL))) < 0) {
+    perror ("socket() failed ");
+    exit (EXIT_FAILURE);
+  }
+
+  signal (SIGINT, sig_handler);
+
+  printf ("Sending %i SYNs with %i bytes of TCP options to %s\n", count, OPT_LEN, dst_ip);
+
+  // Ephemeral source ports are used in turn, and initial sequence numbers are spread
+  // over the sequence space by stepping with the golden ratio.
+  sport = 32768;
+  clock_gettime (CLOCK_MONOTONIC, &t1);
+  seq = (uint32_t) t1.tv_nsec;
+  next = t1;
+  build = 0.0;
+  sent = 0;
+  while ((stop == 0) && (sent < count)) {
+    n = ((count - sent) < BATCH) ? (count - sent) : BATCH;
+
+    // Timestamp clock: milliseconds, the same for a whole batch.
+    clock_gettime (CLOCK_MONOTONIC, &now);
+#if OPT_TIMESTAMP
+    tsval = (uint32_t) ((now.tv_sec * 1000) + (now.tv_nsec / 1000000));
+#endif
+
+    for (i=0; i<n; i++) {
+      slot = frames + (i * MAX_FRAMELEN) + ETH_HDRLEN + IP4_HDRLEN;
+      slot[0] = sport >> 8;
+      slot[1] = sport & 0xff;
+      slot[4] = seq >> 24;
+      slot[5] = (seq >> 16) & 0xff;
+      slot[6] = (seq >> 8) & 0xff;
+      slot[7] = seq & 0xff;
+      sum = tcp_base + sport + (seq >> 16) + (seq & 0xffff);
+#if OPT_TIMESTAMP
+      slot[TCP_HDRLEN + OPT_TSVAL] = tsval >> 24;
+      slot[TCP_HDRLEN + OPT_TSVAL + 1] = (tsval >> 16) & 0xff;
+      slot[TCP_HDRLEN + OPT_TSVAL + 2] = (tsval >> 8) & 0xff;
+      slot[TCP_HDRLEN + OPT_TSVAL + 3] = tsval & 0xff;
+      sum += (tsval >> 16) + (tsval & 0xffff);
+#endif
+      sum = ~fold_sum (sum) & 0xffff;
+      slot[16] = sum >> 8;
+      slot[17] = sum & 0xff;
+
+      sport = (sport == 60999) ? 32768 : (sport + 1);
+      seq += 0x9e3779b9u;
+    }
+    clock_gettime (CLOCK_MONOTONIC, &t2);
+    build += (double) (t2.tv_sec - now.tv_sec) + (double) (t2.tv_nsec - now.tv_nsec) / 1000000000.0;
+
+    if (rate > 0) {
+      pace (&next, (long int) (1000000000.0 * n / rate));
+    }
+
+    // Send batch.
+    i = 0;
+    while (i < n) {
+      if ((status = sendmmsg (sd, msgs + i, n - i, 0)) < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        if (errno == ENOBUFS) {  // Transmit queue full: let it drain.
+          usleep (100);
+          continue;
+        }
+        perror ("sendmmsg() failed ");
+        exit (EXIT_FAILURE);
+      }
+      i += status;
+    }
+    sent += n;
+  }
+  clock_gettime (CLOCK_MONOTONIC, &t2);
+  dt = (double) (t2.tv_sec - t1.tv_sec) + (double) (t2.tv_nsec - t1.tv_nsec) / 1000000000.0;
+
+  // Report rate, and time spent filling in packets.
+  printf ("Sent %i SYNs in %g seconds (%.0f packets/s)\n", sent, dt, sent / dt);
+  if (sent > 0) {
+    printf ("Building took %.1f ns per SYN\n", 1000000000.0 * build / sent);
+  }
+
+  // Close socket descriptor.
+  close (sd);
+
+  // Free allocated memory.
+  free (src_mac);
+  free (dst_mac);
+  free (frames);
+  free (interface);
+  free (target);
+  free (src_ip);
+  free (dst_ip);
+
+  return (EXIT_SUCCESS);
+}
+
+// Add bytes to a running (host byte order) one's complement sum.
+uint32_t
+sum_bytes (uint32_t sum, const uint8_t *data, int len)
+{
+  while (len > 1) {
+    sum += (data[0] << 8) + data[1];
+    data += 2;
+    len -= 2;
+  }
+
+  // Odd byte is padded with zero.
+  if (len == 1) {
+    sum += data[0] << 8;
+  }
+
+  return (sum);
+}
+
+// Fold a 32-bit running sum into 16 bits, with end-around carry.
+uint16_t
+fold_sum (uint32_t sum)
+{
+  while (sum >> 16) {
+    sum = (sum & 0xffff) + (sum >> 16);
+  }
+
+  return ((uint16_t) sum);
+}
+
+// Sleep until next scheduled send time, then schedule the one after.
+// Absolute deadlines keep the average rate exact even if one sleep runs long.
+void
+pace (struct timespec *next, long int interval)
+{
+  next->tv_nsec += interval;
+  while (next->tv_nsec >= 1000000000L) {
+    next->tv_nsec -= 1000000000L;
+    next->tv_sec++;
+  }
+  while (clock_nanosleep (CLOCK_MONOTONIC, TIMER_ABSTIME, next, NULL) == EINTR) {
+    if (stop == 1) {
+      break;
+    }
+  }
+}
+
+// SIGINT handler: stop sending and report results.
+void
+sig_handler (int signum)
+{
+  (void) signum;
+  stop = 1;
+}
+
+// Allocate memory for an array of chars.
+char *
+allocate_strmem (int len)
+{
+  void *tmp;
+
+  if (len <= 0) {
+    fprintf (stderr, "ERROR: Cannot allocate memory because len = %i in allocate_strmem().\n", len);
+    exit (EXIT_FAILURE);
+  }
+
+  tmp = (char *) malloc (len * sizeof (char));
+  if (tmp != NULL) {
+    memset (tmp, 0, len * sizeof (char));
+    return (tmp);
+  } else {
+    fprintf (stderr, "ERROR: Cannot allocate memory for array allocate_strmem().\n");
+    exit (EXIT_FAILURE);
+  }
+}
+
+// Allocate memory for an array of unsigned chars.
+uint8_t *
+allocate_ustrmem (int len)
+{
+  void *tmp;
+
+  if (len <= 0) {
+    fprintf (stderr, "ERROR: Cannot allocate memory because len = %i in allocate_ustrmem().\n", len);
+    exit (EXIT_FAILURE);
+  }
+
+  tmp = (uint8_t *) malloc (len * sizeof (uint8_t));
+  if (tmp != NULL) {
+    memset (tmp, 0, len * sizeof (uint8_t));
+    return (tmp);
+  } else {
+    fprintf (stderr, "ERROR: Cannot allocate memory for array allocate_ustrmem().\n");
+    exit (EXIT_FAILURE);
+  }
+}
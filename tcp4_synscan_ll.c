@@ -0,0 +1,1360 @@
+/*  Copyright (C) 2013  P.D. Buchan (pdbuchan@yahoo.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Stateless TCP SYN scanner: send IPv4 TCP SYN packets via raw socket at the link layer
+// (ethernet frame) to every port of a list on every address of a network, and report
+// which answer with SYN-ACK (open) or RST (closed).
+// Targets are visited in a random order given by a keyed Feistel permutation of the
+// (address, port) index space, so no list of targets is ever held in memory.
+// No per-probe state is kept either: the sequence number and source port of each SYN
+// carry a keyed hash (SipHash-2-4) of the target, and a reply is accepted only if its
+// acknowledgement number and destination port match the hash recomputed from its source.
+// The kernel knows nothing of these connections and will answer each SYN-ACK with a RST.
+// Optionally, every probe sent and every frame received is written to pcapng capture files,
+// with nanosecond timestamps and direction flags. Frames are appended to one large buffer
+// while a second thread writes the other one to disk, so the send loop never waits on the
+// disk; if the disk falls behind, frames are dropped from the capture (and counted) instead.
+// Capture files are rotated after a given size or time. Link with -lpthread.
+// Each stage of the send and receive loops (building probes, checksums, sendmmsg(), recvmmsg(),
+// matching replies, capture, and the capture writer's disk writes) is timed with the CPU's
+// timestamp counter, per batch of frames, into per-thread counters and log2 histograms.
+// These are published in a POSIX shared memory segment, where synscan_stat.c reads them
+// while the scan runs. Each thread writes only its own counters, in cache lines of their own,
+// and never waits for a reader. Link with -lrt on systems with glibc older than 2.34.
+// Need to have destination MAC address (of the gateway, for remote networks).
+
+#define _GNU_SOURCE           // sendmmsg(), recvmmsg() and struct mmsghdr
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>           // close()
+#include <string.h>           // strcpy, memset(), and memcpy()
+
+#include <sys/types.h>        // needed for socket(), uint8_t, uint16_t, uint32_t
+#include <sys/socket.h>       // needed for socket(), sendmmsg(), recvmmsg()
+#include <netinet/in.h>       // IPPROTO_TCP, INET_ADDRSTRLEN
+#include <netinet/ip.h>       // struct ip and IP_MAXPACKET (which is 65535)
+#define __FAVOR_BSD           // Use BSD format of tcp header
+#include <netinet/tcp.h>      // struct tcphdr
+#include <arpa/inet.h>        // inet_pton() and inet_ntop()
+#include <sys/ioctl.h>        // macro ioctl is defined
+#include <bits/ioctls.h>      // defines values for argument "request" of ioctl.
+#include <net/if.h>           // struct ifreq
+#include <linux/if_ether.h>   // ETH_P_IP = 0x0800, ETH_P_IPV6 = 0x86DD
+#include <linux/if_packet.h>  // struct sockaddr_ll (see man 7 packet)
+#include <net/ethernet.h>
+#include <sys/random.h>       // getrandom()
+#include <signal.h>           // signal(), SIGINT
+#include <time.h>             // clock_gettime(), clock_nanosleep()
+#include <fcntl.h>            // open(), posix_fadvise()
+#include <pthread.h>          // pthread_create(), mutexes and condition variables (link with -lpthread)
+#include <sys/mman.h>         // shm_open(), mmap()
+#include <sys/stat.h>         // mode constants for shm_open()
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>        // __rdtsc()
+#endif
+
+#include <errno.h>            // errno, perror()
+
+// Define some constants.
+#define ETH_HDRLEN 14         // Ethernet header length
+#define IP4_HDRLEN 20         // IPv4 header length
+#define TCP_HDRLEN 20         // TCP header length, excludes options data
+#define BATCH 64              // Number of probes handed to sendmmsg() at once
+#define RXBATCH 64            // Maximum number of replies taken per recvmmsg()
+#define MAX_FRAMELEN 2048     // Largest reply frame we look at
+#define MAX_PORTS 65536       // Maximum number of ports to scan
+#define FEISTEL_ROUNDS 4      // Rounds of Feistel network used to permute targets
+#define SPORT_BASE 49152      // Source ports are SPORT_BASE plus SPORT_BITS bits of the cookie
+#define SPORT_BITS 14
+#define PCAP_BUFSIZE 16777216 // Size of each of the two capture buffers
+#define PCAP_SNAPLEN 256      // Bytes of each frame kept in capture
+#define PCAP_FLUSH_NS 1000000000  // Hand a partly full capture buffer to the writer at least this often
+
+// Statistics published in shared memory. synscan_stat.c has a copy of these definitions.
+#define STATS_MAGIC 0x53434e53  // "SNCS": written last, once the segment is ready
+#define STATS_VERSION 1
+#define STATS_THREADS 2       // Threads with counters: scan loop, and capture writer
+#define STAT_NAMELEN 16       // Room for each name of a thread, stage or counter
+#define HIST_BUCKETS 32       // Bucket b counts runs of 2^b to 2^(b+1) - 1 ticks (bucket 0 from 0)
+
+// Stages
+#define STAGE_BUILD 0         // Fill a batch of probes from the permutation and cookies
+#define STAGE_CHECKSUM 1      // IPv4 and TCP checksums of a batch
+#define STAGE_SEND 2          // sendmmsg() of a batch, with any retries
+#define STAGE_RECEIVE 3       // One recvmmsg() call, whether or not it finds replies
+#define STAGE_MATCH 4         // check_reply() on one frame
+#define STAGE_CAPTURE 5       // Copy frames into the capture buffer
+#define STAGE_WRITE 6         // Write one capture buffer to disk (writer thread)
+#define NUM_STAGES 7
+
+// Counters
+#define CTR_PROBES 0          // Probes sent
+#define CTR_RETRIES 1         // sendmmsg() calls retried (EINTR, or ENOBUFS while queue was full)
+#define CTR_RECEIVED 2        // Frames received, not counting our own outgoing ones
+#define CTR_OPEN 3            // SYN-ACK replies
+#define CTR_CLOSED 4          // RST replies
+#define CTR_CAPTURED 5        // Frames captured
+#define CTR_CAP_DROPPED 6     // Frames dropped from capture
+#define CTR_CAP_BYTES 7       // Bytes written to capture files (writer thread)
+#define CTR_CAP_FILES 8       // Capture files opened (writer thread)
+#define NUM_COUNTERS 9
+
+// Define a struct for a scan: target space, its permutation, and cookie key.
+typedef struct _scan scan;
+struct _scan {
+  uint32_t base;        // First target IPv4 address (host byte order)
+  uint64_t nhosts;      // Number of target addresses
+  uint16_t *ports;      // Target ports
+  int nports;           // Number of target ports
+  uint64_t range;       // Size of target space: nhosts * nports
+  int half_bits;        // Feistel half width: permutation domain is 2^(2 * half_bits), at least range
+  uint64_t half_mask;   // (1 << half_bits) - 1
+  uint64_t round_key[FEISTEL_ROUNDS];
+  uint64_t k0;          // SipHash key for SYN cookies
+  uint64_t k1;
+};
+
+// Define a struct for the statistics of one stage in one thread.
+// Aligned to a cache line, so no two stages or threads share one.
+typedef struct _stage_stats stage_stats;
+struct _stage_stats {
+  uint64_t runs;        // Times stage was run
+  uint64_t items;       // Frames handled (a batch is many)
+  uint64_t ticks;       // Total time taken (timer ticks)
+  uint64_t max;         // Longest run (timer ticks)
+  uint64_t hist[HIST_BUCKETS];  // Runs by time taken, in log2 buckets
+} __attribute__ ((aligned (64)));
+
+// Define a struct for the statistics of one thread. Only that thread writes them.
+typedef struct _thread_stats thread_stats;
+struct _thread_stats {
+  char name[STAT_NAMELEN];  // Empty if unused
+  stage_stats stage[NUM_STAGES];
+  uint64_t counter[NUM_COUNTERS] __attribute__ ((aligned (64)));
+} __attribute__ ((aligned (64)));
+
+// Define a struct for the shared memory segment.
+typedef struct _stats_shm stats_shm;
+struct _stats_shm {
+  uint32_t magic;       // STATS_MAGIC once the rest is filled in
+  uint32_t version;     // STATS_VERSION
+  uint32_t nthreads;    // STATS_THREADS, NUM_STAGES, NUM_COUNTERS and HIST_BUCKETS,
+  uint32_t nstages;     // so a reader can check it was built with the same layout
+  uint32_t ncounters;
+  uint32_t nbuckets;
+  int32_t pid;          // Process writing the statistics
+  uint32_t unused;
+  uint64_t tick_hz;     // Timer ticks per second
+  uint64_t start_ns;    // Time statistics began (ns since the epoch)
+  char stage_names[NUM_STAGES][STAT_NAMELEN];
+  char counter_names[NUM_COUNTERS][STAT_NAMELEN];
+  thread_stats thread[STATS_THREADS];
+};
+
+// Define a struct for a pcapng capture writer: the capture side fills one buffer
+// while the writer thread writes the other to the current capture file.
+typedef struct _pcapng_writer pcapng_writer;
+struct _pcapng_writer {
+  char prefix[64];        // Capture files are named prefix-N.pcapng
+  char ifname[IF_NAMESIZE];  // Interface name recorded in each file
+  int snaplen;            // Bytes of each frame kept
+  int fd;                 // Current capture file (writer thread only, once started)
+  int fileno;             // Number of current capture file
+  uint64_t file_bytes;    // Bytes of frames written to current capture file
+  uint64_t max_bytes;     // Rotate to a new file after this many bytes (0 for no limit)
+  int max_seconds;        // Rotate to a new file after this many seconds (0 for no limit)
+  time_t opened;          // Time current capture file was opened
+  uint8_t *buf[2];        // The two buffers
+  int len[2];             // Bytes used in each buffer
+  int active;             // Buffer being filled by capture side
+  int pending;            // Buffer handed to writer thread, or -1 if none
+  int done;               // Tells writer thread to exit
+  pthread_t thread;
+  pthread_mutex_t lock;   // Protects pending and done
+  pthread_cond_t cond;    // Signalled whenever pending or done changes
+  uint64_t frames;        // Frames captured
+  uint64_t dropped;       // Frames dropped because writer thread had not kept up
+  thread_stats *stats;    // Statistics of writer thread
+};
+
+// Function prototypes
+int scan_init (scan *, char *, uint16_t *, int);
+uint64_t permute (scan *, uint64_t);
+uint64_t siphash24 (uint64_t, uint64_t, const uint8_t *, int);
+uint64_t syn_cookie (scan *, uint32_t, uint32_t, uint16_t);
+int parse_ports (char *, uint16_t *);
+int check_reply (scan *, uint8_t *, int, uint32_t);
+uint32_t sum_bytes (uint32_t, uint8_t *, int);
+uint16_t fold_sum (uint32_t);
+void pace (struct timespec *, long int);
+void pcapng_open (pcapng_writer *, char *, char *, int, uint64_t, int, thread_stats *);
+void pcapng_file_open (pcapng_writer *);
+void pcapng_frame (pcapng_writer *, uint8_t *, int, uint64_t, int);
+int pcapng_flush (pcapng_writer *, int);
+void pcapng_close (pcapng_writer *);
+void *pcapng_thread (void *);
+void write_all (int, uint8_t *, int);
+stats_shm *stats_open (char *, int);
+uint64_t stat_ticks (void);
+uint64_t stage_record (stage_stats *, uint64_t, uint64_t);
+void stat_set (uint64_t *, uint64_t);
+void sig_handler (int);
+char *allocate_strmem (int);
+uint8_t *allocate_ustrmem (int);
+
+// Set by SIGINT handler to stop the scan.
+volatile sig_atomic_t stop = 0;
+
+int
+main (int argc, char **argv)
+{
+  int i, n, c, status, sd, rd, frame_length, rate, wait, capture, cap_seconds, stats;
+  char *interface, *targets, *portlist, *src_ip, *cap_prefix, *stats_name;
+  uint8_t *src_mac, *dst_mac, *frames, *rxframes, *slot;
+  uint16_t *ports;
+  uint32_t src, dst, ip_base, tcp_base, sum;
+  uint64_t idx, p, cookie, sent, open_ports, closed_ports, received, retries, cap_bytes, now_ns, flush_ns, t;
+  struct ip iphdr;
+  struct tcphdr tcphdr;
+  struct ifreq ifr;
+  struct sockaddr_ll device, from[RXBATCH];
+  struct mmsghdr msgs[BATCH], rxmsgs[RXBATCH];
+  struct iovec iovs[BATCH], rxiovs[RXBATCH];
+  struct timespec next, t1, t2, end, ts;
+  double dt;
+  scan s;
+  pcapng_writer pw;
+  stats_shm *shm;
+  thread_stats *st;
+
+  // Allocate memory for various arrays.
+  src_mac = allocate_ustrmem (6);
+  dst_mac = allocate_ustrmem (6);
+  interface = allocate_strmem (40);
+  targets = allocate_strmem (40);
+  portlist = allocate_strmem (1024);
+  src_ip = allocate_strmem (INET_ADDRSTRLEN);
+  cap_prefix = allocate_strmem (64);
+  stats_name = allocate_strmem (64);
+  frames = allocate_ustrmem (BATCH * MAX_FRAMELEN);
+  rxframes = allocate_ustrmem (RXBATCH * MAX_FRAMELEN);
+  ports = (uint16_t *) allocate_ustrmem (MAX_PORTS * sizeof (uint16_t));
+
+  // Interface to send packets through.
+  strcpy (interface, "eth0");
+
+  // Source IPv4 address: you need to fill this out
+  strcpy (src_ip, "192.168.1.132");
+
+  // Target network, in CIDR notation: you need to fill this out
+  strcpy (targets, "192.168.1.0/24");
+
+  // Target ports: comma-separated list of ports and ranges: you need to fill this out
+  strcpy (portlist, "21-23,25,53,80,110,143,443,445,3389,8000-8100");
+
+  // Probes per second (0 for as fast as possible), and seconds to wait for late replies.
+  rate = 100000;
+  wait = 3;
+
+  // Capture probes and replies to pcapng files named cap_prefix-N.pcapng (1 for yes, 0 for no),
+  // starting a new file after cap_bytes bytes or cap_seconds seconds (0 for no limit).
+  capture = 1;
+  strcpy (cap_prefix, "synscan");
+  cap_bytes = 1000000000;
+  cap_seconds = 60;
+
+  // Publish statistics in POSIX shared memory segment stats_name (1 for yes, 0 for no), for
+  // synscan_stat.c to read (it appears as /dev/shm/synscan, and is left there after the scan).
+  // The stages are timed either way: only a few timer reads per batch of probes.
+  stats = 1;
+  strcpy (stats_name, "/synscan");
+
+  // Submit request for a socket descriptor to look up interface.
+  if ((sd = socket (PF_PACKET, SOCK_RAW, htons (ETH_P_ALL))) < 0) {
+    perror ("socket() failed to get socket descriptor for using ioctl() ");
+    exit (EXIT_FAILURE);
+  }
+
+  // Use ioctl() to look up interface name and get its MAC address.
+  memset (&ifr, 0, sizeof (ifr));
+  snprintf (ifr.ifr_name, sizeof (ifr.ifr_name), "%s", interface);
+  if (ioctl (sd, SIOCGIFHWADDR, &ifr) < 0) {
+    perror ("ioctl() failed to get source MAC address ");
+    return (EXIT_FAILURE);
+  }
+  close (sd);
+
+  // Copy source MAC address.
+  memcpy (src_mac, ifr.ifr_hwaddr.sa_data, 6 * sizeof (uint8_t));
+
+  // Report source MAC address to stdout.
+  printf ("MAC address for interface %s is ", interface);
+  for (i=0; i<5; i++) {
+    printf ("%02x:", src_mac[i]);
+  }
+  printf ("%02x\n", src_mac[5]);
+
+  // Find interface index from interface name and store index in
+  // struct sockaddr_ll device, which will be used as an argument of sendmmsg().
+  memset (&device, 0, sizeof (device));
+  if ((device.sll_ifindex = if_nametoindex (interface)) == 0) {
+    perror ("if_nametoindex() failed to obtain interface index ");
+    exit (EXIT_FAILURE);
+  }
+  printf ("Index for interface %s is %i\n", interface, device.sll_ifindex);
+
+  // Set destination MAC address: you need to fill these out
+  dst_mac[0] = 0xff;
+  dst_mac[1] = 0xff;
+  dst_mac[2] = 0xff;
+  dst_mac[3] = 0xff;
+  dst_mac[4] = 0xff;
+  dst_mac[5] = 0xff;
+
+  // Fill out sockaddr_ll.
+  device.sll_family = AF_PACKET;
+  memcpy (device.sll_addr, src_mac, 6 * sizeof (uint8_t));
+  device.sll_halen = 6;
+
+  // Set up target space, permutation and cookie keys.
+  scan_init (&s, targets, ports, parse_ports (portlist, ports));
+  printf ("Scanning %llu addresses x %i ports = %llu probes\n", (unsigned long long) s.nhosts, s.nports, (unsigned long long) s.range);
+
+  // IPv4 header
+
+  // IPv4 header length (4 bits): Number of 32-bit words in header = 5
+  iphdr.ip_hl = IP4_HDRLEN / sizeof (uint32_t);
+
+  // Internet Protocol version (4 bits): IPv4
+  iphdr.ip_v = 4;
+
+  // Type of service (8 bits)
+  iphdr.ip_tos = 0;
+
+  // Total length of datagram (16 bits): IP header + TCP header
+  iphdr.ip_len = htons (IP4_HDRLEN + TCP_HDRLEN);
+
+  // ID sequence number (16 bits): unused, since single datagram
+  iphdr.ip_id = htons (0);
+
+  // Flags, and Fragmentation offset (3, 13 bits): 0 since single datagram
+  iphdr.ip_off = htons (0);
+
+  // Time-to-Live (8 bits): default to maximum value
+  iphdr.ip_ttl = 255;
+
+  // Transport layer protocol (8 bits): 6 for TCP
+  iphdr.ip_p = IPPROTO_TCP;
+
+  // Source IPv4 address (32 bits)
+  if ((status = inet_pton (AF_INET, src_ip, &(iphdr.ip_src))) != 1) {
+    fprintf (stderr, "inet_pton() failed.\nError message: %s", strerror (status));
+    exit (EXIT_FAILURE);
+  }
+  src = ntohl (iphdr.ip_src.s_addr);
+
+  // Destination IPv4 address (32 bits): filled in for each probe
+  iphdr.ip_dst.s_addr = 0;
+
+  // IPv4 header checksum (16 bits): filled in for each probe
+  iphdr.ip_sum = 0;
+
+  // TCP header: ports and sequence number are filled in for each probe.
+  tcphdr.th_sport = 0;
+  tcphdr.th_dport = 0;
+  tcphdr.th_seq = 0;
+  tcphdr.th_ack = htonl (0);
+  tcphdr.th_x2 = 0;
+  tcphdr.th_off = TCP_HDRLEN / 4;
+  tcphdr.th_flags = TH_SYN;
+  tcphdr.th_win = htons (65535);
+  tcphdr.th_sum = 0;
+  tcphdr.th_urp = htons (0);
+
+  // Partial checksums over the fields which are the same in every probe.
+  // Each probe only adds its destination address, ports, and sequence number.
+  ip_base = sum_bytes (0, (uint8_t *) &iphdr, IP4_HDRLEN);
+  tcp_base = sum_bytes (0, (uint8_t *) &iphdr.ip_src, 4);  // Pseudo-header: source address,
+  tcp_base += IPPROTO_TCP + TCP_HDRLEN;                    // protocol and TCP length,
+  tcp_base = sum_bytes (tcp_base, (uint8_t *) &tcphdr, TCP_HDRLEN);  // and TCP header.
+
+  // Build template frame in every slot.
+  c = 0;
+  memcpy (frames, dst_mac, 6 * sizeof (uint8_t));
+  memcpy (frames + 6, src_mac, 6 * sizeof (uint8_t));
+  frames[12] = ETH_P_IP / 256;
+  frames[13] = ETH_P_IP % 256;
+  c += ETH_HDRLEN;
+  memcpy (frames + c, &iphdr, IP4_HDRLEN * sizeof (uint8_t));
+  c += IP4_HDRLEN;
+  memcpy (frames + c, &tcphdr, TCP_HDRLEN * sizeof (uint8_t));
+  c += TCP_HDRLEN;
+  frame_length = c;
+
+  memset (msgs, 0, sizeof (msgs));
+  for (i=0; i<BATCH; i++) {
+    if (i > 0) {
+      memcpy (frames + (i * MAX_FRAMELEN), frames, frame_length * sizeof (uint8_t));
+    }
+    iovs[i].iov_base = frames + (i * MAX_FRAMELEN);
+    iovs[i].iov_len = frame_length;
+    msgs[i].msg_hdr.msg_iov = &iovs[i];
+    msgs[i].msg_hdr.msg_iovlen = 1;
+    msgs[i].msg_hdr.msg_name = &device;
+    msgs[i].msg_hdr.msg_namelen = sizeof (device);
+  }
+
+  // Submit request for raw socket descriptors: one to send, and one to receive IPv4 frames.
+  if ((sd = socket (PF_PACKET, SOCK_RAW, htons (ETH_P_ALL))) < 0) {
+    perror ("socket() failed ");
+    exit (EXIT_FAILURE);
+  }
+  if ((rd = socket (PF_PACKET, SOCK_RAW, htons (ETH_P_IP))) < 0) {
+    perror ("socket() failed ");
+    exit (EXIT_FAILURE);
+  }
+  memset (&from[0], 0, sizeof (struct sockaddr_ll));
+  from[0].sll_family = AF_PACKET;
+  from[0].sll_protocol = htons (ETH_P_IP);
+  from[0].sll_ifindex = device.sll_ifindex;
+  if (bind (rd, (struct sockaddr *) &from[0], sizeof (struct sockaddr_ll)) < 0) {
+    perror ("bind() failed ");
+    exit (EXIT_FAILURE);
+  }
+
+  memset (rxmsgs, 0, sizeof (rxmsgs));
+  for (i=0; i<RXBATCH; i++) {
+    rxiovs[i].iov_base = rxframes + (i * MAX_FRAMELEN);
+    rxiovs[i].iov_len = MAX_FRAMELEN;
+    rxmsgs[i].msg_hdr.msg_iov = &rxiovs[i];
+    rxmsgs[i].msg_hdr.msg_iovlen = 1;
+    rxmsgs[i].msg_hdr.msg_name = &from[i];
+    rxmsgs[i].msg_hdr.msg_namelen = sizeof (struct sockaddr_ll);
+  }
+
+  signal (SIGINT, sig_handler);
+
+  shm = stats_open (stats_name, stats);
+  st = &shm->thread[0];
+  strcpy (st->name, "scan");
+
+  if (capture) {
+    strcpy (shm->thread[1].name, "pcapng");
+    pcapng_open (&pw, cap_prefix, interface, PCAP_SNAPLEN, cap_bytes, cap_seconds, &shm->thread[1]);
+  }
+
+  sent = 0;
+  open_ports = 0;
+  closed_ports = 0;
+  received = 0;
+  retries = 0;
+  idx = 0;
+  clock_gettime (CLOCK_MONOTONIC, &t1);
+  next = t1;
+  end.tv_sec = 0;
+  flush_ns = 0;
+  while (stop == 0) {
+
+    // Fill a batch of probes from the next indices of the permutation.
+    t = stat_ticks ();
+    n = 0;
+    while ((n < BATCH) && (idx < s.range)) {
+      p = permute (&s, idx++);
+      dst = s.base + (uint32_t) (p % s.nhosts);
+      slot = frames + (n * MAX_FRAMELEN) + ETH_HDRLEN;
+      cookie = syn_cookie (&s, src, dst, s.ports[p / s.nhosts]);
+
+      // IPv4 destination
+      slot[16] = dst >> 24;
+      slot[17] = (dst >> 16) & 0xff;
+      slot[18] = (dst >> 8) & 0xff;
+      slot[19] = dst & 0xff;
+
+      // TCP source port and sequence number carry the cookie.
+      slot[IP4_HDRLEN] = (SPORT_BASE + ((cookie >> 32) & ((1u << SPORT_BITS) - 1))) >> 8;
+      slot[IP4_HDRLEN + 1] = (SPORT_BASE + ((cookie >> 32) & ((1u << SPORT_BITS) - 1))) & 0xff;
+      slot[IP4_HDRLEN + 2] = s.ports[p / s.nhosts] >> 8;
+      slot[IP4_HDRLEN + 3] = s.ports[p / s.nhosts] & 0xff;
+      slot[IP4_HDRLEN + 4] = (cookie >> 24) & 0xff;
+      slot[IP4_HDRLEN + 5] = (cookie >> 16) & 0xff;
+      slot[IP4_HDRLEN + 6] = (cookie >> 8) & 0xff;
+      slot[IP4_HDRLEN + 7] = cookie & 0xff;
+      n++;
+    }
+
+    // Send batch.
+    if (n > 0) {
+      t = stage_record (&st->stage[STAGE_BUILD], n, t);
+
+      // Checksums: the partial sums plus the fields just filled in, which were zero in the template.
+      for (i=0; i<n; i++) {
+        slot = frames + (i * MAX_FRAMELEN) + ETH_HDRLEN;
+        sum = ~fold_sum (sum_bytes (ip_base, slot + 16, 4)) & 0xffff;
+        slot[10] = sum >> 8;
+        slot[11] = sum & 0xff;
+        sum = sum_bytes (tcp_base, slot + 16, 4);  // Pseudo-header destination address,
+        sum = sum_bytes (sum, slot + IP4_HDRLEN, 8);  // ports and sequence number.
+        sum = ~fold_sum (sum) & 0xffff;
+        slot[IP4_HDRLEN + 16] = sum >> 8;
+        slot[IP4_HDRLEN + 17] = sum & 0xff;
+      }
+      stage_record (&st->stage[STAGE_CHECKSUM], n, t);
+
+      if (rate > 0) {
+        pace (&next, (long int) (1000000000.0 * n / rate));
+      }
+      t = stat_ticks ();
+      i = 0;
+      while (i < n) {
+        if ((status = sendmmsg (sd, msgs + i, n - i, 0)) < 0) {
+          if (errno == EINTR) {
+            retries++;
+            continue;
+          }
+          if (errno == ENOBUFS) {  // Transmit queue full: let it drain.
+            retries++;
+            usleep (100);
+            continue;
+          }
+          perror ("sendmmsg() failed ");
+          exit (EXIT_FAILURE);
+        }
+        i += status;
+      }
+      sent += n;
+      t = stage_record (&st->stage[STAGE_SEND], n, t);
+
+      // Capture the batch, all with one timestamp.
+      if (capture) {
+        clock_gettime (CLOCK_REALTIME, &ts);
+        now_ns = (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+        for (i=0; i<n; i++) {
+          pcapng_frame (&pw, frames + (i * MAX_FRAMELEN), frame_length, now_ns, 2);
+        }
+        stage_record (&st->stage[STAGE_CAPTURE], n, t);
+      }
+    } else {
+
+      // All probes sent: keep listening for a while.
+      clock_gettime (CLOCK_MONOTONIC, &t2);
+      if (end.tv_sec == 0) {
+        end = t2;
+        end.tv_sec += wait;
+      }
+      if ((t2.tv_sec > end.tv_sec) || ((t2.tv_sec == end.tv_sec) && (t2.tv_nsec >= end.tv_nsec))) {
+        break;
+      }
+      usleep (1000);
+    }
+
+    // Check whatever replies have arrived, without waiting.
+    while (1) {
+      t = stat_ticks ();
+      status = recvmmsg (rd, rxmsgs, RXBATCH, MSG_DONTWAIT, NULL);
+      t = stage_record (&st->stage[STAGE_RECEIVE], (status > 0) ? status : 0, t);
+      if (status <= 0) {
+        break;
+      }
+      if (capture) {
+        clock_gettime (CLOCK_REALTIME, &ts);
+        now_ns = (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+      }
+      for (i=0; i<status; i++) {
+        if (from[i].sll_pkttype == PACKET_OUTGOING) {
+          continue;
+        }
+        received++;
+        if (capture) {
+          t = stat_ticks ();
+          pcapng_frame (&pw, rxframes + (i * MAX_FRAMELEN), rxmsgs[i].msg_len, now_ns, 1);
+          stage_record (&st->stage[STAGE_CAPTURE], 1, t);
+        }
+        t = stat_ticks ();
+        c = check_reply (&s, rxframes + (i * MAX_FRAMELEN), rxmsgs[i].msg_len, src);
+        stage_record (&st->stage[STAGE_MATCH], 1, t);
+        if (c == 1) {
+          open_ports++;
+        } else if (c == 2) {
+          closed_ports++;
+        }
+      }
+    }
+
+    // Publish running totals.
+    stat_set (&st->counter[CTR_PROBES], sent);
+    stat_set (&st->counter[CTR_RETRIES], retries);
+    stat_set (&st->counter[CTR_RECEIVED], received);
+    stat_set (&st->counter[CTR_OPEN], open_ports);
+    stat_set (&st->counter[CTR_CLOSED], closed_ports);
+    if (capture) {
+      stat_set (&st->counter[CTR_CAPTURED], pw.frames);
+      stat_set (&st->counter[CTR_CAP_DROPPED], pw.dropped);
+    }
+
+    // Don't let captured frames sit in a quiet buffer for long (nor past a rotation time).
+    if (capture) {
+      clock_gettime (CLOCK_REALTIME, &ts);
+      now_ns = (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+      if (now_ns >= flush_ns) {
+        pcapng_flush (&pw, 0);
+        flush_ns = now_ns + PCAP_FLUSH_NS;
+      }
+    }
+  }
+  clock_gettime (CLOCK_MONOTONIC, &t2);
+  dt = (double) (t2.tv_sec - t1.tv_sec) + (double) (t2.tv_nsec - t1.tv_nsec) / 1000000000.0;
+
+  // Report results.
+  printf ("Sent %llu probes in %g seconds (including %i second wait)\n", (unsigned long long) sent, dt, wait);
+  printf ("Replies: %llu open, %llu closed\n", (unsigned long long) open_ports, (unsigned long long) closed_ports);
+
+  // Report where the time went, per frame.
+  for (i=0; i<NUM_STAGES; i++) {
+    if (st->stage[i].items > 0) {
+      printf ("Stage %-9s %12llu frames, %8.1f ns per frame\n", shm->stage_names[i],
+              (unsigned long long) st->stage[i].items, st->stage[i].ticks * 1e9 / shm->tick_hz / st->stage[i].items);
+    }
+  }
+
+  // Write out the rest of the capture.
+  if (capture) {
+    pcapng_close (&pw);
+    printf ("Captured %llu frames to %i file(s) %s-N.pcapng, dropped %llu\n", (unsigned long long) pw.frames,
+            pw.fileno, pw.prefix, (unsigned long long) pw.dropped);
+  }
+
+  // Close socket descriptors.
+  close (sd);
+  close (rd);
+
+  // Free allocated memory.
+  free (src_mac);
+  free (dst_mac);
+  free (interface);
+  free (targets);
+  free (portlist);
+  free (src_ip);
+  free (cap_prefix);
+  free (stats_name);
+  free (frames);
+  free (rxframes);
+  free (ports);
+
+  return (EXIT_SUCCESS);
+}
+
+// Set up target space from CIDR network and list of ports,
+// and draw fresh random keys for the permutation and the cookies.
+int
+scan_init (scan *s, char *cidr, uint16_t *ports, int nports)
+{
+  int prefixlen, bits;
+  char *slash;
+  struct in_addr addr;
+
+  memset (s, 0, sizeof (scan));
+
+  prefixlen = 32;
+  if ((slash = strchr (cidr, '/')) != NULL) {
+    *slash = 0;
+    prefixlen = atoi (slash + 1);
+  }
+  if ((inet_pton (AF_INET, cidr, &addr) != 1) || (prefixlen < 0) || (prefixlen > 32)) {
+    fprintf (stderr, "ERROR: Invalid target network %s\n", cidr);
+    exit (EXIT_FAILURE);
+  }
+  if (slash != NULL) {
+    *slash = '/';
+  }
+
+  s->nhosts = 1ull << (32 - prefixlen);
+  s->base = ntohl (addr.s_addr) & (uint32_t) ~(s->nhosts - 1);
+  s->ports = ports;
+  s->nports = nports;
+  s->range = s->nhosts * nports;
+
+  // Smallest even number of bits covering the range, so the Feistel halves are equal.
+  // Then the domain is less than four times the range, and cycle-walking is short.
+  bits = 2;
+  while ((bits < 64) && ((1ull << bits) < s->range)) {
+    bits += 2;
+  }
+  s->half_bits = bits / 2;
+  s->half_mask = (1ull << s->half_bits) - 1;
+
+  if (getrandom (s->round_key, sizeof (s->round_key), 0) != sizeof (s->round_key)) {
+    perror ("getrandom() failed ");
+    exit (EXIT_FAILURE);
+  }
+  if ((getrandom (&s->k0, sizeof (s->k0), 0) != sizeof (s->k0)) || (getrandom (&s->k1, sizeof (s->k1), 0) != sizeof (s->k1))) {
+    perror ("getrandom() failed ");
+    exit (EXIT_FAILURE);
+  }
+
+  return (EXIT_SUCCESS);
+}
+
+// Map index i of [0, range) to a unique position in [0, range).
+// A balanced Feistel network is a permutation of [0, 2^(2 * half_bits)); results
+// outside the range are fed back in until one lands inside it (cycle-walking).
+uint64_t
+permute (scan *s, uint64_t i)
+{
+  int r;
+  uint64_t left, right, f;
+
+  do {
+    left = i >> s->half_bits;
+    right = i & s->half_mask;
+    for (r=0; r<FEISTEL_ROUNDS; r++) {
+
+      // Round function: keyed 64-bit mix (finalizer of MurmurHash3).
+      f = right ^ s->round_key[r];
+      f ^= f >> 33;
+      f *= 0xff51afd7ed558ccdull;
+      f ^= f >> 33;
+      f *= 0xc4ceb9fe1a85ec53ull;
+      f ^= f >> 33;
+
+      f = (left ^ f) & s->half_mask;
+      left = right;
+      right = f;
+    }
+    i = (left << s->half_bits) | right;
+  } while (i >= s->range);
+
+  return (i);
+}
+
+#define SIPROUND \
+  do { \
+    v0 += v1; v1 = (v1 << 13) | (v1 >> 51); v1 ^= v0; v0 = (v0 << 32) | (v0 >> 32); \
+    v2 += v3; v3 = (v3 << 16) | (v3 >> 48); v3 ^= v2; \
+    v0 += v3; v3 = (v3 << 21) | (v3 >> 43); v3 ^= v0; \
+    v2 += v1; v1 = (v1 << 17) | (v1 >> 47); v1 ^= v2; v2 = (v2 << 32) | (v2 >> 32); \
+  } while (0)
+
+// SipHash-2-4 of len bytes of data, with 128-bit key (k0, k1).
+uint64_t
+siphash24 (uint64_t k0, uint64_t k1, const uint8_t *data, int len)
+{
+  int i, j;
+  uint64_t v0, v1, v2, v3, m, b;
+
+  v0 = 0x736f6d6570736575ull ^ k0;
+  v1 = 0x646f72616e646f6dull ^ k1;
+  v2 = 0x6c7967656e657261ull ^ k0;
+  v3 = 0x7465646279746573ull ^ k1;
+  b = (uint64_t) len << 56;
+
+  // Whole 8-byte words, little-endian.
+  for (i=0; (i + 8)<=len; i+=8) {
+    m = 0;
+    for (j=7; j>=0; j--) {
+      m = (m << 8) | data[i + j];
+    }
+    v3 ^= m;
+    SIPROUND;
+    SIPROUND;
+    v0 ^= m;
+  }
+
+  // Last 0 to 7 bytes, with length in top byte.
+  for (j=len-1; j>=i; j--) {
+    b |= (uint64_t) data[j] << (8 * (j - i));
+  }
+  v3 ^= b;
+  SIPROUND;
+  SIPROUND;
+  v0 ^= b;
+
+  v2 ^= 0xff;
+  SIPROUND;
+  SIPROUND;
+  SIPROUND;
+  SIPROUND;
+
+  return (v0 ^ v1 ^ v2 ^ v3);
+}
+
+// Keyed hash of a probe's addresses and destination port. The low 32 bits become the
+// sequence number, and the next SPORT_BITS bits choose the source port.
+uint64_t
+syn_cookie (scan *s, uint32_t src, uint32_t dst, uint16_t dport)
+{
+  uint8_t msg[10];
+
+  msg[0] = src >> 24;
+  msg[1] = (src >> 16) & 0xff;
+  msg[2] = (src >> 8) & 0xff;
+  msg[3] = src & 0xff;
+  msg[4] = dst >> 24;
+  msg[5] = (dst >> 16) & 0xff;
+  msg[6] = (dst >> 8) & 0xff;
+  msg[7] = dst & 0xff;
+  msg[8] = dport >> 8;
+  msg[9] = dport & 0xff;
+
+  return (siphash24 (s->k0, s->k1, msg, 10));
+}
+
+// Parse a list of ports and ranges, such as "22,80,8000-8100". Returns number of ports.
+int
+parse_ports (char *list, uint16_t *ports)
+{
+  int n, lo, hi, p;
+  char *tok, *save, *copy, *dash;
+
+  copy = allocate_strmem (strlen (list) + 1);
+  strcpy (copy, list);
+
+  n = 0;
+  for (tok = strtok_r (copy, ",", &save); tok != NULL; tok = strtok_r (NULL, ",", &save)) {
+    lo = atoi (tok);
+    hi = lo;
+    if ((dash = strchr (tok, '-')) != NULL) {
+      hi = atoi (dash + 1);
+    }
+    if ((lo < 1) || (hi > 65535) || (lo > hi)) {
+      fprintf (stderr, "ERROR: Invalid port or range %s\n", tok);
+      exit (EXIT_FAILURE);
+    }
+    for (p=lo; p<=hi; p++) {
+      if (n >= MAX_PORTS) {
+        fprintf (stderr, "ERROR: Too many ports in list.\n");
+        exit (EXIT_FAILURE);
+      }
+      ports[n++] = p;
+    }
+  }
+  free (copy);
+
+  if (n == 0) {
+    fprintf (stderr, "ERROR: No ports to scan.\n");
+    exit (EXIT_FAILURE);
+  }
+
+  return (n);
+}
+
+// Validate a received frame as the answer to one of our probes, and report it.
+// Returns 1 for SYN-ACK (open), 2 for RST (closed), and 0 if it is not ours.
+int
+check_reply (scan *s, uint8_t *frame, int len, uint32_t src)
+{
+  int ihl;
+  uint8_t *ip, *tcp, flags;
+  uint16_t sport, dport;
+  uint32_t from, to, ack;
+  uint64_t cookie;
+  char addr[INET_ADDRSTRLEN];
+
+  if (len < (ETH_HDRLEN + IP4_HDRLEN + TCP_HDRLEN)) {
+    return (0);
+  }
+  ip = frame + ETH_HDRLEN;
+  ihl = (ip[0] & 0x0f) * 4;
+  if (((ip[0] >> 4) != 4) || (ip[9] != IPPROTO_TCP) || (len < (ETH_HDRLEN + ihl + TCP_HDRLEN))) {
+    return (0);
+  }
+  to = ((uint32_t) ip[16] << 24) | (ip[17] << 16) | (ip[18] << 8) | ip[19];
+  if (to != src) {
+    return (0);
+  }
+  from = ((uint32_t) ip[12] << 24) | (ip[13] << 16) | (ip[14] << 8) | ip[15];
+  if ((from - s->base) >= s->nhosts) {
+    return (0);
+  }
+
+  tcp = ip + ihl;
+  sport = (tcp[0] << 8) + tcp[1];
+  dport = (tcp[2] << 8) + tcp[3];
+  ack = ((uint32_t) tcp[8] << 24) | (tcp[9] << 16) | (tcp[10] << 8) | tcp[11];
+  flags = tcp[13];
+
+  // Recompute cookie: our SYN used up one sequence number, and went out from a port it chose.
+  cookie = syn_cookie (s, src, from, sport);
+  if (((uint32_t) (ack - 1) != (uint32_t) cookie) ||
+      (dport != (SPORT_BASE + ((cookie >> 32) & ((1u << SPORT_BITS) - 1))))) {
+    return (0);
+  }
+
+  inet_ntop (AF_INET, ip + 12, addr, INET_ADDRSTRLEN);
+  if ((flags & (TH_SYN | TH_ACK)) == (TH_SYN | TH_ACK)) {
+    printf ("open   %s:%u\n", addr, sport);
+    return (1);
+  }
+  if (flags & TH_RST) {
+    printf ("closed %s:%u\n", addr, sport);
+    return (2);
+  }
+
+  return (0);
+}
+
+// Add bytes to a running (host byte order) one's complement sum.
+uint32_t
+sum_bytes (uint32_t sum, uint8_t *data, int len)
+{
+  while (len > 1) {
+    sum += (data[0] << 8) + data[1];
+    data += 2;
+    len -= 2;
+  }
+
+  // Odd byte is padded with zero.
+  if (len == 1) {
+    sum += data[0] << 8;
+  }
+
+  return (sum);
+}
+
+// Fold a 32-bit running sum into 16 bits, with end-around carry.
+uint16_t
+fold_sum (uint32_t sum)
+{
+  while (sum >> 16) {
+    sum = (sum & 0xffff) + (sum >> 16);
+  }
+
+  return ((uint16_t) sum);
+}
+
+// Sleep until next scheduled send time, then schedule the one after.
+// Absolute deadlines keep the average rate exact even if one sleep runs long.
+void
+pace (struct timespec *next, long int interval)
+{
+  next->tv_nsec += interval;
+  while (next->tv_nsec >= 1000000000L) {
+    next->tv_nsec -= 1000000000L;
+    next->tv_sec++;
+  }
+  while (clock_nanosleep (CLOCK_MONOTONIC, TIMER_ABSTIME, next, NULL) == EINTR) {
+    if (stop == 1) {
+      break;
+    }
+  }
+}
+
+// Set up a pcapng writer, open the first capture file, and start the writer thread.
+void
+pcapng_open (pcapng_writer *w, char *prefix, char *ifname, int snaplen, uint64_t max_bytes, int max_seconds,
+             thread_stats *stats)
+{
+  int status;
+
+  memset (w, 0, sizeof (pcapng_writer));
+  snprintf (w->prefix, sizeof (w->prefix), "%s", prefix);
+  snprintf (w->ifname, sizeof (w->ifname), "%s", ifname);
+  w->snaplen = snaplen;
+  w->max_bytes = max_bytes;
+  w->max_seconds = max_seconds;
+  w->buf[0] = allocate_ustrmem (PCAP_BUFSIZE);
+  w->buf[1] = allocate_ustrmem (PCAP_BUFSIZE);
+  w->active = 0;
+  w->pending = -1;
+  w->stats = stats;
+  pcapng_file_open (w);
+
+  pthread_mutex_init (&w->lock, NULL);
+  pthread_cond_init (&w->cond, NULL);
+  if ((status = pthread_create (&w->thread, NULL, pcapng_thread, w)) != 0) {
+    fprintf (stderr, "pthread_create() failed.\nError message: %s\n", strerror (status));
+    exit (EXIT_FAILURE);
+  }
+}
+
+// Open the next capture file, and write its Section Header Block
+// and Interface Description Block (Ethernet, nanosecond timestamps).
+void
+pcapng_file_open (pcapng_writer *w)
+{
+  int c, n;
+  uint8_t hdr[128];
+  uint16_t u16;
+  uint32_t u32;
+  int64_t i64;
+  char filename[96];
+
+  w->fileno++;
+  snprintf (filename, sizeof (filename), "%s-%i.pcapng", w->prefix, w->fileno);
+  if ((w->fd = open (filename, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+    fprintf (stderr, "open() failed for capture file %s.\nError message: %s\n", filename, strerror (errno));
+    exit (EXIT_FAILURE);
+  }
+  posix_fadvise (w->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+  w->opened = time (NULL);
+
+  // Section Header Block: type, length, byte-order magic, version 1.0, section length unknown.
+  c = 0;
+  u32 = 0x0a0d0d0a; memcpy (hdr + c, &u32, 4); c += 4;
+  u32 = 28; memcpy (hdr + c, &u32, 4); c += 4;
+  u32 = 0x1a2b3c4d; memcpy (hdr + c, &u32, 4); c += 4;
+  u16 = 1; memcpy (hdr + c, &u16, 2); c += 2;
+  u16 = 0; memcpy (hdr + c, &u16, 2); c += 2;
+  i64 = -1; memcpy (hdr + c, &i64, 8); c += 8;
+  u32 = 28; memcpy (hdr + c, &u32, 4); c += 4;
+
+  // Interface Description Block: type, length (filled in below), link type, snap length,
+  // then options if_name (2), if_tsresol (9) = 10^-9 seconds, and end of options.
+  n = c;
+  u32 = 1; memcpy (hdr + c, &u32, 4); c += 8;
+  u16 = 1; memcpy (hdr + c, &u16, 2); c += 2;  // LINKTYPE_ETHERNET
+  u16 = 0; memcpy (hdr + c, &u16, 2); c += 2;
+  u32 = w->snaplen; memcpy (hdr + c, &u32, 4); c += 4;
+  u16 = 2; memcpy (hdr + c, &u16, 2); c += 2;
+  u16 = strlen (w->ifname); memcpy (hdr + c, &u16, 2); c += 2;
+  memset (hdr + c, 0, (u16 + 3) & ~3);
+  memcpy (hdr + c, w->ifname, u16);
+  c += (u16 + 3) & ~3;
+  u16 = 9; memcpy (hdr + c, &u16, 2); c += 2;
+  u16 = 1; memcpy (hdr + c, &u16, 2); c += 2;
+  hdr[c] = 9; memset (hdr + c + 1, 0, 3); c += 4;  // One byte value, padded to 4
+  u32 = 0; memcpy (hdr + c, &u32, 4); c += 4;
+  u32 = c - n + 4; memcpy (hdr + n + 4, &u32, 4);
+  memcpy (hdr + c, &u32, 4); c += 4;
+
+  write_all (w->fd, hdr, c);
+  w->file_bytes = 0;
+  stat_set (&w->stats->counter[CTR_CAP_FILES], w->fileno);
+}
+
+// Append a frame to the capture as an Enhanced Packet Block, with its timestamp (ns since
+// the epoch) and direction (1 inbound, 2 outbound) in the epb_flags option. Never blocks:
+// if the active buffer is full and the writer thread still has the other, the frame is dropped.
+void
+pcapng_frame (pcapng_writer *w, uint8_t *data, int len, uint64_t ts_ns, int direction)
+{
+  int caplen, padded, blen;
+  uint8_t *b;
+  uint16_t u16[2];
+  uint32_t u32[7];
+
+  caplen = (len < w->snaplen) ? len : w->snaplen;
+  padded = (caplen + 3) & ~3;
+  blen = 28 + padded + 12 + 4;
+  if ((w->len[w->active] + blen) > PCAP_BUFSIZE) {
+    if (pcapng_flush (w, 1) < 0) {
+      w->dropped++;
+      return;
+    }
+  }
+  b = w->buf[w->active] + w->len[w->active];
+
+  // Block type, length, interface ID, timestamp (high and low 32 bits),
+  // captured and original length.
+  u32[0] = 6;
+  u32[1] = blen;
+  u32[2] = 0;
+  u32[3] = ts_ns >> 32;
+  u32[4] = ts_ns & 0xffffffff;
+  u32[5] = caplen;
+  u32[6] = len;
+  memcpy (b, u32, 28);
+  memcpy (b + 28, data, caplen);
+  memset (b + 28 + caplen, 0, padded - caplen);
+  b += 28 + padded;
+
+  // Option epb_flags (2): direction in the low 2 bits; end of options; block length again.
+  u16[0] = 2;
+  u16[1] = 4;
+  memcpy (b, u16, 4);
+  u32[0] = direction;
+  u32[1] = 0;
+  u32[2] = blen;
+  memcpy (b + 4, u32, 12);
+
+  w->len[w->active] += blen;
+  w->frames++;
+}
+
+// Hand the active buffer, if not empty, to the writer thread, and carry on in the other one.
+// If the writer thread is still busy with the other buffer, return -1 at once if nowait is
+// set, or else wait for it. Returns 0 once the buffers have been swapped.
+int
+pcapng_flush (pcapng_writer *w, int nowait)
+{
+  if (w->len[w->active] == 0) {
+    return (0);
+  }
+  pthread_mutex_lock (&w->lock);
+  while (w->pending != -1) {
+    if (nowait) {
+      pthread_mutex_unlock (&w->lock);
+      return (-1);
+    }
+    pthread_cond_wait (&w->cond, &w->lock);
+  }
+  w->pending = w->active;
+  w->active ^= 1;
+  w->len[w->active] = 0;
+  pthread_cond_broadcast (&w->cond);
+  pthread_mutex_unlock (&w->lock);
+
+  return (0);
+}
+
+// Write out all captured frames, stop the writer thread, and close the capture file.
+void
+pcapng_close (pcapng_writer *w)
+{
+  pcapng_flush (w, 0);
+  pthread_mutex_lock (&w->lock);
+  while (w->pending != -1) {
+    pthread_cond_wait (&w->cond, &w->lock);
+  }
+  w->done = 1;
+  pthread_cond_broadcast (&w->cond);
+  pthread_mutex_unlock (&w->lock);
+  pthread_join (w->thread, NULL);
+
+  close (w->fd);
+  pthread_mutex_destroy (&w->lock);
+  pthread_cond_destroy (&w->cond);
+  free (w->buf[0]);
+  free (w->buf[1]);
+}
+
+// Writer thread: write each buffer handed over to the current capture file, first
+// starting a new file if the current one has reached its size or age limit.
+// Rotation happens only between buffers, which hold whole blocks.
+void *
+pcapng_thread (void *arg)
+{
+  int b;
+  uint64_t t, bytes;
+  pcapng_writer *w;
+
+  w = (pcapng_writer *) arg;
+  bytes = 0;
+  while (1) {
+    pthread_mutex_lock (&w->lock);
+    while ((w->pending == -1) && (w->done == 0)) {
+      pthread_cond_wait (&w->cond, &w->lock);
+    }
+    if (w->pending == -1) {
+      pthread_mutex_unlock (&w->lock);
+      break;
+    }
+    b = w->pending;
+    pthread_mutex_unlock (&w->lock);
+
+    if ((w->file_bytes > 0) &&
+        (((w->max_bytes > 0) && ((w->file_bytes + w->len[b]) > w->max_bytes)) ||
+         ((w->max_seconds > 0) && ((time (NULL) - w->opened) >= w->max_seconds)))) {
+      close (w->fd);
+      pcapng_file_open (w);
+    }
+    t = stat_ticks ();
+    write_all (w->fd, w->buf[b], w->len[b]);
+    stage_record (&w->stats->stage[STAGE_WRITE], 1, t);
+    w->file_bytes += w->len[b];
+    bytes += w->len[b];
+    stat_set (&w->stats->counter[CTR_CAP_BYTES], bytes);
+
+    pthread_mutex_lock (&w->lock);
+    w->pending = -1;
+    pthread_cond_broadcast (&w->cond);
+    pthread_mutex_unlock (&w->lock);
+  }
+
+  return (NULL);
+}
+
+// Write len bytes to file descriptor fd, however many write() calls it takes.
+void
+write_all (int fd, uint8_t *data, int len)
+{
+  int n;
+
+  while (len > 0) {
+    if ((n = write (fd, data, len)) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      perror ("write() failed to capture file ");
+      exit (EXIT_FAILURE);
+    }
+    data += n;
+    len -= n;
+  }
+}
+
+// Set up statistics: in POSIX shared memory segment name if publish is set, else in private memory.
+// Any segment left by an earlier scan is replaced. Names and layout are filled in, and the timer
+// rate measured, before the magic number which tells a reader the segment is ready.
+stats_shm *
+stats_open (char *name, int publish)
+{
+  int i, fd;
+  uint64_t c0, c1, n0, n1;
+  stats_shm *shm;
+  struct timespec ts;
+  static const char *stage_names[NUM_STAGES] = {"build", "checksum", "send", "receive", "match", "capture", "write"};
+  static const char *counter_names[NUM_COUNTERS] = {"probes", "retries", "received", "open", "closed",
+    "captured", "cap_dropped", "cap_bytes", "cap_files"};
+
+  if (publish) {
+    shm_unlink (name);
+    if ((fd = shm_open (name, O_RDWR | O_CREAT | O_EXCL, 0644)) < 0) {
+      perror ("shm_open() failed to create statistics segment ");
+      exit (EXIT_FAILURE);
+    }
+    if (ftruncate (fd, sizeof (stats_shm)) < 0) {
+      perror ("ftruncate() failed to size statistics segment ");
+      exit (EXIT_FAILURE);
+    }
+    shm = mmap (NULL, sizeof (stats_shm), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close (fd);
+  } else {
+    shm = mmap (NULL, sizeof (stats_shm), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  }
+  if (shm == MAP_FAILED) {
+    perror ("mmap() failed to map statistics ");
+    exit (EXIT_FAILURE);
+  }
+
+  // Memory comes zeroed, so only the header needs filling in.
+  shm->version = STATS_VERSION;
+  shm->nthreads = STATS_THREADS;
+  shm->nstages = NUM_STAGES;
+  shm->ncounters = NUM_COUNTERS;
+  shm->nbuckets = HIST_BUCKETS;
+  shm->pid = getpid ();
+  clock_gettime (CLOCK_REALTIME, &ts);
+  shm->start_ns = (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+  for (i=0; i<NUM_STAGES; i++) {
+    snprintf (shm->stage_names[i], STAT_NAMELEN, "%s", stage_names[i]);
+  }
+  for (i=0; i<NUM_COUNTERS; i++) {
+    snprintf (shm->counter_names[i], STAT_NAMELEN, "%s", counter_names[i]);
+  }
+
+  // Timer ticks per second, against the monotonic clock over 50 ms.
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  n0 = (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+  c0 = stat_ticks ();
+  usleep (50000);
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  n1 = (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+  c1 = stat_ticks ();
+  shm->tick_hz = (uint64_t) ((double) (c1 - c0) * 1e9 / (n1 - n0));
+
+  __atomic_store_n (&shm->magic, STATS_MAGIC, __ATOMIC_RELEASE);
+
+  return (shm);
+}
+
+// Read the timer: the CPU's timestamp counter where there is one, else the monotonic clock (ns).
+uint64_t
+stat_ticks (void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+  return (__rdtsc ());
+#else
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+
+  return ((uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec);
+#endif
+}
+
+// Record a run of a stage which handled items frames and began at timer reading start.
+// Returns the timer reading at the end, so the next stage can begin from it.
+uint64_t
+stage_record (stage_stats *st, uint64_t items, uint64_t start)
+{
+  int b;
+  uint64_t now, ticks;
+
+  now = stat_ticks ();
+  ticks = now - start;
+  b = (ticks > 1) ? (63 - __builtin_clzll (ticks)) : 0;
+  if (b >= HIST_BUCKETS) {
+    b = HIST_BUCKETS - 1;
+  }
+
+  stat_set (&st->runs, st->runs + 1);
+  stat_set (&st->items, st->items + items);
+  stat_set (&st->ticks, st->ticks + ticks);
+  stat_set (&st->hist[b], st->hist[b] + 1);
+  if (ticks > st->max) {
+    stat_set (&st->max, ticks);
+  }
+
+  return (now);
+}
+
+// Store a statistic. Only its own thread writes it, so no locked read-modify-write is needed;
+// storing the whole word at once means a reader never sees half of an update.
+void
+stat_set (uint64_t *p, uint64_t value)
+{
+  __atomic_store_n (p, value, __ATOMIC_RELAXED);
+}
+
+// SIGINT handler: stop sending and report results.
+void
+sig_handler (int signum)
+{
+  (void) signum;
+  stop = 1;
+}
+
+// Allocate memory for an array of chars.
+char *
+allocate_strmem (int len)
+{
+  void *tmp;
+
+  if (len <= 0) {
+    fprintf (stderr, "ERROR: Cannot allocate memory because len = %i in allocate_strmem().\n", len);
+    exit (EXIT_FAILURE);
+  }
+
+  tmp = (char *) malloc (len * sizeof (char));
+  if (tmp != NULL) {
+    memset (tmp, 0, len * sizeof (char));
+    return (tmp);
+  } else {
+    fprintf (stderr, "ERROR: Cannot allocate memory for array allocate_strmem().\n");
+    exit (EXIT_FAILURE);
+  }
+}
+
+// Allocate memory for an array of unsigned chars.
+uint8_t *
+allocate_ustrmem (int len)
+{
+  void *tmp;
+
+  if (len <= 0) {
+    fprintf (stderr, "ERROR: Cannot allocate memory because len = %i in allocate_ustrmem().\n", len);
+    exit (EXIT_FAILURE);
+  }
+
+  tmp = (uint8_t *) malloc (len * sizeof (uint8_t));
+  if (tmp != NULL) {
+    memset (tmp, 0, len * sizeof (uint8_t));
+    return (tmp);
+  } else {
+    fprintf (stderr, "ERROR: Cannot allocate memory for array allocate_ustrmem().\n");
+    exit (EXIT_FAILURE);
+  }
+}
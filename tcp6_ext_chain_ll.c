@@ -0,0 +1,773 @@
+/*  Copyright (C) 2013  P.D. Buchan (pdbuchan@yahoo.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Send IPv6 TCP SYN packets via raw socket at the link layer (ethernet frame),
+// each carrying a chain of extension headers.
+// The chain is described as a list of headers and options: a hop-by-hop header
+// with a router alert option, a type 3 (RPL) routing header, and a destination
+// header with an ILNP nonce option. The layout, alignment padding, and Next Header
+// links are worked out once into a template, which is then copied into every
+// frame with a single memcpy().
+// Need to have destination MAC address.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>           // close()
+#include <string.h>           // strcpy, memset(), and memcpy()
+
+#include <netdb.h>            // struct addrinfo
+#include <sys/types.h>        // needed for socket(), uint8_t, uint16_t, uint32_t
+#include <sys/socket.h>       // needed for socket()
+#include <netinet/in.h>       // IPPROTO_HOPOPTS, IPPROTO_ROUTING, IPPROTO_DSTOPTS, IPPROTO_TCP, INET6_ADDRSTRLEN
+#include <netinet/ip.h>       // IP_MAXPACKET (which is 65535)
+#include <netinet/ip6.h>      // struct ip6_hdr
+#define __FAVOR_BSD           // Use BSD format of tcp header
+#include <netinet/tcp.h>      // struct tcphdr
+#include <arpa/inet.h>        // inet_pton() and inet_ntop()
+#include <sys/ioctl.h>        // macro ioctl is defined
+#include <bits/ioctls.h>      // defines values for argument "request" of ioctl.
+#include <net/if.h>           // struct ifreq
+#include <linux/if_ether.h>   // ETH_P_IP = 0x0800, ETH_P_IPV6 = 0x86DD
+#include <linux/if_packet.h>  // struct sockaddr_ll (see man 7 packet)
+#include <net/ethernet.h>
+
+#include <errno.h>            // errno, perror()
+
+// Define some constants.
+#define ETH_HDRLEN 14         // Ethernet header length
+#define IP6_HDRLEN 40         // IPv6 header length
+#define OPT_HDRLEN 2          // Hop-by-hop or destination header length, excluding options
+#define RTE_HDRLEN 4          // Routing header length, excluding data
+#define TCP_HDRLEN 20         // TCP header length, excludes options data
+#define MAX_EXTHDRS 8         // Maximum number of extension headers in a chain
+#define MAX_OPTIONS 10        // Maximum number of options in a hop-by-hop or destination header
+#define MAX_OPTDATA 255       // Maximum length of an option's data
+#define MAX_ADDRESSES 16      // Maximum number of addresses in a type 3 routing header
+#define MAX_CHAINLEN 2048     // Maximum length of a complete extension header chain (bytes)
+
+// Define a struct for a hop-by-hop or destination option.
+// The option's alignment requirement is expressed as xN + y (Section 4.2 of RFC 2460).
+typedef struct _ext_opt ext_opt;
+struct _ext_opt {
+  uint8_t type;               // Option Type
+  uint8_t len;                // Length of Option Data field
+  int x, y;                   // Alignment requirement xN + y
+  uint8_t data[MAX_OPTDATA];  // Option Data
+};
+
+// Define a struct describing one extension header of a chain.
+// Hop-by-hop and destination headers use the options; a routing header uses the addresses.
+typedef struct _ext_spec ext_spec;
+struct _ext_spec {
+  uint8_t proto;              // IPPROTO_HOPOPTS, IPPROTO_ROUTING or IPPROTO_DSTOPTS
+  int nopt;                   // Number of options
+  ext_opt opt[MAX_OPTIONS];   // Options
+  uint8_t routing_type;       // Routing type (only type 3 is built here)
+  int naddr;                  // Number of addresses in routing header
+  struct in6_addr addr[MAX_ADDRESSES];  // Routing header addresses
+};
+
+// Define a struct for a built extension header chain.
+typedef struct _ext_chain ext_chain;
+struct _ext_chain {
+  uint8_t bytes[MAX_CHAINLEN];  // All extension headers, ready to copy after the IPv6 header
+  int len;                    // Length of chain (bytes)
+  uint8_t first;              // Protocol number of first header, for IPv6 Next Header field
+  struct in6_addr *final_dst; // Last routing header address, if any, for upper layer checksum
+};
+
+// Function prototypes
+int pad_needed (int, int, int);
+int write_pad (uint8_t *, int);
+int build_options_hdr (ext_spec *, uint8_t *);
+int build_route3_hdr (ext_spec *, uint8_t *);
+int build_chain (ext_spec *, int, uint8_t, ext_chain *);
+uint16_t checksum (uint16_t *, int);
+uint16_t tcp6_checksum (struct ip6_hdr, struct tcphdr, uint8_t *, int);
+char *allocate_strmem (int);
+uint8_t *allocate_ustrmem (int);
+int *allocate_intmem (int);
+
+int
+main (int argc, char **argv)
+{
+  int i, n, status, frame_length, sd, bytes, npackets, nspec, *tcp_flags;
+  char *interface, *target, *src_ip, *dst_ip, *address;
+  struct ip6_hdr iphdr, pseudo;
+  struct tcphdr tcphdr;
+  uint8_t *src_mac, *dst_mac, *ether_frame;
+  ext_spec *spec;
+  ext_chain *chain;
+  struct addrinfo hints, *res;
+  struct sockaddr_in6 *ipv6;
+  struct sockaddr_ll device;
+  struct ifreq ifr;
+  void *tmp;
+
+  // Allocate memory for various arrays.
+  src_mac = allocate_ustrmem (6);
+  dst_mac = allocate_ustrmem (6);
+  ether_frame = allocate_ustrmem (IP_MAXPACKET);
+  interface = allocate_strmem (40);
+  target = allocate_strmem (INET6_ADDRSTRLEN);
+  src_ip = allocate_strmem (INET6_ADDRSTRLEN);
+  dst_ip = allocate_strmem (INET6_ADDRSTRLEN);
+  address = allocate_strmem (INET6_ADDRSTRLEN);
+  tcp_flags = allocate_intmem (8);
+  spec = (ext_spec *) allocate_ustrmem (MAX_EXTHDRS * sizeof (ext_spec));
+  chain = (ext_chain *) allocate_ustrmem (sizeof (ext_chain));
+
+  // Interface to send packet through.
+  strcpy (interface, "eth0");
+
+  // Number of packets to send.
+  npackets = 10;
+
+  // Submit request for a socket descriptor to look up interface.
+  if ((sd = socket (PF_PACKET, SOCK_RAW, htons (ETH_P_ALL))) < 0) {
+    perror ("socket() failed to get socket descriptor for using ioctl() ");
+    exit (EXIT_FAILURE);
+  }
+
+  // Use ioctl() to look up interface name and get its MAC address.
+  memset (&ifr, 0, sizeof (ifr));
+  snprintf (ifr.ifr_name, sizeof (ifr.ifr_name), "%s", interface);
+  if (ioctl (sd, SIOCGIFHWADDR, &ifr) < 0) {
+    perror ("ioctl() failed to get source MAC address ");
+    return (EXIT_FAILURE);
+  }
+  close (sd);
+
+  // Copy source MAC address.
+  memcpy (src_mac, ifr.ifr_hwaddr.sa_data, 6 * sizeof (uint8_t));
+
+  // Report source MAC address to stdout.
+  printf ("MAC address for interface %s is ", interface);
+  for (i=0; i<5; i++) {
+    printf ("%02x:", src_mac[i]);
+  }
+  printf ("%02x\n", src_mac[5]);
+
+  // Find interface index from interface name and store index in
+  // struct sockaddr_ll device, which will be used as an argument of sendto().
+  memset (&device, 0, sizeof (device));
+  if ((device.sll_ifindex = if_nametoindex (interface)) == 0) {
+    perror ("if_nametoindex() failed to obtain interface index ");
+    exit (EXIT_FAILURE);
+  }
+  printf ("Index for interface %s is %i\n", interface, device.sll_ifindex);
+
+  // Set destination MAC address: you need to fill these out
+  dst_mac[0] = 0xff;
+  dst_mac[1] = 0xff;
+  dst_mac[2] = 0xff;
+  dst_mac[3] = 0xff;
+  dst_mac[4] = 0xff;
+  dst_mac[5] = 0xff;
+
+  // Source IPv6 address: you need to fill this out
+  strcpy (src_ip, "2001:db8::214:51ff:fe2f:1556");
+
+  // Destination URL or IPv6 address: you need to fill this out
+  strcpy (target, "ipv6.google.com");
+
+  // Fill out hints for getaddrinfo().
+  memset (&hints, 0, sizeof (struct addrinfo));
+  hints.ai_family = AF_INET6;
+  hints.ai_socktype = SOCK_RAW;
+  hints.ai_flags = hints.ai_flags | AI_CANONNAME;
+
+  // Resolve target using getaddrinfo().
+  if ((status = getaddrinfo (target, NULL, &hints, &res)) != 0) {
+    fprintf (stderr, "getaddrinfo() failed: %s\n", gai_strerror (status));
+    exit (EXIT_FAILURE);
+  }
+  ipv6 = (struct sockaddr_in6 *) res->ai_addr;
+  tmp = &(ipv6->sin6_addr);
+  if (inet_ntop (AF_INET6, tmp, dst_ip, INET6_ADDRSTRLEN) == NULL) {
+    status = errno;
+    fprintf (stderr, "inet_ntop() failed.\nError message: %s", strerror (status));
+    exit (EXIT_FAILURE);
+  }
+  freeaddrinfo (res);
+
+  // Fill out sockaddr_ll.
+  device.sll_family = AF_PACKET;
+  memcpy (device.sll_addr, src_mac, 6 * sizeof (uint8_t));
+  device.sll_halen = 6;
+
+  // Describe the extension header chain, in the order the headers appear in the packet.
+  nspec = 0;
+
+  // Hop-by-hop header with a router alert option (with bogus value).
+  // Alignment requirement is 2n+0 for router alert. See Section 2.1 of RFC 2711.
+  spec[nspec].proto = IPPROTO_HOPOPTS;
+  spec[nspec].nopt = 1;
+  spec[nspec].opt[0].type = 5;  // Option Type: router alert
+  spec[nspec].opt[0].len = 2;  // Length of Option Data field
+  spec[nspec].opt[0].x = 2;
+  spec[nspec].opt[0].y = 0;
+  spec[nspec].opt[0].data[0] = 0;  // Option Data: some unassigned IANA value, you
+  spec[nspec].opt[0].data[1] = 5;  // should select what you want.
+  nspec++;
+
+  // Type 3 routing header: Source Routing Header for RPL (RFC 6554), with full (uncompressed) addresses.
+  spec[nspec].proto = IPPROTO_ROUTING;
+  spec[nspec].routing_type = 3;
+  spec[nspec].naddr = 0;
+  // First address: you need to fill this out
+  strcpy (address, "2001:db8::214:51ff:fe2f:1556");
+  if ((status = inet_pton (AF_INET6, address, &spec[nspec].addr[spec[nspec].naddr++])) != 1) {
+    fprintf (stderr, "inet_pton() failed.\nError message: %s", strerror (status));
+    exit (EXIT_FAILURE);
+  }
+  // Second address: you need to fill this out
+  strcpy (address, "2001:db8::23e:7dd3:529:7cc2");
+  if ((status = inet_pton (AF_INET6, address, &spec[nspec].addr[spec[nspec].naddr++])) != 1) {
+    fprintf (stderr, "inet_pton() failed.\nError message: %s", strerror (status));
+    exit (EXIT_FAILURE);
+  }
+  // Third address: you need to fill this out
+  strcpy (address, "2001:db8::65ff:203c:9901:ab2b");
+  if ((status = inet_pton (AF_INET6, address, &spec[nspec].addr[spec[nspec].naddr++])) != 1) {
+    fprintf (stderr, "inet_pton() failed.\nError message: %s", strerror (status));
+    exit (EXIT_FAILURE);
+  }
+  nspec++;
+
+  // Destination header (last) with an ILNP nonce option.
+  // Alignment requirement is 4n+2 for ILNP nonce, so that nonce itself, starts on a 4-byte boundary.
+  // See Section 2 of RFC 6744. Nonce can be 4 bytes or 12 bytes long. We use 12 bytes here.
+  spec[nspec].proto = IPPROTO_DSTOPTS;
+  spec[nspec].nopt = 1;
+  spec[nspec].opt[0].type = 139;  // Option Type: ILNP nonce
+  spec[nspec].opt[0].len = 12;  // Length of nonce, in bytes
+  spec[nspec].opt[0].x = 4;
+  spec[nspec].opt[0].y = 2;
+  // Some unique, unpredicable 12-byte number
+  memcpy (spec[nspec].opt[0].data, "\x04\x23\xe5\x00\x4f\x32\xd3\x17\x9c\xaa\x66\x74", 12);
+  nspec++;
+
+  // Lay out the chain once: alignment, padding, lengths, and Next Header links.
+  build_chain (spec, nspec, IPPROTO_TCP, chain);
+  printf ("Extension header chain length (bytes): %i\n", chain->len);
+  for (i=0; i<chain->len; i++) {
+    printf ("%02x%s", chain->bytes[i], (((i + 1) % 8) == 0) ? "\n" : " ");
+  }
+  if ((chain->len % 8) != 0) {
+    printf ("\n");
+  }
+
+  // IPv6 header
+
+  // IPv6 version (4 bits), Traffic class (8 bits), Flow label (20 bits)
+  iphdr.ip6_flow = htonl ((6 << 28) | (0 << 20) | 0);
+
+  // Payload length (16 bits): extension headers + TCP header
+  iphdr.ip6_plen = htons (chain->len + TCP_HDRLEN);
+
+  // Next header (8 bits): first extension header in chain
+  iphdr.ip6_nxt = chain->first;
+
+  // Hop limit (8 bits): default to maximum value
+  iphdr.ip6_hops = 255;
+
+  // Source IPv6 address (128 bits)
+  if ((status = inet_pton (AF_INET6, src_ip, &(iphdr.ip6_src))) != 1) {
+    fprintf (stderr, "inet_pton() failed.\nError message: %s", strerror (status));
+    exit (EXIT_FAILURE);
+  }
+
+  // Destination IPv6 address (128 bits)
+  if ((status = inet_pton (AF_INET6, dst_ip, &(iphdr.ip6_dst))) != 1) {
+    fprintf (stderr, "inet_pton() failed.\nError message: %s", strerror (status));
+    exit (EXIT_FAILURE);
+  }
+
+  // Pseudo-header for the TCP checksum uses the final destination, which is
+  // the last address of a routing header, if there is one (Section 8.1 of RFC 2460).
+  pseudo = iphdr;
+  pseudo.ip6_nxt = IPPROTO_TCP;
+  if (chain->final_dst != NULL) {
+    pseudo.ip6_dst = *chain->final_dst;
+  }
+
+  // TCP header
+
+  // Source port number (16 bits)
+  tcphdr.th_sport = htons (80);
+
+  // Destination port number (16 bits)
+  tcphdr.th_dport = htons (80);
+
+  // Sequence number (32 bits): set for each packet in loop below.
+  tcphdr.th_seq = htonl (0);
+
+  // Acknowledgement number (32 bits): 0 in first packet of SYN/ACK process
+  tcphdr.th_ack = htonl (0);
+
+  // Reserved (4 bits): should be 0
+  tcphdr.th_x2 = 0;
+
+  // Data offset (4 bits): size of TCP header in 32-bit words
+  tcphdr.th_off = TCP_HDRLEN / 4;
+
+  // Flags (8 bits)
+
+  // FIN flag (1 bit)
+  tcp_flags[0] = 0;
+
+  // SYN flag (1 bit): set to 1
+  tcp_flags[1] = 1;
+
+  // RST flag (1 bit)
+  tcp_flags[2] = 0;
+
+  // PSH flag (1 bit)
+  tcp_flags[3] = 0;
+
+  // ACK flag (1 bit)
+  tcp_flags[4] = 0;
+
+  // URG flag (1 bit)
+  tcp_flags[5] = 0;
+
+  // ECE flag (1 bit)
+  tcp_flags[6] = 0;
+
+  // CWR flag (1 bit)
+  tcp_flags[7] = 0;
+
+  tcphdr.th_flags = 0;
+  for (i=0; i<8; i++) {
+    tcphdr.th_flags += (tcp_flags[i] << i);
+  }
+
+  // Window size (16 bits)
+  tcphdr.th_win = htons (65535);
+
+  // Urgent pointer (16 bits): 0 (only valid if URG flag is set)
+  tcphdr.th_urp = htons (0);
+
+  // Fill out ethernet frame header, IPv6 header, and extension header chain.
+  // None of these change from packet to packet.
+
+  // Destination and Source MAC addresses
+  memcpy (ether_frame, dst_mac, 6 * sizeof (uint8_t));
+  memcpy (ether_frame + 6, src_mac, 6 * sizeof (uint8_t));
+
+  // Next is ethernet type code (ETH_P_IPV6 for IPv6).
+  // http://www.iana.org/assignments/ethernet-numbers
+  ether_frame[12] = ETH_P_IPV6 / 256;
+  ether_frame[13] = ETH_P_IPV6 % 256;
+
+  // IPv6 header
+  memcpy (ether_frame + ETH_HDRLEN, &iphdr, IP6_HDRLEN * sizeof (uint8_t));
+
+  // Ethernet frame length = ethernet header + IPv6 header + extension headers + TCP header
+  frame_length = ETH_HDRLEN + IP6_HDRLEN + chain->len + TCP_HDRLEN;
+
+  // Submit request for a raw socket descriptor.
+  if ((sd = socket (PF_PACKET, SOCK_RAW, htons (ETH_P_ALL))) < 0) {
+    perror ("socket() failed ");
+    exit (EXIT_FAILURE);
+  }
+
+  for (n=0; n<npackets; n++) {
+
+    // Extension header chain: a single copy of the prebuilt template.
+    memcpy (ether_frame + ETH_HDRLEN + IP6_HDRLEN, chain->bytes, chain->len * sizeof (uint8_t));
+
+    // TCP header, with a new sequence number for each packet.
+    tcphdr.th_seq = htonl (n);
+    tcphdr.th_sum = 0;
+    tcphdr.th_sum = tcp6_checksum (pseudo, tcphdr, NULL, 0);
+    memcpy (ether_frame + ETH_HDRLEN + IP6_HDRLEN + chain->len, &tcphdr, TCP_HDRLEN * sizeof (uint8_t));
+
+    // Send ethernet frame to socket.
+    if ((bytes = sendto (sd, ether_frame, frame_length, 0, (struct sockaddr *) &device, sizeof (device))) <= 0) {
+      perror ("sendto() failed");
+      exit (EXIT_FAILURE);
+    }
+  }
+  printf ("Sent %i packets of %i bytes\n", npackets, frame_length);
+
+  // Close socket descriptor.
+  close (sd);
+
+  // Free allocated memory.
+  free (src_mac);
+  free (dst_mac);
+  free (ether_frame);
+  free (interface);
+  free (target);
+  free (src_ip);
+  free (dst_ip);
+  free (address);
+  free (tcp_flags);
+  free (spec);
+  free (chain);
+
+  return (EXIT_SUCCESS);
+}
+
+// Number of padding bytes needed so an option starting at offset indx satisfies
+// alignment requirement xN + y (Section 4.2 of RFC 2460).
+int
+pad_needed (int indx, int x, int y)
+{
+  return ((((y - indx) % x) + x) % x);
+}
+
+// Write n bytes of padding: a Pad1 option if n = 1, otherwise a PadN option.
+int
+write_pad (uint8_t *buf, int n)
+{
+  if (n == 1) {
+    buf[0] = 0;  // Padding option type: Pad1
+  } else if (n > 1) {
+    buf[0] = 1;  // Padding option type: PadN
+    buf[1] = n - 2;  // PadN length: N - 2
+    memset (buf + 2, 0, (n - 2) * sizeof (uint8_t));
+  }
+
+  return (n);
+}
+
+// Build a hop-by-hop or destination options header, with all alignment
+// padding and final padding to a multiple of 8 bytes. Next Header is filled in later.
+// Returns length of header (bytes).
+int
+build_options_hdr (ext_spec *spec, uint8_t *out)
+{
+  int i, indx;
+
+  // Next Header and Header Length are the first two bytes.
+  indx = OPT_HDRLEN;
+
+  for (i=0; i<spec->nopt; i++) {
+
+    // Pad as needed to achieve alignment requirements for option i.
+    indx += write_pad (out + indx, pad_needed (indx, spec->opt[i].x, spec->opt[i].y));
+
+    // Option Type, Option Data Length, Option Data
+    out[indx] = spec->opt[i].type;
+    out[indx + 1] = spec->opt[i].len;
+    memcpy (out + indx + 2, spec->opt[i].data, spec->opt[i].len * sizeof (uint8_t));
+    indx += 2 + spec->opt[i].len;
+  }
+
+  // Now pad last option to next 8-byte boundary (Section 4.2 of RFC 2460).
+  indx += write_pad (out + indx, pad_needed (indx, 8, 0));
+
+  // Header length in units of 8 bytes, excluding first 8 bytes (Section 4.3 of RFC 2460).
+  out[1] = (indx / 8) - 1;
+
+  return (indx);
+}
+
+// Build a type 3 routing header (Source Routing Header for RPL) with full addresses.
+// Next Header is filled in later. Returns length of header (bytes).
+int
+build_route3_hdr (ext_spec *spec, uint8_t *out)
+{
+  int i, indx, pad;
+
+  // Section 3 of RFC 6554
+  out[2] = spec->routing_type;  // Routing Type
+  out[3] = spec->naddr;  // Segments Left: number of addresses still to be visited
+  out[4] = 0;  // CmprI (4 bits) and CmprE (4 bits): 0 = no prefix elided, full IPv6 addresses
+  out[6] = 0;  // Reserved
+  out[7] = 0;  // Reserved
+  indx = RTE_HDRLEN + 4;
+
+  for (i=0; i<spec->naddr; i++) {
+    memcpy (out + indx, &spec->addr[i], 16 * sizeof (uint8_t));
+    indx += 16;
+  }
+
+  // Pad (4 bits): number of padding octets after the last address, so the header is a multiple of 8 bytes.
+  pad = pad_needed (indx, 8, 0);
+  memset (out + indx, 0, pad * sizeof (uint8_t));
+  indx += pad;
+  out[5] = pad << 4;  // Pad (4 bits) and Reserved (4 bits)
+
+  // Header length in units of 8 bytes, excluding first 8 bytes.
+  out[1] = (indx / 8) - 1;
+
+  return (indx);
+}
+
+// Lay out a complete extension header chain from a list of header descriptions.
+// Each header's Next Header field is linked to the following header, and the
+// last one to the upper layer protocol.
+int
+build_chain (ext_spec *spec, int nspec, uint8_t upper, ext_chain *chain)
+{
+  int i, j, len, prev;
+
+  memset (chain, 0, sizeof (ext_chain));
+  chain->first = upper;
+  prev = -1;  // Offset of previous header's Next Header field
+
+  for (i=0; i<nspec; i++) {
+
+    // A hop-by-hop header must immediately follow the IPv6 header (Section 4.1 of RFC 2460).
+    if ((spec[i].proto == IPPROTO_HOPOPTS) && (i != 0)) {
+      fprintf (stderr, "ERROR: Hop-by-hop header must be first in the extension header chain.\n");
+      exit (EXIT_FAILURE);
+    }
+
+    // Make sure the header fits, allowing for worst-case padding.
+    len = RTE_HDRLEN + 4 + (16 * spec[i].naddr) + 7;
+    for (j=0; j<spec[i].nopt; j++) {
+      if ((spec[i].opt[j].x < 1) || (spec[i].opt[j].y >= spec[i].opt[j].x)) {
+        fprintf (stderr, "ERROR: Invalid alignment requirement %in+%i for option %i.\n", spec[i].opt[j].x, spec[i].opt[j].y, j);
+        exit (EXIT_FAILURE);
+      }
+      len += spec[i].opt[j].x + 2 + spec[i].opt[j].len;
+    }
+    if ((chain->len + len) > MAX_CHAINLEN) {
+      fprintf (stderr, "ERROR: Extension header chain too long in build_chain().\n");
+      exit (EXIT_FAILURE);
+    }
+
+    if ((spec[i].proto == IPPROTO_HOPOPTS) || (spec[i].proto == IPPROTO_DSTOPTS)) {
+      len = build_options_hdr (&spec[i], chain->bytes + chain->len);
+
+    } else if ((spec[i].proto == IPPROTO_ROUTING) && (spec[i].routing_type == 3)) {
+      if ((spec[i].naddr < 1) || (spec[i].naddr > MAX_ADDRESSES)) {
+        fprintf (stderr, "ERROR: Type 3 routing header needs between 1 and %i addresses.\n", MAX_ADDRESSES);
+        exit (EXIT_FAILURE);
+      }
+      len = build_route3_hdr (&spec[i], chain->bytes + chain->len);
+      chain->final_dst = &spec[i].addr[spec[i].naddr - 1];
+
+    } else {
+      fprintf (stderr, "ERROR: Unsupported extension header %i in build_chain().\n", spec[i].proto);
+      exit (EXIT_FAILURE);
+    }
+
+    // Link previous header (or IPv6 header) to this one.
+    if (prev < 0) {
+      chain->first = spec[i].proto;
+    } else {
+      chain->bytes[prev] = spec[i].proto;
+    }
+    prev = chain->len;
+    chain->len += len;
+  }
+
+  // Last header points to upper layer protocol.
+  if (prev >= 0) {
+    chain->bytes[prev] = upper;
+  }
+
+  return (EXIT_SUCCESS);
+}
+
+// Checksum function
+uint16_t
+checksum (uint16_t *addr, int len)
+{
+  int nleft = len;
+  int sum = 0;
+  uint16_t *w = addr;
+  uint16_t answer = 0;
+
+  while (nleft > 1) {
+    sum += *w++;
+    nleft -= sizeof (uint16_t);
+  }
+
+  if (nleft == 1) {
+    *(uint8_t *) (&answer) = *(uint8_t *) w;
+    sum += answer;
+  }
+
+  sum = (sum >> 16) + (sum & 0xFFFF);
+  sum += (sum >> 16);
+  answer = ~sum;
+  return (answer);
+}
+
+// Build IPv6 TCP pseudo-header and call checksum function (Section 8.1 of RFC 2460).
+uint16_t
+tcp6_checksum (struct ip6_hdr iphdr, struct tcphdr tcphdr, uint8_t *payload, int payloadlen)
+{
+  uint32_t lvalue;
+  char buf[IP_MAXPACKET], cvalue;
+  char *ptr;
+  int chksumlen = 0;
+  int i;
+
+  memset (buf, 0, IP_MAXPACKET * sizeof (uint8_t));
+
+  ptr = &buf[0];  // ptr points to beginning of buffer buf
+
+  // Copy source IP address into buf (128 bits)
+  memcpy (ptr, &iphdr.ip6_src.s6_addr, sizeof (iphdr.ip6_src.s6_addr));
+  ptr += sizeof (iphdr.ip6_src.s6_addr);
+  chksumlen += sizeof (iphdr.ip6_src.s6_addr);
+
+  // Copy destination IP address into buf (128 bits)
+  memcpy (ptr, &iphdr.ip6_dst.s6_addr, sizeof (iphdr.ip6_dst.s6_addr));
+  ptr += sizeof (iphdr.ip6_dst.s6_addr);
+  chksumlen += sizeof (iphdr.ip6_dst.s6_addr);
+
+  // Copy TCP length to buf (32 bits)
+  lvalue = htonl (sizeof (tcphdr) + payloadlen);
+  memcpy (ptr, &lvalue, sizeof (lvalue));
+  ptr += sizeof (lvalue);
+  chksumlen += sizeof (lvalue);
+
+  // Copy zero field to buf (24 bits)
+  *ptr = 0; ptr++;
+  *ptr = 0; ptr++;
+  *ptr = 0; ptr++;
+  chksumlen += 3;
+
+  // Copy next header field to buf (8 bits)
+  memcpy (ptr, &iphdr.ip6_nxt, sizeof (iphdr.ip6_nxt));
+  ptr += sizeof (iphdr.ip6_nxt);
+  chksumlen += sizeof (iphdr.ip6_nxt);
+
+  // Copy TCP source port to buf (16 bits)
+  memcpy (ptr, &tcphdr.th_sport, sizeof (tcphdr.th_sport));
+  ptr += sizeof (tcphdr.th_sport);
+  chksumlen += sizeof (tcphdr.th_sport);
+
+  // Copy TCP destination port to buf (16 bits)
+  memcpy (ptr, &tcphdr.th_dport, sizeof (tcphdr.th_dport));
+  ptr += sizeof (tcphdr.th_dport);
+  chksumlen += sizeof (tcphdr.th_dport);
+
+  // Copy sequence number to buf (32 bits)
+  memcpy (ptr, &tcphdr.th_seq, sizeof (tcphdr.th_seq));
+  ptr += sizeof (tcphdr.th_seq);
+  chksumlen += sizeof (tcphdr.th_seq);
+
+  // Copy acknowledgement number to buf (32 bits)
+  memcpy (ptr, &tcphdr.th_ack, sizeof (tcphdr.th_ack));
+  ptr += sizeof (tcphdr.th_ack);
+  chksumlen += sizeof (tcphdr.th_ack);
+
+  // Copy data offset to buf (4 bits) and
+  // copy reserved bits to buf (4 bits)
+  cvalue = (tcphdr.th_off << 4) + tcphdr.th_x2;
+  memcpy (ptr, &cvalue, sizeof (cvalue));
+  ptr += sizeof (cvalue);
+  chksumlen += sizeof (cvalue);
+
+  // Copy TCP flags to buf (8 bits)
+  memcpy (ptr, &tcphdr.th_flags, sizeof (tcphdr.th_flags));
+  ptr += sizeof (tcphdr.th_flags);
+  chksumlen += sizeof (tcphdr.th_flags);
+
+  // Copy TCP window size to buf (16 bits)
+  memcpy (ptr, &tcphdr.th_win, sizeof (tcphdr.th_win));
+  ptr += sizeof (tcphdr.th_win);
+  chksumlen += sizeof (tcphdr.th_win);
+
+  // Copy TCP checksum to buf (16 bits)
+  // Zero, since we don't know it yet
+  *ptr = 0; ptr++;
+  *ptr = 0; ptr++;
+  chksumlen += 2;
+
+  // Copy urgent pointer to buf (16 bits)
+  memcpy (ptr, &tcphdr.th_urp, sizeof (tcphdr.th_urp));
+  ptr += sizeof (tcphdr.th_urp);
+  chksumlen += sizeof (tcphdr.th_urp);
+
+  // Copy payload to buf
+  memcpy (ptr, payload, payloadlen * sizeof (uint8_t));
+  ptr += payloadlen;
+  chksumlen += payloadlen;
+
+  // Pad to the next 16-bit boundary
+  i = 0;
+  while (((payloadlen+i)%2) != 0) {
+    i++;
+    chksumlen++;
+    ptr++;
+  }
+
+  return checksum ((uint16_t *) buf, chksumlen);
+}
+
+// Allocate memory for an array of chars.
+char *
+allocate_strmem (int len)
+{
+  void *tmp;
+
+  if (len <= 0) {
+    fprintf (stderr, "ERROR: Cannot allocate memory because len = %i in allocate_strmem().\n", len);
+    exit (EXIT_FAILURE);
+  }
+
+  tmp = (char *) malloc (len * sizeof (char));
+  if (tmp != NULL) {
+    memset (tmp, 0, len * sizeof (char));
+    return (tmp);
+  } else {
+    fprintf (stderr, "ERROR: Cannot allocate memory for array allocate_strmem().\n");
+    exit (EXIT_FAILURE);
+  }
+}
+
+// Allocate memory for an array of unsigned chars.
+uint8_t *
+allocate_ustrmem (int len)
+{
+  void *tmp;
+
+  if (len <= 0) {
+    fprintf (stderr, "ERROR: Cannot allocate memory because len = %i in allocate_ustrmem().\n", len);
+    exit (EXIT_FAILURE);
+  }
+
+  tmp = (uint8_t *) malloc (len * sizeof (uint8_t));
+  if (tmp != NULL) {
+    memset (tmp, 0, len * sizeof (uint8_t));
+    return (tmp);
+  } else {
+    fprintf (stderr, "ERROR: Cannot allocate memory for array allocate_ustrmem().\n");
+    exit (EXIT_FAILURE);
+  }
+}
+
+// Allocate memory for an array of ints.
+int *
+allocate_intmem (int len)
+{
+  void *tmp;
+
+  if (len <= 0) {
+    fprintf (stderr, "ERROR: Cannot allocate memory because len = %i in allocate_intmem().\n", len);
+    exit (EXIT_FAILURE);
+  }
+
+  tmp = (int *) malloc (len * sizeof (int));
+  if (tmp != NULL) {
+    memset (tmp, 0, len * sizeof (int));
+    return (tmp);
+  } else {
+    fprintf (stderr, "ERROR: Cannot allocate memory for array allocate_intmem().\n");
+    exit (EXIT_FAILURE);
+  }
+}
@@ -0,0 +1,527 @@
+/*  Copyright (C) 2013  P.D. Buchan (pdbuchan@yahoo.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Send a large amount of TCP payload as IPv6 TCP segments via raw socket
+// at the link layer (ethernet frame), and compare two ways of doing it:
+// - software: we cut the payload into MSS-sized segments and compute each
+//   segment's headers and TCP checksum ourselves;
+// - GSO: we hand the kernel one TCP "super-frame" of up to 64 KB at a time, preceded by
+//   a struct virtio_net_hdr (socket option PACKET_VNET_HDR) asking for it to be cut into
+//   MSS-sized segments (GSO_TCPV6) and checksummed. This is done by the NIC (TSO) if it can,
+//   or else by the kernel just before the driver. We only fill in the headers once per
+//   super-frame, and never touch the payload.
+// Need to have destination MAC address.
+// Segments are sent with ACK set, but there is no connection; a receiving host answers with resets.
+
+#define _GNU_SOURCE           // sendmmsg() and struct mmsghdr
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>           // close()
+#include <string.h>           // strcpy, memset(), and memcpy()
+
+#include <netdb.h>            // struct addrinfo
+#include <sys/types.h>        // needed for socket(), uint8_t, uint16_t, uint32_t
+#include <sys/socket.h>       // needed for socket(), sendmmsg()
+#include <netinet/in.h>       // IPPROTO_TCP, INET6_ADDRSTRLEN
+#include <netinet/ip.h>       // IP_MAXPACKET (which is 65535)
+#include <arpa/inet.h>        // inet_pton() and inet_ntop()
+#include <sys/ioctl.h>        // macro ioctl is defined
+#include <bits/ioctls.h>      // defines values for argument "request" of ioctl.
+#include <net/if.h>           // struct ifreq
+#include <linux/if_ether.h>   // ETH_P_IP = 0x0800, ETH_P_IPV6 = 0x86DD
+#include <linux/if_packet.h>  // struct sockaddr_ll (see man 7 packet), PACKET_VNET_HDR
+#include <net/ethernet.h>
+#include <linux/virtio_net.h> // struct virtio_net_hdr
+#include <sys/resource.h>     // getrusage()
+#include <signal.h>           // signal(), SIGINT
+#include <time.h>             // clock_gettime()
+
+#include <errno.h>            // errno, perror()
+
+// Define some constants.
+#define ETH_HDRLEN 14         // Ethernet header length
+#define IP6_HDRLEN 40         // IPv6 header length
+#define TCP_HDRLEN 20         // TCP header length, excludes options data
+#define HDRS_LEN (ETH_HDRLEN + IP6_HDRLEN + TCP_HDRLEN)  // Length of all headers in front of the payload
+#define VNET_HDRLEN (sizeof (struct virtio_net_hdr))   // Length of header in front of each frame with PACKET_VNET_HDR
+#define MSS 1440              // TCP maximum segment size: payload bytes per segment on the wire
+#define SEGS_PER_FRAME 45     // Segments per super-frame: IPv6 payload length must fit in 16 bits
+#define SUPER_LEN (MSS * SEGS_PER_FRAME)  // Payload bytes per super-frame
+#define BATCH 64              // Maximum number of frames handed to sendmmsg() at once
+#define MODE_SOFTWARE 0       // Modes: segment in software,
+#define MODE_GSO 1            // let kernel or NIC segment super-frames,
+#define MODE_BOTH 2           // or both in turn, for comparison
+
+// Define a struct for the results of one run.
+typedef struct _run_stats run_stats;
+struct _run_stats {
+  long int frames;      // Frames handed to kernel
+  long int segments;    // TCP segments these make on the wire
+  long int bytes;       // TCP payload bytes
+  double wall;          // Elapsed time (s)
+  double user;          // CPU time in our code (s)
+  double sys;           // CPU time in kernel on our behalf (s)
+};
+
+// Function prototypes
+int build_headers (uint8_t *, uint8_t *, uint8_t *, struct in6_addr, struct in6_addr, uint16_t, uint16_t, uint32_t, int, int, int);
+void run (int, int, struct sockaddr_ll *, uint8_t *, uint8_t *, struct in6_addr, struct in6_addr, uint16_t, uint16_t, uint8_t *, long int, run_stats *);
+void report (char *, run_stats *);
+double seconds (struct timeval *);
+uint32_t sum_bytes (uint32_t, uint8_t *, int);
+uint16_t fold_sum (uint32_t);
+void sig_handler (int);
+char *allocate_strmem (int);
+uint8_t *allocate_ustrmem (int);
+
+// Set by SIGINT handler to end current run.
+volatile sig_atomic_t stop = 0;
+
+int
+main (int argc, char **argv)
+{
+  int i, status, sd, mode;
+  long int total;
+  char *interface, *target, *src_ip, *dst_ip;
+  uint8_t *src_mac, *dst_mac, *payload;
+  uint16_t sport, dport;
+  struct addrinfo hints, *res;
+  struct sockaddr_in6 *ipv6;
+  struct sockaddr_ll device;
+  struct ifreq ifr;
+  struct in6_addr saddr, daddr;
+  run_stats stats[2];
+  void *tmp;
+
+  // Allocate memory for various arrays.
+  src_mac = allocate_ustrmem (6);
+  dst_mac = allocate_ustrmem (6);
+  interface = allocate_strmem (40);
+  target = allocate_strmem (40);
+  src_ip = allocate_strmem (INET6_ADDRSTRLEN);
+  dst_ip = allocate_strmem (INET6_ADDRSTRLEN);
+  payload = allocate_ustrmem (SUPER_LEN);
+
+  // Interface to send packets through.
+  strcpy (interface, "eth0");
+
+  // Mode (MODE_SOFTWARE, MODE_GSO or MODE_BOTH), and bytes of TCP payload to send in each run.
+  mode = MODE_BOTH;
+  total = 1024L * 1024L * 1024L;
+
+  // TCP ports.
+  sport = 60000;
+  dport = 80;
+
+  // Submit request for a socket descriptor to look up interface.
+  if ((sd = socket (PF_PACKET, SOCK_RAW, htons (ETH_P_ALL))) < 0) {
+    perror ("socket() failed to get socket descriptor for using ioctl() ");
+    exit (EXIT_FAILURE);
+  }
+
+  // Use ioctl() to look up interface name and get its MAC address.
+  memset (&ifr, 0, sizeof (ifr));
+  snprintf (ifr.ifr_name, sizeof (ifr.ifr_name), "%s", interface);
+  if (ioctl (sd, SIOCGIFHWADDR, &ifr) < 0) {
+    perror ("ioctl() failed to get source MAC address ");
+    return (EXIT_FAILURE);
+  }
+  close (sd);
+
+  // Copy source MAC address.
+  memcpy (src_mac, ifr.ifr_hwaddr.sa_data, 6 * sizeof (uint8_t));
+
+  // Report source MAC address to stdout.
+  printf ("MAC address for interface %s is ", interface);
+  for (i=0; i<5; i++) {
+    printf ("%02x:", src_mac[i]);
+  }
+  printf ("%02x\n", src_mac[5]);
+
+  // Find interface index from interface name and store index in
+  // struct sockaddr_ll device, which will be used as an argument of sendmmsg().
+  memset (&device, 0, sizeof (device));
+  if ((device.sll_ifindex = if_nametoindex (interface)) == 0) {
+    perror ("if_nametoindex() failed to obtain interface index ");
+    exit (EXIT_FAILURE);
+  }
+  printf ("Index for interface %s is %i\n", interface, device.sll_ifindex);
+
+  // Set destination MAC address: you need to fill these out
+  dst_mac[0] = 0xff;
+  dst_mac[1] = 0xff;
+  dst_mac[2] = 0xff;
+  dst_mac[3] = 0xff;
+  dst_mac[4] = 0xff;
+  dst_mac[5] = 0xff;
+
+  // Source IPv6 address: you need to fill this out
+  strcpy (src_ip, "2001:db8::214:51ff:fe2f:1556");
+
+  // Destination URL or IPv6 address: you need to fill this out
+  strcpy (target, "ipv6.google.com");
+
+  // Fill out hints for getaddrinfo().
+  memset (&hints, 0, sizeof (struct addrinfo));
+  hints.ai_family = AF_INET6;
+  hints.ai_socktype = SOCK_RAW;
+  hints.ai_flags = hints.ai_flags | AI_CANONNAME;
+
+  // Resolve target using getaddrinfo().
+  if ((status = getaddrinfo (target, NULL, &hints, &res)) != 0) {
+    fprintf (stderr, "getaddrinfo() failed: %s\n", gai_strerror (status));
+    exit (EXIT_FAILURE);
+  }
+  ipv6 = (struct sockaddr_in6 *) res->ai_addr;
+  tmp = &(ipv6->sin6_addr);
+  if (inet_ntop (AF_INET6, tmp, dst_ip, INET6_ADDRSTRLEN) == NULL) {
+    status = errno;
+    fprintf (stderr, "inet_ntop() failed.\nError message: %s", strerror (status));
+    exit (EXIT_FAILURE);
+  }
+  daddr = ipv6->sin6_addr;
+  freeaddrinfo (res);
+
+  if ((status = inet_pton (AF_INET6, src_ip, &saddr)) != 1) {
+    fprintf (stderr, "inet_pton() failed.\nError message: %s", strerror (status));
+    exit (EXIT_FAILURE);
+  }
+
+  // Fill out sockaddr_ll. Kernel checks GSO type against protocol.
+  device.sll_family = AF_PACKET;
+  device.sll_protocol = htons (ETH_P_IPV6);
+  memcpy (device.sll_addr, src_mac, 6 * sizeof (uint8_t));
+  device.sll_halen = 6;
+
+  // Payload: incrementing bytes.
+  for (i=0; i<SUPER_LEN; i++) {
+    payload[i] = i % 256;
+  }
+
+  signal (SIGINT, sig_handler);
+
+  memset (stats, 0, sizeof (stats));
+  printf ("Sending %li bytes of TCP payload to %s port %i\n", total, dst_ip, dport);
+
+  // Segment in software.
+  if ((mode == MODE_SOFTWARE) || (mode == MODE_BOTH)) {
+    if ((sd = socket (PF_PACKET, SOCK_RAW, htons (ETH_P_ALL))) < 0) {
+      perror ("socket() failed ");
+      exit (EXIT_FAILURE);
+    }
+    run (MODE_SOFTWARE, sd, &device, src_mac, dst_mac, saddr, daddr, sport, dport, payload, total, &stats[0]);
+    close (sd);
+    report ("Software segmentation", &stats[0]);
+    stop = 0;
+  }
+
+  // Segment with GSO.
+  if ((mode == MODE_GSO) || (mode == MODE_BOTH)) {
+    if ((sd = socket (PF_PACKET, SOCK_RAW, htons (ETH_P_ALL))) < 0) {
+      perror ("socket() failed ");
+      exit (EXIT_FAILURE);
+    }
+    i = 1;
+    if (setsockopt (sd, SOL_PACKET, PACKET_VNET_HDR, &i, sizeof (i)) < 0) {
+      perror ("setsockopt() failed to set PACKET_VNET_HDR ");
+      exit (EXIT_FAILURE);
+    }
+    run (MODE_GSO, sd, &device, src_mac, dst_mac, saddr, daddr, sport, dport, payload, total, &stats[1]);
+    close (sd);
+    report ("GSO super-frames", &stats[1]);
+  }
+
+  if ((mode == MODE_BOTH) && (stats[0].segments > 0) && (stats[1].segments > 0)) {
+    printf ("GSO vs software: %.2fx segments per second; user CPU per segment %.0f ns vs %.0f ns\n",
+            (stats[1].segments / stats[1].wall) / (stats[0].segments / stats[0].wall),
+            stats[1].user * 1e9 / stats[1].segments, stats[0].user * 1e9 / stats[0].segments);
+  }
+
+  // Free allocated memory.
+  free (src_mac);
+  free (dst_mac);
+  free (interface);
+  free (target);
+  free (src_ip);
+  free (dst_ip);
+  free (payload);
+
+  return (EXIT_SUCCESS);
+}
+
+// Send total bytes of payload as a stream of TCP segments, in software or GSO mode.
+// Each frame is a header buffer plus a pointer into the payload, so payload is never copied.
+void
+run (int mode, int sd, struct sockaddr_ll *device, uint8_t *src_mac, uint8_t *dst_mac, struct in6_addr saddr, struct in6_addr daddr,
+     uint16_t sport, uint16_t dport, uint8_t *payload, long int total, run_stats *stats)
+{
+  int i, n, len, seglen, done;
+  long int sent;
+  uint8_t *hdrs, *tcp;
+  uint32_t seq, sum;
+  struct mmsghdr msgs[BATCH];
+  struct iovec iovs[BATCH][2];
+  struct rusage ru0, ru1;
+  struct timespec t0, t1;
+
+  hdrs = allocate_ustrmem (BATCH * (VNET_HDRLEN + HDRS_LEN));
+  memset (msgs, 0, sizeof (msgs));
+  for (i=0; i<BATCH; i++) {
+    iovs[i][0].iov_base = hdrs + (i * (VNET_HDRLEN + HDRS_LEN));
+    msgs[i].msg_hdr.msg_iov = iovs[i];
+    msgs[i].msg_hdr.msg_iovlen = 2;
+    msgs[i].msg_hdr.msg_name = device;
+    msgs[i].msg_hdr.msg_namelen = sizeof (struct sockaddr_ll);
+  }
+
+  // Frames carry up to one MSS (software) or up to SUPER_LEN bytes (GSO) of payload.
+  seglen = (mode == MODE_GSO) ? SUPER_LEN : MSS;
+
+  seq = 1000000;
+  sent = 0;
+  getrusage (RUSAGE_SELF, &ru0);
+  clock_gettime (CLOCK_MONOTONIC, &t0);
+  while ((stop == 0) && (sent < total)) {
+
+    // Build a batch of frames.
+    n = 0;
+    while ((n < BATCH) && (sent < total)) {
+      len = ((total - sent) < seglen) ? (int) (total - sent) : seglen;
+      iovs[n][0].iov_len = build_headers (iovs[n][0].iov_base, src_mac, dst_mac, saddr, daddr, sport, dport, seq,
+                                          (mode == MODE_GSO), len, (mode == MODE_SOFTWARE) ? 1 : 0);
+      iovs[n][1].iov_base = payload;
+      iovs[n][1].iov_len = len;
+
+      // Software checksum covers the payload too.
+      if (mode == MODE_SOFTWARE) {
+        tcp = (uint8_t *) iovs[n][0].iov_base + ETH_HDRLEN + IP6_HDRLEN;
+        sum = ~fold_sum (sum_bytes ((tcp[16] << 8) | tcp[17], payload, len)) & 0xffff;
+        tcp[16] = sum >> 8;
+        tcp[17] = sum & 0xff;
+      }
+
+      stats->frames++;
+      stats->segments += (len + MSS - 1) / MSS;
+      seq += len;
+      sent += len;
+      n++;
+    }
+
+    // Send batch.
+    done = 0;
+    while (done < n) {
+      if ((i = sendmmsg (sd, msgs + done, n - done, 0)) < 0) {
+        if ((errno == ENOBUFS) || (errno == EINTR)) {
+          usleep (100);
+          continue;
+        }
+        perror ("sendmmsg() failed ");
+        exit (EXIT_FAILURE);
+      }
+      done += i;
+    }
+  }
+  clock_gettime (CLOCK_MONOTONIC, &t1);
+  getrusage (RUSAGE_SELF, &ru1);
+
+  stats->bytes = sent;
+  stats->wall = (t1.tv_sec - t0.tv_sec) + ((t1.tv_nsec - t0.tv_nsec) / 1e9);
+  stats->user = seconds (&ru1.ru_utime) - seconds (&ru0.ru_utime);
+  stats->sys = seconds (&ru1.ru_stime) - seconds (&ru0.ru_stime);
+
+  free (hdrs);
+}
+
+// Build headers of a frame carrying len bytes of TCP payload starting at sequence number seq.
+// With gso, prepend a struct virtio_net_hdr asking kernel to segment frame and compute TCP checksum;
+// TCP checksum field then holds only the pseudo-header sum, as for a partial checksum.
+// Without gso, TCP checksum field holds the (uncomplemented) sum of all but the payload, if partial,
+// for caller to finish. Returns length of everything in front of the payload.
+int
+build_headers (uint8_t *buf, uint8_t *src_mac, uint8_t *dst_mac, struct in6_addr saddr, struct in6_addr daddr,
+               uint16_t sport, uint16_t dport, uint32_t seq, int gso, int len, int partial)
+{
+  int offset;
+  uint8_t *ip, *tcp;
+  uint32_t sum;
+  struct virtio_net_hdr vnet;
+
+  offset = 0;
+  if (gso) {
+    memset (&vnet, 0, sizeof (vnet));
+    vnet.flags = VIRTIO_NET_HDR_F_NEEDS_CSUM;
+    vnet.csum_start = ETH_HDRLEN + IP6_HDRLEN;  // Checksum from start of TCP header,
+    vnet.csum_offset = 16;                      // stored at TCP checksum field
+    if (len > MSS) {
+      vnet.gso_type = VIRTIO_NET_HDR_GSO_TCPV6;
+      vnet.gso_size = MSS;
+      vnet.hdr_len = HDRS_LEN;
+    } else {
+      vnet.gso_type = VIRTIO_NET_HDR_GSO_NONE;
+    }
+    memcpy (buf, &vnet, VNET_HDRLEN);
+    offset = VNET_HDRLEN;
+  }
+  buf += offset;
+
+  // Ethernet frame header
+  memcpy (buf, dst_mac, 6 * sizeof (uint8_t));
+  memcpy (buf + 6, src_mac, 6 * sizeof (uint8_t));
+  buf[12] = ETH_P_IPV6 / 256;
+  buf[13] = ETH_P_IPV6 % 256;
+
+  // IPv6 header. With GSO, kernel gives each segment its own payload length.
+  ip = buf + ETH_HDRLEN;
+  ip[0] = 6 << 4;                             // Version, traffic class and flow label
+  ip[1] = 0;
+  ip[2] = 0;
+  ip[3] = 0;
+  ip[4] = (TCP_HDRLEN + len) >> 8;            // Payload length
+  ip[5] = (TCP_HDRLEN + len) & 0xff;
+  ip[6] = IPPROTO_TCP;                        // Next header
+  ip[7] = 255;                                // Hop limit
+  memcpy (ip + 8, saddr.s6_addr, 16 * sizeof (uint8_t));
+  memcpy (ip + 24, daddr.s6_addr, 16 * sizeof (uint8_t));
+
+  // TCP header: ACK and PSH set, no options.
+  tcp = ip + IP6_HDRLEN;
+  tcp[0] = sport >> 8;
+  tcp[1] = sport & 0xff;
+  tcp[2] = dport >> 8;
+  tcp[3] = dport & 0xff;
+  tcp[4] = seq >> 24;
+  tcp[5] = (seq >> 16) & 0xff;
+  tcp[6] = (seq >> 8) & 0xff;
+  tcp[7] = seq & 0xff;
+  memset (tcp + 8, 0, 4 * sizeof (uint8_t));  // Acknowledgement number
+  tcp[12] = (TCP_HDRLEN / 4) << 4;
+  tcp[13] = 0x18;                             // PSH, ACK
+  tcp[14] = 65535 >> 8;
+  tcp[15] = 65535 & 0xff;
+  tcp[16] = 0;
+  tcp[17] = 0;
+  tcp[18] = 0;
+  tcp[19] = 0;
+
+  // Pseudo-header: addresses, next header, and TCP length (of whole super-frame, with GSO).
+  sum = sum_bytes (0, ip + 8, 32) + IPPROTO_TCP + TCP_HDRLEN + len;
+  if (partial) {
+    sum = sum_bytes (sum, tcp, TCP_HDRLEN);
+  }
+  sum = fold_sum (sum);
+  tcp[16] = sum >> 8;
+  tcp[17] = sum & 0xff;
+
+  return (offset + HDRS_LEN);
+}
+
+// Print results of a run.
+void
+report (char *name, run_stats *stats)
+{
+  if ((stats->segments == 0) || (stats->wall <= 0.0)) {
+    return;
+  }
+  printf ("%s: %li frames, %li segments in %.2f s\n", name, stats->frames, stats->segments, stats->wall);
+  printf ("  %.0f segments/s, %.2f Gbit/s payload\n", stats->segments / stats->wall, stats->bytes * 8.0 / stats->wall / 1e9);
+  printf ("  CPU per segment: %.0f ns user, %.0f ns system\n", stats->user * 1e9 / stats->segments, stats->sys * 1e9 / stats->segments);
+}
+
+// Convert struct timeval to seconds.
+double
+seconds (struct timeval *tv)
+{
+  return (tv->tv_sec + (tv->tv_usec / 1e6));
+}
+
+// Add bytes to a running (host byte order) one's complement sum.
+uint32_t
+sum_bytes (uint32_t sum, uint8_t *data, int len)
+{
+  while (len > 1) {
+    sum += (data[0] << 8) + data[1];
+    data += 2;
+    len -= 2;
+  }
+
+  // Odd byte is padded with zero.
+  if (len == 1) {
+    sum += data[0] << 8;
+  }
+
+  return (sum);
+}
+
+// Fold a 32-bit running sum into 16 bits, with end-around carry.
+uint16_t
+fold_sum (uint32_t sum)
+{
+  while (sum >> 16) {
+    sum = (sum & 0xffff) + (sum >> 16);
+  }
+
+  return ((uint16_t) sum);
+}
+
+// SIGINT handler: end current run.
+void
+sig_handler (int signum)
+{
+  (void) signum;
+  stop = 1;
+}
+
+// Allocate memory for an array of chars.
+char *
+allocate_strmem (int len)
+{
+  void *tmp;
+
+  if (len <= 0) {
+    fprintf (stderr, "ERROR: Cannot allocate memory because len = %i in allocate_strmem().\n", len);
+    exit (EXIT_FAILURE);
+  }
+
+  tmp = (char *) malloc (len * sizeof (char));
+  if (tmp != NULL) {
+    memset (tmp, 0, len * sizeof (char));
+    return (tmp);
+  } else {
+    fprintf (stderr, "ERROR: Cannot allocate memory for array allocate_strmem().\n");
+    exit (EXIT_FAILURE);
+  }
+}
+
+// Allocate memory for an array of unsigned chars.
+uint8_t *
+allocate_ustrmem (int len)
+{
+  void *tmp;
+
+  if (len <= 0) {
+    fprintf (stderr, "ERROR: Cannot allocate memory because len = %i in allocate_ustrmem().\n", len);
+    exit (EXIT_FAILURE);
+  }
+
+  tmp = (uint8_t *) malloc (len * sizeof (uint8_t));
+  if (tmp != NULL) {
+    memset (tmp, 0, len * sizeof (uint8_t));
+    return (tmp);
+  } else {
+    fprintf (stderr, "ERROR: Cannot allocate memory for array allocate_ustrmem().\n");
+    exit (EXIT_FAILURE);
+  }
+}
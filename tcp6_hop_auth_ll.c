@@ -0,0 +1,1096 @@
+/*  Copyright (C) 2013  P.D. Buchan (pdbuchan@yahoo.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Send a stream of IPv6 TCP packets via raw socket at the link layer (ethernet frame).
+// Include a hop-by-hop options extension header with a router alert option,
+// and an authentication extension header (AH) carrying a genuine integrity
+// check value (ICV), computed with HMAC-SHA1-96 (RFC 2404) or HMAC-SHA-256-128
+// (RFC 4868) as per Section 3.3.3 of RFC 4302.
+// The authentication header can be used in transport mode or tunnel mode.
+// The HMAC inner and outer pad states are computed once per security
+// association, and ICVs are computed for a batch of packets at a time.
+// Need to have destination MAC address.
+
+#define _GNU_SOURCE           // sendmmsg() and struct mmsghdr
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>           // close()
+#include <string.h>           // strcpy, memset(), and memcpy()
+
+#include <netdb.h>            // struct addrinfo
+#include <sys/types.h>        // needed for socket(), uint8_t, uint16_t, uint32_t
+#include <sys/socket.h>       // needed for socket(), sendmmsg()
+#include <netinet/in.h>       // IPPROTO_IPV6, IPPROTO_HOPOPTS, IPPROTO_AH, IPPROTO_TCP, INET6_ADDRSTRLEN
+#include <netinet/ip.h>       // IP_MAXPACKET (which is 65535)
+#include <netinet/ip6.h>      // struct ip6_hdr
+#define __FAVOR_BSD           // Use BSD format of tcp header
+#include <netinet/tcp.h>      // struct tcphdr
+#include <arpa/inet.h>        // inet_pton() and inet_ntop()
+#include <sys/ioctl.h>        // macro ioctl is defined
+#include <bits/ioctls.h>      // defines values for argument "request" of ioctl.
+#include <net/if.h>           // struct ifreq
+#include <linux/if_ether.h>   // ETH_P_IP = 0x0800, ETH_P_IPV6 = 0x86DD
+#include <linux/if_packet.h>  // struct sockaddr_ll (see man 7 packet)
+#include <net/ethernet.h>
+#include <time.h>             // clock_gettime()
+
+#include <errno.h>            // errno, perror()
+
+// Define a struct for hop-by-hop header, excluding options.
+typedef struct _hop_hdr hop_hdr;
+struct _hop_hdr {
+  uint8_t nxt_hdr;
+  uint8_t hdr_len;
+};
+
+// Define a struct for authentication header, excluding authentication data.
+typedef struct _auth_hdr auth_hdr;
+struct _auth_hdr {
+  uint8_t nxt_hdr;
+  uint8_t pay_len;
+  uint16_t reserved;
+  uint32_t spi;
+  uint32_t seq;
+};
+
+// Define some constants.
+#define ETH_HDRLEN 14         // Ethernet header length
+#define IP6_HDRLEN 40         // IPv6 header length
+#define HOP_HDRLEN 2          // Hop-by-hop header length, excluding options
+#define ATH_HDRLEN 12         // Authentication header length, excludes authentication data
+#define TCP_HDRLEN 20         // TCP header length, excludes options data
+#define BATCH 64              // Number of packets signed and handed to sendmmsg() at once
+#define MAX_KEYLEN 64         // Maximum authentication key length (bytes)
+
+// Integrity algorithms
+#define AUTH_HMAC_SHA1_96 1        // RFC 2404: 20-byte digest truncated to 12-byte ICV
+#define AUTH_HMAC_SHA256_128 2     // RFC 4868: 32-byte digest truncated to 16-byte ICV
+
+// Rotate 32-bit value left or right.
+#define ROL(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+#define ROR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+// Define a struct for SHA-1 or SHA-256 hash state.
+typedef struct _hash_ctx hash_ctx;
+struct _hash_ctx {
+  int alg;              // AUTH_HMAC_SHA1_96 or AUTH_HMAC_SHA256_128
+  uint32_t h[8];        // Chaining state (5 words for SHA-1, 8 for SHA-256)
+  uint64_t len;         // Total number of bytes hashed
+  uint8_t buf[64];      // Partial block
+  int nbuf;             // Number of bytes in partial block
+};
+
+// Define a struct for an AH security association (SA).
+typedef struct _ah_sa ah_sa;
+struct _ah_sa {
+  uint32_t spi;         // Security parameters index
+  uint64_t seq;         // Last sequence number sent (64 bits if extended sequence numbers are used)
+  int esn;              // Extended (64-bit) sequence numbers: 0 = no, 1 = yes (Section 2.5.1 of RFC 4302)
+  int alg;              // Integrity algorithm
+  int digest_len;       // Full HMAC digest length (bytes)
+  int icv_len;          // Truncated ICV length (bytes)
+  int ah_len;           // Total authentication header length, including ICV and padding (bytes)
+  hash_ctx inner;       // Hash state after absorbing key XOR ipad
+  hash_ctx outer;       // Hash state after absorbing key XOR opad
+};
+
+// Function prototypes
+int ah_sa_init (ah_sa *, int, uint8_t *, int, uint32_t, int);
+int ah_compute_icv (ah_sa *, uint8_t *, int, uint64_t, uint8_t *);
+int ah_sign_batch (ah_sa *, uint8_t **, int *, int);
+int hex_to_bytes (char *, uint8_t *, int);
+void hash_init (hash_ctx *, int);
+void sha1_block (uint32_t *, const uint8_t *);
+void sha256_block (uint32_t *, const uint8_t *);
+void hash_update (hash_ctx *, const uint8_t *, int);
+void hash_final (hash_ctx *, uint8_t *);
+uint16_t checksum (uint16_t *, int);
+uint16_t tcp6_checksum (struct ip6_hdr, struct tcphdr, uint8_t *, int);
+char *allocate_strmem (int);
+uint8_t *allocate_ustrmem (int);
+uint8_t **allocate_ustrmemp (int);
+int *allocate_intmem (int);
+
+int
+main (int argc, char **argv)
+{
+  int i, n, c, status, frame_length, sd, mode, alg, esn, keylen, npackets, sent, payloadlen;
+  int *tcp_flags, *lens;
+  char *interface, *target, *src_ip, *dst_ip, *key_hex;
+  struct ip6_hdr iphdr, newiphdr;
+  struct tcphdr tcphdr;
+  hop_hdr hophdr;
+  auth_hdr authhdr;
+  ah_sa sa;
+  uint8_t *src_mac, *dst_mac, *payload, *key, *frames, **pkts;
+  struct addrinfo hints, *res;
+  struct sockaddr_in6 *ipv6;
+  struct sockaddr_ll device;
+  struct ifreq ifr;
+  struct mmsghdr msgs[BATCH];
+  struct iovec iovs[BATCH];
+  struct timespec t1, t2, s1, s2;
+  double dt, dsign;
+  void *tmp;
+
+  // Allocate memory for various arrays.
+  src_mac = allocate_ustrmem (6);
+  dst_mac = allocate_ustrmem (6);
+  interface = allocate_strmem (40);
+  target = allocate_strmem (INET6_ADDRSTRLEN);
+  src_ip = allocate_strmem (INET6_ADDRSTRLEN);
+  dst_ip = allocate_strmem (INET6_ADDRSTRLEN);
+  key_hex = allocate_strmem (2 * MAX_KEYLEN + 1);
+  key = allocate_ustrmem (MAX_KEYLEN);
+  tcp_flags = allocate_intmem (8);
+  payload = allocate_ustrmem (IP_MAXPACKET);
+  frames = allocate_ustrmem (BATCH * IP_MAXPACKET);
+  pkts = allocate_ustrmemp (BATCH);
+  lens = allocate_intmem (BATCH);
+
+  // Interface to send packets through.
+  strcpy (interface, "eth0");
+
+  // Authentication header mode: 1 = transport mode, 2 = tunnel mode
+  mode = 1;
+
+  // Integrity algorithm: AUTH_HMAC_SHA1_96 or AUTH_HMAC_SHA256_128
+  alg = AUTH_HMAC_SHA1_96;
+
+  // Authentication key, in hexadecimal: you need to fill this out
+  // RFC 2404 uses 160-bit keys for HMAC-SHA1-96, and RFC 4868 256-bit keys for HMAC-SHA-256-128.
+  strcpy (key_hex, "0102030405060708090a0b0c0d0e0f1011121314");
+
+  // Use extended (64-bit) sequence numbers: 0 = no, 1 = yes
+  esn = 0;
+
+  // Number of packets to send.
+  npackets = 100000;
+
+  // Submit request for a socket descriptor to look up interface.
+  if ((sd = socket (PF_PACKET, SOCK_RAW, htons (ETH_P_ALL))) < 0) {
+    perror ("socket() failed to get socket descriptor for using ioctl() ");
+    exit (EXIT_FAILURE);
+  }
+
+  // Use ioctl() to look up interface name and get its MAC address.
+  memset (&ifr, 0, sizeof (ifr));
+  snprintf (ifr.ifr_name, sizeof (ifr.ifr_name), "%s", interface);
+  if (ioctl (sd, SIOCGIFHWADDR, &ifr) < 0) {
+    perror ("ioctl() failed to get source MAC address ");
+    return (EXIT_FAILURE);
+  }
+  close (sd);
+
+  // Copy source MAC address.
+  memcpy (src_mac, ifr.ifr_hwaddr.sa_data, 6 * sizeof (uint8_t));
+
+  // Report source MAC address to stdout.
+  printf ("MAC address for interface %s is ", interface);
+  for (i=0; i<5; i++) {
+    printf ("%02x:", src_mac[i]);
+  }
+  printf ("%02x\n", src_mac[5]);
+
+  // Find interface index from interface name and store index in
+  // struct sockaddr_ll device, which will be used as an argument of sendmmsg().
+  memset (&device, 0, sizeof (device));
+  if ((device.sll_ifindex = if_nametoindex (interface)) == 0) {
+    perror ("if_nametoindex() failed to obtain interface index ");
+    exit (EXIT_FAILURE);
+  }
+  printf ("Index for interface %s is %i\n", interface, device.sll_ifindex);
+
+  // Set destination MAC address: you need to fill these out
+  dst_mac[0] = 0xff;
+  dst_mac[1] = 0xff;
+  dst_mac[2] = 0xff;
+  dst_mac[3] = 0xff;
+  dst_mac[4] = 0xff;
+  dst_mac[5] = 0xff;
+
+  // Source IPv6 address: you need to fill this out
+  strcpy (src_ip, "2001:db8::214:51ff:fe2f:1556");
+
+  // Destination URL or IPv6 address: you need to fill this out
+  strcpy (target, "ipv6.google.com");
+
+  // Fill out hints for getaddrinfo().
+  memset (&hints, 0, sizeof (struct addrinfo));
+  hints.ai_family = AF_INET6;
+  hints.ai_socktype = SOCK_RAW;
+  hints.ai_flags = hints.ai_flags | AI_CANONNAME;
+
+  // Resolve target using getaddrinfo().
+  if ((status = getaddrinfo (target, NULL, &hints, &res)) != 0) {
+    fprintf (stderr, "getaddrinfo() failed: %s\n", gai_strerror (status));
+    exit (EXIT_FAILURE);
+  }
+  ipv6 = (struct sockaddr_in6 *) res->ai_addr;
+  tmp = &(ipv6->sin6_addr);
+  if (inet_ntop (AF_INET6, tmp, dst_ip, INET6_ADDRSTRLEN) == NULL) {
+    status = errno;
+    fprintf (stderr, "inet_ntop() failed.\nError message: %s", strerror (status));
+    exit (EXIT_FAILURE);
+  }
+  freeaddrinfo (res);
+
+  // Fill out sockaddr_ll.
+  device.sll_family = AF_PACKET;
+  memcpy (device.sll_addr, src_mac, 6 * sizeof (uint8_t));
+  device.sll_halen = 6;
+
+  // Set up security association: SPI and key are shared with the receiver.
+  keylen = hex_to_bytes (key_hex, key, MAX_KEYLEN);
+  ah_sa_init (&sa, alg, key, keylen, 51413ul, esn);  // Security parameters index (Section 2.4 of RFC 4302): you set this
+  printf ("ICV length: %i, total length of authentication header (including ICV and padding): %i\n", sa.icv_len, sa.ah_len);
+
+  // TCP data: you need to fill this out
+  payloadlen = 1000;
+  for (i=0; i<payloadlen; i++) {
+    payload[i] = 'a' + (i % 26);
+  }
+
+  // IPv6 header
+
+  // IPv6 version (4 bits), Traffic class (8 bits), Flow label (20 bits)
+  iphdr.ip6_flow = htonl ((6 << 28) | (0 << 20) | 0);
+
+  // Next header (8 bits): 6 for TCP
+  // We'll change this later, otherwise TCP checksum will be wrong.
+  iphdr.ip6_nxt = IPPROTO_TCP;
+
+  // Hop limit (8 bits): default to maximum value
+  iphdr.ip6_hops = 255;
+
+  // Source IPv6 address (128 bits)
+  if ((status = inet_pton (AF_INET6, src_ip, &(iphdr.ip6_src))) != 1) {
+    fprintf (stderr, "inet_pton() failed.\nError message: %s", strerror (status));
+    exit (EXIT_FAILURE);
+  }
+
+  // Destination IPv6 address (128 bits)
+  if ((status = inet_pton (AF_INET6, dst_ip, &(iphdr.ip6_dst))) != 1) {
+    fprintf (stderr, "inet_pton() failed.\nError message: %s", strerror (status));
+    exit (EXIT_FAILURE);
+  }
+
+  // TCP header
+
+  // Source port number (16 bits)
+  tcphdr.th_sport = htons (80);
+
+  // Destination port number (16 bits)
+  tcphdr.th_dport = htons (80);
+
+  // Sequence number (32 bits)
+  tcphdr.th_seq = htonl (0);
+
+  // Acknowledgement number (32 bits)
+  tcphdr.th_ack = htonl (0);
+
+  // Reserved (4 bits): should be 0
+  tcphdr.th_x2 = 0;
+
+  // Data offset (4 bits): size of TCP header in 32-bit words
+  tcphdr.th_off = TCP_HDRLEN / 4;
+
+  // Flags (8 bits)
+
+  // FIN flag (1 bit)
+  tcp_flags[0] = 0;
+
+  // SYN flag (1 bit)
+  tcp_flags[1] = 0;
+
+  // RST flag (1 bit)
+  tcp_flags[2] = 0;
+
+  // PSH flag (1 bit)
+  tcp_flags[3] = 1;
+
+  // ACK flag (1 bit)
+  tcp_flags[4] = 1;
+
+  // URG flag (1 bit)
+  tcp_flags[5] = 0;
+
+  // ECE flag (1 bit)
+  tcp_flags[6] = 0;
+
+  // CWR flag (1 bit)
+  tcp_flags[7] = 0;
+
+  tcphdr.th_flags = 0;
+  for (i=0; i<8; i++) {
+    tcphdr.th_flags += (tcp_flags[i] << i);
+  }
+
+  // Window size (16 bits)
+  tcphdr.th_win = htons (65535);
+
+  // Urgent pointer (16 bits): 0 (only valid if URG flag is set)
+  tcphdr.th_urp = htons (0);
+
+  // TCP checksum (16 bits)
+  tcphdr.th_sum = tcp6_checksum (iphdr, tcphdr, payload, payloadlen);
+
+  // Hop-by-hop extension header with a router alert option (with bogus value).
+  // Alignment requirement is 2n+0 for router alert (Section 2.1 of RFC 2711), so the
+  // option directly follows the 2-byte header, and a 2-byte PadN ends the header on an 8-byte boundary.
+  hophdr.hdr_len = 0;  // Length in units of 8 bytes, excluding first 8 bytes
+
+  // Authentication extension header
+  // Sequence number and ICV are filled in for each packet by ah_sign_batch().
+  authhdr.pay_len = (sa.ah_len / 4) - 2;  // Payload length (in units of 32-bits) less 2 (Section 2.2 of RFC 4302)
+  authhdr.reserved = htons (0u);
+  authhdr.spi = htonl (sa.spi);
+  authhdr.seq = htonl (0ul);
+
+  // Build template frame in first slot.
+  c = 0;
+
+  // Destination and Source MAC addresses
+  memcpy (frames, dst_mac, 6 * sizeof (uint8_t));
+  memcpy (frames + 6, src_mac, 6 * sizeof (uint8_t));
+
+  // Next is ethernet type code (ETH_P_IPV6 for IPv6).
+  // http://www.iana.org/assignments/ethernet-numbers
+  frames[12] = ETH_P_IPV6 / 256;
+  frames[13] = ETH_P_IPV6 % 256;
+  c += ETH_HDRLEN;
+
+  if (mode == 1) {
+
+    // Transport mode: IPv6 header, hop-by-hop header, AH, TCP (Section 3.1.1 of RFC 4302).
+    iphdr.ip6_nxt = IPPROTO_HOPOPTS;
+    iphdr.ip6_plen = htons (8 + sa.ah_len + TCP_HDRLEN + payloadlen);
+    memcpy (frames + c, &iphdr, IP6_HDRLEN * sizeof (uint8_t));
+    c += IP6_HDRLEN;
+
+    hophdr.nxt_hdr = IPPROTO_AH;  // 51 for authentication extension header
+    authhdr.nxt_hdr = IPPROTO_TCP;
+
+  } else {
+
+    // Tunnel mode: new IPv6 header, AH, original IPv6 header, hop-by-hop header, TCP (Section 3.1.2 of RFC 4302).
+    // Inner extension headers are not copied to the outer header (Section 5.1.2.2 of RFC 4301).
+    newiphdr = iphdr;
+    newiphdr.ip6_nxt = IPPROTO_AH;  // 51 for authentication extension header
+    newiphdr.ip6_plen = htons (sa.ah_len + IP6_HDRLEN + 8 + TCP_HDRLEN + payloadlen);
+    memcpy (frames + c, &newiphdr, IP6_HDRLEN * sizeof (uint8_t));
+    c += IP6_HDRLEN;
+
+    authhdr.nxt_hdr = IPPROTO_IPV6;  // 41 for IPv6 header
+    memcpy (frames + c, &authhdr, ATH_HDRLEN * sizeof (uint8_t));
+    c += sa.ah_len;  // ICV and padding are zero for now.
+
+    iphdr.ip6_nxt = IPPROTO_HOPOPTS;
+    iphdr.ip6_plen = htons (8 + TCP_HDRLEN + payloadlen);
+    memcpy (frames + c, &iphdr, IP6_HDRLEN * sizeof (uint8_t));
+    c += IP6_HDRLEN;
+
+    hophdr.nxt_hdr = IPPROTO_TCP;
+  }
+
+  // Hop-by-hop header and options
+  memcpy (frames + c, &hophdr, HOP_HDRLEN * sizeof (uint8_t));
+  c += HOP_HDRLEN;
+  frames[c++] = 5;  // Option Type: router alert
+  frames[c++] = 2;  // Length of Option Data field
+  frames[c++] = 0;  // Option Data: some unassigned IANA value, you
+  frames[c++] = 5;  // should select what you want.
+  frames[c++] = 1;  // Padding option type: PadN
+  frames[c++] = 0;  // PadN length: N - 2
+
+  // Authentication header in transport mode follows the hop-by-hop header.
+  if (mode == 1) {
+    memcpy (frames + c, &authhdr, ATH_HDRLEN * sizeof (uint8_t));
+    c += sa.ah_len;  // ICV and padding are zero for now.
+  }
+
+  // TCP header and data
+  memcpy (frames + c, &tcphdr, TCP_HDRLEN * sizeof (uint8_t));
+  c += TCP_HDRLEN;
+  memcpy (frames + c, payload, payloadlen * sizeof (uint8_t));
+  c += payloadlen;
+
+  frame_length = c;
+  printf ("Ethernet frame length: %i\n", frame_length);
+
+  // Copy template into remaining slots, and prepare messages for sendmmsg().
+  memset (msgs, 0, sizeof (msgs));
+  for (i=0; i<BATCH; i++) {
+    if (i > 0) {
+      memcpy (frames + (i * IP_MAXPACKET), frames, frame_length * sizeof (uint8_t));
+    }
+    pkts[i] = frames + (i * IP_MAXPACKET) + ETH_HDRLEN;  // IPv6 packet, which is what AH covers
+    lens[i] = frame_length - ETH_HDRLEN;
+    iovs[i].iov_base = frames + (i * IP_MAXPACKET);
+    iovs[i].iov_len = frame_length;
+    msgs[i].msg_hdr.msg_iov = &iovs[i];
+    msgs[i].msg_hdr.msg_iovlen = 1;
+    msgs[i].msg_hdr.msg_name = &device;
+    msgs[i].msg_hdr.msg_namelen = sizeof (device);
+  }
+
+  // Submit request for a raw socket descriptor.
+  if ((sd = socket (PF_PACKET, SOCK_RAW, htons (ETH_P_ALL))) < 0) {
+    perror ("socket() failed ");
+    exit (EXIT_FAILURE);
+  }
+
+  dsign = 0.0;
+  sent = 0;
+  clock_gettime (CLOCK_MONOTONIC, &t1);
+  while (sent < npackets) {
+
+    n = npackets - sent;
+    if (n > BATCH) {
+      n = BATCH;
+    }
+
+    // Assign sequence numbers and compute ICVs for the whole batch.
+    clock_gettime (CLOCK_MONOTONIC, &s1);
+    ah_sign_batch (&sa, pkts, lens, n);
+    clock_gettime (CLOCK_MONOTONIC, &s2);
+    dsign += (double) (s2.tv_sec - s1.tv_sec) + (double) (s2.tv_nsec - s1.tv_nsec) / 1000000000.0;
+
+    // Send batch of ethernet frames to socket.
+    i = 0;
+    while (i < n) {
+      if ((status = sendmmsg (sd, msgs + i, n - i, 0)) < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        perror ("sendmmsg() failed ");
+        exit (EXIT_FAILURE);
+      }
+      i += status;
+    }
+    sent += n;
+  }
+  clock_gettime (CLOCK_MONOTONIC, &t2);
+  dt = (double) (t2.tv_sec - t1.tv_sec) + (double) (t2.tv_nsec - t1.tv_nsec) / 1000000000.0;
+
+  // Report results.
+  printf ("Sent %i packets in %g seconds (%.0f packets per second)\n", sent, dt, (dt > 0.0) ? (double) sent / dt : 0.0);
+  printf ("Time spent computing ICVs: %g seconds (%.0f ns per packet)\n", dsign, (sent > 0) ? dsign * 1000000000.0 / sent : 0.0);
+
+  // Close socket descriptor.
+  close (sd);
+
+  // Free allocated memory.
+  free (src_mac);
+  free (dst_mac);
+  free (interface);
+  free (target);
+  free (src_ip);
+  free (dst_ip);
+  free (key_hex);
+  free (key);
+  free (tcp_flags);
+  free (payload);
+  free (frames);
+  free (pkts);
+  free (lens);
+
+  return (EXIT_SUCCESS);
+}
+
+// Set up an AH security association.
+// The HMAC key is XORed with ipad and opad and each is hashed once here (Section 2 of RFC 2104);
+// every packet then resumes from these saved states, saving two hash blocks per packet.
+int
+ah_sa_init (ah_sa *sa, int alg, uint8_t *key, int keylen, uint32_t spi, int esn)
+{
+  int i;
+  uint8_t k[64], block[64];
+  hash_ctx ctx;
+
+  memset (sa, 0, sizeof (ah_sa));
+  sa->spi = spi;
+  sa->seq = 0;  // First packet sent has sequence number 1 (Section 3.3.2 of RFC 4302).
+  sa->esn = esn;
+  sa->alg = alg;
+
+  if (alg == AUTH_HMAC_SHA1_96) {
+    sa->digest_len = 20;
+    sa->icv_len = 12;
+  } else if (alg == AUTH_HMAC_SHA256_128) {
+    sa->digest_len = 32;
+    sa->icv_len = 16;
+  } else {
+    fprintf (stderr, "ERROR: Unknown integrity algorithm %i in ah_sa_init().\n", alg);
+    exit (EXIT_FAILURE);
+  }
+
+  // For IPv6, AH header must be multiple of 64 bits (8 bytes). See Section 2.6 of RFC 4302.
+  sa->ah_len = ATH_HDRLEN + sa->icv_len;
+  while ((sa->ah_len % 8) != 0) {
+    sa->ah_len++;
+  }
+
+  // Keys longer than the block size are hashed first.
+  memset (k, 0, sizeof (k));
+  if (keylen > 64) {
+    hash_init (&ctx, alg);
+    hash_update (&ctx, key, keylen);
+    hash_final (&ctx, k);
+  } else {
+    memcpy (k, key, keylen * sizeof (uint8_t));
+  }
+
+  for (i=0; i<64; i++) {
+    block[i] = k[i] ^ 0x36;
+  }
+  hash_init (&sa->inner, alg);
+  hash_update (&sa->inner, block, 64);
+
+  for (i=0; i<64; i++) {
+    block[i] = k[i] ^ 0x5c;
+  }
+  hash_init (&sa->outer, alg);
+  hash_update (&sa->outer, block, 64);
+
+  return (EXIT_SUCCESS);
+}
+
+// Compute the ICV of an IPv6 packet containing an authentication header.
+// Fields which may change in transit are hashed as zero (Section 3.3.3.1 of RFC 4302):
+// traffic class, flow label and hop limit of the IPv6 header, the data of any hop-by-hop
+// or destination option whose type says it may change en route, and the ICV itself.
+// Everything after the authentication header is hashed in place, without copying.
+int
+ah_compute_icv (ah_sa *sa, uint8_t *pkt, int len, uint64_t seq, uint8_t *icv)
+{
+  int c, hdrlen, indx, optlen;
+  uint8_t nxt, scratch[2048], digest[32], seqhi[4];
+  hash_ctx ctx;
+
+  // Resume from saved inner state: H(K XOR ipad, ...
+  ctx = sa->inner;
+
+  // IPv6 header: zero mutable fields.
+  memcpy (scratch, pkt, IP6_HDRLEN * sizeof (uint8_t));
+  scratch[0] = 0x60;  // Version is immutable; traffic class and flow label are mutable.
+  scratch[1] = 0;
+  scratch[2] = 0;
+  scratch[3] = 0;
+  scratch[7] = 0;  // Hop limit
+  hash_update (&ctx, scratch, IP6_HDRLEN);
+  nxt = pkt[6];
+  c = IP6_HDRLEN;
+
+  // Extension headers ahead of the authentication header.
+  while (nxt != IPPROTO_AH) {
+    if ((nxt != IPPROTO_HOPOPTS) && (nxt != IPPROTO_DSTOPTS)) {
+      fprintf (stderr, "ERROR: Extension header %i ahead of authentication header not handled in ah_compute_icv().\n", nxt);
+      exit (EXIT_FAILURE);
+    }
+    hdrlen = (pkt[c + 1] + 1) * 8;
+    if ((c + hdrlen) > len) {
+      fprintf (stderr, "ERROR: Truncated extension header in ah_compute_icv().\n");
+      exit (EXIT_FAILURE);
+    }
+    memcpy (scratch, pkt + c, hdrlen * sizeof (uint8_t));
+
+    // Zero data of options whose third-highest type bit is set (Section 4.2 of RFC 2460).
+    indx = 2;
+    while (indx < hdrlen) {
+      if (scratch[indx] == 0) {  // Pad1
+        indx++;
+        continue;
+      }
+      optlen = scratch[indx + 1];
+      if (scratch[indx] & 0x20) {
+        memset (scratch + indx + 2, 0, optlen * sizeof (uint8_t));
+      }
+      indx += 2 + optlen;
+    }
+    hash_update (&ctx, scratch, hdrlen);
+    nxt = pkt[c];
+    c += hdrlen;
+  }
+
+  // Authentication header, with ICV (and padding) as zero.
+  hdrlen = (pkt[c + 1] + 2) * 4;
+  memset (scratch, 0, hdrlen * sizeof (uint8_t));
+  memcpy (scratch, pkt + c, ATH_HDRLEN * sizeof (uint8_t));
+  hash_update (&ctx, scratch, hdrlen);
+  c += hdrlen;
+
+  // Upper layer protocol (or inner packet in tunnel mode) is immutable.
+  hash_update (&ctx, pkt + c, len - c);
+
+  // High-order 32 bits of an extended sequence number are included implicitly (Section 3.3.3.2.2 of RFC 4302).
+  if (sa->esn == 1) {
+    seqhi[0] = (seq >> 56) & 0xff;
+    seqhi[1] = (seq >> 48) & 0xff;
+    seqhi[2] = (seq >> 40) & 0xff;
+    seqhi[3] = (seq >> 32) & 0xff;
+    hash_update (&ctx, seqhi, 4);
+  }
+  hash_final (&ctx, digest);
+
+  // ... then H(K XOR opad, inner digest), from saved outer state.
+  ctx = sa->outer;
+  hash_update (&ctx, digest, sa->digest_len);
+  hash_final (&ctx, digest);
+
+  // Truncate to ICV length.
+  memcpy (icv, digest, sa->icv_len * sizeof (uint8_t));
+
+  return (EXIT_SUCCESS);
+}
+
+// Assign the next sequence numbers to a batch of packets and fill in their ICVs.
+// Each packet must already contain its authentication header; pkts[i] points to the IPv6 header.
+int
+ah_sign_batch (ah_sa *sa, uint8_t **pkts, int *lens, int n)
+{
+  int i, c, hdrlen;
+  uint8_t nxt;
+
+  for (i=0; i<n; i++) {
+
+    // Sequence numbers must never cycle (Section 3.3.2 of RFC 4302).
+    if ((sa->esn == 0) && (sa->seq == 0xfffffffful)) {
+      fprintf (stderr, "ERROR: Sequence number space exhausted; a new SA is needed.\n");
+      exit (EXIT_FAILURE);
+    }
+    sa->seq++;
+
+    // Find authentication header.
+    nxt = pkts[i][6];
+    c = IP6_HDRLEN;
+    while (nxt != IPPROTO_AH) {
+      nxt = pkts[i][c];
+      c += (pkts[i][c + 1] + 1) * 8;
+    }
+
+    // Low-order 32 bits of sequence number go in the header.
+    pkts[i][c + 8] = (sa->seq >> 24) & 0xff;
+    pkts[i][c + 9] = (sa->seq >> 16) & 0xff;
+    pkts[i][c + 10] = (sa->seq >> 8) & 0xff;
+    pkts[i][c + 11] = sa->seq & 0xff;
+
+    // ICV, with the rest of the authentication data (padding) left as zero.
+    hdrlen = (pkts[i][c + 1] + 2) * 4;
+    memset (pkts[i] + c + ATH_HDRLEN, 0, (hdrlen - ATH_HDRLEN) * sizeof (uint8_t));
+    ah_compute_icv (sa, pkts[i], lens[i], sa->seq, pkts[i] + c + ATH_HDRLEN);
+  }
+
+  return (EXIT_SUCCESS);
+}
+
+// Convert a string of hexadecimal digits to bytes. Returns number of bytes.
+int
+hex_to_bytes (char *hex, uint8_t *out, int max)
+{
+  int n;
+  unsigned int byte;
+
+  n = 0;
+  while ((hex[2 * n] != 0) && (hex[(2 * n) + 1] != 0)) {
+    if (n >= max) {
+      fprintf (stderr, "ERROR: Hexadecimal key longer than %i bytes in hex_to_bytes().\n", max);
+      exit (EXIT_FAILURE);
+    }
+    if (sscanf (hex + (2 * n), "%2x", &byte) != 1) {
+      fprintf (stderr, "ERROR: Invalid hexadecimal digits in hex_to_bytes().\n");
+      exit (EXIT_FAILURE);
+    }
+    out[n] = byte;
+    n++;
+  }
+
+  return (n);
+}
+
+// Initialize hash state for SHA-1 (FIPS 180-4) or SHA-256.
+void
+hash_init (hash_ctx *ctx, int alg)
+{
+  static const uint32_t sha1_iv[5] = {
+    0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0
+  };
+  static const uint32_t sha256_iv[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+  };
+
+  memset (ctx, 0, sizeof (hash_ctx));
+  ctx->alg = alg;
+  if (alg == AUTH_HMAC_SHA1_96) {
+    memcpy (ctx->h, sha1_iv, sizeof (sha1_iv));
+  } else {
+    memcpy (ctx->h, sha256_iv, sizeof (sha256_iv));
+  }
+}
+
+// SHA-1 compression function: process one 64-byte block.
+// Rounds are split into four loops of 20, so no round has to test which function to use.
+void
+sha1_block (uint32_t *h, const uint8_t *p)
+{
+  int i;
+  uint32_t w[80], a, b, c, d, e, t;
+
+  for (i=0; i<16; i++) {
+    w[i] = ((uint32_t) p[4*i] << 24) | ((uint32_t) p[4*i+1] << 16) | ((uint32_t) p[4*i+2] << 8) | p[4*i+3];
+  }
+  for (i=16; i<80; i++) {
+    w[i] = ROL (w[i-3] ^ w[i-8] ^ w[i-14] ^ w[i-16], 1);
+  }
+
+  a = h[0]; b = h[1]; c = h[2]; d = h[3]; e = h[4];
+  for (i=0; i<20; i++) {
+    t = ROL (a, 5) + (d ^ (b & (c ^ d))) + e + 0x5a827999 + w[i];
+    e = d; d = c; c = ROL (b, 30); b = a; a = t;
+  }
+  for (; i<40; i++) {
+    t = ROL (a, 5) + (b ^ c ^ d) + e + 0x6ed9eba1 + w[i];
+    e = d; d = c; c = ROL (b, 30); b = a; a = t;
+  }
+  for (; i<60; i++) {
+    t = ROL (a, 5) + ((b & c) | (d & (b | c))) + e + 0x8f1bbcdc + w[i];
+    e = d; d = c; c = ROL (b, 30); b = a; a = t;
+  }
+  for (; i<80; i++) {
+    t = ROL (a, 5) + (b ^ c ^ d) + e + 0xca62c1d6 + w[i];
+    e = d; d = c; c = ROL (b, 30); b = a; a = t;
+  }
+  h[0] += a; h[1] += b; h[2] += c; h[3] += d; h[4] += e;
+}
+
+// SHA-256 compression function: process one 64-byte block.
+void
+sha256_block (uint32_t *h, const uint8_t *p)
+{
+  static const uint32_t k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+  };
+  int i;
+  uint32_t w[64], a, b, c, d, e, f, g, hh, s0, s1, t1, t2;
+
+  for (i=0; i<16; i++) {
+    w[i] = ((uint32_t) p[4*i] << 24) | ((uint32_t) p[4*i+1] << 16) | ((uint32_t) p[4*i+2] << 8) | p[4*i+3];
+  }
+  for (i=16; i<64; i++) {
+    s0 = ROR (w[i-15], 7) ^ ROR (w[i-15], 18) ^ (w[i-15] >> 3);
+    s1 = ROR (w[i-2], 17) ^ ROR (w[i-2], 19) ^ (w[i-2] >> 10);
+    w[i] = w[i-16] + s0 + w[i-7] + s1;
+  }
+
+  a = h[0]; b = h[1]; c = h[2]; d = h[3]; e = h[4]; f = h[5]; g = h[6]; hh = h[7];
+  for (i=0; i<64; i++) {
+    s1 = ROR (e, 6) ^ ROR (e, 11) ^ ROR (e, 25);
+    t1 = hh + s1 + ((e & f) ^ (~e & g)) + k[i] + w[i];
+    s0 = ROR (a, 2) ^ ROR (a, 13) ^ ROR (a, 22);
+    t2 = s0 + ((a & b) ^ (a & c) ^ (b & c));
+    hh = g; g = f; f = e; e = d + t1; d = c; c = b; b = a; a = t1 + t2;
+  }
+  h[0] += a; h[1] += b; h[2] += c; h[3] += d; h[4] += e; h[5] += f; h[6] += g; h[7] += hh;
+}
+
+// Add data to hash.
+void
+hash_update (hash_ctx *ctx, const uint8_t *data, int len)
+{
+  int n;
+
+  ctx->len += len;
+
+  // Top up a partial block first.
+  if (ctx->nbuf > 0) {
+    n = 64 - ctx->nbuf;
+    if (n > len) {
+      n = len;
+    }
+    memcpy (ctx->buf + ctx->nbuf, data, n * sizeof (uint8_t));
+    ctx->nbuf += n;
+    data += n;
+    len -= n;
+    if (ctx->nbuf < 64) {
+      return;
+    }
+    if (ctx->alg == AUTH_HMAC_SHA1_96) {
+      sha1_block (ctx->h, ctx->buf);
+    } else {
+      sha256_block (ctx->h, ctx->buf);
+    }
+    ctx->nbuf = 0;
+  }
+
+  // Whole blocks are processed straight from the caller's buffer.
+  while (len >= 64) {
+    if (ctx->alg == AUTH_HMAC_SHA1_96) {
+      sha1_block (ctx->h, data);
+    } else {
+      sha256_block (ctx->h, data);
+    }
+    data += 64;
+    len -= 64;
+  }
+
+  memcpy (ctx->buf, data, len * sizeof (uint8_t));
+  ctx->nbuf = len;
+}
+
+// Finish hash: append padding and bit length, and write out the digest.
+void
+hash_final (hash_ctx *ctx, uint8_t *digest)
+{
+  int i, n;
+  uint64_t bits;
+  uint8_t pad[72];
+
+  bits = ctx->len * 8;
+  n = (ctx->nbuf < 56) ? (56 - ctx->nbuf) : (120 - ctx->nbuf);
+  memset (pad, 0, sizeof (pad));
+  pad[0] = 0x80;
+  for (i=0; i<8; i++) {
+    pad[n + i] = (bits >> (56 - (8 * i))) & 0xff;
+  }
+  hash_update (ctx, pad, n + 8);
+
+  n = (ctx->alg == AUTH_HMAC_SHA1_96) ? 5 : 8;
+  for (i=0; i<n; i++) {
+    digest[4*i] = ctx->h[i] >> 24;
+    digest[4*i+1] = (ctx->h[i] >> 16) & 0xff;
+    digest[4*i+2] = (ctx->h[i] >> 8) & 0xff;
+    digest[4*i+3] = ctx->h[i] & 0xff;
+  }
+}
+
+// Checksum function
+uint16_t
+checksum (uint16_t *addr, int len)
+{
+  int nleft = len;
+  int sum = 0;
+  uint16_t *w = addr;
+  uint16_t answer = 0;
+
+  while (nleft > 1) {
+    sum += *w++;
+    nleft -= sizeof (uint16_t);
+  }
+
+  if (nleft == 1) {
+    *(uint8_t *) (&answer) = *(uint8_t *) w;
+    sum += answer;
+  }
+
+  sum = (sum >> 16) + (sum & 0xFFFF);
+  sum += (sum >> 16);
+  answer = ~sum;
+  return (answer);
+}
+// Build IPv6 TCP pseudo-header and call checksum function (Section 8.1 of RFC 2460).
+uint16_t
+tcp6_checksum (struct ip6_hdr iphdr, struct tcphdr tcphdr, uint8_t *payload, int payloadlen)
+{
+  uint32_t lvalue;
+  char buf[IP_MAXPACKET], cvalue;
+  char *ptr;
+  int chksumlen = 0;
+  int i;
+
+  memset (buf, 0, IP_MAXPACKET * sizeof (uint8_t));
+
+  ptr = &buf[0];  // ptr points to beginning of buffer buf
+
+  // Copy source IP address into buf (128 bits)
+  memcpy (ptr, &iphdr.ip6_src.s6_addr, sizeof (iphdr.ip6_src.s6_addr));
+  ptr += sizeof (iphdr.ip6_src.s6_addr);
+  chksumlen += sizeof (iphdr.ip6_src.s6_addr);
+
+  // Copy destination IP address into buf (128 bits)
+  memcpy (ptr, &iphdr.ip6_dst.s6_addr, sizeof (iphdr.ip6_dst.s6_addr));
+  ptr += sizeof (iphdr.ip6_dst.s6_addr);
+  chksumlen += sizeof (iphdr.ip6_dst.s6_addr);
+
+  // Copy TCP length to buf (32 bits)
+  lvalue = htonl (sizeof (tcphdr) + payloadlen);
+  memcpy (ptr, &lvalue, sizeof (lvalue));
+  ptr += sizeof (lvalue);
+  chksumlen += sizeof (lvalue);
+
+  // Copy zero field to buf (24 bits)
+  *ptr = 0; ptr++;
+  *ptr = 0; ptr++;
+  *ptr = 0; ptr++;
+  chksumlen += 3;
+
+  // Copy next header field to buf (8 bits)
+  memcpy (ptr, &iphdr.ip6_nxt, sizeof (iphdr.ip6_nxt));
+  ptr += sizeof (iphdr.ip6_nxt);
+  chksumlen += sizeof (iphdr.ip6_nxt);
+
+  // Copy TCP source port to buf (16 bits)
+  memcpy (ptr, &tcphdr.th_sport, sizeof (tcphdr.th_sport));
+  ptr += sizeof (tcphdr.th_sport);
+  chksumlen += sizeof (tcphdr.th_sport);
+
+  // Copy TCP destination port to buf (16 bits)
+  memcpy (ptr, &tcphdr.th_dport, sizeof (tcphdr.th_dport));
+  ptr += sizeof (tcphdr.th_dport);
+  chksumlen += sizeof (tcphdr.th_dport);
+
+  // Copy sequence number to buf (32 bits)
+  memcpy (ptr, &tcphdr.th_seq, sizeof (tcphdr.th_seq));
+  ptr += sizeof (tcphdr.th_seq);
+  chksumlen += sizeof (tcphdr.th_seq);
+
+  // Copy acknowledgement number to buf (32 bits)
+  memcpy (ptr, &tcphdr.th_ack, sizeof (tcphdr.th_ack));
+  ptr += sizeof (tcphdr.th_ack);
+  chksumlen += sizeof (tcphdr.th_ack);
+
+  // Copy data offset to buf (4 bits) and
+  // copy reserved bits to buf (4 bits)
+  cvalue = (tcphdr.th_off << 4) + tcphdr.th_x2;
+  memcpy (ptr, &cvalue, sizeof (cvalue));
+  ptr += sizeof (cvalue);
+  chksumlen += sizeof (cvalue);
+
+  // Copy TCP flags to buf (8 bits)
+  memcpy (ptr, &tcphdr.th_flags, sizeof (tcphdr.th_flags));
+  ptr += sizeof (tcphdr.th_flags);
+  chksumlen += sizeof (tcphdr.th_flags);
+
+  // Copy TCP window size to buf (16 bits)
+  memcpy (ptr, &tcphdr.th_win, sizeof (tcphdr.th_win));
+  ptr += sizeof (tcphdr.th_win);
+  chksumlen += sizeof (tcphdr.th_win);
+
+  // Copy TCP checksum to buf (16 bits)
+  // Zero, since we don't know it yet
+  *ptr = 0; ptr++;
+  *ptr = 0; ptr++;
+  chksumlen += 2;
+
+  // Copy urgent pointer to buf (16 bits)
+  memcpy (ptr, &tcphdr.th_urp, sizeof (tcphdr.th_urp));
+  ptr += sizeof (tcphdr.th_urp);
+  chksumlen += sizeof (tcphdr.th_urp);
+
+  // Copy payload to buf
+  memcpy (ptr, payload, payloadlen * sizeof (uint8_t));
+  ptr += payloadlen;
+  chksumlen += payloadlen;
+
+  // Pad to the next 16-bit boundary
+  i = 0;
+  while (((payloadlen+i)%2) != 0) {
+    i++;
+    chksumlen++;
+    ptr++;
+  }
+
+  return checksum ((uint16_t *) buf, chksumlen);
+}
+// Allocate memory for an array of chars.
+char *
+allocate_strmem (int len)
+{
+  void *tmp;
+
+  if (len <= 0) {
+    fprintf (stderr, "ERROR: Cannot allocate memory because len = %i in allocate_strmem().\n", len);
+    exit (EXIT_FAILURE);
+  }
+
+  tmp = (char *) malloc (len * sizeof (char));
+  if (tmp != NULL) {
+    memset (tmp, 0, len * sizeof (char));
+    return (tmp);
+  } else {
+    fprintf (stderr, "ERROR: Cannot allocate memory for array allocate_strmem().\n");
+    exit (EXIT_FAILURE);
+  }
+}
+
+// Allocate memory for an array of unsigned chars.
+uint8_t *
+allocate_ustrmem (int len)
+{
+  void *tmp;
+
+  if (len <= 0) {
+    fprintf (stderr, "ERROR: Cannot allocate memory because len = %i in allocate_ustrmem().\n", len);
+    exit (EXIT_FAILURE);
+  }
+
+  tmp = (uint8_t *) malloc (len * sizeof (uint8_t));
+  if (tmp != NULL) {
+    memset (tmp, 0, len * sizeof (uint8_t));
+    return (tmp);
+  } else {
+    fprintf (stderr, "ERROR: Cannot allocate memory for array allocate_ustrmem().\n");
+    exit (EXIT_FAILURE);
+  }
+}
+
+// Allocate memory for an array of pointers to arrays of unsigned chars.
+uint8_t **
+allocate_ustrmemp (int len)
+{
+  void *tmp;
+
+  if (len <= 0) {
+    fprintf (stderr, "ERROR: Cannot allocate memory because len = %i in allocate_ustrmemp().\n", len);
+    exit (EXIT_FAILURE);
+  }
+
+  tmp = (uint8_t **) malloc (len * sizeof (uint8_t *));
+  if (tmp != NULL) {
+    memset (tmp, 0, len * sizeof (uint8_t *));
+    return (tmp);
+  } else {
+    fprintf (stderr, "ERROR: Cannot allocate memory for array allocate_ustrmemp().\n");
+    exit (EXIT_FAILURE);
+  }
+}
+
+// Allocate memory for an array of ints.
+int *
+allocate_intmem (int len)
+{
+  void *tmp;
+
+  if (len <= 0) {
+    fprintf (stderr, "ERROR: Cannot allocate memory because len = %i in allocate_intmem().\n", len);
+    exit (EXIT_FAILURE);
+  }
+
+  tmp = (int *) malloc (len * sizeof (int));
+  if (tmp != NULL) {
+    memset (tmp, 0, len * sizeof (int));
+    return (tmp);
+  } else {
+    fprintf (stderr, "ERROR: Cannot allocate memory for array allocate_intmem().\n");
+    exit (EXIT_FAILURE);
+  }
+}
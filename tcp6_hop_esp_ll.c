@@ -0,0 +1,1219 @@
+/*  Copyright (C) 2013  P.D. Buchan (pdbuchan@yahoo.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Send a stream of IPv6 TCP packets via raw socket at the link layer (ethernet frame).
+// Include a hop-by-hop options extension header with a router alert option,
+// and an encapsulating security payload (ESP) extension header whose payload
+// is genuinely encrypted and authenticated with AES-GCM (RFC 4106), using a
+// 128-bit or 256-bit key.
+// The ESP header can be used in transport mode or tunnel mode.
+// Sequence numbers and IVs are managed per security association, and packets
+// are encrypted a batch at a time, using AES-NI and PCLMULQDQ instructions if
+// the processor has them.
+// Need to have destination MAC address.
+
+#define _GNU_SOURCE           // sendmmsg() and struct mmsghdr
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>           // close()
+#include <string.h>           // strcpy, memset(), and memcpy()
+
+#include <netdb.h>            // struct addrinfo
+#include <sys/types.h>        // needed for socket(), uint8_t, uint16_t, uint32_t
+#include <sys/socket.h>       // needed for socket(), sendmmsg()
+#include <netinet/in.h>       // IPPROTO_IPV6, IPPROTO_HOPOPTS, IPPROTO_ESP, IPPROTO_TCP, INET6_ADDRSTRLEN
+#include <netinet/ip.h>       // IP_MAXPACKET (which is 65535)
+#include <netinet/ip6.h>      // struct ip6_hdr
+#define __FAVOR_BSD           // Use BSD format of tcp header
+#include <netinet/tcp.h>      // struct tcphdr
+#include <arpa/inet.h>        // inet_pton() and inet_ntop()
+#include <sys/ioctl.h>        // macro ioctl is defined
+#include <bits/ioctls.h>      // defines values for argument "request" of ioctl.
+#include <net/if.h>           // struct ifreq
+#include <linux/if_ether.h>   // ETH_P_IP = 0x0800, ETH_P_IPV6 = 0x86DD
+#include <linux/if_packet.h>  // struct sockaddr_ll (see man 7 packet)
+#include <net/ethernet.h>
+#include <time.h>             // clock_gettime()
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>        // AES-NI and PCLMULQDQ intrinsics (x86 only)
+#endif
+
+#include <errno.h>            // errno, perror()
+
+// Define a struct for hop-by-hop header, excluding options.
+typedef struct _hop_hdr hop_hdr;
+struct _hop_hdr {
+  uint8_t nxt_hdr;
+  uint8_t hdr_len;
+};
+
+// Define a struct for head of ESP header, excluding IV, payload and authentication data.
+typedef struct _esp_hdr esp_hdr;
+struct _esp_hdr {
+  uint32_t spi;
+  uint32_t seq;
+};
+
+// Define a struct for tail of ESP header, excluding ESP header (above), payload data, padding, and auth. data
+typedef struct _esp_tail esp_tail;
+struct _esp_tail {
+  uint8_t pad_len;
+  uint8_t nxt_hdr;
+};
+
+// Define some constants.
+#define ETH_HDRLEN 14         // Ethernet header length
+#define IP6_HDRLEN 40         // IPv6 header length
+#define HOP_HDRLEN 2          // Hop-by-hop header length, excluding options
+#define ESP_HDRLEN 8          // Encapsulating security payload (ESP) header, excluding IV, payload data, padding, ESP trailer, and authentication data
+#define ESP_IVLEN 8           // AES-GCM explicit IV length (Section 3.1 of RFC 4106)
+#define ESP_TAILLEN 2         // Encapsulating security payload (ESP) tail, excluding ESP header (above), payload data, padding, and auth. data
+#define ESP_ICVLEN 16         // AES-GCM ICV length (16-octet ICV variant of RFC 4106)
+#define TCP_HDRLEN 20         // TCP header length, excludes options data
+#define BATCH 64              // Number of packets encrypted and handed to sendmmsg() at once
+#define MAX_KEYLEN 36         // Maximum keying material length: 32-byte AES key plus 4-byte salt
+
+// Multiply by x in GF(2^8), as used by AES MixColumns.
+#define XTIME(x) ((uint8_t) (((x) << 1) ^ (((x) & 0x80) ? 0x1b : 0x00)))
+
+// Define a struct for expanded AES key.
+typedef struct _aes_ctx aes_ctx;
+struct _aes_ctx {
+  uint8_t rk[240];      // Round keys, 16 bytes for each round plus initial key
+  int nr;               // Number of rounds: 10 for AES-128, 14 for AES-256
+};
+
+// Define a struct for an ESP security association (SA).
+typedef struct _esp_sa esp_sa;
+struct _esp_sa {
+  uint32_t spi;         // Security parameters index
+  uint64_t seq;         // Last sequence number sent (64 bits if extended sequence numbers are used)
+  int esn;              // Extended (64-bit) sequence numbers: 0 = no, 1 = yes (Section 2.2.1 of RFC 4303)
+  uint8_t salt[4];      // Implicit part of nonce, from end of keying material (Section 4 of RFC 4106)
+  aes_ctx aes;          // Expanded AES key
+  uint8_t h[16];        // GHASH key: H = E(K, 0^128)
+  uint8_t hpow[4][16];  // H, H^2, H^3, H^4, so four GHASH multiplications per step are independent
+  int aesni;            // Use AES-NI and PCLMULQDQ instructions: 0 = no, 1 = yes
+};
+
+// AES S-box (Section 5.1.1 of FIPS 197)
+static const uint8_t aes_sbox[256] = {
+  0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5, 0x30, 0x01, 0x67, 0x2b, 0xfe, 0xd7, 0xab, 0x76,
+  0xca, 0x82, 0xc9, 0x7d, 0xfa, 0x59, 0x47, 0xf0, 0xad, 0xd4, 0xa2, 0xaf, 0x9c, 0xa4, 0x72, 0xc0,
+  0xb7, 0xfd, 0x93, 0x26, 0x36, 0x3f, 0xf7, 0xcc, 0x34, 0xa5, 0xe5, 0xf1, 0x71, 0xd8, 0x31, 0x15,
+  0x04, 0xc7, 0x23, 0xc3, 0x18, 0x96, 0x05, 0x9a, 0x07, 0x12, 0x80, 0xe2, 0xeb, 0x27, 0xb2, 0x75,
+  0x09, 0x83, 0x2c, 0x1a, 0x1b, 0x6e, 0x5a, 0xa0, 0x52, 0x3b, 0xd6, 0xb3, 0x29, 0xe3, 0x2f, 0x84,
+  0x53, 0xd1, 0x00, 0xed, 0x20, 0xfc, 0xb1, 0x5b, 0x6a, 0xcb, 0xbe, 0x39, 0x4a, 0x4c, 0x58, 0xcf,
+  0xd0, 0xef, 0xaa, 0xfb, 0x43, 0x4d, 0x33, 0x85, 0x45, 0xf9, 0x02, 0x7f, 0x50, 0x3c, 0x9f, 0xa8,
+  0x51, 0xa3, 0x40, 0x8f, 0x92, 0x9d, 0x38, 0xf5, 0xbc, 0xb6, 0xda, 0x21, 0x10, 0xff, 0xf3, 0xd2,
+  0xcd, 0x0c, 0x13, 0xec, 0x5f, 0x97, 0x44, 0x17, 0xc4, 0xa7, 0x7e, 0x3d, 0x64, 0x5d, 0x19, 0x73,
+  0x60, 0x81, 0x4f, 0xdc, 0x22, 0x2a, 0x90, 0x88, 0x46, 0xee, 0xb8, 0x14, 0xde, 0x5e, 0x0b, 0xdb,
+  0xe0, 0x32, 0x3a, 0x0a, 0x49, 0x06, 0x24, 0x5c, 0xc2, 0xd3, 0xac, 0x62, 0x91, 0x95, 0xe4, 0x79,
+  0xe7, 0xc8, 0x37, 0x6d, 0x8d, 0xd5, 0x4e, 0xa9, 0x6c, 0x56, 0xf4, 0xea, 0x65, 0x7a, 0xae, 0x08,
+  0xba, 0x78, 0x25, 0x2e, 0x1c, 0xa6, 0xb4, 0xc6, 0xe8, 0xdd, 0x74, 0x1f, 0x4b, 0xbd, 0x8b, 0x8a,
+  0x70, 0x3e, 0xb5, 0x66, 0x48, 0x03, 0xf6, 0x0e, 0x61, 0x35, 0x57, 0xb9, 0x86, 0xc1, 0x1d, 0x9e,
+  0xe1, 0xf8, 0x98, 0x11, 0x69, 0xd9, 0x8e, 0x94, 0x9b, 0x1e, 0x87, 0xe9, 0xce, 0x55, 0x28, 0xdf,
+  0x8c, 0xa1, 0x89, 0x0d, 0xbf, 0xe6, 0x42, 0x68, 0x41, 0x99, 0x2d, 0x0f, 0xb0, 0x54, 0xbb, 0x16
+};
+
+// Function prototypes
+int esp_sa_init (esp_sa *, uint8_t *, int, uint32_t, int);
+int esp_seal_batch (esp_sa *, uint8_t **, uint8_t **, int *, int);
+int hex_to_bytes (char *, uint8_t *, int);
+void aes_key_expand (aes_ctx *, const uint8_t *, int);
+void aes_encrypt_block (aes_ctx *, const uint8_t *, uint8_t *);
+void ghash_mult (uint8_t *, const uint8_t *);
+void ghash_update (uint8_t *, const uint8_t *, const uint8_t *, int);
+void gcm_seal (esp_sa *, const uint8_t *, const uint8_t *, int, const uint8_t *, uint8_t *, int, uint8_t *);
+#if defined(__x86_64__) || defined(__i386__)
+void gcm_seal_ni (esp_sa *, const uint8_t *, const uint8_t *, int, const uint8_t *, uint8_t *, int, uint8_t *);
+#endif
+uint16_t checksum (uint16_t *, int);
+uint16_t tcp6_checksum (struct ip6_hdr, struct tcphdr, uint8_t *, int);
+char *allocate_strmem (int);
+uint8_t *allocate_ustrmem (int);
+uint8_t **allocate_ustrmemp (int);
+int *allocate_intmem (int);
+
+int
+main (int argc, char **argv)
+{
+  int i, n, c, status, frame_length, sd, mode, esn, keylen, npackets, sent, payloadlen, plainlen, esp_padlen;
+  int *tcp_flags, *lens;
+  char *interface, *target, *src_ip, *dst_ip, *key_hex;
+  struct ip6_hdr iphdr, newiphdr;
+  struct tcphdr tcphdr;
+  hop_hdr hophdr;
+  esp_hdr esphdr;
+  esp_tail esptail;
+  esp_sa sa;
+  uint8_t *src_mac, *dst_mac, *payload, *key, *plain, *frames, **esp, **plains;
+  struct addrinfo hints, *res;
+  struct sockaddr_in6 *ipv6;
+  struct sockaddr_ll device;
+  struct ifreq ifr;
+  struct mmsghdr msgs[BATCH];
+  struct iovec iovs[BATCH];
+  struct timespec t1, t2, s1, s2;
+  double dt, dseal;
+  void *tmp;
+
+  // Allocate memory for various arrays.
+  src_mac = allocate_ustrmem (6);
+  dst_mac = allocate_ustrmem (6);
+  interface = allocate_strmem (40);
+  target = allocate_strmem (INET6_ADDRSTRLEN);
+  src_ip = allocate_strmem (INET6_ADDRSTRLEN);
+  dst_ip = allocate_strmem (INET6_ADDRSTRLEN);
+  key_hex = allocate_strmem (2 * MAX_KEYLEN + 1);
+  key = allocate_ustrmem (MAX_KEYLEN);
+  tcp_flags = allocate_intmem (8);
+  payload = allocate_ustrmem (IP_MAXPACKET);
+  plain = allocate_ustrmem (IP_MAXPACKET);
+  frames = allocate_ustrmem (BATCH * IP_MAXPACKET);
+  esp = allocate_ustrmemp (BATCH);
+  plains = allocate_ustrmemp (BATCH);
+  lens = allocate_intmem (BATCH);
+
+  // Interface to send packets through.
+  strcpy (interface, "eth0");
+
+  // ESP mode: 1 = transport mode, 2 = tunnel mode
+  mode = 1;
+
+  // Keying material, in hexadecimal: you need to fill this out
+  // AES key (16 bytes for AES-GCM-128, 32 bytes for AES-GCM-256) followed by 4-byte salt (Section 8.1 of RFC 4106).
+  strcpy (key_hex, "000102030405060708090a0b0c0d0e0fdeadbeef");
+
+  // Use extended (64-bit) sequence numbers: 0 = no, 1 = yes
+  esn = 0;
+
+  // Number of packets to send.
+  npackets = 100000;
+
+  // Submit request for a socket descriptor to look up interface.
+  if ((sd = socket (PF_PACKET, SOCK_RAW, htons (ETH_P_ALL))) < 0) {
+    perror ("socket() failed to get socket descriptor for using ioctl() ");
+    exit (EXIT_FAILURE);
+  }
+
+  // Use ioctl() to look up interface name and get its MAC address.
+  memset (&ifr, 0, sizeof (ifr));
+  snprintf (ifr.ifr_name, sizeof (ifr.ifr_name), "%s", interface);
+  if (ioctl (sd, SIOCGIFHWADDR, &ifr) < 0) {
+    perror ("ioctl() failed to get source MAC address ");
+    return (EXIT_FAILURE);
+  }
+  close (sd);
+
+  // Copy source MAC address.
+  memcpy (src_mac, ifr.ifr_hwaddr.sa_data, 6 * sizeof (uint8_t));
+
+  // Report source MAC address to stdout.
+  printf ("MAC address for interface %s is ", interface);
+  for (i=0; i<5; i++) {
+    printf ("%02x:", src_mac[i]);
+  }
+  printf ("%02x\n", src_mac[5]);
+
+  // Find interface index from interface name and store index in
+  // struct sockaddr_ll device, which will be used as an argument of sendmmsg().
+  memset (&device, 0, sizeof (device));
+  if ((device.sll_ifindex = if_nametoindex (interface)) == 0) {
+    perror ("if_nametoindex() failed to obtain interface index ");
+    exit (EXIT_FAILURE);
+  }
+  printf ("Index for interface %s is %i\n", interface, device.sll_ifindex);
+
+  // Set destination MAC address: you need to fill these out
+  dst_mac[0] = 0xff;
+  dst_mac[1] = 0xff;
+  dst_mac[2] = 0xff;
+  dst_mac[3] = 0xff;
+  dst_mac[4] = 0xff;
+  dst_mac[5] = 0xff;
+
+  // Source IPv6 address: you need to fill this out
+  strcpy (src_ip, "2001:db8::214:51ff:fe2f:1556");
+
+  // Destination URL or IPv6 address: you need to fill this out
+  strcpy (target, "ipv6.google.com");
+
+  // Fill out hints for getaddrinfo().
+  memset (&hints, 0, sizeof (struct addrinfo));
+  hints.ai_family = AF_INET6;
+  hints.ai_socktype = SOCK_RAW;
+  hints.ai_flags = hints.ai_flags | AI_CANONNAME;
+
+  // Resolve target using getaddrinfo().
+  if ((status = getaddrinfo (target, NULL, &hints, &res)) != 0) {
+    fprintf (stderr, "getaddrinfo() failed: %s\n", gai_strerror (status));
+    exit (EXIT_FAILURE);
+  }
+  ipv6 = (struct sockaddr_in6 *) res->ai_addr;
+  tmp = &(ipv6->sin6_addr);
+  if (inet_ntop (AF_INET6, tmp, dst_ip, INET6_ADDRSTRLEN) == NULL) {
+    status = errno;
+    fprintf (stderr, "inet_ntop() failed.\nError message: %s", strerror (status));
+    exit (EXIT_FAILURE);
+  }
+  freeaddrinfo (res);
+
+  // Fill out sockaddr_ll.
+  device.sll_family = AF_PACKET;
+  memcpy (device.sll_addr, src_mac, 6 * sizeof (uint8_t));
+  device.sll_halen = 6;
+
+  // Set up security association: SPI and keying material are shared with the receiver.
+  keylen = hex_to_bytes (key_hex, key, MAX_KEYLEN);
+  esp_sa_init (&sa, key, keylen, 31415ul, esn);  // Security parameters index (Section 2.1 of RFC 4303): you set this
+  printf ("AES-GCM-%i, using %s\n", (sa.aes.nr == 10) ? 128 : 256, (sa.aesni == 1) ? "AES-NI and PCLMULQDQ" : "portable C implementation");
+
+  // TCP data: you need to fill this out
+  payloadlen = 1000;
+  for (i=0; i<payloadlen; i++) {
+    payload[i] = 'a' + (i % 26);
+  }
+
+  // IPv6 header
+
+  // IPv6 version (4 bits), Traffic class (8 bits), Flow label (20 bits)
+  iphdr.ip6_flow = htonl ((6 << 28) | (0 << 20) | 0);
+
+  // Next header (8 bits): 6 for TCP
+  // We'll change this later, otherwise TCP checksum will be wrong.
+  iphdr.ip6_nxt = IPPROTO_TCP;
+
+  // Hop limit (8 bits): default to maximum value
+  iphdr.ip6_hops = 255;
+
+  // Source IPv6 address (128 bits)
+  if ((status = inet_pton (AF_INET6, src_ip, &(iphdr.ip6_src))) != 1) {
+    fprintf (stderr, "inet_pton() failed.\nError message: %s", strerror (status));
+    exit (EXIT_FAILURE);
+  }
+
+  // Destination IPv6 address (128 bits)
+  if ((status = inet_pton (AF_INET6, dst_ip, &(iphdr.ip6_dst))) != 1) {
+    fprintf (stderr, "inet_pton() failed.\nError message: %s", strerror (status));
+    exit (EXIT_FAILURE);
+  }
+
+  // TCP header
+
+  // Source port number (16 bits)
+  tcphdr.th_sport = htons (80);
+
+  // Destination port number (16 bits)
+  tcphdr.th_dport = htons (80);
+
+  // Sequence number (32 bits)
+  tcphdr.th_seq = htonl (0);
+
+  // Acknowledgement number (32 bits)
+  tcphdr.th_ack = htonl (0);
+
+  // Reserved (4 bits): should be 0
+  tcphdr.th_x2 = 0;
+
+  // Data offset (4 bits): size of TCP header in 32-bit words
+  tcphdr.th_off = TCP_HDRLEN / 4;
+
+  // Flags (8 bits)
+
+  // FIN flag (1 bit)
+  tcp_flags[0] = 0;
+
+  // SYN flag (1 bit)
+  tcp_flags[1] = 0;
+
+  // RST flag (1 bit)
+  tcp_flags[2] = 0;
+
+  // PSH flag (1 bit)
+  tcp_flags[3] = 1;
+
+  // ACK flag (1 bit)
+  tcp_flags[4] = 1;
+
+  // URG flag (1 bit)
+  tcp_flags[5] = 0;
+
+  // ECE flag (1 bit)
+  tcp_flags[6] = 0;
+
+  // CWR flag (1 bit)
+  tcp_flags[7] = 0;
+
+  tcphdr.th_flags = 0;
+  for (i=0; i<8; i++) {
+    tcphdr.th_flags += (tcp_flags[i] << i);
+  }
+
+  // Window size (16 bits)
+  tcphdr.th_win = htons (65535);
+
+  // Urgent pointer (16 bits): 0 (only valid if URG flag is set)
+  tcphdr.th_urp = htons (0);
+
+  // TCP checksum (16 bits)
+  tcphdr.th_sum = tcp6_checksum (iphdr, tcphdr, payload, payloadlen);
+
+  // Hop-by-hop extension header with a router alert option (with bogus value).
+  // Alignment requirement is 2n+0 for router alert (Section 2.1 of RFC 2711), so the
+  // option directly follows the 2-byte header, and a 2-byte PadN ends the header on an 8-byte boundary.
+  hophdr.hdr_len = 0;  // Length in units of 8 bytes, excluding first 8 bytes
+
+  // Encapsulating security payload (ESP) header
+  // Sequence number, IV, ciphertext and ICV are filled in for each packet by esp_seal_batch().
+  esphdr.spi = htonl (sa.spi);
+  esphdr.seq = htonl (0ul);
+
+  // Build plaintext which will be encrypted: in transport mode, the TCP segment;
+  // in tunnel mode, the original IPv6 packet, including its hop-by-hop header.
+  plainlen = 0;
+  if (mode == 2) {
+    iphdr.ip6_nxt = IPPROTO_HOPOPTS;
+    iphdr.ip6_plen = htons (8 + TCP_HDRLEN + payloadlen);
+    memcpy (plain, &iphdr, IP6_HDRLEN * sizeof (uint8_t));
+    plainlen += IP6_HDRLEN;
+
+    hophdr.nxt_hdr = IPPROTO_TCP;
+    memcpy (plain + plainlen, &hophdr, HOP_HDRLEN * sizeof (uint8_t));
+    plainlen += HOP_HDRLEN;
+    plain[plainlen++] = 5;  // Option Type: router alert
+    plain[plainlen++] = 2;  // Length of Option Data field
+    plain[plainlen++] = 0;  // Option Data: some unassigned IANA value, you
+    plain[plainlen++] = 5;  // should select what you want.
+    plain[plainlen++] = 1;  // Padding option type: PadN
+    plain[plainlen++] = 0;  // PadN length: N - 2
+  }
+  memcpy (plain + plainlen, &tcphdr, TCP_HDRLEN * sizeof (uint8_t));
+  plainlen += TCP_HDRLEN;
+  memcpy (plain + plainlen, payload, payloadlen * sizeof (uint8_t));
+  plainlen += payloadlen;
+
+  // The ESP header Pad Length and Next Header must be right-aligned to nearest 4-byte block.
+  // See Section 2.4 of RFC 4303. Padding values are 1, 2, 3, ...
+  esp_padlen = 0;
+  while (((plainlen + ESP_TAILLEN) % 4) != 0) {
+    plain[plainlen++] = (uint8_t) (esp_padlen + 1u);
+    esp_padlen++;
+  }
+
+  // ESP trailer
+  esptail.pad_len = esp_padlen;
+  esptail.nxt_hdr = (mode == 1) ? IPPROTO_TCP : IPPROTO_IPV6;
+  memcpy (plain + plainlen, &esptail, ESP_TAILLEN * sizeof (uint8_t));
+  plainlen += ESP_TAILLEN;
+
+  // Build template frame in first slot.
+  c = 0;
+
+  // Destination and Source MAC addresses
+  memcpy (frames, dst_mac, 6 * sizeof (uint8_t));
+  memcpy (frames + 6, src_mac, 6 * sizeof (uint8_t));
+
+  // Next is ethernet type code (ETH_P_IPV6 for IPv6).
+  // http://www.iana.org/assignments/ethernet-numbers
+  frames[12] = ETH_P_IPV6 / 256;
+  frames[13] = ETH_P_IPV6 % 256;
+  c += ETH_HDRLEN;
+
+  if (mode == 1) {
+
+    // Transport mode: IPv6 header, hop-by-hop header, ESP (Section 3.1.1 of RFC 4303).
+    iphdr.ip6_nxt = IPPROTO_HOPOPTS;
+    iphdr.ip6_plen = htons (8 + ESP_HDRLEN + ESP_IVLEN + plainlen + ESP_ICVLEN);
+    memcpy (frames + c, &iphdr, IP6_HDRLEN * sizeof (uint8_t));
+    c += IP6_HDRLEN;
+
+    hophdr.nxt_hdr = IPPROTO_ESP;  // 50 for encapsulating security payload (ESP) extension header
+    memcpy (frames + c, &hophdr, HOP_HDRLEN * sizeof (uint8_t));
+    c += HOP_HDRLEN;
+    frames[c++] = 5;  // Option Type: router alert
+    frames[c++] = 2;  // Length of Option Data field
+    frames[c++] = 0;  // Option Data: some unassigned IANA value, you
+    frames[c++] = 5;  // should select what you want.
+    frames[c++] = 1;  // Padding option type: PadN
+    frames[c++] = 0;  // PadN length: N - 2
+
+  } else {
+
+    // Tunnel mode: new IPv6 header, ESP (Section 3.1.2 of RFC 4303).
+    // Inner extension headers are not copied to the outer header (Section 5.1.2.2 of RFC 4301).
+    newiphdr = iphdr;
+    newiphdr.ip6_nxt = IPPROTO_ESP;  // 50 for encapsulating security payload (ESP) extension header
+    newiphdr.ip6_plen = htons (ESP_HDRLEN + ESP_IVLEN + plainlen + ESP_ICVLEN);
+    memcpy (frames + c, &newiphdr, IP6_HDRLEN * sizeof (uint8_t));
+    c += IP6_HDRLEN;
+  }
+
+  // ESP header, followed by room for IV, ciphertext, and ICV.
+  memcpy (frames + c, &esphdr, ESP_HDRLEN * sizeof (uint8_t));
+  esp[0] = frames + c;
+  c += ESP_HDRLEN + ESP_IVLEN + plainlen + ESP_ICVLEN;
+
+  frame_length = c;
+  printf ("Ethernet frame length: %i\n", frame_length);
+
+  // Copy template into remaining slots, and prepare messages for sendmmsg().
+  memset (msgs, 0, sizeof (msgs));
+  for (i=0; i<BATCH; i++) {
+    if (i > 0) {
+      memcpy (frames + (i * IP_MAXPACKET), frames, frame_length * sizeof (uint8_t));
+      esp[i] = esp[0] + (i * IP_MAXPACKET);
+    }
+    plains[i] = plain;  // Every packet carries the same plaintext here.
+    lens[i] = plainlen;
+    iovs[i].iov_base = frames + (i * IP_MAXPACKET);
+    iovs[i].iov_len = frame_length;
+    msgs[i].msg_hdr.msg_iov = &iovs[i];
+    msgs[i].msg_hdr.msg_iovlen = 1;
+    msgs[i].msg_hdr.msg_name = &device;
+    msgs[i].msg_hdr.msg_namelen = sizeof (device);
+  }
+
+  // Submit request for a raw socket descriptor.
+  if ((sd = socket (PF_PACKET, SOCK_RAW, htons (ETH_P_ALL))) < 0) {
+    perror ("socket() failed ");
+    exit (EXIT_FAILURE);
+  }
+
+  dseal = 0.0;
+  sent = 0;
+  clock_gettime (CLOCK_MONOTONIC, &t1);
+  while (sent < npackets) {
+
+    n = npackets - sent;
+    if (n > BATCH) {
+      n = BATCH;
+    }
+
+    // Assign sequence numbers and IVs, encrypt, and compute ICVs for the whole batch.
+    clock_gettime (CLOCK_MONOTONIC, &s1);
+    esp_seal_batch (&sa, esp, plains, lens, n);
+    clock_gettime (CLOCK_MONOTONIC, &s2);
+    dseal += (double) (s2.tv_sec - s1.tv_sec) + (double) (s2.tv_nsec - s1.tv_nsec) / 1000000000.0;
+
+    // Send batch of ethernet frames to socket.
+    i = 0;
+    while (i < n) {
+      if ((status = sendmmsg (sd, msgs + i, n - i, 0)) < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        perror ("sendmmsg() failed ");
+        exit (EXIT_FAILURE);
+      }
+      i += status;
+    }
+    sent += n;
+  }
+  clock_gettime (CLOCK_MONOTONIC, &t2);
+  dt = (double) (t2.tv_sec - t1.tv_sec) + (double) (t2.tv_nsec - t1.tv_nsec) / 1000000000.0;
+
+  // Report results.
+  printf ("Sent %i packets in %g seconds (%.0f packets per second, %.2f Gbit/s)\n", sent, dt,
+    (dt > 0.0) ? (double) sent / dt : 0.0, (dt > 0.0) ? (double) sent * frame_length * 8.0 / dt / 1000000000.0 : 0.0);
+  printf ("Time spent encrypting: %g seconds (%.0f ns per packet, %.2f Gbit/s)\n", dseal, (sent > 0) ? dseal * 1000000000.0 / sent : 0.0,
+    (dseal > 0.0) ? (double) sent * plainlen * 8.0 / dseal / 1000000000.0 : 0.0);
+
+  // Close socket descriptor.
+  close (sd);
+
+  // Free allocated memory.
+  free (src_mac);
+  free (dst_mac);
+  free (interface);
+  free (target);
+  free (src_ip);
+  free (dst_ip);
+  free (key_hex);
+  free (key);
+  free (tcp_flags);
+  free (payload);
+  free (plain);
+  free (frames);
+  free (esp);
+  free (plains);
+  free (lens);
+
+  return (EXIT_SUCCESS);
+}
+
+// Set up an ESP security association for AES-GCM with a 16-byte ICV.
+// Keying material is the AES key followed by a 4-byte salt (Section 8.1 of RFC 4106).
+int
+esp_sa_init (esp_sa *sa, uint8_t *key, int keylen, uint32_t spi, int esn)
+{
+  int i;
+  uint8_t zero[16];
+
+  if ((keylen != 20) && (keylen != 36)) {
+    fprintf (stderr, "ERROR: Keying material must be 20 bytes (AES-GCM-128) or 36 bytes (AES-GCM-256); got %i.\n", keylen);
+    exit (EXIT_FAILURE);
+  }
+
+  memset (sa, 0, sizeof (esp_sa));
+  sa->spi = spi;
+  sa->seq = 0;  // First packet sent has sequence number 1 (Section 3.3.3 of RFC 4303).
+  sa->esn = esn;
+  memcpy (sa->salt, key + keylen - 4, 4 * sizeof (uint8_t));
+  aes_key_expand (&sa->aes, key, keylen - 4);
+
+  memset (zero, 0, 16 * sizeof (uint8_t));
+  aes_encrypt_block (&sa->aes, zero, sa->h);
+  memcpy (sa->hpow[0], sa->h, 16 * sizeof (uint8_t));
+  for (i=1; i<4; i++) {
+    memcpy (sa->hpow[i], sa->hpow[i-1], 16 * sizeof (uint8_t));
+    ghash_mult (sa->hpow[i], sa->h);
+  }
+
+  // Use AES-NI and PCLMULQDQ if processor supports them.
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_cpu_init ();
+  sa->aesni = (__builtin_cpu_supports ("aes") && __builtin_cpu_supports ("pclmul") && __builtin_cpu_supports ("sse4.1")) ? 1 : 0;
+#else
+  sa->aesni = 0;
+#endif
+
+  return (EXIT_SUCCESS);
+}
+
+// Assign the next sequence numbers to a batch of packets, and encrypt and authenticate them.
+// esp[i] points to the ESP header of packet i (SPI already filled in); plain[i] and lens[i]
+// are its plaintext (payload, padding, and ESP trailer) and length. IV, ciphertext and ICV follow the ESP header.
+int
+esp_seal_batch (esp_sa *sa, uint8_t **esp, uint8_t **plain, int *lens, int n)
+{
+  int i, aadlen;
+  uint8_t nonce[12], aad[12];
+
+  for (i=0; i<n; i++) {
+
+    // Sequence numbers must never cycle (Section 3.3.3 of RFC 4303).
+    if ((sa->esn == 0) && (sa->seq == 0xfffffffful)) {
+      fprintf (stderr, "ERROR: Sequence number space exhausted; a new SA is needed.\n");
+      exit (EXIT_FAILURE);
+    }
+    sa->seq++;
+
+    // Low-order 32 bits of sequence number go in the header.
+    esp[i][4] = (sa->seq >> 24) & 0xff;
+    esp[i][5] = (sa->seq >> 16) & 0xff;
+    esp[i][6] = (sa->seq >> 8) & 0xff;
+    esp[i][7] = sa->seq & 0xff;
+
+    // IV must never repeat for a given key (Section 3.1 of RFC 4106); the 64-bit sequence number serves.
+    esp[i][8] = (sa->seq >> 56) & 0xff;
+    esp[i][9] = (sa->seq >> 48) & 0xff;
+    esp[i][10] = (sa->seq >> 40) & 0xff;
+    esp[i][11] = (sa->seq >> 32) & 0xff;
+    memcpy (esp[i] + 12, esp[i] + 4, 4 * sizeof (uint8_t));
+
+    // Nonce is salt followed by IV (Section 4 of RFC 4106).
+    memcpy (nonce, sa->salt, 4 * sizeof (uint8_t));
+    memcpy (nonce + 4, esp[i] + ESP_HDRLEN, ESP_IVLEN * sizeof (uint8_t));
+
+    // Additional authenticated data is SPI and (32 or 64-bit) sequence number (Section 5 of RFC 4106).
+    memcpy (aad, esp[i], 4 * sizeof (uint8_t));
+    if (sa->esn == 1) {
+      memcpy (aad + 4, esp[i] + 8, 8 * sizeof (uint8_t));
+      aadlen = 12;
+    } else {
+      memcpy (aad + 4, esp[i] + 4, 4 * sizeof (uint8_t));
+      aadlen = 8;
+    }
+
+#if defined(__x86_64__) || defined(__i386__)
+    if (sa->aesni == 1) {
+      gcm_seal_ni (sa, nonce, aad, aadlen, plain[i], esp[i] + ESP_HDRLEN + ESP_IVLEN, lens[i], esp[i] + ESP_HDRLEN + ESP_IVLEN + lens[i]);
+    } else {
+      gcm_seal (sa, nonce, aad, aadlen, plain[i], esp[i] + ESP_HDRLEN + ESP_IVLEN, lens[i], esp[i] + ESP_HDRLEN + ESP_IVLEN + lens[i]);
+    }
+#else
+    gcm_seal (sa, nonce, aad, aadlen, plain[i], esp[i] + ESP_HDRLEN + ESP_IVLEN, lens[i], esp[i] + ESP_HDRLEN + ESP_IVLEN + lens[i]);
+#endif
+  }
+
+  return (EXIT_SUCCESS);
+}
+
+// Convert a string of hexadecimal digits to bytes. Returns number of bytes.
+int
+hex_to_bytes (char *hex, uint8_t *out, int max)
+{
+  int n;
+  unsigned int byte;
+
+  n = 0;
+  while ((hex[2 * n] != 0) && (hex[(2 * n) + 1] != 0)) {
+    if (n >= max) {
+      fprintf (stderr, "ERROR: Hexadecimal key longer than %i bytes in hex_to_bytes().\n", max);
+      exit (EXIT_FAILURE);
+    }
+    if (sscanf (hex + (2 * n), "%2x", &byte) != 1) {
+      fprintf (stderr, "ERROR: Invalid hexadecimal digits in hex_to_bytes().\n");
+      exit (EXIT_FAILURE);
+    }
+    out[n] = byte;
+    n++;
+  }
+
+  return (n);
+}
+
+// Expand AES-128 or AES-256 key into round keys (Section 5.2 of FIPS 197).
+void
+aes_key_expand (aes_ctx *ctx, const uint8_t *key, int keylen)
+{
+  static const uint8_t rcon[10] = {0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0x1b, 0x36};
+  int i, j, nk;
+  uint8_t t[4], u;
+
+  nk = keylen / 4;
+  ctx->nr = nk + 6;
+  memcpy (ctx->rk, key, keylen * sizeof (uint8_t));
+
+  for (i=nk; i<4*(ctx->nr + 1); i++) {
+    memcpy (t, ctx->rk + (4 * (i - 1)), 4 * sizeof (uint8_t));
+    if ((i % nk) == 0) {
+      u = t[0];  // RotWord, SubWord, and Rcon
+      t[0] = aes_sbox[t[1]] ^ rcon[(i / nk) - 1];
+      t[1] = aes_sbox[t[2]];
+      t[2] = aes_sbox[t[3]];
+      t[3] = aes_sbox[u];
+    } else if ((nk > 6) && ((i % nk) == 4)) {
+      for (j=0; j<4; j++) {
+        t[j] = aes_sbox[t[j]];
+      }
+    }
+    for (j=0; j<4; j++) {
+      ctx->rk[(4 * i) + j] = ctx->rk[(4 * (i - nk)) + j] ^ t[j];
+    }
+  }
+}
+
+// Encrypt one 16-byte block with AES, without special instructions.
+void
+aes_encrypt_block (aes_ctx *ctx, const uint8_t *in, uint8_t *out)
+{
+  int i, r;
+  uint8_t s[16], t[16], a0, a1, a2, a3, x;
+
+  for (i=0; i<16; i++) {
+    s[i] = in[i] ^ ctx->rk[i];
+  }
+
+  for (r=1; r<=ctx->nr; r++) {
+
+    // SubBytes and ShiftRows: state is column-major, so row i%4 moves left by i%4 columns.
+    for (i=0; i<16; i++) {
+      t[i] = aes_sbox[s[(i + (4 * (i % 4))) % 16]];
+    }
+
+    // MixColumns, except in final round.
+    if (r < ctx->nr) {
+      for (i=0; i<16; i+=4) {
+        a0 = t[i];
+        a1 = t[i+1];
+        a2 = t[i+2];
+        a3 = t[i+3];
+        x = a0 ^ a1 ^ a2 ^ a3;
+        s[i] = a0 ^ x ^ XTIME (a0 ^ a1);
+        s[i+1] = a1 ^ x ^ XTIME (a1 ^ a2);
+        s[i+2] = a2 ^ x ^ XTIME (a2 ^ a3);
+        s[i+3] = a3 ^ x ^ XTIME (a3 ^ a0);
+      }
+    } else {
+      memcpy (s, t, 16 * sizeof (uint8_t));
+    }
+
+    // AddRoundKey
+    for (i=0; i<16; i++) {
+      s[i] ^= ctx->rk[(16 * r) + i];
+    }
+  }
+
+  memcpy (out, s, 16 * sizeof (uint8_t));
+}
+
+// Multiply x by h in GF(2^128), bit by bit, leaving the result in x (Algorithm 1 of NIST SP 800-38D).
+void
+ghash_mult (uint8_t *x, const uint8_t *h)
+{
+  int i, j, lsb;
+  uint8_t z[16], v[16];
+
+  memset (z, 0, 16 * sizeof (uint8_t));
+  memcpy (v, h, 16 * sizeof (uint8_t));
+
+  for (i=0; i<128; i++) {
+    if ((x[i / 8] >> (7 - (i % 8))) & 1) {
+      for (j=0; j<16; j++) {
+        z[j] ^= v[j];
+      }
+    }
+    lsb = v[15] & 1;
+    for (j=15; j>0; j--) {
+      v[j] = (v[j] >> 1) | (v[j-1] << 7);
+    }
+    v[0] >>= 1;
+    if (lsb) {
+      v[0] ^= 0xe1;
+    }
+  }
+
+  memcpy (x, z, 16 * sizeof (uint8_t));
+}
+
+// Absorb data into GHASH accumulator x, zero-padding the final partial block.
+void
+ghash_update (uint8_t *x, const uint8_t *h, const uint8_t *data, int len)
+{
+  int i, n;
+
+  while (len > 0) {
+    n = (len < 16) ? len : 16;
+    for (i=0; i<n; i++) {
+      x[i] ^= data[i];
+    }
+    ghash_mult (x, h);
+    data += n;
+    len -= n;
+  }
+}
+
+// AES-GCM authenticated encryption, without special instructions (Section 7.1 of NIST SP 800-38D).
+// The 12-byte nonce gives J0 = nonce || 1; encryption starts from counter 2.
+void
+gcm_seal (esp_sa *sa, const uint8_t *nonce, const uint8_t *aad, int aadlen, const uint8_t *in, uint8_t *out, int len, uint8_t *tag)
+{
+  int i, j, n;
+  uint32_t ctr;
+  uint8_t cb[16], ks[16], x[16], lens[16];
+
+  // Encrypt: CTR mode.
+  memcpy (cb, nonce, 12 * sizeof (uint8_t));
+  ctr = 2;
+  for (i=0; i<len; i+=16) {
+    cb[12] = ctr >> 24;
+    cb[13] = (ctr >> 16) & 0xff;
+    cb[14] = (ctr >> 8) & 0xff;
+    cb[15] = ctr & 0xff;
+    aes_encrypt_block (&sa->aes, cb, ks);
+    n = ((len - i) < 16) ? (len - i) : 16;
+    for (j=0; j<n; j++) {
+      out[i + j] = in[i + j] ^ ks[j];
+    }
+    ctr++;
+  }
+
+  // Authenticate: GHASH over AAD, ciphertext, and their bit lengths.
+  memset (x, 0, 16 * sizeof (uint8_t));
+  ghash_update (x, sa->h, aad, aadlen);
+  ghash_update (x, sa->h, out, len);
+  memset (lens, 0, 16 * sizeof (uint8_t));
+  for (i=0; i<8; i++) {
+    lens[7 - i] = ((uint64_t) aadlen * 8) >> (8 * i);
+    lens[15 - i] = ((uint64_t) len * 8) >> (8 * i);
+  }
+  ghash_update (x, sa->h, lens, 16);
+
+  // Tag = E(K, J0) XOR GHASH
+  memcpy (cb, nonce, 12 * sizeof (uint8_t));
+  cb[12] = 0;
+  cb[13] = 0;
+  cb[14] = 0;
+  cb[15] = 1;
+  aes_encrypt_block (&sa->aes, cb, ks);
+  for (i=0; i<16; i++) {
+    tag[i] = x[i] ^ ks[i];
+  }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+// Multiply a by b in GF(2^128) with carry-less multiplication. Operands and result are
+// byte-reflected GCM field elements (Algorithm 5 of Intel's "Carry-Less Multiplication
+// Instruction and its Usage for Computing the GCM Mode").
+__attribute__ ((target ("pclmul,sse2")))
+static inline __m128i
+gfmul_ni (__m128i a, __m128i b)
+{
+  __m128i t2, t3, t4, t5, t6, t7, t8, t9;
+
+  t3 = _mm_clmulepi64_si128 (a, b, 0x00);
+  t4 = _mm_clmulepi64_si128 (a, b, 0x10);
+  t5 = _mm_clmulepi64_si128 (a, b, 0x01);
+  t6 = _mm_clmulepi64_si128 (a, b, 0x11);
+
+  t4 = _mm_xor_si128 (t4, t5);
+  t5 = _mm_slli_si128 (t4, 8);
+  t4 = _mm_srli_si128 (t4, 8);
+  t3 = _mm_xor_si128 (t3, t5);
+  t6 = _mm_xor_si128 (t6, t4);
+
+  // Shift 256-bit product left by one bit, since operands are reflected.
+  t7 = _mm_srli_epi32 (t3, 31);
+  t8 = _mm_srli_epi32 (t6, 31);
+  t3 = _mm_slli_epi32 (t3, 1);
+  t6 = _mm_slli_epi32 (t6, 1);
+  t9 = _mm_srli_si128 (t7, 12);
+  t8 = _mm_slli_si128 (t8, 4);
+  t7 = _mm_slli_si128 (t7, 4);
+  t3 = _mm_or_si128 (t3, t7);
+  t6 = _mm_or_si128 (t6, t8);
+  t6 = _mm_or_si128 (t6, t9);
+
+  // Reduce modulo x^128 + x^7 + x^2 + x + 1.
+  t7 = _mm_slli_epi32 (t3, 31);
+  t8 = _mm_slli_epi32 (t3, 30);
+  t9 = _mm_slli_epi32 (t3, 25);
+  t7 = _mm_xor_si128 (t7, t8);
+  t7 = _mm_xor_si128 (t7, t9);
+  t8 = _mm_srli_si128 (t7, 4);
+  t7 = _mm_slli_si128 (t7, 12);
+  t3 = _mm_xor_si128 (t3, t7);
+
+  t2 = _mm_srli_epi32 (t3, 1);
+  t4 = _mm_srli_epi32 (t3, 2);
+  t5 = _mm_srli_epi32 (t3, 7);
+  t2 = _mm_xor_si128 (t2, t4);
+  t2 = _mm_xor_si128 (t2, t5);
+  t2 = _mm_xor_si128 (t2, t8);
+  t3 = _mm_xor_si128 (t3, t2);
+
+  return (_mm_xor_si128 (t6, t3));
+}
+
+// AES-GCM authenticated encryption with AES-NI and PCLMULQDQ.
+// Four counter blocks are kept in flight per round, to hide AESENC latency, and their
+// GHASH is aggregated as X = (X + C0)H^4 + C1H^3 + C2H^2 + C3H, so the multiplications overlap too.
+__attribute__ ((target ("aes,pclmul,sse4.1")))
+void
+gcm_seal_ni (esp_sa *sa, const uint8_t *nonce, const uint8_t *aad, int aadlen, const uint8_t *in, uint8_t *out, int len, uint8_t *tag)
+{
+  int i, r, n;
+  uint32_t ctr;
+  uint8_t last[16];
+  __m128i rk[15], bswap, h, h2, h3, h4, x, j0, b0, b1, b2, b3, c0, c1, c2, c3;
+
+  bswap = _mm_set_epi8 (0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+  for (r=0; r<=sa->aes.nr; r++) {
+    rk[r] = _mm_loadu_si128 ((const __m128i *) (sa->aes.rk + (16 * r)));
+  }
+  h = _mm_shuffle_epi8 (_mm_loadu_si128 ((const __m128i *) sa->hpow[0]), bswap);
+  h2 = _mm_shuffle_epi8 (_mm_loadu_si128 ((const __m128i *) sa->hpow[1]), bswap);
+  h3 = _mm_shuffle_epi8 (_mm_loadu_si128 ((const __m128i *) sa->hpow[2]), bswap);
+  h4 = _mm_shuffle_epi8 (_mm_loadu_si128 ((const __m128i *) sa->hpow[3]), bswap);
+
+  // J0 = nonce || 0x00000001
+  memcpy (last, nonce, 12 * sizeof (uint8_t));
+  last[12] = 0;
+  last[13] = 0;
+  last[14] = 0;
+  last[15] = 1;
+  j0 = _mm_loadu_si128 ((const __m128i *) last);
+
+  // GHASH over AAD.
+  x = _mm_setzero_si128 ();
+  for (i=0; i<aadlen; i+=16) {
+    n = ((aadlen - i) < 16) ? (aadlen - i) : 16;
+    memset (last, 0, 16 * sizeof (uint8_t));
+    memcpy (last, aad + i, n * sizeof (uint8_t));
+    x = gfmul_ni (_mm_xor_si128 (x, _mm_shuffle_epi8 (_mm_loadu_si128 ((const __m128i *) last), bswap)), h);
+  }
+
+  // Four blocks at a time.
+  ctr = 2;
+  for (i=0; (i + 64)<=len; i+=64) {
+    b0 = _mm_xor_si128 (_mm_insert_epi32 (j0, __builtin_bswap32 (ctr), 3), rk[0]);
+    b1 = _mm_xor_si128 (_mm_insert_epi32 (j0, __builtin_bswap32 (ctr + 1), 3), rk[0]);
+    b2 = _mm_xor_si128 (_mm_insert_epi32 (j0, __builtin_bswap32 (ctr + 2), 3), rk[0]);
+    b3 = _mm_xor_si128 (_mm_insert_epi32 (j0, __builtin_bswap32 (ctr + 3), 3), rk[0]);
+    ctr += 4;
+    for (r=1; r<sa->aes.nr; r++) {
+      b0 = _mm_aesenc_si128 (b0, rk[r]);
+      b1 = _mm_aesenc_si128 (b1, rk[r]);
+      b2 = _mm_aesenc_si128 (b2, rk[r]);
+      b3 = _mm_aesenc_si128 (b3, rk[r]);
+    }
+    b0 = _mm_aesenclast_si128 (b0, rk[r]);
+    b1 = _mm_aesenclast_si128 (b1, rk[r]);
+    b2 = _mm_aesenclast_si128 (b2, rk[r]);
+    b3 = _mm_aesenclast_si128 (b3, rk[r]);
+
+    c0 = _mm_xor_si128 (b0, _mm_loadu_si128 ((const __m128i *) (in + i)));
+    c1 = _mm_xor_si128 (b1, _mm_loadu_si128 ((const __m128i *) (in + i + 16)));
+    c2 = _mm_xor_si128 (b2, _mm_loadu_si128 ((const __m128i *) (in + i + 32)));
+    c3 = _mm_xor_si128 (b3, _mm_loadu_si128 ((const __m128i *) (in + i + 48)));
+    _mm_storeu_si128 ((__m128i *) (out + i), c0);
+    _mm_storeu_si128 ((__m128i *) (out + i + 16), c1);
+    _mm_storeu_si128 ((__m128i *) (out + i + 32), c2);
+    _mm_storeu_si128 ((__m128i *) (out + i + 48), c3);
+
+    x = _mm_xor_si128 (_mm_xor_si128 (gfmul_ni (_mm_xor_si128 (x, _mm_shuffle_epi8 (c0, bswap)), h4),
+                                      gfmul_ni (_mm_shuffle_epi8 (c1, bswap), h3)),
+                       _mm_xor_si128 (gfmul_ni (_mm_shuffle_epi8 (c2, bswap), h2),
+                                      gfmul_ni (_mm_shuffle_epi8 (c3, bswap), h)));
+  }
+
+  // Remaining blocks, the last of which may be partial.
+  for (; i<len; i+=16) {
+    b0 = _mm_xor_si128 (_mm_insert_epi32 (j0, __builtin_bswap32 (ctr), 3), rk[0]);
+    ctr++;
+    for (r=1; r<sa->aes.nr; r++) {
+      b0 = _mm_aesenc_si128 (b0, rk[r]);
+    }
+    b0 = _mm_aesenclast_si128 (b0, rk[r]);
+
+    n = ((len - i) < 16) ? (len - i) : 16;
+    memset (last, 0, 16 * sizeof (uint8_t));
+    memcpy (last, in + i, n * sizeof (uint8_t));
+    c0 = _mm_xor_si128 (b0, _mm_loadu_si128 ((const __m128i *) last));
+    _mm_storeu_si128 ((__m128i *) last, c0);
+    memset (last + n, 0, (16 - n) * sizeof (uint8_t));
+    memcpy (out + i, last, n * sizeof (uint8_t));
+    x = gfmul_ni (_mm_xor_si128 (x, _mm_shuffle_epi8 (_mm_loadu_si128 ((const __m128i *) last), bswap)), h);
+  }
+
+  // Bit lengths of AAD and ciphertext (already byte-reflected).
+  x = gfmul_ni (_mm_xor_si128 (x, _mm_set_epi64x ((uint64_t) aadlen * 8, (uint64_t) len * 8)), h);
+
+  // Tag = E(K, J0) XOR GHASH
+  b0 = _mm_xor_si128 (j0, rk[0]);
+  for (r=1; r<sa->aes.nr; r++) {
+    b0 = _mm_aesenc_si128 (b0, rk[r]);
+  }
+  b0 = _mm_aesenclast_si128 (b0, rk[r]);
+  _mm_storeu_si128 ((__m128i *) tag, _mm_xor_si128 (b0, _mm_shuffle_epi8 (x, bswap)));
+}
+
+#endif
+
+// Checksum function
+uint16_t
+checksum (uint16_t *addr, int len)
+{
+  int nleft = len;
+  int sum = 0;
+  uint16_t *w = addr;
+  uint16_t answer = 0;
+
+  while (nleft > 1) {
+    sum += *w++;
+    nleft -= sizeof (uint16_t);
+  }
+
+  if (nleft == 1) {
+    *(uint8_t *) (&answer) = *(uint8_t *) w;
+    sum += answer;
+  }
+
+  sum = (sum >> 16) + (sum & 0xFFFF);
+  sum += (sum >> 16);
+  answer = ~sum;
+  return (answer);
+}
+// Build IPv6 TCP pseudo-header and call checksum function (Section 8.1 of RFC 2460).
+uint16_t
+tcp6_checksum (struct ip6_hdr iphdr, struct tcphdr tcphdr, uint8_t *payload, int payloadlen)
+{
+  uint32_t lvalue;
+  char buf[IP_MAXPACKET], cvalue;
+  char *ptr;
+  int chksumlen = 0;
+  int i;
+
+  memset (buf, 0, IP_MAXPACKET * sizeof (uint8_t));
+
+  ptr = &buf[0];  // ptr points to beginning of buffer buf
+
+  // Copy source IP address into buf (128 bits)
+  memcpy (ptr, &iphdr.ip6_src.s6_addr, sizeof (iphdr.ip6_src.s6_addr));
+  ptr += sizeof (iphdr.ip6_src.s6_addr);
+  chksumlen += sizeof (iphdr.ip6_src.s6_addr);
+
+  // Copy destination IP address into buf (128 bits)
+  memcpy (ptr, &iphdr.ip6_dst.s6_addr, sizeof (iphdr.ip6_dst.s6_addr));
+  ptr += sizeof (iphdr.ip6_dst.s6_addr);
+  chksumlen += sizeof (iphdr.ip6_dst.s6_addr);
+
+  // Copy TCP length to buf (32 bits)
+  lvalue = htonl (sizeof (tcphdr) + payloadlen);
+  memcpy (ptr, &lvalue, sizeof (lvalue));
+  ptr += sizeof (lvalue);
+  chksumlen += sizeof (lvalue);
+
+  // Copy zero field to buf (24 bits)
+  *ptr = 0; ptr++;
+  *ptr = 0; ptr++;
+  *ptr = 0; ptr++;
+  chksumlen += 3;
+
+  // Copy next header field to buf (8 bits)
+  memcpy (ptr, &iphdr.ip6_nxt, sizeof (iphdr.ip6_nxt));
+  ptr += sizeof (iphdr.ip6_nxt);
+  chksumlen += sizeof (iphdr.ip6_nxt);
+
+  // Copy TCP source port to buf (16 bits)
+  memcpy (ptr, &tcphdr.th_sport, sizeof (tcphdr.th_sport));
+  ptr += sizeof (tcphdr.th_sport);
+  chksumlen += sizeof (tcphdr.th_sport);
+
+  // Copy TCP destination port to buf (16 bits)
+  memcpy (ptr, &tcphdr.th_dport, sizeof (tcphdr.th_dport));
+  ptr += sizeof (tcphdr.th_dport);
+  chksumlen += sizeof (tcphdr.th_dport);
+
+  // Copy sequence number to buf (32 bits)
+  memcpy (ptr, &tcphdr.th_seq, sizeof (tcphdr.th_seq));
+  ptr += sizeof (tcphdr.th_seq);
+  chksumlen += sizeof (tcphdr.th_seq);
+
+  // Copy acknowledgement number to buf (32 bits)
+  memcpy (ptr, &tcphdr.th_ack, sizeof (tcphdr.th_ack));
+  ptr += sizeof (tcphdr.th_ack);
+  chksumlen += sizeof (tcphdr.th_ack);
+
+  // Copy data offset to buf (4 bits) and
+  // copy reserved bits to buf (4 bits)
+  cvalue = (tcphdr.th_off << 4) + tcphdr.th_x2;
+  memcpy (ptr, &cvalue, sizeof (cvalue));
+  ptr += sizeof (cvalue);
+  chksumlen += sizeof (cvalue);
+
+  // Copy TCP flags to buf (8 bits)
+  memcpy (ptr, &tcphdr.th_flags, sizeof (tcphdr.th_flags));
+  ptr += sizeof (tcphdr.th_flags);
+  chksumlen += sizeof (tcphdr.th_flags);
+
+  // Copy TCP window size to buf (16 bits)
+  memcpy (ptr, &tcphdr.th_win, sizeof (tcphdr.th_win));
+  ptr += sizeof (tcphdr.th_win);
+  chksumlen += sizeof (tcphdr.th_win);
+
+  // Copy TCP checksum to buf (16 bits)
+  // Zero, since we don't know it yet
+  *ptr = 0; ptr++;
+  *ptr = 0; ptr++;
+  chksumlen += 2;
+
+  // Copy urgent pointer to buf (16 bits)
+  memcpy (ptr, &tcphdr.th_urp, sizeof (tcphdr.th_urp));
+  ptr += sizeof (tcphdr.th_urp);
+  chksumlen += sizeof (tcphdr.th_urp);
+
+  // Copy payload to buf
+  memcpy (ptr, payload, payloadlen * sizeof (uint8_t));
+  ptr += payloadlen;
+  chksumlen += payloadlen;
+
+  // Pad to the next 16-bit boundary
+  i = 0;
+  while (((payloadlen+i)%2) != 0) {
+    i++;
+    chksumlen++;
+    ptr++;
+  }
+
+  return checksum ((uint16_t *) buf, chksumlen);
+}
+// Allocate memory for an array of chars.
+char *
+allocate_strmem (int len)
+{
+  void *tmp;
+
+  if (len <= 0) {
+    fprintf (stderr, "ERROR: Cannot allocate memory because len = %i in allocate_strmem().\n", len);
+    exit (EXIT_FAILURE);
+  }
+
+  tmp = (char *) malloc (len * sizeof (char));
+  if (tmp != NULL) {
+    memset (tmp, 0, len * sizeof (char));
+    return (tmp);
+  } else {
+    fprintf (stderr, "ERROR: Cannot allocate memory for array allocate_strmem().\n");
+    exit (EXIT_FAILURE);
+  }
+}
+
+// Allocate memory for an array of unsigned chars.
+uint8_t *
+allocate_ustrmem (int len)
+{
+  void *tmp;
+
+  if (len <= 0) {
+    fprintf (stderr, "ERROR: Cannot allocate memory because len = %i in allocate_ustrmem().\n", len);
+    exit (EXIT_FAILURE);
+  }
+
+  tmp = (uint8_t *) malloc (len * sizeof (uint8_t));
+  if (tmp != NULL) {
+    memset (tmp, 0, len * sizeof (uint8_t));
+    return (tmp);
+  } else {
+    fprintf (stderr, "ERROR: Cannot allocate memory for array allocate_ustrmem().\n");
+    exit (EXIT_FAILURE);
+  }
+}
+
+// Allocate memory for an array of pointers to arrays of unsigned chars.
+uint8_t **
+allocate_ustrmemp (int len)
+{
+  void *tmp;
+
+  if (len <= 0) {
+    fprintf (stderr, "ERROR: Cannot allocate memory because len = %i in allocate_ustrmemp().\n", len);
+    exit (EXIT_FAILURE);
+  }
+
+  tmp = (uint8_t **) malloc (len * sizeof (uint8_t *));
+  if (tmp != NULL) {
+    memset (tmp, 0, len * sizeof (uint8_t *));
+    return (tmp);
+  } else {
+    fprintf (stderr, "ERROR: Cannot allocate memory for array allocate_ustrmemp().\n");
+    exit (EXIT_FAILURE);
+  }
+}
+
+// Allocate memory for an array of ints.
+int *
+allocate_intmem (int len)
+{
+  void *tmp;
+
+  if (len <= 0) {
+    fprintf (stderr, "ERROR: Cannot allocate memory because len = %i in allocate_intmem().\n", len);
+    exit (EXIT_FAILURE);
+  }
+
+  tmp = (int *) malloc (len * sizeof (int));
+  if (tmp != NULL) {
+    memset (tmp, 0, len * sizeof (int));
+    return (tmp);
+  } else {
+    fprintf (stderr, "ERROR: Cannot allocate memory for array allocate_intmem().\n");
+    exit (EXIT_FAILURE);
+  }
+}
@@ -41,6 +41,10 @@
 #include <linux/if_packet.h>  // struct sockaddr_ll (see man 7 packet)
 #include <net/ethernet.h>
 #include <sys/time.h>         // gettimeofday()
+#include <time.h>             // clock_gettime()
+#include <poll.h>             // poll()
+#include <ctype.h>            // tolower()
+#include <sys/random.h>       // getrandom()
 
 #include <errno.h>            // errno, perror()
 
@@ -50,6 +54,111 @@
 #define TCP_HDRLEN 20  // TCP header length, excludes options data
 #define UDP_HDRLEN  8  // UDP header length, excludes data
 #define ICMP_HDRLEN 8  // ICMP header length for echo request, excludes data
+#define DISSECT_ETH 0  // dissect() starts at an ethernet header
+#define DISSECT_ICMP6 1  // dissect() starts at an ICMPv6 header, as read from an ICMPv6 raw socket
+#define ND_OPT_TYPES 32  // Neighbor discovery option types whose first offset dissect() records
+#define MAX_EXTHDRS 16  // Most IPv6 extension headers dissect() will follow
+#define DNS_HDRLEN 12  // DNS header length
+#define DNS_QUERYLEN 128  // Longest PTR query we build (question and EDNS0 OPT record)
+#define DNS_MSGLEN 4096  // Longest DNS answer we take in over UDP
+#define DNS_NAMELEN 256  // Longest domain name in text form, with its terminating null
+#define EDNS_PAYLOAD 1232  // UDP payload size offered in EDNS0, to avoid fragmentation
+#define DNS_SERVERS 3  // Most nameservers taken from /etc/resolv.conf, as for the C library
+#define DNS_SLOTS 256  // Most reverse lookups outstanding at once
+#define DNS_TRIES 2  // Tries for each lookup, each to the next server in turn
+#define DNS_QUERY_MS 1000  // Time (ms) to wait for an answer to the first try; doubles for each retry
+#define DNS_WAIT_MS 2000  // Time (ms) to wait at the end of a trace for names still outstanding
+#define DNS_MAX_RRS 64  // Most answer records examined in one answer
+#define DNS_MAX_CNAMES 8  // Longest chain of aliases followed
+#define DNS_MAX_TTL 86400  // Longest time (s) an answer is cached
+#define DNS_FAIL_TTL 30  // Time (s) a lookup which failed (no answer, SERVFAIL) is cached
+#define DNS_BUCKETS 4096  // Buckets in cache of names (power of 2)
+#define DNS_NOERROR 0  // DNS rcodes
+#define DNS_NXDOMAIN 3
+#define DNS_IN 1  // DNS class Internet
+#define DNS_CNAME 5  // DNS record types
+#define DNS_SOA 6
+#define DNS_PTR 12
+#define DNS_OPT 41
+#define ENTRY_PENDING 0  // States of a cache entry: lookup outstanding, name known, no name
+#define ENTRY_POSITIVE 1
+#define ENTRY_NEGATIVE 2
+
+// Define a struct for the layout of a received frame, as found by dissect().
+// Offsets are from the start of the frame; -1 means the header is absent, or not
+// wholly within the frame. Nothing in it points into the frame.
+typedef struct _pkt_info pkt_info;
+struct _pkt_info {
+  int len;              // Length of frame
+  int end;              // End of IP packet: frames may carry padding after it
+  int nvlans;           // Number of VLAN tags (802.1Q, and 802.1ad outer tag for QinQ)
+  uint16_t vlan[2];     // VLAN IDs, outer tag first
+  uint16_t ethertype;   // Ethernet type after any VLAN tags
+  int l3;               // Offset of ARP, IPv4 or IPv6 header
+  int l3_len;           // Length of ARP header, IPv4 header with options, or IPv6 header with extension headers
+  int ip_opts;          // Offset of IPv4 options, or of first IPv6 extension header
+  int ip_opts_len;      // Length of IPv4 options, or of all IPv6 extension headers
+  int frag;             // 1 for a fragment other than the first, which has no transport header
+  uint8_t proto;        // Transport protocol (for IPv6, the next header after any extension headers)
+  int l4;               // Offset of TCP, UDP, ICMP or ICMPv6 header
+  int l4_len;           // Length of TCP header with options, or 8 for UDP, ICMP and ICMPv6
+  int payload;          // Offset of data after transport header (for ND, after the fixed part of the message)
+  int inner_l3;         // ICMP or ICMPv6 error: offset of IP header of the packet quoted
+  uint8_t inner_proto;  // ICMP or ICMPv6 error: transport protocol of the packet quoted
+  int inner_l4;         // ICMP or ICMPv6 error: offset of first 8 bytes of its transport header
+  int nd_opts;          // Neighbor discovery: offset of first option (-1 if any option is malformed)
+  int nd_opt[ND_OPT_TYPES];  // Neighbor discovery: offset of first option of each type (if nd_opts >= 0)
+};
+
+// Define a struct for the name of a hop's address, as cached.
+typedef struct _ptr_entry ptr_entry;
+struct _ptr_entry {
+  struct in_addr addr;   // Address of hop
+  int state;             // ENTRY_PENDING, ENTRY_POSITIVE or ENTRY_NEGATIVE
+  char *host;            // Name of hop (ENTRY_POSITIVE)
+  int64_t expires;       // Time (ms, CLOCK_MONOTONIC) answer goes stale
+  int report;            // 1 if a hop was printed without its name, which ptr_report() is to give
+  ptr_entry *next;       // Next entry in same hash bucket
+  ptr_entry *done_next;  // Next entry whose answer awaits ptr_report()
+};
+
+// Define a struct for an outstanding reverse lookup.
+typedef struct _dns_query dns_query;
+struct _dns_query {
+  ptr_entry *entry;  // Cache entry it is for (NULL if slot is free)
+  uint16_t id;       // DNS message ID
+  int tries;         // Tries so far
+  int64_t deadline;  // Time (ms, CLOCK_MONOTONIC) to try again or give up
+};
+
+// Define a struct for a resource record of an answer.
+typedef struct _dns_rr dns_rr;
+struct _dns_rr {
+  char owner[DNS_NAMELEN];  // Name it is for
+  uint16_t type;            // Record type
+  uint32_t ttl;             // Time to live (s)
+  int rdoff;                // Offset of its data in message
+  int rdlen;                // Length of its data
+};
+
+// Define a struct for the state of the resolver of hop names.
+typedef struct _resolver resolver;
+struct _resolver {
+  int sd[2];                  // UDP sockets for IPv4 and IPv6 nameservers (-1 if none)
+  struct sockaddr_storage server[DNS_SERVERS];  // Nameservers
+  socklen_t server_len[DNS_SERVERS];  // Length of each nameserver's address
+  int nservers;               // Number of nameservers
+  ptr_entry **table;          // Cache of names, by address
+  dns_query slot[DNS_SLOTS];  // Outstanding lookups
+  int free[DNS_SLOTS];        // Stack of free slots
+  int nfree;                  // Number of free slots
+  int *by_id;                 // Slot of each DNS message ID (-1 if not in use)
+  uint16_t ids[256];          // Random IDs yet to be used
+  int nids;                   // Number of random IDs yet to be used
+  ptr_entry *done;            // First and last entries whose answers await ptr_report()
+  ptr_entry *done_tail;
+  uint8_t *buf;               // Answer being read
+};
 
 // Function prototypes
 uint16_t checksum (uint16_t *, int);
@@ -59,6 +168,31 @@ uint16_t icmp4_checksum (struct icmp, uint8_t *, int);
 int create_tcp_frame (uint8_t *, char *, char *, uint8_t *, uint8_t *, int, uint8_t *, int);
 int create_udp_frame (uint8_t *, char *, char *, uint8_t *, uint8_t *, int, uint8_t *, int);
 int create_icmp_frame (uint8_t *, char *, char *, uint8_t *, uint8_t *, int, uint8_t *, int);
+int dissect (pkt_info *, uint8_t *, int, int);
+int dissect_ip (uint8_t *, int, int, int *, int *, uint8_t *, int *);
+int dissect_l4 (pkt_info *, uint8_t *, int);
+resolver *res_open (void);
+void res_close (resolver *);
+void read_resolv_conf (resolver *);
+int add_server (resolver *, char *);
+ptr_entry *ptr_lookup (resolver *, struct in_addr);
+void res_send (resolver *, int, int64_t);
+void res_recv (resolver *, int);
+void res_answer (resolver *, uint8_t *, int, struct sockaddr_storage *, int64_t);
+void res_finish (resolver *, int, char *, uint32_t, int64_t);
+int64_t res_expire (resolver *, int64_t);
+void ptr_wait (resolver *, int, struct timeval *, int);
+void ptr_report (resolver *);
+void ptr_pending (resolver *);
+ptr_entry *cache_find (resolver *, struct in_addr);
+ptr_entry *cache_add (resolver *, struct in_addr);
+uint16_t new_id (resolver *);
+int from_server (resolver *, struct sockaddr_storage *);
+void arpa_name (struct in_addr, char *);
+int encode_query (uint8_t *, uint16_t, struct in_addr);
+int read_name (uint8_t *, int, int, char *);
+int read_rr (uint8_t *, int, int, dns_rr *);
+int64_t now_ms (void);
 char *allocate_strmem (int);
 uint8_t *allocate_ustrmem (int);
 int *allocate_intmem (int);
@@ -67,9 +201,8 @@ int
 main (int argc, char **argv)
 {
   int i, status, frame_length, sd, sendsd, recsd, bytes, timeout, node, trylim, trycount;
-  int packet_type, done, datalen, resolve, maxhops, probes, num_probes;
+  int packet_type, done, datalen, resolve, maxhops, probes, num_probes, flags;
   char *interface, *target, *src_ip, *dst_ip, *rec_ip, *tcp_dat, *icmp_dat, *udp_dat;
-  char hostname[NI_MAXHOST];
   struct ip *iphdr;
   struct tcphdr *tcphdr;
   struct udphdr *udphdr;
@@ -78,17 +211,22 @@ main (int argc, char **argv)
   uint8_t *snd_ether_frame, *rec_ether_frame;
   uint8_t *data;
   struct addrinfo hints, *res;
-  struct sockaddr_in *dst, sa;
+  struct sockaddr_in *dst;
   struct sockaddr from;
   struct sockaddr_ll device;
   struct ifreq ifr;
   socklen_t fromlen;
-  struct timeval wait, t1, t2;
+  struct timeval wait, t1, t2, t3;
   struct timezone tz;
   double dt;
   void *tmp;
+  pkt_info pi;
+  resolver *dns;
+  ptr_entry *e;
 
   // Choose whether to resolve IPs to hostnames: default to not resolve hostnames
+  // Names are looked up without holding up the trace: a hop whose name is not yet
+  // known is printed without it, and its name is given once the answer arrives.
   resolve = 0;
 
   // Number of probes per node.
@@ -218,6 +356,12 @@ main (int argc, char **argv)
     exit (EXIT_FAILURE);
   }
 
+  // Open sockets to the nameservers for looking up the names of hops.
+  dns = NULL;
+  if (resolve != 0) {
+    dns = res_open ();
+  }
+
   // Set maximum number of tries for a host before incrementing TTL and moving on.
   trylim = 3;
 
@@ -225,16 +369,17 @@ main (int argc, char **argv)
   node = 1;
 
   // LOOP: incrementing TTL each time, exiting when we get our target IP address.
-  iphdr = (struct ip *) (rec_ether_frame + ETH_HDRLEN);
-  icmphdr = (struct icmp *) (rec_ether_frame + ETH_HDRLEN + IP4_HDRLEN);
-  tcphdr = (struct tcphdr *) (rec_ether_frame + ETH_HDRLEN + IP4_HDRLEN);
-  udphdr = (struct udphdr *) (rec_ether_frame + ETH_HDRLEN + IP4_HDRLEN);
   done = 0;
   trycount = 0;
   probes = 0;
 
   for (;;) {
 
+  // Give the names of hops whose lookups have been answered, between lines of hops.
+  if ((dns != NULL) && (probes == 0)) {
+    ptr_report (dns);
+  }
+
   // Create probe packet.
   memset (snd_ether_frame, 0, IP_MAXPACKET * sizeof (uint8_t));
   if (packet_type == 1) {
@@ -276,6 +421,13 @@ main (int argc, char **argv)
     wait.tv_usec = 0;
     setsockopt (recsd, SOL_SOCKET, SO_RCVTIMEO, (char *) &wait, sizeof (struct timeval));
 
+    // If looking up names of hops, wait in poll() instead, so answers are taken in
+    // while we wait, and read without blocking once a frame arrives (or time is up).
+    flags = 0;
+    if (dns != NULL) {
+      flags = MSG_DONTWAIT;
+    }
+
     // Listen for incoming ethernet frame from socket sd.
     // We expect an ICMP ethernet frame of the form:
     //     MAC (6 bytes) + MAC (6 bytes) + ethernet type (2 bytes)
@@ -288,7 +440,11 @@ main (int argc, char **argv)
       memset (rec_ether_frame, 0, IP_MAXPACKET * sizeof (uint8_t));
       memset (&from, 0, sizeof (from));
       fromlen = sizeof (from);
-      if ((bytes = recvfrom (recsd, rec_ether_frame, IP_MAXPACKET, 0, (struct sockaddr *) &from, &fromlen)) < 0) {
+      if (dns != NULL) {
+        (void) gettimeofday (&t3, &tz);  // As with SO_RCVTIMEO, the timeout counts from each read
+        ptr_wait (dns, recsd, &t3, timeout * 1000);
+      }
+      if ((bytes = recvfrom (recsd, rec_ether_frame, IP_MAXPACKET, flags, (struct sockaddr *) &from, &fromlen)) < 0) {
 
         status = errno;
 
@@ -305,8 +461,16 @@ main (int argc, char **argv)
         }
       }  // End of error handling conditionals.
 
-      // Check for an IP ethernet frame. If not, ignore and keep listening.
-      if (((rec_ether_frame[12] << 8) + rec_ether_frame[13]) == ETH_P_IP) {
+      // Find the IPv4 header and the transport header behind it, wherever VLAN tags
+      // and IPv4 options put them.
+      dissect (&pi, rec_ether_frame, bytes, DISSECT_ETH);
+
+      // Check for an IP ethernet frame with a whole transport header. If not, ignore and keep listening.
+      if ((pi.ethertype == ETH_P_IP) && (pi.l4 >= 0)) {
+        iphdr = (struct ip *) (rec_ether_frame + pi.l3);
+        icmphdr = (struct icmp *) (rec_ether_frame + pi.l4);
+        tcphdr = (struct tcphdr *) (rec_ether_frame + pi.l4);
+        udphdr = (struct udphdr *) (rec_ether_frame + pi.l4);
 
         // Did we get an ICMP_TIME_EXCEEDED?
         if ((iphdr->ip_p == IPPROTO_ICMP) && (icmphdr->icmp_type == ICMP_TIME_EXCEEDED)) {
@@ -323,20 +487,19 @@ main (int argc, char **argv)
             exit (EXIT_FAILURE);
           }
 
-          // Report source IP address and time for reply.
-          if (resolve == 0) {
-            printf ("%2i  %s  %g ms (%i bytes received)", node, rec_ip, dt, bytes);
+          // Report source IP address and time for reply, and its name if already known.
+          // If not, its name is looked up (once, however many times the hop replies),
+          // and given later by ptr_report().
+          e = NULL;
+          if (dns != NULL) {
+            e = ptr_lookup (dns, iphdr->ip_src);
+          }
+          if ((e != NULL) && (e->state == ENTRY_POSITIVE)) {
+            printf ("%2i  %s (%s)  %g ms (%i bytes received)", node, rec_ip, e->host, dt, bytes);
+          } else if ((e != NULL) && (e->state == ENTRY_NEGATIVE)) {
+            printf ("%2i  %s (%s)  %g ms (%i bytes received)", node, rec_ip, rec_ip, dt, bytes);
           } else {
-            sa.sin_family = AF_INET;
-            if ((status = inet_pton (AF_INET, rec_ip, &sa.sin_addr)) != 1) {
-              fprintf (stderr, "inet_pton() failed.\nError message: %s", strerror (status));
-              exit (EXIT_FAILURE);
-            }
-            if ((status = getnameinfo ((struct sockaddr*)&sa, sizeof (sa), hostname, sizeof (hostname), NULL, 0, 0)) != 0) {
-              fprintf (stderr, "getnameinfo() failed.\nError message: %s", strerror (status));
-              exit (EXIT_FAILURE);
-            }
-            printf ("%2i  %s (%s)  %g ms (%i bytes received)", node, rec_ip, hostname, dt, bytes);
+            printf ("%2i  %s  %g ms (%i bytes received)", node, rec_ip, dt, bytes);
           }
           if (probes < num_probes) {
             printf (" : ");
@@ -403,6 +566,16 @@ main (int argc, char **argv)
 
   }  // End of Send loop.
 
+  // Give the names of hops still outstanding, waiting a little for the last answers,
+  // and the bare addresses of those whose answers do not come in time.
+  if (dns != NULL) {
+    (void) gettimeofday (&t1, &tz);
+    ptr_wait (dns, -1, &t1, DNS_WAIT_MS);
+    ptr_report (dns);
+    ptr_pending (dns);
+    res_close (dns);
+  }
+
   // Close socket descriptors.
   close (sendsd);
   close (recsd);
@@ -1063,6 +1236,952 @@ udp4_checksum (struct ip iphdr, struct udphdr udphdr, uint8_t *payload, int payl
   return checksum ((uint16_t *) buf, chksumlen);
 }
 
+// Find the headers of a frame (start = DISSECT_ETH), or of an ICMPv6 message as read
+// from an ICMPv6 raw socket (start = DISSECT_ICMP6), in one pass, without copying.
+// Each header is checked to lie within the frame before it is read.
+// Returns 0 if all headers found were whole, or -1 if one was cut short or malformed,
+// in which case pi describes the headers in front of it.
+int
+dissect (pkt_info *pi, uint8_t *pkt, int len, int start)
+{
+  int off, type, ip_len;
+
+  pi->len = len;
+  pi->end = len;
+  pi->nvlans = 0;
+  pi->ethertype = 0;
+  pi->l3 = -1;
+  pi->l3_len = 0;
+  pi->ip_opts = -1;
+  pi->ip_opts_len = 0;
+  pi->frag = 0;
+  pi->proto = 0;
+  pi->l4 = -1;
+  pi->l4_len = 0;
+  pi->payload = -1;
+  pi->inner_l3 = -1;
+  pi->inner_proto = 0;
+  pi->inner_l4 = -1;
+  pi->nd_opts = -1;
+
+  if (start == DISSECT_ICMP6) {
+    pi->proto = IPPROTO_ICMPV6;
+    return (dissect_l4 (pi, pkt, 0));
+  }
+
+  // Ethernet header, and any VLAN tags in front of the ethernet type.
+  if (len < 14) {
+    return (-1);
+  }
+  off = 12;
+  type = (pkt[off] << 8) + pkt[off + 1];
+  while ((type == 0x8100) || (type == 0x88a8)) {
+    if ((off + 6) > len) {
+      return (-1);
+    }
+    if (pi->nvlans < 2) {
+      pi->vlan[pi->nvlans] = ((pkt[off + 2] << 8) + pkt[off + 3]) & 0x0fff;
+    }
+    pi->nvlans++;
+    off += 4;
+    type = (pkt[off] << 8) + pkt[off + 1];
+  }
+  off += 2;
+  pi->ethertype = type;
+
+  // ARP: fixed part, then sender and target hardware and protocol addresses.
+  if (type == 0x0806) {
+    if (((off + 8) > len) || ((off + 8 + (2 * (pkt[off + 4] + pkt[off + 5]))) > len)) {
+      return (-1);
+    }
+    pi->l3 = off;
+    pi->l3_len = 8 + (2 * (pkt[off + 4] + pkt[off + 5]));
+    return (0);
+  }
+
+  if ((type != 0x0800) && (type != 0x86dd)) {
+    return (0);
+  }
+  if (dissect_ip (pkt, off, len, &pi->l3_len, &ip_len, &pi->proto, &pi->frag) < 0) {
+    return (-1);
+  }
+  pi->l3 = off;
+  pi->ip_opts_len = pi->l3_len - (((pkt[off] >> 4) == 4) ? 20 : 40);
+  if (pi->ip_opts_len > 0) {
+    pi->ip_opts = off + pi->l3_len - pi->ip_opts_len;
+  }
+  if ((off + ip_len) < len) {
+    pi->end = off + ip_len;
+  }
+  if (pi->frag) {
+    return (0);
+  }
+
+  return (dissect_l4 (pi, pkt, off + pi->l3_len));
+}
+
+// Check the IPv4 or IPv6 header at offset off, and follow any IPv6 extension headers.
+// Gives the length of the header with options or extension headers, the length of the
+// packet according to the header, the transport protocol, and whether this is a fragment
+// other than the first. Returns -1 if the header is not wholly within len bytes.
+int
+dissect_ip (uint8_t *pkt, int off, int len, int *hlen, int *ip_len, uint8_t *proto, int *frag)
+{
+  int i, ext;
+  uint8_t nh;
+
+  *frag = 0;
+  if ((off + 1) > len) {
+    return (-1);
+  }
+
+  // IPv4: header length in 32-bit words, total length, fragment offset, protocol.
+  if ((pkt[off] >> 4) == 4) {
+    if ((off + 20) > len) {
+      return (-1);
+    }
+    *hlen = (pkt[off] & 0x0f) * 4;
+    *ip_len = (pkt[off + 2] << 8) + pkt[off + 3];
+    if ((*hlen < 20) || ((off + *hlen) > len) || (*ip_len < *hlen)) {
+      return (-1);
+    }
+    *proto = pkt[off + 9];
+    *frag = ((((pkt[off + 6] & 0x1f) << 8) + pkt[off + 7]) != 0);
+    return (0);
+  }
+
+  if ((pkt[off] >> 4) != 6) {
+    return (-1);
+  }
+
+  // IPv6: fixed header, then a chain of extension headers, each naming the next.
+  // Payload length 0 means a jumbogram, whose length is in a hop-by-hop option.
+  if ((off + 40) > len) {
+    return (-1);
+  }
+  *ip_len = 40 + (pkt[off + 4] << 8) + pkt[off + 5];
+  if (*ip_len == 40) {
+    *ip_len = len - off;
+  }
+  nh = pkt[off + 6];
+  *hlen = 40;
+  for (i=0; i<MAX_EXTHDRS; i++) {
+    if ((nh != 0) && (nh != 43) && (nh != 44) && (nh != 51) && (nh != 60) && (nh != 135) && (nh != 139) && (nh != 140)) {
+      break;  // Transport header, ESP, or no next header (59).
+    }
+    if ((off + *hlen + 8) > len) {
+      return (-1);
+    }
+    if (nh == 44) {  // Fragment header: fixed length.
+      ext = 8;
+    } else if (nh == 51) {  // Authentication header: length in 32-bit words, less 2.
+      ext = (pkt[off + *hlen + 1] + 2) * 4;
+    } else {  // Others: length in 8-byte units, not counting the first.
+      ext = (pkt[off + *hlen + 1] + 1) * 8;
+    }
+    if ((off + *hlen + ext) > len) {
+      return (-1);
+    }
+    if ((nh == 44) && ((((pkt[off + *hlen + 2] << 8) + pkt[off + *hlen + 3]) >> 3) != 0)) {
+      *frag = 1;
+    }
+    nh = pkt[off + *hlen];
+    *hlen += ext;
+    if (*frag) {
+      break;
+    }
+  }
+  if ((i == MAX_EXTHDRS) || (*ip_len < *hlen)) {
+    return (-1);
+  }
+  *proto = nh;
+
+  return (0);
+}
+
+// Check the transport header at offset off, then for an ICMP or ICMPv6 error, the
+// IP header and first 8 bytes of the packet quoted, and for a neighbor discovery
+// message, its options.
+int
+dissect_l4 (pkt_info *pi, uint8_t *pkt, int off)
+{
+  int i, n, type, hlen, ip_len, frag;
+
+  if (pi->proto == IPPROTO_TCP) {
+    if ((off + 20) > pi->end) {
+      return (-1);
+    }
+    pi->l4_len = (pkt[off + 12] >> 4) * 4;
+    if ((pi->l4_len < 20) || ((off + pi->l4_len) > pi->end)) {
+      pi->l4_len = 0;
+      return (-1);
+    }
+  } else if ((pi->proto == IPPROTO_UDP) || (pi->proto == IPPROTO_ICMP) || (pi->proto == IPPROTO_ICMPV6)) {
+    if ((off + 8) > pi->end) {
+      return (-1);
+    }
+    pi->l4_len = 8;
+  } else {
+    return (0);
+  }
+  pi->l4 = off;
+  pi->payload = off + pi->l4_len;
+
+  // ICMP errors (destination unreachable, source quench, redirect, time exceeded,
+  // parameter problem) and ICMPv6 errors (types 1 to 4) quote the packet which caused them.
+  type = pkt[off];
+  if (((pi->proto == IPPROTO_ICMP) && ((type == 3) || (type == 4) || (type == 5) || (type == 11) || (type == 12))) ||
+      ((pi->proto == IPPROTO_ICMPV6) && (type >= 1) && (type <= 4))) {
+    if (dissect_ip (pkt, off + 8, pi->end, &hlen, &ip_len, &pi->inner_proto, &frag) == 0) {
+      pi->inner_l3 = off + 8;
+      if ((frag == 0) && ((off + 8 + hlen + 8) <= pi->end)) {
+        pi->inner_l4 = off + 8 + hlen;
+      }
+    }
+    return (0);
+  }
+
+  // Neighbor discovery (router solicitation and advertisement, neighbor solicitation and
+  // advertisement, redirect): options follow the fixed part of the message. Each gives its
+  // length in units of 8 bytes, and must not be zero length nor run past the end.
+  if ((pi->proto != IPPROTO_ICMPV6) || (type < 133) || (type > 137)) {
+    return (0);
+  }
+  n = off + ((type == 133) ? 8 : (type == 134) ? 16 : (type == 137) ? 40 : 24);
+  if (n > pi->end) {
+    return (-1);
+  }
+  pi->payload = n;
+  for (i=0; i<ND_OPT_TYPES; i++) {
+    pi->nd_opt[i] = -1;
+  }
+  for (i=n; i<pi->end; i+=pkt[i + 1] * 8) {
+    if (((i + 2) > pi->end) || (pkt[i + 1] == 0) || ((i + (pkt[i + 1] * 8)) > pi->end)) {
+      return (-1);
+    }
+    if ((pkt[i] < ND_OPT_TYPES) && (pi->nd_opt[pkt[i]] < 0)) {
+      pi->nd_opt[pkt[i]] = i;
+    }
+  }
+  pi->nd_opts = n;
+
+  return (0);
+}
+
+// Open UDP sockets to the nameservers in /etc/resolv.conf, and make room for the cache
+// of reverse lookups and the queries outstanding.
+resolver *
+res_open (void)
+{
+  int i, f;
+  resolver *res;
+
+  res = (resolver *) calloc (1, sizeof (resolver));
+  if (res == NULL) {
+    fprintf (stderr, "ERROR: Cannot allocate memory for struct resolver.\n");
+    exit (EXIT_FAILURE);
+  }
+  res->table = (ptr_entry **) calloc (DNS_BUCKETS, sizeof (ptr_entry *));
+  res->by_id = (int *) calloc (65536, sizeof (int));
+  if ((res->table == NULL) || (res->by_id == NULL)) {
+    fprintf (stderr, "ERROR: Cannot allocate memory for resolver.\n");
+    exit (EXIT_FAILURE);
+  }
+  res->buf = allocate_ustrmem (DNS_MSGLEN);
+  for (i=0; i<DNS_SLOTS; i++) {
+    res->free[i] = DNS_SLOTS - 1 - i;
+  }
+  res->nfree = DNS_SLOTS;
+  for (i=0; i<65536; i++) {
+    res->by_id[i] = -1;
+  }
+
+  read_resolv_conf (res);
+
+  // One socket for each address family of server, with a port chosen at random by the kernel.
+  res->sd[0] = -1;
+  res->sd[1] = -1;
+  for (i=0; i<res->nservers; i++) {
+    f = (res->server[i].ss_family == AF_INET6);
+    if (res->sd[f] >= 0) {
+      continue;
+    }
+    if ((res->sd[f] = socket (res->server[i].ss_family, SOCK_DGRAM | SOCK_NONBLOCK, IPPROTO_UDP)) < 0) {
+      perror ("socket() failed to get socket descriptor for DNS ");
+      exit (EXIT_FAILURE);
+    }
+  }
+
+  return (res);
+}
+
+// Close the sockets, and free the cache and all else.
+void
+res_close (resolver *res)
+{
+  int i;
+  ptr_entry *e, *next;
+
+  for (i=0; i<2; i++) {
+    if (res->sd[i] >= 0) {
+      close (res->sd[i]);
+    }
+  }
+  for (i=0; i<DNS_BUCKETS; i++) {
+    for (e = res->table[i]; e != NULL; e = next) {
+      next = e->next;
+      free (e->host);
+      free (e);
+    }
+  }
+  free (res->table);
+  free (res->by_id);
+  free (res->buf);
+  free (res);
+}
+
+// Read the nameservers in /etc/resolv.conf. If there are none, as with the C library,
+// use the local host.
+void
+read_resolv_conf (resolver *res)
+{
+  char line[256], addr[256], *p;
+  FILE *fi;
+
+  if ((fi = fopen ("/etc/resolv.conf", "r")) != NULL) {
+    while ((res->nservers < DNS_SERVERS) && (fgets (line, sizeof (line), fi) != NULL)) {
+      if (sscanf (line, "nameserver %255s", addr) != 1) {
+        continue;
+      }
+
+      // Drop any scope of an IPv6 link-local address (fe80::1%eth0).
+      if ((p = strchr (addr, '%')) != NULL) {
+        *p = 0;
+      }
+      add_server (res, addr);
+    }
+    fclose (fi);
+  }
+  if (res->nservers == 0) {
+    add_server (res, "127.0.0.1");
+  }
+}
+
+// Add a nameserver by IPv4 or IPv6 address. Returns 0, or -1 if addr is neither.
+int
+add_server (resolver *res, char *addr)
+{
+  struct sockaddr_in *sin;
+  struct sockaddr_in6 *sin6;
+
+  memset (&res->server[res->nservers], 0, sizeof (struct sockaddr_storage));
+  sin = (struct sockaddr_in *) &res->server[res->nservers];
+  sin6 = (struct sockaddr_in6 *) &res->server[res->nservers];
+  if (inet_pton (AF_INET, addr, &sin->sin_addr) == 1) {
+    sin->sin_family = AF_INET;
+    sin->sin_port = htons (53);
+    res->server_len[res->nservers] = sizeof (struct sockaddr_in);
+  } else if (inet_pton (AF_INET6, addr, &sin6->sin6_addr) == 1) {
+    sin6->sin6_family = AF_INET6;
+    sin6->sin6_port = htons (53);
+    res->server_len[res->nservers] = sizeof (struct sockaddr_in6);
+  } else {
+    return (-1);
+  }
+  res->nservers++;
+
+  return (0);
+}
+
+// Look up the name of an address: from the cache if its answer there is fresh, else by
+// sending a query, unless one is already outstanding. Returns the cache entry, whose
+// state tells whether the name is known yet; or NULL if too many queries are outstanding.
+// If not yet known, the name is reported by ptr_report() once its answer arrives.
+ptr_entry *
+ptr_lookup (resolver *res, struct in_addr addr)
+{
+  int slot;
+  int64_t now;
+  ptr_entry *e;
+  dns_query *q;
+
+  now = now_ms ();
+  e = cache_find (res, addr);
+  if ((e != NULL) && (e->state == ENTRY_PENDING)) {
+    e->report = 1;
+    return (e);
+  }
+  if ((e != NULL) && (e->expires > now)) {
+    return (e);
+  }
+  if (res->nfree == 0) {
+    return (NULL);
+  }
+  if (e == NULL) {
+    e = cache_add (res, addr);
+  }
+  e->state = ENTRY_PENDING;
+  e->report = 1;
+
+  slot = res->free[--res->nfree];
+  q = &res->slot[slot];
+  q->entry = e;
+  q->tries = 0;
+  q->id = new_id (res);
+  res->by_id[q->id] = slot;
+  res_send (res, slot, now);
+
+  return (e);
+}
+
+// Send a query, to the next server in turn for each try, and set the time to wait for
+// its answer, which doubles with each try.
+void
+res_send (resolver *res, int slot, int64_t now)
+{
+  int s, len;
+  uint8_t query[DNS_QUERYLEN];
+  dns_query *q;
+
+  q = &res->slot[slot];
+  s = q->tries % res->nservers;
+  len = encode_query (query, q->id, q->entry->addr);
+  if ((sendto (res->sd[res->server[s].ss_family == AF_INET6], query, len, 0, (struct sockaddr *) &res->server[s], res->server_len[s]) < 0)
+      && (errno != EAGAIN) && (errno != ENOBUFS)) {
+    perror ("sendto() failed to send DNS query ");
+    exit (EXIT_FAILURE);
+  }
+  q->deadline = now + ((int64_t) DNS_QUERY_MS << q->tries);
+  q->tries++;
+}
+
+// Take in all answers waiting on a socket.
+void
+res_recv (resolver *res, int sd)
+{
+  int len;
+  struct sockaddr_storage from;
+  socklen_t fromlen;
+
+  for (;;) {
+    fromlen = sizeof (from);
+    if ((len = recvfrom (sd, res->buf, DNS_MSGLEN, 0, (struct sockaddr *) &from, &fromlen)) < 0) {
+      if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+        return;
+      }
+
+      // An earlier query drew an ICMP error (port unreachable, ...): it will time out.
+      if ((errno == EINTR) || (errno == ECONNREFUSED) || (errno == EHOSTUNREACH) || (errno == ENETUNREACH)) {
+        continue;
+      }
+      perror ("recvfrom() failed on DNS socket ");
+      exit (EXIT_FAILURE);
+    }
+    res_answer (res, res->buf, len, &from, now_ms ());
+  }
+}
+
+// Match an answer to its query, and read the name, following any aliases (as for
+// classless delegation, RFC 2317). Anything which is not a well-formed answer, from one
+// of our servers, to the question of an outstanding query, is ignored.
+void
+res_answer (resolver *res, uint8_t *msg, int len, struct sockaddr_storage *from, int64_t now)
+{
+  int i, n, off, hops, slot, flags, rcode, qdcount, ancount, nscount;
+  uint32_t ttl, negttl, minimum;
+  char name[DNS_NAMELEN], cur[DNS_NAMELEN];
+  dns_rr rr[DNS_MAX_RRS], ns;
+  dns_query *q;
+  ptr_entry *e;
+
+  if ((len < DNS_HDRLEN) || (from_server (res, from) < 0)) {
+    return;
+  }
+  slot = res->by_id[(msg[0] << 8) + msg[1]];
+  flags = (msg[2] << 8) + msg[3];
+  qdcount = (msg[4] << 8) + msg[5];
+  ancount = (msg[6] << 8) + msg[7];
+  nscount = (msg[8] << 8) + msg[9];
+  if ((slot < 0) || ((flags & 0x8000) == 0) || (qdcount != 1)) {
+    return;
+  }
+  q = &res->slot[slot];
+  e = q->entry;
+
+  // Question must be the one we asked.
+  arpa_name (e->addr, cur);
+  if (((off = read_name (msg, len, DNS_HDRLEN, name)) < 0) || (off + 4 > len)
+      || (strcmp (name, cur) != 0) || (((msg[off] << 8) + msg[off + 1]) != DNS_PTR)
+      || (((msg[off + 2] << 8) + msg[off + 3]) != DNS_IN)) {
+    return;
+  }
+  off += 4;
+
+  // Server could not answer: ask the next one, if tries remain.
+  rcode = flags & 0x000f;
+  if ((rcode != DNS_NOERROR) && (rcode != DNS_NXDOMAIN)) {
+    if (q->tries < DNS_TRIES) {
+      res_send (res, slot, now);
+      return;
+    }
+    res_finish (res, slot, NULL, DNS_FAIL_TTL, now);
+    return;
+  }
+
+  // Answer section.
+  n = 0;
+  for (i=0; i<ancount; i++) {
+    if ((off = read_rr (msg, len, off, (n < DNS_MAX_RRS) ? &rr[n] : &ns)) < 0) {
+      break;
+    }
+    if (n < DNS_MAX_RRS) {
+      n++;
+    }
+  }
+
+  // Follow aliases, then take the first name. The answer may be cached no longer
+  // than any record on the way.
+  ttl = DNS_MAX_TTL;
+  for (hops=0; hops<DNS_MAX_CNAMES; hops++) {
+    for (i=0; i<n; i++) {
+      if ((rr[i].type == DNS_CNAME) && (strcmp (rr[i].owner, cur) == 0)) {
+        break;
+      }
+    }
+    if ((i == n) || (read_name (msg, len, rr[i].rdoff, cur) < 0)) {
+      break;
+    }
+    if (rr[i].ttl < ttl) {
+      ttl = rr[i].ttl;
+    }
+  }
+  for (i=0; i<n; i++) {
+    if ((rr[i].type == DNS_PTR) && (strcmp (rr[i].owner, cur) == 0) && (read_name (msg, len, rr[i].rdoff, name) > 0)) {
+      res_finish (res, slot, name, (rr[i].ttl < ttl) ? rr[i].ttl : ttl, now);
+      return;
+    }
+  }
+
+  // No name: cached for the lesser of the TTL of the SOA record in the authority
+  // section, and its MINIMUM field (RFC 2308), or not at all without one.
+  negttl = 0;
+  for (i=0; (i<nscount) && (off >= 0); i++) {
+    if ((off = read_rr (msg, len, off, &ns)) < 0) {
+      break;
+    }
+    if (ns.type != DNS_SOA) {
+      continue;
+    }
+
+    // MINIMUM is the last of the five 32-bit fields after the two names of SOA data.
+    if (ns.rdlen < 22) {
+      break;
+    }
+    minimum = ((uint32_t) msg[ns.rdoff + ns.rdlen - 4] << 24) + (msg[ns.rdoff + ns.rdlen - 3] << 16)
+            + (msg[ns.rdoff + ns.rdlen - 2] << 8) + msg[ns.rdoff + ns.rdlen - 1];
+    negttl = (ns.ttl < minimum) ? ns.ttl : minimum;
+    break;
+  }
+  res_finish (res, slot, NULL, (negttl < ttl) ? negttl : ttl, now);
+}
+
+// Finish a query: cache its answer (host, or NULL if none) for ttl seconds, queue it
+// to be reported if a hop is waiting for it, and free its slot.
+void
+res_finish (resolver *res, int slot, char *host, uint32_t ttl, int64_t now)
+{
+  dns_query *q;
+  ptr_entry *e;
+
+  q = &res->slot[slot];
+  e = q->entry;
+  if (ttl > DNS_MAX_TTL) {
+    ttl = DNS_MAX_TTL;
+  }
+  free (e->host);
+  e->host = NULL;
+  if (host != NULL) {
+    if ((e->host = strdup (host)) == NULL) {
+      fprintf (stderr, "ERROR: Cannot allocate memory for host name.\n");
+      exit (EXIT_FAILURE);
+    }
+    e->state = ENTRY_POSITIVE;
+  } else {
+    e->state = ENTRY_NEGATIVE;
+  }
+  e->expires = now + (int64_t) ttl * 1000;
+
+  if (e->report != 0) {
+    e->report = 0;
+    e->done_next = NULL;
+    if (res->done_tail != NULL) {
+      res->done_tail->done_next = e;
+    } else {
+      res->done = e;
+    }
+    res->done_tail = e;
+  }
+
+  res->by_id[q->id] = -1;
+  q->entry = NULL;
+  res->free[res->nfree++] = slot;
+}
+
+// Send again each query whose time is up, or give up on it after DNS_TRIES.
+// Returns the earliest time still awaited.
+int64_t
+res_expire (resolver *res, int64_t now)
+{
+  int i;
+  int64_t earliest;
+  dns_query *q;
+
+  earliest = now + DNS_QUERY_MS;
+  for (i=0; i<DNS_SLOTS; i++) {
+    q = &res->slot[i];
+    if (q->entry == NULL) {
+      continue;
+    }
+    if (q->deadline <= now) {
+      if (q->tries < DNS_TRIES) {
+        res_send (res, i, now);
+      } else {
+        res_finish (res, i, NULL, DNS_FAIL_TTL, now);
+        continue;
+      }
+    }
+    if (q->deadline < earliest) {
+      earliest = q->deadline;
+    }
+  }
+
+  return (earliest);
+}
+
+// Wait until a frame can be read from recsd, or timeout ms have passed since t1,
+// taking in answers to reverse lookups meanwhile. If recsd is -1, wait instead until
+// no lookups are outstanding.
+void
+ptr_wait (resolver *res, int recsd, struct timeval *t1, int timeout)
+{
+  int i, wait;
+  int64_t now, earliest;
+  struct timeval t2;
+  struct timezone tz;
+  struct pollfd pfd[3];
+
+  pfd[0].fd = recsd;
+  pfd[1].fd = res->sd[0];
+  pfd[2].fd = res->sd[1];
+  for (i=0; i<3; i++) {
+    pfd[i].events = POLLIN;
+  }
+  for (;;) {
+
+    // Take in answers which arrived while we were busy, before any query is
+    // taken to have timed out.
+    for (i=0; i<2; i++) {
+      if (res->sd[i] >= 0) {
+        res_recv (res, res->sd[i]);
+      }
+    }
+    (void) gettimeofday (&t2, &tz);
+    wait = timeout - (int) ((t2.tv_sec - t1->tv_sec) * 1000 + (t2.tv_usec - t1->tv_usec) / 1000);
+    if ((wait <= 0) || ((recsd < 0) && (res->nfree == DNS_SLOTS))) {
+      return;
+    }
+    now = now_ms ();
+    earliest = res_expire (res, now);
+    if (earliest - now < wait) {
+      wait = (earliest > now) ? (int) (earliest - now) : 0;
+    }
+    if (poll (pfd, 3, wait) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      perror ("poll() failed ");
+      exit (EXIT_FAILURE);
+    }
+    if (pfd[0].revents & POLLIN) {
+      return;
+    }
+  }
+}
+
+// Report the names of hops whose answers have arrived since last time.
+void
+ptr_report (resolver *res)
+{
+  char ip[INET_ADDRSTRLEN];
+  ptr_entry *e;
+
+  for (e = res->done; e != NULL; e = e->done_next) {
+    inet_ntop (AF_INET, &e->addr, ip, INET_ADDRSTRLEN);
+    if (e->state == ENTRY_POSITIVE) {
+      printf ("    %s is %s\n", ip, e->host);
+    } else {
+      printf ("    %s has no name\n", ip);
+    }
+  }
+  res->done = NULL;
+  res->done_tail = NULL;
+}
+
+// Report the addresses of hops printed without their names, whose lookups are still outstanding.
+void
+ptr_pending (resolver *res)
+{
+  int i;
+  char ip[INET_ADDRSTRLEN];
+  ptr_entry *e;
+
+  for (i=0; i<DNS_SLOTS; i++) {
+    e = res->slot[i].entry;
+    if ((e != NULL) && (e->report != 0)) {
+      inet_ntop (AF_INET, &e->addr, ip, INET_ADDRSTRLEN);
+      printf ("    %s (no answer in time)\n", ip);
+      e->report = 0;
+    }
+  }
+}
+
+// Find an address in the cache. Returns NULL if not there.
+ptr_entry *
+cache_find (resolver *res, struct in_addr addr)
+{
+  ptr_entry *e;
+
+  for (e = res->table[(ntohl (addr.s_addr) * 2654435761U) & (DNS_BUCKETS - 1)]; e != NULL; e = e->next) {
+    if (e->addr.s_addr == addr.s_addr) {
+      return (e);
+    }
+  }
+
+  return (NULL);
+}
+
+// Add an address to the cache.
+ptr_entry *
+cache_add (resolver *res, struct in_addr addr)
+{
+  uint32_t b;
+  ptr_entry *e;
+
+  if ((e = (ptr_entry *) calloc (1, sizeof (ptr_entry))) == NULL) {
+    fprintf (stderr, "ERROR: Cannot allocate memory for cache entry.\n");
+    exit (EXIT_FAILURE);
+  }
+  e->addr = addr;
+  b = (ntohl (addr.s_addr) * 2654435761U) & (DNS_BUCKETS - 1);
+  e->next = res->table[b];
+  res->table[b] = e;
+
+  return (e);
+}
+
+// Choose a random DNS message ID not in use.
+uint16_t
+new_id (resolver *res)
+{
+  uint16_t id;
+
+  do {
+    if (res->nids == 0) {
+      if (getrandom (res->ids, sizeof (res->ids), 0) != sizeof (res->ids)) {
+        perror ("getrandom() failed ");
+        exit (EXIT_FAILURE);
+      }
+      res->nids = sizeof (res->ids) / sizeof (uint16_t);
+    }
+    id = res->ids[--res->nids];
+  } while (res->by_id[id] >= 0);
+
+  return (id);
+}
+
+// Find which of our servers a message came from. Returns its index, or -1 if none.
+int
+from_server (resolver *res, struct sockaddr_storage *from)
+{
+  int i;
+  struct sockaddr_in *a, *b;
+  struct sockaddr_in6 *a6, *b6;
+
+  for (i=0; i<res->nservers; i++) {
+    if (res->server[i].ss_family != from->ss_family) {
+      continue;
+    }
+    if (from->ss_family == AF_INET) {
+      a = (struct sockaddr_in *) from;
+      b = (struct sockaddr_in *) &res->server[i];
+      if ((a->sin_addr.s_addr == b->sin_addr.s_addr) && (a->sin_port == b->sin_port)) {
+        return (i);
+      }
+    } else {
+      a6 = (struct sockaddr_in6 *) from;
+      b6 = (struct sockaddr_in6 *) &res->server[i];
+      if ((memcmp (&a6->sin6_addr, &b6->sin6_addr, sizeof (struct in6_addr)) == 0) && (a6->sin6_port == b6->sin6_port)) {
+        return (i);
+      }
+    }
+  }
+
+  return (-1);
+}
+
+// Name to look up for the name of an IPv4 address: its bytes in reverse, under in-addr.arpa.
+void
+arpa_name (struct in_addr addr, char *out)
+{
+  uint8_t *b;
+
+  b = (uint8_t *) &addr.s_addr;
+  sprintf (out, "%u.%u.%u.%u.in-addr.arpa", b[3], b[2], b[1], b[0]);
+}
+
+// Build a PTR query for the name of an address, with recursion desired, and an EDNS0
+// OPT record offering to take answers of up to EDNS_PAYLOAD bytes over UDP.
+// Returns the length of the query.
+int
+encode_query (uint8_t *buf, uint16_t id, struct in_addr addr)
+{
+  int off, len;
+  char name[DNS_NAMELEN], *p, *dot;
+
+  // Header: ID, flags (RD), one question, no answers or authority, one additional record.
+  memset (buf, 0, DNS_HDRLEN);
+  buf[0] = id >> 8;
+  buf[1] = id & 0xff;
+  buf[2] = 0x01;
+  buf[5] = 1;
+  buf[11] = 1;
+  off = DNS_HDRLEN;
+
+  // Name, as labels each preceded by its length, ending with the root (length 0).
+  arpa_name (addr, name);
+  p = name;
+  while (*p != 0) {
+    dot = strchr (p, '.');
+    len = (dot != NULL) ? (int) (dot - p) : (int) strlen (p);
+    buf[off++] = len;
+    memcpy (buf + off, p, len);
+    off += len;
+    p += len;
+    if (*p == '.') {
+      p++;
+    }
+  }
+  buf[off++] = 0;
+
+  // Type and class.
+  buf[off++] = 0;
+  buf[off++] = DNS_PTR;
+  buf[off++] = 0;
+  buf[off++] = DNS_IN;
+
+  // OPT record: root name, type, UDP payload size (in place of class), TTL and data length 0.
+  buf[off++] = 0;
+  buf[off++] = 0;
+  buf[off++] = DNS_OPT;
+  buf[off++] = EDNS_PAYLOAD >> 8;
+  buf[off++] = EDNS_PAYLOAD & 0xff;
+  memset (buf + off, 0, 6);
+  off += 6;
+
+  return (off);
+}
+
+// Read the name at offset off of a message into text form, lowercase and without a
+// trailing dot, following compression pointers. Returns the offset just after the
+// name where it starts (not where pointers lead), or -1 if it is malformed.
+int
+read_name (uint8_t *msg, int len, int off, char *out)
+{
+  int i, n, end, jumps;
+
+  end = -1;
+  jumps = 0;
+  n = 0;
+  for (;;) {
+    if (off >= len) {
+      return (-1);
+    }
+
+    // Pointer (two top bits set): rest of name is elsewhere, earlier in message.
+    if ((msg[off] & 0xc0) == 0xc0) {
+      if ((off + 1 >= len) || (++jumps > 64)) {
+        return (-1);
+      }
+      if (end < 0) {
+        end = off + 2;
+      }
+      off = ((msg[off] & 0x3f) << 8) + msg[off + 1];
+      continue;
+    }
+    if (msg[off] & 0xc0) {
+      return (-1);
+    }
+
+    // End of name.
+    if (msg[off] == 0) {
+      if (end < 0) {
+        end = off + 1;
+      }
+      break;
+    }
+
+    // Label.
+    if ((off + 1 + msg[off] > len) || (n + msg[off] + 1 >= DNS_NAMELEN)) {
+      return (-1);
+    }
+    if (n > 0) {
+      out[n++] = '.';
+    }
+    for (i=0; i<msg[off]; i++) {
+      out[n++] = tolower (msg[off + 1 + i]);
+    }
+    off += 1 + msg[off];
+  }
+  out[n] = 0;
+
+  return (end);
+}
+
+// Read a resource record at offset off of a message. Returns the offset of the next,
+// or -1 if it is malformed.
+int
+read_rr (uint8_t *msg, int len, int off, dns_rr *rr)
+{
+  if (((off = read_name (msg, len, off, rr->owner)) < 0) || (off + 10 > len)) {
+    return (-1);
+  }
+  rr->type = (msg[off] << 8) + msg[off + 1];
+  rr->ttl = ((uint32_t) msg[off + 4] << 24) + (msg[off + 5] << 16) + (msg[off + 6] << 8) + msg[off + 7];
+  rr->rdlen = (msg[off + 8] << 8) + msg[off + 9];
+  rr->rdoff = off + 10;
+
+  // TTLs with the top bit set are taken as 0 (RFC 2181).
+  if (rr->ttl & 0x80000000U) {
+    rr->ttl = 0;
+  }
+  if (rr->rdoff + rr->rdlen > len) {
+    return (-1);
+  }
+
+  return (rr->rdoff + rr->rdlen);
+}
+
+// Time now (ms, CLOCK_MONOTONIC).
+int64_t
+now_ms (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+
+  return ((int64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
 // Allocate memory for an array of chars.
 char *
 allocate_strmem (int len)
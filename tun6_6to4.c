@@ -0,0 +1,567 @@
+/*  Copyright (C) 2013  P.D. Buchan (pdbuchan@yahoo.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// 6to4 tunnel endpoint (RFC 3056). IPv6 packets read from a TUN device are
+// wrapped in an IPv4 header with protocol 41 (the same layout as tcp6_6to4.c),
+// and sent to the IPv4 address embedded in a 2002::/16 destination, or else to
+// a 6to4 relay router. Inbound protocol 41 packets addressed to this node are
+// checked, unwrapped, and written back to the TUN device.
+// Packets are moved in batches: the TUN device is drained on each wakeup and
+// the batch goes out with one sendmmsg(); inbound packets arrive via recvmmsg().
+// Runs until stopped with Ctrl-C.
+
+#define _GNU_SOURCE           // sendmmsg(), recvmmsg() and struct mmsghdr
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>           // close(), read(), write()
+#include <string.h>           // strcpy, memset(), and memcpy()
+
+#include <sys/types.h>        // needed for socket(), uint8_t, uint16_t, uint32_t
+#include <sys/socket.h>       // needed for socket(), sendmmsg(), recvmmsg()
+#include <netinet/in.h>       // IPPROTO_IP, IPPROTO_IPV6, INET_ADDRSTRLEN, INET6_ADDRSTRLEN
+#include <netinet/ip.h>       // struct ip and IP_MAXPACKET (which is 65535)
+#include <netinet/ip6.h>      // struct ip6_hdr
+#include <arpa/inet.h>        // inet_pton() and inet_ntop()
+#include <sys/ioctl.h>        // macro ioctl is defined
+#include <bits/ioctls.h>      // defines values for argument "request" of ioctl.
+#include <net/if.h>           // struct ifreq
+#include <linux/if_tun.h>     // TUNSETIFF, IFF_TUN, IFF_NO_PI
+#include <fcntl.h>            // open(), fcntl(), O_RDWR, O_NONBLOCK
+#include <poll.h>             // poll()
+#include <signal.h>           // signal(), SIGINT
+#include <time.h>             // clock_gettime()
+
+#include <errno.h>            // errno, perror()
+
+// Taken from <linux/ipv6.h>, which conflicts with <netinet/in.h>
+struct in6_ifreq {
+  struct in6_addr ifr6_addr;
+  uint32_t ifr6_prefixlen;
+  int ifr6_ifindex;
+};
+
+// Define some constants.
+#define IP4_HDRLEN 20         // IPv4 header length
+#define IP6_HDRLEN 40         // IPv6 header length
+#define BATCH 64              // Maximum number of packets moved per system call
+#define SLOTLEN 65536         // Buffer space per packet
+
+// Define a struct for tunnel counters.
+typedef struct _tun_stats tun_stats;
+struct _tun_stats {
+  uint64_t encap;       // IPv6 packets encapsulated and sent
+  uint64_t decap;       // IPv6 packets decapsulated and written to TUN device
+  uint64_t noroute;     // Dropped: not 2002::/16 and no relay configured, or would loop back to us
+  uint64_t bad;         // Dropped: malformed or truncated
+  uint64_t spoof;       // Dropped: failed 6to4 address checks (Section 9 of RFC 3056)
+  uint64_t senderr;     // Dropped: sendmmsg() or write() failed
+};
+
+// Function prototypes
+void sig_handler (int);
+int tun_alloc (char *);
+int tun_configure (char *, int, struct in6_addr *);
+int encap_batch (int, int, uint8_t *, struct mmsghdr *, struct sockaddr_in *, struct in_addr, struct in_addr, tun_stats *);
+int decap_batch (int, int, uint8_t *, struct mmsghdr *, struct in_addr, tun_stats *);
+uint16_t checksum (uint16_t *, int);
+char *allocate_strmem (int);
+uint8_t *allocate_ustrmem (int);
+
+// Set by SIGINT handler to stop the tunnel.
+volatile sig_atomic_t stop = 0;
+
+int
+main (int argc, char **argv)
+{
+  int i, sd, tunfd, mtu, on, bufsize, status;
+  char *tun_name, *local_ip, *relay_ip, *prefix;
+  uint8_t *outbuf, *inbuf;
+  struct in_addr local, relay;
+  struct in6_addr addr6;
+  struct sockaddr_in sin;
+  struct sockaddr_in outaddr[BATCH];
+  struct mmsghdr outmsgs[BATCH], inmsgs[BATCH];
+  struct iovec outiovs[BATCH], iniovs[BATCH];
+  struct pollfd fds[2];
+  struct timespec t0, t1;
+  tun_stats stats;
+  uint64_t last_encap, last_decap;
+  double dt;
+
+  // Allocate memory for various arrays.
+  tun_name = allocate_strmem (IFNAMSIZ);
+  local_ip = allocate_strmem (INET_ADDRSTRLEN);
+  relay_ip = allocate_strmem (INET_ADDRSTRLEN);
+  prefix = allocate_strmem (INET6_ADDRSTRLEN);
+  outbuf = allocate_ustrmem (BATCH * SLOTLEN);
+  inbuf = allocate_ustrmem (BATCH * SLOTLEN);
+
+  // Name of TUN device to create.
+  strcpy (tun_name, "tun6to4");
+
+  // This node's public IPv4 address: you need to fill this out
+  strcpy (local_ip, "192.168.1.132");
+
+  // IPv4 address of 6to4 relay router for destinations outside 2002::/16,
+  // or empty string for none: you need to fill this out
+  strcpy (relay_ip, "192.88.99.1");
+
+  // Tunnel MTU: IPv4 path MTU less IPv4 header (Section 3.2 of RFC 4213).
+  mtu = 1500 - IP4_HDRLEN;
+
+  if (inet_pton (AF_INET, local_ip, &local) != 1) {
+    fprintf (stderr, "ERROR: Invalid local IPv4 address %s\n", local_ip);
+    exit (EXIT_FAILURE);
+  }
+  relay.s_addr = 0;
+  if ((relay_ip[0] != 0) && (inet_pton (AF_INET, relay_ip, &relay) != 1)) {
+    fprintf (stderr, "ERROR: Invalid relay IPv4 address %s\n", relay_ip);
+    exit (EXIT_FAILURE);
+  }
+
+  // This site's 6to4 prefix is 2002:V4ADDR::/48 (Section 2 of RFC 3056); the TUN device gets 2002:V4ADDR::1.
+  memset (&addr6, 0, sizeof (addr6));
+  addr6.s6_addr[0] = 0x20;
+  addr6.s6_addr[1] = 0x02;
+  memcpy (&addr6.s6_addr[2], &local, 4);
+  addr6.s6_addr[15] = 1;
+  if (inet_ntop (AF_INET6, &addr6, prefix, INET6_ADDRSTRLEN) == NULL) {
+    status = errno;
+    fprintf (stderr, "inet_ntop() failed.\nError message: %s", strerror (status));
+    exit (EXIT_FAILURE);
+  }
+
+  // Create and configure TUN device.
+  tunfd = tun_alloc (tun_name);
+  tun_configure (tun_name, mtu, &addr6);
+  printf ("TUN device %s is up with address %s/16, MTU %i\n", tun_name, prefix, mtu);
+  if (relay.s_addr != 0) {
+    printf ("Route other IPv6 destinations through the relay with, e.g.: ip -6 route add 2000::/3 dev %s\n", tun_name);
+  }
+
+  // Submit request for a raw socket descriptor for protocol 41 (IPv6 encapsulated in IPv4).
+  if ((sd = socket (AF_INET, SOCK_RAW, IPPROTO_IPV6)) < 0) {
+    perror ("socket() failed ");
+    exit (EXIT_FAILURE);
+  }
+
+  // We supply the IPv4 header ourselves.
+  on = 1;
+  if (setsockopt (sd, IPPROTO_IP, IP_HDRINCL, &on, sizeof (on)) < 0) {
+    perror ("setsockopt() failed to set IP_HDRINCL ");
+    exit (EXIT_FAILURE);
+  }
+
+  // Only accept packets addressed to our IPv4 address.
+  memset (&sin, 0, sizeof (sin));
+  sin.sin_family = AF_INET;
+  sin.sin_addr = local;
+  if (bind (sd, (struct sockaddr *) &sin, sizeof (sin)) < 0) {
+    perror ("bind() failed ");
+    exit (EXIT_FAILURE);
+  }
+
+  // Large socket buffers absorb bursts at high packet rates.
+  bufsize = 16 * 1024 * 1024;
+  if ((setsockopt (sd, SOL_SOCKET, SO_RCVBUF, &bufsize, sizeof (bufsize)) < 0) ||
+      (setsockopt (sd, SOL_SOCKET, SO_SNDBUF, &bufsize, sizeof (bufsize)) < 0)) {
+    perror ("setsockopt() failed to set socket buffer size ");
+    exit (EXIT_FAILURE);
+  }
+
+  // Prepare messages for sendmmsg() and recvmmsg().
+  // Outbound packets are read from the TUN device just past room for the IPv4 header, so need no copying.
+  memset (outmsgs, 0, sizeof (outmsgs));
+  memset (inmsgs, 0, sizeof (inmsgs));
+  for (i=0; i<BATCH; i++) {
+    outiovs[i].iov_base = outbuf + (i * SLOTLEN);
+    outmsgs[i].msg_hdr.msg_iov = &outiovs[i];
+    outmsgs[i].msg_hdr.msg_iovlen = 1;
+    outmsgs[i].msg_hdr.msg_name = &outaddr[i];
+    outmsgs[i].msg_hdr.msg_namelen = sizeof (struct sockaddr_in);
+
+    iniovs[i].iov_base = inbuf + (i * SLOTLEN);
+    iniovs[i].iov_len = SLOTLEN;
+    inmsgs[i].msg_hdr.msg_iov = &iniovs[i];
+    inmsgs[i].msg_hdr.msg_iovlen = 1;
+  }
+
+  signal (SIGINT, sig_handler);
+
+  memset (&stats, 0, sizeof (stats));
+  last_encap = 0;
+  last_decap = 0;
+  fds[0].fd = tunfd;
+  fds[0].events = POLLIN;
+  fds[1].fd = sd;
+  fds[1].events = POLLIN;
+  clock_gettime (CLOCK_MONOTONIC, &t0);
+  while (stop == 0) {
+
+    if ((status = poll (fds, 2, 1000)) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      perror ("poll() failed ");
+      exit (EXIT_FAILURE);
+    }
+
+    // Outbound: TUN device to IPv4 network.
+    if (fds[0].revents & POLLIN) {
+      while (encap_batch (tunfd, sd, outbuf, outmsgs, outaddr, local, relay, &stats) == BATCH);
+    }
+
+    // Inbound: IPv4 network to TUN device.
+    if (fds[1].revents & POLLIN) {
+      while (decap_batch (sd, tunfd, inbuf, inmsgs, local, &stats) == BATCH);
+    }
+
+    // Report rates once a second, if anything is happening.
+    clock_gettime (CLOCK_MONOTONIC, &t1);
+    dt = (double) (t1.tv_sec - t0.tv_sec) + (double) (t1.tv_nsec - t0.tv_nsec) / 1000000000.0;
+    if (dt >= 1.0) {
+      if ((stats.encap != last_encap) || (stats.decap != last_decap)) {
+        printf ("Encapsulated %.0f, decapsulated %.0f packets per second\n",
+          (double) (stats.encap - last_encap) / dt, (double) (stats.decap - last_decap) / dt);
+      }
+      last_encap = stats.encap;
+      last_decap = stats.decap;
+      t0 = t1;
+    }
+  }
+
+  // Report results.
+  printf ("\nEncapsulated: %llu, decapsulated: %llu\n", (unsigned long long) stats.encap, (unsigned long long) stats.decap);
+  printf ("Dropped: %llu no route, %llu malformed, %llu failed address checks, %llu send errors\n",
+    (unsigned long long) stats.noroute, (unsigned long long) stats.bad, (unsigned long long) stats.spoof, (unsigned long long) stats.senderr);
+
+  // Close descriptors; the TUN device disappears with its descriptor.
+  close (sd);
+  close (tunfd);
+
+  // Free allocated memory.
+  free (tun_name);
+  free (local_ip);
+  free (relay_ip);
+  free (prefix);
+  free (outbuf);
+  free (inbuf);
+
+  return (EXIT_SUCCESS);
+}
+
+// Signal handler: stop the tunnel.
+void
+sig_handler (int signum)
+{
+  (void) signum;
+  stop = 1;
+}
+
+// Create a TUN device carrying bare IPv6 packets (no packet information header).
+// Returns a non-blocking descriptor.
+int
+tun_alloc (char *name)
+{
+  int fd;
+  struct ifreq ifr;
+
+  if ((fd = open ("/dev/net/tun", O_RDWR)) < 0) {
+    perror ("open() failed to open /dev/net/tun ");
+    exit (EXIT_FAILURE);
+  }
+
+  memset (&ifr, 0, sizeof (ifr));
+  ifr.ifr_flags = IFF_TUN | IFF_NO_PI;
+  snprintf (ifr.ifr_name, sizeof (ifr.ifr_name), "%s", name);
+  if (ioctl (fd, TUNSETIFF, &ifr) < 0) {
+    perror ("ioctl() failed to create TUN device ");
+    exit (EXIT_FAILURE);
+  }
+  snprintf (name, IFNAMSIZ, "%s", ifr.ifr_name);
+
+  if (fcntl (fd, F_SETFL, fcntl (fd, F_GETFL) | O_NONBLOCK) < 0) {
+    perror ("fcntl() failed to set O_NONBLOCK ");
+    exit (EXIT_FAILURE);
+  }
+
+  return (fd);
+}
+
+// Set MTU and queue length of TUN device, bring it up, and give it an IPv6 address in 2002::/16.
+int
+tun_configure (char *name, int mtu, struct in6_addr *addr6)
+{
+  int sd, sd6;
+  struct ifreq ifr;
+  struct in6_ifreq ifr6;
+
+  if ((sd = socket (AF_INET, SOCK_DGRAM, 0)) < 0) {
+    perror ("socket() failed to get socket descriptor for using ioctl() ");
+    exit (EXIT_FAILURE);
+  }
+
+  memset (&ifr, 0, sizeof (ifr));
+  snprintf (ifr.ifr_name, sizeof (ifr.ifr_name), "%s", name);
+  ifr.ifr_mtu = mtu;
+  if (ioctl (sd, SIOCSIFMTU, &ifr) < 0) {
+    perror ("ioctl() failed to set MTU ");
+    exit (EXIT_FAILURE);
+  }
+
+  // A longer transmit queue than the default 500 lets the kernel hold a burst while we drain it.
+  ifr.ifr_qlen = 10000;
+  if (ioctl (sd, SIOCSIFTXQLEN, &ifr) < 0) {
+    perror ("ioctl() failed to set transmit queue length ");
+    exit (EXIT_FAILURE);
+  }
+
+  if (ioctl (sd, SIOCGIFFLAGS, &ifr) < 0) {
+    perror ("ioctl() failed to get interface flags ");
+    exit (EXIT_FAILURE);
+  }
+  ifr.ifr_flags |= IFF_UP | IFF_RUNNING;
+  if (ioctl (sd, SIOCSIFFLAGS, &ifr) < 0) {
+    perror ("ioctl() failed to bring interface up ");
+    exit (EXIT_FAILURE);
+  }
+
+  if (ioctl (sd, SIOCGIFINDEX, &ifr) < 0) {
+    perror ("ioctl() failed to get interface index ");
+    exit (EXIT_FAILURE);
+  }
+  close (sd);
+
+  // The /16 prefix length makes the kernel route all of 2002::/16 into the tunnel.
+  if ((sd6 = socket (AF_INET6, SOCK_DGRAM, 0)) < 0) {
+    perror ("socket() failed to get socket descriptor for using ioctl() ");
+    exit (EXIT_FAILURE);
+  }
+  memset (&ifr6, 0, sizeof (ifr6));
+  ifr6.ifr6_addr = *addr6;
+  ifr6.ifr6_prefixlen = 16;
+  ifr6.ifr6_ifindex = ifr.ifr_ifindex;
+  if ((ioctl (sd6, SIOCSIFADDR, &ifr6) < 0) && (errno != EEXIST)) {
+    perror ("ioctl() failed to set IPv6 address ");
+    exit (EXIT_FAILURE);
+  }
+  close (sd6);
+
+  return (EXIT_SUCCESS);
+}
+
+// Read up to BATCH IPv6 packets from the TUN device, encapsulate them, and send them with one sendmmsg().
+// Returns number of packets read, so the caller knows whether more may be waiting.
+int
+encap_batch (int tunfd, int sd, uint8_t *buf, struct mmsghdr *msgs, struct sockaddr_in *addrs, struct in_addr local, struct in_addr relay, tun_stats *stats)
+{
+  int i, n, nread, len, status;
+  uint8_t *slot;
+  struct ip *iphdr;
+  struct in_addr dst;
+
+  // Drain TUN device: it hands over one packet per read().
+  n = 0;
+  for (nread=0; nread<BATCH; nread++) {
+    slot = buf + (n * SLOTLEN);
+    if ((len = read (tunfd, slot + IP4_HDRLEN, SLOTLEN - IP4_HDRLEN)) < 0) {
+      if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+        break;
+      }
+      perror ("read() failed on TUN device ");
+      exit (EXIT_FAILURE);
+    }
+    if ((len < IP6_HDRLEN) || ((slot[IP4_HDRLEN] >> 4) != 6)) {
+      stats->bad++;
+      continue;
+    }
+
+    // Tunnel endpoint: IPv4 address embedded in 2002::/16 destination, otherwise the relay.
+    if ((slot[IP4_HDRLEN + 24] == 0x20) && (slot[IP4_HDRLEN + 25] == 0x02)) {
+      memcpy (&dst, slot + IP4_HDRLEN + 26, 4);
+    } else {
+      dst = relay;
+    }
+    if ((dst.s_addr == 0) || (dst.s_addr == local.s_addr)) {
+      stats->noroute++;
+      continue;
+    }
+
+    // IPv4 header (Section 3.5 of RFC 4213)
+    iphdr = (struct ip *) slot;
+    iphdr->ip_hl = IP4_HDRLEN / sizeof (uint32_t);
+    iphdr->ip_v = 4;
+    iphdr->ip_tos = 0;
+    iphdr->ip_len = htons (IP4_HDRLEN + len);
+    iphdr->ip_id = htons (0);
+    iphdr->ip_off = htons (0);  // Don't fragment flag not set (Section 3.2.1 of RFC 4213)
+    iphdr->ip_ttl = 64;
+    iphdr->ip_p = IPPROTO_IPV6;  // 41: IPv6 encapsulation
+    iphdr->ip_src = local;
+    iphdr->ip_dst = dst;
+    iphdr->ip_sum = 0;
+    iphdr->ip_sum = checksum ((uint16_t *) iphdr, IP4_HDRLEN);
+
+    msgs[n].msg_hdr.msg_iov->iov_len = IP4_HDRLEN + len;
+    memset (&addrs[n], 0, sizeof (struct sockaddr_in));
+    addrs[n].sin_family = AF_INET;
+    addrs[n].sin_addr = dst;
+    n++;
+  }
+
+  // Send batch; a packet the kernel refuses is counted and skipped.
+  i = 0;
+  while (i < n) {
+    if ((status = sendmmsg (sd, msgs + i, n - i, 0)) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      stats->senderr++;
+      i++;
+      continue;
+    }
+    stats->encap += status;
+    i += status;
+  }
+
+  return (nread);
+}
+
+// Receive up to BATCH protocol 41 packets, check them, and write the inner IPv6 packets to the TUN device.
+// Returns number of packets received, so the caller knows whether more may be waiting.
+int
+decap_batch (int sd, int tunfd, uint8_t *buf, struct mmsghdr *msgs, struct in_addr local, tun_stats *stats)
+{
+  int i, n, len, ihl, plen;
+  uint8_t *pkt, *ip6;
+
+  if ((n = recvmmsg (sd, msgs, BATCH, MSG_DONTWAIT, NULL)) < 0) {
+    if ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR)) {
+      return (0);
+    }
+    perror ("recvmmsg() failed ");
+    exit (EXIT_FAILURE);
+  }
+
+  for (i=0; i<n; i++) {
+    pkt = buf + (i * SLOTLEN);
+    len = msgs[i].msg_len;
+    if (msgs[i].msg_hdr.msg_flags & MSG_TRUNC) {
+      stats->bad++;
+      continue;
+    }
+
+    // Raw socket hands over the (reassembled) IPv4 header too.
+    ihl = (pkt[0] & 0x0f) * 4;
+    if ((len < (ihl + IP6_HDRLEN)) || (pkt[9] != IPPROTO_IPV6)) {
+      stats->bad++;
+      continue;
+    }
+    ip6 = pkt + ihl;
+    plen = (ip6[4] << 8) + ip6[5];
+    if (((ip6[0] >> 4) != 6) || ((IP6_HDRLEN + plen) > (len - ihl))) {
+      stats->bad++;
+      continue;
+    }
+
+    // A 6to4 source address must embed the IPv4 source it came from (Section 9 of RFC 3056);
+    // native sources can only arrive via a relay. Either way, the destination must be our own
+    // 2002:V4ADDR::/48 prefix, so we are not used to reach third parties.
+    if ((ip6[8] == 0x20) && (ip6[9] == 0x02) && (memcmp (ip6 + 10, pkt + 12, 4) != 0)) {
+      stats->spoof++;
+      continue;
+    }
+    if ((ip6[24] != 0x20) || (ip6[25] != 0x02) || (memcmp (ip6 + 26, &local, 4) != 0)) {
+      stats->spoof++;
+      continue;
+    }
+
+    if (write (tunfd, ip6, IP6_HDRLEN + plen) < 0) {
+      stats->senderr++;
+      continue;
+    }
+    stats->decap++;
+  }
+
+  return (n);
+}
+
+// Checksum function
+uint16_t
+checksum (uint16_t *addr, int len)
+{
+  int nleft = len;
+  int sum = 0;
+  uint16_t *w = addr;
+  uint16_t answer = 0;
+
+  while (nleft > 1) {
+    sum += *w++;
+    nleft -= sizeof (uint16_t);
+  }
+
+  if (nleft == 1) {
+    *(uint8_t *) (&answer) = *(uint8_t *) w;
+    sum += answer;
+  }
+
+  sum = (sum >> 16) + (sum & 0xFFFF);
+  sum += (sum >> 16);
+  answer = ~sum;
+  return (answer);
+}
+
+// Allocate memory for an array of chars.
+char *
+allocate_strmem (int len)
+{
+  void *tmp;
+
+  if (len <= 0) {
+    fprintf (stderr, "ERROR: Cannot allocate memory because len = %i in allocate_strmem().\n", len);
+    exit (EXIT_FAILURE);
+  }
+
+  tmp = (char *) malloc (len * sizeof (char));
+  if (tmp != NULL) {
+    memset (tmp, 0, len * sizeof (char));
+    return (tmp);
+  } else {
+    fprintf (stderr, "ERROR: Cannot allocate memory for array allocate_strmem().\n");
+    exit (EXIT_FAILURE);
+  }
+}
+
+// Allocate memory for an array of unsigned chars.
+uint8_t *
+allocate_ustrmem (int len)
+{
+  void *tmp;
+
+  if (len <= 0) {
+    fprintf (stderr, "ERROR: Cannot allocate memory because len = %i in allocate_ustrmem().\n", len);
+    exit (EXIT_FAILURE);
+  }
+
+  tmp = (uint8_t *) malloc (len * sizeof (uint8_t));
+  if (tmp != NULL) {
+    memset (tmp, 0, len * sizeof (uint8_t));
+    return (tmp);
+  } else {
+    fprintf (stderr, "ERROR: Cannot allocate memory for array allocate_ustrmem().\n");
+    exit (EXIT_FAILURE);
+  }
+}
@@ -0,0 +1,1210 @@
+/*  Copyright (C) 2013  P.D. Buchan (pdbuchan@yahoo.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Stream a payload source as a sequence of IPv4 UDP packets via raw socket
+// at the link layer (ethernet frame).
+// The payload source is either a file of any size, which is memory-mapped
+// and sliced into datagram-sized pieces without copying, or a generated pattern.
+// The stream can loop over the source, and be paced: at a constant packet rate (sleeping
+// between bursts of a chosen size), by a token bucket (average bit rate, with bursts up to the
+// bucket size), or by stamping each frame with its launch time (SO_TXTIME) for the ETF qdisc.
+// The UDP checksum can be computed here, or left to the kernel or NIC (checksum offload):
+// with socket option PACKET_VNET_HDR, each frame is preceded by a struct virtio_net_hdr
+// saying where the checksum starts and where to store it, and the payload need never be read.
+// Offloaded checksums can be verified by receiving the frames on the other end of a veth pair.
+// Need to have destination MAC address.
+
+#define _GNU_SOURCE           // sendmmsg() and struct mmsghdr
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>           // close()
+#include <string.h>           // strcpy, memset(), and memcpy()
+
+#include <netdb.h>            // struct addrinfo
+#include <sys/types.h>        // needed for socket(), uint8_t, uint16_t, uint32_t
+#include <sys/socket.h>       // needed for socket(), sendmmsg()
+#include <netinet/in.h>       // IPPROTO_UDP, INET_ADDRSTRLEN
+#include <netinet/ip.h>       // struct ip and IP_MAXPACKET (which is 65535)
+#include <netinet/udp.h>      // struct udphdr
+#include <arpa/inet.h>        // inet_pton() and inet_ntop()
+#include <sys/ioctl.h>        // macro ioctl is defined
+#include <bits/ioctls.h>      // defines values for argument "request" of ioctl.
+#include <net/if.h>           // struct ifreq
+#include <linux/if_ether.h>   // ETH_P_IP = 0x0800, ETH_P_IPV6 = 0x86DD
+#include <linux/if_packet.h>  // struct sockaddr_ll (see man 7 packet)
+#include <net/ethernet.h>
+#include <sys/mman.h>         // mmap(), madvise(), munmap()
+#include <sys/stat.h>         // fstat()
+#include <fcntl.h>            // open()
+#include <time.h>             // clock_gettime(), clock_nanosleep()
+#include <signal.h>           // signal(), SIGINT
+#include <linux/virtio_net.h> // struct virtio_net_hdr
+#include <sched.h>            // setns()
+#include <linux/net_tstamp.h> // struct sock_txtime, SOF_TXTIME_REPORT_ERRORS
+#include <linux/errqueue.h>   // struct sock_extended_err, SO_EE_ORIGIN_TXTIME
+
+#include <errno.h>            // errno, perror()
+
+// Define some constants.
+#define ETH_HDRLEN 14         // Ethernet header length
+#define IP4_HDRLEN 20         // IPv4 header length
+#define UDP_HDRLEN  8         // UDP header length, excludes data
+#define HDRS_LEN (ETH_HDRLEN + IP4_HDRLEN + UDP_HDRLEN)  // Length of all headers in front of the payload
+#define VNET_HDRLEN (sizeof (struct virtio_net_hdr))   // Length of header in front of each frame with PACKET_VNET_HDR
+#define HDRS_STRIDE (VNET_HDRLEN + HDRS_LEN)  // Room for each message's headers
+#define BATCH 64              // Maximum number of frames handed to sendmmsg() at once
+#define PATTERN_LEN 65536     // Period of a generated payload pattern (bytes); multiple of 256
+#define POPULATE_MAX (256 * 1024 * 1024)  // Files up to this size are pre-faulted with MAP_POPULATE
+#define READAHEAD (8 * 1024 * 1024)  // Larger files are read ahead in windows of this size
+
+// Payload source types
+#define PAYLOAD_FILE 0        // Memory-mapped file
+#define PATTERN_ZERO 1        // All zero bytes
+#define PATTERN_INCR 2        // Incrementing bytes: 0x00, 0x01, ... 0xff, 0x00, ...
+#define PATTERN_RANDOM 3      // Pseudo-random bytes
+#define PATTERN_NUMBERS 4     // ASCII list of numbers "0 1 2 3 ...", like the file "data"
+
+// UDP checksum modes
+#define CSUM_NONE 0           // Checksum field set to zero, allowed for IPv4 UDP
+#define CSUM_SOFTWARE 1       // Computed here, over each payload
+#define CSUM_OFFLOAD 2        // Left to kernel or NIC (PACKET_VNET_HDR with VIRTIO_NET_HDR_F_NEEDS_CSUM)
+#define CSUM_AUTO 3           // Offload if the kernel accepts it, otherwise software
+
+// Pacing modes
+#define PACE_CBR 0            // Constant packet rate, sleeping between bursts
+#define PACE_TOKEN_BUCKET 1   // Average bit rate, with bursts up to the bucket size
+#define PACE_TXTIME 2         // Constant packet rate, each frame stamped with its launch time (SO_TXTIME)
+#define TXTIME_LEAD 2000000L  // Frames are handed to the qdisc this long (ns) before their launch time
+
+// Define a struct for a payload source.
+// Each call to payload_next() returns a pointer into the mapped file or
+// pattern buffer, so payload bytes are never copied by this program.
+typedef struct _payload_src payload_src;
+struct _payload_src {
+  int type;             // PAYLOAD_FILE or one of the PATTERN_ types
+  uint8_t *base;        // Start of mapped file or pattern buffer
+  size_t size;          // Size of file, or period of pattern
+  size_t pos;           // Offset of next slice
+  size_t advised;       // Offset up to which the kernel has been asked to read ahead
+  int chunk;            // Maximum number of payload bytes per datagram
+  int loop;             // At end of file: 0 = stop, 1 = start again from the beginning
+  long int max_passes;  // Maximum number of passes through the file when looping (0 = no limit)
+  long int passes;      // Number of complete passes through the file
+};
+
+// Define a struct for a token bucket. Tokens are bytes of frames; sending takes tokens,
+// which are added back at the configured rate, up to the bucket depth.
+typedef struct _token_bucket token_bucket;
+struct _token_bucket {
+  double rate;          // Tokens added per nanosecond
+  double depth;         // Most tokens held: the largest burst (bytes)
+  double tokens;        // Tokens held now
+  struct timespec last; // Time tokens were last added
+};
+
+// Define a struct for the results of checking checksums of frames received on the veth peer.
+typedef struct _csum_check csum_check;
+struct _csum_check {
+  long int frames;      // Frames of our stream received
+  long int complete;    // Checksum complete and correct
+  long int partial;     // Checksum still left to offload (TP_STATUS_CSUMNOTREADY), with correct pseudo-header sum
+  long int bad;         // Anything else
+};
+
+// Function prototypes
+int payload_open_file (payload_src *, char *, int, int, long int);
+int payload_open_pattern (payload_src *, int, int);
+int payload_next (payload_src *, uint8_t **);
+void payload_close (payload_src *);
+uint16_t udp_csum_field (uint8_t *, int, int, uint32_t, uint32_t);
+int tb_take (token_bucket *, struct iovec (*)[2], int, int);
+int txtime_errors (int);
+int verify_open (char *, char *);
+void verify_frames (int, uint8_t *, csum_check *);
+uint32_t sum_bytes (uint32_t, uint8_t *, int);
+uint16_t fold_sum (uint32_t);
+void pace (struct timespec *, long int);
+void sig_handler (int);
+char *allocate_strmem (int);
+uint8_t *allocate_ustrmem (int);
+int *allocate_intmem (int);
+
+// Set by SIGINT handler to stop the stream.
+volatile sig_atomic_t stop = 0;
+
+int
+main (int argc, char **argv)
+{
+  int i, k, n, status, sd, vd, mtu, chunk, source, loop, udp_csum, offload, verify, pacing, burst, done, *ip_flags;
+  long int rate, bitrate, bucket, max_packets, max_passes, packets, interval, late;
+  uint64_t txtime, txstart;
+  unsigned long long int bytes;
+  char *interface, *target, *src_ip, *dst_ip, *filename, *verify_interface, *verify_netns;
+  struct ip iphdr;
+  struct udphdr udphdr;
+  uint8_t *src_mac, *dst_mac, *template, *hdrs, *h, *payload;
+  uint16_t ip_id, len16;
+  uint32_t ip_sum0, udp_sum0, pseudo0, sum;
+  struct addrinfo hints, *res;
+  struct sockaddr_in *ipv4;
+  struct sockaddr_ll device;
+  struct ifreq ifr;
+  struct mmsghdr msgs[BATCH];
+  struct iovec iovs[BATCH][2];
+  struct timespec t1, t2, next;
+  struct sock_txtime txconf;
+  struct cmsghdr *cmsg;
+  token_bucket tb;
+  clockid_t txclock;
+  static uint8_t txcontrol[BATCH][CMSG_SPACE (sizeof (uint64_t))];
+  struct virtio_net_hdr vnet;
+  payload_src src;
+  csum_check check;
+  double dt;
+  void *tmp;
+
+  // Allocate memory for various arrays.
+  src_mac = allocate_ustrmem (6);
+  dst_mac = allocate_ustrmem (6);
+  template = allocate_ustrmem (HDRS_LEN);
+  hdrs = allocate_ustrmem (BATCH * HDRS_STRIDE);
+  interface = allocate_strmem (40);
+  target = allocate_strmem (40);
+  src_ip = allocate_strmem (INET_ADDRSTRLEN);
+  dst_ip = allocate_strmem (INET_ADDRSTRLEN);
+  filename = allocate_strmem (256);
+  verify_interface = allocate_strmem (40);
+  verify_netns = allocate_strmem (256);
+  ip_flags = allocate_intmem (4);
+
+  // Interface to send packets through.
+  strcpy (interface, "eth0");
+
+  // Payload source: PAYLOAD_FILE, or one of PATTERN_ZERO, PATTERN_INCR, PATTERN_RANDOM, PATTERN_NUMBERS.
+  source = PAYLOAD_FILE;
+
+  // File to stream if source is PAYLOAD_FILE. It may be many gigabytes in size.
+  strcpy (filename, "data");
+
+  // Loop back to the beginning of the file when the end is reached: 0 = no, 1 = yes
+  loop = 1;
+
+  // Maximum number of passes through the file when looping (0 = no limit).
+  max_passes = 10;
+
+  // Maximum number of packets to send (0 = no limit).
+  // A generated pattern never ends, so set a limit or stop the stream with Ctrl-C.
+  max_packets = 0;
+
+  // Pacing: PACE_CBR, PACE_TOKEN_BUCKET or PACE_TXTIME (see constants above).
+  pacing = PACE_CBR;
+
+  // For PACE_CBR and PACE_TXTIME: packet rate in packets per second (0 = as fast as possible).
+  rate = 0;
+
+  // For PACE_CBR: packets sent together at each wakeup (0 = all of a batch, or one at rates
+  // below 10000 packets per second). Larger bursts mean fewer wakeups, but less even spacing.
+  burst = 0;
+
+  // For PACE_TOKEN_BUCKET: average rate in bits per second of ethernet frames, and bucket
+  // depth in bytes: the most that may be sent at once after an idle spell. At least one frame.
+  bitrate = 100000000L;
+  bucket = 64L * 1514L;
+
+  // For PACE_TXTIME: clock for launch times. ETF qdisc uses CLOCK_TAI
+  // (e.g., tc qdisc replace dev eth0 root etf clockid CLOCK_TAI delta 200000);
+  // fq qdisc reads launch times as CLOCK_MONOTONIC. Without either, frames still
+  // leave about on time in batches, as we sleep until shortly before each batch is due.
+  txclock = CLOCK_TAI;
+
+  // UDP checksum: CSUM_NONE, CSUM_SOFTWARE, CSUM_OFFLOAD or CSUM_AUTO (see constants above).
+  udp_csum = CSUM_AUTO;
+
+  // Verify checksums by receiving our frames on the other end of a veth pair: 0 = no, 1 = yes.
+  // Give the name of the peer interface, and the network namespace it is in (empty if ours).
+  // With tx checksumming enabled on the sending interface (the default for veth), offloaded frames
+  // reach the peer still marked as needing a checksum, and only the pseudo-header sum can be checked;
+  // disable it (ethtool -K <interface> tx off) to have the kernel complete checksums before sending.
+  verify = 0;
+  strcpy (verify_interface, "veth1");
+  strcpy (verify_netns, "");
+
+  // Submit request for a socket descriptor to look up interface.
+  if ((sd = socket (PF_PACKET, SOCK_RAW, htons (ETH_P_ALL))) < 0) {
+    perror ("socket() failed to get socket descriptor for using ioctl() ");
+    exit (EXIT_FAILURE);
+  }
+
+  // Use ioctl() to get interface maximum transmission unit (MTU).
+  memset (&ifr, 0, sizeof (ifr));
+  strcpy (ifr.ifr_name, interface);
+  if (ioctl (sd, SIOCGIFMTU, &ifr) < 0) {
+    perror ("ioctl() failed to get MTU ");
+    return (EXIT_FAILURE);
+  }
+  mtu = ifr.ifr_mtu;
+  printf ("Current MTU of interface %s is: %i\n", interface, mtu);
+
+  // Use ioctl() to look up interface name and get its MAC address.
+  memset (&ifr, 0, sizeof (ifr));
+  snprintf (ifr.ifr_name, sizeof (ifr.ifr_name), "%s", interface);
+  if (ioctl (sd, SIOCGIFHWADDR, &ifr) < 0) {
+    perror ("ioctl() failed to get source MAC address ");
+    return (EXIT_FAILURE);
+  }
+  close (sd);
+
+  // Copy source MAC address.
+  memcpy (src_mac, ifr.ifr_hwaddr.sa_data, 6 * sizeof (uint8_t));
+
+  // Report source MAC address to stdout.
+  printf ("MAC address for interface %s is ", interface);
+  for (i=0; i<5; i++) {
+    printf ("%02x:", src_mac[i]);
+  }
+  printf ("%02x\n", src_mac[5]);
+
+  // Find interface index from interface name and store index in
+  // struct sockaddr_ll device, which will be used as an argument of sendmmsg().
+  memset (&device, 0, sizeof (device));
+  if ((device.sll_ifindex = if_nametoindex (interface)) == 0) {
+    perror ("if_nametoindex() failed to obtain interface index ");
+    exit (EXIT_FAILURE);
+  }
+  printf ("Index for interface %s is %i\n", interface, device.sll_ifindex);
+
+  // Set destination MAC address: you need to fill these out
+  dst_mac[0] = 0xff;
+  dst_mac[1] = 0xff;
+  dst_mac[2] = 0xff;
+  dst_mac[3] = 0xff;
+  dst_mac[4] = 0xff;
+  dst_mac[5] = 0xff;
+
+  // Source IPv4 address: you need to fill this out
+  strcpy (src_ip, "192.168.1.132");
+
+  // Destination URL or IPv4 address: you need to fill this out
+  strcpy (target, "www.google.com");
+
+  // Fill out hints for getaddrinfo().
+  memset (&hints, 0, sizeof (struct addrinfo));
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = hints.ai_flags | AI_CANONNAME;
+
+  // Resolve target using getaddrinfo().
+  if ((status = getaddrinfo (target, NULL, &hints, &res)) != 0) {
+    fprintf (stderr, "getaddrinfo() failed: %s\n", gai_strerror (status));
+    exit (EXIT_FAILURE);
+  }
+  ipv4 = (struct sockaddr_in *) res->ai_addr;
+  tmp = &(ipv4->sin_addr);
+  if (inet_ntop (AF_INET, tmp, dst_ip, INET_ADDRSTRLEN) == NULL) {
+    status = errno;
+    fprintf (stderr, "inet_ntop() failed.\nError message: %s", strerror (status));
+    exit (EXIT_FAILURE);
+  }
+  freeaddrinfo (res);
+
+  // Fill out sockaddr_ll.
+  device.sll_family = AF_PACKET;
+  memcpy (device.sll_addr, src_mac, 6 * sizeof (uint8_t));
+  device.sll_halen = 6;
+
+  // Largest payload that fits in one unfragmented datagram.
+  chunk = mtu - IP4_HDRLEN - UDP_HDRLEN;
+  printf ("Payload bytes per datagram: %i\n", chunk);
+
+  // Open payload source.
+  if (source == PAYLOAD_FILE) {
+    payload_open_file (&src, filename, chunk, loop, max_passes);
+    printf ("Mapped file '%s' (%lu bytes)\n", filename, (unsigned long int) src.size);
+  } else {
+    payload_open_pattern (&src, source, chunk);
+    printf ("Generated pattern %i with period of %lu bytes\n", source, (unsigned long int) src.size);
+  }
+
+  // IPv4 header
+
+  // IPv4 header length (4 bits): Number of 32-bit words in header = 5
+  iphdr.ip_hl = IP4_HDRLEN / sizeof (uint32_t);
+
+  // Internet Protocol version (4 bits): IPv4
+  iphdr.ip_v = 4;
+
+  // Type of service (8 bits)
+  iphdr.ip_tos = 0;
+
+  // Total length of datagram (16 bits): set for each datagram in loop below.
+  iphdr.ip_len = 0;
+
+  // ID sequence number (16 bits): set for each datagram in loop below.
+  iphdr.ip_id = 0;
+
+  // Flags, and Fragmentation offset (3, 13 bits): 0 since single datagram
+
+  // Zero (1 bit)
+  ip_flags[0] = 0;
+
+  // Do not fragment flag (1 bit)
+  ip_flags[1] = 1;
+
+  // More fragments following flag (1 bit)
+  ip_flags[2] = 0;
+
+  // Fragmentation offset (13 bits)
+  ip_flags[3] = 0;
+
+  iphdr.ip_off = htons ((ip_flags[0] << 15)
+                      + (ip_flags[1] << 14)
+                      + (ip_flags[2] << 13)
+                      +  ip_flags[3]);
+
+  // Time-to-Live (8 bits): default to maximum value
+  iphdr.ip_ttl = 255;
+
+  // Transport layer protocol (8 bits): 17 for UDP
+  iphdr.ip_p = IPPROTO_UDP;
+
+  // Source IPv4 address (32 bits)
+  if ((status = inet_pton (AF_INET, src_ip, &(iphdr.ip_src))) != 1) {
+    fprintf (stderr, "inet_pton() failed.\nError message: %s", strerror (status));
+    exit (EXIT_FAILURE);
+  }
+
+  // Destination IPv4 address (32 bits)
+  if ((status = inet_pton (AF_INET, dst_ip, &(iphdr.ip_dst))) != 1) {
+    fprintf (stderr, "inet_pton() failed.\nError message: %s", strerror (status));
+    exit (EXIT_FAILURE);
+  }
+
+  // IPv4 header checksum (16 bits): set for each datagram in loop below.
+  iphdr.ip_sum = 0;
+
+  // UDP header
+
+  // Source port number (16 bits): pick a number
+  udphdr.source = htons (4950);
+
+  // Destination port number (16 bits): pick a number
+  udphdr.dest = htons (4950);
+
+  // Length of UDP datagram (16 bits): set for each datagram in loop below.
+  udphdr.len = 0;
+
+  // UDP checksum (16 bits): set for each datagram in loop below.
+  udphdr.check = 0;
+
+  // Build template of ethernet, IPv4 and UDP headers, which is copied in front of every payload slice.
+  memcpy (template, dst_mac, 6 * sizeof (uint8_t));
+  memcpy (template + 6, src_mac, 6 * sizeof (uint8_t));
+  template[12] = ETH_P_IP / 256;
+  template[13] = ETH_P_IP % 256;
+  memcpy (template + ETH_HDRLEN, &iphdr, IP4_HDRLEN * sizeof (uint8_t));
+  memcpy (template + ETH_HDRLEN + IP4_HDRLEN, &udphdr, UDP_HDRLEN * sizeof (uint8_t));
+
+  // Partial sums over the header fields which never change.
+  // Only lengths, IP ID, and payload need to be added for each datagram.
+  ip_sum0 = sum_bytes (0, template + ETH_HDRLEN, IP4_HDRLEN);
+  udp_sum0 = sum_bytes (0, (uint8_t *) &iphdr.ip_src, 8);  // Pseudo-header source and destination addresses
+  udp_sum0 += IPPROTO_UDP;  // Pseudo-header zero and protocol fields
+  pseudo0 = udp_sum0;
+  udp_sum0 = sum_bytes (udp_sum0, template + ETH_HDRLEN + IP4_HDRLEN, 4);  // Ports
+
+  // Submit request for a raw socket descriptor.
+  if ((sd = socket (PF_PACKET, SOCK_RAW, htons (ETH_P_ALL))) < 0) {
+    perror ("socket() failed ");
+    exit (EXIT_FAILURE);
+  }
+
+  // Checksum offload needs a struct virtio_net_hdr in front of every frame.
+  offload = 0;
+  if ((udp_csum == CSUM_OFFLOAD) || (udp_csum == CSUM_AUTO)) {
+    i = 1;
+    if (setsockopt (sd, SOL_PACKET, PACKET_VNET_HDR, &i, sizeof (i)) == 0) {
+      offload = 1;
+    } else if (udp_csum == CSUM_OFFLOAD) {
+      perror ("setsockopt() failed to set PACKET_VNET_HDR ");
+      exit (EXIT_FAILURE);
+    } else {
+      perror ("setsockopt() failed to set PACKET_VNET_HDR; computing checksums in software ");
+    }
+  }
+  printf ("UDP checksum: %s\n", (udp_csum == CSUM_NONE) ? "none" : (offload ? "offloaded" : "software"));
+
+  // Virtio header: checksum from start of UDP header to end of frame, stored at offset 6 of UDP header.
+  memset (&vnet, 0, sizeof (vnet));
+  vnet.flags = VIRTIO_NET_HDR_F_NEEDS_CSUM;
+  vnet.gso_type = VIRTIO_NET_HDR_GSO_NONE;
+  vnet.csum_start = ETH_HDRLEN + IP4_HDRLEN;
+  vnet.csum_offset = 6;
+
+  // Each message is two pieces: its own copy of the headers (after room for a virtio header),
+  // and a slice of the payload source.
+  memset (msgs, 0, sizeof (msgs));
+  for (i=0; i<BATCH; i++) {
+    memcpy (hdrs + (i * HDRS_STRIDE), &vnet, VNET_HDRLEN);
+    memcpy (hdrs + (i * HDRS_STRIDE) + VNET_HDRLEN, template, HDRS_LEN * sizeof (uint8_t));
+    iovs[i][0].iov_base = hdrs + (i * HDRS_STRIDE) + (offload ? 0 : VNET_HDRLEN);
+    iovs[i][0].iov_len = (offload ? VNET_HDRLEN : 0) + HDRS_LEN;
+    msgs[i].msg_hdr.msg_iov = iovs[i];
+    msgs[i].msg_hdr.msg_iovlen = 2;
+    msgs[i].msg_hdr.msg_name = &device;
+    msgs[i].msg_hdr.msg_namelen = sizeof (device);
+  }
+
+  // Send several frames per system call, unless the rate is so low that batching would cause bursts.
+  if ((pacing != PACE_CBR) || (burst <= 0) || (burst > BATCH)) {
+    burst = BATCH;
+    if ((pacing == PACE_CBR) && (rate > 0) && (rate < 10000)) {
+      burst = 1;
+    }
+  }
+  interval = 0;
+  if ((pacing == PACE_CBR) && (rate > 0)) {
+    interval = (1000000000L / rate) * burst;  // Nanoseconds between batches
+  }
+
+  // Token bucket starts full.
+  if (pacing == PACE_TOKEN_BUCKET) {
+    if ((bitrate <= 0) || (bucket < (HDRS_LEN + chunk))) {
+      fprintf (stderr, "Token bucket needs a bit rate, and room for at least one frame (%i bytes).\n", HDRS_LEN + chunk);
+      exit (EXIT_FAILURE);
+    }
+    tb.rate = bitrate / 8.0 / 1000000000.0;
+    tb.depth = bucket;
+    tb.tokens = bucket;
+    clock_gettime (CLOCK_MONOTONIC, &tb.last);
+  }
+
+  // Launch times: each frame carries a control message with its launch time, in ns of txclock.
+  // Kernel reports frames dropped for missing their launch time on the socket's error queue.
+  if (pacing == PACE_TXTIME) {
+    if (rate <= 0) {
+      fprintf (stderr, "PACE_TXTIME needs a packet rate.\n");
+      exit (EXIT_FAILURE);
+    }
+    txconf.clockid = txclock;
+    txconf.flags = SOF_TXTIME_REPORT_ERRORS;
+    if (setsockopt (sd, SOL_SOCKET, SO_TXTIME, &txconf, sizeof (txconf)) < 0) {
+      perror ("setsockopt() failed to set SO_TXTIME ");
+      exit (EXIT_FAILURE);
+    }
+    for (i=0; i<BATCH; i++) {
+      msgs[i].msg_hdr.msg_control = txcontrol[i];
+      msgs[i].msg_hdr.msg_controllen = sizeof (txcontrol[i]);
+      cmsg = CMSG_FIRSTHDR (&msgs[i].msg_hdr);
+      cmsg->cmsg_level = SOL_SOCKET;
+      cmsg->cmsg_type = SCM_TXTIME;
+      cmsg->cmsg_len = CMSG_LEN (sizeof (uint64_t));
+    }
+  }
+
+  // Receiving end for verification.
+  vd = -1;
+  memset (&check, 0, sizeof (check));
+  if (verify) {
+    vd = verify_open (verify_interface, verify_netns);
+  }
+
+  // Stop stream cleanly on Ctrl-C.
+  signal (SIGINT, sig_handler);
+
+  packets = 0;
+  bytes = 0;
+  ip_id = 0;
+  done = 0;
+  late = 0;
+  clock_gettime (CLOCK_MONOTONIC, &t1);
+  next = t1;
+  clock_gettime (txclock, &t2);
+  txstart = (t2.tv_sec * 1000000000ULL) + t2.tv_nsec + TXTIME_LEAD;
+
+  // Send loop
+  while ((done == 0) && (stop == 0)) {
+
+    // Fill out up to 'burst' messages.
+    for (n=0; n<burst; n++) {
+      if ((max_packets > 0) && ((packets + n) >= max_packets)) {
+        done = 1;
+        break;
+      }
+      if ((i = payload_next (&src, &payload)) == 0) {
+        done = 1;
+        break;
+      }
+      iovs[n][1].iov_base = payload;
+      iovs[n][1].iov_len = i;
+
+      // Patch per-datagram IPv4 fields: total length, ID, and header checksum.
+      h = hdrs + (n * HDRS_STRIDE) + VNET_HDRLEN;
+      len16 = htons (IP4_HDRLEN + UDP_HDRLEN + i);
+      memcpy (h + ETH_HDRLEN + 2, &len16, 2);
+      ip_id++;
+      h[ETH_HDRLEN + 4] = ip_id >> 8;
+      h[ETH_HDRLEN + 5] = ip_id & 0xff;
+      sum = ip_sum0 + IP4_HDRLEN + UDP_HDRLEN + i + ip_id;
+      sum = (uint16_t) ~fold_sum (sum);
+      h[ETH_HDRLEN + 10] = sum >> 8;
+      h[ETH_HDRLEN + 11] = sum & 0xff;
+
+      // Patch UDP length and checksum.
+      len16 = htons (UDP_HDRLEN + i);
+      memcpy (h + ETH_HDRLEN + IP4_HDRLEN + 4, &len16, 2);
+      if (udp_csum != CSUM_NONE) {
+        sum = udp_csum_field (payload, i, offload, pseudo0, udp_sum0);
+        h[ETH_HDRLEN + IP4_HDRLEN + 6] = sum >> 8;
+        h[ETH_HDRLEN + IP4_HDRLEN + 7] = sum & 0xff;
+      }
+      bytes += HDRS_LEN + i;
+    }
+    if (n == 0) {
+      break;
+    }
+
+    // Wait until it's time to send this batch.
+    if (interval > 0) {
+      pace (&next, interval);
+    }
+
+    // Stamp launch times, counted from start so they never drift, and sleep until shortly before the first.
+    if (pacing == PACE_TXTIME) {
+      for (i=0; i<n; i++) {
+        txtime = txstart + (((packets + i) * 1000000000ULL) / rate);
+        memcpy (CMSG_DATA (CMSG_FIRSTHDR (&msgs[i].msg_hdr)), &txtime, sizeof (uint64_t));
+      }
+      txtime = txstart + ((packets * 1000000000ULL) / rate) - TXTIME_LEAD;
+      t2.tv_sec = txtime / 1000000000ULL;
+      t2.tv_nsec = txtime % 1000000000ULL;
+      while ((clock_nanosleep (txclock, TIMER_ABSTIME, &t2, NULL) == EINTR) && (stop == 0));
+    }
+
+    // Send batch of ethernet frames to socket. A token bucket may let only part of it go at a time.
+    i = 0;
+    while (i < n) {
+      k = n;
+      if (pacing == PACE_TOKEN_BUCKET) {
+        k = tb_take (&tb, iovs, i, n);
+      }
+      if ((status = sendmmsg (sd, msgs + i, k - i, 0)) < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+
+        // Kernel refuses virtio header (e.g., device cannot take it): fall back to software checksums,
+        // and finish this batch without virtio headers.
+        if ((errno == EINVAL) && offload && (udp_csum == CSUM_AUTO)) {
+          fprintf (stderr, "Checksum offload refused; computing checksums in software.\n");
+          status = 0;
+          setsockopt (sd, SOL_PACKET, PACKET_VNET_HDR, &status, sizeof (status));
+          offload = 0;
+          for (status=0; status<BATCH; status++) {
+            h = hdrs + (status * HDRS_STRIDE) + VNET_HDRLEN;
+            iovs[status][0].iov_base = h;
+            iovs[status][0].iov_len = HDRS_LEN;
+            if (status < n) {
+              sum = udp_csum_field (iovs[status][1].iov_base, iovs[status][1].iov_len, 0, pseudo0, udp_sum0);
+              h[ETH_HDRLEN + IP4_HDRLEN + 6] = sum >> 8;
+              h[ETH_HDRLEN + IP4_HDRLEN + 7] = sum & 0xff;
+            }
+          }
+          continue;
+        }
+        perror ("sendmmsg() failed ");
+        exit (EXIT_FAILURE);
+      }
+      i += status;
+    }
+    packets += n;
+
+    // Frames dropped for missing their launch time.
+    if (pacing == PACE_TXTIME) {
+      late += txtime_errors (sd);
+    }
+
+    // Check whatever has arrived at the veth peer.
+    if (vd >= 0) {
+      verify_frames (vd, template, &check);
+    }
+  }
+
+  clock_gettime (CLOCK_MONOTONIC, &t2);
+  dt = (double) (t2.tv_sec - t1.tv_sec) + (double) (t2.tv_nsec - t1.tv_nsec) / 1000000000.0;
+
+  // Report results.
+  printf ("Sent %li packets (%llu bytes) in %g seconds\n", packets, bytes, dt);
+  if (dt > 0.0) {
+    printf ("Rate: %.0f packets per second, %.2f Mbit/s\n", (double) packets / dt, (double) bytes * 8.0 / dt / 1000000.0);
+  }
+
+  if (pacing == PACE_TXTIME) {
+    usleep (TXTIME_LEAD / 1000);
+    late += txtime_errors (sd);
+    printf ("Frames dropped for missing their launch time: %li\n", late);
+  }
+
+  // Report verification, after letting last frames arrive.
+  if (vd >= 0) {
+    usleep (100000);
+    verify_frames (vd, template, &check);
+    printf ("Verified %li frames at %s: %li checksums complete and correct, %li left to offload with correct pseudo-header sum, %li bad\n",
+            check.frames, verify_interface, check.complete, check.partial, check.bad);
+    close (vd);
+  }
+
+  // Close socket descriptor.
+  close (sd);
+
+  // Release payload source.
+  payload_close (&src);
+
+  // Free allocated memory.
+  free (src_mac);
+  free (dst_mac);
+  free (template);
+  free (hdrs);
+  free (interface);
+  free (target);
+  free (src_ip);
+  free (dst_ip);
+  free (filename);
+  free (verify_interface);
+  free (verify_netns);
+  free (ip_flags);
+
+  return (EXIT_SUCCESS);
+}
+
+// Memory-map a file as payload source.
+// Small files are faulted in at once with MAP_POPULATE. Large files are left to
+// the kernel's sequential read-ahead, with explicit windows requested by payload_next().
+int
+payload_open_file (payload_src *src, char *filename, int chunk, int loop, long int max_passes)
+{
+  int fd, flags;
+  struct stat st;
+  void *map;
+
+  memset (src, 0, sizeof (payload_src));
+
+  if ((fd = open (filename, O_RDONLY)) < 0) {
+    fprintf (stderr, "Can't open file '%s'.\n", filename);
+    exit (EXIT_FAILURE);
+  }
+  if (fstat (fd, &st) < 0) {
+    perror ("fstat() failed ");
+    exit (EXIT_FAILURE);
+  }
+  if (st.st_size == 0) {
+    fprintf (stderr, "ERROR: File '%s' is empty.\n", filename);
+    exit (EXIT_FAILURE);
+  }
+
+  flags = MAP_PRIVATE;
+  if (st.st_size <= POPULATE_MAX) {
+    flags |= MAP_POPULATE;
+  }
+  if ((map = mmap (NULL, st.st_size, PROT_READ, flags, fd, 0)) == MAP_FAILED) {
+    perror ("mmap() failed ");
+    exit (EXIT_FAILURE);
+  }
+
+  // Mapping stays valid after descriptor is closed.
+  close (fd);
+
+  // Tell kernel we'll read the file front to back.
+  if (madvise (map, st.st_size, MADV_SEQUENTIAL) < 0) {
+    perror ("madvise() failed ");
+  }
+
+  src->type = PAYLOAD_FILE;
+  src->base = (uint8_t *) map;
+  src->size = st.st_size;
+  src->chunk = chunk;
+  src->loop = loop;
+  src->max_passes = max_passes;
+  if (st.st_size <= POPULATE_MAX) {
+    src->advised = st.st_size;
+  }
+
+  return (EXIT_SUCCESS);
+}
+
+// Generate a payload pattern.
+// The buffer holds one period of the pattern followed by a copy of its first
+// 'chunk' bytes, so any slice starting within the period is contiguous in memory.
+int
+payload_open_pattern (payload_src *src, int type, int chunk)
+{
+  int i, n, len;
+  uint32_t x;
+  char number[16];
+
+  memset (src, 0, sizeof (payload_src));
+
+  src->type = type;
+  src->size = PATTERN_LEN;
+  src->chunk = chunk;
+  src->base = allocate_ustrmem (PATTERN_LEN + chunk);
+
+  switch (type) {
+    case PATTERN_ZERO:
+      break;  // allocate_ustrmem() already zeroed buffer.
+    case PATTERN_INCR:
+      for (i=0; i<PATTERN_LEN; i++) {
+        src->base[i] = i & 0xff;
+      }
+      break;
+    case PATTERN_RANDOM:
+      x = 2463534242u;  // xorshift32 seed
+      for (i=0; i<PATTERN_LEN; i++) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        src->base[i] = x & 0xff;
+      }
+      break;
+    case PATTERN_NUMBERS:
+      i = 0;
+      n = 0;
+      while (i < PATTERN_LEN) {
+        len = snprintf (number, sizeof (number), "%i ", n++);
+        if (len > (PATTERN_LEN - i)) {
+          len = PATTERN_LEN - i;
+        }
+        memcpy (src->base + i, number, len * sizeof (uint8_t));
+        i += len;
+      }
+      break;
+    default:
+      fprintf (stderr, "ERROR: Unknown payload pattern %i in payload_open_pattern().\n", type);
+      exit (EXIT_FAILURE);
+  }
+
+  // Repeat start of pattern after end of period.
+  memcpy (src->base + PATTERN_LEN, src->base, chunk * sizeof (uint8_t));
+
+  return (EXIT_SUCCESS);
+}
+
+// Return length of next payload slice and point *ptr to it.
+// Returns 0 when the end of the file has been reached and we're not to loop again.
+int
+payload_next (payload_src *src, uint8_t **ptr)
+{
+  size_t len, start;
+
+  // Generated pattern: endless, fixed-size slices.
+  if (src->type != PAYLOAD_FILE) {
+    *ptr = src->base + src->pos;
+    src->pos = (src->pos + src->chunk) % src->size;
+    return (src->chunk);
+  }
+
+  // End of file reached.
+  if (src->pos >= src->size) {
+    src->passes++;
+    if ((src->loop == 0) || ((src->max_passes > 0) && (src->passes >= src->max_passes))) {
+      return (0);
+    }
+    src->pos = 0;
+  }
+
+  // Ask kernel to read the next window ahead of us, before we fault on it.
+  if ((src->advised < src->size) && ((src->pos + (READAHEAD / 2)) >= src->advised)) {
+    start = src->advised & ~((size_t) sysconf (_SC_PAGESIZE) - 1);
+    len = READAHEAD;
+    if ((start + len) > src->size) {
+      len = src->size - start;
+    }
+    madvise (src->base + start, len, MADV_WILLNEED);
+    src->advised = start + len;
+  }
+
+  len = src->size - src->pos;
+  if (len > (size_t) src->chunk) {
+    len = src->chunk;
+  }
+  *ptr = src->base + src->pos;
+  src->pos += len;
+
+  // Keep readahead in step when looping back to start of file.
+  if ((src->pos >= src->size) && (src->loop == 1) && (src->size > POPULATE_MAX)) {
+    src->advised = 0;
+  }
+
+  return ((int) len);
+}
+
+// Release payload source.
+void
+payload_close (payload_src *src)
+{
+  if (src->type == PAYLOAD_FILE) {
+    munmap (src->base, src->size);
+  } else {
+    free (src->base);
+  }
+  src->base = NULL;
+}
+
+// Take tokens for as many frames, from index i up to n, as there are tokens for,
+// sleeping first if there are not enough for even one. Returns index of first frame not covered.
+int
+tb_take (token_bucket *tb, struct iovec (*iovs)[2], int i, int n)
+{
+  int k;
+  double need;
+  struct timespec now, wake;
+  long int ns;
+
+  while (1) {
+
+    // Add tokens for time passed.
+    clock_gettime (CLOCK_MONOTONIC, &now);
+    tb->tokens += tb->rate * (((now.tv_sec - tb->last.tv_sec) * 1000000000.0) + (now.tv_nsec - tb->last.tv_nsec));
+    if (tb->tokens > tb->depth) {
+      tb->tokens = tb->depth;
+    }
+    tb->last = now;
+
+    // Frames covered by tokens held.
+    need = 0.0;
+    for (k=i; k<n; k++) {
+      if ((need + HDRS_LEN + iovs[k][1].iov_len) > tb->tokens) {
+        break;
+      }
+      need += HDRS_LEN + iovs[k][1].iov_len;
+    }
+    if ((k > i) || (stop == 1)) {
+      break;
+    }
+
+    // Sleep until there are tokens for the next frame.
+    ns = (long int) ((HDRS_LEN + iovs[i][1].iov_len - tb->tokens) / tb->rate) + 1;
+    wake.tv_sec = now.tv_sec + (ns / 1000000000L);
+    wake.tv_nsec = now.tv_nsec + (ns % 1000000000L);
+    if (wake.tv_nsec >= 1000000000L) {
+      wake.tv_nsec -= 1000000000L;
+      wake.tv_sec++;
+    }
+    clock_nanosleep (CLOCK_MONOTONIC, TIMER_ABSTIME, &wake, NULL);
+  }
+  if (k == i) {
+    k = i + 1;  // Stopping: let one frame go, so the loop ends
+    need = HDRS_LEN + iovs[i][1].iov_len;
+  }
+  tb->tokens -= need;
+
+  return (k);
+}
+
+// Count frames the qdisc has dropped for missing their launch time (or having a bad one),
+// as reported on the socket's error queue.
+int
+txtime_errors (int sd)
+{
+  int count;
+  uint8_t control[256];
+  struct msghdr msg;
+  struct cmsghdr *cmsg;
+  struct sock_extended_err *err;
+
+  count = 0;
+  while (1) {
+    memset (&msg, 0, sizeof (msg));
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof (control);
+    if (recvmsg (sd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+      break;
+    }
+    for (cmsg = CMSG_FIRSTHDR (&msg); cmsg != NULL; cmsg = CMSG_NXTHDR (&msg, cmsg)) {
+      err = (struct sock_extended_err *) CMSG_DATA (cmsg);
+      if (err->ee_origin == SO_EE_ORIGIN_TXTIME) {
+        count++;
+      }
+    }
+  }
+
+  return (count);
+}
+
+// Value for the UDP checksum field of a datagram with len bytes of payload.
+// In software, the whole checksum; with offload, only the pseudo-header sum, not complemented,
+// which the kernel or NIC adds to its sum over UDP header and payload.
+// pseudo0 is the sum over addresses and protocol, and udp_sum0 adds the ports.
+uint16_t
+udp_csum_field (uint8_t *payload, int len, int offload, uint32_t pseudo0, uint32_t udp_sum0)
+{
+  uint32_t sum;
+
+  if (offload) {
+    return (fold_sum (pseudo0 + UDP_HDRLEN + len));
+  }
+
+  sum = udp_sum0 + (2 * (UDP_HDRLEN + len));  // Pseudo-header length + UDP header length
+  sum = (uint16_t) ~fold_sum (sum_bytes (sum, payload, len));
+  if (sum == 0) {
+    sum = 0xffff;  // Zero means "no checksum" in UDP (RFC 768)
+  }
+
+  return ((uint16_t) sum);
+}
+
+// Open a socket receiving IPv4 frames on the given interface, which may be in another
+// network namespace (named by a path such as /var/run/netns/name, or empty for ours).
+// Asks for auxiliary data, which says whether a frame's checksum was left to offload.
+int
+verify_open (char *interface, char *netns)
+{
+  int vd, nsfd, ourfd, on;
+  struct sockaddr_ll sll;
+
+  nsfd = -1;
+  ourfd = -1;
+  if (netns[0] != 0) {
+    if (((ourfd = open ("/proc/self/ns/net", O_RDONLY)) < 0) || ((nsfd = open (netns, O_RDONLY)) < 0)) {
+      perror ("open() failed to open network namespace ");
+      exit (EXIT_FAILURE);
+    }
+    if (setns (nsfd, CLONE_NEWNET) < 0) {
+      perror ("setns() failed to enter network namespace ");
+      exit (EXIT_FAILURE);
+    }
+  }
+
+  // Socket and interface index belong to the namespace we are in when asking for them.
+  if ((vd = socket (PF_PACKET, SOCK_RAW, htons (ETH_P_IP))) < 0) {
+    perror ("socket() failed ");
+    exit (EXIT_FAILURE);
+  }
+  memset (&sll, 0, sizeof (sll));
+  sll.sll_family = AF_PACKET;
+  sll.sll_protocol = htons (ETH_P_IP);
+  if ((sll.sll_ifindex = if_nametoindex (interface)) == 0) {
+    perror ("if_nametoindex() failed to obtain index of verifying interface ");
+    exit (EXIT_FAILURE);
+  }
+  if (bind (vd, (struct sockaddr *) &sll, sizeof (sll)) < 0) {
+    perror ("bind() failed ");
+    exit (EXIT_FAILURE);
+  }
+  on = 1;
+  if (setsockopt (vd, SOL_PACKET, PACKET_AUXDATA, &on, sizeof (on)) < 0) {
+    perror ("setsockopt() failed to set PACKET_AUXDATA ");
+    exit (EXIT_FAILURE);
+  }
+
+  if (nsfd >= 0) {
+    if (setns (ourfd, CLONE_NEWNET) < 0) {
+      perror ("setns() failed to return to our network namespace ");
+      exit (EXIT_FAILURE);
+    }
+    close (nsfd);
+    close (ourfd);
+  }
+
+  return (vd);
+}
+
+// Check UDP checksums of the frames of our stream (same addresses and ports as template)
+// waiting at the verifying socket.
+void
+verify_frames (int vd, uint8_t *template, csum_check *check)
+{
+  int i, n, len;
+  uint8_t *ip, *udp;
+  uint32_t sum;
+  static uint8_t frames[BATCH][IP_MAXPACKET];
+  static uint8_t control[BATCH][CMSG_SPACE (sizeof (struct tpacket_auxdata))];
+  struct mmsghdr msgs[BATCH];
+  struct iovec iovs[BATCH];
+  struct cmsghdr *cmsg;
+  struct tpacket_auxdata *aux;
+
+  while (1) {
+    memset (msgs, 0, sizeof (msgs));
+    for (i=0; i<BATCH; i++) {
+      iovs[i].iov_base = frames[i];
+      iovs[i].iov_len = IP_MAXPACKET;
+      msgs[i].msg_hdr.msg_iov = &iovs[i];
+      msgs[i].msg_hdr.msg_iovlen = 1;
+      msgs[i].msg_hdr.msg_control = control[i];
+      msgs[i].msg_hdr.msg_controllen = sizeof (control[i]);
+    }
+    if ((n = recvmmsg (vd, msgs, BATCH, MSG_DONTWAIT, NULL)) <= 0) {
+      return;
+    }
+
+    for (i=0; i<n; i++) {
+      ip = frames[i] + ETH_HDRLEN;
+      udp = ip + IP4_HDRLEN;
+      len = msgs[i].msg_len;
+      if ((len < HDRS_LEN) || (ip[0] != 0x45) || (ip[9] != IPPROTO_UDP) ||
+          (memcmp (ip + 12, template + ETH_HDRLEN + 12, 8) != 0) ||
+          (memcmp (udp, template + ETH_HDRLEN + IP4_HDRLEN, 4) != 0)) {
+        continue;
+      }
+      len = (udp[4] << 8) + udp[5];
+      if ((len < UDP_HDRLEN) || ((HDRS_LEN - UDP_HDRLEN + len) > (int) msgs[i].msg_len)) {
+        check->bad++;
+        continue;
+      }
+      check->frames++;
+
+      // Was checksum left to offload?
+      aux = NULL;
+      for (cmsg = CMSG_FIRSTHDR (&msgs[i].msg_hdr); cmsg != NULL; cmsg = CMSG_NXTHDR (&msgs[i].msg_hdr, cmsg)) {
+        if ((cmsg->cmsg_level == SOL_PACKET) && (cmsg->cmsg_type == PACKET_AUXDATA)) {
+          aux = (struct tpacket_auxdata *) CMSG_DATA (cmsg);
+        }
+      }
+
+      // Complete checksum: sum over pseudo-header, UDP header and payload is all ones.
+      sum = sum_bytes (0, ip + 12, 8) + IPPROTO_UDP + len;
+      if ((aux != NULL) && (aux->tp_status & TP_STATUS_CSUMNOTREADY)) {
+        if (((udp[6] << 8) + udp[7]) == fold_sum (sum)) {
+          check->partial++;
+        } else {
+          check->bad++;
+        }
+      } else if (fold_sum (sum_bytes (sum, udp, len)) == 0xffff) {
+        check->complete++;
+      } else {
+        check->bad++;
+      }
+    }
+  }
+}
+
+// Add bytes to a running ones' complement sum of 16-bit words in host byte order.
+// Data need not be aligned, so this can run directly over a memory-mapped file.
+uint32_t
+sum_bytes (uint32_t sum, uint8_t *data, int len)
+{
+  while (len > 1) {
+    sum += (data[0] << 8) + data[1];
+    data += 2;
+    len -= 2;
+  }
+
+  // Odd byte is padded with zero.
+  if (len == 1) {
+    sum += data[0] << 8;
+  }
+
+  return (sum);
+}
+
+// Fold a 32-bit running sum into 16 bits, with end-around carry.
+uint16_t
+fold_sum (uint32_t sum)
+{
+  while (sum >> 16) {
+    sum = (sum & 0xffff) + (sum >> 16);
+  }
+
+  return ((uint16_t) sum);
+}
+
+// Sleep until next scheduled send time, then schedule the one after.
+// Absolute deadlines keep the average rate exact even if one sleep runs long.
+void
+pace (struct timespec *next, long int interval)
+{
+  next->tv_nsec += interval;
+  while (next->tv_nsec >= 1000000000L) {
+    next->tv_nsec -= 1000000000L;
+    next->tv_sec++;
+  }
+  while (clock_nanosleep (CLOCK_MONOTONIC, TIMER_ABSTIME, next, NULL) == EINTR) {
+    if (stop == 1) {
+      break;
+    }
+  }
+}
+
+// SIGINT handler: finish current batch and report statistics.
+void
+sig_handler (int signum)
+{
+  (void) signum;
+  stop = 1;
+}
+
+// Allocate memory for an array of chars.
+char *
+allocate_strmem (int len)
+{
+  void *tmp;
+
+  if (len <= 0) {
+    fprintf (stderr, "ERROR: Cannot allocate memory because len = %i in allocate_strmem().\n", len);
+    exit (EXIT_FAILURE);
+  }
+
+  tmp = (char *) malloc (len * sizeof (char));
+  if (tmp != NULL) {
+    memset (tmp, 0, len * sizeof (char));
+    return (tmp);
+  } else {
+    fprintf (stderr, "ERROR: Cannot allocate memory for array allocate_strmem().\n");
+    exit (EXIT_FAILURE);
+  }
+}
+
+// Allocate memory for an array of unsigned chars.
+uint8_t *
+allocate_ustrmem (int len)
+{
+  void *tmp;
+
+  if (len <= 0) {
+    fprintf (stderr, "ERROR: Cannot allocate memory because len = %i in allocate_ustrmem().\n", len);
+    exit (EXIT_FAILURE);
+  }
+
+  tmp = (uint8_t *) malloc (len * sizeof (uint8_t));
+  if (tmp != NULL) {
+    memset (tmp, 0, len * sizeof (uint8_t));
+    return (tmp);
+  } else {
+    fprintf (stderr, "ERROR: Cannot allocate memory for array allocate_ustrmem().\n");
+    exit (EXIT_FAILURE);
+  }
+}
+
+// Allocate memory for an array of ints.
+int *
+allocate_intmem (int len)
+{
+  void *tmp;
+
+  if (len <= 0) {
+    fprintf (stderr, "ERROR: Cannot allocate memory because len = %i in allocate_intmem().\n", len);
+    exit (EXIT_FAILURE);
+  }
+
+  tmp = (int *) malloc (len * sizeof (int));
+  if (tmp != NULL) {
+    memset (tmp, 0, len * sizeof (int));
+    return (tmp);
+  } else {
+    fprintf (stderr, "ERROR: Cannot allocate memory for array allocate_intmem().\n");
+    exit (EXIT_FAILURE);
+  }
+}
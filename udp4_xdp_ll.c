@@ -0,0 +1,949 @@
+/*  Copyright (C) 2013  P.D. Buchan (pdbuchan@yahoo.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Send or receive a flood of IPv4 UDP packets at the link layer (ethernet frame),
+// through either a PF_PACKET raw socket, as in the other *_ll.c examples, or an AF_XDP socket,
+// and report packets per second. Optionally run both, one after the other, and compare them.
+// Need to have destination MAC address.
+// An AF_XDP socket exchanges frames with the driver through rings shared with the kernel,
+// pointing into a region of our own memory (the UMEM), so skipping most of the kernel's
+// packet path. To receive, a small XDP program (loaded here without libbpf) redirects our
+// UDP packets to the socket, and passes everything else on to the kernel as usual.
+// Generic (SKB) XDP mode works with any interface, including veth; native mode and
+// zero-copy need driver support. If zero-copy is refused, copy mode is used instead.
+// The xsk_ functions below depend only on each other, and can be copied into another
+// *_ll.c example to replace its PF_PACKET socket.
+
+#define _GNU_SOURCE           // sendmmsg(), recvmmsg() and struct mmsghdr
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>           // close(), syscall()
+#include <string.h>           // strcpy, memset(), and memcpy()
+
+#include <netdb.h>            // struct addrinfo
+#include <sys/types.h>        // needed for socket(), uint8_t, uint16_t, uint32_t
+#include <sys/socket.h>       // needed for socket(), sendmmsg(), recvmmsg()
+#include <netinet/in.h>       // IPPROTO_UDP, INET_ADDRSTRLEN
+#include <netinet/ip.h>       // struct ip and IP_MAXPACKET (which is 65535)
+#include <arpa/inet.h>        // inet_pton() and inet_ntop()
+#include <sys/ioctl.h>        // macro ioctl is defined
+#include <bits/ioctls.h>      // defines values for argument "request" of ioctl.
+#include <net/if.h>           // struct ifreq
+#include <linux/if_ether.h>   // ETH_P_IP = 0x0800, ETH_P_IPV6 = 0x86DD
+#include <linux/if_packet.h>  // struct sockaddr_ll (see man 7 packet)
+#include <net/ethernet.h>
+#include <linux/if_xdp.h>     // struct sockaddr_xdp, struct xdp_umem_reg, struct xdp_desc
+#include <linux/if_link.h>    // XDP_FLAGS_SKB_MODE, XDP_FLAGS_DRV_MODE
+#include <linux/bpf.h>        // union bpf_attr, struct bpf_insn
+#include <sys/syscall.h>      // __NR_bpf
+#include <sys/mman.h>         // mmap(), munmap()
+#include <poll.h>             // poll()
+#include <signal.h>           // signal(), SIGINT
+#include <time.h>             // clock_gettime()
+
+#include <errno.h>            // errno, perror()
+
+#ifndef AF_XDP
+#define AF_XDP 44
+#endif
+#ifndef SOL_XDP
+#define SOL_XDP 283
+#endif
+
+// Define some constants.
+#define ETH_HDRLEN 14         // Ethernet header length
+#define IP4_HDRLEN 20         // IPv4 header length
+#define UDP_HDRLEN  8         // UDP header length, excludes data
+#define DATALEN 18            // UDP payload length: makes a minimum size (60 byte) frame
+#define FRAME_LEN (ETH_HDRLEN + IP4_HDRLEN + UDP_HDRLEN + DATALEN)
+#define BATCH 64              // Frames handed to kernel at once
+#define MAX_RXLEN 2048        // Room for each frame received through PF_PACKET
+#define NUM_FRAMES 4096       // Frames in UMEM
+#define FRAME_SIZE 2048       // Size of each UMEM frame (XDP_UMEM_DEFAULT_CHUNK_SIZE)
+#define RING_SIZE 2048        // Entries in each ring (power of 2)
+#define ROLE_SEND 0           // Roles: send a flood of packets,
+#define ROLE_RECV 1           // or count packets arriving for our UDP port
+#define BACKEND_PACKET 0      // Backends: PF_PACKET raw socket,
+#define BACKEND_XDP 1         // AF_XDP socket,
+#define BACKEND_BOTH 2        // or each in turn, for comparison
+
+// Build one eBPF instruction.
+#define INSN(c, d, s, o, i) ((struct bpf_insn) { .code = (c), .dst_reg = (d), .src_reg = (s), .off = (o), .imm = (i) })
+
+// Define a struct for one ring shared with the kernel.
+// We are producer of the fill and TX rings, and consumer of the completion and RX rings.
+// Producer and consumer indexes run freely, and are masked to find entries.
+typedef struct _xsk_ring xsk_ring;
+struct _xsk_ring {
+  uint32_t *producer;   // Shared producer index
+  uint32_t *consumer;   // Shared consumer index
+  uint32_t *flags;      // Shared flags (XDP_RING_NEED_WAKEUP)
+  void *entries;        // Ring entries: UMEM addresses (fill, completion) or struct xdp_desc (RX, TX)
+  uint32_t mask;        // Number of entries - 1
+  uint32_t cached_prod; // Our copy of producer index
+  uint32_t cached_cons; // Our copy of consumer index
+  void *map;            // Mapping of ring
+  size_t maplen;
+};
+
+// Define a struct for an AF_XDP socket and its UMEM.
+typedef struct _xsk xsk;
+struct _xsk {
+  int fd;               // AF_XDP socket descriptor
+  uint8_t *umem;        // UMEM: NUM_FRAMES frames of FRAME_SIZE bytes
+  xsk_ring fill;        // Frames given to kernel to receive into
+  xsk_ring comp;        // Frames kernel has finished sending
+  xsk_ring rx;          // Frames received
+  xsk_ring tx;          // Frames to send
+  uint64_t *free;       // Stack of UMEM addresses of frames free for sending
+  uint32_t nfree;
+  int need_wakeup;      // Kernel only needs a syscall when it sets XDP_RING_NEED_WAKEUP
+  int map_fd;           // XSKMAP, program and link of XDP program for receiving (-1 if none)
+  int prog_fd;
+  int link_fd;
+};
+
+// Function prototypes
+int xsk_open (xsk *, int, int, int, int, int, uint32_t, uint16_t);
+int xsk_ring_map (int, xsk_ring *, struct xdp_ring_offset *, off_t, size_t);
+int xsk_attach (xsk *, int, int, uint32_t, uint16_t);
+int xsk_send (xsk *, uint8_t *, int, int);
+int xsk_complete (xsk *);
+int xsk_recv (xsk *, uint16_t, int);
+void xsk_close (xsk *);
+long int bpf (int, union bpf_attr *);
+double run_send (int, int, xsk *, struct sockaddr_ll *, uint8_t *, int, int);
+double run_recv (int, int, xsk *, uint16_t, int);
+double elapsed (struct timespec *);
+uint32_t sum_bytes (uint32_t, uint8_t *, int);
+uint16_t fold_sum (uint32_t);
+void sig_handler (int);
+char *allocate_strmem (int);
+uint8_t *allocate_ustrmem (int);
+
+// Set by SIGINT handler to end current run.
+volatile sig_atomic_t stop = 0;
+
+int
+main (int argc, char **argv)
+{
+  int i, status, sd, role, backend, bind_mode, need_wakeup, xdp_flags, queue, duration, zerocopy;
+  char *interface, *target, *src_ip, *dst_ip;
+  uint8_t *src_mac, *dst_mac, *frame;
+  uint16_t sport, dport;
+  uint32_t sum;
+  double pps[2];
+  struct addrinfo hints, *res;
+  struct sockaddr_in *ipv4;
+  struct sockaddr_ll device;
+  struct ifreq ifr;
+  struct in_addr saddr, daddr;
+  xsk x;
+  void *tmp;
+
+  // Allocate memory for various arrays.
+  src_mac = allocate_ustrmem (6);
+  dst_mac = allocate_ustrmem (6);
+  interface = allocate_strmem (40);
+  target = allocate_strmem (40);
+  src_ip = allocate_strmem (INET_ADDRSTRLEN);
+  dst_ip = allocate_strmem (INET_ADDRSTRLEN);
+  frame = allocate_ustrmem (FRAME_LEN);
+
+  // Interface to send or receive packets through, and its queue (for AF_XDP).
+  strcpy (interface, "eth0");
+  queue = 0;
+
+  // Role (ROLE_SEND or ROLE_RECV), backend (BACKEND_PACKET, BACKEND_XDP or BACKEND_BOTH),
+  // and seconds to run each backend for.
+  role = ROLE_SEND;
+  backend = BACKEND_BOTH;
+  duration = 5;
+
+  // AF_XDP settings: copy or zero-copy (XDP_COPY or XDP_ZEROCOPY), whether to use need_wakeup,
+  // and mode of XDP program for receiving: generic (XDP_FLAGS_SKB_MODE) or native (XDP_FLAGS_DRV_MODE).
+  bind_mode = XDP_COPY;
+  need_wakeup = 1;
+  xdp_flags = XDP_FLAGS_SKB_MODE;
+
+  // UDP ports.
+  sport = 4950;
+  dport = 4951;
+
+  // Submit request for a socket descriptor to look up interface.
+  if ((sd = socket (PF_PACKET, SOCK_RAW, htons (ETH_P_ALL))) < 0) {
+    perror ("socket() failed to get socket descriptor for using ioctl() ");
+    exit (EXIT_FAILURE);
+  }
+
+  // Use ioctl() to look up interface name and get its MAC address.
+  memset (&ifr, 0, sizeof (ifr));
+  snprintf (ifr.ifr_name, sizeof (ifr.ifr_name), "%s", interface);
+  if (ioctl (sd, SIOCGIFHWADDR, &ifr) < 0) {
+    perror ("ioctl() failed to get source MAC address ");
+    return (EXIT_FAILURE);
+  }
+  close (sd);
+
+  // Copy source MAC address.
+  memcpy (src_mac, ifr.ifr_hwaddr.sa_data, 6 * sizeof (uint8_t));
+
+  // Report source MAC address to stdout.
+  printf ("MAC address for interface %s is ", interface);
+  for (i=0; i<5; i++) {
+    printf ("%02x:", src_mac[i]);
+  }
+  printf ("%02x\n", src_mac[5]);
+
+  // Find interface index from interface name and store index in
+  // struct sockaddr_ll device, which will be used as an argument of sendmmsg().
+  memset (&device, 0, sizeof (device));
+  if ((device.sll_ifindex = if_nametoindex (interface)) == 0) {
+    perror ("if_nametoindex() failed to obtain interface index ");
+    exit (EXIT_FAILURE);
+  }
+  printf ("Index for interface %s is %i\n", interface, device.sll_ifindex);
+
+  // Set destination MAC address: you need to fill these out
+  dst_mac[0] = 0xff;
+  dst_mac[1] = 0xff;
+  dst_mac[2] = 0xff;
+  dst_mac[3] = 0xff;
+  dst_mac[4] = 0xff;
+  dst_mac[5] = 0xff;
+
+  // Source IPv4 address: you need to fill this out
+  strcpy (src_ip, "192.168.1.132");
+
+  // Destination URL or IPv4 address: you need to fill this out
+  strcpy (target, "www.google.com");
+
+  // Fill out hints for getaddrinfo().
+  memset (&hints, 0, sizeof (struct addrinfo));
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = hints.ai_flags | AI_CANONNAME;
+
+  // Resolve target using getaddrinfo().
+  if ((status = getaddrinfo (target, NULL, &hints, &res)) != 0) {
+    fprintf (stderr, "getaddrinfo() failed: %s\n", gai_strerror (status));
+    exit (EXIT_FAILURE);
+  }
+  ipv4 = (struct sockaddr_in *) res->ai_addr;
+  tmp = &(ipv4->sin_addr);
+  if (inet_ntop (AF_INET, tmp, dst_ip, INET_ADDRSTRLEN) == NULL) {
+    status = errno;
+    fprintf (stderr, "inet_ntop() failed.\nError message: %s", strerror (status));
+    exit (EXIT_FAILURE);
+  }
+  daddr = ipv4->sin_addr;
+  freeaddrinfo (res);
+
+  if ((status = inet_pton (AF_INET, src_ip, &saddr)) != 1) {
+    fprintf (stderr, "inet_pton() failed.\nError message: %s", strerror (status));
+    exit (EXIT_FAILURE);
+  }
+
+  // Fill out sockaddr_ll.
+  device.sll_family = AF_PACKET;
+  memcpy (device.sll_addr, src_mac, 6 * sizeof (uint8_t));
+  device.sll_halen = 6;
+
+  // Build the frame to send: ethernet header, IPv4 header, UDP header and data.
+  memcpy (frame, dst_mac, 6 * sizeof (uint8_t));
+  memcpy (frame + 6, src_mac, 6 * sizeof (uint8_t));
+  frame[12] = ETH_P_IP / 256;
+  frame[13] = ETH_P_IP % 256;
+  frame[ETH_HDRLEN] = (4 << 4) + (IP4_HDRLEN / 4);
+  frame[ETH_HDRLEN + 2] = (IP4_HDRLEN + UDP_HDRLEN + DATALEN) >> 8;
+  frame[ETH_HDRLEN + 3] = (IP4_HDRLEN + UDP_HDRLEN + DATALEN) & 0xff;
+  frame[ETH_HDRLEN + 6] = IP_DF >> 8;
+  frame[ETH_HDRLEN + 8] = 255;
+  frame[ETH_HDRLEN + 9] = IPPROTO_UDP;
+  memcpy (frame + ETH_HDRLEN + 12, &saddr.s_addr, 4 * sizeof (uint8_t));
+  memcpy (frame + ETH_HDRLEN + 16, &daddr.s_addr, 4 * sizeof (uint8_t));
+  sum = ~fold_sum (sum_bytes (0, frame + ETH_HDRLEN, IP4_HDRLEN)) & 0xffff;
+  frame[ETH_HDRLEN + 10] = sum >> 8;
+  frame[ETH_HDRLEN + 11] = sum & 0xff;
+  frame[ETH_HDRLEN + IP4_HDRLEN] = sport >> 8;
+  frame[ETH_HDRLEN + IP4_HDRLEN + 1] = sport & 0xff;
+  frame[ETH_HDRLEN + IP4_HDRLEN + 2] = dport >> 8;
+  frame[ETH_HDRLEN + IP4_HDRLEN + 3] = dport & 0xff;
+  frame[ETH_HDRLEN + IP4_HDRLEN + 4] = (UDP_HDRLEN + DATALEN) >> 8;
+  frame[ETH_HDRLEN + IP4_HDRLEN + 5] = (UDP_HDRLEN + DATALEN) & 0xff;
+  memcpy (frame + ETH_HDRLEN + IP4_HDRLEN + UDP_HDRLEN, "xdp test packet 00", DATALEN);
+  sum = sum_bytes (0, frame + ETH_HDRLEN + 12, 8) + IPPROTO_UDP + UDP_HDRLEN + DATALEN;
+  sum = ~fold_sum (sum_bytes (sum, frame + ETH_HDRLEN + IP4_HDRLEN, UDP_HDRLEN + DATALEN)) & 0xffff;
+  frame[ETH_HDRLEN + IP4_HDRLEN + 6] = sum >> 8;
+  frame[ETH_HDRLEN + IP4_HDRLEN + 7] = sum & 0xff;
+
+  signal (SIGINT, sig_handler);
+
+  pps[0] = 0.0;
+  pps[1] = 0.0;
+
+  // PF_PACKET run.
+  if ((backend == BACKEND_PACKET) || (backend == BACKEND_BOTH)) {
+    if (role == ROLE_SEND) {
+      if ((sd = socket (PF_PACKET, SOCK_RAW, htons (ETH_P_ALL))) < 0) {
+        perror ("socket() failed ");
+        exit (EXIT_FAILURE);
+      }
+      printf ("PF_PACKET: sending to %s port %i for %i s\n", dst_ip, dport, duration);
+      pps[0] = run_send (BACKEND_PACKET, sd, NULL, &device, frame, FRAME_LEN, duration);
+    } else {
+      if ((sd = socket (PF_PACKET, SOCK_RAW, htons (ETH_P_IP))) < 0) {
+        perror ("socket() failed ");
+        exit (EXIT_FAILURE);
+      }
+      device.sll_protocol = htons (ETH_P_IP);
+      if (bind (sd, (struct sockaddr *) &device, sizeof (device)) < 0) {
+        perror ("bind() failed ");
+        exit (EXIT_FAILURE);
+      }
+      printf ("PF_PACKET: receiving on port %i for %i s\n", dport, duration);
+      pps[0] = run_recv (BACKEND_PACKET, sd, NULL, dport, duration);
+    }
+    close (sd);
+    printf ("PF_PACKET: %.0f packets per second\n", pps[0]);
+    stop = 0;
+  }
+
+  // AF_XDP run.
+  if ((backend == BACKEND_XDP) || (backend == BACKEND_BOTH)) {
+    zerocopy = (bind_mode == XDP_ZEROCOPY);
+    if (xsk_open (&x, device.sll_ifindex, queue, bind_mode, need_wakeup, (role == ROLE_RECV), xdp_flags, dport) < 0) {
+      if (zerocopy == 0) {
+        exit (EXIT_FAILURE);
+      }
+      fprintf (stderr, "Zero-copy not available on %s; using copy mode.\n", interface);
+      zerocopy = 0;
+      if (xsk_open (&x, device.sll_ifindex, queue, XDP_COPY, need_wakeup, (role == ROLE_RECV), xdp_flags, dport) < 0) {
+        exit (EXIT_FAILURE);
+      }
+    }
+    printf ("AF_XDP (%s mode, need_wakeup %s%s): %s port %i for %i s\n", zerocopy ? "zero-copy" : "copy",
+            need_wakeup ? "on" : "off", (role == ROLE_RECV) ? ((xdp_flags == XDP_FLAGS_SKB_MODE) ? ", generic XDP" : ", native XDP") : "",
+            (role == ROLE_SEND) ? "sending to" : "receiving on", dport, duration);
+    if (role == ROLE_SEND) {
+      pps[1] = run_send (BACKEND_XDP, -1, &x, NULL, frame, FRAME_LEN, duration);
+    } else {
+      pps[1] = run_recv (BACKEND_XDP, -1, &x, dport, duration);
+    }
+    xsk_close (&x);
+    printf ("AF_XDP: %.0f packets per second\n", pps[1]);
+  }
+
+  if ((backend == BACKEND_BOTH) && (pps[0] > 0.0)) {
+    printf ("AF_XDP gain over PF_PACKET: %.2fx\n", pps[1] / pps[0]);
+  }
+
+  // Free allocated memory.
+  free (src_mac);
+  free (dst_mac);
+  free (interface);
+  free (target);
+  free (src_ip);
+  free (dst_ip);
+  free (frame);
+
+  return (EXIT_SUCCESS);
+}
+
+// Send copies of a frame as fast as possible for given number of seconds,
+// through PF_PACKET socket sd or AF_XDP socket x. Returns packets per second.
+double
+run_send (int backend, int sd, xsk *x, struct sockaddr_ll *device, uint8_t *frame, int len, int duration)
+{
+  int i, n;
+  long int sent;
+  double t;
+  struct mmsghdr msgs[BATCH];
+  struct iovec iov;
+  struct timespec start;
+
+  if (backend == BACKEND_PACKET) {
+    iov.iov_base = frame;
+    iov.iov_len = len;
+    memset (msgs, 0, sizeof (msgs));
+    for (i=0; i<BATCH; i++) {
+      msgs[i].msg_hdr.msg_iov = &iov;
+      msgs[i].msg_hdr.msg_iovlen = 1;
+      msgs[i].msg_hdr.msg_name = device;
+      msgs[i].msg_hdr.msg_namelen = sizeof (struct sockaddr_ll);
+    }
+  }
+
+  sent = 0;
+  clock_gettime (CLOCK_MONOTONIC, &start);
+  while ((stop == 0) && ((t = elapsed (&start)) < duration)) {
+    for (i=0; i<1024; i+=BATCH) {
+      if (backend == BACKEND_PACKET) {
+        if ((n = sendmmsg (sd, msgs, BATCH, 0)) < 0) {
+          if ((errno == ENOBUFS) || (errno == EINTR)) {
+            usleep (100);
+            continue;
+          }
+          perror ("sendmmsg() failed ");
+          exit (EXIT_FAILURE);
+        }
+      } else {
+        if ((n = xsk_send (x, frame, len, BATCH)) < 0) {
+          exit (EXIT_FAILURE);
+        }
+      }
+      sent += n;
+    }
+  }
+
+  // Frames still in flight through AF_XDP are not counted until sent.
+  if (backend == BACKEND_XDP) {
+    sent -= (NUM_FRAMES - x->nfree);
+    usleep (10000);
+    sent += xsk_complete (x);
+  }
+
+  t = elapsed (&start);
+  printf ("Sent %li packets in %.2f s\n", sent, t);
+
+  return (sent / t);
+}
+
+// Count UDP packets arriving for port dport for given number of seconds,
+// through PF_PACKET socket sd or AF_XDP socket x. Returns packets per second.
+double
+run_recv (int backend, int sd, xsk *x, uint16_t dport, int duration)
+{
+  int i, n;
+  long int received;
+  double t;
+  uint8_t *frames, *p;
+  struct sockaddr_ll from[BATCH];
+  struct mmsghdr msgs[BATCH];
+  struct iovec iovs[BATCH];
+  struct pollfd pfd;
+  struct timespec start;
+
+  frames = NULL;
+  if (backend == BACKEND_PACKET) {
+    frames = allocate_ustrmem (BATCH * MAX_RXLEN);
+    memset (msgs, 0, sizeof (msgs));
+    for (i=0; i<BATCH; i++) {
+      iovs[i].iov_base = frames + (i * MAX_RXLEN);
+      iovs[i].iov_len = MAX_RXLEN;
+      msgs[i].msg_hdr.msg_iov = &iovs[i];
+      msgs[i].msg_hdr.msg_iovlen = 1;
+      msgs[i].msg_hdr.msg_name = &from[i];
+      msgs[i].msg_hdr.msg_namelen = sizeof (struct sockaddr_ll);
+    }
+  }
+
+  received = 0;
+  clock_gettime (CLOCK_MONOTONIC, &start);
+  while ((stop == 0) && ((t = elapsed (&start)) < duration)) {
+    if (backend == BACKEND_XDP) {
+      received += xsk_recv (x, dport, 100);
+      continue;
+    }
+
+    if ((n = recvmmsg (sd, msgs, BATCH, MSG_DONTWAIT, NULL)) < 0) {
+      if ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR)) {
+        pfd.fd = sd;
+        pfd.events = POLLIN;
+        poll (&pfd, 1, 100);
+        continue;
+      }
+      perror ("recvmmsg() failed ");
+      exit (EXIT_FAILURE);
+    }
+    for (i=0; i<n; i++) {
+      p = frames + (i * MAX_RXLEN) + ETH_HDRLEN;
+      if ((msgs[i].msg_len >= (ETH_HDRLEN + IP4_HDRLEN + UDP_HDRLEN)) && (p[0] == 0x45) && (p[9] == IPPROTO_UDP) &&
+          (((p[IP4_HDRLEN + 2] << 8) | p[IP4_HDRLEN + 3]) == dport)) {
+        received++;
+      }
+    }
+  }
+
+  t = elapsed (&start);
+  printf ("Received %li packets in %.2f s\n", received, t);
+  free (frames);
+
+  return (received / t);
+}
+
+// Seconds since start.
+double
+elapsed (struct timespec *start)
+{
+  struct timespec now;
+
+  clock_gettime (CLOCK_MONOTONIC, &now);
+
+  return ((now.tv_sec - start->tv_sec) + ((now.tv_nsec - start->tv_nsec) / 1e9));
+}
+
+// Create an AF_XDP socket bound to queue of interface, with its UMEM and rings.
+// Bind flags are XDP_COPY or XDP_ZEROCOPY. For receiving, also attach an XDP program
+// (in mode xdp_flags) redirecting UDP packets for port dport to the socket.
+// All UMEM frames start out free for sending, or half in fill ring when receiving.
+// Returns 0, or -1 if bind() fails (as for zero-copy on an interface without support).
+int
+xsk_open (xsk *x, int ifindex, int queue, int bind_mode, int need_wakeup, int receive, uint32_t xdp_flags, uint16_t dport)
+{
+  int i, size;
+  socklen_t optlen;
+  struct xdp_umem_reg reg;
+  struct xdp_mmap_offsets off;
+  struct sockaddr_xdp sxdp;
+
+  memset (x, 0, sizeof (xsk));
+  x->map_fd = -1;
+  x->prog_fd = -1;
+  x->link_fd = -1;
+  x->need_wakeup = need_wakeup;
+
+  if ((x->fd = socket (AF_XDP, SOCK_RAW, 0)) < 0) {
+    perror ("socket() failed to get AF_XDP socket ");
+    exit (EXIT_FAILURE);
+  }
+
+  // Register UMEM: our own page-aligned memory, divided into frames.
+  x->umem = mmap (NULL, (size_t) NUM_FRAMES * FRAME_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+  if (x->umem == MAP_FAILED) {
+    perror ("mmap() failed to allocate UMEM ");
+    exit (EXIT_FAILURE);
+  }
+  memset (&reg, 0, sizeof (reg));
+  reg.addr = (uint64_t) (uintptr_t) x->umem;
+  reg.len = (uint64_t) NUM_FRAMES * FRAME_SIZE;
+  reg.chunk_size = FRAME_SIZE;
+  reg.headroom = 0;
+  if (setsockopt (x->fd, SOL_XDP, XDP_UMEM_REG, &reg, sizeof (reg)) < 0) {
+    perror ("setsockopt() failed to register UMEM ");
+    exit (EXIT_FAILURE);
+  }
+
+  // Set ring sizes, and map rings.
+  size = RING_SIZE;
+  if ((setsockopt (x->fd, SOL_XDP, XDP_UMEM_FILL_RING, &size, sizeof (size)) < 0) ||
+      (setsockopt (x->fd, SOL_XDP, XDP_UMEM_COMPLETION_RING, &size, sizeof (size)) < 0) ||
+      (setsockopt (x->fd, SOL_XDP, XDP_RX_RING, &size, sizeof (size)) < 0) ||
+      (setsockopt (x->fd, SOL_XDP, XDP_TX_RING, &size, sizeof (size)) < 0)) {
+    perror ("setsockopt() failed to set ring size ");
+    exit (EXIT_FAILURE);
+  }
+  optlen = sizeof (off);
+  if (getsockopt (x->fd, SOL_XDP, XDP_MMAP_OFFSETS, &off, &optlen) < 0) {
+    perror ("getsockopt() failed to get ring offsets ");
+    exit (EXIT_FAILURE);
+  }
+  if ((xsk_ring_map (x->fd, &x->fill, &off.fr, XDP_UMEM_PGOFF_FILL_RING, sizeof (uint64_t)) < 0) ||
+      (xsk_ring_map (x->fd, &x->comp, &off.cr, XDP_UMEM_PGOFF_COMPLETION_RING, sizeof (uint64_t)) < 0) ||
+      (xsk_ring_map (x->fd, &x->rx, &off.rx, XDP_PGOFF_RX_RING, sizeof (struct xdp_desc)) < 0) ||
+      (xsk_ring_map (x->fd, &x->tx, &off.tx, XDP_PGOFF_TX_RING, sizeof (struct xdp_desc)) < 0)) {
+    perror ("mmap() failed to map ring ");
+    exit (EXIT_FAILURE);
+  }
+
+  // Producer rings start with all entries free to fill.
+  x->fill.cached_cons = RING_SIZE;
+  x->tx.cached_cons = RING_SIZE;
+
+  // Frames free for sending, then (when receiving) hand half of them to fill ring.
+  x->free = (uint64_t *) allocate_ustrmem (NUM_FRAMES * sizeof (uint64_t));
+  for (i=0; i<NUM_FRAMES; i++) {
+    x->free[i] = (uint64_t) (NUM_FRAMES - 1 - i) * FRAME_SIZE;
+  }
+  x->nfree = NUM_FRAMES;
+  if (receive) {
+    for (i=0; i<(NUM_FRAMES / 2); i++) {
+      ((uint64_t *) x->fill.entries)[i & x->fill.mask] = x->free[--x->nfree];
+    }
+    __atomic_store_n (x->fill.producer, NUM_FRAMES / 2, __ATOMIC_RELEASE);
+    x->fill.cached_prod = NUM_FRAMES / 2;
+  }
+
+  // Bind socket to interface queue.
+  memset (&sxdp, 0, sizeof (sxdp));
+  sxdp.sxdp_family = AF_XDP;
+  sxdp.sxdp_ifindex = ifindex;
+  sxdp.sxdp_queue_id = queue;
+  sxdp.sxdp_flags = bind_mode | (need_wakeup ? XDP_USE_NEED_WAKEUP : 0);
+  if (bind (x->fd, (struct sockaddr *) &sxdp, sizeof (sxdp)) < 0) {
+    perror ("bind() failed to bind AF_XDP socket ");
+    xsk_close (x);
+    return (-1);
+  }
+
+  if (receive) {
+    xsk_attach (x, ifindex, queue, xdp_flags, dport);
+  }
+
+  return (0);
+}
+
+// Map one ring, and find its indexes, flags and entries.
+int
+xsk_ring_map (int fd, xsk_ring *ring, struct xdp_ring_offset *off, off_t pgoff, size_t entry_size)
+{
+  uint8_t *map;
+
+  ring->maplen = off->desc + (RING_SIZE * entry_size);
+  map = mmap (NULL, ring->maplen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, pgoff);
+  if (map == MAP_FAILED) {
+    ring->map = NULL;
+    return (-1);
+  }
+  ring->map = map;
+  ring->producer = (uint32_t *) (map + off->producer);
+  ring->consumer = (uint32_t *) (map + off->consumer);
+  ring->flags = (uint32_t *) (map + off->flags);
+  ring->entries = map + off->desc;
+  ring->mask = RING_SIZE - 1;
+  ring->cached_prod = 0;
+  ring->cached_cons = 0;
+
+  return (0);
+}
+
+// Load and attach an XDP program which redirects our UDP packets (IPv4 with no options,
+// to port dport) arriving on queue to the socket, through an XSKMAP; other packets,
+// and all packets if the socket is not ready, are passed on to the kernel.
+// The link is detached automatically when the program exits.
+int
+xsk_attach (xsk *x, int ifindex, int queue, uint32_t xdp_flags, uint16_t dport)
+{
+  int n, key, value;
+  char log[4096];
+  union bpf_attr attr;
+  struct bpf_insn prog[32];
+
+  // XSKMAP with an entry for each queue up to ours.
+  memset (&attr, 0, sizeof (attr));
+  attr.map_type = BPF_MAP_TYPE_XSKMAP;
+  attr.key_size = sizeof (int);
+  attr.value_size = sizeof (int);
+  attr.max_entries = queue + 1;
+  if ((x->map_fd = bpf (BPF_MAP_CREATE, &attr)) < 0) {
+    perror ("bpf() failed to create XSKMAP ");
+    exit (EXIT_FAILURE);
+  }
+  key = queue;
+  value = x->fd;
+  memset (&attr, 0, sizeof (attr));
+  attr.map_fd = x->map_fd;
+  attr.key = (uint64_t) (uintptr_t) &key;
+  attr.value = (uint64_t) (uintptr_t) &value;
+  if (bpf (BPF_MAP_UPDATE_ELEM, &attr) < 0) {
+    perror ("bpf() failed to add socket to XSKMAP ");
+    exit (EXIT_FAILURE);
+  }
+
+  // Program. r1 = struct xdp_md *: data at offset 0, data_end at 4, rx_queue_index at 16.
+  // Each test jumps to pass if it fails; jump offsets are filled in afterwards.
+  n = 0;
+  prog[n++] = INSN (BPF_LDX | BPF_W | BPF_MEM, 2, 1, 0, 0);            // r2 = data
+  prog[n++] = INSN (BPF_LDX | BPF_W | BPF_MEM, 3, 1, 4, 0);            // r3 = data_end
+  prog[n++] = INSN (BPF_ALU64 | BPF_MOV | BPF_X, 4, 2, 0, 0);          // r4 = data + headers
+  prog[n++] = INSN (BPF_ALU64 | BPF_ADD | BPF_K, 4, 0, 0, ETH_HDRLEN + IP4_HDRLEN + UDP_HDRLEN);
+  prog[n++] = INSN (BPF_JMP | BPF_JGT | BPF_X, 4, 3, 0, 0);            // if beyond data_end, pass
+  prog[n++] = INSN (BPF_LDX | BPF_B | BPF_MEM, 4, 2, 12, 0);           // ethertype 0x0800
+  prog[n++] = INSN (BPF_JMP | BPF_JNE | BPF_K, 4, 0, 0, ETH_P_IP >> 8);
+  prog[n++] = INSN (BPF_LDX | BPF_B | BPF_MEM, 4, 2, 13, 0);
+  prog[n++] = INSN (BPF_JMP | BPF_JNE | BPF_K, 4, 0, 0, ETH_P_IP & 0xff);
+  prog[n++] = INSN (BPF_LDX | BPF_B | BPF_MEM, 4, 2, ETH_HDRLEN, 0);   // version 4, header length 20
+  prog[n++] = INSN (BPF_JMP | BPF_JNE | BPF_K, 4, 0, 0, 0x45);
+  prog[n++] = INSN (BPF_LDX | BPF_B | BPF_MEM, 4, 2, ETH_HDRLEN + 9, 0);  // protocol UDP
+  prog[n++] = INSN (BPF_JMP | BPF_JNE | BPF_K, 4, 0, 0, IPPROTO_UDP);
+  prog[n++] = INSN (BPF_LDX | BPF_B | BPF_MEM, 4, 2, ETH_HDRLEN + IP4_HDRLEN + 2, 0);  // destination port
+  prog[n++] = INSN (BPF_JMP | BPF_JNE | BPF_K, 4, 0, 0, dport >> 8);
+  prog[n++] = INSN (BPF_LDX | BPF_B | BPF_MEM, 4, 2, ETH_HDRLEN + IP4_HDRLEN + 3, 0);
+  prog[n++] = INSN (BPF_JMP | BPF_JNE | BPF_K, 4, 0, 0, dport & 0xff);
+  prog[n++] = INSN (BPF_LDX | BPF_W | BPF_MEM, 2, 1, 16, 0);           // r2 = rx_queue_index
+  prog[n++] = INSN (BPF_LD | BPF_DW | BPF_IMM, 1, BPF_PSEUDO_MAP_FD, 0, x->map_fd);  // r1 = XSKMAP
+  prog[n++] = INSN (0, 0, 0, 0, 0);
+  prog[n++] = INSN (BPF_ALU64 | BPF_MOV | BPF_K, 3, 0, 0, XDP_PASS);   // r3 = action if no socket
+  prog[n++] = INSN (BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_redirect_map);
+  prog[n++] = INSN (BPF_JMP | BPF_EXIT, 0, 0, 0, 0);
+  prog[n++] = INSN (BPF_ALU64 | BPF_MOV | BPF_K, 0, 0, 0, XDP_PASS);   // pass:
+  prog[n++] = INSN (BPF_JMP | BPF_EXIT, 0, 0, 0, 0);
+
+  // Jumps to pass skip over the redirect; fix their offsets now that we know where it lands.
+  for (key=0; key<n; key++) {
+    if ((BPF_CLASS (prog[key].code) == BPF_JMP) && ((BPF_OP (prog[key].code) == BPF_JGT) || (BPF_OP (prog[key].code) == BPF_JNE))) {
+      prog[key].off = (n - 2) - (key + 1);
+    }
+  }
+
+  memset (&attr, 0, sizeof (attr));
+  attr.prog_type = BPF_PROG_TYPE_XDP;
+  attr.insns = (uint64_t) (uintptr_t) prog;
+  attr.insn_cnt = n;
+  attr.license = (uint64_t) (uintptr_t) "GPL";
+  attr.log_buf = (uint64_t) (uintptr_t) log;
+  attr.log_size = sizeof (log);
+  attr.log_level = 1;
+  log[0] = 0;
+  if ((x->prog_fd = bpf (BPF_PROG_LOAD, &attr)) < 0) {
+    perror ("bpf() failed to load XDP program ");
+    fprintf (stderr, "%s\n", log);
+    exit (EXIT_FAILURE);
+  }
+
+  // Attach program to interface.
+  memset (&attr, 0, sizeof (attr));
+  attr.link_create.prog_fd = x->prog_fd;
+  attr.link_create.target_ifindex = ifindex;
+  attr.link_create.attach_type = BPF_XDP;
+  attr.link_create.flags = xdp_flags;
+  if ((x->link_fd = bpf (BPF_LINK_CREATE, &attr)) < 0) {
+    perror ("bpf() failed to attach XDP program to interface ");
+    exit (EXIT_FAILURE);
+  }
+
+  return (0);
+}
+
+// Queue up to n copies of a frame on TX ring, and wake kernel if it asks.
+// First reclaims frames whose sending is complete. Returns number of frames queued.
+int
+xsk_send (xsk *x, uint8_t *frame, int len, int n)
+{
+  int i;
+  uint64_t addr;
+  struct xdp_desc *desc;
+
+  xsk_complete (x);
+
+  // Room in TX ring, refreshing our copy of consumer index only when short.
+  if ((x->tx.cached_cons - x->tx.cached_prod) < (uint32_t) n) {
+    x->tx.cached_cons = __atomic_load_n (x->tx.consumer, __ATOMIC_ACQUIRE) + RING_SIZE;
+  }
+  if ((uint32_t) n > (x->tx.cached_cons - x->tx.cached_prod)) {
+    n = x->tx.cached_cons - x->tx.cached_prod;
+  }
+  if ((uint32_t) n > x->nfree) {
+    n = x->nfree;
+  }
+
+  desc = (struct xdp_desc *) x->tx.entries;
+  for (i=0; i<n; i++) {
+    addr = x->free[--x->nfree];
+    memcpy (x->umem + addr, frame, len * sizeof (uint8_t));
+    desc[(x->tx.cached_prod + i) & x->tx.mask].addr = addr;
+    desc[(x->tx.cached_prod + i) & x->tx.mask].len = len;
+    desc[(x->tx.cached_prod + i) & x->tx.mask].options = 0;
+  }
+  x->tx.cached_prod += n;
+  __atomic_store_n (x->tx.producer, x->tx.cached_prod, __ATOMIC_RELEASE);
+
+  // Copy mode sends from within this syscall. With need_wakeup, only call when asked.
+  if ((x->need_wakeup == 0) || (__atomic_load_n (x->tx.flags, __ATOMIC_RELAXED) & XDP_RING_NEED_WAKEUP)) {
+    if ((sendto (x->fd, NULL, 0, MSG_DONTWAIT, NULL, 0) < 0) &&
+        (errno != EAGAIN) && (errno != EBUSY) && (errno != ENOBUFS) && (errno != ENETDOWN)) {
+      perror ("sendto() failed to wake AF_XDP socket ");
+      return (-1);
+    }
+  }
+
+  return (n);
+}
+
+// Take frames whose sending is complete off completion ring, making them free again.
+// Returns number of frames.
+int
+xsk_complete (xsk *x)
+{
+  uint32_t i, n;
+
+  x->comp.cached_prod = __atomic_load_n (x->comp.producer, __ATOMIC_ACQUIRE);
+  n = x->comp.cached_prod - x->comp.cached_cons;
+  for (i=0; i<n; i++) {
+    x->free[x->nfree++] = ((uint64_t *) x->comp.entries)[(x->comp.cached_cons + i) & x->comp.mask];
+  }
+  x->comp.cached_cons += n;
+  __atomic_store_n (x->comp.consumer, x->comp.cached_cons, __ATOMIC_RELEASE);
+
+  return ((int) n);
+}
+
+// Count frames on RX ring for UDP port dport, and give them back to fill ring.
+// If none are waiting, poll for up to timeout ms. Returns number of frames counted.
+int
+xsk_recv (xsk *x, uint16_t dport, int timeout)
+{
+  int count;
+  uint32_t i, n;
+  uint8_t *p;
+  struct xdp_desc *desc;
+  struct pollfd pfd;
+
+  x->rx.cached_prod = __atomic_load_n (x->rx.producer, __ATOMIC_ACQUIRE);
+  n = x->rx.cached_prod - x->rx.cached_cons;
+  if (n == 0) {
+
+    // poll() also wakes kernel to refill from fill ring, if it asks (need_wakeup).
+    pfd.fd = x->fd;
+    pfd.events = POLLIN;
+    poll (&pfd, 1, timeout);
+    return (0);
+  }
+  if (n > BATCH) {
+    n = BATCH;
+  }
+
+  // Every frame taken from RX ring came from fill ring, so there is room to give it back.
+  // Descriptor address may point past start of frame (headroom), so round it down.
+  count = 0;
+  desc = (struct xdp_desc *) x->rx.entries;
+  for (i=0; i<n; i++) {
+    p = x->umem + desc[(x->rx.cached_cons + i) & x->rx.mask].addr + ETH_HDRLEN;
+    if ((desc[(x->rx.cached_cons + i) & x->rx.mask].len >= (ETH_HDRLEN + IP4_HDRLEN + UDP_HDRLEN)) &&
+        (((p[IP4_HDRLEN + 2] << 8) | p[IP4_HDRLEN + 3]) == dport)) {
+      count++;
+    }
+    ((uint64_t *) x->fill.entries)[(x->fill.cached_prod + i) & x->fill.mask] =
+      desc[(x->rx.cached_cons + i) & x->rx.mask].addr & ~((uint64_t) FRAME_SIZE - 1);
+  }
+  x->fill.cached_prod += n;
+  __atomic_store_n (x->fill.producer, x->fill.cached_prod, __ATOMIC_RELEASE);
+  x->rx.cached_cons += n;
+  __atomic_store_n (x->rx.consumer, x->rx.cached_cons, __ATOMIC_RELEASE);
+
+  if (x->need_wakeup && (__atomic_load_n (x->fill.flags, __ATOMIC_RELAXED) & XDP_RING_NEED_WAKEUP)) {
+    recvfrom (x->fd, NULL, 0, MSG_DONTWAIT, NULL, NULL);
+  }
+
+  return (count);
+}
+
+// Detach XDP program, and release socket, rings and UMEM.
+void
+xsk_close (xsk *x)
+{
+  if (x->link_fd >= 0) {
+    close (x->link_fd);
+  }
+  if (x->prog_fd >= 0) {
+    close (x->prog_fd);
+  }
+  if (x->map_fd >= 0) {
+    close (x->map_fd);
+  }
+  if (x->fill.map != NULL) {
+    munmap (x->fill.map, x->fill.maplen);
+  }
+  if (x->comp.map != NULL) {
+    munmap (x->comp.map, x->comp.maplen);
+  }
+  if (x->rx.map != NULL) {
+    munmap (x->rx.map, x->rx.maplen);
+  }
+  if (x->tx.map != NULL) {
+    munmap (x->tx.map, x->tx.maplen);
+  }
+  close (x->fd);
+  munmap (x->umem, (size_t) NUM_FRAMES * FRAME_SIZE);
+  free (x->free);
+  memset (x, 0, sizeof (xsk));
+}
+
+// bpf() system call, which has no wrapper in the C library.
+long int
+bpf (int cmd, union bpf_attr *attr)
+{
+  return (syscall (__NR_bpf, cmd, attr, sizeof (union bpf_attr)));
+}
+
+// Add bytes to a running (host byte order) one's complement sum.
+uint32_t
+sum_bytes (uint32_t sum, uint8_t *data, int len)
+{
+  while (len > 1) {
+    sum += (data[0] << 8) + data[1];
+    data += 2;
+    len -= 2;
+  }
+
+  // Odd byte is padded with zero.
+  if (len == 1) {
+    sum += data[0] << 8;
+  }
+
+  return (sum);
+}
+
+// Fold a 32-bit running sum into 16 bits, with end-around carry.
+uint16_t
+fold_sum (uint32_t sum)
+{
+  while (sum >> 16) {
+    sum = (sum & 0xffff) + (sum >> 16);
+  }
+
+  return ((uint16_t) sum);
+}
+
+// SIGINT handler: end current run.
+void
+sig_handler (int signum)
+{
+  (void) signum;
+  stop = 1;
+}
+
+// Allocate memory for an array of chars.
+char *
+allocate_strmem (int len)
+{
+  void *tmp;
+
+  if (len <= 0) {
+    fprintf (stderr, "ERROR: Cannot allocate memory because len = %i in allocate_strmem().\n", len);
+    exit (EXIT_FAILURE);
+  }
+
+  tmp = (char *) malloc (len * sizeof (char));
+  if (tmp != NULL) {
+    memset (tmp, 0, len * sizeof (char));
+    return (tmp);
+  } else {
+    fprintf (stderr, "ERROR: Cannot allocate memory for array allocate_strmem().\n");
+    exit (EXIT_FAILURE);
+  }
+}
+
+// Allocate memory for an array of unsigned chars.
+uint8_t *
+allocate_ustrmem (int len)
+{
+  void *tmp;
+
+  if (len <= 0) {
+    fprintf (stderr, "ERROR: Cannot allocate memory because len = %i in allocate_ustrmem().\n", len);
+    exit (EXIT_FAILURE);
+  }
+
+  tmp = (uint8_t *) malloc (len * sizeof (uint8_t));
+  if (tmp != NULL) {
+    memset (tmp, 0, len * sizeof (uint8_t));
+    return (tmp);
+  } else {
+    fprintf (stderr, "ERROR: Cannot allocate memory for array allocate_ustrmem().\n");
+    exit (EXIT_FAILURE);
+  }
+}